@@ -27,13 +27,25 @@
 #include "../common/saturnregisters.h"
 #include "../common/saturndrivers.h"
 #include "../common/hwaccess.h"
+#include "../common/fec.h"
+#include "../common/predistortion.h"
+#include "../common/txiqformat.h"
+#include "streamprofile.h"
+#include "watchdog.h"
+#include "liveness.h"
+#include "rxtiming.h"
+#include "txplayback.h"
+#include "securestream.h"
+#include "handoff.h"
 #include <pthread.h>
 #include <syscall.h>
+#include <time.h>
 
 
 
 
 #define VIQSAMPLESPERFRAME 240                      // samples per UDP frame
+#define VDUCSAMPLERATE 192                          // DUC I/Q sample rate, ksps
 #define VMEMWORDSPERFRAME 180                       // memory writes per UDP frame
 #define VBYTESPERSAMPLE 6							// 24 bit + 24 bit samples
 #define VDMABUFFERSIZE 32768						// memory buffer to reserve
@@ -41,20 +53,258 @@
 #define VBASE 0x1000								// DMA start at 4K into buffer
 #define VDMATRANSFERSIZE 1440                       // write 1 message at a time
 #define VSTARTUPDELAY 100                           // 100 messages (~100ms) before reporting under or overflows
+#define VFECQUIETNS 1250000ULL                      // one packet period: DUC I/Q paused if none for longer
+
+//
+// FEC decoder for TX I/Q data, if FEC enabled. Large, so not on the thread stack
+//
+TFECDecoder DUCFECDecoder;
+
+
+//
+// TX predistortion, if a client has loaded a table
+// PDFrame holds a frame while it is predistorted, so the packet is unchanged
+// (FEC may still need it)
+//
+TPredistorter DUCPredistorter;
+uint8_t PDFrame[VDMATRANSFERSIZE];
+
+
+//
+// TX I/Q packet format negotiated by the client (24 bit unless it asks)
+// and what it has saved in this run
+//
+volatile ETXIQFormat TXIQFormat = eTXFormat24;
+
+typedef struct
+{
+    uint64_t Packets[eTXNumFormats];                // packets received in each format
+    uint64_t Invalid;                               // packets dropped: samples not valid
+    uint64_t WriteNs[eTXNumFormats];                // time spent writing samples to the DMA buffer
+} TTXFormatStatistics;
+
+TTXFormatStatistics TXFormatStats;
+
+
+//
+// get time in ns, for CPU load measurement
+//
+static uint64_t DUCGetTimeNs(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (uint64_t)Now.tv_sec * 1000000000ULL + (uint64_t)Now.tv_nsec;
+}
+
+
+//
+// handle a TX I/Q format request received on port 1024, and reply to it
+//
+void HandleTXFormatPacket(uint8_t* Buffer, int Socketid, struct sockaddr_in* Addr)
+{
+    uint8_t Reply[60];
+    uint8_t Requested = Buffer[5];
+
+    if (Requested < eTXNumFormats)
+        TXIQFormat = (ETXIQFormat)Requested;
+    memset(Reply, 0, sizeof(Reply));
+    memcpy(Reply, Buffer, 4);                                   // sequence number of the request
+    Reply[4] = VTXFPACKETID;
+    Reply[5] = (uint8_t)TXIQFormat;
+    Reply[6] = (1 << eTXNumFormats) - 1;                       // all formats supported
+    *(uint16_t*)(Reply + 8) = htons((uint16_t)TXFPacketSize(TXIQFormat));
+    SecureSendTo(Socketid, Reply, sizeof(Reply), Addr);
+    printf("TX I/Q format %s requested; %s accepted\n", TXFName((ETXIQFormat)Requested), TXFName(TXIQFormat));
+}
+
+
+//
+// return to the standard format (a new client has discovered the SDR)
+//
+void ResetTXIQFormat(void)
+{
+    TXIQFormat = eTXFormat24;
+}
+
+
+//
+// report TX I/Q formats used in a run: network bytes saved, and CPU time per
+// sample to write each format to the DMA buffer
+//
+static void PrintTXFormatStatistics(void)
+{
+    uint64_t Bytes = 0, Bytes24 = 0, Total = 0;
+    ETXIQFormat Format;
+
+    for (Format = eTXFormat24; Format < eTXNumFormats; Format++)
+    {
+        Total += TXFormatStats.Packets[Format];
+        Bytes += TXFormatStats.Packets[Format] * TXFPacketSize(Format);
+        Bytes24 += TXFormatStats.Packets[Format] * VTXF24SIZE;
+    }
+    if ((Total == TXFormatStats.Packets[eTXFormat24]) && (TXFormatStats.Invalid == 0))
+        return;                                                 // only standard packets: nothing to report
+    for (Format = eTXFormat24; Format < eTXNumFormats; Format++)
+        if (TXFormatStats.Packets[Format] != 0)
+            printf("TX I/Q %s: %llu packets, %.1fns per sample to DMA buffer\n", TXFName(Format),
+                   (unsigned long long)TXFormatStats.Packets[Format],
+                   (double)TXFormatStats.WriteNs[Format] / (TXFormatStats.Packets[Format] * VIQSAMPLESPERFRAME));
+    printf("TX I/Q: %llu bytes received, %llu in 24 bit format (%.1f%% saved); %llu invalid packets dropped\n",
+           (unsigned long long)Bytes, (unsigned long long)Bytes24, 100.0 * (1.0 - (double)Bytes / (double)Bytes24),
+           (unsigned long long)TXFormatStats.Invalid);
+}
+
+
+//
+// initialise TX predistortion (disabled until a client loads a table)
+//
+void InitialiseDUCPredistortion(void)
+{
+    PDInit(&DUCPredistorter);
+}
+
+
+//
+// handle a predistortion packet received on port 1024
+//
+void HandleDUCPredistortionPacket(uint8_t* Buffer, uint32_t Size)
+{
+    if(PDHandlePacket(&DUCPredistorter, Buffer, Size))
+        printf("invalid predistortion packet, size=%d\n", Size);
+    else if(UseDebug)
+        printf("predistortion %s, table id=%d\n", PDIsEnabled(&DUCPredistorter) ? "table loaded" : "disabled",
+               ntohl(*(uint32_t*)(Buffer + 8)));
+}
+
+
+//
+// write one DUC I/Q packet to the FPGA
+// wait for FIFO space, swap I & Q (expanding compact formats) and DMA it.
+// Packet points to the whole UDP payload (sequence number first)
+//
+static void WriteDUCIQFrame(int DMAWritefile_fd, unsigned char* IQBasePtr, uint8_t* Packet, ETXIQFormat Format,
+                            unsigned int StartupCount)
+{
+    uint32_t Depth = 0;
+    bool FIFOOverflow, FIFOUnderflow, FIFOOverThreshold;
+    uint8_t* SrcPtr;                                        // pointer to data from Thetis
+    unsigned int Current;                                   // current occupied locations in FIFO
+    uint64_t StartTime;
+    ETXIQFormat SrcFormat = Format;                         // format received, for statistics
+
+    Depth = ReadFIFOMonitorChannel(eTXDUCDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);           // read the FIFO free locations
+    if((StartupCount == 0) && FIFOOverThreshold && UseDebug)
+        printf("TX DUC FIFO Overthreshold, depth now = %d\n", Current);
+
+    if((StartupCount == 0) && FIFOUnderflow)
+    {
+        atomic_fetch_or(&GlobalFIFOOverflows, 0b00000100);
+        if(UseDebug)
+            printf("TX DUC FIFO Underflowed, depth now = %d\n", Current);
+    }
+
+    while (Depth < VMEMWORDSPERFRAME)       // loop till space available
+    {
+        usleep(GStreamProfile.DUCPollUs);			                    // wait (0.5ms by default)
+        Depth = ReadFIFOMonitorChannel(eTXDUCDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);       // read the FIFO free locations
+        if((StartupCount == 0) && FIFOOverThreshold && UseDebug)
+            printf("TX DUC FIFO Overthreshold, depth now = %d\n", Current);
+        if((StartupCount == 0) && FIFOUnderflow)
+        {
+            atomic_fetch_or(&GlobalFIFOOverflows, 0b00000100);
+            if(UseDebug)
+                printf("TX DUC FIFO Underflowed, depth now = %d\n", Current);
+        }
+    }
+    // copy data from UDP Buffer & DMA write it
+//    memcpy(IQBasePtr, UDPInBuffer + 4, VDMATRANSFERSIZE);                // copy out I/Q samples
+    // need to swap I & Q samples on replay
+    SrcPtr = (uint8_t *) (Packet + 4);
+    //
+    // if predistortion is on, apply it to a 24 bit copy of the samples
+    //
+    if(PDIsEnabled(&DUCPredistorter))
+    {
+        if(TXFToP2(Format, SrcPtr, PDFrame))
+        {
+            TXFormatStats.Invalid++;
+            return;
+        }
+        PDApplyP2Samples(&DUCPredistorter, PDFrame, VIQSAMPLESPERFRAME);
+        SrcPtr = PDFrame;
+        Format = eTXFormat24;
+    }
+    StartTime = DUCGetTimeNs();
+    if(TXFToDMA(Format, SrcPtr, IQBasePtr))
+    {
+        TXFormatStats.Invalid++;
+        return;
+    }
+    TXFormatStats.WriteNs[SrcFormat] += DUCGetTimeNs() - StartTime;
+    TXFormatStats.Packets[SrcFormat]++;
+    DMAWriteToFPGA(DMAWritefile_fd, IQBasePtr, VDMATRANSFERSIZE, VADDRDUCSTREAMWRITE);
+    WatchdogHeartbeat(eWDDUCIQ);
+}
+
+
+//
+// DUC sink for preloaded waveform playback: the same FIFO and DMA writes as
+// the network path, with predistortion if a table is loaded
+//
+typedef struct
+{
+    int DMAWritefile_fd;
+    unsigned char* IQBasePtr;
+} TDUCPlaybackSink;
+
+static uint32_t DUCPlaybackFreeWords(__attribute__((unused)) void* Context, bool* Underflowed, uint32_t* Occupied)
+{
+    bool FIFOOverflow, FIFOOverThreshold;
+    unsigned int Current;
+    uint32_t Depth;
+
+    Depth = ReadFIFOMonitorChannel(eTXDUCDMA, &FIFOOverflow, &FIFOOverThreshold, Underflowed, &Current);
+    *Occupied = Current;
+    return Depth;
+}
+
+static void DUCPlaybackWriteFrame(void* Context, uint8_t* Samples)
+{
+    TDUCPlaybackSink* Sink = (TDUCPlaybackSink*)Context;
+
+    if(PDIsEnabled(&DUCPredistorter))
+    {
+        memcpy(PDFrame, Samples, VDMATRANSFERSIZE);
+        PDApplyP2Samples(&DUCPredistorter, PDFrame, VIQSAMPLESPERFRAME);
+        Samples = PDFrame;
+    }
+    TXFToDMA(eTXFormat24, Samples, Sink->IQBasePtr);
+    DMAWriteToFPGA(Sink->DMAWritefile_fd, Sink->IQBasePtr, VDMATRANSFERSIZE, VADDRDUCSTREAMWRITE);
+}
+
 
 //
 // listener thread for incoming DUC I/Q packets
 // planned strategy: just DMA spkr data when available; don't copy and DMA a larger amount.
 // if sufficient FIFO data available: DMA that data and transfer it out. 
 // if it turns out to be too inefficient, we'll have to try larger DMA.
+// if FEC is enabled, packets pass through the FEC decoder first. That holds back
+// one FEC block so lost packets can be rebuilt from parity. If DUC I/Q pauses
+// part way through a block (the end of a transmission) the packets held are
+// written then, or dropped if TX is no longer keyed, so they can't be sent
+// ahead of the next transmission.
+// when a preloaded waveform is due, it is played from memory instead; network
+// DUC I/Q arriving meanwhile is discarded.
 //
 void *IncomingDUCIQ(void *arg)                          // listener thread
 {
     struct ThreadSocketData *ThreadData;                  // socket etc data for this thread
     struct sockaddr_in addr_from;                         // holds MAC address of source of incoming messages
-    uint8_t UDPInBuffer[VDUCIQSIZE];                      // incoming buffer
+    uint8_t UDPInBuffer[VDUCIQSIZE + VFECHEADERSIZE];     // incoming buffer (parity packet is longer)
     struct iovec iovecinst;                               // iovcnt buffer - 1 for each outgoing buffer
     struct msghdr datagram;                               // multiple incoming message header
+    uint8_t RxControl[VRXTCONTROLSIZE];                   // kernel receive timestamp
     int size;                                             // UDP datagram length
 
                                                           //
@@ -63,19 +313,25 @@ void *IncomingDUCIQ(void *arg)                          // listener thread
     uint8_t* IQWriteBuffer = NULL;							// data for DMA to write to DUC
     uint32_t IQBufferSize = VDMABUFFERSIZE;
     unsigned char* IQBasePtr;								// ptr to DMA location in I/Q memory
-    uint32_t Depth = 0;
     int DMAWritefile_fd = -1;								// DMA read file device
-    bool FIFOOverflow, FIFOUnderflow, FIFOOverThreshold;
-    uint32_t Cntr;                                          // sample counter
-    uint8_t* SrcPtr;                                        // pointer to data from Thetis
-    uint8_t* DestPtr;                                       // pointer to DMA buffer data
-    unsigned int Current;                                   // current occupied locations in FIFO
-    unsigned int StartupCount;                              // used to delay reporting of under & overflows
+    unsigned int StartupCount = 0;                          // used to delay reporting of under & overflows
     bool PrevSDRActive = false;                             // used to detect change of state
+    bool WatchdogArmed = false;                             // true if watchdog monitoring this thread
+    bool UseFEC;                                            // true if FEC decoder in use
+    uint32_t FECGroup, FECDepth;                            // FEC settings
+    uint8_t* FECOutPtr;                                     // packet released by FEC decoder
+    uint64_t LastDUCNs = 0;                                 // time the last DUC I/Q packet arrived
+    bool PrevTXMode = false;                                // used to detect MOX falling
+    ETXIQFormat Format = eTXFormat24;                       // TX I/Q format in use
+    TDUCPlaybackSink PlaybackContext;                       // preloaded waveform playback
+    TTXPlaybackSink PlaybackSink;
 
     ThreadData = (struct ThreadSocketData *)arg;
-    ThreadData->Active = true;
+    atomic_store(&ThreadData->Active, true);
     printf("spinning up DUC I/Q thread with port %d, pid=%ld\n", ThreadData->Portid, syscall(SYS_gettid));
+    HandoffRegisterThread(eHODUCIQ);
+    SetStreamThreadAffinity(GStreamProfile.DUCCpu, "DUC I/Q");
+    WatchdogRegisterThread(eWDDUCIQ, "DUC I/Q");
   
     //
     // setup DMA buffer
@@ -87,11 +343,14 @@ void *IncomingDUCIQ(void *arg)                          // listener thread
     memset(IQWriteBuffer, 0, IQBufferSize);
 
     //
-    // open DMA device driver
+    // open DMA device driver (or take over the running instance's at an upgrade)
     //
-    DMAWritefile_fd = open(VDUCDMADEVICE, O_RDWR);
+    DMAWritefile_fd = HandoffAdoptDevice(eHODevDUC);
+    if (DMAWritefile_fd < 0)
+        DMAWritefile_fd = open(VDUCDMADEVICE, O_RDWR);
     if (DMAWritefile_fd < 0)
         printf("XDMA write device open failed for TX I/Q data\n");
+    HandoffRegisterDevice(eHODevDUC, DMAWritefile_fd);
         
 //
 // setup hardware
@@ -103,82 +362,170 @@ void *IncomingDUCIQ(void *arg)                          // listener thread
     SetupFIFOMonitorChannel(eTXDUCDMA, false);
     EnableDUCMux(true);                                   // enable operation
 
+    PlaybackContext.DMAWritefile_fd = DMAWritefile_fd;
+    PlaybackContext.IQBasePtr = IQBasePtr;
+    PlaybackSink.FreeWords = DUCPlaybackFreeWords;
+    PlaybackSink.WriteFrame = DUCPlaybackWriteFrame;
+    PlaybackSink.Context = &PlaybackContext;
+
+    UseFEC = FECIsEnabled();
+    FECGetConfiguration(&FECGroup, &FECDepth);
+    if(UseFEC)
+        FECInitDecoder(&DUCFECDecoder, VDUCIQSIZE, FECGroup, FECDepth);
+
   //
   // main processing loop
   //
     while(1)
     {
+        if(HandoffFreezing())                                 // upgrade checkpoint: between packets
+            HandoffPark(eHODUCIQ, NULL, 0);
         if(SDRActive & !PrevSDRActive)                      // detect SDRActive has been asserted
             StartupCount = VSTARTUPDELAY;
+        //
+        // at the end of a run, report FEC recovery and start the decoder afresh
+        //
+        if(UseFEC && !SDRActive && PrevSDRActive)
+        {
+            FECFlushDecoder(&DUCFECDecoder);
+            if(DUCFECDecoder.Stats.DataPackets != 0)
+                FECPrintStatistics("DUC in", &DUCFECDecoder.Stats);
+            FECInitDecoder(&DUCFECDecoder, TXFPacketSize(Format), FECGroup, FECDepth);
+        }
+        //
+        // at the end of a run, report predistortion cost
+        //
+        if(!SDRActive && PrevSDRActive && (DUCPredistorter.Stats.Samples != 0))
+        {
+            PDPrintStatistics("DUC", &DUCPredistorter.Stats);
+            DUCPredistorter.Stats.Samples = 0;
+            DUCPredistorter.Stats.Frames = 0;
+            DUCPredistorter.Stats.ProcessingNs = 0;
+            DUCPredistorter.Stats.MaxFrameNs = 0;
+        }
+        //
+        // at the end of a run, report compact TX I/Q format use
+        //
+        if(!SDRActive && PrevSDRActive)
+        {
+            PrintTXFormatStatistics();
+            memset(&TXFormatStats, 0, sizeof(TXFormatStats));
+            PrintTXPlaybackReport();
+        }
         PrevSDRActive = SDRActive;
+        //
+        // if the client has negotiated a new format, the FEC decoder needs its packet size
+        //
+        if(TXIQFormat != Format)
+        {
+            Format = TXIQFormat;
+            if(UseFEC)
+                FECInitDecoder(&DUCFECDecoder, TXFPacketSize(Format), FECGroup, FECDepth);
+        }
+        //
+        // the client only has to send TX I/Q data when transmitting,
+        // so the watchdog checks this thread only in TX
+        //
+        if(SDRActive && IsTXMode && !WatchdogArmed)
+        {
+            WatchdogArm(eWDDUCIQ, (VIQSAMPLESPERFRAME * 1000) / VDUCSAMPLERATE);
+            WatchdogArmed = true;
+        }
+        else if(!(SDRActive && IsTXMode) && WatchdogArmed)
+        {
+            WatchdogDisarm(eWDDUCIQ);
+            WatchdogArmed = false;
+        }
+
+        //
+        // preloaded waveform playback. Returns when played out; then network
+        // DUC I/Q queued meanwhile is out of date, so discard it
+        //
+        if(TXPlaybackDue())
+        {
+            RunTXPlayback(&PlaybackSink);
+            while(recv(ThreadData->Socketid, UDPInBuffer, sizeof(UDPInBuffer), MSG_DONTWAIT) > 0)
+                ;
+            StartupCount = VSTARTUPDELAY;
+            continue;
+        }
 
         memset(&iovecinst, 0, sizeof(struct iovec));
         memset(&datagram, 0, sizeof(datagram));
         iovecinst.iov_base = &UDPInBuffer;                  // set buffer for incoming message number i
-        iovecinst.iov_len = VDUCIQSIZE;
+        iovecinst.iov_len = sizeof(UDPInBuffer);
         datagram.msg_iov = &iovecinst;
         datagram.msg_iovlen = 1;
         datagram.msg_name = &addr_from;
         datagram.msg_namelen = sizeof(addr_from);
-        size = recvmsg(ThreadData->Socketid, &datagram, 0);         // get one message. If it times out, ges size=-1
-        if(size < 0 && errno != EAGAIN)
+        RxTimingSetControl(&datagram, RxControl);
+        size = SecureRecvMsg(ThreadData->Socketid, &datagram);         // get one message. If it times out, ges size=-1
+        if(size < 0 && errno != EAGAIN && errno != EINTR)           // EINTR if the watchdog captures our stack
         {
             perror("recvfrom fail, TX I/Q data");
             return NULL;
         }
-        if(size == VDUCIQSIZE)
+        //
+        // the thread is running even if no DUC I/Q arrives (receive times out
+        // after 1ms): lost client data in TX is the liveness monitor's concern,
+        // so only a thread blocked elsewhere (eg in a DMA write) is a stall
+        //
+        WatchdogHeartbeat(eWDDUCIQ);
+        if(size > 0)
+            RxTimingRecord(eRXTDUCIQ, &datagram);
+        if(UseFEC && (size > 0))
         {
-            if(StartupCount != 0)                                   // decrement startup message count
-                StartupCount--;
-            NewMessageReceived = true;
-            Depth = ReadFIFOMonitorChannel(eTXDUCDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);           // read the FIFO free locations
-            if((StartupCount == 0) && FIFOOverThreshold && UseDebug)
-                printf("TX DUC FIFO Overthreshold, depth now = %d\n", Current);
-
-            if((StartupCount == 0) && FIFOUnderflow)
-            {
-                GlobalFIFOOverflows |= 0b00000100;
-                if(UseDebug)
-                    printf("TX DUC FIFO Underflowed, depth now = %d\n", Current);
-            }
-
-            while (Depth < VMEMWORDSPERFRAME)       // loop till space available
+            LivenessPacket(eLVDUCIQ);
+            LastDUCNs = DUCGetTimeNs();
+            if(FECDecodePacket(&DUCFECDecoder, UDPInBuffer, size))
             {
-                usleep(500);								                    // 0.5ms wait
-                Depth = ReadFIFOMonitorChannel(eTXDUCDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);       // read the FIFO free locations
-                if((StartupCount == 0) && FIFOOverThreshold && UseDebug)
-                    printf("TX DUC FIFO Overthreshold, depth now = %d\n", Current);
-                if((StartupCount == 0) && FIFOUnderflow)
+                while((FECOutPtr = FECGetOutputPacket(&DUCFECDecoder)) != NULL)
                 {
-                    GlobalFIFOOverflows |= 0b00000100;
-                    if(UseDebug)
-                        printf("TX DUC FIFO Underflowed, depth now = %d\n", Current);
+                    if(StartupCount != 0)                           // decrement startup message count
+                        StartupCount--;
+                    WriteDUCIQFrame(DMAWritefile_fd, IQBasePtr, FECOutPtr, Format, StartupCount);
                 }
             }
-            // copy data from UDP Buffer & DMA write it
-//            memcpy(IQBasePtr, UDPInBuffer + 4, VDMATRANSFERSIZE);                // copy out I/Q samples
-            // need to swap I & Q samples on replay
-            SrcPtr = (uint8_t *) (UDPInBuffer + 4);
-            DestPtr = (uint8_t *) IQBasePtr;
-            for (Cntr=0; Cntr < VIQSAMPLESPERFRAME; Cntr++)                     // samplecounter
+        }
+        //
+        // standard packets are always accepted; compact ones once negotiated
+        //
+        else if((size == VDUCIQSIZE) || ((size > 0) && ((uint32_t)size == TXFPacketSize(Format))))
+        {
+            if(StartupCount != 0)                                   // decrement startup message count
+                StartupCount--;
+            LivenessPacket(eLVDUCIQ);
+            WriteDUCIQFrame(DMAWritefile_fd, IQBasePtr, UDPInBuffer, (size == VDUCIQSIZE) ? eTXFormat24 : Format, StartupCount);
+        }
+        //
+        // FEC holding part of a block: if TX has dropped (MOX cleared by the
+        // client or by the liveness monitor) drop it; if DUC I/Q has paused,
+        // write it now if still in TX, else drop it
+        //
+        if(UseFEC && FECIsHolding(&DUCFECDecoder))
+        {
+            if(PrevTXMode && !IsTXMode)
+                FECDiscardHeld(&DUCFECDecoder);
+            else if(DUCGetTimeNs() - LastDUCNs > VFECQUIETNS)
             {
-                *DestPtr++ = *(SrcPtr+3);                           // get I sample (3 bytes)
-                *DestPtr++ = *(SrcPtr+4);
-                *DestPtr++ = *(SrcPtr+5);
-                *DestPtr++ = *(SrcPtr+0);                           // get Q sample (3 bytes)
-                *DestPtr++ = *(SrcPtr+1);
-                *DestPtr++ = *(SrcPtr+2);
-                SrcPtr += 6;                                        // point at next source sample
+                if(!IsTXMode)
+                    FECDiscardHeld(&DUCFECDecoder);
+                else
+                {
+                    FECFlushHeld(&DUCFECDecoder);
+                    while((FECOutPtr = FECGetOutputPacket(&DUCFECDecoder)) != NULL)
+                        WriteDUCIQFrame(DMAWritefile_fd, IQBasePtr, FECOutPtr, Format, StartupCount);
+                }
             }
-            DMAWriteToFPGA(DMAWritefile_fd, IQBasePtr, VDMATRANSFERSIZE, VADDRDUCSTREAMWRITE);
         }
+        PrevTXMode = IsTXMode;
     }
 //
 // close down thread
 //
     close(ThreadData->Socketid);                  // close incoming data socket
     ThreadData->Socketid = 0;
-    ThreadData->Active = false;                   // indicate it is closed
+    atomic_store(&ThreadData->Active, false);     // indicate it is closed
     return NULL;
 }
 
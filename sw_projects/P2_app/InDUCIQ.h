@@ -19,6 +19,7 @@
 
 
 #include <stdint.h>
+#include <netinet/in.h>
 #include "../common/saturntypes.h"
 
 
@@ -30,6 +31,31 @@
 //
 void *IncomingDUCIQ(void *arg);                 // listener thread
 
+
+//
+// initialise TX predistortion (disabled until a client loads a table)
+//
+void InitialiseDUCPredistortion(void);
+
+
+//
+// handle a predistortion packet received on port 1024
+// a loaded table is applied to DUC I/Q samples from the next frame on
+//
+void HandleDUCPredistortionPacket(uint8_t* Buffer, uint32_t Size);
+
+//
+// handle a TX I/Q format request received on port 1024, and reply to it
+// a compact format is accepted for DUC I/Q packets from then on
+//
+void HandleTXFormatPacket(uint8_t* Buffer, int Socketid, struct sockaddr_in* Addr);
+
+
+//
+// return to the standard 24 bit TX I/Q format (called when a client discovers the SDR)
+//
+void ResetTXIQFormat(void);
+
 //
 // HandlerSetEERMode (bool EEREnabled)
 // enables amplitude restoration mode. Generates envelope output alongside I/Q samples.
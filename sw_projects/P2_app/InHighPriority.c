@@ -28,6 +28,12 @@
 #include "../common/version.h"
 #include "cathandler.h"
 #include "AriesATU.h"
+#include "liveness.h"
+#include "rxtiming.h"
+#include "txplayback.h"
+#include "securestream.h"
+#include "handoff.h"
+#include "tenant.h"
 #include <pthread.h>
 #include <syscall.h>
 
@@ -46,6 +52,7 @@ void *IncomingHighPriority(void *arg)                   // listener thread
   uint8_t UDPInBuffer[VHIGHPRIOTIYTOSDRSIZE];           // incoming buffer
   struct iovec iovecinst;                               // iovcnt buffer - 1 for each outgoing buffer
   struct msghdr datagram;                               // multiple incoming message header
+  uint8_t RxControl[VRXTCONTROLSIZE];                   // kernel receive timestamp
   int size;                                             // UDP datagram length
   bool RunBit;                                          // true if "run" bit set
   uint8_t Byte, Byte2;                                  // received dat being decoded
@@ -57,8 +64,9 @@ void *IncomingHighPriority(void *arg)                   // listener thread
 
 
   ThreadData = (struct ThreadSocketData *)arg;
-  ThreadData->Active = true;
+  atomic_store(&ThreadData->Active, true);
   printf("spinning up high priority incoming thread with port %d, pid=%ld\n", ThreadData->Portid, syscall(SYS_gettid));
+  HandoffRegisterThread(eHOHighPriorityIn);
   FPGAVersion = GetFirmwareVersion(&FPGASWID);          // get version of FPGA code
 
   //
@@ -66,6 +74,8 @@ void *IncomingHighPriority(void *arg)                   // listener thread
   //
   while(1)
   {
+    if(HandoffFreezing())                                 // upgrade checkpoint: between packets
+      HandoffPark(eHOHighPriorityIn, NULL, 0);
     memset(&iovecinst, 0, sizeof(struct iovec));
     memset(&datagram, 0, sizeof(datagram));
     iovecinst.iov_base = &UDPInBuffer;                  // set buffer for incoming message number i
@@ -74,20 +84,23 @@ void *IncomingHighPriority(void *arg)                   // listener thread
     datagram.msg_iovlen = 1;
     datagram.msg_name = &addr_from;
     datagram.msg_namelen = sizeof(addr_from);
-    size = recvmsg(ThreadData->Socketid, &datagram, 0);         // get one message. If it times out, ges size=-1
+    RxTimingSetControl(&datagram, RxControl);
+    size = SecureRecvMsg(ThreadData->Socketid, &datagram);         // get one message. If it times out, ges size=-1
     if(size < 0 && errno != EAGAIN)
     {
       perror("recvfrom, high priority");
       printf("error number = %d\n", errno);
       EXIT_FAILURE;
     }
+    if(size > 0)
+      RxTimingRecord(eRXTHighPriority, &datagram);
 
     //
     // if correct packet, process it
     //
     if(size == VHIGHPRIOTIYTOSDRSIZE)
     {
-      NewMessageReceived = true;
+      LivenessPacket(eLVHighPriority);
       LongWord = ntohl(*(uint32_t *)(UDPInBuffer));
       printf("high priority packet received\n");
       Byte = (uint8_t)(UDPInBuffer[4]);
@@ -113,8 +126,10 @@ void *IncomingHighPriority(void *arg)                   // listener thread
       }
       //
       // set TX or not TX
+      // (refused if TX was dropped because DUC I/Q stopped, until it resumes;
+      // kept while a preloaded waveform plays)
       //
-      IsTXMode = (bool)(Byte&2);
+      IsTXMode = TXPlaybackHoldsMOX() || ((bool)(Byte&2) && LivenessTXAllowed());
       SetMOX(IsTXMode);
 
 //
@@ -123,7 +138,8 @@ void *IncomingHighPriority(void *arg)                   // listener thread
       for (i=0; i<VNUMDDC; i++)
       {
         LongWord = ntohl(*(uint32_t *)(UDPInBuffer+i*4+9));
-        SetDDCFrequency(i, LongWord, true);                   // temporarily set above
+        if(TenantOfDDC(i) == 0)                               // not a DDC given to another tenant
+          SetDDCFrequency(i, LongWord, true);                 // temporarily set above
       }
       //
       // DUC frequency & drive level
@@ -222,7 +238,7 @@ void *IncomingHighPriority(void *arg)                   // listener thread
 //
   close(ThreadData->Socketid);                  // close incoming data socket
   ThreadData->Socketid = 0;
-  ThreadData->Active = false;                   // indicate it is closed
+  atomic_store(&ThreadData->Active, false);     // indicate it is closed
   return NULL;
 }
 
@@ -29,6 +29,10 @@
 #include "../common/saturnregisters.h"
 #include "../common/saturndrivers.h"
 #include "../common/hwaccess.h"
+#include "liveness.h"
+#include "rxtiming.h"
+#include "securestream.h"
+#include "handoff.h"
 
 
 #define VSPKSAMPLESPERFRAME 64                      // samples per UDP frame
@@ -54,6 +58,7 @@ void *IncomingSpkrAudio(void *arg)                      // listener thread
     uint8_t UDPInBuffer[VSPEAKERAUDIOSIZE];               // incoming buffer
     struct iovec iovecinst;                               // iovcnt buffer - 1 for each outgoing buffer
     struct msghdr datagram;                               // multiple incoming message header
+    uint8_t RxControl[VRXTCONTROLSIZE];                   // kernel receive timestamp
     int size;                                             // UDP datagram length
 
 //
@@ -72,8 +77,9 @@ void *IncomingSpkrAudio(void *arg)                      // listener thread
 
 
     ThreadData = (struct ThreadSocketData *)arg;
-    ThreadData->Active = true;
+    atomic_store(&ThreadData->Active, true);
     printf("spinning up speaker audio thread with port %d, pid=%ld\n", ThreadData->Portid, syscall(SYS_gettid));
+    HandoffRegisterThread(eHOSpkrAudio);
 
     //
     // setup DMA buffer
@@ -85,11 +91,14 @@ void *IncomingSpkrAudio(void *arg)                      // listener thread
     memset(SpkWriteBuffer, 0, SpkBufferSize);
 
     //
-    // open DMA device driver
+    // open DMA device driver (or take over the running instance's at an upgrade)
     //
-    DMAWritefile_fd = open(VSPKDMADEVICE, O_RDWR);
+    DMAWritefile_fd = HandoffAdoptDevice(eHODevSpkr);
+    if (DMAWritefile_fd < 0)
+        DMAWritefile_fd = open(VSPKDMADEVICE, O_RDWR);
     if (DMAWritefile_fd < 0)
         printf("XDMA write device open failed for spk data\n");
+    HandoffRegisterDevice(eHODevSpkr, DMAWritefile_fd);
     ResetDMAStreamFIFO(eSpkCodecDMA);
     SetupFIFOMonitorChannel(eSpkCodecDMA, false);
 
@@ -99,6 +108,8 @@ void *IncomingSpkrAudio(void *arg)                      // listener thread
   //
     while(1)
     {
+        if(HandoffFreezing())                                 // upgrade checkpoint: between packets
+            HandoffPark(eHOSpkrAudio, NULL, 0);
         //
         // now released to start processing. Setup buffers.
         //
@@ -114,27 +125,30 @@ void *IncomingSpkrAudio(void *arg)                      // listener thread
         datagram.msg_iovlen = 1;
         datagram.msg_name = &addr_from;
         datagram.msg_namelen = sizeof(addr_from);
+        RxTimingSetControl(&datagram, RxControl);
         //
         // receive operation thread
         //
-        size = recvmsg(ThreadData->Socketid, &datagram, 0);     // get one message. If it times out, sets size=-1
+        size = SecureRecvMsg(ThreadData->Socketid, &datagram);     // get one message. If it times out, sets size=-1
         if(size < 0 && errno != EAGAIN)
         {
             perror("recvfrom fail, Speaker data");
             return NULL;
         }
+        if(size > 0)
+            RxTimingRecord(eRXTSpeaker, &datagram);
         if(size == VSPEAKERAUDIOSIZE)                           // we have received a packet!
         {
             if(StartupCount != 0)                                   // decrement startup message count
                 StartupCount--;
-            NewMessageReceived = true;
+            LivenessPacket(eLVSpeaker);
             RegVal += 1;            //debug
             Depth = ReadFIFOMonitorChannel(eSpkCodecDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);        // read the FIFO free locations
             if((StartupCount == 0) && FIFOOverThreshold && UseDebug)
                 printf("Codec speaker FIFO Overthreshold, depth now = %d\n", Current);
             if((StartupCount == 0) && FIFOUnderflow)
             {
-                GlobalFIFOOverflows |= 0b00001000;
+                atomic_fetch_or(&GlobalFIFOOverflows, 0b00001000);
                 if(UseDebug)
                     printf("Codec speaker FIFO Underflowed, depth now = %d\n", Current);
             }
@@ -147,7 +161,7 @@ void *IncomingSpkrAudio(void *arg)                      // listener thread
                     printf("Codec speaker FIFO Overthreshold, depth now = %d\n", Current);
                 if((StartupCount == 0) && FIFOUnderflow)
                 {
-                    GlobalFIFOOverflows |= 0b00001000;
+                    atomic_fetch_or(&GlobalFIFOOverflows, 0b00001000);
                     if(UseDebug)
                         printf("Codec speaker FIFO Underflowed, depth now = %d\n", Current);
                 }
@@ -164,7 +178,7 @@ void *IncomingSpkrAudio(void *arg)                      // listener thread
 //
     close(ThreadData->Socketid);                  // close incoming data socket
     ThreadData->Socketid = 0;
-    ThreadData->Active = false;                   // indicate it is closed
+    atomic_store(&ThreadData->Active, false);     // indicate it is closed
     return NULL;
 }
 
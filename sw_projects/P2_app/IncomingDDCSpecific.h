@@ -31,4 +31,11 @@
 void *IncomingDDCSpecific(void *arg);           // listener thread
 
 
+//
+// apply a DDC specific packet to the DDCs in DDCMask (bit n for DDC n)
+// sets the ADC options too if ADCSettings. Does not write the rate register.
+//
+void ApplyDDCSpecificPacket(uint8_t* UDPInBuffer, uint32_t DDCMask, bool ADCSettings);
+
+
 #endif
\ No newline at end of file
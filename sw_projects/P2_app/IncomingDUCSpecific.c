@@ -26,6 +26,8 @@
 #include <stdio.h>
 #include <string.h>
 #include "../common/saturnregisters.h"
+#include "securestream.h"
+#include "handoff.h"
 #include <pthread.h>
 #include <syscall.h>
 
@@ -53,13 +55,16 @@ void *IncomingDUCSpecific(void *arg)                    // listener thread
     uint32_t CWRampTime_us;
 
     ThreadData = (struct ThreadSocketData *)arg;
-    ThreadData->Active = true;
+    atomic_store(&ThreadData->Active, true);
     printf("spinning up DUC specific thread with port %d, pid=%ld\n", ThreadData->Portid, syscall(SYS_gettid));
+    HandoffRegisterThread(eHODUCSpecific);
     //
     // main processing loop
     //
     while(1)
     {
+        if(HandoffFreezing())                                 // upgrade checkpoint: between packets
+            HandoffPark(eHODUCSpecific, NULL, 0);
       memset(&iovecinst, 0, sizeof(struct iovec));
       memset(&datagram, 0, sizeof(datagram));
       iovecinst.iov_base = &UDPInBuffer;                  // set buffer for incoming message number i
@@ -68,7 +73,7 @@ void *IncomingDUCSpecific(void *arg)                    // listener thread
       datagram.msg_iovlen = 1;
       datagram.msg_name = &addr_from;
       datagram.msg_namelen = sizeof(addr_from);
-      size = recvmsg(ThreadData->Socketid, &datagram, 0);         // get one message. If it times out, ges size=-1
+      size = SecureRecvMsg(ThreadData->Socketid, &datagram);         // get one message. If it times out, ges size=-1
       if(size < 0 && errno != EAGAIN)
       {
           perror("recvfrom, DUC specific");
@@ -123,7 +128,7 @@ void *IncomingDUCSpecific(void *arg)                    // listener thread
 //
     close(ThreadData->Socketid);                  // close incoming data socket
     ThreadData->Socketid = 0;
-    ThreadData->Active = false;                   // indicate it is closed
+    atomic_store(&ThreadData->Active, false);     // indicate it is closed
     return NULL;
 }
 
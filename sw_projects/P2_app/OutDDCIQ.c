@@ -30,6 +30,21 @@
 #include "../common/saturndrivers.h"
 #include "../common/hwaccess.h"
 #include "../common/debugaids.h"
+#include "../common/fec.h"
+#include "../common/spectrum.h"
+#include "../common/ddccontainer.h"
+#include "../common/virtualrx.h"
+#include "../common/demodaudio.h"
+#include "streamprofile.h"
+#include "watchdog.h"
+#include "timedcommand.h"
+#include "netclass.h"
+#include "securestream.h"
+#include "tenant.h"
+#include "iqhistory.h"
+#include "clockcorr.h"
+#include "presets.h"
+#include "handoff.h"
 
 
 
@@ -41,12 +56,12 @@
 #define VALIGNMENT 4096                             // buffer alignment
 #define VBASE 0x1000									              // DMA start at 4K into buffer
 #define VBASE 0x1000                                // offset into I/Q buffer for DMA to start
-#define VDMATRANSFERSIZE 4096                       // read 4K at a time  initially
 
 #define VDDCPACKETSIZE 1444
 #define VIQSAMPLESPERFRAME 238                      // total I/Q samples in one DDC packet
 #define VIQBYTESPERFRAME 6*VIQSAMPLESPERFRAME       // total bytes in one outgoing frame
 #define VSTARTUPDELAY 100                           // 100 messages (~100ms) before reporting under or overflows
+#define VCTFLUSHBYTES 32768                         // send containers early if a DDC has buffered this much
 
 //
 // strategy:
@@ -199,6 +214,213 @@ unsigned char* IQReadPtr[VNUMDDC];							// pointer for reading out an I or Q sa
 unsigned char* IQHeadPtr[VNUMDDC];							// ptr to 1st free location in I/Q memory
 unsigned char* IQBasePtr[VNUMDDC];							// ptr to DMA location in I/Q memory
 
+uint64_t DDCSamplesDemuxed[VNUMDDC];                        // samples taken from DMA stream, per DDC (for self test)
+
+
+//
+// state handed to a new instance at an upgrade: the sequence counts, and the
+// samples read from the FIFO but not yet sent, so its streams continue with
+// nothing lost. Followed by each DDC's I/Q residue, then the DMA residue.
+//
+typedef struct
+{
+    uint32_t SequenceCounter[VNUMDDC];
+    uint64_t SamplesDemuxed[VNUMDDC];
+    uint32_t IQResidue[VNUMDDC];                            // bytes of I/Q not yet sent, per DDC
+    uint32_t DMAResidue;                                    // bytes of DMA not yet demultiplexed
+    bool HeaderFound;                                       // false if no DMA yet this run
+} TDDCHandoffState;
+
+static uint8_t DDCHandoffBuffer[sizeof(TDDCHandoffState) + (VNUMDDC + 1) * VBASE];
+
+TFECEncoder DDCFECEncoder[VNUMDDC];                         // FEC parity generators, if FEC enabled
+uint8_t FECParityBuffer[VFECMAXPACKET + VFECHEADERSIZE];    // outgoing parity packet
+
+TSpectrum DDCSpectrum[VNUMDDC];                             // spectrum calculation, if DDC in spectrum mode
+uint8_t SpectrumPacket[VSPECPACKETSIZE];                    // outgoing spectrum packet
+
+TDemodAudio DDCAudio[VNUMDDC];                              // demodulator, if DDC in audio mode
+uint8_t AudioPacket[VDAPACKETSIZE];                         // outgoing audio packet
+
+TDDCContainer DDCContainer;                                 // container packer, if container mode selected
+uint32_t DDCContainerIntervalMs = 0;                        // 0 if standard I/Q packets
+
+TVirtualRX VirtualRX[VVRXMAX];                              // virtual receivers, fed from wide DDCs
+uint32_t VirtualRXCount = 0;
+int VirtualRXSocket[VVRXMAX];                               // outgoing socket per virtual receiver
+uint16_t VirtualRXBasePort = 0;                             // port virtual receiver 0 is bound to; 0 if none
+uint32_t VirtualRXSequence[VVRXMAX];                        // UDP sequence count
+uint8_t VirtualRXPacket[VDDCPACKETSIZE];                    // outgoing virtual receiver packet
+
+
+//
+// select spectrum output for a DDC. FFTSize = 0 restores I/Q output.
+// returns true if settings are not valid
+//
+bool SetDDCSpectrumMode(uint32_t DDC, uint32_t FFTSize, uint32_t FramesPerSecond, uint32_t Averages)
+{
+    if ((DDC >= VNUMDDC) || (DDCAudio[DDC].Mode != eDemodNone))
+        return true;
+    SpectrumFree(&DDCSpectrum[DDC]);
+    if (FFTSize == 0)
+        return false;
+    return SpectrumInit(&DDCSpectrum[DDC], FFTSize, FramesPerSecond, Averages);
+}
+
+
+//
+// select demodulated audio output for a DDC. Mode = eDemodNone restores I/Q output.
+// returns true if settings are not valid, or the DDC is in spectrum mode
+//
+bool SetDDCAudioMode(uint32_t DDC, EDemodMode Mode, uint32_t AudioRate, int32_t LowHz, int32_t HighHz)
+{
+    if ((DDC >= VNUMDDC) || (DDCSpectrum[DDC].FFTSize != 0))
+        return true;
+    DemodAudioFree(&DDCAudio[DDC]);
+    if (Mode == eDemodNone)
+        return false;
+    return DemodAudioInit(&DDCAudio[DDC], Mode, AudioRate, LowHz, HighHz, VDAAGCMAXGAINDB, VDADEFAULTBUDGET);
+}
+
+
+//
+// true if a DDC sends spectrum or audio packets in place of I/Q
+//
+static bool DDCReplacesIQ(uint32_t DDC)
+{
+    return (DDCSpectrum[DDC].FFTSize != 0) || (DDCAudio[DDC].Mode != eDemodNone);
+}
+
+
+//
+// select container output for all DDCs. IntervalMs = 0 restores standard I/Q packets.
+// returns true if settings are not valid
+//
+bool SetDDCContainerMode(uint32_t IntervalMs, uint32_t MaxSize)
+{
+    ContainerFree(&DDCContainer);
+    DDCContainerIntervalMs = 0;
+    if (IntervalMs == 0)
+        return false;
+    if ((IntervalMs > VCTMAXINTERVALMS) || ContainerInit(&DDCContainer, MaxSize))
+        return true;
+    DDCContainerIntervalMs = IntervalMs;
+    return false;
+}
+
+
+//
+// add a virtual receiver, fed from a wide DDC. Virtual receiver n is sent as
+// if it were DDC (VNUMDDC + n), from the port that DDC would use.
+// returns true if settings are not valid or too many receivers
+//
+bool AddVirtualReceiver(uint32_t DDC, int32_t OffsetHz, uint32_t Decimation)
+{
+    if (VirtualRXCount >= VVRXMAX)
+        return true;
+    if (VirtualRXInit(&VirtualRX[VirtualRXCount], DDC, OffsetHz, Decimation))
+        return true;
+    VirtualRXSocket[VirtualRXCount] = -1;
+    VirtualRXCount++;
+    return false;
+}
+
+
+//
+// bind the virtual receiver sockets to ports following on from the DDCs
+// (re-bound only if the DDC port has been changed)
+// returns true if error
+//
+static bool OpenVirtualRXSockets(uint16_t BasePort)
+{
+    struct sockaddr_in Addr;
+    ENetClass Class;
+    uint32_t VRX;
+    int yes = 1;
+
+    if (BasePort == VirtualRXBasePort)
+        return false;
+    VirtualRXBasePort = 0;
+    Class = GetPortNetClass(VPORTDDCIQ0);
+    for (VRX = 0; VRX < VirtualRXCount; VRX++)
+    {
+        if (VirtualRXSocket[VRX] >= 0)
+        {
+            SecureSocketClosed(VirtualRXSocket[VRX]);
+            close(VirtualRXSocket[VRX]);
+        }
+        if ((VirtualRXSocket[VRX] = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+        {
+            perror("virtual receiver socket fail");
+            return true;
+        }
+        setsockopt(VirtualRXSocket[VRX], SOL_SOCKET, SO_REUSEADDR, (void *)&yes , sizeof(yes));
+        ApplyNetClass(VirtualRXSocket[VRX], Class);
+        memset(&Addr, 0, sizeof(struct sockaddr_in));
+        Addr.sin_family = AF_INET;
+        Addr.sin_addr = GetNetClassAddress(Class);
+        Addr.sin_port = htons(BasePort + VRX);
+        if (bind(VirtualRXSocket[VRX], (struct sockaddr *)&Addr, sizeof(struct sockaddr_in)) < 0)
+        {
+            perror("bind virtual receiver");
+            return true;
+        }
+    }
+    VirtualRXBasePort = BasePort;
+    return false;
+}
+
+
+//
+// run the virtual receivers on the samples just demultiplexed for their source DDCs
+// (from Start[DDC] to the head pointer), sending any completed frames
+// returns true if a send failed
+//
+static bool RunVirtualReceivers(unsigned char** Start, struct sockaddr_in* DestAddr)
+{
+    float I[VVRXBLOCK], Q[VVRXBLOCK];
+    unsigned char* Ptr;
+    uint32_t DDC, VRX, Available, Block, Rate;
+    bool Used;
+
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+    {
+        Used = false;
+        for (VRX = 0; VRX < VirtualRXCount; VRX++)
+            if (VirtualRX[VRX].SourceDDC == DDC)
+                Used = true;
+        if (!Used)
+            continue;
+
+        Rate = GetP2SampleRate(DDC);
+        Ptr = Start[DDC];
+        Available = (IQHeadPtr[DDC] - Ptr) / 6;
+        while (Available != 0)
+        {
+            Block = (Available > VVRXBLOCK) ? VVRXBLOCK : Available;
+            VirtualRXConvertP2Samples(Ptr, Block, I, Q);
+            for (VRX = 0; VRX < VirtualRXCount; VRX++)
+            {
+                if (VirtualRX[VRX].SourceDDC != DDC)
+                    continue;
+                VirtualRXProcess(&VirtualRX[VRX], I, Q, Block, Rate);
+                while (VirtualRXGetFrame(&VirtualRX[VRX], VirtualRXPacket + 16))
+                {
+                    *(uint32_t*)VirtualRXPacket = htonl(VirtualRXSequence[VRX]++);   // add sequence count
+                    memset(VirtualRXPacket + 4, 0, 8);                              // clear the timestamp data
+                    *(uint16_t*)(VirtualRXPacket + 12) = htons(24);                 // bits per sample
+                    *(uint16_t*)(VirtualRXPacket + 14) = htons(VVRXFRAMESAMPLES);   // I/Q samples for this frame
+                    if (SecureSendTo(VirtualRXSocket[VRX], VirtualRXPacket, VDDCPACKETSIZE, DestAddr) < 0)
+                        return true;
+                }
+            }
+            Ptr += 6 * Block;
+            Available -= Block;
+        }
+    }
+    return false;
+}
+
 
 bool CreateDynamicMemory(void)                              // return true if error
 {
@@ -249,6 +471,156 @@ void FreeDynamicMemory(void)
 }
 
 
+//
+// expected time (us) for the DDC FIFO to supply one DMA transfer of I/Q data
+// 6 bytes per complex sample; returns 0 if no DDCs are enabled
+//
+static uint32_t DDCTransferPeriodUs(uint32_t TransferSize)
+{
+    uint32_t TotalRate;
+
+    TotalRate = GetP2TotalSampleRate();                     // ksps
+    if (TotalRate == 0)
+        return 0;
+    return (TransferSize * 1000U) / (6U * TotalRate);
+}
+
+
+//
+// true if containers should be sent: the interval has elapsed, or a DDC
+// has buffered enough that it should not wait
+//
+static bool DDCContainerDue(uint64_t LastSentMs)
+{
+    struct timespec Now;
+    uint32_t DDC;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    if (((uint64_t)Now.tv_sec * 1000 + Now.tv_nsec / 1000000) - LastSentMs >= DDCContainerIntervalMs)
+        return true;
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+        if ((IQHeadPtr[DDC] - IQReadPtr[DDC]) >= VCTFLUSHBYTES)
+            return true;
+    return false;
+}
+
+
+//
+// send all buffered I/Q samples (except DDCs in spectrum or audio mode) as containers
+// returns the number of datagrams sent, or -1 if a send failed
+//
+static int SendDDCContainers(int Socketid, struct sockaddr_in* DestAddr)
+{
+    uint32_t DDC, Available, Added, Length;
+    int Datagrams = 0;
+
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+    {
+        if (DDCReplacesIQ(DDC))
+            continue;
+        Available = (IQHeadPtr[DDC] - IQReadPtr[DDC]) / 6;
+        while (Available != 0)
+        {
+            Added = ContainerAddSamples(&DDCContainer, DDC, IQReadPtr[DDC], Available);
+            IQReadPtr[DDC] += 6 * Added;
+            Available -= Added;
+            if (Available != 0)
+            {
+                Length = ContainerFinish(&DDCContainer);
+                if (SecureSendTo(Socketid, DDCContainer.Buffer, Length, DestAddr) < 0)
+                    return -1;
+                Datagrams++;
+            }
+        }
+    }
+    Length = ContainerFinish(&DDCContainer);
+    if (Length != 0)
+    {
+        if (SecureSendTo(Socketid, DDCContainer.Buffer, Length, DestAddr) < 0)
+            return -1;
+        Datagrams++;
+    }
+    return Datagrams;
+}
+
+
+//
+// save the state for an upgrade, at a point where each residue is below its buffer base
+// returns its length; 0 if a residue is too large to restore (the stream then restarts)
+//
+static uint32_t SaveDDCHandoffState(uint32_t* SequenceCounter, bool HeaderFound)
+{
+    TDDCHandoffState* State = (TDDCHandoffState*)DDCHandoffBuffer;
+    uint8_t* Ptr = DDCHandoffBuffer + sizeof(TDDCHandoffState);
+    uint32_t DDC;
+
+    State->HeaderFound = HeaderFound;
+    State->DMAResidue = DMAHeadPtr - DMAReadPtr;
+    if (State->DMAResidue > VBASE)
+        return 0;
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+    {
+        State->SequenceCounter[DDC] = SequenceCounter[DDC];
+        State->SamplesDemuxed[DDC] = DDCSamplesDemuxed[DDC];
+        State->IQResidue[DDC] = IQHeadPtr[DDC] - IQReadPtr[DDC];
+        if (State->IQResidue[DDC] > VBASE)
+            return 0;
+        memcpy(Ptr, IQReadPtr[DDC], State->IQResidue[DDC]);
+        Ptr += State->IQResidue[DDC];
+    }
+    memcpy(Ptr, DMAReadPtr, State->DMAResidue);
+    Ptr += State->DMAResidue;
+    return Ptr - DDCHandoffBuffer;
+}
+
+
+//
+// restore the state saved by the old instance: residues are put below the buffer bases
+// returns true if restored
+//
+static bool RestoreDDCHandoffState(uint8_t* Buffer, uint32_t Length, uint32_t* SequenceCounter, bool* HeaderFound)
+{
+    TDDCHandoffState* State = (TDDCHandoffState*)Buffer;
+    uint8_t* Ptr = Buffer + sizeof(TDDCHandoffState);
+    uint32_t DDC, Total;
+
+    if (Length < sizeof(TDDCHandoffState))
+        return false;
+    Total = sizeof(TDDCHandoffState) + State->DMAResidue;
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+        Total += State->IQResidue[DDC];
+    if (Total != Length)
+        return false;
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+    {
+        SequenceCounter[DDC] = State->SequenceCounter[DDC];
+        DDCSamplesDemuxed[DDC] = State->SamplesDemuxed[DDC];
+        IQReadPtr[DDC] = IQBasePtr[DDC] - State->IQResidue[DDC];
+        IQHeadPtr[DDC] = IQBasePtr[DDC];
+        memcpy(IQReadPtr[DDC], Ptr, State->IQResidue[DDC]);
+        Ptr += State->IQResidue[DDC];
+    }
+    DMAReadPtr = DMABasePtr - State->DMAResidue;
+    DMAHeadPtr = DMABasePtr;
+    memcpy(DMAReadPtr, Ptr, State->DMAResidue);
+    *HeaderFound = State->HeaderFound;
+    return true;
+}
+
+
+//
+// total DDC sample rate, samples/s
+//
+static uint32_t DDCTotalSampleRate(void)
+{
+    uint32_t DDC, Rate = 0;
+
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+        Rate += GetP2SampleRate(DDC) * 1000;
+    return Rate;
+}
+
+
 //
 //
 // this runs as its own thread to send outgoing data
@@ -278,6 +650,8 @@ void *OutgoingDDCIQ(void *arg)
 // variables for outgoing UDP frame
 //
     struct sockaddr_in DestAddr[VNUMDDC];                       // destination address for outgoing data
+    struct sockaddr_in PrimaryAddr;                             // primary client's address (DDC0 may be another tenant's)
+    int DDCSocket;                                              // socket a DDC's I/Q is sent from
     struct iovec iovecinst[VNUMDDC];                            // instance of iovec
     struct msghdr datagram[VNUMDDC];
     uint32_t SequenceCounter[VNUMDDC];                          // UDP sequence count
@@ -296,25 +670,50 @@ void *OutgoingDDCIQ(void *arg)
     uint32_t DecodeByteCount;                                   // bytes to decode
     unsigned int Current;                                   // current occupied locations in FIFO
     unsigned int StartupCount;                              // used to delay reporting of under & overflows
+    bool UseFEC;                                            // true if FEC parity packets to be sent
+    uint32_t FECGroup, FECDepth;                            // FEC settings
+    uint32_t ParityGroup;
+    uint32_t ParityLength;
+    uint32_t SpectrumIndex;                                 // packet within a spectrum frame
+    uint32_t SpectrumLength;
+    uint32_t AudioLength;                                   // audio packet length
+    bool UseContainers;                                     // true if containers sent in place of I/Q packets
+    uint64_t ContainerSentMs = 0;                           // time containers last sent
+    uint64_t ContainerDatagrams = 0;                        // containers sent in this run
+    int ContainerCount;
+    struct timespec Now;
+    unsigned char* DemuxStart[VNUMDDC];                     // 1st sample demultiplexed by a DMA, per DDC
+    struct timespec DMATime;                                // host time a DMA was started, for the sample clock mapping
+    uint32_t VRX;
+    uint8_t* ResumeState;                                   // upgrade: the old instance's state, until used
+    uint32_t ResumeLength;
+    bool ReportResume = false;
 
 //
 // initialise. Create memory buffers and open DMA file devices
 //
     PrevRateWord = 0xFFFFFFFF;                                  // illegal value to forc re-calculation of rates
-    DMATransferSize = VDMATRANSFERSIZE;                         // initial size, but can be changed
+    DMATransferSize = GStreamProfile.DDCMinDMASize;             // initial size, but can be changed
     InitError = CreateDynamicMemory();
     //
-    // open DMA device driver
+    // open DMA device driver (or take over the running instance's at an upgrade)
     //
-    IQReadfile_fd = open(VDDCDMADEVICE, O_RDWR);
+    ResumeState = HandoffThreadState(eHODDCIQ, &ResumeLength);
+    IQReadfile_fd = HandoffAdoptDevice(eHODevDDC);
+    if (IQReadfile_fd < 0)
+        IQReadfile_fd = open(VDDCDMADEVICE, O_RDWR);
     if (IQReadfile_fd < 0)
     {
         printf("XDMA read device open failed for DDC data\n");
         InitError = true;
     }
+    HandoffRegisterDevice(eHODevDDC, IQReadfile_fd);
 
     ThreadData = (struct ThreadSocketData*)arg;
     printf("spinning up outgoing I/Q thread with port %d, pid=%ld\n", ThreadData->Portid, syscall(SYS_gettid));
+    SetStreamThreadAffinity(GStreamProfile.DDCCpu, "DDC I/Q");
+    WatchdogRegisterThread(eWDDDCIQ, "DDC I/Q");
+    HandoffRegisterThread(eHODDCIQ);
 
     //
     // set up per-DDC data structures
@@ -322,7 +721,7 @@ void *OutgoingDDCIQ(void *arg)
     for (DDC = 0; DDC < VNUMDDC; DDC++)
     {
         SequenceCounter[DDC] = 0;                           // clear UDP packet counter
-        (ThreadData + DDC)->Active = true;                  // set outgoing socket active
+        atomic_store(&(ThreadData+DDC)->Active, true);    // set outgoing socket active
     }
 
 
@@ -332,15 +731,19 @@ void *OutgoingDDCIQ(void *arg)
 // ***This is debug code at the moment. ***
 // clear FIFO
 // then read depth
+// (not at an upgrade: the FIFO holds samples the old instance left for this one)
 //
 //    RegisterWrite(0x1010, 0x0000002A);      // disable DDC data transfer; DDC2=test source
-    SetRXDDCEnabled(false);
-    usleep(1000);                           // give FIFO time to stop recording 
-    SetupFIFOMonitorChannel(eRXDDCDMA, false);
-    ResetDMAStreamFIFO(eRXDDCDMA);
-    RegisterValue = ReadFIFOMonitorChannel(eRXDDCDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);				// read the FIFO Depth register
-	if(UseDebug)
-        printf("DDC FIFO Depth register = %08x (should be ~0)\n", RegisterValue);
+    if (ResumeState == NULL)
+    {
+        SetRXDDCEnabled(false);
+        usleep(1000);                           // give FIFO time to stop recording 
+        SetupFIFOMonitorChannel(eRXDDCDMA, false);
+        ResetDMAStreamFIFO(eRXDDCDMA);
+        RegisterValue = ReadFIFOMonitorChannel(eRXDDCDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);				// read the FIFO Depth register
+        if(UseDebug)
+            printf("DDC FIFO Depth register = %08x (should be ~0)\n", RegisterValue);
+    }
 	Depth=0;
 
 
@@ -352,22 +755,38 @@ void *OutgoingDDCIQ(void *arg)
 //
     while(!InitError)
     {
-        while(!SDRActive)
+        while(!TenantStreamsActive())                               // primary client, or any partitioned mode tenant
         {
             for (DDC=0; DDC < VNUMDDC; DDC++)
-                if((ThreadData+DDC) -> Cmdid & VBITCHANGEPORT)
+                if(atomic_load(&(ThreadData+DDC)->Cmdid) & VBITCHANGEPORT)
                 {
+                    SecureSocketClosed((ThreadData+DDC) -> Socketid);
                     close((ThreadData+DDC) -> Socketid);                      // close old socket, open new one
                     MakeSocket((ThreadData + DDC), 0);                        // this binds to the new port.
-                    (ThreadData + DDC) -> Cmdid &= ~VBITCHANGEPORT;           // clear command bit
+                    atomic_fetch_and(&(ThreadData + DDC)->Cmdid, ~VBITCHANGEPORT); // clear command bit
                 }
+            if(HandoffFreezing())
+                HandoffPark(eHODDCIQ, NULL, 0);
             usleep(100);
         }
         printf("starting outgoing DDC data\n");
+        IQHistoryRestart();
+        ClockCorrRestart();
         StartupCount = VSTARTUPDELAY;
         //
+        // discard anything left from a previous run: the FIFO is reset when the DDC is enabled
+        //
+        DMAReadPtr = DMABasePtr;
+        DMAHeadPtr = DMABasePtr;
+        for (DDC = 0; DDC < VNUMDDC; DDC++)
+        {
+            IQReadPtr[DDC] = IQBasePtr[DDC];
+            IQHeadPtr[DDC] = IQBasePtr[DDC];
+        }
+        //
         // initialise outgoing DDC packets - 1 per DDC
         //
+        memcpy(&PrimaryAddr, &reply_addr, sizeof(struct sockaddr_in));
         for (DDC = 0; DDC < VNUMDDC; DDC++)
         {
             SequenceCounter[DDC] = 0;
@@ -381,24 +800,131 @@ void *OutgoingDDCIQ(void *arg)
             datagram[DDC].msg_name = &DestAddr[DDC];                   // MAC addr & port to send to
             datagram[DDC].msg_namelen = sizeof(DestAddr);
         }
+        UseFEC = FECIsEnabled();
+        FECGetConfiguration(&FECGroup, &FECDepth);
+        if(UseFEC)
+            for (DDC = 0; DDC < VNUMDDC; DDC++)
+                FECInitEncoder(&DDCFECEncoder[DDC], VDDCPACKETSIZE, FECGroup, FECDepth);
+        for (DDC = 0; DDC < VNUMDDC; DDC++)
+        {
+            if (DDCSpectrum[DDC].FFTSize != 0)
+                SpectrumRestart(&DDCSpectrum[DDC]);
+            if (DDCAudio[DDC].Mode != eDemodNone)
+                DemodAudioRestart(&DDCAudio[DDC]);
+        }
+        UseContainers = (DDCContainerIntervalMs != 0);
+        if(UseContainers)
+        {
+            ContainerRestart(&DDCContainer);
+            ContainerDatagrams = 0;
+            clock_gettime(CLOCK_MONOTONIC, &Now);
+            ContainerSentMs = (uint64_t)Now.tv_sec * 1000 + Now.tv_nsec / 1000000;
+        }
+        if(VirtualRXCount != 0)
+        {
+            if(OpenVirtualRXSockets(ThreadData->Portid + VNUMDDC))
+                InitError = true;
+            for (VRX = 0; VRX < VirtualRXCount; VRX++)
+            {
+                VirtualRXRestart(&VirtualRX[VRX]);
+                VirtualRXSequence[VRX] = 0;
+            }
+        }
       //
       // enable Saturn DDC to transfer data
       //
         printf("outDDCIQ: enable data transfer\n");
         SetRXDDCEnabled(true);
         HeaderFound = false;
-        while(!InitError && SDRActive)
+        //
+        // at an upgrade, continue from where the old instance stopped: its
+        // DMA residue starts at a rate word, as it would have here
+        //
+        if(ResumeState != NULL)
+        {
+            ReportResume = RestoreDDCHandoffState(ResumeState, ResumeLength, SequenceCounter, &HeaderFound);
+            ResumeState = NULL;
+        }
+        WatchdogArm(eWDDDCIQ, DDCTransferPeriodUs(DMATransferSize));
+        while(!InitError && TenantStreamsActive())
         {
 
+        //
+        // in container mode, samples from all DDCs are sent together once per interval
+        //
+            if (UseContainers && DDCContainerDue(ContainerSentMs))
+            {
+                ContainerCount = SendDDCContainers(ThreadData->Socketid, &DestAddr[0]);
+                if (ContainerCount < 0)
+                {
+                    printf("Send Error, DDC containers, errno=%d\n", errno);
+                    InitError = true;
+                }
+                else
+                    ContainerDatagrams += ContainerCount;
+                clock_gettime(CLOCK_MONOTONIC, &Now);
+                ContainerSentMs = (uint64_t)Now.tv_sec * 1000 + Now.tv_nsec / 1000000;
+            }
+
         //
         // loop through all DDC I/Q buffers.
         // while there is enough I/Q data for this DDC in local (ARM) memory, make DDC Packets
+        // (unless they are sent in containers)
         // then put any residues at the heads of the buffer, ready for new data to come in
+        // in partitioned mode each DDC goes to its own tenant, within its budgets
         //
+            TenantBeginPass();
             for (DDC = 0; DDC < VNUMDDC; DDC++)
             {
-                while ((IQHeadPtr[DDC] - IQReadPtr[DDC]) > VIQBYTESPERFRAME)
+                DDCSocket = TenantDDCRoute(DDC, (ThreadData+DDC)->Socketid, &DestAddr[DDC]);
+                TenantStartTiming(DDC);                                 // its frames' time is charged to its tenant
+                while (((IQHeadPtr[DDC] - IQReadPtr[DDC]) > VIQBYTESPERFRAME) && (!UseContainers || DDCReplacesIQ(DDC)))
                 {
+                    if (!TenantAdmitFrame(DDC, VDDCPACKETSIZE))       // tenant not active, or over its budget
+                    {
+                        IQReadPtr[DDC] += VIQBYTESPERFRAME;
+                        continue;
+                    }
+                    //
+                    // in spectrum mode, I/Q samples go to the FFT; send a spectrum when a frame is complete
+                    //
+                    if (DDCSpectrum[DDC].FFTSize != 0)
+                    {
+                        if (SpectrumAddP2Samples(&DDCSpectrum[DDC], IQReadPtr[DDC], VIQSAMPLESPERFRAME, GetP2SampleRate(DDC)))
+                        {
+                            for (SpectrumIndex = 0; SpectrumIndex < SpectrumPacketCount(&DDCSpectrum[DDC]); SpectrumIndex++)
+                            {
+                                SpectrumLength = SpectrumMakePacket(&DDCSpectrum[DDC], SpectrumIndex, SequenceCounter[DDC]++, SpectrumPacket);
+                                if (SecureSendTo(DDCSocket, SpectrumPacket, SpectrumLength, &DestAddr[DDC]) < 0)
+                                {
+                                    printf("Send Error, DDC=%d spectrum, errno=%d, socket id = %d\n", DDC, errno, DDCSocket);
+                                    InitError = true;
+                                    break;
+                                }
+                            }
+                        }
+                        IQReadPtr[DDC] += VIQBYTESPERFRAME;
+                        continue;
+                    }
+                    //
+                    // in audio mode, I/Q samples are demodulated; send each audio packet as it is completed
+                    //
+                    if (DDCAudio[DDC].Mode != eDemodNone)
+                    {
+                        DemodAudioAddP2Samples(&DDCAudio[DDC], IQReadPtr[DDC], VIQSAMPLESPERFRAME, GetP2SampleRate(DDC));
+                        while ((AudioLength = DemodAudioMakePacket(&DDCAudio[DDC], SequenceCounter[DDC], AudioPacket)) != 0)
+                        {
+                            SequenceCounter[DDC]++;
+                            if (SecureSendTo(DDCSocket, AudioPacket, AudioLength, &DestAddr[DDC]) < 0)
+                            {
+                                printf("Send Error, DDC=%d audio, errno=%d, socket id = %d\n", DDC, errno, DDCSocket);
+                                InitError = true;
+                                break;
+                            }
+                        }
+                        IQReadPtr[DDC] += VIQBYTESPERFRAME;
+                        continue;
+                    }
 //                    printf("enough data for packet: DDC= %d\n", DDC);
                     *(uint32_t*)UDPBuffer[DDC] = htonl(SequenceCounter[DDC]++);     // add sequence count
                     memset(UDPBuffer[DDC] + 4, 0, 8);                               // clear the timestamp data
@@ -411,16 +937,39 @@ void *OutgoingDDCIQ(void *arg)
                     IQReadPtr[DDC] += VIQBYTESPERFRAME;
 
                     int Error;
-                    Error = sendmsg((ThreadData+DDC)->Socketid, &datagram[DDC], 0);
+                    Error = SecureSendMsg(DDCSocket, &datagram[DDC], true);       // sealed I/Q is batched
                     if(StartupCount != 0)                                   // decrement startup message count
                         StartupCount--;
 
                     if (Error == -1)
                     {
-                        printf("Send Error, DDC=%d, errno=%d, socket id = %d\n", DDC, errno, (ThreadData+DDC)->Socketid);
+                        printf("Send Error, DDC=%d, errno=%d, socket id = %d\n", DDC, errno, DDCSocket);
                         InitError = true;
                     }
+                    //
+                    // if FEC enabled, add to parity; send parity packets at the end of each block
+                    //
+                    else if(UseFEC && FECEncodePacket(&DDCFECEncoder[DDC], UDPBuffer[DDC]))
+                    {
+                        for (ParityGroup = 0; ParityGroup < FECDepth; ParityGroup++)
+                        {
+                            ParityLength = FECGetParityPacket(&DDCFECEncoder[DDC], ParityGroup, FECParityBuffer);
+                            if (SecureSendTo(DDCSocket, FECParityBuffer, ParityLength, &DestAddr[DDC]) == -1)
+                            {
+                                printf("Send Error, DDC=%d parity, errno=%d, socket id = %d\n", DDC, errno, DDCSocket);
+                                InitError = true;
+                                break;
+                            }
+                        }
+                    }
+                    TenantChargeTime(DDC);
                 }
+                if((DDCSocket >= 0) && (SecureFlush(DDCSocket) < 0))         // send any sealed I/Q held for a batch
+                {
+                    printf("Send Error, DDC=%d, errno=%d, socket id = %d\n", DDC, errno, DDCSocket);
+                    InitError = true;
+                }
+                TenantChargeTime(DDC);
                 //
                 // now copy any residue to the start of the buffer (before the data copy in point)
                 // unless the buffer already starts at or below the base
@@ -448,12 +997,25 @@ void *OutgoingDDCIQ(void *arg)
             // persistent across DMAs, or we need to recognise an incomplete fragment of a frame as such
             // and copy it like we do with IQ data so the next readout begins at a new frame
             // the latter approach seems easier!
+            // (this is the upgrade checkpoint: nothing is half done, and the residues are saved)
             //
+            if(HandoffFreezing())
+                HandoffPark(eHODDCIQ, DDCHandoffBuffer, SaveDDCHandoffState(SequenceCounter, HeaderFound));
             Depth = ReadFIFOMonitorChannel(eRXDDCDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);				// read the FIFO Depth register
+            //
+            // 1st read after an upgrade: report the gap, and any loss (a full FIFO
+            // counts, as the high priority thread may have read the overflow flag)
+            //
+            if(ReportResume)
+            {
+                HandoffStreamResumed(eHODDCIQ, FIFOOverflow || (Depth >= DMAFIFODepths[eRXDDCDMA]),
+                                     DDCTotalSampleRate(), DMAFIFODepths[eRXDDCDMA]);
+                ReportResume = false;
+            }
 
             if((StartupCount == 0) && FIFOOverThreshold)
             {
-                GlobalFIFOOverflows |= 0b00000001;
+                atomic_fetch_or(&GlobalFIFOOverflows, 0b00000001);
                 if(UseDebug)
                     printf("RX DDC FIFO Overthreshold, depth now = %d\n", Current);
             }
@@ -464,11 +1026,11 @@ void *OutgoingDDCIQ(void *arg)
             //		printf("read: depth = %d\n", Depth);
             while(Depth < (DMATransferSize/8U))			// 8 bytes per location
             {
-                usleep(500);								// 1ms wait
+                usleep(GStreamProfile.DDCPollUs);			// wait (0.5ms by default)
                 Depth = ReadFIFOMonitorChannel(eRXDDCDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);				// read the FIFO Depth register
                 if((StartupCount == 0) && FIFOOverThreshold)
                 {
-                    GlobalFIFOOverflows |= 0b00000001;
+                    atomic_fetch_or(&GlobalFIFOOverflows, 0b00000001);
                     if(UseDebug)
                         printf("RX DDC FIFO Overthreshold, depth now = %d\n", Current);
                 }
@@ -476,17 +1038,13 @@ void *OutgoingDDCIQ(void *arg)
 //                    printf("RX DDC FIFO Underflowed, depth now = %d\n", Current);
              }
 //            printf("DDC DMA read %d bytes from destination to base\n", DMATransferSize);
-            if(Depth > 4096)
-                DMATransferSize = 32768;
-            else if(Depth > 2048)
-                DMATransferSize = 16384;
-            else if(Depth > 1024)
-                DMATransferSize = 8192;
-            else
-                DMATransferSize = 4096;
+            DMATransferSize = GetDDCDMATransferSize(Depth);             // largest the FIFO can supply
+            clock_gettime(CLOCK_MONOTONIC, &DMATime);                   // all data read were in the FIFO by now
 
             DMAReadFromFPGA(IQReadfile_fd, DMAHeadPtr, DMATransferSize, VADDRDDCSTREAMREAD);
             DMAHeadPtr += DMATransferSize;
+            WatchdogHeartbeat(eWDDDCIQ);
+            WatchdogSetPeriod(eWDDDCIQ, DDCTransferPeriodUs(DMATransferSize));
             //
             // find header: may not be the 1st word
             //
@@ -520,6 +1078,8 @@ void *OutgoingDDCIQ(void *arg)
             // assume that DMA is > 1 frame.
 //            printf("headptr = %x readptr = %x\n", DMAHeadPtr, DMAReadPtr);
             DecodeByteCount = DMAHeadPtr - DMAReadPtr;
+            for (DDC = 0; DDC < VNUMDDC; DDC++)
+                DemuxStart[DDC] = IQHeadPtr[DDC];
             while (DecodeByteCount >= 16)                       // minimum size to try!
             {
                 if(*(DMAReadPtr + 7) != 0x80)
@@ -557,6 +1117,7 @@ void *OutgoingDDCIQ(void *arg)
                                     SrcWordPtr++;                                       // and skip 16 bits where theres no data
                                 }
                                 IQHeadPtr[DDC] += 6 * HdrWord;                          // 6 bytes per sample
+                                DDCSamplesDemuxed[DDC] += HdrWord;
                             }
                             // read N samples; write at head ptr
                         }
@@ -567,6 +1128,21 @@ void *OutgoingDDCIQ(void *arg)
                         break;                                                          // if not enough left, exit loop
                 }
             }
+            SetTimedCommandSampleReference(DDCSamplesDemuxed[0], GetP2SampleRate(0));
+            ClockCorrAddDMA(DDCSamplesDemuxed, (int64_t)DMATime.tv_sec * 1000000000LL + DMATime.tv_nsec);
+            //
+            // keep the new samples in the I/Q history rings, if enabled
+            //
+            IQHistoryAddSamples(DemuxStart, IQHeadPtr);
+            //
+            // virtual receivers take the new samples from their wide DDCs, whatever
+            // else is done with them (I/Q packets, spectrum or containers)
+            //
+            if ((VirtualRXCount != 0) && SDRActive && RunVirtualReceivers(DemuxStart, &PrimaryAddr))
+            {
+                printf("Send Error, virtual receivers, errno=%d\n", errno);
+                InitError = true;
+            }
             //
             // now copy any residue to the start of the buffer (before the data copy in point)
             // unless the buffer already starts at or below the base
@@ -586,14 +1162,68 @@ void *OutgoingDDCIQ(void *arg)
                 DMAHeadPtr = DMABasePtr;                            // ready for new data at base
             }
         }     // end of while(!InitError) loop
+        WatchdogDisarm(eWDDDCIQ);
+        //
+        // report container use for the run that has just ended
+        //
+        if(UseContainers && (ContainerDatagrams != 0))
+        {
+            uint64_t Samples = 0;
+            for (DDC = 0; DDC < VNUMDDC; DDC++)
+                Samples += DDCContainer.NextSample[DDC];
+            printf("DDC containers: %llu datagrams carried %llu samples (%llu standard I/Q packets)\n",
+                   (unsigned long long)ContainerDatagrams, (unsigned long long)Samples,
+                   (unsigned long long)(Samples / VIQSAMPLESPERFRAME));
+        }
+        PrintSecureReport();
+        PrintTenantReport();
+        PrintIQHistoryReport();
+        PrintClockCorrReport();
+        PrintPresetReport();
+        //
+        // report demodulator load and bandwidth, and virtual receiver load, for the run that has just ended
+        //
+        for (DDC = 0; DDC < VNUMDDC; DDC++)
+            if (DDCAudio[DDC].Mode != eDemodNone)
+            {
+                char AudioName[20];
+                snprintf(AudioName, sizeof(AudioName), "DDC%d audio", DDC);
+                DemodAudioPrintStatistics(AudioName, &DDCAudio[DDC]);
+            }
+        for (VRX = 0; VRX < VirtualRXCount; VRX++)
+        {
+            char VRXName[24];
+            snprintf(VRXName, sizeof(VRXName), "virtual RX %d", VRX);
+            VirtualRXPrintStatistics(VRXName, &VirtualRX[VRX]);
+        }
+        //
+        // report FEC overhead for the run that has just ended
+        //
+        if(UseFEC)
+        {
+            char FECName[20];
+            for (DDC = 0; DDC < VNUMDDC; DDC++)
+                if(DDCFECEncoder[DDC].Stats.DataPackets != 0)
+                {
+                    snprintf(FECName, sizeof(FECName), "DDC%d out", DDC);
+                    FECPrintStatistics(FECName, &DDCFECEncoder[DDC].Stats);
+                }
+        }
     }
 
 //
 // tidy shutdown of the thread
 //
     printf("shutting down DDC outgoing thread\n");
+    SecureSocketClosed(ThreadData->Socketid);
     close(ThreadData->Socketid); 
-    ThreadData->Active = false;                   // signal closed
+    for (VRX = 0; VRX < VirtualRXCount; VRX++)
+        if (VirtualRXSocket[VRX] >= 0)
+        {
+            SecureSocketClosed(VirtualRXSocket[VRX]);
+            close(VirtualRXSocket[VRX]);
+        }
+    atomic_store(&ThreadData->Active, false);     // signal closed
     FreeDynamicMemory();
     return NULL;
 }
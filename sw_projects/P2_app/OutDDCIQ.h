@@ -20,9 +20,13 @@
 
 #include <stdint.h>
 #include "../common/saturntypes.h"
+#include "../common/demodaudio.h"
 
 
 #define VDDCPACKETSIZE 1444             // each DDC I/Qpacket
+#define VIQSAMPLESPERFRAME 238          // total I/Q samples in one DDC packet
+
+extern uint64_t DDCSamplesDemuxed[];    // samples taken from DMA stream, per DDC
 
 
 //
@@ -36,6 +40,49 @@ void *OutgoingDDCIQ(void *arg);
 //
 
 
+//
+// SetDDCSpectrumMode(uint32_t DDC, uint32_t FFTSize, uint32_t FramesPerSecond, uint32_t Averages)
+// select spectrum output for a DDC: panadapter spectrum packets are sent on
+// its I/Q port instead of I/Q samples. FFTSize = 0 restores I/Q output.
+// must be called before the DDC thread starts.
+// returns true if settings are not valid
+//
+bool SetDDCSpectrumMode(uint32_t DDC, uint32_t FFTSize, uint32_t FramesPerSecond, uint32_t Averages);
+
+
+//
+// SetDDCAudioMode(uint32_t DDC, EDemodMode Mode, uint32_t AudioRate, int32_t LowHz, int32_t HighHz)
+// select demodulated audio output for a DDC: audio packets are sent on its I/Q
+// port instead of I/Q samples. AudioRate in ksps; LowHz = HighHz = 0 selects
+// the mode's default passband. Mode = eDemodNone restores I/Q output.
+// must be called before the DDC thread starts.
+// returns true if settings are not valid, or the DDC is in spectrum mode
+//
+bool SetDDCAudioMode(uint32_t DDC, EDemodMode Mode, uint32_t AudioRate, int32_t LowHz, int32_t HighHz);
+
+
+//
+// SetDDCContainerMode(uint32_t IntervalMs, uint32_t MaxSize)
+// select container output: I/Q samples from all DDCs are sent together in
+// container datagrams of up to MaxSize bytes on the DDC0 I/Q port, once per
+// interval. IntervalMs = 0 restores standard I/Q packets.
+// must be called before the DDC thread starts.
+// returns true if settings are not valid
+//
+bool SetDDCContainerMode(uint32_t IntervalMs, uint32_t MaxSize);
+
+
+//
+// AddVirtualReceiver(uint32_t DDC, int32_t OffsetHz, uint32_t Decimation)
+// add a software receiver at OffsetHz from the centre of wide DDC "DDC", at its
+// sample rate / Decimation. Virtual receiver n is sent in standard DDC I/Q
+// packets as if it were DDC (10 + n), from the port that DDC would use.
+// must be called before the DDC thread starts.
+// returns true if settings are not valid or too many receivers
+//
+bool AddVirtualReceiver(uint32_t DDC, int32_t OffsetHz, uint32_t Decimation);
+
+
 //
 // HandlerCheckDDCSettings()
 // called when DDC settings have been changed. Check which DDCs are enabled, and sample rate.
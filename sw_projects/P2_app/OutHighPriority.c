@@ -29,9 +29,15 @@
 #include "../common/saturnregisters.h"
 #include "../common/saturndrivers.h"
 #include "LDGATU.h"
+#include "watchdog.h"
+#include "netclass.h"
+#include "securestream.h"
+#include "handoff.h"
 
 
-uint8_t GlobalFIFOOverflows = 0;             // FIFO overflow words
+_Atomic(uint8_t) GlobalFIFOOverflows = 0;    // FIFO overflow words
+
+#define VHIGHPRIORITYPERIODUS 200000            // longest time between messages (not in TX)
 
 
 
@@ -49,6 +55,7 @@ void *OutgoingHighPriority(void *arg)
   struct msghdr datagram;
   uint8_t UDPBuffer[VHIGHPRIOTIYFROMSDRSIZE];             // DDC frame buffer
   uint32_t SequenceCounter = 0;                           // UDP sequence count
+  uint8_t NetControl[VNETCONTROLSIZE];                    // DSCP marking, if socket shared
 
   struct ThreadSocketData *ThreadData;            // socket etc data for this thread
   struct sockaddr_in DestAddr;                    // destination address for outgoing data
@@ -61,13 +68,20 @@ void *OutgoingHighPriority(void *arg)
   bool FIFOOverflow, FIFOUnderflow, FIFOOverThreshold;      // FIFO flags
   uint8_t FIFOOverflows;
   uint8_t ADCOverflows = 0;                       // set non zero if ADC overflows detected
+  uint32_t* ResumeSequence;                       // upgrade: the old instance's count, until used
+  uint32_t ResumeLength;
 
 //
 // initialise. Create memory buffers and open DMA file devices
 //
   ThreadData = (struct ThreadSocketData *)arg;
-  ThreadData->Active = true;
+  atomic_store(&ThreadData->Active, true);
   printf("spinning up outgoing high priority with port %d, pid=%ld\n", ThreadData->Portid, syscall(SYS_gettid));
+  WatchdogRegisterThread(eWDHighPriority, "high priority");
+  HandoffRegisterThread(eHOHighPriorityOut);
+  ResumeSequence = (uint32_t*)HandoffThreadState(eHOHighPriorityOut, &ResumeLength);
+  if (ResumeLength != sizeof(uint32_t))
+    ResumeSequence = NULL;
 
 //
 // OK, now the main work
@@ -79,19 +93,27 @@ void *OutgoingHighPriority(void *arg)
   {
     while(!(SDRActive))
     {
-      if(ThreadData->Cmdid & VBITCHANGEPORT)
+      if(atomic_load(&ThreadData->Cmdid) & VBITCHANGEPORT)
       {
         close(ThreadData->Socketid);                      // close old socket, open new one
         MakeSocket(ThreadData, 0);                        // this binds to the new port.
-        ThreadData->Cmdid &= ~VBITCHANGEPORT;             // clear command bit
+        atomic_fetch_and(&ThreadData->Cmdid, ~VBITCHANGEPORT); // clear command bit
       }
+      if(HandoffFreezing())
+        HandoffPark(eHOHighPriorityOut, NULL, 0);
       usleep(100);
     }
     //
     // if we get here, run has been initiated
     // initialise outgoing data packet
+    // (at an upgrade, continue the old instance's count)
     //
     SequenceCounter = 0;
+    if(ResumeSequence != NULL)
+    {
+      SequenceCounter = *ResumeSequence;
+      ResumeSequence = NULL;
+    }
     printf("starting outgoing high priority data\n");
     memcpy(&DestAddr, &reply_addr, sizeof(struct sockaddr_in));           // local copy of PC destination address
     memset(&iovecinst, 0, sizeof(struct iovec));
@@ -103,6 +125,8 @@ void *OutgoingHighPriority(void *arg)
     datagram.msg_iovlen = 1;
     datagram.msg_name = &DestAddr;                   // MAC addr & port to send to
     datagram.msg_namelen = sizeof(DestAddr);
+    NetClassMarkMessage(&datagram, eNetHighPriority, NetControl);
+    WatchdogArm(eWDHighPriority, VHIGHPRIORITYPERIODUS);
 
     //
     // this is the main loop. SDR is running. transfer data;
@@ -116,6 +140,8 @@ void *OutgoingHighPriority(void *arg)
     {
       uint16_t SleepCount;                                      // counter for sending next message
       uint8_t PTTBits;                                          // PTT bits - and change means a new message needed
+      if(HandoffFreezing())                                     // upgrade checkpoint
+        HandoffPark(eHOHighPriorityOut, &SequenceCounter, sizeof(SequenceCounter));
       // create the packet
       *(uint32_t *)UDPBuffer = htonl(SequenceCounter++);        // add sequence count
       ReadStatusRegister();
@@ -170,11 +196,11 @@ void *OutgoingHighPriority(void *arg)
       if(FIFOUnderflow)
         FIFOOverflows |= 0b00001000;
 
-      FIFOOverflows |= GlobalFIFOOverflows;                   // copy in any bits set during normal data transfer
+      FIFOOverflows |= atomic_exchange(&GlobalFIFOOverflows, 0);  // copy in and clear any bits set during normal data transfer
       *(uint8_t *)(UDPBuffer+30) = FIFOOverflows;
-      GlobalFIFOOverflows = 0;                                // clear any overflows
       FIFOOverflows = 0;
-      Error = sendmsg(ThreadData -> Socketid, &datagram, 0);
+      Error = SecureSendMsg(ThreadData -> Socketid, &datagram, false);
+      WatchdogHeartbeat(eWDHighPriority);
 
 
       //
@@ -203,11 +229,12 @@ void *OutgoingHighPriority(void *arg)
         if ((uint8_t)GetP2PTTKeyInputs() != PTTBits)
           break;
         ADCOverflows |= (uint8_t)GetADCOverflow();
-        if(ADCOverflows != 0)
+        if((ADCOverflows != 0) || HandoffFreezing())
           break;
         usleep(500);
       }
     }
+    WatchdogDisarm(eWDHighPriority);
   }
 //
 // tidy shutdown of the thread
@@ -216,7 +243,7 @@ void *OutgoingHighPriority(void *arg)
     ThreadError = true;
   printf("shutting down outgoing high priority thread\n");
   close(ThreadData->Socketid); 
-  ThreadData->Active = false;                   // signal closed
+  atomic_store(&ThreadData->Active, false);     // signal closed
   return NULL;
 }
 
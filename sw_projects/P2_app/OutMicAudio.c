@@ -29,9 +29,15 @@
 #include "../common/saturnregisters.h"
 #include "../common/saturndrivers.h"
 #include "../common/hwaccess.h"
+#include "streamprofile.h"
+#include "watchdog.h"
+#include "netclass.h"
+#include "securestream.h"
+#include "handoff.h"
 
 
 #define VMICSAMPLESPERFRAME 64
+#define VMICSAMPLERATE 48                           // mic sample rate, ksps
 #define VDMABUFFERSIZE 32768						// memory buffer to reserve
 #define VALIGNMENT 4096                             // buffer alignment
 #define VBASE 0x1000                                // offset into I/Q buffer for DMA to start
@@ -59,6 +65,7 @@ void *OutgoingMicSamples(void *arg)
     struct msghdr datagram;
     uint8_t UDPBuffer[VMICPACKETSIZE];                      // DDC frame buffer
     uint32_t SequenceCounter = 0;                           // UDP sequence count
+    uint8_t NetControl[VNETCONTROLSIZE];                    // DSCP marking, if socket shared
 
     struct ThreadSocketData* ThreadData;            // socket etc data for this thread
     struct sockaddr_in DestAddr;                    // destination address for outgoing data
@@ -76,6 +83,9 @@ void *OutgoingMicSamples(void *arg)
     bool FIFOOverflow, FIFOUnderflow, FIFOOverThreshold;
     unsigned int Current;                                   // current occupied locations in FIFO
     unsigned int StartupCount;                              // used to delay reporting of under & overflows
+    uint32_t* ResumeSequence;                               // upgrade: the old instance's count, until used
+    uint32_t ResumeLength;
+    bool ReportResume = false;
 
 
 
@@ -84,8 +94,14 @@ void *OutgoingMicSamples(void *arg)
 // then create memory buffers and open DMA file devices
 //
     ThreadData = (struct ThreadSocketData *)arg;
-    ThreadData->Active = true;
+    atomic_store(&ThreadData->Active, true);
     printf("spinning up outgoing mic thread with port %d, pid=%ld\n", ThreadData->Portid, syscall(SYS_gettid));
+    SetStreamThreadAffinity(GStreamProfile.MicCpu, "mic");
+    WatchdogRegisterThread(eWDMic, "mic");
+    HandoffRegisterThread(eHOMic);
+    ResumeSequence = (uint32_t*)HandoffThreadState(eHOMic, &ResumeLength);
+    if (ResumeLength != sizeof(uint32_t))
+        ResumeSequence = NULL;
 
 //
 // setup DMA buffer
@@ -101,25 +117,32 @@ void *OutgoingMicSamples(void *arg)
 
 
   //
-  // open DMA device driver
+  // open DMA device driver (or take over the running instance's at an upgrade)
   //
-    DMAReadfile_fd = open(VMICDMADEVICE, O_RDWR);
+    DMAReadfile_fd = HandoffAdoptDevice(eHODevMic);
+    if (DMAReadfile_fd < 0)
+        DMAReadfile_fd = open(VMICDMADEVICE, O_RDWR);
     if (DMAReadfile_fd < 0)
     {
         printf("XDMA read device open failed for mic data\n");
         InitError = true;
     }
+    HandoffRegisterDevice(eHODevMic, DMAReadfile_fd);
 
   //
   // now initialise Saturn hardware.
   // clear FIFO
   // then read depth
+  // (not at an upgrade: the FIFO holds samples the old instance left for this one)
   //
-    SetupFIFOMonitorChannel(eMicCodecDMA, false);
-    ResetDMAStreamFIFO(eMicCodecDMA);
-    RegisterValue = ReadFIFOMonitorChannel(eMicCodecDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);				// read the FIFO Depth register
-    if(UseDebug)
-        printf("mic FIFO Depth register = %08x (should be ~0)\n", RegisterValue);
+    if (ResumeSequence == NULL)
+    {
+        SetupFIFOMonitorChannel(eMicCodecDMA, false);
+        ResetDMAStreamFIFO(eMicCodecDMA);
+        RegisterValue = ReadFIFOMonitorChannel(eMicCodecDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);				// read the FIFO Depth register
+        if(UseDebug)
+            printf("mic FIFO Depth register = %08x (should be ~0)\n", RegisterValue);
+    }
     Depth = 0;
 
 
@@ -132,13 +155,15 @@ void *OutgoingMicSamples(void *arg)
     {
         while(!(SDRActive))
         {
-            if(ThreadData->Cmdid & VBITCHANGEPORT)
+            if(atomic_load(&ThreadData->Cmdid) & VBITCHANGEPORT)
             {
                 printf("Mic data request change port\n");
                 close(ThreadData->Socketid);                      // close old socket, open new one
                 MakeSocket(ThreadData, 0);                        // this binds to the new port.
-                ThreadData->Cmdid &= ~VBITCHANGEPORT;             // clear command bit
+                atomic_fetch_and(&ThreadData->Cmdid, ~VBITCHANGEPORT); // clear command bit
             }
+            if(HandoffFreezing())
+                HandoffPark(eHOMic, NULL, 0);
             usleep(100);
         }
     //
@@ -148,6 +173,12 @@ void *OutgoingMicSamples(void *arg)
         printf("starting activity on mic thread\n");
         StartupCount = VSTARTUPDELAY;
         SequenceCounter = 0;
+        if(ResumeSequence != NULL)                                  // upgrade: continue the old instance's count
+        {
+            SequenceCounter = *ResumeSequence;
+            ReportResume = true;
+            ResumeSequence = NULL;
+        }
         memcpy(&DestAddr, &reply_addr, sizeof(struct sockaddr_in));           // create local copy of PC destination address
         memset(&iovecinst, 0, sizeof(struct iovec));
         memset(&datagram, 0, sizeof(datagram));
@@ -157,16 +188,26 @@ void *OutgoingMicSamples(void *arg)
         datagram.msg_iovlen = 1;
         datagram.msg_name = &DestAddr;                              // MAC addr & port to send to
         datagram.msg_namelen = sizeof(DestAddr);
+        NetClassMarkMessage(&datagram, eNetAudio, NetControl);
+        WatchdogArm(eWDMic, (VMICSAMPLESPERFRAME * 1000) / VMICSAMPLERATE);
 
         while(SDRActive && !InitError)                              // main loop
         {
+            if(HandoffFreezing())                                   // upgrade checkpoint: whole frames only
+                HandoffPark(eHOMic, &SequenceCounter, sizeof(SequenceCounter));
             //
             // now wait until there is data, then DMA it
             //
             Depth = ReadFIFOMonitorChannel(eMicCodecDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);			// read the FIFO Depth register. 4 mic words per 64 bit word.
+            if(ReportResume)
+            {
+                HandoffStreamResumed(eHOMic, FIFOOverflow || (Depth >= DMAFIFODepths[eMicCodecDMA]),
+                                     VMICSAMPLERATE * 1000, DMAFIFODepths[eMicCodecDMA] * 4);
+                ReportResume = false;
+            }
             if((StartupCount == 0) && FIFOOverThreshold)
             {
-                GlobalFIFOOverflows |= 0b00000010;
+                atomic_fetch_or(&GlobalFIFOOverflows, 0b00000010);
                 if(UseDebug)
                     printf("Codec Mic FIFO Overthreshold, depth now = %d\n", Current);
             }
@@ -177,11 +218,11 @@ void *OutgoingMicSamples(void *arg)
 //                printf("Codec Mic FIFO Underflowed, depth now = %d\n", Current);
             while (Depth < (VMICSAMPLESPERFRAME/4))			        // 16 locations = 64 samples
             {
-                usleep(1000);								        // 1ms wait
+                usleep(GStreamProfile.MicPollUs);			        // wait (1ms by default)
                 Depth = ReadFIFOMonitorChannel(eMicCodecDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);				// read the FIFO Depth register
                 if((StartupCount == 0) && FIFOOverThreshold)
                 {
-                    GlobalFIFOOverflows |= 0b00000010;
+                    atomic_fetch_or(&GlobalFIFOOverflows, 0b00000010);
                     if(UseDebug)
                         printf("Codec Mic FIFO Overthreshold, depth now = %d\n", Current);
                 }
@@ -197,7 +238,8 @@ void *OutgoingMicSamples(void *arg)
             // create the packet into UDPBuffer
             *(uint32_t*)UDPBuffer = htonl(SequenceCounter++);        // add sequence count
             memcpy(UDPBuffer+4, MicBasePtr, VDMATRANSFERSIZE);       // copy in mic samples
-            Error = sendmsg(ThreadData -> Socketid, &datagram, 0);
+            Error = SecureSendMsg(ThreadData -> Socketid, &datagram, false);
+            WatchdogHeartbeat(eWDMic);
             if(StartupCount != 0)                                   // decrement startup message count
                 StartupCount--;
             if(Error == -1)
@@ -206,6 +248,7 @@ void *OutgoingMicSamples(void *arg)
                 InitError=true;
             }
         }
+        WatchdogDisarm(eWDMic);
     }
 //
 // tidy shutdown of the thread
@@ -215,6 +258,6 @@ void *OutgoingMicSamples(void *arg)
 
     printf("shutting down outgoing mic data thread\n");
     close(ThreadData->Socketid); 
-    ThreadData->Active = false;                   // signal closed
+    atomic_store(&ThreadData->Active, false);     // signal closed
     return NULL;
 }
@@ -30,6 +30,12 @@
 #include "../common/saturnregisters.h"
 #include "../common/hwaccess.h"
 #include "../common/debugaids.h"
+#include "streamprofile.h"
+#include "watchdog.h"
+#include "netclass.h"
+#include "securestream.h"
+#include "handoff.h"
+#include "wbevents.h"
 
 
 //
@@ -134,6 +140,32 @@ void SetWidebandParams(uint8_t Enables, uint16_t SampleCount, uint8_t SampleSize
 }
 
 
+//
+// wideband IP update rate (ms): the client's if it has enabled wideband data,
+// else the signal detector's
+//
+static uint32_t WidebandUpdateRate(void)
+{
+    if(StoredEnables != 0)
+        return StoredRate;
+    return WBEventsCapturePeriodMs();
+}
+
+
+//
+// expected time (us) between wideband frames: the update period, plus the time
+// to send a frame out and poll for the next. Returns 0 if wideband is off
+//
+static uint32_t WidebandFramePeriodUs(void)
+{
+    if((StoredEnables | WBEventsADCEnables()) == 0)
+        return 0;
+    if(StoredEnables == 0)
+        return WidebandUpdateRate() * 1000U + GStreamProfile.WBPollUs;
+    return StoredRate * 1000U + StoredPacketCount * GStreamProfile.WBPacketGapUs + GStreamProfile.WBPollUs;
+}
+
+
 //
 // read out the Wideband FIFO
 // returns the number of samples read
@@ -188,8 +220,11 @@ void *OutgoingWidebandSamples(void *arg)
     
     int ADC;                                                    // iterator
     uint32_t SampleWordCount;                                   // no of 64 bit words required
+    uint32_t DetectWordCount;                                   // words the signal detector needs
+    uint8_t Enables;                                            // client's ADC enables, plus the detector's
     bool ADC1, ADC2;                                            // true if data available
     uint32_t PacketCounter;
+    uint32_t PacketsToSend;                                     // packets for the client from this capture
     uint32_t StartAddress;                                      // data locations in wideband collected data
     struct ThreadSocketData *ThreadData;                        // socket etc data for each thread.
                                                                 // points to 1st one
@@ -200,6 +235,7 @@ void *OutgoingWidebandSamples(void *arg)
     struct iovec iovecinst[VNUMWBADC];                          // instance of iovec
     struct msghdr datagram[VNUMWBADC];
     uint32_t SequenceCounter[VNUMWBADC];                        // UDP sequence count
+    uint8_t NetControl[VNUMWBADC][VNETCONTROLSIZE];             // DSCP marking, if socket shared
     
 
 //
@@ -213,6 +249,9 @@ void *OutgoingWidebandSamples(void *arg)
 
     ThreadData = (struct ThreadSocketData*)arg;
     printf("spinning up outgoing Wideband sample thread with port %d, pid=%ld\n", ThreadData->Portid, syscall(SYS_gettid));
+    SetStreamThreadAffinity(GStreamProfile.WBCpu, "wideband");
+    WatchdogRegisterThread(eWDWideband, "wideband");
+    HandoffRegisterThread(eHOWideband);
 
     //
     // set up per-ADC data structures
@@ -220,7 +259,7 @@ void *OutgoingWidebandSamples(void *arg)
     for (ADC = 0; ADC < VNUMWBADC; ADC++)
     {
         SequenceCounter[ADC] = 0;                           // clear UDP packet counter
-        (ThreadData + ADC)->Active = true;                  // set outgoing socket active
+        atomic_store(&(ThreadData+ADC)->Active, true);    // set outgoing socket active
     }
 
 
@@ -243,16 +282,24 @@ void *OutgoingWidebandSamples(void *arg)
     {
         while(!SDRActive)
         {
+            if(HandoffFreezing())                       // upgrade checkpoint: idle
+                HandoffPark(eHOWideband, NULL, 0);
             for (ADC=0; ADC < VNUMWBADC; ADC++)
-                if((ThreadData+ADC) -> Cmdid & VBITCHANGEPORT)
+                if(atomic_load(&(ThreadData+ADC)->Cmdid) & VBITCHANGEPORT)
                 {
                     close((ThreadData+ADC) -> Socketid);                      // close old socket, open new one
                     MakeSocket((ThreadData + ADC), 0);                        // this binds to the new port.
-                    (ThreadData + ADC) -> Cmdid &= ~VBITCHANGEPORT;           // clear command bit
+                    atomic_fetch_and(&(ThreadData + ADC)->Cmdid, ~VBITCHANGEPORT); // clear command bit
                 }
+            WBEventsPoll();                             // take detector subscriptions
             usleep(100);
         }
         printf("starting outgoing Wideband data\n");
+        if(WBEventsEnabled())
+        {
+            WBEventsRestart();
+            WBParamsChanged = true;                     // collect for the detector even if the client does not
+        }
         //
         // initialise outgoing WB packet buffers - 1 per ADC
         //
@@ -268,6 +315,7 @@ void *OutgoingWidebandSamples(void *arg)
             datagram[ADC].msg_iovlen = 1;
             datagram[ADC].msg_name = &DestAddr[ADC];                   // MAC addr & port to send to
             datagram[ADC].msg_namelen = sizeof(struct sockaddr_in);
+            NetClassMarkMessage(&datagram[ADC], eNetWideband, NetControl[ADC]);
         }
       //
       // enable Saturn WB IP to transfer data
@@ -275,8 +323,11 @@ void *OutgoingWidebandSamples(void *arg)
       // monitor changes to paramters, because this is the trigger to reconfigure operation
       //
         printf("outDDCIQ: enable data transfer\n");
+        WatchdogArm(eWDWideband, WidebandFramePeriodUs());
         while(!InitError && SDRActive)
         {
+            if(HandoffFreezing())                       // upgrade checkpoint: between frames
+                HandoffPark(eHOWideband, NULL, 0);
 //
 // if parameters have changed, halt then re-load configuration (strategy step 3)
 // (this will also work from a cold start)
@@ -287,11 +338,19 @@ void *OutgoingWidebandSamples(void *arg)
                 usleep(150);                                            // wait for any current write to end
                 ReadFIFOContent();                                      // then empty the FIFO discarding data
                 SampleWordCount = ((StoredSamplePerPktCount * StoredPacketCount) / 4) + 8;    // no. 64 bit words; over-read by 8 words
+                Enables = StoredEnables | WBEventsADCEnables();
+                if(WBEventsEnabled())                                   // the detector needs a whole FFT per capture
+                {
+                    DetectWordCount = (WBEventsCaptureSamples() / 4) + 8;
+                    if(DetectWordCount > SampleWordCount)
+                        SampleWordCount = DetectWordCount;
+                }
                 SetWidebandSampleCount(SampleWordCount);
-                SetWidebandUpdateRate(StoredRate);
-                SetWidebandEnable((bool)(StoredEnables&1), (bool)(StoredEnables&2), false);
-                printf("Setting WB IP: WordCount = %d, Rate = %d, ADC1 = %d, ADC2=%d\n", SampleWordCount, StoredRate, (StoredEnables&1), (StoredEnables&2));
+                SetWidebandUpdateRate(WidebandUpdateRate());
+                SetWidebandEnable((bool)(Enables&1), (bool)(Enables&2), false);
+                printf("Setting WB IP: WordCount = %d, Rate = %d, ADC1 = %d, ADC2=%d\n", SampleWordCount, WidebandUpdateRate(), (Enables&1), (Enables&2));
                 WBParamsChanged = false;
+                WatchdogSetPeriod(eWDWideband, WidebandFramePeriodUs());
             }
 //
 // then if enabled:
@@ -301,14 +360,15 @@ void *OutgoingWidebandSamples(void *arg)
 // then send out packets to SDR client
 // recheck if parameters have changed after a successful ready
 //
-            if(StoredEnables != 0)                      // if active
+            Enables = StoredEnables | WBEventsADCEnables();
+            if(Enables != 0)                            // if active
             {
                 GetWidebandStatus(&ADC1, &ADC2);      // get flags for data available
                 if(ADC1 || ADC2)                                        // if data available for either
                 {
                     SampleWordCount = ReadFIFOContent();                // then read FIFO till empty
 //                    printf("WB data available, ADC sample count = %d\n", SampleWordCount);
-                    SetWidebandEnable((bool)(StoredEnables&1), (bool)(StoredEnables&2), true);  // re-enable record
+                    SetWidebandEnable((bool)(Enables&1), (bool)(Enables&2), true);  // re-enable record
                     //
                     // now transfer data out on UDP packets
                     // first select the buffer set yo use based on what data is available
@@ -318,7 +378,10 @@ void *OutgoingWidebandSamples(void *arg)
                     else
                         ADC=0;
                     SequenceCounter[ADC] = 0;                           // restart at 0 for each frame
-                    for(PacketCounter = 0; PacketCounter < StoredPacketCount; PacketCounter++)
+                    PacketsToSend = StoredPacketCount;
+                    if((StoredEnables & (1 << ADC)) == 0)               // collected for the signal detector only
+                        PacketsToSend = 0;
+                    for(PacketCounter = 0; PacketCounter < PacketsToSend; PacketCounter++)
                     {
                         *(uint32_t*)WBUDPBuffer[ADC] = htonl(SequenceCounter[ADC]++);     // add sequence count
                         //
@@ -328,14 +391,20 @@ void *OutgoingWidebandSamples(void *arg)
                         memcpy(WBUDPBuffer[ADC] + 4, WBDMAReadBuffer + StartAddress, StoredSamplePerPktCount * 2);
                         iovecinst[ADC].iov_len = StoredSamplePerPktCount * 2 + 4;           // P2 data dependent
 
-                        sendmsg((ThreadData+ADC)->Socketid, &datagram[ADC], 0);
-                        usleep(200);                    // gap between outgoing messages
+                        SecureSendMsg((ThreadData+ADC)->Socketid, &datagram[ADC], false);
+                        usleep(GStreamProfile.WBPacketGapUs);   // gap between outgoing messages
                     }
+                    if(SampleWordCount > 16)                            // detector: samples after the 4 word inset
+                        WBEventsProcessCapture(WBDMAReadBuffer + 32, SampleWordCount - 16, ADC);
+                    WatchdogHeartbeat(eWDWideband);
                 }
             }
-            usleep(5000);
+            WBEventsPoll();
+            usleep(GStreamProfile.WBPollUs);
 
         }     // end of while(!InitError&& SDRActive) loop - typically when comm with SDR client stops
+        WatchdogDisarm(eWDWideband);
+        PrintWBEventsReport();
         StoredEnables = false;                                          // force a re-config if comm continues later
     } //end of while(!InitError)
 
@@ -346,7 +415,7 @@ void *OutgoingWidebandSamples(void *arg)
     printf("shutting down Wideband outgoing thread\n");
     SetWidebandEnable(false, false, false);
     close(ThreadData->Socketid); 
-    ThreadData->Active = false;                   // signal closed
+    atomic_store(&ThreadData->Active, false);     // signal closed
     FreeWBDynamicMemory();
     return NULL;
 }
\ No newline at end of file
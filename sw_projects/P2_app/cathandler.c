@@ -38,6 +38,7 @@
 #include "cathandler.h"
 #include "catmessages.h"
 #include "serialport.h"
+#include "netclass.h"
 
 
 
@@ -61,9 +62,20 @@ char OutputStrings[VNUMOPSTRINGS] [VOPSTRSIZE];
 int CATWritePtr = 0;                        // pointer to next string to write
 int CATReadPtr = 0;                         // pointer to next string to read
 
+//
+// counts for the subscription report
+//
+uint32_t CATSubPollsSent;                   // polls sent to SDR client for subscribed commands
+uint32_t CATSubReplies;                     // replies to those polls
+uint32_t CATSubUnchanged;                   // replies discarded because unchanged
+uint32_t CATSubPushes;                      // values pushed to serial subscribers
+uint32_t CATForwarded;                      // messages forwarded to SDR client for others
+
 
 extern SCATCommands GCATCommands[];
 
+static bool UpdateCATSubscriptions(unsigned long MatchWord, char* Message);
+
 
 
 //
@@ -237,6 +249,11 @@ void ParseCATCmd(char* Buffer,  int Source)
   else
   {
     MatchWord = Make32BitStr(Buffer);
+//
+// a subscribed value from the SDR client that has not changed needs no processing
+//
+    if ((Source == DESTTCPCATPORT) && UpdateCATSubscriptions(MatchWord, Buffer))
+      return;
     for (CmdCntr=0; CmdCntr < VNUMCATCMDS; CmdCntr++)         // loop thro commands we recognise
     {
       if (GCATMatch[CmdCntr] == MatchWord)
@@ -357,6 +374,7 @@ void SendCATMessage(char* Msg)
       strcpy(OutputStrings[CATWritePtr++], Msg);
       if(CATWritePtr >= VNUMOPSTRINGS)
         CATWritePtr = 0;
+      CATForwarded++;
       if (CATDebugPrint)
         printf("Sent CAT msg %s\n", Msg);                       // debug
     }
@@ -365,6 +383,293 @@ void SendCATMessage(char* Msg)
 
 
 
+//
+// CAT subscriptions
+// a client (a serial device, or p2app code with DESTLOCALCAT) registers interest in
+// a ZZ command. The CAT thread polls the SDR client once per command, at the fastest
+// rate any subscriber asked for, and caches each reply. Only replies that differ from
+// the cached value are passed to handlers and pushed to subscribers; each subscriber
+// is sent the latest value no more often than its own interval.
+//
+#define VMAXCATSUBS 16                      // subscriptions across all clients
+#define VCATVALUESIZE 32                    // largest cached CAT message
+#define VCATMINPOLLMS 20                    // fastest poll of the SDR client
+
+typedef struct
+{
+    bool InUse;
+    int Device;                             // serial device handle or DESTLOCALCAT
+    unsigned long MatchWord;                // 32 bit version of the command
+    char CATString[5];
+    uint32_t IntervalMs;                    // minimum time between pushes
+    uint64_t LastPushMs;
+    uint64_t LastPollMs;                    // time this command was last polled
+    bool Pending;                           // a changed value is waiting to be pushed
+    char Value[VCATVALUESIZE];              // latest complete message, eg "ZZXV0123;"
+} TCATSubscription;
+
+TCATSubscription CATSubscriptions[VMAXCATSUBS];
+pthread_mutex_t CATSubscriptionMutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+//
+// helper: time in ms
+//
+static uint64_t CATTimeMs(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (uint64_t)Now.tv_sec * 1000 + Now.tv_nsec / 1000000;
+}
+
+
+//
+// push a subscription's value to its device. Called with mutex held.
+//
+static void PushCATSubscription(TCATSubscription* Sub, uint64_t Now)
+{
+    Sub->Pending = false;
+    Sub->LastPushMs = Now;
+    if (Sub->Device != DESTLOCALCAT)
+    {
+        SendStringToSerial(Sub->Device, Sub->Value);
+        CATSubPushes++;
+    }
+}
+
+
+//
+// subscribe a device to a ZZ command, or change its interval
+// if a value is already known it is pushed at once
+// returns true if error (table full, or bad command)
+//
+bool CATSubscribe(int Device, char* CATString, uint32_t IntervalMs)
+{
+    int Cntr;
+    int Free = -1;
+    unsigned long MatchWord;
+    TCATSubscription* Sub = NULL;
+    char* KnownValue = NULL;
+
+    if ((strlen(CATString) < 4) || (Device == DESTTCPCATPORT))
+        return true;
+    MatchWord = Make32BitStr(CATString);
+    pthread_mutex_lock(&CATSubscriptionMutex);
+    for (Cntr = 0; Cntr < VMAXCATSUBS; Cntr++)
+    {
+        if (!CATSubscriptions[Cntr].InUse)
+        {
+            if (Free < 0)
+                Free = Cntr;
+        }
+        else if (CATSubscriptions[Cntr].MatchWord == MatchWord)
+        {
+            if (CATSubscriptions[Cntr].Device == Device)
+                Sub = CATSubscriptions + Cntr;
+            else if (CATSubscriptions[Cntr].Value[0] != 0)
+                KnownValue = CATSubscriptions[Cntr].Value;
+        }
+    }
+    if ((Sub == NULL) && (Free >= 0))
+    {
+        Sub = CATSubscriptions + Free;
+        memset(Sub, 0, sizeof(TCATSubscription));
+        Sub->InUse = true;
+        Sub->Device = Device;
+        Sub->MatchWord = MatchWord;
+        memcpy(Sub->CATString, CATString, 4);
+        Sub->CATString[4] = 0;
+        if (KnownValue != NULL)
+        {
+            strcpy(Sub->Value, KnownValue);
+            PushCATSubscription(Sub, CATTimeMs());
+        }
+    }
+    if (Sub != NULL)
+        Sub->IntervalMs = IntervalMs;
+    pthread_mutex_unlock(&CATSubscriptionMutex);
+    if (Sub == NULL)
+    {
+        printf("CAT subscription table full: %.4s not subscribed\n", CATString);
+        return true;
+    }
+    if (CATDebugPrint)
+        printf("CAT subscription: device %d, %s every %dms\n", Device, Sub->CATString, IntervalMs);
+    return false;
+}
+
+
+//
+// remove one subscription
+//
+void CATUnsubscribe(int Device, char* CATString)
+{
+    int Cntr;
+    unsigned long MatchWord;
+
+    if (strlen(CATString) < 4)
+        return;
+    MatchWord = Make32BitStr(CATString);
+    pthread_mutex_lock(&CATSubscriptionMutex);
+    for (Cntr = 0; Cntr < VMAXCATSUBS; Cntr++)
+        if (CATSubscriptions[Cntr].InUse && (CATSubscriptions[Cntr].Device == Device)
+            && (CATSubscriptions[Cntr].MatchWord == MatchWord))
+            CATSubscriptions[Cntr].InUse = false;
+    pthread_mutex_unlock(&CATSubscriptionMutex);
+}
+
+
+//
+// remove all subscriptions for a device (eg when its serial port closes)
+//
+void CATUnsubscribeDevice(int Device)
+{
+    int Cntr;
+
+    pthread_mutex_lock(&CATSubscriptionMutex);
+    for (Cntr = 0; Cntr < VMAXCATSUBS; Cntr++)
+        if (CATSubscriptions[Cntr].Device == Device)
+            CATSubscriptions[Cntr].InUse = false;
+    pthread_mutex_unlock(&CATSubscriptionMutex);
+}
+
+
+//
+// a message has arrived from the SDR client: update subscribed values
+// returns true if the command is subscribed and its value has not changed,
+// so the message needs no further processing
+//
+static bool UpdateCATSubscriptions(unsigned long MatchWord, char* Message)
+{
+    int Cntr;
+    bool Subscribed = false;
+    bool Changed = false;
+    uint64_t Now;
+    TCATSubscription* Sub;
+
+    if (strlen(Message) >= VCATVALUESIZE)
+        return false;
+    Now = CATTimeMs();
+    pthread_mutex_lock(&CATSubscriptionMutex);
+    for (Cntr = 0; Cntr < VMAXCATSUBS; Cntr++)
+    {
+        Sub = CATSubscriptions + Cntr;
+        if (!Sub->InUse || (Sub->MatchWord != MatchWord))
+            continue;
+        Subscribed = true;
+        if (strcmp(Sub->Value, Message) == 0)
+            continue;
+        Changed = true;
+        strcpy(Sub->Value, Message);
+        if ((Now - Sub->LastPushMs) >= Sub->IntervalMs)
+            PushCATSubscription(Sub, Now);
+        else
+            Sub->Pending = true;
+    }
+    if (Subscribed)
+    {
+        CATSubReplies++;
+        if (!Changed)
+            CATSubUnchanged++;
+    }
+    pthread_mutex_unlock(&CATSubscriptionMutex);
+    return Subscribed && !Changed;
+}
+
+
+//
+// periodic subscription processing, called from the CAT thread:
+// poll the SDR client for commands that are due, and push rate limited values
+// each command is polled once, at its fastest subscriber's interval
+//
+static void ServiceCATSubscriptions(void)
+{
+    int Cntr, Other;
+    uint64_t Now;
+    uint32_t Interval;
+    char Poll[8];
+    TCATSubscription* Sub;
+
+    Now = CATTimeMs();
+    pthread_mutex_lock(&CATSubscriptionMutex);
+    for (Cntr = 0; Cntr < VMAXCATSUBS; Cntr++)
+    {
+        Sub = CATSubscriptions + Cntr;
+        if (!Sub->InUse)
+            continue;
+        if (Sub->Pending && ((Now - Sub->LastPushMs) >= Sub->IntervalMs))
+            PushCATSubscription(Sub, Now);
+
+        //
+        // only the first subscription for a command polls it
+        //
+        Interval = Sub->IntervalMs;
+        for (Other = 0; Other < VMAXCATSUBS; Other++)
+            if (CATSubscriptions[Other].InUse && (CATSubscriptions[Other].MatchWord == Sub->MatchWord))
+            {
+                if (Other < Cntr)
+                    break;
+                if (CATSubscriptions[Other].IntervalMs < Interval)
+                    Interval = CATSubscriptions[Other].IntervalMs;
+            }
+        if (Other < Cntr)
+            continue;
+        if (Interval < VCATMINPOLLMS)
+            Interval = VCATMINPOLLMS;
+        if ((Now - Sub->LastPollMs) >= Interval)
+        {
+            Sub->LastPollMs = Now;
+            sprintf(Poll, "%s;", Sub->CATString);
+            if ((GetCATOPBufferUsed() <= (VNUMOPSTRINGS - 1)) && CATPortAssigned)
+            {
+                strcpy(OutputStrings[CATWritePtr], Poll);
+                if (++CATWritePtr >= VNUMOPSTRINGS)
+                    CATWritePtr = 0;
+                CATSubPollsSent++;
+            }
+        }
+    }
+    pthread_mutex_unlock(&CATSubscriptionMutex);
+}
+
+
+//
+// forget cached values, so the next reply for each command is treated as a change
+// (called when the SDR client connection is made)
+//
+static void ClearCATSubscriptionValues(void)
+{
+    int Cntr;
+
+    pthread_mutex_lock(&CATSubscriptionMutex);
+    for (Cntr = 0; Cntr < VMAXCATSUBS; Cntr++)
+    {
+        CATSubscriptions[Cntr].Value[0] = 0;
+        CATSubscriptions[Cntr].Pending = false;
+        CATSubscriptions[Cntr].LastPollMs = 0;
+    }
+    CATSubPollsSent = 0;
+    CATSubReplies = 0;
+    CATSubUnchanged = 0;
+    CATSubPushes = 0;
+    CATForwarded = 0;
+    pthread_mutex_unlock(&CATSubscriptionMutex);
+}
+
+
+//
+// print subscription counts for a CAT connection
+//
+static void PrintCATSubscriptionReport(void)
+{
+    printf("CAT subscriptions: %d polls sent, %d replies, %d unchanged and discarded, %d pushes; %d other messages forwarded\n",
+           CATSubPollsSent, CATSubReplies, CATSubUnchanged, CATSubPushes, CATForwarded);
+}
+
+
+
 //
 // helper to append a string with a character
 //
@@ -621,6 +926,16 @@ void* CATHandlerThread(__attribute__((unused)) void *arg)
       ReadTimeout.tv_usec = 1000;
       setsockopt(CATSocketid, SOL_SOCKET, SO_RCVTIMEO, (void *)&ReadTimeout , sizeof(ReadTimeout));
 
+    //
+    // CAT is control traffic: use the control class interface and DSCP
+    //
+      ApplyNetClass(CATSocketid, eNetControl);
+      memset(&addr_cat, 0, sizeof(addr_cat));
+      addr_cat.sin_family = AF_INET;
+      addr_cat.sin_addr = GetNetClassAddress(eNetControl);
+      if((addr_cat.sin_addr.s_addr != htonl(INADDR_ANY)) && (bind(CATSocketid, (struct sockaddr *)&addr_cat, sizeof(struct sockaddr_in)) < 0))
+          perror("CAT bind");
+
     //
     // connect to destination port
     //
@@ -636,6 +951,7 @@ void* CATHandlerThread(__attribute__((unused)) void *arg)
           ActiveCATPort = 0;
           return NULL;
       }
+      ClearCATSubscriptionValues();
       ThreadActive = true;
       CATPortAssigned = true;
 
@@ -661,6 +977,7 @@ void* CATHandlerThread(__attribute__((unused)) void *arg)
             ThreadError = true;
           }
 
+          ServiceCATSubscriptions();
           //
           // if there are CAT messages available, send them
           //
@@ -681,6 +998,7 @@ void* CATHandlerThread(__attribute__((unused)) void *arg)
       }                                                       // end of thread main loop
       close(CATSocketid);
       printf("Closing CAT Port & terminating thread\n");
+      PrintCATSubscriptionReport();
       ActiveCATPort = 0;
       CATPort = 0;                                            // set port not assigned
       CATPortAssigned = false;
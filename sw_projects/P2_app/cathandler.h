@@ -16,6 +16,7 @@
 #ifndef __CAThandler_h
 #define __CAThandler_h
 
+#include <stdint.h>
 #include "cattypes.h"
 #include "../common/saturntypes.h"
 #include "catmessages.h"
@@ -43,6 +44,7 @@ typedef struct
 extern SCATCommands GCATCommands[];
 
 #define DESTTCPCATPORT -1                          // selects CAT Port as the destination
+#define DESTLOCALCAT -2                            // subscriber is p2app itself: values go to the handlers only
 
 
 //
@@ -98,6 +100,25 @@ void ShutdownCATHandler(void);
 //
 void SendCATMessage(char* CatString);
 
+//
+// subscribe a device to a ZZ command (eg "ZZXV"), or change its interval.
+// p2app polls the SDR client for it, and pushes a new value to the device
+// only when it changes, at most once per IntervalMs.
+// Device is a serial device handle, or DESTLOCALCAT for p2app's own handlers
+// returns true if error
+//
+bool CATSubscribe(int Device, char* CATString, uint32_t IntervalMs);
+
+//
+// remove one subscription
+//
+void CATUnsubscribe(int Device, char* CATString);
+
+//
+// remove all subscriptions for a device
+//
+void CATUnsubscribeDevice(int Device);
+
 //
 // parse a CAT command, and call appropriate handler
 // message source provided so potentially different handlers can be used
@@ -175,6 +175,28 @@ void HandleZZTU(__attribute__((unused)) int SourceDevice, __attribute__((unused)
 }
 
 
+//
+// subscribe to a ZZ command: sent by a CAT client, handled locally
+// parameter is the 4 character command then a 4 digit interval in ms, eg ZZASZZXV0100;
+// interval 0 removes the subscription. The current value is pushed at once if known.
+//
+void HandleZZAS(int SourceDevice, ERXParamType Type, __attribute__((unused)) bool BoolParam, __attribute__((unused)) int NumParam, char* StringParam)
+{
+    char Command[5];
+    int Interval;
+
+    if((SourceDevice == DESTTCPCATPORT) || (Type != eStr) || (strlen(StringParam) < 8))
+        return;
+    memcpy(Command, StringParam, 4);
+    Command[4] = 0;
+    Interval = atoi(StringParam + 4);
+    if(Interval == 0)
+        CATUnsubscribe(SourceDevice, Command);
+    else
+        CATSubscribe(SourceDevice, Command, Interval);
+}
+
+
 //
 // array of records. This must exactly match the enum ECATCommands in tiger.h
 // and the number of commands defined here must be correct
@@ -201,5 +223,6 @@ SCATCommands GCATCommands[VNUMCATCMDS] =
   {"ZZOV", eBool, 0, 1, 1, false, NULL},                        // ATU enable/disable
   {"ZZOX", eBool, 0, 1, 1, false, HandleZZOX},                  // ATU tune success/fail
   {"ZZOY", eBool, 0, 1, 1, false, NULL},                        // set ATU option
-  {"ZZOZ", eNum, 0, 3, 1, false, HandleZZOZ}                    // erase tuning solutions (reply is 0/1 only: fail/success)
+  {"ZZOZ", eNum, 0, 3, 1, false, HandleZZOZ},                   // erase tuning solutions (reply is 0/1 only: fail/success)
+  {"ZZAS", eStr, 0, 0, 8, false, HandleZZAS}                    // subscribe to a command
 };
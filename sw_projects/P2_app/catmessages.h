@@ -26,7 +26,7 @@
 // ordered as per documentation, not alphabetically!
 // this list must match exactly the table GCATCommands
 //
-#define VNUMCATCMDS 18
+#define VNUMCATCMDS 19
 
 typedef enum 
 {
@@ -48,6 +48,7 @@ typedef enum
   eZZOX,                          // ATU Tune success/fail
   eZZOY,                          // ATU options
   eZZOZ,                          // erase ATU tune solutions
+  eZZAS,                          // subscribe to a command (local to p2app)
   eNoCommand                      // this is an exception condition
 }ECATCommands;
 
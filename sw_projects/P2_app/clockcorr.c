@@ -0,0 +1,701 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// clockcorr.c:
+//
+// sample clock correlation. After each DDC DMA, the DDC thread passes the
+// samples demultiplexed so far and the host time the DMA started. One DDC's
+// count, scaled by its decimation, gives ADC clock ticks since the anchor
+// (the DMA at which the estimate last restarted). Data reach the host some
+// time after they were sampled: a positive delay (FIFO fill, polling, DMA,
+// scheduling) with a long tail. So only the least delayed DMA in each
+// VCCBINMS is kept, and a line is fitted to the last VCCWINDOW of them:
+// a robust first fit (median of pair slopes and of intercepts), outliers
+// beyond VCCREJECTSIGMA robust standard deviations rejected, then least
+// squares on the rest, which also gives the uncertainty of the mapping.
+// a run of outlier bins is taken as a step in the sample count (a FIFO
+// overflow) and restarts the estimate, as do DDC rate changes and DMA gaps.
+// the mapping is published under a mutex for other threads.
+//
+//////////////////////////////////////////////////////////////
+
+#include "threaddata.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "clockcorr.h"
+
+
+#define VCCNOMINALNSPERTICK (1.0e9 / VCCADCCLOCK)
+#define VCCTICKSPERKSAMPLE (VCCADCCLOCK / 1000.0)   // ADC ticks per sample = this / rate in ksps
+
+
+static pthread_mutex_t CCMutex = PTHREAD_MUTEX_INITIALIZER;
+static TClockMapping CCMapping;                     // published mapping (written by the DDC thread only)
+static _Atomic(bool) CCRestartRequested = true;
+static bool CCStarted = false;                      // anchor set
+static uint32_t CCEpoch = 0;
+static uint64_t CCAnchorSamples[VNUMDDC];
+static uint32_t CCRates[VNUMDDC];
+static uint32_t CCRefDDC;                           // DDC whose count gives the ticks
+static double CCTicksPerSample;
+static int64_t CCAnchorNs;
+static int64_t CCLastNs;
+static bool CCBinHasPoint;
+static int64_t CCBinStartNs;
+static double CCBinTicks;
+static int64_t CCBinNs;
+static double CCBinOffset;                          // delay measure of the bin's point: least is kept
+static double CCTicks[VCCWINDOW];                   // ring of kept points
+static int64_t CCNs[VCCWINDOW];
+static uint32_t CCCount, CCHead;
+static double CCRobustSigma;                        // from the last fit
+static uint32_t CCOutlierRun;
+static TClockCorrStatistics CCStats;
+
+
+static int64_t CCClockNs(clockid_t Clock)
+{
+    struct timespec Now;
+
+    clock_gettime(Clock, &Now);
+    return (int64_t)Now.tv_sec * 1000000000LL + Now.tv_nsec;
+}
+
+
+//
+// offset of a host clock from CLOCK_MONOTONIC: read between two monotonic reads
+//
+static int64_t CCClockOffset(clockid_t Clock)
+{
+    int64_t Before, Other, After;
+
+    Before = CCClockNs(CLOCK_MONOTONIC);
+    Other = CCClockNs(Clock);
+    After = CCClockNs(CLOCK_MONOTONIC);
+    return Other - (Before + (After - Before) / 2);
+}
+
+
+static int CCCompare(const void* A, const void* B)
+{
+    double Diff = *(const double*)A - *(const double*)B;
+
+    return (Diff > 0.0) - (Diff < 0.0);
+}
+
+
+//
+// median of Count values; reorders them
+//
+static double CCMedian(double* Values, uint32_t Count)
+{
+    qsort(Values, Count, sizeof(double), CCCompare);
+    return Values[Count / 2];
+}
+
+
+//
+// predicted host time of a tick count on the published mapping
+//
+static double CCPredictNs(TClockMapping* Map, double Ticks)
+{
+    return (double)Map->RefNs + (Ticks - Map->RefTicks) * Map->NsPerTick;
+}
+
+
+//
+// forget everything: set the anchor at this DMA
+//
+static void CCRestartAt(uint64_t* Samples, uint32_t* Rates, int64_t HostNs)
+{
+    uint32_t DDC;
+
+    CCStarted = false;
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+    {
+        CCAnchorSamples[DDC] = Samples[DDC];
+        CCRates[DDC] = Rates[DDC];
+    }
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+        if (Rates[DDC] != 0)
+        {
+            CCRefDDC = DDC;
+            CCTicksPerSample = VCCTICKSPERKSAMPLE / Rates[DDC];
+            CCStarted = true;
+            break;
+        }
+    CCAnchorNs = HostNs;
+    CCLastNs = HostNs;
+    CCBinHasPoint = false;
+    CCCount = 0;
+    CCHead = 0;
+    CCRobustSigma = 0.0;
+    CCOutlierRun = 0;
+    CCStats.Restarts++;
+
+    pthread_mutex_lock(&CCMutex);
+    CCMapping.Valid = false;
+    CCMapping.Epoch = ++CCEpoch;
+    memcpy(CCMapping.AnchorSamples, CCAnchorSamples, sizeof(CCAnchorSamples));
+    memcpy(CCMapping.Rates, CCRates, sizeof(CCRates));
+    pthread_mutex_unlock(&CCMutex);
+}
+
+
+//
+// fit a line to the kept points and publish it
+//
+static void CCFit(void)
+{
+    static double X[VCCWINDOW], Y[VCCWINDOW], Work[VCCWINDOW];
+    uint32_t Cntr, Index, Half, Pairs, Used;
+    double X0, RobustSlope, Slope, Intercept, Threshold, Residual;
+    double MeanX, MeanY, Sxx, Sxy, SumSq, Variance;
+    int64_t Ns0;
+    TClockMapping Map;
+
+    //
+    // points in time order, as ticks and host time less nominal, from the oldest
+    //
+    Index = (CCHead + VCCWINDOW - CCCount) % VCCWINDOW;
+    X0 = CCTicks[Index];
+    Ns0 = CCNs[Index];
+    for (Cntr = 0; Cntr < CCCount; Cntr++)
+    {
+        Index = (CCHead + VCCWINDOW - CCCount + Cntr) % VCCWINDOW;
+        X[Cntr] = CCTicks[Index] - X0;
+        Y[Cntr] = (double)(CCNs[Index] - Ns0) - X[Cntr] * VCCNOMINALNSPERTICK;
+    }
+
+    //
+    // robust first fit: median slope of pairs half the window apart, then median intercept
+    //
+    Half = CCCount / 2;
+    Pairs = 0;
+    for (Cntr = 0; Cntr < Half; Cntr++)
+        if (X[Cntr + Half] > X[Cntr])
+            Work[Pairs++] = (Y[Cntr + Half] - Y[Cntr]) / (X[Cntr + Half] - X[Cntr]);
+    if (Pairs == 0)
+        return;
+    RobustSlope = CCMedian(Work, Pairs);
+    for (Cntr = 0; Cntr < CCCount; Cntr++)
+        Work[Cntr] = Y[Cntr] - RobustSlope * X[Cntr];
+    Intercept = CCMedian(Work, CCCount);
+    for (Cntr = 0; Cntr < CCCount; Cntr++)
+        Work[Cntr] = fabs(Y[Cntr] - Intercept - RobustSlope * X[Cntr]);
+    CCRobustSigma = 1.4826 * CCMedian(Work, CCCount);
+    Threshold = VCCREJECTSIGMA * CCRobustSigma;
+    if (Threshold < VCCMINREJECTNS)
+        Threshold = VCCMINREJECTNS;
+
+    //
+    // least squares on the points within the threshold
+    //
+    Used = 0;
+    MeanX = 0.0;
+    MeanY = 0.0;
+    for (Cntr = 0; Cntr < CCCount; Cntr++)
+        if (fabs(Y[Cntr] - Intercept - RobustSlope * X[Cntr]) <= Threshold)
+        {
+            MeanX += X[Cntr];
+            MeanY += Y[Cntr];
+            Used++;
+        }
+    if (Used < 3)
+        return;
+    MeanX /= Used;
+    MeanY /= Used;
+    Sxx = 0.0;
+    Sxy = 0.0;
+    for (Cntr = 0; Cntr < CCCount; Cntr++)
+        if (fabs(Y[Cntr] - Intercept - RobustSlope * X[Cntr]) <= Threshold)
+        {
+            Sxx += (X[Cntr] - MeanX) * (X[Cntr] - MeanX);
+            Sxy += (X[Cntr] - MeanX) * (Y[Cntr] - MeanY);
+        }
+    if (Sxx <= 0.0)
+        return;
+    Slope = Sxy / Sxx;
+    SumSq = 0.0;
+    for (Cntr = 0; Cntr < CCCount; Cntr++)
+    {
+        Residual = Y[Cntr] - MeanY - Slope * (X[Cntr] - MeanX);
+        if (fabs(Y[Cntr] - Intercept - RobustSlope * X[Cntr]) <= Threshold)
+            SumSq += Residual * Residual;
+    }
+    Variance = SumSq / (Used - 2);
+    CCStats.Fits++;
+
+    Map = CCMapping;
+    Map.Valid = true;
+    Map.RefTicks = X0 + MeanX;
+    Map.RefNs = Ns0 + (int64_t)llround(MeanY + MeanX * VCCNOMINALNSPERTICK);
+    Map.NsPerTick = VCCNOMINALNSPERTICK + Slope;
+    Map.DriftPpm = Slope / VCCNOMINALNSPERTICK * 1.0e6;
+    Map.SlopeSigma = sqrt(Variance / Sxx);
+    Map.DriftSigmaPpm = Map.SlopeSigma / VCCNOMINALNSPERTICK * 1.0e6;
+    Map.OffsetSigmaNs = sqrt(Variance / Used);
+    Map.ResidualNs = sqrt(Variance);
+    Map.Points = Used;
+    Map.Rejected = CCCount - Used;
+    Map.LatestTicks = X0 + X[CCCount - 1];
+    Map.TAIOffsetNs = CCClockOffset(CLOCK_TAI);
+    Map.RealtimeOffsetNs = CCClockOffset(CLOCK_REALTIME);
+    pthread_mutex_lock(&CCMutex);
+    CCMapping = Map;
+    pthread_mutex_unlock(&CCMutex);
+}
+
+
+//
+// keep a bin's point; refit. A run of points far off the mapping is a step
+//
+static void CCAddPoint(double Ticks, int64_t Ns)
+{
+    double Threshold;
+
+    CCStats.Bins++;
+    if (CCMapping.Valid)
+    {
+        Threshold = VCCREJECTSIGMA * CCRobustSigma;
+        if (Threshold < VCCMINREJECTNS)
+            Threshold = VCCMINREJECTNS;
+        if (fabs((double)Ns - CCPredictNs(&CCMapping, Ticks)) > Threshold)
+            CCOutlierRun++;
+        else
+            CCOutlierRun = 0;
+        if (CCOutlierRun >= VCCSTEPBINS)
+        {
+            CCStats.Steps++;
+            atomic_store(&CCRestartRequested, true);
+            return;
+        }
+    }
+    CCTicks[CCHead] = Ticks;
+    CCNs[CCHead] = Ns;
+    CCHead = (CCHead + 1) % VCCWINDOW;
+    if (CCCount < VCCWINDOW)
+        CCCount++;
+    if (CCCount >= VCCMINPOINTS)
+        CCFit();
+}
+
+
+//
+// start of a run: restart the estimate at the next DMA
+//
+void ClockCorrRestart(void)
+{
+    atomic_store(&CCRestartRequested, true);
+}
+
+
+//
+// a DMA has been demultiplexed, with the DDC rates given
+//
+void ClockCorrAddDMARates(uint64_t* Samples, uint32_t* Rates, int64_t HostNs)
+{
+    uint32_t DDC;
+    double Ticks, Offset;
+
+    CCStats.DMAs++;
+    if (atomic_exchange(&CCRestartRequested, false) || !CCStarted)
+    {
+        CCRestartAt(Samples, Rates, HostNs);
+        return;
+    }
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+        if (Rates[DDC] != CCRates[DDC])
+        {
+            CCStats.RateChanges++;
+            CCRestartAt(Samples, Rates, HostNs);
+            return;
+        }
+    if ((HostNs - CCLastNs) > VCCMAXGAPMS * 1000000LL)
+    {
+        CCStats.Gaps++;
+        CCRestartAt(Samples, Rates, HostNs);
+        return;
+    }
+    CCLastNs = HostNs;
+
+    if (CCBinHasPoint && ((HostNs - CCBinStartNs) >= VCCBINMS * 1000000LL))
+    {
+        CCBinHasPoint = false;
+        CCAddPoint(CCBinTicks, CCBinNs);
+    }
+    Ticks = (double)(Samples[CCRefDDC] - CCAnchorSamples[CCRefDDC]) * CCTicksPerSample;
+    Offset = (double)(HostNs - CCAnchorNs) - Ticks * VCCNOMINALNSPERTICK;
+    if (!CCBinHasPoint || (Offset < CCBinOffset))
+    {
+        if (!CCBinHasPoint)
+            CCBinStartNs = HostNs;
+        CCBinHasPoint = true;
+        CCBinTicks = Ticks;
+        CCBinNs = HostNs;
+        CCBinOffset = Offset;
+    }
+}
+
+
+//
+// a DMA has been demultiplexed: DDC rates from the registers
+//
+void ClockCorrAddDMA(uint64_t* Samples, int64_t HostNs)
+{
+    uint32_t Rates[VNUMDDC];
+    uint32_t DDC;
+
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+        Rates[DDC] = GetP2SampleRate(DDC);
+    ClockCorrAddDMARates(Samples, Rates, HostNs);
+}
+
+
+//
+// copy the current mapping
+// returns true if there is no valid mapping
+//
+bool ClockCorrGetMapping(TClockMapping* Dest)
+{
+    pthread_mutex_lock(&CCMutex);
+    *Dest = CCMapping;
+    pthread_mutex_unlock(&CCMutex);
+    return !Dest->Valid;
+}
+
+
+//
+// convert a DDC sample count to host clock time
+// returns true if there is no valid mapping, or the DDC was not running at the anchor
+//
+bool ClockCorrSampleToNs(uint32_t DDC, uint64_t SampleCount, clockid_t Clock, int64_t* Ns, double* SigmaNs)
+{
+    TClockMapping Map;
+    double Ticks, Offset;
+
+    if ((DDC >= VNUMDDC) || ClockCorrGetMapping(&Map) || (Map.Rates[DDC] == 0))
+        return true;
+    Ticks = (double)(int64_t)(SampleCount - Map.AnchorSamples[DDC]) * VCCTICKSPERKSAMPLE / Map.Rates[DDC];
+    Offset = 0.0;
+    if (Clock == CLOCK_TAI)
+        Offset = (double)Map.TAIOffsetNs;
+    else if (Clock == CLOCK_REALTIME)
+        Offset = (double)Map.RealtimeOffsetNs;
+    *Ns = (int64_t)llround(CCPredictNs(&Map, Ticks) + Offset);
+    if (SigmaNs != NULL)
+        *SigmaNs = sqrt(Map.OffsetSigmaNs * Map.OffsetSigmaNs
+                        + (Ticks - Map.RefTicks) * (Ticks - Map.RefTicks) * Map.SlopeSigma * Map.SlopeSigma);
+    return false;
+}
+
+
+//
+// print the mapping and statistics
+//
+void PrintClockCorrReport(void)
+{
+    TClockMapping Map;
+
+    if (CCStats.DMAs == 0)
+        return;
+    if (ClockCorrGetMapping(&Map))
+        printf("sample clock: no mapping to host time\n");
+    else
+        printf("sample clock: ADC clock %+.3f +/- %.3f ppm slow against host; offset +/- %.2fus, residual %.2fus rms (%d points, %d rejected)\n",
+               Map.DriftPpm, Map.DriftSigmaPpm, Map.OffsetSigmaNs / 1000.0, Map.ResidualNs / 1000.0,
+               Map.Points, Map.Rejected);
+    printf("sample clock: %llu DMAs, %llu fits; %llu restarts (%llu rate changes, %llu steps, %llu gaps)\n",
+           (unsigned long long)CCStats.DMAs, (unsigned long long)CCStats.Fits, (unsigned long long)CCStats.Restarts,
+           (unsigned long long)CCStats.RateChanges, (unsigned long long)CCStats.Steps, (unsigned long long)CCStats.Gaps);
+}
+
+
+
+//////////////////////////////////////////////////////////////
+//
+// check: simulated DMA timing. The ADC clock runs with a set drift against
+// the host clock; DMAs come every 0.8-1.6ms of ADC time and are seen by the
+// host after a fixed delay plus exponential jitter, with occasional long
+// preemptions. Each DMA's DDC0 count is converted back through the mapping
+// and compared with the true host time of that sample.
+//
+//////////////////////////////////////////////////////////////
+
+#define VCHKDDC0RATE 192                            // ksps
+#define VCHKDDC1RATE 48
+#define VCHKSTARTUPS 3.0                            // seconds before errors are counted
+#define VCHKRECOVERS 2.5                            // most seconds to recover from a step or rate change
+#define VCHKMAXDRIFTPPM 0.2                         // largest drift estimate error
+#define VCHKMINWITHIN 0.95                          // fraction of errors within 3 sigma
+
+
+typedef struct
+{
+    char* Name;
+    double Seconds;
+    double DriftPpm;
+    double FixedUs;                                 // least delay
+    double JitterUs;                                // mean of exponential delay
+    double PreemptProbability;
+    double PreemptMaxMs;
+    double EventSeconds;                            // step or rate change time (0 = none)
+    double LostMs;                                  // samples lost at the event (a step)
+    uint32_t NewRate;                               // DDC0 rate after the event (0 = no change)
+    double MaxRmsUs;                                // largest rms error about the bias
+    double MaxBiasUs;                               // largest bias beyond the fixed delay
+} TCCCheckScenario;
+
+
+static TCCCheckScenario CCCheckScenarios[] =
+{
+    {"steady", 60.0, 23.7, 20.0, 40.0, 0.01, 5.0, 0.0, 0.0, 0, 2.0, 5.0},
+    {"heavy jitter", 60.0, -41.3, 50.0, 300.0, 0.10, 20.0, 0.0, 0.0, 0, 5.0, 30.0},
+    {"sample step", 40.0, 5.0, 20.0, 40.0, 0.01, 5.0, 20.0, 3.0, 0, 2.0, 5.0},
+    {"rate change", 40.0, -12.0, 20.0, 40.0, 0.01, 5.0, 20.0, 0.0, 384, 2.0, 5.0}
+};
+
+
+static double CCCheckUniform(void)
+{
+    return (rand() + 0.5) / (RAND_MAX + 1.0);
+}
+
+
+//
+// ADC time (s) of a DDC sample count
+//
+static double CCCheckSampleTime(TCCCheckScenario* Sc, uint32_t DDC, uint64_t Count, bool After)
+{
+    double Rate, Event;
+
+    Rate = ((DDC == 0) ? VCHKDDC0RATE : VCHKDDC1RATE) * 1000.0;
+    if (!After)
+        return Count / Rate;
+    Event = Sc->EventSeconds;
+    if ((DDC == 0) && (Sc->NewRate != 0))
+        return Event + (Count - floor(Event * Rate)) / (Sc->NewRate * 1000.0);
+    return Count / Rate + Sc->LostMs / 1000.0;
+}
+
+
+//
+// DDC sample counts at ADC time Tau
+//
+static void CCCheckSamples(TCCCheckScenario* Sc, double Tau, uint64_t* Samples, uint32_t* Rates)
+{
+    double Event = Sc->EventSeconds;
+    bool After = (Event != 0.0) && (Tau >= Event);
+
+    memset(Samples, 0, VNUMDDC * sizeof(uint64_t));
+    memset(Rates, 0, VNUMDDC * sizeof(uint32_t));
+    Rates[0] = VCHKDDC0RATE;
+    Rates[1] = VCHKDDC1RATE;
+    if (After && (Sc->NewRate != 0))
+    {
+        Rates[0] = Sc->NewRate;
+        Samples[0] = (uint64_t)floor(Event * VCHKDDC0RATE * 1000.0) + (uint64_t)floor((Tau - Event) * Sc->NewRate * 1000.0);
+        Samples[1] = (uint64_t)floor(Tau * VCHKDDC1RATE * 1000.0);
+        return;
+    }
+    if (After)
+        Tau -= Sc->LostMs / 1000.0;
+    Samples[0] = (uint64_t)floor(Tau * VCHKDDC0RATE * 1000.0);
+    Samples[1] = (uint64_t)floor(Tau * VCHKDDC1RATE * 1000.0);
+}
+
+
+static bool CCCheckScenario(TCCCheckScenario* Sc, int64_t HostBaseNs)
+{
+    uint64_t Samples[VNUMDDC];
+    uint32_t Rates[VNUMDDC];
+    double Tau, Delay, TrueNs, Error, Sigma, NextCheck, RecoveredAt;
+    double Sum, SumSq, MaxAbs, Bias, Rms, Ddc1Worst, Ddc1Limit;
+    double Errors[8192], Sigmas[8192], Ddc1Errors[8192];
+    bool Segments[8192];                                // after the event: its own bias
+    double SegmentBias[2];
+    uint32_t Count, Cntr, Within, StartEpoch, SegmentCount[2];
+    int64_t HostNs, MappedNs;
+    TClockMapping Map;
+    bool After, Recovered, Failed = false;
+
+    memset(&CCMapping, 0, sizeof(CCMapping));
+    memset(&CCStats, 0, sizeof(CCStats));
+    CCStarted = false;
+    atomic_store(&CCRestartRequested, true);
+    srand(7);
+
+    Tau = 0.0;
+    NextCheck = VCHKSTARTUPS;
+    Count = 0;
+    StartEpoch = 0;
+    Recovered = (Sc->EventSeconds == 0.0);
+    RecoveredAt = 0.0;
+    while (Tau < Sc->Seconds)
+    {
+        Tau += (0.8 + 0.8 * CCCheckUniform()) / 1000.0;
+        After = (Sc->EventSeconds != 0.0) && (Tau >= Sc->EventSeconds);
+        CCCheckSamples(Sc, Tau, Samples, Rates);
+        Delay = Sc->FixedUs - Sc->JitterUs * log(CCCheckUniform());
+        if (CCCheckUniform() < Sc->PreemptProbability)
+            Delay += Sc->PreemptMaxMs * 1000.0 * CCCheckUniform();
+        HostNs = HostBaseNs + (int64_t)llround(Tau * (1.0 + Sc->DriftPpm * 1.0e-6) * 1.0e9 + Delay * 1000.0);
+        ClockCorrAddDMARates(Samples, Rates, HostNs);
+
+        if (Tau < NextCheck)
+            continue;
+        NextCheck += 0.01;
+        if (ClockCorrGetMapping(&Map))
+            continue;
+        if (StartEpoch == 0)
+            StartEpoch = Map.Epoch;
+        if (After && !Recovered)
+        {
+            if (Map.Epoch == StartEpoch)                        // not yet detected
+                continue;
+            Recovered = true;
+            RecoveredAt = Tau;
+            printf("  %s detected and mapping recovered %.2fs after it\n",
+                   (Sc->NewRate != 0) ? "rate change" : "step", Tau - Sc->EventSeconds);
+        }
+        if ((Sc->EventSeconds != 0.0) && !After && (Tau > Sc->EventSeconds - 0.05))
+            continue;
+        if (Count >= 8192)
+            continue;
+        ClockCorrSampleToNs(0, Samples[0], CLOCK_MONOTONIC, &MappedNs, &Sigma);
+        TrueNs = HostBaseNs + CCCheckSampleTime(Sc, 0, Samples[0], After) * (1.0 + Sc->DriftPpm * 1.0e-6) * 1.0e9;
+        Errors[Count] = (double)MappedNs - TrueNs;
+        Sigmas[Count] = Sigma;
+        ClockCorrSampleToNs(1, Samples[1], CLOCK_MONOTONIC, &MappedNs, NULL);
+        TrueNs = HostBaseNs + CCCheckSampleTime(Sc, 1, Samples[1], After) * (1.0 + Sc->DriftPpm * 1.0e-6) * 1.0e9;
+        Ddc1Errors[Count] = (double)MappedNs - TrueNs;
+        Segments[Count] = After;
+        Count++;
+    }
+
+    //
+    // bias (the fixed delay plus the least jitter), then spread about it
+    // a restart gives a new estimate, with its own bias
+    //
+    ClockCorrGetMapping(&Map);
+    Sum = 0.0;
+    SegmentBias[0] = 0.0;
+    SegmentBias[1] = 0.0;
+    SegmentCount[0] = 0;
+    SegmentCount[1] = 0;
+    for (Cntr = 0; Cntr < Count; Cntr++)
+    {
+        Sum += Errors[Cntr];
+        SegmentBias[Segments[Cntr]] += Errors[Cntr];
+        SegmentCount[Segments[Cntr]]++;
+    }
+    Bias = (Count != 0) ? Sum / Count : 0.0;
+    for (Cntr = 0; Cntr < 2; Cntr++)
+        if (SegmentCount[Cntr] != 0)
+            SegmentBias[Cntr] /= SegmentCount[Cntr];
+    SumSq = 0.0;
+    MaxAbs = 0.0;
+    Within = 0;
+    Ddc1Worst = 0.0;
+    for (Cntr = 0; Cntr < Count; Cntr++)
+    {
+        Error = Errors[Cntr] - SegmentBias[Segments[Cntr]];
+        SumSq += Error * Error;
+        if (fabs(Error) > MaxAbs)
+            MaxAbs = fabs(Error);
+        if (fabs(Error) <= 3.0 * Sigmas[Cntr])
+            Within++;
+        if (fabs(Ddc1Errors[Cntr] - SegmentBias[Segments[Cntr]]) > Ddc1Worst)
+            Ddc1Worst = fabs(Ddc1Errors[Cntr] - SegmentBias[Segments[Cntr]]);
+    }
+    Rms = (Count != 0) ? sqrt(SumSq / Count) : 0.0;
+    Ddc1Limit = 1.0e9 / (VCHKDDC1RATE * 1000.0) + 3.0 * Map.OffsetSigmaNs + Sc->MaxRmsUs * 1000.0;
+    printf("  drift %+.3f ppm (set %+.3f), +/- %.3f ppm; %d points used, %d rejected\n",
+           Map.DriftPpm, Sc->DriftPpm, Map.DriftSigmaPpm, Map.Points, Map.Rejected);
+    printf("  %d conversions: bias %.2fus (fixed delay %.1fus); error about it %.2fus rms, %.2fus max; %.1f%% within 3 sigma (%.2fus)\n",
+           Count, Bias / 1000.0, Sc->FixedUs, Rms / 1000.0, MaxAbs / 1000.0,
+           (Count != 0) ? 100.0 * Within / Count : 0.0, Map.OffsetSigmaNs / 1000.0);
+    printf("  DDC1 (%dksps) worst error about the bias %.2fus\n", VCHKDDC1RATE, Ddc1Worst / 1000.0);
+    printf("  %llu DMAs, %llu restarts (%llu rate changes, %llu steps, %llu gaps)\n",
+           (unsigned long long)CCStats.DMAs, (unsigned long long)CCStats.Restarts,
+           (unsigned long long)CCStats.RateChanges, (unsigned long long)CCStats.Steps, (unsigned long long)CCStats.Gaps);
+
+    if (Count < 100)
+    {
+        printf("  FAIL: too few conversions\n");
+        Failed = true;
+    }
+    if (fabs(Map.DriftPpm - Sc->DriftPpm) > VCHKMAXDRIFTPPM)
+    {
+        printf("  FAIL: drift error\n");
+        Failed = true;
+    }
+    if ((Bias < (Sc->FixedUs - 2.0) * 1000.0) || (Bias > (Sc->FixedUs + Sc->MaxBiasUs) * 1000.0))
+    {
+        printf("  FAIL: bias\n");
+        Failed = true;
+    }
+    if (Rms > Sc->MaxRmsUs * 1000.0)
+    {
+        printf("  FAIL: rms error\n");
+        Failed = true;
+    }
+    if ((Count != 0) && ((double)Within / Count < VCHKMINWITHIN))
+    {
+        printf("  FAIL: uncertainty understated\n");
+        Failed = true;
+    }
+    if (Ddc1Worst > Ddc1Limit)
+    {
+        printf("  FAIL: DDC1 error\n");
+        Failed = true;
+    }
+    if (!Recovered || ((Sc->EventSeconds != 0.0) && (RecoveredAt - Sc->EventSeconds > VCHKRECOVERS)))
+    {
+        printf("  FAIL: not recovered from the %s\n", (Sc->NewRate != 0) ? "rate change" : "step");
+        Failed = true;
+    }
+    return Failed;
+}
+
+
+//
+// run every scenario
+// returns true if failed
+//
+bool RunClockCorrCheck(void)
+{
+    uint32_t Sc;
+    bool Failed = false;
+    int64_t HostBaseNs;
+
+    HostBaseNs = CCClockNs(CLOCK_MONOTONIC);
+    printf("sample clock correlation check: simulated DMA timing, %dksps DDC0 and %dksps DDC1\n",
+           VCHKDDC0RATE, VCHKDDC1RATE);
+    for (Sc = 0; Sc < sizeof(CCCheckScenarios) / sizeof(CCCheckScenarios[0]); Sc++)
+    {
+        printf("%s: %.0fs, drift %+.1f ppm, delay %.0fus + %.0fus mean jitter, %.0f%% preempted up to %.0fms\n",
+               CCCheckScenarios[Sc].Name, CCCheckScenarios[Sc].Seconds, CCCheckScenarios[Sc].DriftPpm,
+               CCCheckScenarios[Sc].FixedUs, CCCheckScenarios[Sc].JitterUs,
+               100.0 * CCCheckScenarios[Sc].PreemptProbability, CCCheckScenarios[Sc].PreemptMaxMs);
+        if (CCCheckScenario(&CCCheckScenarios[Sc], HostBaseNs))
+            Failed = true;
+    }
+    memset(&CCMapping, 0, sizeof(CCMapping));
+    memset(&CCStats, 0, sizeof(CCStats));
+    CCStarted = false;
+    printf("sample clock correlation check: %s\n", Failed ? "FAIL" : "pass");
+    return Failed;
+}
@@ -0,0 +1,133 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// clockcorr.h:
+// sample clock correlation: estimates the mapping from DDC sample counts
+// (through the ADC clock) to host clock time, from DDC DMA times
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __clockcorr_h
+#define __clockcorr_h
+
+
+#include <stdint.h>
+#include <time.h>
+#include "../common/saturntypes.h"
+#include "../common/saturnregisters.h"
+
+
+#define VCCADCCLOCK 122880000.0                     // ADC clock, Hz: the sample time base
+#define VCCBINMS 50                                 // one point kept per bin: the least delayed DMA
+#define VCCWINDOW 256                               // bins in the fit (12.8s)
+#define VCCMINPOINTS 20                             // bins before a mapping is published (1s)
+#define VCCREJECTSIGMA 3.5                          // outlier rejection, in robust standard deviations
+#define VCCMINREJECTNS 10000.0                      // least rejection threshold, ns
+#define VCCSTEPBINS 10                              // consecutive outlier bins taken as a step: restart
+#define VCCMAXGAPMS 1000                            // DMA gap that restarts the estimate
+
+
+//
+// the mapping from ADC clock ticks to host CLOCK_MONOTONIC time:
+// Ns = RefNs + (Ticks - RefTicks) * NsPerTick
+// ticks count from the anchor: the DMA at which the estimate last restarted,
+// when each DDC had delivered AnchorSamples[DDC] samples at Rates[DDC] ksps.
+// the fit is to the least delayed DMA in each VCCBINMS, so the mapping gives
+// the time data reached the host less that minimum delay: a constant offset
+// (a few us) that cannot be observed from the host side.
+//
+typedef struct
+{
+    bool Valid;
+    uint32_t Epoch;                                 // restarts so far; changes when the anchor does
+    uint64_t AnchorSamples[VNUMDDC];
+    uint32_t Rates[VNUMDDC];                        // ksps, 0 if the DDC was off
+    double RefTicks;                                // centre of the fit
+    int64_t RefNs;
+    double NsPerTick;
+    double DriftPpm;                                // host ns per ADC tick vs nominal; +ve: ADC clock slow
+    double DriftSigmaPpm;
+    double OffsetSigmaNs;                           // standard error at the centre of the fit
+    double SlopeSigma;                              // standard error of NsPerTick
+    double ResidualNs;                              // rms residual of the points used
+    uint32_t Points;                                // points in the fit
+    uint32_t Rejected;                              // points rejected as outliers
+    double LatestTicks;                             // newest point
+    int64_t TAIOffsetNs;                            // CLOCK_TAI - CLOCK_MONOTONIC when published
+    int64_t RealtimeOffsetNs;                       // CLOCK_REALTIME - CLOCK_MONOTONIC when published
+} TClockMapping;
+
+
+//
+// statistics
+//
+typedef struct
+{
+    uint64_t DMAs;                                  // DMA times offered
+    uint64_t Bins;                                  // points kept
+    uint64_t Fits;
+    uint64_t Restarts;
+    uint64_t Steps;                                 // restarts for a step in the sample count
+    uint64_t RateChanges;                           // restarts for a DDC rate change
+    uint64_t Gaps;                                  // restarts for a gap in DMAs
+} TClockCorrStatistics;
+
+
+//
+// start of a run: restart the estimate
+//
+void ClockCorrRestart(void);
+
+
+//
+// called by the DDC thread after each DMA is demultiplexed
+// Samples: samples demultiplexed so far, per DDC
+// HostNs: CLOCK_MONOTONIC time the DMA was started
+//
+void ClockCorrAddDMA(uint64_t* Samples, int64_t HostNs);
+
+
+//
+// same, with the DDC rates (ksps) given: used by the check
+//
+void ClockCorrAddDMARates(uint64_t* Samples, uint32_t* Rates, int64_t HostNs);
+
+
+//
+// copy the current mapping
+// returns true if there is no valid mapping
+//
+bool ClockCorrGetMapping(TClockMapping* Dest);
+
+
+//
+// convert a DDC sample count to time on a host clock (CLOCK_MONOTONIC,
+// CLOCK_TAI or CLOCK_REALTIME). SigmaNs (if not NULL) gets the standard
+// error of the result. A DDC's count is placed to within one of its
+// sample periods.
+// returns true if there is no valid mapping, or the DDC was not running at the anchor
+//
+bool ClockCorrSampleToNs(uint32_t DDC, uint64_t SampleCount, clockid_t Clock, int64_t* Ns, double* SigmaNs);
+
+
+//
+// print the mapping and statistics, at the end of a run
+//
+void PrintClockCorrReport(void);
+
+
+//
+// check the estimate against simulated DMA timing with injected jitter,
+// outliers, a sample count step and a rate change
+// returns true if failed
+//
+bool RunClockCorrCheck(void);
+
+
+#endif
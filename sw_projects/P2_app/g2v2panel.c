@@ -60,7 +60,7 @@ pthread_t G2V1AdapterSerialThread;                    // thread wfor serial read
 uint8_t G2V2PanelSWID;
 uint8_t G2V2PanelHWVersion;
 uint8_t G2V2PanelProductID;
-uint8_t CATPollCntr;                                // determines which message to poll for
+bool G2CATSubscribed = false;                       // true if subscribed to VFO state, 2 tone and RX1/RX2
 bool G2ToneState;                                   // true if 2 tone test in progress
 bool GVFOBSelected;                                 // true if VFO B selected
 uint32_t GCombinedVFOState;                         // reported VFO state bits
@@ -71,6 +71,7 @@ bool ATUGreenLED = false;                           // LED states
 
 
 #define VKEEPALIVECOUNT 150                         // 15s period between keepalive requests (based on 100ms tick)
+#define VG2CATINTERVAL 300                          // ms between CAT state updates
 
 
 #define G2ARDUINOPATH "/dev/ttyAMA1"                // G2 panel, Raspberry pi serial port
@@ -183,27 +184,23 @@ void* G2V2PanelTick(__attribute__((unused)) void *arg)
         else
             G2V2CATDetected = false;
 //
-// poll CAT, if we haven't been sent an indicator message
+// subscribe to CAT state, if we haven't been sent an indicator message
+// the CAT handler polls for these, and calls the handlers only when they change
 //
-        if(GZZZIReceived == false)
-            switch(CATPollCntr++)
-            {
-                case 0:
-                    MakeCATMessageNoParam(DESTTCPCATPORT, eZZXV);
-                    break;
-
-                case 1:
-                    MakeCATMessageNoParam(DESTTCPCATPORT, eZZUT);
-                    break;
-
-                case 2:
-                    MakeCATMessageNoParam(DESTTCPCATPORT, eZZYR);
-                    break;
-
-                default:
-                    CATPollCntr = 0;
-                    break;
-            }
+        if((GZZZIReceived == false) && !G2CATSubscribed)
+        {
+            CATSubscribe(DESTLOCALCAT, GCATCommands[eZZXV].CATString, VG2CATINTERVAL);
+            CATSubscribe(DESTLOCALCAT, GCATCommands[eZZUT].CATString, VG2CATINTERVAL);
+            CATSubscribe(DESTLOCALCAT, GCATCommands[eZZYR].CATString, VG2CATINTERVAL);
+            G2CATSubscribed = true;
+        }
+        else if(GZZZIReceived && G2CATSubscribed)
+        {
+            CATUnsubscribe(DESTLOCALCAT, GCATCommands[eZZXV].CATString);
+            CATUnsubscribe(DESTLOCALCAT, GCATCommands[eZZUT].CATString);
+            CATUnsubscribe(DESTLOCALCAT, GCATCommands[eZZYR].CATString);
+            G2CATSubscribed = false;
+        }
 //
 // Set LEDs from values reported by CAT messages
 // store into NewLEDStates; then set to I2C create ZZZI if different from what we had before
@@ -0,0 +1,1086 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// handoff.c:
+//
+// upgrade without stopping the streams. The running instance listens on a
+// Unix stream socket. The new instance connects before it touches the
+// hardware, and asks for the handover once its own setup is done, just
+// before it would make its sockets. The old instance then:
+// - asks each streaming thread to park at its next checkpoint (a point in
+//   its loop where nothing is half done) and waits for them all; each
+//   leaves the state its successor needs, eg sequence counts and samples
+//   not yet sent;
+// - sends the socket and XDMA device file descriptors (SCM_RIGHTS), the
+//   register shadow copies, the client session and the thread states;
+// - waits for the new instance to confirm, then exits without shutting
+//   anything down. If it does not confirm, the threads carry on.
+// meanwhile the FPGA keeps filling the DDC and mic FIFOs, so nothing is
+// lost unless the gap is longer than a FIFO holds.
+//
+//////////////////////////////////////////////////////////////
+
+#include "threaddata.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../common/saturnregisters.h"
+#include "securestream.h"
+#include "tenant.h"
+#include "handoff.h"
+
+
+#define VHOMAGIC 0x50324855                         // "P2HU"
+#define VHOVERSION 2                                // changes whenever the message or a thread state changes
+#define VHOMAXFDS (VPORTTABLESIZE + eHONumDevices)
+#define VHOPOLLUS 200                               // park and wait poll period
+#define VHOACK 0x41                                 // new instance's confirmation byte
+
+
+typedef enum
+{
+    eHOAccepted,
+    eHOVersionMismatch,                             // the other build's state layout differs
+    eHOTransmitting,                                // not while transmitting
+    eHOUnsupported,                                 // tenant sessions and encryption nonces can't be handed over
+    eHOThreadsBusy,                                 // a thread didn't reach a checkpoint in time
+    eHOStateTooLarge,
+    eHONumResults
+} EHOResult;
+
+
+//
+// request (new to old: Magic, Version, ShadowSize, ShadowLayout) and reply (old to new)
+// the reply is followed by the register shadows, then each thread's state
+//
+typedef struct
+{
+    uint32_t Magic;
+    uint32_t Version;
+    uint32_t ShadowSize;
+    uint32_t ShadowLayout;                          // RegisterShadowLayout(): both builds must match
+    uint32_t Result;                                // EHOResult
+    uint32_t FdCount;
+    int8_t SocketIndex[VPORTTABLESIZE];             // fd for each SocketData[] slot, -1 if none
+    uint16_t Portid[VPORTTABLESIZE];
+    int8_t DeviceIndex[eHONumDevices];
+    struct sockaddr_in ReplyAddr;
+    bool SDRActive;
+    bool ReplyAddressSet;
+    bool StartBitReceived;
+    uint64_t ParkNs[eHONumThreads];                 // CLOCK_MONOTONIC when each thread parked
+    uint32_t StateLength[eHONumThreads];
+    uint32_t TotalLength;                           // bytes that follow
+} THOMessage;
+
+
+static const char* HOResultNames[eHONumResults] =
+{
+    "accepted",
+    "the other instance is a different build",
+    "transmitting",
+    "partitioned DDCs (-M) or encrypted datagrams (-K) in use",
+    "streaming threads did not stop in time",
+    "state too large"
+};
+
+static const char* HOThreadNames[eHONumThreads] =
+{
+    "command", "DDC specific", "DUC specific", "high priority in", "speaker audio",
+    "DUC I/Q", "high priority out", "mic", "DDC I/Q", "wideband"
+};
+
+
+static char HOPath[sizeof(((struct sockaddr_un*)0)->sun_path)];
+static bool HOPathSet = false;
+static int HOListenSocket = -1;
+static pthread_t HOListenThread;
+static bool HOExitOnHandover = true;                // false in the check: the old instance stays parked
+// old instance
+static _Atomic(bool) HOFreeze;
+static _Atomic(uint32_t) HORunning;                 // 1 bit per registered thread
+static _Atomic(uint32_t) HOParked;
+static uint8_t* HOParkState[eHONumThreads];
+static uint32_t HOParkLength[eHONumThreads];
+static uint64_t HOParkNs[eHONumThreads];
+static int HODeviceFd[eHONumDevices];
+static bool HODeviceSet[eHONumDevices];
+static uint32_t HOHandovers, HOAbandoned;
+// new instance
+static int HOConnection = -1;
+static bool HOTakingOver = false;
+static THOMessage HOReply;
+static int HOFds[VHOMAXFDS];
+static bool HOSocketTaken[VPORTTABLESIZE];
+static bool HODeviceTaken[eHONumDevices];
+static uint8_t* HOReceived;
+static uint8_t* HOThreadState[eHONumThreads];
+static bool HOStateGiven[eHONumThreads];
+static bool HOResumePending[eHONumThreads];
+static uint64_t HOResumeGapNs;                      // DDC I/Q (or the check's stream)
+static uint64_t HOResumeLost;
+
+
+static uint64_t HONowNs(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (uint64_t)Now.tv_sec * 1000000000ULL + Now.tv_nsec;
+}
+
+
+//
+// write all of a block to a stream socket
+// returns true if error
+//
+static bool HOWrite(int Socket, void* Data, uint32_t Length)
+{
+    uint8_t* Ptr = (uint8_t*)Data;
+    ssize_t Written;
+
+    while (Length != 0)
+    {
+        Written = send(Socket, Ptr, Length, MSG_NOSIGNAL);
+        if (Written <= 0)
+        {
+            if ((Written < 0) && (errno == EINTR))
+                continue;
+            return true;
+        }
+        Ptr += Written;
+        Length -= Written;
+    }
+    return false;
+}
+
+
+//
+// wait for data, up to TimeoutMs
+// returns true if none arrived
+//
+static bool HOWait(int Socket, int TimeoutMs)
+{
+    struct pollfd Poll;
+
+    Poll.fd = Socket;
+    Poll.events = POLLIN;
+    Poll.revents = 0;
+    return poll(&Poll, 1, TimeoutMs) <= 0;
+}
+
+
+//
+// read all of a block from a stream socket, each part within TimeoutMs
+// returns true if error, timeout or closed
+//
+static bool HORead(int Socket, void* Data, uint32_t Length, int TimeoutMs)
+{
+    uint8_t* Ptr = (uint8_t*)Data;
+    ssize_t Read;
+
+    while (Length != 0)
+    {
+        if (HOWait(Socket, TimeoutMs))
+            return true;
+        Read = recv(Socket, Ptr, Length, 0);
+        if (Read <= 0)
+        {
+            if ((Read < 0) && (errno == EINTR))
+                continue;
+            return true;
+        }
+        Ptr += Read;
+        Length -= Read;
+    }
+    return false;
+}
+
+
+//
+// send a message with file descriptors attached
+// returns true if error
+//
+static bool HOSendMessage(int Socket, THOMessage* Msg, int* Fds, uint32_t FdCount)
+{
+    struct msghdr Header;
+    struct iovec Vec;
+    struct cmsghdr* Control;
+    union
+    {
+        char Buffer[CMSG_SPACE(sizeof(int) * VHOMAXFDS)];
+        struct cmsghdr Align;
+    } ControlData;
+
+    memset(&Header, 0, sizeof(Header));
+    memset(&ControlData, 0, sizeof(ControlData));
+    Vec.iov_base = Msg;
+    Vec.iov_len = sizeof(THOMessage);
+    Header.msg_iov = &Vec;
+    Header.msg_iovlen = 1;
+    if (FdCount != 0)
+    {
+        Header.msg_control = ControlData.Buffer;
+        Header.msg_controllen = CMSG_SPACE(sizeof(int) * FdCount);
+        Control = CMSG_FIRSTHDR(&Header);
+        Control->cmsg_level = SOL_SOCKET;
+        Control->cmsg_type = SCM_RIGHTS;
+        Control->cmsg_len = CMSG_LEN(sizeof(int) * FdCount);
+        memcpy(CMSG_DATA(Control), Fds, sizeof(int) * FdCount);
+    }
+    if (sendmsg(Socket, &Header, MSG_NOSIGNAL) != (ssize_t)sizeof(THOMessage))
+        return true;
+    return false;
+}
+
+
+//
+// receive a message and any file descriptors attached (set close on exec)
+// FdCount is set to the number received
+// returns true if error
+//
+static bool HOReceiveMessage(int Socket, THOMessage* Msg, int* Fds, uint32_t* FdCount, int TimeoutMs)
+{
+    struct msghdr Header;
+    struct iovec Vec;
+    struct cmsghdr* Control;
+    ssize_t Read;
+    union
+    {
+        char Buffer[CMSG_SPACE(sizeof(int) * VHOMAXFDS)];
+        struct cmsghdr Align;
+    } ControlData;
+
+    *FdCount = 0;
+    if (HOWait(Socket, TimeoutMs))
+        return true;
+    memset(&Header, 0, sizeof(Header));
+    Vec.iov_base = Msg;
+    Vec.iov_len = sizeof(THOMessage);
+    Header.msg_iov = &Vec;
+    Header.msg_iovlen = 1;
+    Header.msg_control = ControlData.Buffer;
+    Header.msg_controllen = sizeof(ControlData.Buffer);
+    Read = recvmsg(Socket, &Header, MSG_CMSG_CLOEXEC);
+    if (Read <= 0)
+        return true;
+    for (Control = CMSG_FIRSTHDR(&Header); Control != NULL; Control = CMSG_NXTHDR(&Header, Control))
+        if ((Control->cmsg_level == SOL_SOCKET) && (Control->cmsg_type == SCM_RIGHTS))
+        {
+            *FdCount = (Control->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(Fds, CMSG_DATA(Control), sizeof(int) * *FdCount);
+        }
+    //
+    // the rest of the message, if the stream split it
+    //
+    if ((Read < (ssize_t)sizeof(THOMessage)) && HORead(Socket, (uint8_t*)Msg + Read, sizeof(THOMessage) - Read, TimeoutMs))
+        return true;
+    return (Msg->Magic != VHOMAGIC);
+}
+
+
+//
+// connect to an instance listening at a path
+// returns the connection, or -1 if none
+//
+static int HOConnectPath(char* Path)
+{
+    struct sockaddr_un Addr;
+    int Socket;
+
+    Socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (Socket < 0)
+        return -1;
+    memset(&Addr, 0, sizeof(Addr));
+    Addr.sun_family = AF_UNIX;
+    strncpy(Addr.sun_path, Path, sizeof(Addr.sun_path) - 1);
+    if (connect(Socket, (struct sockaddr*)&Addr, sizeof(Addr)) < 0)
+    {
+        close(Socket);
+        return -1;
+    }
+    return Socket;
+}
+
+
+//
+// look for -U <path> in the command line; connect if an instance listens there
+// returns true if this instance will take over from it
+//
+bool HandoffConnect(int argc, char** argv)
+{
+    int Arg;
+    char* Setting = NULL;
+
+    for (Arg = 1; Arg < argc; Arg++)
+        if (strncmp(argv[Arg], "-U", 2) == 0)
+        {
+            if (argv[Arg][2] != 0)
+                Setting = argv[Arg] + 2;
+            else if (Arg + 1 < argc)
+                Setting = argv[Arg + 1];
+        }
+    if ((Setting == NULL) || (strcmp(Setting, "check") == 0))
+        return false;
+    if (strlen(Setting) >= sizeof(HOPath))
+    {
+        printf("upgrade socket path %s is too long; not used\n", Setting);
+        return false;
+    }
+    strcpy(HOPath, Setting);
+    HOPathSet = true;
+    HOConnection = HOConnectPath(HOPath);
+    if (HOConnection < 0)
+        return false;
+    printf("upgrade: found a running instance at %s; taking over from it (hardware not initialised)\n", HOPath);
+    return true;
+}
+
+
+//
+// new instance: ask for the handover, and take the sockets, devices and state
+// returns true if refused or failed
+//
+bool HandoffReceive(void)
+{
+    THOMessage Request;
+    uint32_t FdCount, Fd, Slot, Thread;
+    uint8_t* Ptr;
+    uint8_t Ack = VHOACK;
+    uint64_t Start = HONowNs();
+
+    memset(&Request, 0, sizeof(Request));
+    Request.Magic = VHOMAGIC;
+    Request.Version = VHOVERSION;
+    Request.ShadowSize = RegisterShadowSize();
+    Request.ShadowLayout = RegisterShadowLayout();
+    if (HOWrite(HOConnection, &Request, sizeof(Request))
+        || HOReceiveMessage(HOConnection, &HOReply, HOFds, &FdCount, VHOPARKMS + VHOREPLYMS))
+    {
+        printf("upgrade: no reply from the running instance\n");
+        return true;
+    }
+    if (HOReply.Result != eHOAccepted)
+    {
+        printf("upgrade refused: %s\n", (HOReply.Result < eHONumResults) ? HOResultNames[HOReply.Result] : "unknown reason");
+        return true;
+    }
+    if ((FdCount != HOReply.FdCount) || (HOReply.TotalLength > VHOMAXSTATE))
+    {
+        printf("upgrade: handover message not valid\n");
+        return true;
+    }
+    HOReceived = malloc(HOReply.TotalLength + 1);
+    if ((HOReceived == NULL) || HORead(HOConnection, HOReceived, HOReply.TotalLength, VHOREPLYMS))
+    {
+        printf("upgrade: state not received\n");
+        return true;
+    }
+    if (RestoreRegisterShadows(HOReceived, HOReply.ShadowSize, HOReply.ShadowLayout))
+    {
+        printf("upgrade: register shadow layout differs\n");
+        return true;
+    }
+
+    //
+    // session, port numbers and thread states
+    //
+    memcpy(&reply_addr, &HOReply.ReplyAddr, sizeof(reply_addr));
+    ReplyAddressSet = HOReply.ReplyAddressSet;
+    StartBitReceived = HOReply.StartBitReceived;
+    SDRActive = HOReply.SDRActive;
+    for (Slot = 0; Slot < VPORTTABLESIZE; Slot++)
+        SocketData[Slot].Portid = HOReply.Portid[Slot];
+    Ptr = HOReceived + HOReply.ShadowSize;
+    for (Thread = 0; Thread < eHONumThreads; Thread++)
+    {
+        HOThreadState[Thread] = Ptr;
+        HOResumePending[Thread] = (HOReply.StateLength[Thread] != 0);
+        Ptr += HOReply.StateLength[Thread];
+    }
+    if (HOWrite(HOConnection, &Ack, 1))
+    {
+        printf("upgrade: the running instance went away\n");
+        for (Fd = 0; Fd < FdCount; Fd++)
+            close(HOFds[Fd]);
+        return true;
+    }
+    close(HOConnection);
+    HOConnection = -1;
+    HOTakingOver = true;
+    printf("upgrade: took over %d file descriptors and %d bytes of state in %.1fms; client session %s\n",
+           FdCount, HOReply.TotalLength, (double)(HONowNs() - Start) / 1e6, SDRActive ? "active" : "not active");
+    return false;
+}
+
+
+//
+// new instance: take over the socket for a SocketData[] slot
+//
+bool HandoffAdoptSocket(uint32_t Slot, int* Socketid)
+{
+    if (!HOTakingOver || (Slot >= VPORTTABLESIZE) || HOSocketTaken[Slot] || (HOReply.SocketIndex[Slot] < 0))
+        return false;
+    HOSocketTaken[Slot] = true;
+    *Socketid = HOFds[(int)HOReply.SocketIndex[Slot]];
+    return true;
+}
+
+
+//
+// XDMA DMA devices
+//
+int HandoffAdoptDevice(EHandoffDevice Device)
+{
+    if (!HOTakingOver || HODeviceTaken[Device] || (HOReply.DeviceIndex[Device] < 0))
+        return -1;
+    HODeviceTaken[Device] = true;
+    return HOFds[(int)HOReply.DeviceIndex[Device]];
+}
+
+
+void HandoffRegisterDevice(EHandoffDevice Device, int fd)
+{
+    HODeviceFd[Device] = fd;
+    HODeviceSet[Device] = (fd >= 0);
+}
+
+
+//
+// streaming thread calls
+//
+void HandoffRegisterThread(EHandoffThread Thread)
+{
+    atomic_fetch_or(&HORunning, 1U << Thread);
+}
+
+
+void* HandoffThreadState(EHandoffThread Thread, uint32_t* Length)
+{
+    *Length = 0;
+    if (!HOTakingOver || HOStateGiven[Thread] || (HOReply.StateLength[Thread] == 0))
+        return NULL;
+    HOStateGiven[Thread] = true;
+    *Length = HOReply.StateLength[Thread];
+    return HOThreadState[Thread];
+}
+
+
+bool HandoffFreezing(void)
+{
+    return atomic_load(&HOFreeze);
+}
+
+
+void HandoffPark(EHandoffThread Thread, void* State, uint32_t Length)
+{
+    uint8_t* Copy;
+
+    if (Length > HOParkLength[Thread])
+    {
+        Copy = realloc(HOParkState[Thread], Length);
+        if (Copy == NULL)
+            Length = 0;                             // successor starts the stream afresh
+        else
+            HOParkState[Thread] = Copy;
+    }
+    if (Length != 0)
+        memcpy(HOParkState[Thread], State, Length);
+    HOParkLength[Thread] = Length;
+    HOParkNs[Thread] = HONowNs();
+    atomic_fetch_or(&HOParked, 1U << Thread);
+    while (atomic_load(&HOFreeze))
+        usleep(VHOPOLLUS);
+    atomic_fetch_and(&HOParked, ~(1U << Thread));
+}
+
+
+void HandoffStreamResumed(EHandoffThread Thread, bool Overflowed, uint32_t SampleRate, uint32_t FIFOSamples)
+{
+    uint64_t Gap, Arrived, Lost = 0;
+
+    if (!HOResumePending[Thread])
+        return;
+    HOResumePending[Thread] = false;
+    Gap = HONowNs() - HOReply.ParkNs[Thread];
+    if (Overflowed)
+    {
+        Arrived = Gap * SampleRate / 1000000000ULL;
+        Lost = (Arrived > FIFOSamples) ? Arrived - FIFOSamples : 1;     // at least one, if it overflowed
+    }
+    if (Thread == eHODDCIQ)
+    {
+        HOResumeGapNs = Gap;
+        HOResumeLost = Lost;
+    }
+    if (Overflowed)
+        printf("upgrade: %s resumed %.1fms after the old instance stopped; FIFO overflowed, about %llu samples lost\n",
+               HOThreadNames[Thread], (double)Gap / 1e6, (unsigned long long)Lost);
+    else
+        printf("upgrade: %s resumed %.1fms after the old instance stopped; no samples lost\n",
+               HOThreadNames[Thread], (double)Gap / 1e6);
+}
+
+
+//
+// old instance: serve one request from a new instance
+// returns only if the handover did not happen (or in the check)
+//
+static void HOServe(int Connection)
+{
+    THOMessage Request, Reply;
+    int Fds[VHOMAXFDS];
+    uint32_t FdCount = 0, Slot, Other, Thread, Device, Running;
+    uint32_t Length;
+    uint8_t* Buffer = NULL;
+    uint8_t* Ptr;
+    uint8_t Ack = 0;
+    uint64_t FreezeNs, Deadline;
+
+    if (HORead(Connection, &Request, sizeof(Request), VHOREPLYMS) || (Request.Magic != VHOMAGIC))
+        return;
+    memset(&Reply, 0, sizeof(Reply));
+    Reply.Magic = VHOMAGIC;
+    Reply.Version = VHOVERSION;
+    Reply.ShadowSize = RegisterShadowSize();
+    Reply.ShadowLayout = RegisterShadowLayout();
+    if ((Request.Version != VHOVERSION) || (Request.ShadowSize != Reply.ShadowSize)
+        || (Request.ShadowLayout != Reply.ShadowLayout))
+        Reply.Result = eHOVersionMismatch;
+    else if (IsTXMode)
+        Reply.Result = eHOTransmitting;
+    else if (TenantsEnabled() || SecureStreamsEnabled())
+        Reply.Result = eHOUnsupported;
+
+    //
+    // park the streaming threads
+    //
+    FreezeNs = HONowNs();
+    if (Reply.Result == eHOAccepted)
+    {
+        atomic_store(&HOFreeze, true);
+        Deadline = FreezeNs + VHOPARKMS * 1000000ULL;
+        Running = atomic_load(&HORunning);
+        while (((atomic_load(&HOParked) & Running) != Running) && (HONowNs() < Deadline))
+            usleep(VHOPOLLUS);
+        if ((atomic_load(&HOParked) & Running) != Running)
+            Reply.Result = eHOThreadsBusy;
+    }
+
+    //
+    // gather the sockets (each once: some slots share a socket) and devices
+    //
+    if (Reply.Result == eHOAccepted)
+    {
+        for (Slot = 0; Slot < VPORTTABLESIZE; Slot++)
+        {
+            Reply.Portid[Slot] = SocketData[Slot].Portid;
+            Reply.SocketIndex[Slot] = -1;
+            if (SocketData[Slot].Socketid <= 0)
+                continue;
+            for (Other = 0; Other < Slot; Other++)
+                if ((Reply.SocketIndex[Other] >= 0) && (SocketData[Other].Socketid == SocketData[Slot].Socketid))
+                    Reply.SocketIndex[Slot] = Reply.SocketIndex[Other];
+            if (Reply.SocketIndex[Slot] < 0)
+            {
+                Reply.SocketIndex[Slot] = FdCount;
+                Fds[FdCount++] = SocketData[Slot].Socketid;
+            }
+        }
+        for (Device = 0; Device < eHONumDevices; Device++)
+        {
+            Reply.DeviceIndex[Device] = -1;
+            if (HODeviceSet[Device])
+            {
+                Reply.DeviceIndex[Device] = FdCount;
+                Fds[FdCount++] = HODeviceFd[Device];
+            }
+        }
+        Reply.FdCount = FdCount;
+        memcpy(&Reply.ReplyAddr, &reply_addr, sizeof(reply_addr));
+        Reply.SDRActive = SDRActive;
+        Reply.ReplyAddressSet = ReplyAddressSet;
+        Reply.StartBitReceived = StartBitReceived;
+
+        //
+        // register shadows, then each thread's state
+        //
+        Length = Reply.ShadowSize;
+        for (Thread = 0; Thread < eHONumThreads; Thread++)
+        {
+            Reply.ParkNs[Thread] = HOParkNs[Thread];
+            Reply.StateLength[Thread] = (Running & (1U << Thread)) ? HOParkLength[Thread] : 0;
+            Length += Reply.StateLength[Thread];
+        }
+        Reply.TotalLength = Length;
+        Buffer = malloc(Length);
+        if ((Buffer == NULL) || (Length > VHOMAXSTATE))
+            Reply.Result = eHOStateTooLarge;
+        else
+        {
+            SaveRegisterShadows(Buffer);
+            Ptr = Buffer + Reply.ShadowSize;
+            for (Thread = 0; Thread < eHONumThreads; Thread++)
+            {
+                memcpy(Ptr, HOParkState[Thread], Reply.StateLength[Thread]);
+                Ptr += Reply.StateLength[Thread];
+            }
+        }
+    }
+    if (Reply.Result != eHOAccepted)
+    {
+        Reply.FdCount = 0;
+        Reply.TotalLength = 0;
+        FdCount = 0;
+    }
+
+    //
+    // send, then wait for the new instance to confirm
+    //
+    if (!HOSendMessage(Connection, &Reply, Fds, FdCount) && (Reply.Result == eHOAccepted)
+        && !HOWrite(Connection, Buffer, Reply.TotalLength)
+        && !HORead(Connection, &Ack, 1, VHOREPLYMS) && (Ack == VHOACK))
+    {
+        HOHandovers++;
+        printf("upgrade: handed over %d file descriptors and %d bytes of state; streams stopped %.1fms ago\n",
+               FdCount, Reply.TotalLength, (double)(HONowNs() - FreezeNs) / 1e6);
+        free(Buffer);
+        if (HOExitOnHandover)
+        {
+            printf("upgrade: this instance exits; the new one continues\n");
+            fflush(stdout);
+            _exit(EXIT_SUCCESS);                    // no shutdown: the hardware and sockets carry on
+        }
+        return;                                     // check: stay parked
+    }
+    free(Buffer);
+    if (Reply.Result != eHOAccepted)
+        printf("upgrade request refused: %s\n", HOResultNames[Reply.Result]);
+    else
+    {
+        HOAbandoned++;
+        printf("upgrade abandoned: the new instance did not confirm; streams resume after %.1fms\n",
+               (double)(HONowNs() - FreezeNs) / 1e6);
+    }
+    atomic_store(&HOFreeze, false);
+}
+
+
+//
+// old instance: listener thread
+//
+static void* HOListen(__attribute__((unused)) void* arg)
+{
+    int Connection;
+
+    while (1)
+    {
+        Connection = accept4(HOListenSocket, NULL, NULL, SOCK_CLOEXEC);
+        if (Connection < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("upgrade socket accept");
+            break;
+        }
+        HOServe(Connection);
+        close(Connection);
+    }
+    return NULL;
+}
+
+
+//
+// listen for a later instance at the -U path
+// returns true if error
+//
+bool InitialiseHandoff(void)
+{
+    struct sockaddr_un Addr;
+
+    if (!HOPathSet)
+        return false;
+    HOListenSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (HOListenSocket < 0)
+    {
+        perror("upgrade socket");
+        return true;
+    }
+    memset(&Addr, 0, sizeof(Addr));
+    Addr.sun_family = AF_UNIX;
+    strcpy(Addr.sun_path, HOPath);
+    unlink(HOPath);                                 // the previous instance's, if any
+    if ((bind(HOListenSocket, (struct sockaddr*)&Addr, sizeof(Addr)) < 0) || (listen(HOListenSocket, 1) < 0))
+    {
+        perror("upgrade socket bind");
+        close(HOListenSocket);
+        return true;
+    }
+    if (pthread_create(&HOListenThread, NULL, HOListen, NULL) < 0)
+    {
+        perror("pthread_create upgrade listener");
+        return true;
+    }
+    pthread_detach(HOListenThread);
+    printf("upgrade: a new instance started with -U %s takes over from this one\n", HOPath);
+    return false;
+}
+
+
+
+
+//////////////////////////////////////////////////////////////
+//
+// check: the process running the check is the old instance, streaming
+// frames from a modelled FIFO (filled at a fixed rate since T0, so the
+// model carries on across processes). Two children forked at the start
+// are the new instances: the first takes the reply and goes away without
+// confirming, so the stream must resume; the second takes over and streams
+// until the end. A loopback client checks the frames: one source port,
+// sequence and sample index continuous, no long gap.
+//
+//////////////////////////////////////////////////////////////
+
+#define VHOCHKRATE 48000                            // modelled samples/s
+#define VHOCHKFIFOSAMPLES 16384                     // modelled FIFO (341ms)
+#define VHOCHKFRAME 238                             // samples per frame
+#define VHOCHKABANDONMS 250                         // 1st child asks, then goes away
+#define VHOCHKTAKEOVERMS 600                        // 2nd child takes over
+#define VHOCHKENDMS 1200                            // the 2nd child streams until
+#define VHOCHKCLIENTMS 1100                         // client stops at this many ms of samples
+#define VHOCHKDEADLINEMS 4000
+#define VHOCHKMAXGAPMS 250                          // allows for a slow virtual machine
+
+
+//
+// the stream's state, handed over
+//
+typedef struct
+{
+    uint64_t T0Ns;
+    uint64_t ReadIndex;                             // samples taken from the FIFO
+    uint64_t Lost;                                  // samples lost to overflow
+    uint32_t Sequence;
+} THOCheckStream;
+
+
+typedef struct
+{
+    uint32_t Sequence;
+    uint32_t Instance;                              // 0 = old instance; 1 = the one that took over
+    uint64_t Index;                                 // 1st sample
+} THOCheckFrame;
+
+
+typedef struct
+{
+    int Socket;
+    uint64_t EndIndex;
+    uint64_t DeadlineNs;
+    uint16_t SourcePort;
+    uint32_t Frames, FramesTakenOver, SequenceErrors, IndexErrors, SourceErrors;
+    uint64_t MaxGapNs;
+} THOCheckClient;
+
+
+static THOCheckStream HOCheckState;
+static int HOCheckStreamSocket;
+static struct sockaddr_in HOCheckDest;
+
+
+//
+// stream frames from the modelled FIFO until EndNs
+// the old instance parks at its checkpoint; the new one reports its resume
+//
+static bool HOCheckRunStream(uint32_t Instance, uint64_t EndNs, bool Resumed)
+{
+    THOCheckStream* St = &HOCheckState;
+    THOCheckFrame Frame;
+    uint64_t Available;
+    bool Overflowed;
+
+    while (HONowNs() < EndNs)
+    {
+        Available = (HONowNs() - St->T0Ns) * VHOCHKRATE / 1000000000ULL - St->ReadIndex;
+        Overflowed = (Available > VHOCHKFIFOSAMPLES);
+        if (Overflowed)
+        {
+            St->Lost += Available - VHOCHKFIFOSAMPLES;
+            St->ReadIndex += Available - VHOCHKFIFOSAMPLES;
+            Available = VHOCHKFIFOSAMPLES;
+        }
+        while (Available >= VHOCHKFRAME)
+        {
+            Frame.Sequence = St->Sequence++;
+            Frame.Instance = Instance;
+            Frame.Index = St->ReadIndex;
+            if (sendto(HOCheckStreamSocket, &Frame, sizeof(Frame), 0, (struct sockaddr*)&HOCheckDest, sizeof(HOCheckDest)) < 0)
+            {
+                perror("check stream send");
+                return true;
+            }
+            St->ReadIndex += VHOCHKFRAME;
+            Available -= VHOCHKFRAME;
+        }
+        if (Resumed)
+        {
+            HandoffStreamResumed(eHODDCIQ, Overflowed, VHOCHKRATE, VHOCHKFIFOSAMPLES);
+            Resumed = false;
+        }
+        if ((Instance == 0) && HandoffFreezing())
+            HandoffPark(eHODDCIQ, St, sizeof(THOCheckStream));
+        usleep(1000);
+    }
+    return false;
+}
+
+
+static void* HOCheckStreamThread(__attribute__((unused)) void* arg)
+{
+    HandoffRegisterThread(eHODDCIQ);
+    HOCheckRunStream(0, HOCheckState.T0Ns + VHOCHKDEADLINEMS * 1000000ULL, false);
+    return NULL;
+}
+
+
+static void* HOCheckClientThread(void* arg)
+{
+    THOCheckClient* Client = (THOCheckClient*)arg;
+    THOCheckFrame Frame;
+    struct sockaddr_in From;
+    socklen_t FromLength;
+    uint32_t NextSequence = 0;
+    uint64_t NextIndex = 0, Now, LastNs = 0;
+    ssize_t Size;
+
+    while (((Now = HONowNs()) < Client->DeadlineNs) && (NextIndex < Client->EndIndex))
+    {
+        FromLength = sizeof(From);
+        Size = recvfrom(Client->Socket, &Frame, sizeof(Frame), 0, (struct sockaddr*)&From, &FromLength);
+        if (Size != (ssize_t)sizeof(Frame))
+            continue;
+        Now = HONowNs();
+        if ((LastNs != 0) && (Now - LastNs > Client->MaxGapNs))
+            Client->MaxGapNs = Now - LastNs;
+        LastNs = Now;
+        Client->Frames++;
+        if (Frame.Instance != 0)
+            Client->FramesTakenOver++;
+        if (ntohs(From.sin_port) != Client->SourcePort)
+            Client->SourceErrors++;
+        if (Frame.Sequence != NextSequence)
+            Client->SequenceErrors++;
+        if (Frame.Index != NextIndex)
+            Client->IndexErrors++;
+        NextSequence = Frame.Sequence + 1;
+        NextIndex = Frame.Index + VHOCHKFRAME;
+    }
+    return NULL;
+}
+
+
+//
+// sleep until a time after T0
+//
+static void HOCheckSleepUntil(uint64_t T0Ns, uint32_t Ms)
+{
+    uint64_t Now = HONowNs();
+
+    if (Now < T0Ns + Ms * 1000000ULL)
+        usleep((T0Ns + Ms * 1000000ULL - Now) / 1000);
+}
+
+
+//
+// child that first asks as a build with a different register shadow layout
+// (same size), which must be refused; then asks for the handover, takes the
+// reply and goes away
+//
+static int HOCheckAbandonChild(void)
+{
+    THOMessage Request, Reply;
+    int Fds[VHOMAXFDS];
+    uint32_t FdCount;
+    int Socket;
+
+    HOCheckSleepUntil(HOCheckState.T0Ns, VHOCHKABANDONMS);
+    memset(&Request, 0, sizeof(Request));
+    Request.Magic = VHOMAGIC;
+    Request.Version = VHOVERSION;
+    Request.ShadowSize = RegisterShadowSize();
+    Request.ShadowLayout = RegisterShadowLayout() ^ 1;
+    Socket = HOConnectPath(HOPath);
+    if ((Socket < 0) || HOWrite(Socket, &Request, sizeof(Request))
+        || HOReceiveMessage(Socket, &Reply, Fds, &FdCount, VHOREPLYMS)
+        || (Reply.Result != eHOVersionMismatch) || (FdCount != 0))
+    {
+        printf("check: handover to a different shadow layout not refused\n");
+        return EXIT_FAILURE;
+    }
+    close(Socket);
+    Request.ShadowLayout = RegisterShadowLayout();
+    Socket = HOConnectPath(HOPath);
+    if ((Socket < 0) || HOWrite(Socket, &Request, sizeof(Request))
+        || HOReceiveMessage(Socket, &Reply, Fds, &FdCount, VHOREPLYMS)
+        || (Reply.Result != eHOAccepted) || (FdCount != 1))
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;                            // closes without confirming
+}
+
+
+//
+// child that takes over the stream
+//
+static int HOCheckTakeoverChild(void)
+{
+    void* State;
+    uint32_t Length;
+
+    HOCheckSleepUntil(HOCheckState.T0Ns, VHOCHKTAKEOVERMS);
+    HOConnection = HOConnectPath(HOPath);
+    if ((HOConnection < 0) || HandoffReceive())
+        return EXIT_FAILURE;
+    State = HandoffThreadState(eHODDCIQ, &Length);
+    if ((State == NULL) || (Length != sizeof(THOCheckStream)) || !HandoffAdoptSocket(VPORTDDCIQ0, &HOCheckStreamSocket))
+    {
+        printf("check: stream state or socket not handed over\n");
+        return EXIT_FAILURE;
+    }
+    memcpy(&HOCheckState, State, sizeof(THOCheckStream));
+    memcpy(&HOCheckDest, &reply_addr, sizeof(HOCheckDest));
+    if (HOCheckRunStream(1, HOCheckState.T0Ns + VHOCHKENDMS * 1000000ULL, true))
+        return EXIT_FAILURE;
+    return ((HOResumeLost == 0) && (HOCheckState.Lost == 0)) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+bool RunHandoffCheck(void)
+{
+    THOCheckClient Client;
+    struct sockaddr_in Addr;
+    socklen_t AddrLength = sizeof(Addr);
+    struct timeval Timeout = {0, 10000};
+    pthread_t StreamThread, ClientThread;
+    pid_t Children[2];
+    int Status[2], Child;
+    bool Failed = false;
+
+    printf("upgrade handover check: stream %d samples/s from a modelled FIFO of %d samples\n", VHOCHKRATE, VHOCHKFIFOSAMPLES);
+    snprintf(HOPath, sizeof(HOPath), "/tmp/p2app-handoff-check-%d", (int)getpid());
+    HOPathSet = true;
+    HOExitOnHandover = false;
+
+    //
+    // the stream socket (passed to the new instance) and the client
+    //
+    memset(&Client, 0, sizeof(Client));
+    HOCheckStreamSocket = socket(AF_INET, SOCK_DGRAM, 0);
+    Client.Socket = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&Addr, 0, sizeof(Addr));
+    Addr.sin_family = AF_INET;
+    Addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((HOCheckStreamSocket < 0) || (Client.Socket < 0)
+        || (bind(HOCheckStreamSocket, (struct sockaddr*)&Addr, sizeof(Addr)) < 0)
+        || (bind(Client.Socket, (struct sockaddr*)&Addr, sizeof(Addr)) < 0))
+    {
+        perror("check sockets");
+        return true;
+    }
+    setsockopt(Client.Socket, SOL_SOCKET, SO_RCVTIMEO, &Timeout, sizeof(Timeout));
+    getsockname(HOCheckStreamSocket, (struct sockaddr*)&Addr, &AddrLength);
+    Client.SourcePort = ntohs(Addr.sin_port);
+    AddrLength = sizeof(HOCheckDest);
+    getsockname(Client.Socket, (struct sockaddr*)&HOCheckDest, &AddrLength);
+    memcpy(&reply_addr, &HOCheckDest, sizeof(reply_addr));
+    SDRActive = true;
+    SocketData[VPORTDDCIQ0].Socketid = HOCheckStreamSocket;
+
+    //
+    // fork the new instances before any thread starts; they keep only what is handed over
+    //
+    memset(&HOCheckState, 0, sizeof(HOCheckState));
+    HOCheckState.T0Ns = HONowNs();
+    fflush(stdout);
+    for (Child = 0; Child < 2; Child++)
+    {
+        Children[Child] = fork();
+        if (Children[Child] == 0)
+        {
+            close(HOCheckStreamSocket);
+            close(Client.Socket);
+            Status[0] = (Child == 0) ? HOCheckAbandonChild() : HOCheckTakeoverChild();
+            fflush(stdout);
+            _exit(Status[0]);
+        }
+        if (Children[Child] < 0)
+        {
+            perror("check fork");
+            return true;
+        }
+    }
+
+    //
+    // this process is the old instance
+    //
+    Client.EndIndex = (uint64_t)VHOCHKRATE * VHOCHKCLIENTMS / 1000;
+    Client.DeadlineNs = HOCheckState.T0Ns + VHOCHKDEADLINEMS * 1000000ULL;
+    if (InitialiseHandoff()
+        || (pthread_create(&ClientThread, NULL, HOCheckClientThread, &Client) != 0)
+        || (pthread_create(&StreamThread, NULL, HOCheckStreamThread, NULL) != 0))
+    {
+        kill(Children[0], SIGKILL);
+        kill(Children[1], SIGKILL);
+        return true;
+    }
+    pthread_detach(StreamThread);
+    pthread_join(ClientThread, NULL);
+    waitpid(Children[0], &Status[0], 0);
+    waitpid(Children[1], &Status[1], 0);
+    unlink(HOPath);
+
+    printf("frames received %d (%d from the new instance); sequence errors %d, sample index errors %d, other source %d\n",
+           Client.Frames, Client.FramesTakenOver, Client.SequenceErrors, Client.IndexErrors, Client.SourceErrors);
+    printf("handovers %d, abandoned %d; longest gap between frames %.1fms\n", HOHandovers, HOAbandoned, (double)Client.MaxGapNs / 1e6);
+    if (!WIFEXITED(Status[0]) || (WEXITSTATUS(Status[0]) != EXIT_SUCCESS) || (HOAbandoned != 1))
+    {
+        printf("FAIL: abandoned handover not handled\n");
+        Failed = true;
+    }
+    if (!WIFEXITED(Status[1]) || (WEXITSTATUS(Status[1]) != EXIT_SUCCESS) || (HOHandovers != 1) || (Client.FramesTakenOver == 0))
+    {
+        printf("FAIL: new instance did not take over the stream without loss\n");
+        Failed = true;
+    }
+    if ((Client.SequenceErrors != 0) || (Client.IndexErrors != 0) || (Client.SourceErrors != 0)
+        || (Client.Frames < Client.EndIndex / VHOCHKFRAME))
+    {
+        printf("FAIL: stream not continuous from the same socket\n");
+        Failed = true;
+    }
+    if (Client.MaxGapNs > VHOCHKMAXGAPMS * 1000000ULL)
+    {
+        printf("FAIL: gap longer than %dms\n", VHOCHKMAXGAPMS);
+        Failed = true;
+    }
+    printf(Failed ? "upgrade handover check FAILED\n" : "upgrade handover check passed\n");
+    return Failed;
+}
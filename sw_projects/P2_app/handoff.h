@@ -0,0 +1,134 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// handoff.h:
+//
+// upgrade without stopping the streams: a running p2app listens on a Unix
+// socket. A newly started p2app given the same path connects to it, skips
+// hardware initialisation, and is handed the bound UDP sockets, the open
+// XDMA DMA devices, the register shadow copies, the client session and
+// each streaming thread's state. The old instance then exits without
+// touching the hardware, and the new one continues the streams.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __handoff_h
+#define __handoff_h
+
+
+#include <stdint.h>
+#include "../common/saturntypes.h"
+
+
+#define VHOPARKMS 200                               // streaming threads must reach a checkpoint within this
+#define VHOREPLYMS 2000                             // longest wait for the other instance at each step
+#define VHOMAXSTATE (1024 * 1024)                   // largest total of register, session and thread state
+
+
+//
+// threads that stop at a checkpoint for a handover
+//
+typedef enum
+{
+    eHOMain,                                        // command port (main loop)
+    eHODDCSpecific,
+    eHODUCSpecific,
+    eHOHighPriorityIn,
+    eHOSpkrAudio,
+    eHODUCIQ,
+    eHOHighPriorityOut,
+    eHOMic,
+    eHODDCIQ,
+    eHOWideband,
+    eHONumThreads
+} EHandoffThread;
+
+
+//
+// XDMA DMA devices handed over
+//
+typedef enum
+{
+    eHODevDDC,
+    eHODevDUC,
+    eHODevMic,
+    eHODevSpkr,
+    eHONumDevices
+} EHandoffDevice;
+
+
+//
+// look for -U <path> in the command line, before the hardware is set up.
+// If a running instance listens at the path, connect to it.
+// returns true if this instance will take over from it
+//
+bool HandoffConnect(int argc, char** argv);
+
+
+//
+// new instance: request the handover and receive the sockets, devices and
+// state. Called before any socket is made. Restores the register shadow
+// copies and the client session; the old instance exits.
+// returns true if refused or failed
+//
+bool HandoffReceive(void);
+
+
+//
+// new instance: take over the socket for a SocketData[] slot.
+// returns true if one was handed over (and sets Socketid)
+//
+bool HandoffAdoptSocket(uint32_t Slot, int* Socketid);
+
+
+//
+// XDMA DMA device file descriptors
+// HandoffAdoptDevice: new instance: the device handed over, or -1 if none (open it)
+// HandoffRegisterDevice: note a device, so it can be handed over later
+//
+int HandoffAdoptDevice(EHandoffDevice Device);
+void HandoffRegisterDevice(EHandoffDevice Device, int fd);
+
+
+//
+// streaming thread calls
+// HandoffRegisterThread: when the thread starts: a handover waits for it to park
+// HandoffThreadState: new instance: the thread's state from the old one, or NULL.
+//   Length is set to its size. The state is only given once.
+// HandoffFreezing: true if the thread should park at its next checkpoint
+// HandoffPark: save the thread's state (Length 0 if none) and wait. Returns
+//   only if the handover is abandoned; the thread then carries on.
+// HandoffStreamResumed: new instance: the thread has sent its first data.
+//   Reports the gap since the old instance parked, and samples lost if the
+//   stream's FIFO overflowed meanwhile (SampleRate: samples/s into the FIFO)
+//
+void HandoffRegisterThread(EHandoffThread Thread);
+void* HandoffThreadState(EHandoffThread Thread, uint32_t* Length);
+bool HandoffFreezing(void);
+void HandoffPark(EHandoffThread Thread, void* State, uint32_t Length);
+void HandoffStreamResumed(EHandoffThread Thread, bool Overflowed, uint32_t SampleRate, uint32_t FIFOSamples);
+
+
+//
+// listen for a later instance. Called when all threads have started.
+// returns true if error
+//
+bool InitialiseHandoff(void);
+
+
+//
+// check with two forked instances and a loopback client: one that abandons
+// the handover, then one that takes over a stream from a modelled FIFO.
+// The stream must continue from the same socket with no sequence gap.
+// returns true if the check fails
+//
+bool RunHandoffCheck(void);
+
+
+#endif
@@ -0,0 +1,809 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// iqhistory.c:
+//
+// I/Q history ("time machine"). One block of memory, allocated and touched
+// at startup, is divided into a ring per enabled DDC, sized in proportion
+// to its sample rate. After each DMA is demultiplexed, the DDC I/Q thread
+// copies the new samples of each DDC into its ring (one or two memcpy per
+// DDC) and counts them; nothing else is done on the streaming path, except
+// scanning one DDC for the level trigger if that is set.
+//
+// a trigger is taken by the DDC I/Q thread, which notes the current sample
+// count of every DDC. A separate low priority thread waits until the
+// post-trigger window has arrived, then copies the window out of the rings
+// a chunk at a time to disk. The rings are sized with a margin beyond the
+// two windows; a chunk is checked after it is copied in case the DDC thread
+// has overwritten it meanwhile (counted as lost). If the DDC sample rates
+// change, the rings are laid out again and any dump in progress is abandoned.
+//
+//////////////////////////////////////////////////////////////
+
+#include "threaddata.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "../common/saturnregisters.h"
+#include "../common/hwaccess.h"
+#include "iqhistory.h"
+
+
+#define VIHMARGINSECONDS 1                          // ring length beyond the two windows
+#define VIHSLACKSAMPLES 65536                       // most the DDC thread can write beyond its count
+#define VIHCHUNKBYTES (1024 * 1024)                 // dump copy size
+#define VIHPOLLMS 10                                // dump thread poll period
+#define VIHWAITMS 5000                              // longest wait beyond the post trigger window
+#define VIHFULLSCALE 8388608.0                      // 24 bit sample full scale
+#define VIHADCCLOCK 122880000.0                     // DDC frequency register reference
+#define VIHTWOEXP32 4294967296.0
+#define VIHNAMESIZE 320
+
+
+typedef enum
+{
+    eIHIdle,
+    eIHClaimed,                                     // a trigger is filling in its reason
+    eIHRequested,                                   // waiting for the DDC thread to take it
+    eIHCapturing                                    // taken; dump thread writes it after the post window
+} EIHState;
+
+
+//
+// one DDC's ring: written by the DDC I/Q thread, read by the dump thread
+//
+typedef struct
+{
+    uint8_t* Buffer;
+    uint64_t Capacity;                              // samples
+    uint32_t Rate;                                  // ksps it was laid out for; 0 if not recorded
+    _Atomic(uint64_t) Written;                      // samples written since laid out
+    uint64_t TriggerIndex;                          // sample count at the trigger
+} VCACHEALIGNED TIHRing;
+
+
+//
+// what the last dump wrote, for each DDC
+//
+typedef struct
+{
+    bool Written;
+    uint64_t TriggerIndex;
+    uint64_t FirstIndex;                            // 1st sample in the file
+    uint64_t Samples;
+    uint64_t Lost;
+    char FileName[VIHNAMESIZE];
+} TIHDumpResult;
+
+
+static TIHRing IHRings[VNUMDDC];
+static bool IHEnabled = false;
+static uint32_t IHPreSeconds, IHPostSeconds;
+static uint32_t IHMegaBytes = VIHDEFAULTMB;
+static char IHDirectory[200] = VIHDEFAULTDIR;
+static int IHTriggerDDC = -1;                       // level trigger DDC, or -1
+static double IHTriggerdBFS;
+static int64_t IHTriggerLevel;                      // as I*I + Q*Q
+static uint8_t* IHArena;
+static uint64_t IHArenaBytes;
+static double IHScale = 1.0;                        // fraction of the windows the memory holds at current rates
+static _Atomic(uint32_t) IHLayout;                  // odd while the rings are laid out again
+static _Atomic(int) IHState = eIHIdle;
+static _Atomic(bool) IHRestartRequested;
+static volatile sig_atomic_t IHSignalled = 0;
+static char IHReason[80];
+static struct timespec IHTriggerTime;               // host time when the trigger was taken
+static uint32_t IHTriggerLayout;
+static pthread_t IHDumpThread;
+static _Atomic(bool) IHStopDump;
+static TIHDumpResult IHLastDump[VNUMDDC];
+// DDC I/Q thread statistics
+static uint64_t IHCopyNs, IHCopySamples;
+// dump thread statistics
+static _Atomic(uint64_t) IHDumps;
+static uint64_t IHDumpBytes, IHDumpNs, IHLostSamples;
+
+
+static uint64_t IHNowNs(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (uint64_t)Now.tv_sec * 1000000000ULL + Now.tv_nsec;
+}
+
+
+//
+// parse a -R setting
+// returns true if not valid
+//
+bool ParseIQHistorySetting(char* Setting)
+{
+    unsigned int Pre, Post = 0, MB = VIHDEFAULTMB, DDC;
+    char Directory[200] = VIHDEFAULTDIR;
+    double dBFS, Amplitude;
+
+    if (strncmp(Setting, "trigger:", 8) == 0)
+    {
+        if ((sscanf(Setting + 8, "%u:%lf", &DDC, &dBFS) != 2) || (DDC >= VNUMDDC) || (dBFS > 0.0) || (dBFS < -140.0))
+            return true;
+        IHTriggerDDC = DDC;
+        IHTriggerdBFS = dBFS;
+        Amplitude = VIHFULLSCALE * pow(10.0, dBFS / 20.0);
+        IHTriggerLevel = (int64_t)(Amplitude * Amplitude);
+        return false;
+    }
+    if (sscanf(Setting, "%u,%u,%u,%199s", &Pre, &Post, &MB, Directory) < 1)
+        return true;
+    if ((Pre == 0) || (Pre > VIHMAXSECONDS) || (Post > VIHMAXSECONDS) || (MB == 0) || (MB > VIHMAXMB))
+        return true;
+    IHPreSeconds = Pre;
+    IHPostSeconds = Post;
+    IHMegaBytes = MB;
+    strcpy(IHDirectory, Directory);
+    IHEnabled = true;
+    return false;
+}
+
+
+//
+// true if I/Q history is set
+//
+bool IQHistoryEnabled(void)
+{
+    return IHEnabled;
+}
+
+
+static void IQHistorySignal(__attribute__((unused)) int Signal)
+{
+    IHSignalled = 1;
+}
+
+
+//
+// request a dump
+// returns true if one is already in progress
+//
+bool IQHistoryTrigger(char* Reason)
+{
+    int Expected = eIHIdle;
+
+    if (!IHEnabled)
+        return true;
+    if (!atomic_compare_exchange_strong(&IHState, &Expected, eIHClaimed))
+        return true;
+    strncpy(IHReason, Reason, sizeof(IHReason) - 1);
+    IHReason[sizeof(IHReason) - 1] = 0;
+    atomic_store(&IHState, eIHRequested);
+    return false;
+}
+
+
+//
+// divide the memory between the enabled DDCs by sample rate
+//
+static void LayOutRings(void)
+{
+    uint32_t DDC, Total = 0;
+    uint32_t Rates[VNUMDDC];
+    uint64_t Offset = 0;
+    double Seconds, Needed;
+    TIHRing* Ring;
+
+    atomic_fetch_add(&IHLayout, 1);                             // odd: rings changing
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+    {
+        Rates[DDC] = GetP2SampleRate(DDC);                      // once: another thread may change them
+        Total += Rates[DDC];
+    }
+    Seconds = IHPreSeconds + IHPostSeconds + VIHMARGINSECONDS;
+    Needed = Total * 1000.0 * VIHBYTESPERSAMPLE * Seconds;
+    IHScale = 1.0;
+    if (Needed > IHArenaBytes)
+        IHScale = IHArenaBytes / Needed;
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+    {
+        Ring = &IHRings[DDC];
+        Ring->Rate = Rates[DDC];
+        Ring->Capacity = (uint64_t)(Ring->Rate * 1000.0 * Seconds * IHScale);
+        Ring->Buffer = IHArena + Offset * VIHBYTESPERSAMPLE;
+        Offset += Ring->Capacity;
+        atomic_store(&Ring->Written, 0);
+    }
+    atomic_fetch_add(&IHLayout, 1);
+}
+
+
+//
+// allocate the history memory and start the dump thread
+// returns true if error
+//
+static void* IQHistoryDumper(void* arg);
+
+bool InitialiseIQHistory(void)
+{
+    struct sigaction Action;
+
+    if (!IHEnabled)
+        return false;
+    if (access(IHDirectory, W_OK) != 0)
+    {
+        printf("I/Q history: cannot write to directory %s\n", IHDirectory);
+        return true;
+    }
+    IHArenaBytes = (uint64_t)IHMegaBytes * 1024 * 1024;
+    IHArena = malloc(IHArenaBytes);
+    if (IHArena == NULL)
+    {
+        printf("I/Q history: cannot allocate %dMB\n", IHMegaBytes);
+        return true;
+    }
+    memset(IHArena, 0, IHArenaBytes);                           // fault the pages in now, not while streaming
+    if ((mlock(IHArena, IHArenaBytes) != 0) && UseDebug)
+        printf("I/Q history: memory not locked\n");
+
+    memset(&Action, 0, sizeof(Action));
+    Action.sa_handler = IQHistorySignal;
+    sigemptyset(&Action.sa_mask);
+    Action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &Action, NULL);
+
+    atomic_store(&IHStopDump, false);
+    atomic_store(&IHState, eIHIdle);
+    atomic_store(&IHRestartRequested, true);
+    if (pthread_create(&IHDumpThread, NULL, IQHistoryDumper, NULL) < 0)
+    {
+        perror("pthread_create I/Q history");
+        return true;
+    }
+    printf("I/Q history: %dMB, %ds before and %ds after a trigger; dumps to %s ('r' or SIGUSR1 to trigger)\n",
+           IHMegaBytes, IHPreSeconds, IHPostSeconds, IHDirectory);
+    if (IHTriggerDDC >= 0)
+        printf("I/Q history: triggered by DDC%d at %.1f dBFS\n", IHTriggerDDC, IHTriggerdBFS);
+    return false;
+}
+
+
+//
+// start of a run: the rings are laid out again
+//
+void IQHistoryRestart(void)
+{
+    atomic_store(&IHRestartRequested, true);
+}
+
+
+//
+// first sample at or above the trigger level, or -1
+//
+static int64_t FindTriggerLevel(uint8_t* Start, uint8_t* End)
+{
+    uint8_t* Sample;
+    int32_t I, Q;
+    int64_t Offset = 0;
+
+    for (Sample = Start; Sample + VIHBYTESPERSAMPLE <= End; Sample += VIHBYTESPERSAMPLE, Offset++)
+    {
+        I = (int32_t)(((uint32_t)Sample[0] << 24) | ((uint32_t)Sample[1] << 16) | ((uint32_t)Sample[2] << 8)) >> 8;
+        Q = (int32_t)(((uint32_t)Sample[3] << 24) | ((uint32_t)Sample[4] << 16) | ((uint32_t)Sample[5] << 8)) >> 8;
+        if ((int64_t)I * I + (int64_t)Q * Q >= IHTriggerLevel)
+            return Offset;
+    }
+    return -1;
+}
+
+
+//
+// copy the samples just demultiplexed into the rings
+//
+void IQHistoryAddSamples(unsigned char** Start, unsigned char** End)
+{
+    uint64_t StartNs, Count, Skip, Written, Position, First, Samples = 0;
+    int64_t TriggerOffset = -1;
+    uint32_t DDC, TriggerRate = 0;
+    bool Relayout, Capture;
+    char Reason[80];
+    TIHRing* Ring;
+
+    if (!IHEnabled)
+        return;
+    StartNs = IHNowNs();
+    Relayout = atomic_exchange(&IHRestartRequested, false);
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+        if (GetP2SampleRate(DDC) != IHRings[DDC].Rate)
+            Relayout = true;
+    if (Relayout)
+        LayOutRings();
+
+    //
+    // triggers
+    //
+    if (IHSignalled)
+    {
+        IHSignalled = 0;
+        IQHistoryTrigger("SIGUSR1");
+    }
+    if ((IHTriggerDDC >= 0) && (atomic_load(&IHState) == eIHIdle))
+    {
+        TriggerOffset = FindTriggerLevel(Start[IHTriggerDDC], End[IHTriggerDDC]);
+        TriggerRate = IHRings[IHTriggerDDC].Rate;
+        if ((TriggerOffset >= 0) && (TriggerRate != 0))
+        {
+            snprintf(Reason, sizeof(Reason), "level on DDC%d, %.1f dBFS", IHTriggerDDC, IHTriggerdBFS);
+            if (IQHistoryTrigger(Reason))
+                TriggerOffset = -1;
+        }
+        else
+            TriggerOffset = -1;
+    }
+    Capture = (atomic_load(&IHState) == eIHRequested);
+
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+    {
+        Ring = &IHRings[DDC];
+        Count = (End[DDC] - Start[DDC]) / VIHBYTESPERSAMPLE;
+        Written = atomic_load(&Ring->Written);
+        if (Capture)                                            // a level trigger is at its sample; a command is now
+            Ring->TriggerIndex = (TriggerOffset >= 0) ? Written + TriggerOffset * Ring->Rate / TriggerRate : Written + Count;
+        if ((Ring->Capacity == 0) || (Count == 0))
+            continue;
+        Skip = 0;
+        if (Count > Ring->Capacity)                             // only the newest fit
+            Skip = Count - Ring->Capacity;
+        Position = (Written + Skip) % Ring->Capacity;
+        First = Count - Skip;
+        if (First > Ring->Capacity - Position)
+            First = Ring->Capacity - Position;
+        memcpy(Ring->Buffer + Position * VIHBYTESPERSAMPLE, Start[DDC] + Skip * VIHBYTESPERSAMPLE, First * VIHBYTESPERSAMPLE);
+        if (Count - Skip > First)
+            memcpy(Ring->Buffer, Start[DDC] + (Skip + First) * VIHBYTESPERSAMPLE, (Count - Skip - First) * VIHBYTESPERSAMPLE);
+        atomic_store(&Ring->Written, Written + Count);
+        Samples += Count;
+    }
+    if (Capture)
+    {
+        clock_gettime(CLOCK_REALTIME, &IHTriggerTime);
+        IHTriggerLayout = atomic_load(&IHLayout);
+        atomic_store(&IHState, eIHCapturing);
+    }
+    IHCopyNs += IHNowNs() - StartNs;
+    IHCopySamples += Samples;
+}
+
+
+//
+// write one DDC's window to a file
+// returns bytes written
+//
+static uint64_t DumpRing(uint32_t DDC, uint8_t* Chunk, char* FileName, uint64_t Pre, uint64_t Post, TIHDumpResult* Result)
+{
+    TIHRing* Ring = &IHRings[DDC];
+    uint64_t Written, Slack, Oldest, Index, Last, Count, Position, Bytes = 0;
+    FILE* File;
+
+    memset(Result, 0, sizeof(*Result));
+    strcpy(Result->FileName, FileName);
+    Result->TriggerIndex = Ring->TriggerIndex;
+    Slack = VIHSLACKSAMPLES;
+    if (Slack > Ring->Capacity / 4)
+        Slack = Ring->Capacity / 4;
+    File = fopen(FileName, "wb");
+    if (File == NULL)
+    {
+        perror("I/Q history dump");
+        return 0;
+    }
+    Index = (Ring->TriggerIndex > Pre) ? Ring->TriggerIndex - Pre : 0;
+    Last = Ring->TriggerIndex + Post;
+    Written = atomic_load(&Ring->Written);
+    if (Last > Written)                                         // post window cut short
+        Last = Written;
+    Result->FirstIndex = Index;
+    while (Index < Last)
+    {
+        //
+        // copy a chunk, then check it was not overwritten while copied
+        //
+        Count = Last - Index;
+        if (Count > VIHCHUNKBYTES / VIHBYTESPERSAMPLE)
+            Count = VIHCHUNKBYTES / VIHBYTESPERSAMPLE;
+        Position = Index % Ring->Capacity;
+        if (Count > Ring->Capacity - Position)
+            Count = Ring->Capacity - Position;
+        memcpy(Chunk, Ring->Buffer + Position * VIHBYTESPERSAMPLE, Count * VIHBYTESPERSAMPLE);
+        if (atomic_load(&IHLayout) != IHTriggerLayout)
+            break;
+        Written = atomic_load(&Ring->Written);
+        Oldest = (Written + Slack > Ring->Capacity) ? Written + Slack - Ring->Capacity : 0;
+        if (Index < Oldest)
+        {
+            Result->Lost += Oldest - Index;
+            if (Result->Samples == 0)
+                Result->FirstIndex = Oldest;
+            Index = Oldest;
+            continue;
+        }
+        fwrite(Chunk, VIHBYTESPERSAMPLE, Count, File);
+        Bytes += Count * VIHBYTESPERSAMPLE;
+        Result->Samples += Count;
+        Index += Count;
+    }
+    fclose(File);
+    Result->Written = true;
+    return Bytes;
+}
+
+
+//
+// wait for the post trigger window, then write every recorded DDC's window and the metadata
+//
+static void DumpHistory(uint8_t* Chunk)
+{
+    char BaseName[VIHNAMESIZE - 16], FileName[VIHNAMESIZE], TimeText[32];
+    uint64_t Pre[VNUMDDC], Post[VNUMDDC];
+    uint64_t StartNs, DumpStartNs, Bytes = 0, Lost = 0, Ns;
+    uint32_t DDC, DDCs = 0;
+    struct tm Time;
+    FILE* Meta;
+    bool Waiting;
+    double Frequency;
+
+    StartNs = IHNowNs();
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+    {
+        Pre[DDC] = (uint64_t)(IHRings[DDC].Rate * 1000.0 * IHPreSeconds * IHScale);
+        Post[DDC] = (uint64_t)(IHRings[DDC].Rate * 1000.0 * IHPostSeconds * IHScale);
+    }
+    do
+    {
+        Waiting = false;
+        for (DDC = 0; DDC < VNUMDDC; DDC++)
+            if ((IHRings[DDC].Capacity != 0) && (atomic_load(&IHRings[DDC].Written) < IHRings[DDC].TriggerIndex + Post[DDC]))
+                Waiting = true;
+        if (atomic_load(&IHLayout) != IHTriggerLayout)
+        {
+            printf("I/Q history: dump abandoned, DDC sample rates changed\n");
+            return;
+        }
+        if (Waiting)
+            usleep(VIHPOLLMS * 1000);
+    } while (Waiting && !atomic_load(&IHStopDump) && (IHNowNs() - StartNs < (IHPostSeconds * 1000ULL + VIHWAITMS) * 1000000ULL));
+
+    gmtime_r(&IHTriggerTime.tv_sec, &Time);
+    strftime(TimeText, sizeof(TimeText), "%Y%m%d-%H%M%S", &Time);
+    snprintf(BaseName, sizeof(BaseName), "%s/iqhistory_%s_%03ld", IHDirectory, TimeText, IHTriggerTime.tv_nsec / 1000000);
+    snprintf(FileName, sizeof(FileName), "%s.txt", BaseName);
+    Meta = fopen(FileName, "w");
+    if (Meta == NULL)
+    {
+        perror("I/Q history metadata");
+        return;
+    }
+    strftime(TimeText, sizeof(TimeText), "%Y-%m-%d %H:%M:%S", &Time);
+    fprintf(Meta, "# Saturn p2app I/Q history dump\n");
+    fprintf(Meta, "trigger = %s\n", IHReason);
+    fprintf(Meta, "host time = %s.%09ld UTC (when the DDC thread took the trigger)\n", TimeText, IHTriggerTime.tv_nsec);
+    fprintf(Meta, "format = 24 bit signed big endian I then Q, %d bytes per sample\n", VIHBYTESPERSAMPLE);
+    fprintf(Meta, "pre trigger seconds = %.3f\n", IHPreSeconds * IHScale);
+    fprintf(Meta, "post trigger seconds = %.3f\n", IHPostSeconds * IHScale);
+
+    DumpStartNs = IHNowNs();
+    memset(IHLastDump, 0, sizeof(IHLastDump));
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+    {
+        if (IHRings[DDC].Capacity == 0)
+            continue;
+        snprintf(FileName, sizeof(FileName), "%s_ddc%d.iq", BaseName, DDC);
+        Bytes += DumpRing(DDC, Chunk, FileName, Pre[DDC], Post[DDC], &IHLastDump[DDC]);
+        Lost += IHLastDump[DDC].Lost;
+        Frequency = RegisterRead(DDCRegisters[DDC]) * VIHADCCLOCK / VIHTWOEXP32;
+        fprintf(Meta, "ddc%d = file %s, rate %d ksps, frequency %.0f Hz, %llu samples, first %lld relative to trigger, %llu lost\n",
+                DDC, strrchr(FileName, '/') + 1, IHRings[DDC].Rate, Frequency,
+                (unsigned long long)IHLastDump[DDC].Samples,
+                (long long)IHLastDump[DDC].FirstIndex - (long long)IHLastDump[DDC].TriggerIndex,
+                (unsigned long long)IHLastDump[DDC].Lost);
+        DDCs++;
+    }
+    if (atomic_load(&IHLayout) != IHTriggerLayout)
+        fprintf(Meta, "# incomplete: DDC sample rates changed during the dump\n");
+    fclose(Meta);
+    Ns = IHNowNs() - DumpStartNs;
+    IHDumpBytes += Bytes;
+    IHDumpNs += Ns;
+    IHLostSamples += Lost;
+    atomic_fetch_add(&IHDumps, 1);
+    printf("I/Q history: dumped %s: %d DDCs, %.1fMB in %.0fms (%.0f MB/s), %llu samples lost\n",
+           BaseName, DDCs, Bytes / 1.0e6, Ns / 1.0e6, (Ns != 0) ? Bytes * 1000.0 / Ns : 0.0, (unsigned long long)Lost);
+}
+
+
+//
+// dump thread: waits for a trigger to be taken
+//
+static void* IQHistoryDumper(__attribute__((unused)) void* arg)
+{
+    uint8_t* Chunk;
+
+    Chunk = malloc(VIHCHUNKBYTES);
+    if (Chunk == NULL)
+        return NULL;
+    while (!atomic_load(&IHStopDump))
+    {
+        usleep(VIHPOLLMS * 1000);
+        if (atomic_load(&IHState) != eIHCapturing)
+            continue;
+        DumpHistory(Chunk);
+        atomic_store(&IHState, eIHIdle);
+    }
+    free(Chunk);
+    return NULL;
+}
+
+
+//
+// print memory use, copy cost and dumps
+//
+void PrintIQHistoryReport(void)
+{
+    uint64_t Dumps;
+
+    if (!IHEnabled)
+        return;
+    Dumps = atomic_load(&IHDumps);
+    printf("I/Q history: %dMB holds %.1fs before and %.1fs after a trigger at current rates\n",
+           IHMegaBytes, IHPreSeconds * IHScale, IHPostSeconds * IHScale);
+    printf("I/Q history: %.2f ns per sample copied (%llu samples); %llu dumps, %.1fMB at %.0f MB/s, %llu samples lost\n",
+           (IHCopySamples != 0) ? (double)IHCopyNs / IHCopySamples : 0.0, (unsigned long long)IHCopySamples,
+           (unsigned long long)Dumps, IHDumpBytes / 1.0e6,
+           (IHDumpNs != 0) ? IHDumpBytes * 1000.0 / IHDumpNs : 0.0, (unsigned long long)IHLostSamples);
+}
+
+
+
+//////////////////////////////////////////////////////////////
+//
+// check: synthesised DDC0 (192 ksps, carrying its sample number) and DDC1
+// (96 ksps, quiet with a burst) fed in real time, as the DDC thread would
+//
+//////////////////////////////////////////////////////////////
+
+#define VCHKDDC0RATE 192
+#define VCHKDDC1RATE 96
+#define VCHKSETTING "2,1,16"                        // seconds before, after, MB
+#define VCHKTRIGGER "trigger:1:-20"
+#define VCHKBURSTSAMPLE 240000                      // DDC1 burst start, 2.5s in
+#define VCHKBURSTSAMPLES 9600
+#define VCHKMAXPASS 4096                            // most samples fed per DDC per pass
+#define VCHKTIMEOUTMS 12000
+#define VCHKSIGNALDELAYMS 500                       // after the 1st dump, before SIGUSR1
+#define VCHKSIGNALSLACK (VCHKDDC0RATE * 100)        // DDC0 samples the SIGUSR1 trigger may be late (host stalls)
+#define VCHKALIGNSLACK 8                            // DDC0 samples between its trigger and DDC1's
+
+
+static void CheckPutSample(uint8_t* Sample, int32_t I, int32_t Q)
+{
+    Sample[0] = (uint8_t)(I >> 16);
+    Sample[1] = (uint8_t)(I >> 8);
+    Sample[2] = (uint8_t)I;
+    Sample[3] = (uint8_t)(Q >> 16);
+    Sample[4] = (uint8_t)(Q >> 8);
+    Sample[5] = (uint8_t)Q;
+}
+
+
+//
+// check a dump file against the synthesised samples
+// returns true if the contents are wrong
+//
+static bool CheckDumpFile(uint32_t DDC, TIHDumpResult* Result)
+{
+    uint8_t Sample[VIHBYTESPERSAMPLE], Expected[VIHBYTESPERSAMPLE];
+    uint64_t Index;
+    bool Burst;
+    FILE* File;
+    bool Bad = false;
+
+    File = fopen(Result->FileName, "rb");
+    if (File == NULL)
+        return true;
+    for (Index = Result->FirstIndex; Index < Result->FirstIndex + Result->Samples; Index++)
+    {
+        if (fread(Sample, VIHBYTESPERSAMPLE, 1, File) != 1)
+        {
+            Bad = true;
+            break;
+        }
+        if (DDC == 0)
+            CheckPutSample(Expected, Index & 0xFFFFFF, (Index >> 24) & 0xFFFFFF);
+        else
+        {
+            Burst = (Index >= VCHKBURSTSAMPLE) && (Index < VCHKBURSTSAMPLE + VCHKBURSTSAMPLES);
+            CheckPutSample(Expected, Burst ? 0x400000 : 0x100, Index & 0xFF);
+        }
+        if (memcmp(Sample, Expected, VIHBYTESPERSAMPLE) != 0)
+        {
+            Bad = true;
+            break;
+        }
+    }
+    if (fread(Sample, 1, 1, File) != 0)                         // longer than recorded
+        Bad = true;
+    fclose(File);
+    return Bad;
+}
+
+
+static bool CheckResult(bool Passed, char* Description)
+{
+    printf("  %s: %s\n", Passed ? "pass" : "FAIL", Description);
+    return !Passed;
+}
+
+
+//
+// check with synthesised DDC streams
+// returns true if the check fails
+//
+bool RunIQHistoryCheck(void)
+{
+    static uint8_t Buffers[2][VCHKMAXPASS * VIHBYTESPERSAMPLE];
+    unsigned char* Start[VNUMDDC];
+    unsigned char* End[VNUMDDC];
+    char Directory[] = "/tmp/iqhistoryXXXXXX";
+    char Setting[300], Text[200], Path[600];
+    TIHDumpResult Dumps[2][VNUMDDC];
+    uint64_t Fed[2] = {0, 0};
+    uint64_t Due, StartNs, Now, DumpDoneNs = 0, SignalIndex = 0;
+    uint32_t DDC, Rate, Count, Phase = 0;
+    bool Failed = false, Ok;
+    struct dirent* Entry;
+    DIR* Dir;
+
+    printf("I/Q history check: DDC0 %d ksps, DDC1 %d ksps with a burst at sample %d; %s s before, after, MB\n",
+           VCHKDDC0RATE, VCHKDDC1RATE, VCHKBURSTSAMPLE, VCHKSETTING);
+    if (mkdtemp(Directory) == NULL)
+    {
+        perror("I/Q history check directory");
+        return true;
+    }
+    EnableSimulatedRegisters(true);
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+        SetP2SampleRate(DDC, false, 0, false);
+    SetP2SampleRate(0, true, VCHKDDC0RATE, false);
+    SetP2SampleRate(1, true, VCHKDDC1RATE, false);
+    SetDDCFrequency(0, 7100000, false);
+    SetDDCFrequency(1, 14200000, false);
+    snprintf(Setting, sizeof(Setting), "%s,%s", VCHKSETTING, Directory);
+    if (ParseIQHistorySetting(Setting) || ParseIQHistorySetting(VCHKTRIGGER) || InitialiseIQHistory())
+        return true;
+
+    //
+    // feed in real time: until the level triggered dump is written, then
+    // send SIGUSR1 and feed until that dump is written too
+    //
+    StartNs = IHNowNs();
+    while (Phase < 3)
+    {
+        Now = IHNowNs();
+        if (Now - StartNs > VCHKTIMEOUTMS * 1000000ULL)
+            break;
+        for (DDC = 0; DDC < VNUMDDC; DDC++)
+            Start[DDC] = End[DDC] = Buffers[0];
+        for (DDC = 0; DDC < 2; DDC++)
+        {
+            Rate = (DDC == 0) ? VCHKDDC0RATE : VCHKDDC1RATE;
+            Due = (Now - StartNs) * Rate / 1000000ULL;
+            Count = (Due - Fed[DDC] > VCHKMAXPASS) ? VCHKMAXPASS : Due - Fed[DDC];
+            for (uint32_t Sample = 0; Sample < Count; Sample++)
+            {
+                uint64_t Index = Fed[DDC] + Sample;
+                if (DDC == 0)
+                    CheckPutSample(Buffers[0] + Sample * VIHBYTESPERSAMPLE, Index & 0xFFFFFF, (Index >> 24) & 0xFFFFFF);
+                else
+                    CheckPutSample(Buffers[1] + Sample * VIHBYTESPERSAMPLE,
+                                   ((Index >= VCHKBURSTSAMPLE) && (Index < VCHKBURSTSAMPLE + VCHKBURSTSAMPLES)) ? 0x400000 : 0x100,
+                                   Index & 0xFF);
+            }
+            Start[DDC] = Buffers[DDC];
+            End[DDC] = Buffers[DDC] + Count * VIHBYTESPERSAMPLE;
+            Fed[DDC] += Count;
+        }
+        IQHistoryAddSamples(Start, End);
+
+        if ((Phase == 0) && (atomic_load(&IHDumps) == 1))
+        {
+            memcpy(Dumps[0], IHLastDump, sizeof(IHLastDump));
+            DumpDoneNs = Now;
+            Phase = 1;
+        }
+        else if ((Phase == 1) && (Now - DumpDoneNs > VCHKSIGNALDELAYMS * 1000000ULL))
+        {
+            SignalIndex = Fed[0];
+            raise(SIGUSR1);
+            Phase = 2;
+        }
+        else if ((Phase == 2) && (atomic_load(&IHDumps) == 2))
+        {
+            memcpy(Dumps[1], IHLastDump, sizeof(IHLastDump));
+            Phase = 3;
+        }
+        usleep(1000);
+    }
+    atomic_store(&IHStopDump, true);
+    pthread_join(IHDumpThread, NULL);
+
+    Failed |= CheckResult(Phase == 3, "level and SIGUSR1 triggers each produced a dump");
+    if (Phase == 3)
+    {
+        Failed |= CheckResult(Dumps[0][1].TriggerIndex == VCHKBURSTSAMPLE, "level trigger at the burst's 1st sample");
+        Ok = (Dumps[0][0].TriggerIndex >= VCHKBURSTSAMPLE * 2 - VCHKALIGNSLACK) && (Dumps[0][0].TriggerIndex <= VCHKBURSTSAMPLE * 2 + VCHKALIGNSLACK);
+        Failed |= CheckResult(Ok, "DDC0 trigger sample matches DDC1's in time");
+        Ok = (Dumps[1][0].TriggerIndex >= SignalIndex) && (Dumps[1][0].TriggerIndex <= SignalIndex + VCHKSIGNALSLACK);
+        Failed |= CheckResult(Ok, "SIGUSR1 trigger taken at the next pass");
+        for (uint32_t Dump = 0; Dump < 2; Dump++)
+            for (DDC = 0; DDC < 2; DDC++)
+            {
+                Rate = (DDC == 0) ? VCHKDDC0RATE : VCHKDDC1RATE;
+                Ok = (Dumps[Dump][DDC].Lost == 0)
+                     && (Dumps[Dump][DDC].FirstIndex + 2 * Rate * 1000 == Dumps[Dump][DDC].TriggerIndex)
+                     && (Dumps[Dump][DDC].Samples == 3 * Rate * 1000)
+                     && !CheckDumpFile(DDC, &Dumps[Dump][DDC]);
+                snprintf(Text, sizeof(Text), "dump %d DDC%d: 2s before and 1s after the trigger, samples intact", Dump + 1, DDC);
+                Failed |= CheckResult(Ok, Text);
+            }
+    }
+
+    //
+    // metadata, then remove the files
+    //
+    Ok = false;
+    Dir = opendir(Directory);
+    while ((Dir != NULL) && ((Entry = readdir(Dir)) != NULL))
+    {
+        if (Entry->d_name[0] == '.')
+            continue;
+        snprintf(Path, sizeof(Path), "%s/%s", Directory, Entry->d_name);
+        if (strstr(Entry->d_name, ".txt") != NULL)
+        {
+            FILE* Meta = fopen(Path, "r");
+            bool Trigger = false, Stream = false;
+            while ((Meta != NULL) && (fgets(Text, sizeof(Text), Meta) != NULL))
+            {
+                if (strncmp(Text, "trigger = ", 10) == 0)
+                    Trigger = true;
+                if (strstr(Text, "ddc1 = file") && strstr(Text, "rate 96 ksps") && strstr(Text, "frequency 14200000 Hz"))
+                    Stream = true;
+            }
+            if (Meta != NULL)
+                fclose(Meta);
+            Ok = Ok || (Trigger && Stream);
+        }
+        unlink(Path);
+    }
+    if (Dir != NULL)
+        closedir(Dir);
+    rmdir(Directory);
+    Failed |= CheckResult(Ok, "metadata gives trigger, rate and frequency for each DDC");
+
+    PrintIQHistoryReport();
+    IHEnabled = false;
+    printf("I/Q history check: %s\n", Failed ? "FAILED" : "passed");
+    return Failed;
+}
@@ -0,0 +1,86 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// iqhistory.h:
+//
+// I/Q history ("time machine"): the last few seconds of demultiplexed I/Q
+// from every enabled DDC are kept in memory. On a trigger (keyboard 'r',
+// SIGUSR1, or a signal level on a DDC) the pre-trigger history, and an
+// optional post-trigger window, are written to disk with a metadata file.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __iqhistory_h
+#define __iqhistory_h
+
+
+#include <stdint.h>
+#include "../common/saturntypes.h"
+
+
+#define VIHMAXSECONDS 60                            // longest pre or post trigger window
+#define VIHDEFAULTMB 64                             // default memory for all DDCs
+#define VIHMAXMB 2048
+#define VIHBYTESPERSAMPLE 6                         // 24 bit I then 24 bit Q, as in DDC I/Q packets
+#define VIHDEFAULTDIR "."
+
+
+//
+// parse a -R setting:
+// <seconds>[,<post seconds>[,<MB>[,<directory>]]]  keep <seconds> of history
+// trigger:<ddc>:<dBFS>  also trigger when a DDC's signal reaches a level
+// returns true if not valid
+//
+bool ParseIQHistorySetting(char* Setting);
+
+
+//
+// true if I/Q history is set
+//
+bool IQHistoryEnabled(void);
+
+
+//
+// allocate the history memory and start the dump thread
+// returns true if error
+//
+bool InitialiseIQHistory(void);
+
+
+//
+// DDC I/Q thread calls
+// IQHistoryRestart: at the start of a run (samples are not continuous with the last)
+// IQHistoryAddSamples: after each DMA is demultiplexed: samples Start[n] to End[n] for DDC n
+//
+void IQHistoryRestart(void);
+void IQHistoryAddSamples(unsigned char** Start, unsigned char** End);
+
+
+//
+// request a dump, from any thread
+// returns true if one is already in progress
+//
+bool IQHistoryTrigger(char* Reason);
+
+
+//
+// print memory use, copy cost and dumps
+//
+void PrintIQHistoryReport(void);
+
+
+//
+// check with synthesised DDC streams: a level trigger and a SIGUSR1
+// trigger, with dump contents checked against the samples fed in
+// returns true if the check fails
+//
+bool RunIQHistoryCheck(void);
+
+
+#endif
@@ -0,0 +1,538 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// liveness.c:
+//
+// loss of client detection from the cadence of incoming streams.
+// each listener thread calls LivenessPacket() for every packet, and the
+// expected interval between packets is learned for each stream.
+// the liveness thread checks every VLVCHECKMS:
+// - in TX, if no DUC I/Q has arrived for the TX timeout, MOX is dropped and
+//   MOX requests are refused until DUC I/Q arrives again. This is done even if
+//   the client has disabled its watchdog timer.
+// - if every stream seen in this session has been silent for the session
+//   timeout, the session ends as it did after the old 1 second activity check.
+// a stream with a slow cadence is allowed VLVCADENCEFACTOR missed intervals
+// (up to VLVMAXCADENCEMS) if that is longer than the timeout.
+// the original once per second check for any message still runs as a backstop.
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include "../common/saturntypes.h"
+#include "../common/saturnregisters.h"
+#include "../common/hwaccess.h"
+#include "threaddata.h"
+#include "generalpacket.h"
+#include "liveness.h"
+#include "txplayback.h"
+#include "handoff.h"
+
+
+//
+// state for each stream: written by its listener thread for every packet,
+// so each has its own cache line
+//
+typedef struct
+{
+    char* Name;
+    volatile uint64_t LastUs;                       // time of last packet, 0 if none yet
+    volatile uint32_t ExpectedUs;                   // learned interval between packets
+    uint64_t Packets;
+} VCACHEALIGNED TLivenessStream;
+
+
+static TLivenessStream LVStreams[eLVNumStreams] =
+{
+    {"high priority", 0, 0, 0},
+    {"DUC I/Q", 0, 0, 0},
+    {"speaker", 0, 0, 0}
+};
+
+static volatile uint32_t LVTXTimeoutMs = VLVDEFAULTTXMS;
+static volatile uint32_t LVSessionTimeoutMs = VLVDEFAULTSESSIONMS;
+static volatile bool LVTXLockout = false;           // true after TX dropped, until DUC I/Q resumes
+static pthread_t LivenessThread;
+static bool LivenessRunning = false;
+
+//
+// detection statistics: latency is from the last packet to the action
+//
+static volatile uint32_t LVTXDrops = 0;
+static volatile uint32_t LVSessionEnds = 0;
+static uint64_t LVTXLatencySumUs, LVTXLatencyMaxUs;
+static uint64_t LVSessionLatencySumUs, LVSessionLatencyMaxUs;
+
+
+//
+// get time in us
+//
+static uint64_t LivenessTimeUs(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (uint64_t)Now.tv_sec * 1000000ULL + (uint64_t)(Now.tv_nsec / 1000);
+}
+
+
+//
+// record a packet received on a stream: called by its listener thread
+// the expected interval is a running average of intervals shorter than VLVMAXCADENCEMS;
+// each interval counts as at most twice the average, so gaps (including the ones
+// this code is looking for) hardly change it, but a real change of cadence is followed
+//
+void LivenessPacket(ELivenessStream Stream)
+{
+    TLivenessStream* LV = &LVStreams[Stream];
+    uint64_t Now = LivenessTimeUs();
+    uint64_t Interval;
+
+    if (LV->LastUs != 0)
+    {
+        Interval = Now - LV->LastUs;
+        if (Interval < VLVMAXCADENCEMS * 1000)
+        {
+            if (LV->ExpectedUs == 0)
+                LV->ExpectedUs = (uint32_t)Interval;
+            else
+            {
+                if (Interval > 2ULL * LV->ExpectedUs)               // a gap moves the average only a little
+                    Interval = 2ULL * LV->ExpectedUs;
+                LV->ExpectedUs = (uint32_t)((int64_t)LV->ExpectedUs + ((int64_t)Interval - (int64_t)LV->ExpectedUs) / 16);
+            }
+        }
+    }
+    LV->LastUs = Now;
+    LV->Packets++;
+    if (!NewMessageReceived)                        // only write when it changes: every listener sets it
+        NewMessageReceived = true;
+    if ((Stream == eLVDUCIQ) && LVTXLockout)
+        LVTXLockout = false;
+}
+
+
+//
+// set the TX and session timeouts (ms)
+// returns true if not valid
+//
+bool SetLivenessTimeouts(uint32_t TXMs, uint32_t SessionMs)
+{
+    if ((TXMs < 2 * VLVCHECKMS) || (TXMs > VLVMAXTIMEOUTMS) || (SessionMs < TXMs) || (SessionMs > VLVMAXTIMEOUTMS))
+        return true;
+    LVTXTimeoutMs = TXMs;
+    LVSessionTimeoutMs = SessionMs;
+    return false;
+}
+
+
+//
+// true if MOX may be set
+//
+bool LivenessTXAllowed(void)
+{
+    return !LVTXLockout;
+}
+
+
+//
+// silence allowed on a stream: the timeout, or its cadence allowance if longer
+//
+static uint64_t StreamLimitUs(TLivenessStream* LV, uint32_t TimeoutMs)
+{
+    uint64_t Limit = (uint64_t)TimeoutMs * 1000;
+    uint64_t Cadence = (uint64_t)LV->ExpectedUs * VLVCADENCEFACTOR;
+
+    if (Cadence > VLVMAXCADENCEMS * 1000)
+        Cadence = VLVMAXCADENCEMS * 1000;
+    return (Cadence > Limit) ? Cadence : Limit;
+}
+
+
+//
+// set back to inactive (as the client does when it stops)
+//
+static void Deactivate(void)
+{
+    SDRActive = false;
+    IsTXMode = false;
+    SetMOX(false);
+    SetTXEnable(false);
+    EnableCW(false, false);
+    ReplyAddressSet = false;
+    StartBitReceived = false;
+}
+
+
+//
+// liveness thread
+//
+static void* LivenessCheck(__attribute__((unused)) void* arg)
+{
+    TLivenessStream* LV;
+    uint64_t Now, Ref, Latest, Silent;
+    uint64_t TXStartUs = 0, SessionStartUs = 0;
+    bool PrevTX = false, PrevActive = false;
+    bool Seen, Alive;
+    uint32_t Ticks = 0;
+    int Stream;
+
+    printf("Started liveness thread, pid=%ld\n", syscall(SYS_gettid));
+    while (1)
+    {
+        usleep(VLVCHECKMS * 1000);
+        //
+        // no checks while the streams are parked for an upgrade; the
+        // session is timed again from when they resume
+        //
+        if (HandoffFreezing())
+        {
+            PrevActive = false;
+            Ticks = 0;
+            continue;
+        }
+        Now = LivenessTimeUs();
+
+        //
+        // TX: drop MOX if the DUC I/Q stream has stopped
+        // (measured from the start of TX if no DUC I/Q since; not while a
+        // preloaded waveform plays, as it does not need the stream)
+        //
+        if (SDRActive && IsTXMode && !TXPlaybackHoldsMOX())
+        {
+            if (!PrevTX)
+                TXStartUs = Now;
+            LV = &LVStreams[eLVDUCIQ];
+            Ref = (LV->LastUs > TXStartUs) ? LV->LastUs : TXStartUs;
+            Silent = (Now > Ref) ? Now - Ref : 0;                   // a packet may arrive after Now was read
+            if (Silent > StreamLimitUs(LV, LVTXTimeoutMs))
+            {
+                IsTXMode = false;
+                SetMOX(false);
+                LVTXLockout = true;
+                LVTXLatencySumUs += Silent;
+                if (Silent > LVTXLatencyMaxUs)
+                    LVTXLatencyMaxUs = Silent;
+                LVTXDrops++;
+                printf("TX dropped: no DUC I/Q for %.1fms\n", (double)Silent / 1000.0);
+            }
+        }
+        PrevTX = SDRActive && IsTXMode && !TXPlaybackHoldsMOX();
+
+        //
+        // session: end it if all streams seen since it started are silent
+        //
+        if (SDRActive)
+        {
+            if (!PrevActive)
+                SessionStartUs = Now;
+            Seen = false;
+            Alive = false;
+            Latest = 0;
+            for (Stream = 0; Stream < eLVNumStreams; Stream++)
+            {
+                LV = &LVStreams[Stream];
+                Ref = LV->LastUs;
+                if (Ref < SessionStartUs)
+                    continue;
+                Seen = true;
+                if (Ref > Latest)
+                    Latest = Ref;
+                if ((Now <= Ref) || ((Now - Ref) <= StreamLimitUs(LV, LVSessionTimeoutMs)))
+                    Alive = true;
+            }
+            if (Seen && !Alive && HW_Timer_Enable)
+            {
+                Deactivate();
+                Silent = Now - Latest;
+                LVSessionLatencySumUs += Silent;
+                if (Silent > LVSessionLatencyMaxUs)
+                    LVSessionLatencyMaxUs = Silent;
+                LVSessionEnds++;
+                printf("Reverted to Inactive State: no packets from client for %.1fms\n", (double)Silent / 1000.0);
+            }
+        }
+        PrevActive = SDRActive;
+
+        //
+        // once per second: the original check for no messages of any kind
+        //
+        if (++Ticks >= 1000 / VLVCHECKMS)
+        {
+            Ticks = 0;
+            if (!NewMessageReceived && HW_Timer_Enable)
+            {
+                if (SDRActive)
+                    printf("Reverted to Inactive State after no activity\n");
+                Deactivate();
+            }
+            NewMessageReceived = false;
+        }
+    }
+    return NULL;
+}
+
+
+//
+// start the liveness thread
+// returns true if error
+//
+bool InitialiseLiveness(void)
+{
+    if (LivenessRunning)
+        return false;
+    if (pthread_create(&LivenessThread, NULL, LivenessCheck, NULL) < 0)
+    {
+        perror("pthread_create liveness");
+        return true;
+    }
+    pthread_detach(LivenessThread);
+    LivenessRunning = true;
+    return false;
+}
+
+
+//
+// print timeouts, learned stream cadence and detection latency so far
+//
+void PrintLivenessReport(void)
+{
+    int Stream;
+    TLivenessStream* LV;
+
+    printf("liveness: TX dropped %dms after DUC I/Q stops; session ends %dms after all streams stop\n",
+           LVTXTimeoutMs, LVSessionTimeoutMs);
+    for (Stream = 0; Stream < eLVNumStreams; Stream++)
+    {
+        LV = &LVStreams[Stream];
+        if (LV->Packets != 0)
+            printf("  %s: %llu packets, expected every %.2fms\n", LV->Name,
+                   (unsigned long long)LV->Packets, (double)LV->ExpectedUs / 1000.0);
+    }
+    if (LVTXDrops != 0)
+        printf("  TX drops: %d, detection latency mean %.1fms, max %.1fms\n", LVTXDrops,
+               (double)LVTXLatencySumUs / LVTXDrops / 1000.0, (double)LVTXLatencyMaxUs / 1000.0);
+    if (LVSessionEnds != 0)
+        printf("  session ends: %d, detection latency mean %.1fms, max %.1fms\n", LVSessionEnds,
+               (double)LVSessionLatencySumUs / LVSessionEnds / 1000.0, (double)LVSessionLatencyMaxUs / 1000.0);
+}
+
+
+
+//
+// scripted client check with the simulated register backend
+// the client sends DUC I/Q and speaker audio at their real cadence, and high
+// priority packets every 50ms, with an occasional pause of a few ms.
+//
+#define VCHECKTRIALS 20                             // abrupt stops measured
+#define VCHECKSTREAMMS 300                          // streaming before each stop
+#define VCHECKSLACKMS 15                            // allowed beyond the timeout (check interval, scheduling)
+#define VCHECKPERCENTILE 90                         // detection time judged at this percentile of the trials
+#define VCHECKDUCUS 1250                            // client cadence: 240 samples at 192ksps
+#define VCHECKSPKRUS 1333                           // 64 samples at 48ksps
+#define VCHECKHPUS 50000
+#define VCHECKGAPEVERY 97                           // every so often the client pauses (its own scheduling)
+#define VCHECKGAPUS 6000
+
+static volatile uint64_t CheckMOXOffUs;             // time MOX bit last written clear
+static uint64_t CheckMaxGapUs;                      // longest gap between DUC I/Q packets sent
+
+static void LivenessCheckHook(uint32_t Address, __attribute__((unused)) uint32_t Data)
+{
+    if ((Address == VADDRRFGPIOREG) && !MOXAsserted && (CheckMOXOffUs == 0))
+        CheckMOXOffUs = LivenessTimeUs();
+}
+
+
+//
+// connect as the general and high priority packets do
+//
+static void CheckConnect(void)
+{
+    ReplyAddressSet = true;
+    StartBitReceived = true;
+    SDRActive = true;
+    SetTXEnable(true);
+}
+
+
+//
+// send packets at client cadence for DurationMs; DUC I/Q only if SendDUC
+// every high priority packet requests MOX, handled as InHighPriority does
+// returns the time of the last DUC I/Q packet
+//
+static uint64_t CheckStream(uint32_t DurationMs, bool SendDUC)
+{
+    uint64_t Start = LivenessTimeUs();
+    uint64_t Now, NextDUC, NextSpkr, NextHP, Next, LastDUC = 0;
+    uint32_t Count = 0;
+
+    NextDUC = NextSpkr = NextHP = Start;
+    while ((Now = LivenessTimeUs()) < Start + DurationMs * 1000ULL)
+    {
+        if (SendDUC && (Now >= NextDUC))
+        {
+            LivenessPacket(eLVDUCIQ);
+            if ((LastDUC != 0) && (Now - LastDUC > CheckMaxGapUs))
+                CheckMaxGapUs = Now - LastDUC;
+            LastDUC = Now;
+            NextDUC += VCHECKDUCUS;
+            if ((++Count % VCHECKGAPEVERY) == 0)
+                NextDUC += VCHECKGAPUS;
+        }
+        if (Now >= NextSpkr)
+        {
+            LivenessPacket(eLVSpeaker);
+            NextSpkr += VCHECKSPKRUS;
+        }
+        if (Now >= NextHP)
+        {
+            LivenessPacket(eLVHighPriority);
+            IsTXMode = LivenessTXAllowed();
+            SetMOX(IsTXMode);
+            NextHP += VCHECKHPUS;
+        }
+        Next = NextSpkr < NextHP ? NextSpkr : NextHP;
+        if (SendDUC && (NextDUC < Next))
+            Next = NextDUC;
+        if (Next > Now)
+            usleep((useconds_t)(Next - Now));
+    }
+    return LastDUC;
+}
+
+
+static int CompareLatency(const void* A, const void* B)
+{
+    uint64_t X = *(const uint64_t*)A;
+    uint64_t Y = *(const uint64_t*)B;
+
+    return (X > Y) - (X < Y);
+}
+
+
+//
+// run the check. Detection times are judged at the 90th percentile, so a trial
+// where the host preempted p2app for longer than the slack does not fail it.
+// returns true if the check fails
+//
+bool RunLivenessCheck(void)
+{
+    uint64_t TXLatency[VCHECKTRIALS], SessionLatency[VCHECKTRIALS];
+    uint64_t LastDUC, LastAny, Now, TXLimitUs, SessionLimitUs;
+    uint32_t Trial, Drops, Ends, Measured = 0, FalseDrops = 0, ClientPauses = 0, Judged;
+    int Stream;
+    bool Fail = false, Paused, StallDrop, StallLockout, StallSession, Resumed;
+
+    printf("liveness check with simulated registers: %d abrupt client stops\n", VCHECKTRIALS);
+    EnableSimulatedRegisters(true);
+    SetRegisterWriteHook(LivenessCheckHook);
+    HW_Timer_Enable = true;
+    if (InitialiseLiveness())
+        return true;
+
+    //
+    // client streams then stops abruptly; measure until MOX clear and session end
+    //
+    for (Trial = 0; Trial < VCHECKTRIALS; Trial++)
+    {
+        CheckConnect();
+        Drops = LVTXDrops;
+        Ends = LVSessionEnds;
+        CheckMaxGapUs = 0;
+        LastDUC = CheckStream(VCHECKSTREAMMS, true);
+        LastAny = LivenessTimeUs();
+        Paused = (LVTXDrops != Drops) || (LVSessionEnds != Ends);
+        CheckMOXOffUs = 0;
+        while (SDRActive && (LivenessTimeUs() - LastAny < 4000000ULL))
+            usleep(1000);
+        Now = LivenessTimeUs();
+        //
+        // a drop while streaming is false unless the client itself paused too long
+        // (on a loaded host, the scripted client can be descheduled for tens of ms);
+        // such a trial did not stop abruptly from full TX, so is not measured
+        //
+        if (Paused)
+        {
+            if (CheckMaxGapUs > StreamLimitUs(&LVStreams[eLVDUCIQ], LVTXTimeoutMs))
+                ClientPauses++;
+            else
+                FalseDrops++;
+        }
+        else
+        {
+            TXLatency[Measured] = CheckMOXOffUs ? CheckMOXOffUs - LastDUC : Now - LastDUC;
+            SessionLatency[Measured] = Now - LastAny;
+            Measured++;
+        }
+        usleep(20000);
+    }
+
+    //
+    // DUC I/Q stops but the client is still there: TX drops, session continues,
+    // MOX is refused until DUC I/Q resumes
+    //
+    CheckConnect();
+    CheckStream(100, true);
+    Drops = LVTXDrops;
+    Ends = LVSessionEnds;
+    CheckStream(LVTXTimeoutMs + 100, false);
+    StallDrop = (LVTXDrops == Drops + 1) && !IsTXMode;
+    StallLockout = !LivenessTXAllowed();
+    StallSession = SDRActive && (LVSessionEnds == Ends);
+    CheckStream(20, true);
+    Resumed = LivenessTXAllowed();
+    Deactivate();
+
+    //
+    // expected detection time: the timeout, or a stream's cadence allowance if longer
+    //
+    TXLimitUs = StreamLimitUs(&LVStreams[eLVDUCIQ], LVTXTimeoutMs) + VCHECKSLACKMS * 1000;
+    SessionLimitUs = 0;
+    for (Stream = 0; Stream < eLVNumStreams; Stream++)
+        if (StreamLimitUs(&LVStreams[Stream], LVSessionTimeoutMs) > SessionLimitUs)
+            SessionLimitUs = StreamLimitUs(&LVStreams[Stream], LVSessionTimeoutMs);
+    SessionLimitUs += VCHECKSLACKMS * 1000;
+
+    PrintLivenessReport();
+    if (Measured == 0)
+    {
+        printf("no abrupt stops measured: client paused in every trial\n");
+        Fail = true;
+    }
+    else
+    {
+        qsort(TXLatency, Measured, sizeof(uint64_t), CompareLatency);
+        qsort(SessionLatency, Measured, sizeof(uint64_t), CompareLatency);
+        Judged = ((Measured - 1) * VCHECKPERCENTILE) / 100;
+        printf("abrupt stop (%d measured), last DUC packet to MOX clear: median %.1fms, %d%% %.1fms, max %.1fms (limit %.1fms)\n",
+               Measured, (double)TXLatency[Measured / 2] / 1000.0, VCHECKPERCENTILE, (double)TXLatency[Judged] / 1000.0,
+               (double)TXLatency[Measured - 1] / 1000.0, (double)TXLimitUs / 1000.0);
+        printf("abrupt stop, last packet to session end: median %.1fms, %d%% %.1fms, max %.1fms (limit %.1fms)\n",
+               (double)SessionLatency[Measured / 2] / 1000.0, VCHECKPERCENTILE, (double)SessionLatency[Judged] / 1000.0,
+               (double)SessionLatency[Measured - 1] / 1000.0, (double)SessionLimitUs / 1000.0);
+        Fail = (TXLatency[Judged] > TXLimitUs) || (SessionLatency[Judged] > SessionLimitUs);
+    }
+    printf("false drops while streaming: %d (correct drops when the client paused: %d)\n", FalseDrops, ClientPauses);
+    printf("DUC I/Q stall with client present: TX dropped %s, MOX refused %s, session kept %s, MOX allowed after resume %s\n",
+           StallDrop ? "yes" : "NO", StallLockout ? "yes" : "NO", StallSession ? "yes" : "NO", Resumed ? "yes" : "NO");
+
+    Fail = Fail || (FalseDrops != 0) || !StallDrop || !StallLockout || !StallSession || !Resumed;
+    printf("liveness check: %s\n", Fail ? "FAIL" : "pass");
+    SetRegisterWriteHook(NULL);
+    EnableSimulatedRegisters(false);
+    return Fail;
+}
@@ -0,0 +1,87 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// liveness.h:
+//
+// loss of client detection from the cadence of incoming streams.
+// TX is dropped soon after the DUC I/Q stream stops; the session ends
+// soon after all incoming streams stop.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __liveness_h
+#define __liveness_h
+
+
+#include <stdint.h>
+#include "../common/saturntypes.h"
+
+
+#define VLVCHECKMS 2                                // liveness check interval, ms
+#define VLVDEFAULTTXMS 30                           // default: TX dropped this long after DUC I/Q stops
+#define VLVDEFAULTSESSIONMS 250                     // default: session ends this long after all streams stop
+#define VLVMAXTIMEOUTMS 2000                        // longest timeout that can be set
+#define VLVCADENCEFACTOR 4                          // a stream is also allowed this many missed intervals
+#define VLVMAXCADENCEMS 1000                        // limit on the allowance from a stream's cadence
+
+
+//
+// incoming streams tracked
+//
+typedef enum
+{
+    eLVHighPriority,                                // high priority from client
+    eLVDUCIQ,                                       // TX I/Q
+    eLVSpeaker,                                     // speaker audio
+    eLVNumStreams
+} ELivenessStream;
+
+
+//
+// record a packet received on a stream: called by its listener thread
+//
+void LivenessPacket(ELivenessStream Stream);
+
+
+//
+// set the TX and session timeouts (ms)
+// returns true if not valid
+//
+bool SetLivenessTimeouts(uint32_t TXMs, uint32_t SessionMs);
+
+
+//
+// true if MOX may be set: false after TX was dropped for lack of DUC I/Q,
+// until DUC I/Q packets arrive again
+//
+bool LivenessTXAllowed(void);
+
+
+//
+// start the liveness thread (replaces the once per second activity check)
+// returns true if error
+//
+bool InitialiseLiveness(void);
+
+
+//
+// print timeouts, learned stream cadence and detection latency so far
+//
+void PrintLivenessReport(void);
+
+
+//
+// scripted client check with the simulated register backend: streams packets at
+// client cadence, stops abruptly, and measures how long TX and the session take to drop
+// returns true if the check fails
+//
+bool RunLivenessCheck(void);
+
+
+#endif
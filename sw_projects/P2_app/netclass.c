@@ -0,0 +1,570 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// netclass.c:
+//
+// network stream classes: each class of P2 traffic can be bound to its own
+// interface or source address, with its own DSCP marking. For example bulk
+// I/Q can use a USB 2.5GbE adapter while control and status use the on-board
+// Ethernet, so bursts of I/Q don't queue in front of PTT and status packets.
+// the client must send each class's incoming traffic to that class's address.
+//
+// some P2 ports carry 2 classes (eg wideband shares a port with incoming high
+// priority data). If the 2 classes bind to different addresses, the outgoing
+// stream gets its own socket on that port; otherwise it shares the socket and
+// marks each message with its own DSCP. The outgoing stream's socket never
+// reads, and the kernel delivers to the most specific bind, so it must not be
+// bound to a specific address while the receiving class on that port listens
+// on all addresses: it would take the receiving class's traffic sent to that
+// address. Such settings are refused at startup.
+//
+// for each run, the kernel counters of every interface in use are reported.
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <ifaddrs.h>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+#include <time.h>
+#include <syscall.h>
+#include "../common/saturntypes.h"
+#include "threaddata.h"
+#include "netclass.h"
+
+
+#define VNETREPORTPOLLMS 200                        // run state poll interval
+#define VNETDEBUGREPORTS 10                         // seconds between reports in a run, if debug enabled
+#define VNETMAXINTERFACES (eNetNumClasses + 1)
+
+
+//
+// settings for one class
+//
+typedef struct
+{
+    char Interface[IFNAMSIZ];                       // interface name, or empty
+    struct in_addr Address;                         // source address, if AddressSet
+    bool AddressSet;
+    int DSCP;                                       // -1 if not set
+} TNetClassSetting;
+
+
+//
+// kernel counters for one interface
+//
+typedef struct
+{
+    char Name[IFNAMSIZ];
+    uint32_t Classes;                               // bit set for each class using it
+    uint64_t TxPackets, TxBytes, TxDropped, TxErrors;
+    uint64_t RxPackets, RxBytes, RxDropped, RxErrors;
+} TInterfaceCounters;
+
+
+static const char* NetClassNames[eNetNumClasses] =
+{
+    "control", "highpriority", "ddc", "wideband", "txiq", "audio"
+};
+
+static TNetClassSetting NetClasses[eNetNumClasses] =
+{
+    {"", {0}, false, -1}, {"", {0}, false, -1}, {"", {0}, false, -1},
+    {"", {0}, false, -1}, {"", {0}, false, -1}, {"", {0}, false, -1}
+};
+
+static pthread_t NetReportThread;
+
+
+//
+// parse a -B command line setting: <class>:<interface or address>[:<dscp>]
+// returns true if error
+//
+bool ParseNetClassSetting(char* Setting)
+{
+    char Copy[64];
+    char* Name;
+    char* Binding;
+    char* DSCP;
+    char* End;
+    int Class;
+    long Value;
+
+    strncpy(Copy, Setting, sizeof(Copy) - 1);
+    Copy[sizeof(Copy) - 1] = 0;
+    Name = Copy;
+    Binding = strchr(Name, ':');
+    if (Binding == NULL)
+        return true;
+    *Binding++ = 0;
+    DSCP = strchr(Binding, ':');
+    if (DSCP != NULL)
+        *DSCP++ = 0;
+
+    for (Class = 0; Class < eNetNumClasses; Class++)
+        if (strcmp(Name, NetClassNames[Class]) == 0)
+            break;
+    if (Class == eNetNumClasses)
+        return true;
+
+    if (DSCP != NULL)
+    {
+        Value = strtol(DSCP, &End, 0);
+        if ((*End != 0) || (Value < 0) || (Value > 63))
+            return true;
+        NetClasses[Class].DSCP = (int)Value;
+    }
+    if (inet_pton(AF_INET, Binding, &NetClasses[Class].Address) == 1)
+        NetClasses[Class].AddressSet = true;
+    else if (strlen(Binding) < IFNAMSIZ)
+        strcpy(NetClasses[Class].Interface, Binding);
+    else
+        return true;
+    return false;
+}
+
+
+//
+// print the class settings
+//
+void PrintNetClassSettings(void)
+{
+    int Class;
+    TNetClassSetting* Set;
+
+    for (Class = 0; Class < eNetNumClasses; Class++)
+    {
+        Set = &NetClasses[Class];
+        if (!Set->AddressSet && (Set->Interface[0] == 0) && (Set->DSCP < 0))
+            continue;
+        printf("network class %-12s: ", NetClassNames[Class]);
+        if (Set->AddressSet)
+            printf("address %s", inet_ntoa(Set->Address));
+        else if (Set->Interface[0] != 0)
+            printf("interface %s", Set->Interface);
+        else
+            printf("any interface");
+        if (Set->DSCP >= 0)
+            printf(", DSCP %d", Set->DSCP);
+        printf("\n");
+    }
+}
+
+
+//
+// ports that carry 2 classes: the class that receives on the port, and the
+// class whose outgoing stream sends from it
+//
+static const struct
+{
+    uint32_t Port;
+    ENetClass Receiving;
+    char* ReceivedData;
+    ENetClass Sending;
+    char* SentData;
+} SharedPorts[] =
+{
+    {1025, eNetControl, "DDC specific", eNetHighPriority, "high priority status"},
+    {1026, eNetControl, "DUC specific", eNetAudio, "mic audio"},
+    {1027, eNetHighPriority, "high priority commands", eNetWideband, "wideband ADC1"},
+    {1028, eNetAudio, "speaker audio", eNetWideband, "wideband ADC2"}
+};
+
+
+//
+// check the ports that carry 2 classes bound to different addresses
+// returns true if a sending class's specific bind would shadow the receiving class
+//
+bool CheckNetClassSharedPorts(void)
+{
+    uint32_t Cntr;
+    struct in_addr Receiving, Sending;
+    bool Error = false;
+
+    for (Cntr = 0; Cntr < sizeof(SharedPorts) / sizeof(SharedPorts[0]); Cntr++)
+    {
+        if (!NetClassBindingsDiffer(SharedPorts[Cntr].Receiving, SharedPorts[Cntr].Sending))
+            continue;
+        Receiving = GetNetClassAddress(SharedPorts[Cntr].Receiving);
+        Sending = GetNetClassAddress(SharedPorts[Cntr].Sending);
+        if ((Receiving.s_addr == htonl(INADDR_ANY)) && (Sending.s_addr != htonl(INADDR_ANY)))
+        {
+            printf("network class %s is bound to %s, but port %d also receives %s (class %s) on any address:\n",
+                   NetClassNames[SharedPorts[Cntr].Sending], inet_ntoa(Sending), SharedPorts[Cntr].Port,
+                   SharedPorts[Cntr].ReceivedData, NetClassNames[SharedPorts[Cntr].Receiving]);
+            printf("  %s sent to that address would be lost; bind class %s to an address too\n",
+                   SharedPorts[Cntr].ReceivedData, NetClassNames[SharedPorts[Cntr].Receiving]);
+            Error = true;
+        }
+        else if (Receiving.s_addr != htonl(INADDR_ANY))
+            printf("network classes: port %d sends %s separately; the client must send %s to %s\n",
+                   SharedPorts[Cntr].Port, SharedPorts[Cntr].SentData, SharedPorts[Cntr].ReceivedData, inet_ntoa(Receiving));
+    }
+    return Error;
+}
+
+
+//
+// get the class of a P2 port table entry
+//
+ENetClass GetPortNetClass(int PortIndex)
+{
+    ENetClass Class;
+
+    switch (PortIndex)
+    {
+        case VPORTHIGHPRIORITYTOSDR:
+        case VPORTHIGHPRIORITYFROMSDR:
+            Class = eNetHighPriority;
+            break;
+
+        case VPORTSPKRAUDIO:
+        case VPORTMICAUDIO:
+            Class = eNetAudio;
+            break;
+
+        case VPORTDUCIQ:
+            Class = eNetTXIQ;
+            break;
+
+        case VPORTWIDEBAND0:
+        case VPORTWIDEBAND1:
+            Class = eNetWideband;
+            break;
+
+        default:
+            if ((PortIndex >= VPORTDDCIQ0) && (PortIndex <= VPORTDDCIQ9))
+                Class = eNetDDC;
+            else
+                Class = eNetControl;
+            break;
+    }
+    return Class;
+}
+
+
+//
+// find the IPv4 address of an interface. returns true if not found
+//
+static bool GetInterfaceAddress(char* Name, struct in_addr* Address)
+{
+    struct ifaddrs* List;
+    struct ifaddrs* Entry;
+    bool NotFound = true;
+
+    if (getifaddrs(&List) < 0)
+        return true;
+    for (Entry = List; Entry != NULL; Entry = Entry->ifa_next)
+        if ((Entry->ifa_addr != NULL) && (Entry->ifa_addr->sa_family == AF_INET)
+            && (strcmp(Entry->ifa_name, Name) == 0))
+        {
+            *Address = ((struct sockaddr_in*)Entry->ifa_addr)->sin_addr;
+            NotFound = false;
+            break;
+        }
+    freeifaddrs(List);
+    return NotFound;
+}
+
+
+//
+// find the interface that has an IPv4 address. returns true if not found
+//
+static bool GetAddressInterface(struct in_addr Address, char* Name)
+{
+    struct ifaddrs* List;
+    struct ifaddrs* Entry;
+    bool NotFound = true;
+
+    if (getifaddrs(&List) < 0)
+        return true;
+    for (Entry = List; Entry != NULL; Entry = Entry->ifa_next)
+        if ((Entry->ifa_addr != NULL) && (Entry->ifa_addr->sa_family == AF_INET)
+            && (((struct sockaddr_in*)Entry->ifa_addr)->sin_addr.s_addr == Address.s_addr))
+        {
+            strncpy(Name, Entry->ifa_name, IFNAMSIZ - 1);
+            Name[IFNAMSIZ - 1] = 0;
+            NotFound = false;
+            break;
+        }
+    freeifaddrs(List);
+    return NotFound;
+}
+
+
+//
+// get the local address a class should bind to (INADDR_ANY if not set)
+//
+struct in_addr GetNetClassAddress(ENetClass Class)
+{
+    struct in_addr Address;
+    TNetClassSetting* Set = &NetClasses[Class];
+
+    Address.s_addr = htonl(INADDR_ANY);
+    if (Set->AddressSet)
+        Address = Set->Address;
+    else if ((Set->Interface[0] != 0) && GetInterfaceAddress(Set->Interface, &Address))
+        Address.s_addr = htonl(INADDR_ANY);
+    return Address;
+}
+
+
+//
+// true if two classes bind to different addresses
+//
+bool NetClassBindingsDiffer(ENetClass Class1, ENetClass Class2)
+{
+    return (GetNetClassAddress(Class1).s_addr != GetNetClassAddress(Class2).s_addr)
+        || (strcmp(NetClasses[Class1].Interface, NetClasses[Class2].Interface) != 0);
+}
+
+
+//
+// apply interface binding and DSCP for a class to a socket
+//
+void ApplyNetClass(int Socketid, ENetClass Class)
+{
+    TNetClassSetting* Set = &NetClasses[Class];
+    int TOS;
+
+    if (Set->DSCP >= 0)
+    {
+        TOS = Set->DSCP << 2;
+        if (setsockopt(Socketid, IPPROTO_IP, IP_TOS, (void*)&TOS, sizeof(TOS)) < 0)
+            perror("setsockopt IP_TOS");
+    }
+    if (Set->Interface[0] != 0)
+    {
+        if (GetNetClassAddress(Class).s_addr == htonl(INADDR_ANY))
+            printf("network class %s: interface %s has no IPv4 address\n", NetClassNames[Class], Set->Interface);
+        if (setsockopt(Socketid, SOL_SOCKET, SO_BINDTODEVICE, Set->Interface, strlen(Set->Interface)) < 0)
+            perror("setsockopt SO_BINDTODEVICE");
+    }
+}
+
+
+//
+// mark one outgoing message with the DSCP of a class
+//
+void NetClassMarkMessage(struct msghdr* Message, ENetClass Class, uint8_t* ControlBuffer)
+{
+    struct cmsghdr* Cmsg;
+
+    if (NetClasses[Class].DSCP < 0)
+        return;
+    memset(ControlBuffer, 0, VNETCONTROLSIZE);
+    Message->msg_control = ControlBuffer;
+    Message->msg_controllen = CMSG_SPACE(sizeof(int));
+    Cmsg = CMSG_FIRSTHDR(Message);
+    Cmsg->cmsg_level = IPPROTO_IP;
+    Cmsg->cmsg_type = IP_TOS;
+    Cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    *(int*)CMSG_DATA(Cmsg) = NetClasses[Class].DSCP << 2;
+}
+
+
+//
+// read one kernel interface counter
+//
+static uint64_t ReadInterfaceCounter(char* Name, char* Counter)
+{
+    char Path[128];
+    FILE* Fp;
+    unsigned long long Value = 0;
+
+    snprintf(Path, sizeof(Path), "/sys/class/net/%s/statistics/%s", Name, Counter);
+    Fp = fopen(Path, "r");
+    if (Fp == NULL)
+        return 0;
+    if (fscanf(Fp, "%llu", &Value) != 1)
+        Value = 0;
+    fclose(Fp);
+    return (uint64_t)Value;
+}
+
+
+static void ReadInterfaceCounters(TInterfaceCounters* Ctr)
+{
+    Ctr->TxPackets = ReadInterfaceCounter(Ctr->Name, "tx_packets");
+    Ctr->TxBytes = ReadInterfaceCounter(Ctr->Name, "tx_bytes");
+    Ctr->TxDropped = ReadInterfaceCounter(Ctr->Name, "tx_dropped");
+    Ctr->TxErrors = ReadInterfaceCounter(Ctr->Name, "tx_errors");
+    Ctr->RxPackets = ReadInterfaceCounter(Ctr->Name, "rx_packets");
+    Ctr->RxBytes = ReadInterfaceCounter(Ctr->Name, "rx_bytes");
+    Ctr->RxDropped = ReadInterfaceCounter(Ctr->Name, "rx_dropped");
+    Ctr->RxErrors = ReadInterfaceCounter(Ctr->Name, "rx_errors");
+}
+
+
+//
+// find the interface used to reach the client, for classes with no binding
+//
+static bool GetClientInterface(char* Name)
+{
+    struct sockaddr_in Local;
+    socklen_t Length = sizeof(Local);
+    int Socketid;
+    bool Error = true;
+
+    Socketid = socket(AF_INET, SOCK_DGRAM, 0);
+    if (Socketid < 0)
+        return true;
+    if ((connect(Socketid, (struct sockaddr*)&reply_addr, sizeof(reply_addr)) == 0)
+        && (getsockname(Socketid, (struct sockaddr*)&Local, &Length) == 0))
+        Error = GetAddressInterface(Local.sin_addr, Name);
+    close(Socketid);
+    return Error;
+}
+
+
+//
+// build the list of interfaces in use, and the classes on each
+// returns the number of interfaces
+//
+static int FindInterfaces(TInterfaceCounters* List)
+{
+    char Name[IFNAMSIZ];
+    char ClientInterface[IFNAMSIZ];
+    int Class, Cntr, Count = 0;
+    bool HaveClient;
+    struct in_addr Address;
+
+    HaveClient = !GetClientInterface(ClientInterface);
+    for (Class = 0; Class < eNetNumClasses; Class++)
+    {
+        Address = GetNetClassAddress(Class);
+        if (NetClasses[Class].Interface[0] != 0)
+            strcpy(Name, NetClasses[Class].Interface);
+        else if ((Address.s_addr != htonl(INADDR_ANY)) && !GetAddressInterface(Address, Name))
+            ;
+        else if (HaveClient)
+            strcpy(Name, ClientInterface);
+        else
+            continue;
+        for (Cntr = 0; Cntr < Count; Cntr++)
+            if (strcmp(List[Cntr].Name, Name) == 0)
+                break;
+        if (Cntr == Count)
+        {
+            memset(&List[Count], 0, sizeof(TInterfaceCounters));
+            strcpy(List[Count].Name, Name);
+            Count++;
+        }
+        List[Cntr].Classes |= (1 << Class);
+    }
+    return Count;
+}
+
+
+//
+// print counter changes since the start of the run
+//
+static void PrintInterfaceReport(TInterfaceCounters* Start, int Count, double Seconds)
+{
+    TInterfaceCounters Now;
+    int Cntr, Class;
+
+    printf("network counters, %.1fs:\n", Seconds);
+    for (Cntr = 0; Cntr < Count; Cntr++)
+    {
+        memcpy(&Now, &Start[Cntr], sizeof(Now));
+        ReadInterfaceCounters(&Now);
+        printf("  %-10s tx %9llu pkts %8.2fMbit/s drop %llu err %llu; rx %9llu pkts %8.2fMbit/s drop %llu err %llu; classes:",
+               Now.Name,
+               (unsigned long long)(Now.TxPackets - Start[Cntr].TxPackets),
+               (double)(Now.TxBytes - Start[Cntr].TxBytes) * 8.0 / (Seconds * 1.0e6),
+               (unsigned long long)(Now.TxDropped - Start[Cntr].TxDropped),
+               (unsigned long long)(Now.TxErrors - Start[Cntr].TxErrors),
+               (unsigned long long)(Now.RxPackets - Start[Cntr].RxPackets),
+               (double)(Now.RxBytes - Start[Cntr].RxBytes) * 8.0 / (Seconds * 1.0e6),
+               (unsigned long long)(Now.RxDropped - Start[Cntr].RxDropped),
+               (unsigned long long)(Now.RxErrors - Start[Cntr].RxErrors));
+        for (Class = 0; Class < eNetNumClasses; Class++)
+            if (Now.Classes & (1 << Class))
+                printf(" %s", NetClassNames[Class]);
+        printf("\n");
+    }
+}
+
+
+//
+// get time in seconds
+//
+static double NetTimeSeconds(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (double)Now.tv_sec + (double)Now.tv_nsec / 1.0e9;
+}
+
+
+//
+// thread to report interface counters: at the end of each run, and
+// periodically during a run if debug enabled
+//
+static void* NetClassReport(__attribute__((unused)) void* arg)
+{
+    TInterfaceCounters Start[VNETMAXINTERFACES];
+    int Count = 0;
+    bool Running = false;
+    double StartTime = 0.0;
+    double NextReport = 0.0;
+    double Now;
+    int Cntr;
+
+    printf("spinning up network counter thread, pid=%ld\n", syscall(SYS_gettid));
+    while (1)
+    {
+        usleep(VNETREPORTPOLLMS * 1000);
+        Now = NetTimeSeconds();
+        if (SDRActive && !Running)
+        {
+            Count = FindInterfaces(Start);
+            for (Cntr = 0; Cntr < Count; Cntr++)
+                ReadInterfaceCounters(&Start[Cntr]);
+            StartTime = Now;
+            NextReport = Now + VNETDEBUGREPORTS;
+            Running = true;
+        }
+        else if (!SDRActive && Running)
+        {
+            PrintInterfaceReport(Start, Count, Now - StartTime);
+            Running = false;
+        }
+        else if (Running && UseDebug && (Now >= NextReport))
+        {
+            PrintInterfaceReport(Start, Count, Now - StartTime);
+            NextReport = Now + VNETDEBUGREPORTS;
+        }
+    }
+    return NULL;
+}
+
+
+//
+// start the thread that reports per interface counters for each run
+// returns true if error
+//
+bool InitialiseNetClassReporting(void)
+{
+    if (pthread_create(&NetReportThread, NULL, NetClassReport, NULL) < 0)
+    {
+        perror("pthread_create network counters");
+        return true;
+    }
+    pthread_detach(NetReportThread);
+    return false;
+}
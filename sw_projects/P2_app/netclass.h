@@ -0,0 +1,109 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// netclass.h:
+//
+// network stream classes: each class of P2 traffic can be bound to its own
+// interface or source address, with its own DSCP marking
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __netclass_h
+#define __netclass_h
+
+
+#include <stdint.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include "../common/saturntypes.h"
+
+
+#define VNETCONTROLSIZE 32                          // cmsg buffer size for NetClassMarkMessage()
+
+
+//
+// stream classes
+//
+typedef enum
+{
+    eNetControl,                                    // discovery, general, DDC & DUC specific, CAT
+    eNetHighPriority,                               // high priority status and commands
+    eNetDDC,                                        // DDC I/Q
+    eNetWideband,                                   // wideband ADC data
+    eNetTXIQ,                                       // DUC I/Q
+    eNetAudio,                                      // speaker and mic audio
+    eNetNumClasses
+} ENetClass;
+
+
+//
+// parse a -B command line setting: <class>:<interface or address>[:<dscp>]
+// returns true if error
+//
+bool ParseNetClassSetting(char* Setting);
+
+
+//
+// print the class settings
+//
+void PrintNetClassSettings(void);
+
+
+//
+// get the class of a P2 port table entry (VPORTxxx)
+//
+ENetClass GetPortNetClass(int PortIndex);
+
+
+//
+// get the local address a class should bind to (INADDR_ANY if not set)
+//
+struct in_addr GetNetClassAddress(ENetClass Class);
+
+
+//
+// true if two classes bind to different addresses, so a port they share
+// needs a separate socket for each
+//
+bool NetClassBindingsDiffer(ENetClass Class1, ENetClass Class2);
+
+
+//
+// check the ports that carry 2 classes. Where they bind to different addresses,
+// the client must send the port's incoming traffic to the receiving class's
+// address (printed). A sending class bound to a specific address while the
+// receiving class listens on all addresses would take that traffic, so it is refused.
+// returns true if refused
+//
+bool CheckNetClassSharedPorts(void);
+
+
+//
+// apply interface binding and DSCP for a class to a socket, before bind() or connect()
+//
+void ApplyNetClass(int Socketid, ENetClass Class);
+
+
+//
+// mark one outgoing message with the DSCP of a class. Used where a stream
+// sends on a socket it shares with another class. ControlBuffer must be
+// VNETCONTROLSIZE bytes and remain valid while the msghdr is used.
+//
+void NetClassMarkMessage(struct msghdr* Message, ENetClass Class, uint8_t* ControlBuffer);
+
+
+//
+// start the thread that reports per interface counters for each run
+// returns true if error
+//
+bool InitialiseNetClassReporting(void);
+
+
+#endif
@@ -48,6 +48,7 @@
 #include "../common/codecwrite.h"                   // codec register I/O for Saturn
 #include "../common/version.h"                      // version I/O for Saturn
 #include "../common/auxadc.h"                       // version I/O for Saturn
+#include "../common/fec.h"                          // forward error correction
 
 #include "threaddata.h"
 #include "generalpacket.h"
@@ -64,6 +65,27 @@
 #include "LDGATU.h"
 #include "AriesATU.h"
 #include "frontpanelhandler.h"
+#include "streamprofile.h"
+#include "selftest.h"
+#include "watchdog.h"
+#include "../common/spectrum.h"
+#include "../common/ddccontainer.h"
+#include "../common/predistortion.h"
+#include "../common/virtualrx.h"
+#include "../common/txiqformat.h"
+#include "netclass.h"
+#include "timedcommand.h"
+#include "txplayback.h"
+#include "liveness.h"
+#include "securestream.h"
+#include "tenant.h"
+#include "iqhistory.h"
+#include "wbevents.h"
+#include "clockcorr.h"
+#include "rxtiming.h"
+#include "presets.h"
+#include "handoff.h"
+#include "../common/p2crypt.h"
 
 #define P2APPVERSION 39
 #define FWREQUIREDMAJORVERSION 1                  // major version that is required. Only altered if programming interface changes. 
@@ -126,11 +148,15 @@ sem_t MicWBDMAMutex;                        // protect one DMA read channel shar
 
 struct sockaddr_in reply_addr;              // destination address for outgoing data
 
-bool IsTXMode;                              // true if in TX
+//
+// flags read by the streaming threads on every loop: they start a cache line,
+// and the flag written for every received packet has a line of its own
+//
+bool IsTXMode VCACHEALIGNED;                // true if in TX
 bool SDRActive;                             // true if this SDR is running at the moment
 bool ReplyAddressSet = false;               // true when reply address has been set
 bool StartBitReceived = false;              // true when "run" bit has been set
-bool NewMessageReceived = false;            // set whenever a message is received
+bool NewMessageReceived VCACHEALIGNED = false;  // set whenever a message is received
 bool ExitRequested = false;                 // true if "exit checking" thread requests shutdown
 bool SkipExitCheck = false;                 // true to skip "exit checking", if running as a service
 bool ThreadError = false;                   // true if a thread reports an error
@@ -198,7 +224,6 @@ pthread_t HighPriorityFromSDRThread;
 pthread_t WidebandDataThread;
 
 pthread_t CheckForExitThread;                 // thread looks for types "exit" command
-pthread_t CheckForNoActivityThread;           // thread looks for inactvity
 
 
 //
@@ -228,7 +253,7 @@ bool CheckActiveThreads(int StartingPoint)
 
   for (int i = StartingPoint; i < VPORTTABLESIZE; i++)          // loop through the socket table
   {
-    if(Ptr->Active)                                 // check this thread
+    if(atomic_load(&Ptr->Active))                   // check this thread
       Result = true;
     Ptr++;
   }
@@ -254,7 +279,7 @@ void SetPort(uint32_t ThreadNum, uint16_t PortNum)
     SocketData[ThreadNum].Portid = PortNum;
 
   if (SocketData[ThreadNum].Portid != CurrentPort)
-    SocketData[ThreadNum].Cmdid |= VBITCHANGEPORT;
+    atomic_fetch_or(&SocketData[ThreadNum].Cmdid, VBITCHANGEPORT);
 }
 
 
@@ -267,7 +292,18 @@ int MakeSocket(struct ThreadSocketData* Ptr, int DDCid)
 {
   struct timeval ReadTimeout;                                       // read timeout
   int yes = 1;
+  ENetClass Class;                                                  // stream class of this port
 //  struct sockaddr_in addr_cmddata;
+  //
+  // taking over from a running instance: its socket is already bound and set up
+  //
+  if(HandoffAdoptSocket(Ptr - SocketData, &Ptr->Socketid))
+  {
+    RxTimingPrepareSocket(Ptr - SocketData, Ptr->Socketid);
+    Ptr->DDCid = DDCid;
+    return 0;
+  }
+
   //
   // create socket for incoming data
   //
@@ -286,11 +322,13 @@ int MakeSocket(struct ThreadSocketData* Ptr, int DDCid)
   setsockopt(Ptr->Socketid, SOL_SOCKET, SO_RCVTIMEO, (void *)&ReadTimeout , sizeof(ReadTimeout));
 
   //
-  // bind application to the specified port
+  // bind application to the specified port, on the interface or address set for its stream class
   //
+  Class = GetPortNetClass(Ptr - SocketData);
+  ApplyNetClass(Ptr->Socketid, Class);
   memset(&Ptr->addr_cmddata, 0, sizeof(struct sockaddr_in));
   Ptr->addr_cmddata.sin_family = AF_INET;
-  Ptr->addr_cmddata.sin_addr.s_addr = htonl(INADDR_ANY);
+  Ptr->addr_cmddata.sin_addr = GetNetClassAddress(Class);
   Ptr->addr_cmddata.sin_port = htons(Ptr->Portid);
 
   if(bind(Ptr->Socketid, (struct sockaddr *)&Ptr->addr_cmddata, sizeof(struct sockaddr_in)) < 0)
@@ -303,6 +341,7 @@ int MakeSocket(struct ThreadSocketData* Ptr, int DDCid)
   socklen_t len = sizeof(checkin);
   if(getsockname(Ptr->Socketid, (struct sockaddr *)&checkin, &len)==-1)
     perror("getsockname");
+  RxTimingPrepareSocket(Ptr - SocketData, Ptr->Socketid);   // kernel receive timestamps, if analysed
 
   Ptr->DDCid = DDCid;                       // set DDC number, for outgoing ports
   return 0;
@@ -327,37 +366,13 @@ void* CheckForExitCommand(__attribute__((unused)) void *arg)
       ExitRequested = true;
       break;
     }
-  }
-  return NULL;
-}
-
-
-//
-// this runs as its own thread to see if messages have stopped being received.
-// if nomessages in a second, goes back to "inactive" state.
-//
-void* CheckForActivity(__attribute__((unused)) void *arg)
-{
-  bool PreviouslyActiveState;               
-  printf("Started check for activity thread, pid=%ld\n", syscall(SYS_gettid));
-  while(1)
-  {
-    sleep(1);                                   // wait for 1 second
-    PreviouslyActiveState = SDRActive;          // see if active on entry
-    if (!NewMessageReceived && HW_Timer_Enable) // if no messages received,
+    else if(((ch == 'r') || (ch == 'R')) && IQHistoryEnabled())
     {
-      SDRActive = false;                        // set back to inactive
-      IsTXMode = false;
-      SetMOX(false);
-      SetTXEnable(false);
-      EnableCW(false, false);
-      ReplyAddressSet = false;
-      StartBitReceived = false;
-      if(PreviouslyActiveState)
-        printf("Reverted to Inactive State after no activity\n");
+      if(IQHistoryTrigger("keyboard"))
+        printf("I/Q history: dump already in progress\n");
     }
-    NewMessageReceived = false;
   }
+  return NULL;
 }
 
 
@@ -423,17 +438,33 @@ int main(int argc, char *argv[])
   uint8_t CmdByte;                                                  // command word from PC app
   struct ifreq hwaddr;                                              // holds this device MAC address
   struct sockaddr_in addr_from;                                     // holds MAC address of source of incoming messages
-  uint8_t UDPInBuffer[VDDCPACKETSIZE];                              // outgoing buffer
+  uint8_t UDPInBuffer[VPBDATASIZE];                                 // incoming buffer (playback data is the longest)
   struct iovec iovecinst;                                           // iovcnt buffer - 1 for each outgoing buffer
   struct msghdr datagram;                                           // multiple incoming message header
 
   uint32_t TestFrequency;                                           // test source DDS freq
+  unsigned int FECGroup, FECDepth;                                  // FEC settings from command line
+  unsigned int SpecDDC, SpecSize, SpecRate, SpecAverages;           // spectrum mode settings from command line
+  unsigned int ContainerInterval = 0, ContainerSize;                // container mode settings from command line
+  unsigned int LivenessTX, LivenessSession;                         // loss of client timeouts from command line
+  unsigned int VRXDDC, VRXDecimation;                               // virtual receiver settings from command line
+  int VRXOffset;
+  unsigned int AudioDDC, AudioRate;                                 // demodulated audio settings from command line
+  int AudioLow, AudioHigh;
+  char AudioMode[8];
+  unsigned int VRXNumber = 0;
+  char* ProfilePath = VDEFAULTPROFILEFILE;                          // streaming profile file
+  bool RunTuner = false;                                            // true to generate a new streaming profile
+  bool RunSelfTest = false;                                         // true to run the streaming self test
+  uint32_t SelfTestFrequency = VSELFTESTDEFAULTFREQ;                // self test DDS frequency
+  bool SelfTestFailed;
   int CmdOption;                                                    // command line option
   char BuildDate[]=GIT_DATE;
 	ESoftwareID ID;
 	unsigned int Version = 0;
   unsigned int MajorVersion = 0;
   bool IncompatibleFirmware = false;                                // becomes set if firmware is not compatible with this version
+  bool Upgrading;                                                   // true if taking over from a running instance
 
 
   //
@@ -444,6 +475,12 @@ int main(int argc, char *argv[])
   sem_init(&RFGPIOMutex, 0, 1);                                     // for RF GPIO register
   sem_init(&CodecRegMutex, 0, 1);                                   // for codec accesss
   sem_init(&MicWBDMAMutex, 0, 1);                                   // for mic and WB DMA
+
+//
+// if a running instance listens at the -U path, take over from it:
+// the hardware is left as it set it up
+//
+  Upgrading = HandoffConnect(argc, argv);
     
 //
 // setup Saturn hardware
@@ -457,26 +494,32 @@ int main(int argc, char *argv[])
   if (IsFallbackConfig())
       printf("FPGA load is a fallback - you should re-flash the primary FPGA image!\n");
   
-  CodecInitialise();
   InitialiseDACAttenROMs();
-//  InitialiseCWKeyerRamp(true, 5000);                                // create initial default 5 ms ramp, P2
-  InitialiseCWKeyerRamp(true, 9000);                                // create initial default 9ms DL1YCF amp, P2
-  SetCWSidetoneEnabled(true);
-  SetTXProtocol(true);                                              // set to protocol 2
-  SetTXModulationSource(eIQData);                                   // disable debug options
-  HandlerSetEERMode(false);                                         // no EER
-  SetByteSwapping(true);                                            // h/w to generate network byte order
-  SetSpkrMute(false);
+  if(!Upgrading)
+  {
+    CodecInitialise();
+//    InitialiseCWKeyerRamp(true, 5000);                              // create initial default 5 ms ramp, P2
+    InitialiseCWKeyerRamp(true, 9000);                              // create initial default 9ms DL1YCF amp, P2
+    SetCWSidetoneEnabled(true);
+    SetTXProtocol(true);                                            // set to protocol 2
+    SetTXModulationSource(eIQData);                                 // disable debug options
+    HandlerSetEERMode(false);                                       // no EER
+    SetByteSwapping(true);                                          // h/w to generate network byte order
+    SetSpkrMute(false);
+  }
 
   Version = GetFirmwareVersion(&ID);                                // TX scaling changed at FW V13
   MajorVersion = GetFirmwareMajorVersion();
 
-  if(Version < 13)
-    SetTXAmplitudeScaling(VCONSTTXAMPLSCALEFACTOR);
-  else if (Version < 17)
-    SetTXAmplitudeScaling(VCONSTTXAMPLSCALEFACTOR_13);
-  else
-    SetTXAmplitudeScaling(VCONSTTXAMPLSCALEFACTOR_17);
+  if(!Upgrading)
+  {
+    if(Version < 13)
+      SetTXAmplitudeScaling(VCONSTTXAMPLSCALEFACTOR);
+    else if (Version < 17)
+      SetTXAmplitudeScaling(VCONSTTXAMPLSCALEFACTOR_13);
+    else
+      SetTXAmplitudeScaling(VCONSTTXAMPLSCALEFACTOR_17);
+  }
   
 
 
@@ -494,28 +537,27 @@ int main(int argc, char *argv[])
   }
 
   // SetTXEnable(true);                                             // now only enabled if SDR active
-  EnableAlexManualFilterSelect(true);
-  SetBalancedMicInput(false);
+  if(!Upgrading)
+  {
+    EnableAlexManualFilterSelect(true);
+    SetBalancedMicInput(false);
+  }
   InitCATHandler();
 
   if (signal(SIGINT, sig_handler) == SIG_ERR)
     printf("\ncan't catch SIGINT\n");
 
 //
-// start up thread to check for no longer getting messages, to set back to inactive
+// start up thread to check for the client stopping, to drop TX and set back to inactive
 //
-  if(pthread_create(&CheckForNoActivityThread, NULL, CheckForActivity, NULL) < 0)
-  {
-    perror("pthread_create check for exit");
+  if(InitialiseLiveness())
     return EXIT_FAILURE;
-  }
-  pthread_detach(CheckForNoActivityThread);
 
 //
 // option string needs a colon after each option letter that has a parameter after it
 // and it has a leading colon to suppress error messages
 //
-  while((CmdOption = getopt(argc, argv, ":a:i:f:m:sdph")) != -1)
+  while((CmdOption = getopt(argc, argv, ":a:i:f:m:F:P:TX:S:A:C:B:L:V:W:K:M:R:U:D:E:J:N:Qsdph")) != -1)
   {
     switch(CmdOption)
     {
@@ -532,6 +574,52 @@ int main(int argc, char *argv[])
         printf("-s            skip checking for exit keys, run as service\n");
         printf("-d            print additional debug\n");
         printf("-p            drive G2 control panel\n");
+        printf("-F <group>[,<depth>] XOR parity FEC on DDC output and TX I/Q input\n");
+        printf("              <group> data packets per parity packet (2-%d);\n", VFECMAXGROUP);
+        printf("              <depth> interleave depth (1-%d, default 1) for burst loss\n", VFECMAXDEPTH);
+        printf("-P <file>     streaming profile file (default %s)\n", VDEFAULTPROFILEFILE);
+        printf("-T            run streaming tuner at startup and save the profile\n");
+        printf("-X <frequency in Hz> run streaming self test with test source, then exit\n");
+        printf("-X offline    check the self test analysis with synthesised data, then exit\n");
+        printf("-S <ddc>:<fft size>[,<frames/s>[,<averages>]] send panadapter spectrum for a DDC instead of I/Q\n");
+        printf("              fft size %d-%d, default 10 frames/s with 4 averages; may be repeated\n", VSPECMINFFT, VSPECMAXFFT);
+        printf("-A <ddc>:<mode>[,<audio ksps>[,<low Hz>,<high Hz>]] send demodulated audio for a DDC instead of I/Q\n");
+        printf("              mode am, usb, lsb, cwu, cwl or fm; audio 8, 12 or 16ksps (default 8); may be repeated\n");
+        printf("-A bench      measure demodulator load and bandwidth on this processor, then exit\n");
+        printf("-C <ms>[,<bytes>] send I/Q from all DDCs in container datagrams every <ms> (1-%d)\n", VCTMAXINTERVALMS);
+        printf("              of up to <bytes> (%d-%d, default %d)\n", VCTMINSIZE, VCTMAXSIZE, VCTDEFAULTSIZE);
+        printf("-B <class>:<interface or address>[:<dscp>] bind a stream class; may be repeated\n");
+        printf("              classes: control, highpriority, ddc, wideband, txiq, audio\n");
+        printf("              eg -B ddc:eth1:8 -B control::46  (empty interface = any)\n");
+        printf("-Q            check timed commands with simulated registers, then exit\n");
+        printf("-L <tx ms>[,<session ms>] drop TX when DUC I/Q stops, end session when all client streams stop\n");
+        printf("              (defaults %d, %d)\n", VLVDEFAULTTXMS, VLVDEFAULTSESSIONMS);
+        printf("-L check      check loss of client detection with a scripted client, then exit\n");
+        printf("-W <file>     check preloaded TX playback with simulated registers, DUC output to <file>, then exit\n");
+        printf("-V <ddc>:<offset Hz>:<decimation> add a virtual receiver fed from a wide DDC; may be repeated\n");
+        printf("              virtual receiver n is sent as DDC %d+n\n", VNUMDDC);
+        printf("-V bench      measure how many virtual receivers this processor can run, then exit\n");
+        printf("-K <file>     encrypt and authenticate all P2 datagrams with the pre-shared key in <file>\n");
+        printf("              (%d hex digits); the client must use the same key\n", 2 * VP2CKEYSIZE);
+        printf("-M <ddcs>:<base port>[:<ksps>[,<cpu %%>[,<Mbit/s>]]] give DDCs to a separate RX client using\n");
+        printf("              ports from <base port>, with optional budgets; may be repeated (up to %d)\n", VTNMAXTENANTS - 1);
+        printf("              eg -M 4-7:2048:768,25  (base port %d sets the primary client's DDCs)\n", VTNPRIMARYBASEPORT);
+        printf("-M check      check partitioned DDCs with two scripted clients, then exit\n");
+        printf("-R <seconds>[,<post seconds>[,<MB>[,<directory>]]] keep the last <seconds> of I/Q from every DDC\n");
+        printf("              in memory (default %dMB); 'r' or SIGUSR1 writes it to <directory>\n", VIHDEFAULTMB);
+        printf("-R trigger:<ddc>:<dBFS> also write it when a DDC's signal reaches a level\n");
+        printf("-R check      check I/Q history with synthesised streams, then exit\n");
+        printf("-U <socket path> upgrade: take over streaming from an instance started with the same path,\n");
+        printf("              else listen there for a later instance to take over from this one\n");
+        printf("-U check      check upgrade handover with a modelled stream, then exit\n");
+        printf("-D <adc>,<updates/s>[,<fft size>[,<averages>[,<min SNR dB>[,<port>]]]] detect signals in\n");
+        printf("              wideband data from ADC 0 or 1; events to subscribers on <port> (default %d)\n", VWBEDEFAULTPORT);
+        printf("-D bench      measure signal detector load on this processor, then exit\n");
+        printf("-E check      check sample clock to host clock correlation with simulated DMA timing, then exit\n");
+        printf("-J <seconds>  report arrival jitter, bursts and read delay of DUC I/Q, speaker and high priority\n");
+        printf("              datagrams from kernel timestamps every <seconds> while running\n");
+        printf("-J check      check arrival timing with a local paced sender, then exit\n");
+        printf("-N check      check band preset switching with simulated registers, then exit\n");
         return EXIT_SUCCESS;
         break;
 
@@ -616,10 +704,236 @@ int main(int argc, char *argv[])
       case 'p':
         printf ("Control panel enabled\n");                  
         UseControlPanel = true;
+        break;
+
+      case 'F':
+        FECDepth = 1;
+        if((sscanf(optarg, "%u,%u", &FECGroup, &FECDepth) < 1) || (FECGroup == 0) || FECSetConfiguration(FECGroup, FECDepth))
+        {
+          printf("error parsing FEC settings\n");
+          printf("-F <group>[,<depth>]  group = 2 to %d; depth = 1 to %d\n", VFECMAXGROUP, VFECMAXDEPTH);
+          return EXIT_SUCCESS;
+        }
+        printf("FEC enabled: 1 parity packet per %d data packets, interleave depth %d\n", FECGroup, FECDepth);
+        break;
+
+      case 'P':
+        ProfilePath = optarg;
+        break;
+
+      case 'T':
+        printf("Streaming tuner will run\n");
+        RunTuner = true;
+        break;
+
+      case 'S':
+        SpecRate = 10;
+        SpecAverages = 4;
+        if((sscanf(optarg, "%u:%u,%u,%u", &SpecDDC, &SpecSize, &SpecRate, &SpecAverages) < 2)
+           || SetDDCSpectrumMode(SpecDDC, SpecSize, SpecRate, SpecAverages))
+        {
+          printf("error parsing spectrum settings\n");
+          printf("-S <ddc>:<fft size>[,<frames/s>[,<averages>]]  ddc = 0 to %d; fft size = power of 2, %d to %d;\n", VNUMDDC-1, VSPECMINFFT, VSPECMAXFFT);
+          printf("              up to %d frames/s; up to %d averages\n", VSPECMAXRATE, VSPECMAXAVERAGES);
+          return EXIT_SUCCESS;
+        }
+        printf("DDC%d sends spectrum: %d point FFT, %d frames/s, %d averages\n", SpecDDC, SpecSize, SpecRate, SpecAverages);
+        break;
+
+      case 'A':
+        if(strcmp(optarg,"bench") == 0)
+        {
+          DemodAudioPrintBenchmark();
+          return EXIT_SUCCESS;
+        }
+        AudioRate = VDAMINRATE;
+        AudioLow = 0;
+        AudioHigh = 0;
+        if((sscanf(optarg, "%u:%7[a-z],%u,%d,%d", &AudioDDC, AudioMode, &AudioRate, &AudioLow, &AudioHigh) < 2)
+           || (DemodAudioModeByName(AudioMode) == eDemodNone)
+           || SetDDCAudioMode(AudioDDC, DemodAudioModeByName(AudioMode), AudioRate, AudioLow, AudioHigh))
+        {
+          printf("error parsing demodulated audio settings\n");
+          printf("-A <ddc>:<mode>[,<audio ksps>[,<low Hz>,<high Hz>]]  ddc = 0 to %d, not in spectrum mode;\n", VNUMDDC-1);
+          printf("              mode = am, usb, lsb, cwu, cwl or fm; audio = 8, 12 or 16ksps;\n");
+          printf("              passband relative to the DDC frequency (default for the mode)\n");
+          return EXIT_SUCCESS;
+        }
+        printf("DDC%d sends %s audio at %dksps\n", AudioDDC, AudioMode, AudioRate);
+        break;
+
+      case 'C':
+        ContainerSize = VCTDEFAULTSIZE;
+        if((sscanf(optarg, "%u,%u", &ContainerInterval, &ContainerSize) < 1)
+           || SetDDCContainerMode(ContainerInterval, ContainerSize))
+        {
+          printf("error parsing container settings\n");
+          printf("-C <ms>[,<bytes>]  ms = 1 to %d; bytes = %d to %d\n", VCTMAXINTERVALMS, VCTMINSIZE, VCTMAXSIZE);
+          return EXIT_SUCCESS;
+        }
+        printf("DDC I/Q sent in containers every %dms, up to %d bytes\n", ContainerInterval, ContainerSize);
+        if(ContainerSize > VCTDEFAULTSIZE)
+          printf("containers larger than %d bytes need a jumbo frame link, or will be fragmented\n", VCTDEFAULTSIZE);
+        break;
+
+      case 'B':
+        if(ParseNetClassSetting(optarg))
+        {
+          printf("error parsing stream class binding %s\n", optarg);
+          printf("-B <class>:<interface or address>[:<dscp>]  dscp = 0 to 63\n");
+          return EXIT_SUCCESS;
+        }
+        break;
+
+      case 'Q':
+        return RunTimedCommandCheck() ? EXIT_FAILURE : EXIT_SUCCESS;
+
+      case 'W':
+        return RunTXPlaybackCheck(optarg) ? EXIT_FAILURE : EXIT_SUCCESS;
+
+      case 'M':
+        if(strcmp(optarg,"check") == 0)
+          return RunTenantCheck() ? EXIT_FAILURE : EXIT_SUCCESS;
+        if(ParseTenantSetting(optarg))
+        {
+          printf("error parsing tenant setting %s\n", optarg);
+          return EXIT_SUCCESS;
+        }
+        break;
+
+      case 'R':
+        if(strcmp(optarg,"check") == 0)
+          return RunIQHistoryCheck() ? EXIT_FAILURE : EXIT_SUCCESS;
+        if(ParseIQHistorySetting(optarg))
+        {
+          printf("error parsing I/Q history setting %s\n", optarg);
+          printf("-R <seconds>[,<post seconds>[,<MB>[,<directory>]]]  seconds = 1 to %d, post = 0 to %d, MB = 1 to %d\n",
+                 VIHMAXSECONDS, VIHMAXSECONDS, VIHMAXMB);
+          printf("-R trigger:<ddc>:<dBFS>  dBFS = -140 to 0\n");
+          return EXIT_SUCCESS;
+        }
+        break;
+
+      case 'D':
+        if(strcmp(optarg,"bench") == 0)
+        {
+          WBDetectPrintBenchmark();
+          return EXIT_SUCCESS;
+        }
+        if(ParseWBDetectSetting(optarg))
+        {
+          printf("error parsing signal detector setting %s\n", optarg);
+          printf("-D <adc>,<updates/s>[,<fft size>[,<averages>[,<min SNR dB>[,<port>]]]]  adc = 0 or 1; updates = 1 to %d;\n", VWBDMAXUPDATES);
+          printf("              fft size %d-%d (power of 2, default %d); averages 1 to %d (default %d); min SNR 0 to 60\n",
+                 VWBDMINFFT, VWBDMAXFFT, VWBDDEFAULTFFT, VWBDMAXAVERAGES, VWBDDEFAULTAVERAGES);
+          return EXIT_SUCCESS;
+        }
+        break;
+
+      case 'J':
+        if(strcmp(optarg,"check") == 0)
+          return RunRxTimingCheck() ? EXIT_FAILURE : EXIT_SUCCESS;
+        if(ParseRxTimingSetting(optarg))
+        {
+          printf("error parsing arrival timing setting %s\n", optarg);
+          printf("-J <seconds>  seconds = 1 to %d\n", VRXTMAXREPORTSECONDS);
+          return EXIT_SUCCESS;
+        }
+        break;
+
+      case 'E':
+        if(strcmp(optarg,"check") == 0)
+          return RunClockCorrCheck() ? EXIT_FAILURE : EXIT_SUCCESS;
+        printf("-E check is the only sample clock option\n");
+        return EXIT_SUCCESS;
+
+      case 'N':
+        if(strcmp(optarg,"check") == 0)
+          return RunPresetCheck() ? EXIT_FAILURE : EXIT_SUCCESS;
+        printf("-N check is the only band preset option\n");
+        return EXIT_SUCCESS;
+
+      case 'U':
+        if(strcmp(optarg,"check") == 0)
+          return RunHandoffCheck() ? EXIT_FAILURE : EXIT_SUCCESS;
+        break;                                                      // path already taken by HandoffConnect()
+
+      case 'K':
+        if(LoadSecureKey(optarg))
+        {
+          printf("error reading pre-shared key file %s\n", optarg);
+          return EXIT_SUCCESS;
+        }
+        printf("P2 datagrams encrypted and authenticated: ChaCha20-Poly1305, %d bytes added to each\n", VP2COVERHEAD);
+        break;
+
+      case 'L':
+        if(strcmp(optarg,"check") == 0)
+          return RunLivenessCheck() ? EXIT_FAILURE : EXIT_SUCCESS;
+        LivenessSession = VLVDEFAULTSESSIONMS;
+        if((sscanf(optarg, "%u,%u", &LivenessTX, &LivenessSession) < 1)
+           || SetLivenessTimeouts(LivenessTX, LivenessSession))
+        {
+          printf("error parsing liveness timeouts\n");
+          printf("-L <tx ms>[,<session ms>]  tx = %d to %d; session = tx to %d\n", 2 * VLVCHECKMS, VLVMAXTIMEOUTMS, VLVMAXTIMEOUTMS);
+          return EXIT_SUCCESS;
+        }
+        break;
+
+      case 'V':
+        if(strcmp(optarg,"bench") == 0)
+        {
+          VirtualRXPrintBenchmark();
+          return EXIT_SUCCESS;
+        }
+        if((sscanf(optarg, "%u:%d:%u", &VRXDDC, &VRXOffset, &VRXDecimation) != 3)
+           || AddVirtualReceiver(VRXDDC, VRXOffset, VRXDecimation))
+        {
+          printf("error parsing virtual receiver settings\n");
+          printf("-V <ddc>:<offset Hz>:<decimation>  ddc = 0 to %d; offset up to +/-%dHz; decimation = %d to %d;\n",
+                 VNUMDDC-1, VVRXMAXOFFSET, VVRXMINDECIMATION, VVRXMAXDECIMATION);
+          printf("              up to %d virtual receivers\n", VVRXMAX);
+          return EXIT_SUCCESS;
+        }
+        printf("virtual receiver %d (sent as DDC %d): DDC%d %+dHz, sample rate / %d\n",
+               VRXNumber, VNUMDDC + VRXNumber, VRXDDC, VRXOffset, VRXDecimation);
+        VRXNumber++;
+        break;
+
+      case 'X':
+        if(strcmp(optarg,"offline") == 0)
+          return RunSelfTestAnalysisCheck() ? EXIT_FAILURE : EXIT_SUCCESS;
+        SelfTestFrequency = atoi(optarg);
+        if(SelfTestFrequency == 0)
+          SelfTestFrequency = VSELFTESTDEFAULTFREQ;
+        printf("Streaming self test will run, test frequency = %dHz\n", SelfTestFrequency);
+        RunSelfTest = true;
+        break;
     }
   }
+  if(TenantsEnabled() && (ContainerInterval != 0))
+  {
+    printf("DDC containers (-C) cannot be used with partitioned DDCs (-M)\n");
+    return EXIT_FAILURE;
+  }
+  if(CheckNetClassSharedPorts())
+    return EXIT_FAILURE;
   printf("\n");
 
+//
+// load the streaming profile, or generate one if requested
+//
+  if(RunTuner)
+  {
+    if(RunStreamTuner(ProfilePath))
+      printf("streaming tuner failed; using built-in defaults\n");
+  }
+  else if(LoadStreamProfile(ProfilePath))
+    printf("no streaming profile %s; using built-in defaults\n", ProfilePath);
+  PrintStreamProfile();
+  PrintNetClassSettings();
+  PrintLivenessReport();
+
 
 //
 // startup ATU handler if needed
@@ -652,6 +966,12 @@ int main(int argc, char *argv[])
   }
   pthread_detach(CheckForExitThread);
 
+  //
+  // upgrade: take the running instance's sockets, devices and state before making any socket
+  //
+  if(Upgrading && HandoffReceive())
+    return EXIT_FAILURE;
+
   //
   // create socket for incoming data on the command port
   //
@@ -706,7 +1026,30 @@ int main(int argc, char *argv[])
     for(i = 0; i < 6; ++i) DiscoveryReply[i + 5] = hwaddr.ifr_addr.sa_data[i];         // copy MAC to reply message
 #endif
 
+//
+// partitioned mode: each other tenant gets its own ports and listener thread
+//
+  if(InitialiseTenants(DiscoveryReply))
+    return EXIT_FAILURE;
+  if(InitialiseIQHistory())
+    return EXIT_FAILURE;
+  if(InitialiseWBEvents())
+    return EXIT_FAILURE;
+
+
 
+//
+// start the streaming thread watchdog before the threads it monitors
+//
+  if(InitialiseWatchdog())
+    return EXIT_FAILURE;
+  if(InitialiseNetClassReporting())
+    return EXIT_FAILURE;
+  if(InitialiseRxTiming())
+    return EXIT_FAILURE;
+  if(InitialiseTimedCommands())
+    return EXIT_FAILURE;
+  InitialiseDUCPredistortion();
 
   MakeSocket(SocketData+VPORTDDCSPECIFIC, 0);            // create and bind a socket
   if(pthread_create(&DDCSpecificThread, NULL, IncomingDDCSpecific, (void*)&SocketData[VPORTDDCSPECIFIC]) < 0)
@@ -751,10 +1094,16 @@ int main(int argc, char *argv[])
 //
 // create outgoing mic data thread
 // note this shares a port with incoming DUC specific, so don't create a new port
-// instead copy socket settings from DUCSPECIFIC socket:
+// instead copy socket settings from DUCSPECIFIC socket
+// (unless the audio class is bound to a different address: then it needs its own socket)
 //
-  SocketData[VPORTMICAUDIO].Socketid = SocketData[VPORTDUCSPECIFIC].Socketid;
-  memcpy(&SocketData[VPORTMICAUDIO].addr_cmddata, &SocketData[VPORTDUCSPECIFIC].addr_cmddata, sizeof(struct sockaddr_in));
+  if(NetClassBindingsDiffer(eNetAudio, eNetControl))
+    MakeSocket(SocketData+VPORTMICAUDIO, 0);
+  else
+  {
+    SocketData[VPORTMICAUDIO].Socketid = SocketData[VPORTDUCSPECIFIC].Socketid;
+    memcpy(&SocketData[VPORTMICAUDIO].addr_cmddata, &SocketData[VPORTDUCSPECIFIC].addr_cmddata, sizeof(struct sockaddr_in));
+  }
   if(pthread_create(&MicThread, NULL, OutgoingMicSamples, (void*)&SocketData[VPORTMICAUDIO]) < 0)
   {
     perror("pthread_create Mic");
@@ -766,10 +1115,16 @@ int main(int argc, char *argv[])
 //
 // create outgoing high priority data thread
 // note this shares a port with incoming DDC specific, so don't create a new port
-// instead copy socket settings from VPORTDDCSPECIFIC socket:
+// instead copy socket settings from VPORTDDCSPECIFIC socket
+// (unless the high priority class is bound to a different address)
 //
-  SocketData[VPORTHIGHPRIORITYFROMSDR].Socketid = SocketData[VPORTDDCSPECIFIC].Socketid;
-  memcpy(&SocketData[VPORTHIGHPRIORITYFROMSDR].addr_cmddata, &SocketData[VPORTDDCSPECIFIC].addr_cmddata, sizeof(struct sockaddr_in));
+  if(NetClassBindingsDiffer(eNetHighPriority, eNetControl))
+    MakeSocket(SocketData+VPORTHIGHPRIORITYFROMSDR, 0);
+  else
+  {
+    SocketData[VPORTHIGHPRIORITYFROMSDR].Socketid = SocketData[VPORTDDCSPECIFIC].Socketid;
+    memcpy(&SocketData[VPORTHIGHPRIORITYFROMSDR].addr_cmddata, &SocketData[VPORTDDCSPECIFIC].addr_cmddata, sizeof(struct sockaddr_in));
+  }
   if(pthread_create(&HighPriorityFromSDRThread, NULL, OutgoingHighPriority, (void*)&SocketData[VPORTHIGHPRIORITYFROMSDR]) < 0)
   {
     perror("pthread_create outgoing hi priority");
@@ -806,11 +1161,22 @@ int main(int argc, char *argv[])
 // both sockets already exist so copy socket settings from existing sockets:
 // wideband0 shares port 1027 with incoming high priority data
 // wideband1 shares port 1028 with incoming DDC audio
+// if the wideband class is bound to a different address, make new sockets on those ports
 //
-    SocketData[VPORTWIDEBAND0].Socketid = SocketData[VPORTHIGHPRIORITYTOSDR].Socketid;
-    SocketData[VPORTWIDEBAND1].Socketid = SocketData[VPORTSPKRAUDIO].Socketid;
-    memcpy(&SocketData[VPORTWIDEBAND0].addr_cmddata, &SocketData[VPORTHIGHPRIORITYTOSDR].addr_cmddata, sizeof(struct sockaddr_in));
-    memcpy(&SocketData[VPORTWIDEBAND1].addr_cmddata, &SocketData[VPORTSPKRAUDIO].addr_cmddata, sizeof(struct sockaddr_in));
+    if(NetClassBindingsDiffer(eNetWideband, eNetHighPriority))
+      MakeSocket(SocketData+VPORTWIDEBAND0, 0);
+    else
+    {
+      SocketData[VPORTWIDEBAND0].Socketid = SocketData[VPORTHIGHPRIORITYTOSDR].Socketid;
+      memcpy(&SocketData[VPORTWIDEBAND0].addr_cmddata, &SocketData[VPORTHIGHPRIORITYTOSDR].addr_cmddata, sizeof(struct sockaddr_in));
+    }
+    if(NetClassBindingsDiffer(eNetWideband, eNetAudio))
+      MakeSocket(SocketData+VPORTWIDEBAND1, 0);
+    else
+    {
+      SocketData[VPORTWIDEBAND1].Socketid = SocketData[VPORTSPKRAUDIO].Socketid;
+      memcpy(&SocketData[VPORTWIDEBAND1].addr_cmddata, &SocketData[VPORTSPKRAUDIO].addr_cmddata, sizeof(struct sockaddr_in));
+    }
     if(pthread_create(&WidebandDataThread, NULL, OutgoingWidebandSamples, (void*)&SocketData[VPORTWIDEBAND0]) < 0)
     {
       perror("pthread_create outgoing wideband data");
@@ -818,6 +1184,25 @@ int main(int argc, char *argv[])
     }
     pthread_detach(WidebandDataThread);
   }
+  else if(WBEventsEnabled())
+    printf("signal detector needs wideband data: FPGA firmware version 18 or later\n");
+
+//
+// run the self test if requested, now all threads are running, then exit
+//
+  if(RunSelfTest)
+  {
+    SelfTestFailed = RunStreamSelfTest(SelfTestFrequency);
+    Shutdown();
+    return SelfTestFailed ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+
+//
+// listen for a later instance to take over from this one, if -U is set
+//
+  if(InitialiseHandoff())
+    return EXIT_FAILURE;
+  HandoffRegisterThread(eHOMain);
 
 
 
@@ -831,18 +1216,24 @@ int main(int argc, char *argv[])
   // cmd=03: set IP address (not supported)
   // cmd=04: erase (not supported)
   // cmd=05: program (not supported)
+  // cmd=10: timed register commands
+  // cmd=12: TX predistortion table (longer than 60 bytes to load a table)
+  // cmd=13: TX I/Q format negotiation
+  // cmd=14: preloaded TX waveform playback (longer than 60 bytes to upload data)
   //
   while(1)
   {
+    if(HandoffFreezing())
+      HandoffPark(eHOMain, NULL, 0);
     memset(&iovecinst, 0, sizeof(struct iovec));
     memset(&datagram, 0, sizeof(datagram));
     iovecinst.iov_base = &UDPInBuffer;                  // set buffer for incoming message number i
-    iovecinst.iov_len = VDDCPACKETSIZE;
+    iovecinst.iov_len = sizeof(UDPInBuffer);
     datagram.msg_iov = &iovecinst;
     datagram.msg_iovlen = 1;
     datagram.msg_name = &addr_from;
     datagram.msg_namelen = sizeof(addr_from);
-    size = recvmsg(SocketData[0].Socketid, &datagram, 0);         // get one message. If it times out, gets size=-1
+    size = SecureRecvMsg(SocketData[0].Socketid, &datagram);         // get one message. If it times out, gets size=-1
     if(size < 0 && errno != EAGAIN)
     {
       perror("recvfrom, port 1024");
@@ -893,11 +1284,14 @@ int main(int argc, char *argv[])
           if(SDRActive || IncompatibleFirmware)
             DiscoveryReply[4] = 3;                             // response 2 if not active, 3 if running
           else
+          {
             DiscoveryReply[4] = 2;                             // response 2 if not active, 3 if running
+            ResetTXIQFormat();                                 // new client: standard TX I/Q until it asks
+          }
 
           memset(&UDPInBuffer, 0, VDISCOVERYREPLYSIZE);
           memcpy(&UDPInBuffer, DiscoveryReply, VDISCOVERYREPLYSIZE);
-          sendto(SocketData[0].Socketid, &UDPInBuffer, VDISCOVERYREPLYSIZE, 0, (struct sockaddr *)&addr_from, sizeof(addr_from));
+          SecureSendTo(SocketData[0].Socketid, &UDPInBuffer, VDISCOVERYREPLYSIZE, &addr_from);
           break;
 
         case 3:
@@ -906,11 +1300,61 @@ int main(int argc, char *argv[])
           printf("Unsupported packet\n");
           break;
 
+        //
+        // timed register commands
+        //
+        case VTIMEDCMDPACKETID:
+          HandleTimedCommandPacket(UDPInBuffer, SocketData[0].Socketid, &addr_from);
+          break;
+
+        //
+        // TX predistortion (60 byte packet can only disable it)
+        //
+        case VPDPACKETID:
+          HandleDUCPredistortionPacket(UDPInBuffer, size);
+          break;
+
+        //
+        // TX I/Q format negotiation
+        //
+        case VTXFPACKETID:
+          HandleTXFormatPacket(UDPInBuffer, SocketData[0].Socketid, &addr_from);
+          break;
+
+        //
+        // preloaded TX waveform playback
+        //
+        case VPBPACKETID:
+          HandleTXPlaybackPacket(UDPInBuffer, size, SocketData[0].Socketid, &addr_from);
+          break;
+
+        //
+        // band presets
+        //
+        case VPRPACKETID:
+          HandlePresetPacket(UDPInBuffer, size, SocketData[0].Socketid, &addr_from);
+          break;
+
         default:
           break;
 
       }// end switch (packet type)
     }
+    else if((size > 0) && (CmdByte == VPDPACKETID))
+    {
+      NewMessageReceived = true;
+      HandleDUCPredistortionPacket(UDPInBuffer, size);
+    }
+    else if((size > 0) && (CmdByte == VPBPACKETID))
+    {
+      NewMessageReceived = true;
+      HandleTXPlaybackPacket(UDPInBuffer, size, SocketData[0].Socketid, &addr_from);
+    }
+    else if((size > 0) && (CmdByte == VPRPACKETID))
+    {
+      NewMessageReceived = true;
+      HandlePresetPacket(UDPInBuffer, size, SocketData[0].Socketid, &addr_from);
+    }
 //
 // now do any "post packet" processing
 //
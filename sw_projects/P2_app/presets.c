@@ -0,0 +1,725 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// presets.c:
+//
+// band presets: a client preloads named register images for its bands or
+// antennas, then switches between them with one command. A switch writes
+// only the registers that change, in a fixed order, in one burst.
+//
+// a load is converted to register values when it arrives, so a switch only
+// compares and writes. Switches are serialised by the preset mutex, and the
+// burst is written under the GPIO mutex (see ApplyBandRegisters), so a switch
+// made at the same time as a timed command or another switch is never mixed
+// with it. Presets are held until deleted or p2app exits; the statistics
+// cover one run.
+//
+//////////////////////////////////////////////////////////////
+
+#include "threaddata.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "../common/saturnregisters.h"
+#include "../common/hwaccess.h"
+#include "presets.h"
+#include "securestream.h"
+#include "tenant.h"
+#include "liveness.h"
+#include "txplayback.h"
+
+
+//
+// one preset
+//
+typedef struct
+{
+    bool Loaded;
+    char Name[VPRNAMESIZE + 1];
+    TBandRegisters Image;
+} TBandPreset;
+
+
+TBandPreset Presets[VPRMAXPRESETS];
+uint8_t LastPreset = 0xFF;                          // last preset switched to
+pthread_mutex_t PresetMutex = PTHREAD_MUTEX_INITIALIZER;
+
+//
+// switch statistics
+//
+uint32_t PresetSwitches;
+uint32_t PresetRefused;
+uint32_t PresetWrites;
+uint32_t PresetUnchanged;
+int64_t PresetSumLatencyNs;
+int64_t PresetMaxLatencyNs;
+uint32_t PresetLatencyBins[VPRNUMLATENCYBINS];
+char* PresetLatencyBinNames[VPRNUMLATENCYBINS] = {"<10us", "<100us", "<1ms", "<10ms", ">=10ms"};
+
+
+//
+// CLOCK_MONOTONIC time in ns
+//
+static int64_t PresetNowNs(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (int64_t)Now.tv_sec * 1000000000LL + Now.tv_nsec;
+}
+
+
+//
+// registers included in an image
+//
+static uint32_t CountBandRegisters(uint32_t Mask)
+{
+    uint32_t Count = 0;
+
+    while (Mask != 0)
+    {
+        Count += Mask & 1;
+        Mask >>= 1;
+    }
+    return Count;
+}
+
+
+//
+// switch to a preset. RequestNs: CLOCK_MONOTONIC time the request was
+// received, for the latency. Result (if not NULL) gets the outcome.
+// returns true if the switch was not made
+//
+bool SwitchBandPreset(uint32_t Preset, int64_t RequestNs, TPresetSwitch* Result)
+{
+    TPresetSwitch Switch;
+    TBandRegisters Image;
+    uint32_t DDC;
+    int64_t StartNs, EndNs;
+    int Bin;
+
+    memset(&Switch, 0, sizeof(Switch));
+    pthread_mutex_lock(&PresetMutex);
+    if (Preset >= VPRMAXPRESETS)
+        Switch.Result = ePRBadRequest;
+    else if (!Presets[Preset].Loaded)
+        Switch.Result = ePREmpty;
+    else
+    {
+        Image = Presets[Preset].Image;
+        for (DDC = 0; DDC < VNUMDDC; DDC++)                    // the primary client's DDCs only
+            if (TenantOfDDC(DDC) != 0)
+                Image.Mask &= ~(1 << DDC);
+        StartNs = PresetNowNs();
+        if (ApplyBandRegisters(&Image, &Switch.Writes))
+            Switch.Result = ePRTransmitting;
+        else
+        {
+            EndNs = PresetNowNs();
+            Switch.Unchanged = CountBandRegisters(Image.Mask) - Switch.Writes;
+            Switch.LatencyNs = EndNs - RequestNs;
+            Switch.BurstNs = EndNs - StartNs;
+            LastPreset = (uint8_t)Preset;
+
+            PresetSwitches++;
+            PresetWrites += Switch.Writes;
+            PresetUnchanged += Switch.Unchanged;
+            PresetSumLatencyNs += Switch.LatencyNs;
+            if (Switch.LatencyNs > PresetMaxLatencyNs)
+                PresetMaxLatencyNs = Switch.LatencyNs;
+            if (Switch.LatencyNs < 10000)
+                Bin = 0;
+            else if (Switch.LatencyNs < 100000)
+                Bin = 1;
+            else if (Switch.LatencyNs < 1000000)
+                Bin = 2;
+            else if (Switch.LatencyNs < 10000000)
+                Bin = 3;
+            else
+                Bin = 4;
+            PresetLatencyBins[Bin]++;
+        }
+    }
+    if (Switch.Result != ePRDone)
+        PresetRefused++;
+    pthread_mutex_unlock(&PresetMutex);
+
+    if (UseDebug)
+    {
+        if (Switch.Result == ePRDone)
+            printf("preset %d: %d registers written, latency %.1fus\n", Preset, Switch.Writes, (double)Switch.LatencyNs / 1000.0);
+        else
+            printf("preset %d: switch refused (%d)\n", Preset, Switch.Result);
+    }
+    if (Result != NULL)
+        *Result = Switch;
+    return (Switch.Result != ePRDone);
+}
+
+
+//
+// convert a load request to a preset. Called with mutex held.
+//
+static void LoadBandPreset(TBandPreset* Preset, uint8_t* Buffer)
+{
+    TBandRegisters* Image = &Preset->Image;
+    uint32_t DDC;
+
+    memcpy(Preset->Name, Buffer + 8, VPRNAMESIZE);
+    Preset->Name[VPRNAMESIZE] = 0;
+    Image->Mask = ntohl(*(uint32_t*)(Buffer + 24)) & VBANDALL;
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+        Image->DDCDeltaPhase[DDC] = ntohl(*(uint32_t*)(Buffer + 28 + 4 * DDC));
+    Image->DUCDeltaPhase = ntohl(*(uint32_t*)(Buffer + 68));
+    Image->AlexTXAnt = ntohl(*(uint32_t*)(Buffer + 72));
+    Image->AlexTXFilt = ntohl(*(uint32_t*)(Buffer + 76));
+    Image->AlexRX = ntohl(*(uint32_t*)(Buffer + 80));
+    Image->ADCAtten = ADCAttenRegister(Buffer[84], Buffer[85], Buffer[86], Buffer[87]);
+    Image->Drive = TXDriveRegister(Buffer[88]);
+    Image->Outputs = BandOutputBits(Buffer[89], (Buffer[90] & 1) != 0);
+    Preset->Loaded = true;
+}
+
+
+//
+// handle a preset packet received on port 1024
+// the report is sent back to From on Socketid (no report if Socketid < 0)
+//
+void HandlePresetPacket(uint8_t* Buffer, uint32_t Size, int Socketid, struct sockaddr_in* From)
+{
+    uint8_t Report[VPRREPORTSIZE];
+    TPresetSwitch Switch;
+    int64_t RequestNs;
+    uint32_t Preset;
+    uint32_t Cntr;
+    uint16_t Held = 0;
+    uint8_t Request;
+
+    RequestNs = PresetNowNs();
+    Request = Buffer[5];
+    Preset = Buffer[6];
+    memset(&Switch, 0, sizeof(Switch));
+    memset(Report, 0, sizeof(Report));
+
+    if ((Request == ePRSwitch) && (Size == 60))
+        SwitchBandPreset(Preset, RequestNs, &Switch);
+    else
+    {
+        pthread_mutex_lock(&PresetMutex);
+        if ((Request == ePRLoad) && (Size == VPRLOADSIZE) && (Preset < VPRMAXPRESETS))
+        {
+            LoadBandPreset(Presets + Preset, Buffer);
+            if (UseDebug)
+                printf("preset %d loaded: %s\n", Preset, Presets[Preset].Name);
+        }
+        else if ((Request == ePRDelete) && (Size == 60) && (Preset < VPRMAXPRESETS))
+        {
+            if (!Presets[Preset].Loaded)
+                Switch.Result = ePREmpty;
+            Presets[Preset].Loaded = false;
+            if (LastPreset == Preset)
+                LastPreset = 0xFF;
+        }
+        else if ((Request != ePRStatus) || (Size != 60))
+            Switch.Result = ePRBadRequest;
+        pthread_mutex_unlock(&PresetMutex);
+    }
+    if (Socketid < 0)
+        return;
+
+    pthread_mutex_lock(&PresetMutex);
+    for (Cntr = 0; Cntr < VPRMAXPRESETS; Cntr++)
+        if (Presets[Cntr].Loaded)
+            Held |= (1 << Cntr);
+    *(uint32_t*)Report = *(uint32_t*)Buffer;
+    Report[4] = VPRREPORTID;
+    Report[5] = Request;
+    Report[6] = (uint8_t)Switch.Result;
+    Report[7] = (uint8_t)Preset;
+    *(uint16_t*)(Report + 8) = htons(Held);
+    Report[10] = LastPreset;
+    if (Request == ePRSwitch)
+    {
+        Report[12] = (uint8_t)Switch.Writes;
+        Report[13] = (uint8_t)Switch.Unchanged;
+        *(uint32_t*)(Report + 16) = htonl((Switch.LatencyNs > UINT32_MAX) ? UINT32_MAX : (uint32_t)Switch.LatencyNs);
+        *(uint32_t*)(Report + 20) = htonl((Switch.BurstNs > UINT32_MAX) ? UINT32_MAX : (uint32_t)Switch.BurstNs);
+    }
+    if ((Request != ePRStatus) && (Preset < VPRMAXPRESETS))
+        memcpy(Report + 24, Presets[Preset].Name, VPRNAMESIZE);
+    pthread_mutex_unlock(&PresetMutex);
+    SecureSendTo(Socketid, Report, VPRREPORTSIZE, From);
+}
+
+
+//
+// print switch counts and latency for the run that has ended, and clear them
+//
+void PrintPresetReport(void)
+{
+    int Bin;
+
+    pthread_mutex_lock(&PresetMutex);
+    if ((PresetSwitches != 0) || (PresetRefused != 0))
+    {
+        printf("band presets: %d switches (%d refused), %d registers written, %d already set\n",
+               PresetSwitches, PresetRefused, PresetWrites, PresetUnchanged);
+        if (PresetSwitches != 0)
+        {
+            printf("  switch latency: mean %.1fus, max %.1fus;", (double)PresetSumLatencyNs / PresetSwitches / 1000.0,
+                   (double)PresetMaxLatencyNs / 1000.0);
+            for (Bin = 0; Bin < VPRNUMLATENCYBINS; Bin++)
+                printf(" %s:%d", PresetLatencyBinNames[Bin], PresetLatencyBins[Bin]);
+            printf("\n");
+        }
+    }
+    PresetSwitches = 0;
+    PresetRefused = 0;
+    PresetWrites = 0;
+    PresetUnchanged = 0;
+    PresetSumLatencyNs = 0;
+    PresetMaxLatencyNs = 0;
+    memset(PresetLatencyBins, 0, sizeof(PresetLatencyBins));
+    pthread_mutex_unlock(&PresetMutex);
+}
+
+
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// offline check with the simulated register backend
+//
+#define VPRCHECKCYCLES 200                          // times round the switch sequence
+#define VPRCHECKMAXLATENCYNS 1000000LL              // largest allowed 95th percentile latency
+#define VPRCHECKMAXWRITES 64
+#define VPRCHECKSWITCHES 6                          // switches in the sequence
+#define VPRCHECKMAXDONE (VPRCHECKCYCLES * VPRCHECKSWITCHES)
+
+//
+// register write log, filled by the write hook
+//
+uint32_t PRCheckAddress[VPRCHECKMAXWRITES];
+uint32_t PRCheckData[VPRCHECKMAXWRITES];
+uint32_t PRCheckWriteCount;
+
+static void PRCheckWriteHook(uint32_t Address, uint32_t Data)
+{
+    if (PRCheckWriteCount < VPRCHECKMAXWRITES)
+    {
+        PRCheckAddress[PRCheckWriteCount] = Address;
+        PRCheckData[PRCheckWriteCount] = Data;
+    }
+    PRCheckWriteCount++;
+}
+
+static int PRCompareNs(const void* A, const void* B)
+{
+    int64_t Diff = *(const int64_t*)A - *(const int64_t*)B;
+    return (Diff > 0) - (Diff < 0);
+}
+
+
+//
+// settings a check preset is loaded from
+//
+typedef struct
+{
+    char* Name;
+    uint32_t Mask;
+    uint32_t DDCFrequency[2];                       // DDC0 and DDC1 (DDC2 for a DDC2 only preset), Hz
+    uint32_t DUCFrequency;
+    uint32_t AlexTXAnt, AlexTXFilt, AlexRX;
+    uint8_t Atten[4];
+    uint8_t Drive;
+    uint8_t Outputs;
+    uint8_t Xvtr;
+} TPRCheckSettings;
+
+static const TPRCheckSettings PRCheckSettings[] =
+{
+    {"40m", VBANDALL, {7074000, 7200000}, 7074000, 0x01C0, 0x0540, 0x00200020, {0, 10, 0, 10}, 200, 0x02, 0},
+    {"20m", VBANDALL, {14074000, 14200000}, 14074000, 0x0110, 0x0510, 0x00020002, {6, 12, 0, 10}, 180, 0x04, 0},
+    {"20m ant 2", VBANDALL, {14074000, 14200000}, 14074000, 0x0210, 0x0610, 0x00020002, {6, 12, 0, 10}, 180, 0x0C, 0},
+    {"2m xvtr", VBANDALL, {28125000, 28200000}, 28125000, 0x0140, 0x0540, 0x01000002, {3, 12, 0, 10}, 40, 0x40, 1},
+    {"DDC2 only", (1 << 2), {10000000, 0}, 0, 0, 0, 0, {0, 0, 0, 0}, 0, 0, 0}
+};
+#define VPRCHECKPRESETS (sizeof(PRCheckSettings) / sizeof(PRCheckSettings[0]))
+
+//
+// switch sequence, repeated: includes a switch to the preset already set
+//
+static const uint8_t PRCheckSequence[VPRCHECKSWITCHES] = {0, 1, 2, 2, 4, 3};
+
+
+//
+// delta phase for a frequency
+//
+static uint32_t PRCheckDeltaPhase(uint32_t Frequency)
+{
+    return (uint32_t)(4294967296.0 * (double)Frequency / 122880000.0);
+}
+
+
+//
+// make a preset packet
+//
+static uint32_t PRCheckMakePacket(uint8_t* Packet, uint32_t Sequence, EPresetRequest Request, uint32_t Preset)
+{
+    const TPRCheckSettings* Settings;
+    uint32_t DDC;
+
+    memset(Packet, 0, VPRLOADSIZE);
+    *(uint32_t*)Packet = htonl(Sequence);
+    Packet[4] = VPRPACKETID;
+    Packet[5] = Request;
+    Packet[6] = Preset;
+    if ((Request != ePRLoad) || (Preset >= VPRCHECKPRESETS))
+        return 60;
+    Settings = PRCheckSettings + Preset;
+    strncpy((char*)Packet + 8, Settings->Name, VPRNAMESIZE);
+    *(uint32_t*)(Packet + 24) = htonl(Settings->Mask);
+    for (DDC = 0; DDC < 2; DDC++)
+        *(uint32_t*)(Packet + 28 + 4 * DDC) = htonl(PRCheckDeltaPhase(Settings->DDCFrequency[DDC]));
+    if (Settings->Mask == (1 << 2))
+        *(uint32_t*)(Packet + 28 + 8) = htonl(PRCheckDeltaPhase(Settings->DDCFrequency[0]));
+    *(uint32_t*)(Packet + 68) = htonl(PRCheckDeltaPhase(Settings->DUCFrequency));
+    *(uint32_t*)(Packet + 72) = htonl(Settings->AlexTXAnt);
+    *(uint32_t*)(Packet + 76) = htonl(Settings->AlexTXFilt);
+    *(uint32_t*)(Packet + 80) = htonl(Settings->AlexRX);
+    memcpy(Packet + 84, Settings->Atten, 4);
+    Packet[88] = Settings->Drive;
+    Packet[89] = Settings->Outputs;
+    Packet[90] = Settings->Xvtr;
+    return VPRLOADSIZE;
+}
+
+
+//
+// send a request through the packet handler and read its report
+// returns true if no report arrived
+//
+static bool PRCheckRequest(int Socketid, struct sockaddr_in* Addr, uint8_t* Packet, uint32_t Size, uint8_t* Report)
+{
+    memset(Report, 0, VPRREPORTSIZE);
+    HandlePresetPacket(Packet, Size, Socketid, Addr);
+    if (recv(Socketid, Report, VPRREPORTSIZE, 0) != VPRREPORTSIZE)
+        return true;
+    return (Report[4] != VPRREPORTID) || (memcmp(Report, Packet, 4) != 0);
+}
+
+
+//
+// order a register write must take in a burst; AttenFirst if any attenuation rises
+//
+static int PRCheckRank(uint32_t Address, bool AttenFirst)
+{
+    uint32_t DDC;
+
+    if (Address == VADDRADCCTRLREG)
+        return AttenFirst ? 0 : 5;
+    if (Address == VADDRALEXSPIREG + VOFFSETALEXTXANTREG)
+        return 1;
+    if (Address == VADDRALEXSPIREG + VOFFSETALEXTXFILTREG)
+        return 2;
+    if (Address == VADDRALEXSPIREG + VOFFSETALEXRXREG)
+        return 3;
+    if (Address == VADDRRFGPIOREG)
+        return 4;
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+        if (Address == DDCRegisters[DDC])
+            return 6;
+    if (Address == VADDRTXDUCREG)
+        return 7;
+    if (Address == VADDRDACCTRLREG)
+        return 8;
+    return 99;
+}
+
+
+//
+// compare the simulated registers with an image, for the registers in its mask
+// returns the number that differ
+//
+static uint32_t PRCheckContents(TBandRegisters* Image)
+{
+    uint32_t Mask = Image->Mask;
+    uint32_t OutputMask = BandOutputBits(0x7F, true);
+    uint32_t Errors = 0;
+    uint32_t DDC;
+
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+        if ((Mask & (1 << DDC)) && (RegisterRead(DDCRegisters[DDC]) != Image->DDCDeltaPhase[DDC]))
+            Errors++;
+    if ((Mask & VBANDDUC) && (RegisterRead(VADDRTXDUCREG) != Image->DUCDeltaPhase))
+        Errors++;
+    if ((Mask & VBANDALEXTXANT) && (RegisterRead(VADDRALEXSPIREG + VOFFSETALEXTXANTREG) != Image->AlexTXAnt))
+        Errors++;
+    if ((Mask & VBANDALEXTXFILT) && (RegisterRead(VADDRALEXSPIREG + VOFFSETALEXTXFILTREG) != Image->AlexTXFilt))
+        Errors++;
+    if ((Mask & VBANDALEXRX) && (RegisterRead(VADDRALEXSPIREG + VOFFSETALEXRXREG) != Image->AlexRX))
+        Errors++;
+    if ((Mask & VBANDOUTPUTS) && ((RegisterRead(VADDRRFGPIOREG) & OutputMask) != Image->Outputs))
+        Errors++;
+    if ((Mask & VBANDADCATTEN) && (RegisterRead(VADDRADCCTRLREG) != Image->ADCAtten))
+        Errors++;
+    if ((Mask & VBANDDRIVE) && (RegisterRead(VADDRDACCTRLREG) != Image->Drive))
+        Errors++;
+    return Errors;
+}
+
+
+//
+// key or unkey TX as the high priority packet's MOX bit does
+//
+static void PRCheckSetMOX(bool MOX)
+{
+    IsTXMode = TXPlaybackHoldsMOX() || (MOX && LivenessTXAllowed());
+    SetMOX(IsTXMode);
+}
+
+
+//
+// check loading and switching with the simulated register backend
+// presets are loaded through the packet handler, with reports read back
+// over loopback. For every switch the write log is compared with the
+// registers that differ between the previous settings and the preset: the
+// count, the values, and the order. Register contents and local copies must
+// then match the preset; a switch during MOX, and to an empty or deleted
+// preset, must write nothing. Switches are made with manual Alex filter
+// selection on, then once with it off, which must leave the Alex registers
+// alone. Latency is judged at the 95th percentile, so a single preemption
+// of the host does not fail the check.
+// returns true if the check fails
+//
+bool RunPresetCheck(void)
+{
+    uint8_t Packet[VPRLOADSIZE];
+    uint8_t Report[VPRREPORTSIZE];
+    TBandRegisters Before, After, Expected;
+    struct sockaddr_in Addr;
+    socklen_t Length = sizeof(Addr);
+    struct timeval ReadTimeout;
+    int64_t* Latencies;
+    int64_t* Bursts;
+    double SumLatency = 0.0;
+    uint32_t Sequence = 1;
+    uint32_t Cycle, Step, Preset, Write, Cntr, DDC, Field;
+    uint32_t Done = 0, Differ, TotalWrites = 0;
+    uint32_t CountErrors = 0, ValueErrors = 0, OrderErrors = 0, ContentErrors = 0, ReportErrors = 0;
+    uint32_t RefusalErrors = 0, AlexErrors = 0;
+    uint32_t Size;
+    int Socketid;
+    int Rank, LastRank;
+    bool AttenFirst;
+    bool Fail;
+
+    printf("band preset check with simulated registers: %d presets, %d switches\n", (int)VPRCHECKPRESETS,
+           VPRCHECKCYCLES * VPRCHECKSWITCHES);
+    Socketid = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&Addr, 0, sizeof(Addr));
+    Addr.sin_family = AF_INET;
+    Addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((Socketid < 0) || (bind(Socketid, (struct sockaddr*)&Addr, sizeof(Addr)) < 0)
+        || (getsockname(Socketid, (struct sockaddr*)&Addr, &Length) < 0))
+    {
+        perror("band preset check: socket");
+        return true;
+    }
+    ReadTimeout.tv_sec = 1;
+    ReadTimeout.tv_usec = 0;
+    setsockopt(Socketid, SOL_SOCKET, SO_RCVTIMEO, (void *)&ReadTimeout, sizeof(ReadTimeout));
+    Latencies = (int64_t*)malloc(VPRCHECKMAXDONE * sizeof(int64_t));
+    Bursts = (int64_t*)malloc(VPRCHECKMAXDONE * sizeof(int64_t));
+    EnableSimulatedRegisters(true);
+    SetRegisterWriteHook(PRCheckWriteHook);
+    EnableAlexManualFilterSelect(true);
+
+    //
+    // load, then check requests that must be refused
+    //
+    for (Preset = 0; Preset < VPRCHECKPRESETS; Preset++)
+    {
+        Size = PRCheckMakePacket(Packet, Sequence++, ePRLoad, Preset);
+        if (PRCheckRequest(Socketid, &Addr, Packet, Size, Report) || (Report[6] != ePRDone)
+            || (strncmp((char*)Report + 24, PRCheckSettings[Preset].Name, VPRNAMESIZE) != 0))
+            ReportErrors++;
+    }
+    PRCheckMakePacket(Packet, Sequence++, ePRLoad, 0);
+    if (PRCheckRequest(Socketid, &Addr, Packet, 60, Report) || (Report[6] != ePRBadRequest))
+        RefusalErrors++;
+    PRCheckWriteCount = 0;
+    PRCheckMakePacket(Packet, Sequence++, ePRSwitch, VPRCHECKPRESETS);
+    if (PRCheckRequest(Socketid, &Addr, Packet, 60, Report) || (Report[6] != ePREmpty) || (PRCheckWriteCount != 0))
+        RefusalErrors++;
+    PRCheckSetMOX(true);
+    PRCheckWriteCount = 0;
+    PRCheckMakePacket(Packet, Sequence++, ePRSwitch, 0);
+    if (!IsTXMode || PRCheckRequest(Socketid, &Addr, Packet, 60, Report) || (Report[6] != ePRTransmitting)
+        || (PRCheckWriteCount != 0))
+        RefusalErrors++;
+    PRCheckSetMOX(false);
+    PRCheckMakePacket(Packet, Sequence++, ePRStatus, 0);
+    if (PRCheckRequest(Socketid, &Addr, Packet, 60, Report) || (Report[6] != ePRDone)
+        || (ntohs(*(uint16_t*)(Report + 8)) != (1 << VPRCHECKPRESETS) - 1))
+        ReportErrors++;
+
+    //
+    // switch round the sequence
+    //
+    for (Cycle = 0; Cycle < VPRCHECKCYCLES; Cycle++)
+        for (Step = 0; Step < VPRCHECKSWITCHES; Step++)
+        {
+            Preset = PRCheckSequence[Step];
+            GetBandRegisters(&Before);
+            pthread_mutex_lock(&PresetMutex);
+            Expected = Presets[Preset].Image;
+            pthread_mutex_unlock(&PresetMutex);
+
+            //
+            // registers that differ, and whether any attenuation rises
+            //
+            Differ = 0;
+            AttenFirst = false;
+            for (DDC = 0; DDC < VNUMDDC; DDC++)
+                Differ += (Expected.Mask & (1 << DDC)) && (Expected.DDCDeltaPhase[DDC] != Before.DDCDeltaPhase[DDC]);
+            Differ += (Expected.Mask & VBANDDUC) && (Expected.DUCDeltaPhase != Before.DUCDeltaPhase);
+            Differ += (Expected.Mask & VBANDALEXTXANT) && (Expected.AlexTXAnt != Before.AlexTXAnt);
+            Differ += (Expected.Mask & VBANDALEXTXFILT) && (Expected.AlexTXFilt != Before.AlexTXFilt);
+            Differ += (Expected.Mask & VBANDALEXRX) && (Expected.AlexRX != Before.AlexRX);
+            Differ += (Expected.Mask & VBANDOUTPUTS) && (Expected.Outputs != Before.Outputs);
+            Differ += (Expected.Mask & VBANDADCATTEN) && (Expected.ADCAtten != Before.ADCAtten);
+            Differ += (Expected.Mask & VBANDDRIVE) && (Expected.Drive != Before.Drive);
+            for (Field = 0; Field < 20; Field += 5)
+                if (((Expected.ADCAtten >> Field) & 0x1F) > ((Before.ADCAtten >> Field) & 0x1F))
+                    AttenFirst = true;
+
+            PRCheckWriteCount = 0;
+            PRCheckMakePacket(Packet, Sequence++, ePRSwitch, Preset);
+            if (PRCheckRequest(Socketid, &Addr, Packet, 60, Report) || (Report[6] != ePRDone)
+                || (Report[12] != PRCheckWriteCount) || (Report[10] != Preset))
+                ReportErrors++;
+            if ((PRCheckWriteCount != Differ) || (PRCheckWriteCount > VPRCHECKMAXWRITES))
+            {
+                CountErrors++;
+                continue;
+            }
+
+            //
+            // each write must carry the preset's value, in burst order
+            //
+            LastRank = -1;
+            for (Write = 0; Write < PRCheckWriteCount; Write++)
+            {
+                Rank = PRCheckRank(PRCheckAddress[Write], AttenFirst);
+                if (Rank < LastRank)
+                    OrderErrors++;
+                LastRank = Rank;
+                if (PRCheckAddress[Write] == VADDRRFGPIOREG)
+                {
+                    if ((PRCheckData[Write] & BandOutputBits(0x7F, true)) != Expected.Outputs)
+                        ValueErrors++;
+                    continue;
+                }
+                for (Cntr = 0; Cntr < VNUMDDC; Cntr++)
+                    if (PRCheckAddress[Write] == DDCRegisters[Cntr])
+                        break;
+                if (((Cntr < VNUMDDC) && (PRCheckData[Write] != Expected.DDCDeltaPhase[Cntr]))
+                    || ((PRCheckAddress[Write] == VADDRTXDUCREG) && (PRCheckData[Write] != Expected.DUCDeltaPhase))
+                    || ((PRCheckAddress[Write] == VADDRALEXSPIREG + VOFFSETALEXTXANTREG) && (PRCheckData[Write] != Expected.AlexTXAnt))
+                    || ((PRCheckAddress[Write] == VADDRALEXSPIREG + VOFFSETALEXTXFILTREG) && (PRCheckData[Write] != Expected.AlexTXFilt))
+                    || ((PRCheckAddress[Write] == VADDRALEXSPIREG + VOFFSETALEXRXREG) && (PRCheckData[Write] != Expected.AlexRX))
+                    || ((PRCheckAddress[Write] == VADDRADCCTRLREG) && (PRCheckData[Write] != Expected.ADCAtten))
+                    || ((PRCheckAddress[Write] == VADDRDACCTRLREG) && (PRCheckData[Write] != Expected.Drive))
+                    || (Rank == 99))
+                    ValueErrors++;
+            }
+
+            //
+            // registers and local copies now hold the preset
+            //
+            GetBandRegisters(&After);
+            After.Mask = Expected.Mask;
+            ContentErrors += PRCheckContents(&Expected) + PRCheckContents(&After);
+            if (Done < VPRCHECKMAXDONE)
+            {
+                Latencies[Done] = (int64_t)ntohl(*(uint32_t*)(Report + 16));
+                Bursts[Done] = (int64_t)ntohl(*(uint32_t*)(Report + 20));
+                SumLatency += (double)Latencies[Done];
+                Done++;
+            }
+            TotalWrites += PRCheckWriteCount;
+        }
+
+    //
+    // with manual Alex filter selection off, a switch to a preset with other
+    // Alex settings (the sequence ends on preset 3) writes the rest, not them
+    //
+    EnableAlexManualFilterSelect(false);
+    GetBandRegisters(&Before);
+    pthread_mutex_lock(&PresetMutex);
+    Expected = Presets[0].Image;
+    pthread_mutex_unlock(&PresetMutex);
+    Expected.Mask &= ~(VBANDALEXTXANT | VBANDALEXTXFILT | VBANDALEXRX);
+    PRCheckWriteCount = 0;
+    PRCheckMakePacket(Packet, Sequence++, ePRSwitch, 0);
+    if (PRCheckRequest(Socketid, &Addr, Packet, 60, Report) || (Report[6] != ePRDone) || (Report[12] != PRCheckWriteCount)
+        || (Report[12] + Report[13] != CountBandRegisters(Expected.Mask)))
+        ReportErrors++;
+    for (Write = 0; Write < PRCheckWriteCount; Write++)
+        if ((PRCheckAddress[Write] >= VADDRALEXSPIREG) && (PRCheckAddress[Write] <= VADDRALEXSPIREG + VOFFSETALEXTXANTREG))
+            AlexErrors++;
+    GetBandRegisters(&After);
+    if ((After.AlexTXAnt != Before.AlexTXAnt) || (After.AlexTXFilt != Before.AlexTXFilt) || (After.AlexRX != Before.AlexRX)
+        || (Presets[0].Image.AlexTXAnt == Before.AlexTXAnt) || (PRCheckContents(&Expected) != 0))
+        AlexErrors++;
+
+    //
+    // deleted presets can't be switched to
+    //
+    PRCheckMakePacket(Packet, Sequence++, ePRDelete, 4);
+    if (PRCheckRequest(Socketid, &Addr, Packet, 60, Report) || (Report[6] != ePRDone))
+        ReportErrors++;
+    PRCheckWriteCount = 0;
+    PRCheckMakePacket(Packet, Sequence++, ePRSwitch, 4);
+    if (PRCheckRequest(Socketid, &Addr, Packet, 60, Report) || (Report[6] != ePREmpty) || (PRCheckWriteCount != 0))
+        RefusalErrors++;
+
+    PrintPresetReport();
+    printf("register writes: %d in %d switches (%.1f per switch, %d in a full image)\n", TotalWrites, Done,
+           Done ? (double)TotalWrites / Done : 0.0, CountBandRegisters(VBANDALL));
+    printf("errors: %d write count, %d value, %d order, %d register contents, %d refusal, %d report, %d Alex not manual\n",
+           CountErrors, ValueErrors, OrderErrors, ContentErrors, RefusalErrors, ReportErrors, AlexErrors);
+    if (Done != 0)
+    {
+        qsort(Latencies, Done, sizeof(int64_t), PRCompareNs);
+        qsort(Bursts, Done, sizeof(int64_t), PRCompareNs);
+        printf("switch latency: mean %.1fus, median %.1fus, 95%% %.1fus, max %.1fus\n", SumLatency / Done / 1000.0,
+               (double)Latencies[Done / 2] / 1000.0, (double)Latencies[(Done * 95) / 100] / 1000.0,
+               (double)Latencies[Done - 1] / 1000.0);
+        printf("register write burst: median %.1fus, max %.1fus\n", (double)Bursts[Done / 2] / 1000.0,
+               (double)Bursts[Done - 1] / 1000.0);
+    }
+    Fail = (CountErrors != 0) || (ValueErrors != 0) || (OrderErrors != 0) || (ContentErrors != 0)
+           || (RefusalErrors != 0) || (ReportErrors != 0) || (AlexErrors != 0) || (Done != VPRCHECKMAXDONE)
+           || (Latencies[(Done * 95) / 100] > VPRCHECKMAXLATENCYNS);
+    printf("band preset check: %s\n", Fail ? "FAIL" : "pass");
+    SetRegisterWriteHook(NULL);
+    EnableSimulatedRegisters(false);
+    free(Latencies);
+    free(Bursts);
+    close(Socketid);
+    return Fail;
+}
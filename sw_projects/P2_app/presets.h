@@ -0,0 +1,140 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// presets.h:
+//
+// band presets: a client preloads named register images for its bands or
+// antennas, then switches between them with one command. A switch writes
+// only the registers that change, in a fixed order, in one burst.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __presets_h
+#define __presets_h
+
+
+#include <stdint.h>
+#include <netinet/in.h>
+#include "../common/saturntypes.h"
+#include "../common/saturnregisters.h"
+
+
+#define VPRPACKETID 0x16                            // command byte of a preset packet (port 1024)
+#define VPRREPORTID 0x17                            // command byte of the report sent back
+#define VPRLOADSIZE 92                              // bytes in a load request
+#define VPRREPORTSIZE 40                            // bytes in a report
+#define VPRMAXPRESETS 16                            // presets held
+#define VPRNAMESIZE 16                              // bytes in a preset name
+#define VPRNUMLATENCYBINS 5                         // latency histogram bins
+
+
+//
+// preset packet, on port 1024 (all fields big endian):
+// bytes 0-3    sequence number
+// byte 4       0x16
+// byte 5       request: 0 = load, 1 = switch, 2 = delete, 3 = status
+// byte 6       preset number (0-15); not used for status
+// byte 7       0
+// load (92 bytes; replaces any preset held in that number):
+// bytes 8-23   name, NUL padded
+// bytes 24-27  registers included (VBANDxxx bits in saturnregisters.h); others are left alone
+// bytes 28-67  DDC0-9 delta phase
+// bytes 68-71  DUC delta phase
+// bytes 72-75  Alex TX antenna register: TX filters and TX antenna (high priority bytes 1428-1429)
+// bytes 76-79  Alex TX filter register: TX filters and RX antenna (high priority bytes 1432-1433)
+// bytes 80-83  Alex RX register: RX1 (bytes 1434-1435) in bits 15:0, RX2 (bytes 1430-1431) in bits 31:16
+// bytes 84-87  attenuation, dB: ADC1 RX, ADC1 TX, ADC2 RX, ADC2 TX
+// byte 88      TX drive level (0-255)
+// byte 89      open collector outputs, bits 6:0
+// byte 90      bit 0: transverter enable
+// switch, delete and status (60 bytes): no other fields
+//
+// a switch is refused while MOX is asserted. The Alex registers are only set
+// while the client selects Alex filters manually. DDC frequencies are not set for
+// DDCs given to a separate RX client. The client's next high priority packet
+// sets its own settings again, so it should match the preset.
+//
+// report, 40 bytes, sent to the sender of every request:
+// bytes 0-3    sequence number of the request
+// byte 4       0x17
+// byte 5       request
+// byte 6       result (EPresetResult)
+// byte 7       preset number
+// bytes 8-9    presets held: bit n set if preset n is loaded
+// byte 10      last preset switched to (0xFF if none)
+// byte 11      0
+// switch only:
+// byte 12      registers written
+// byte 13      registers in the preset that already held its value
+// bytes 14-15  0
+// bytes 16-19  switch latency, ns: request handled to last register write
+// bytes 20-23  register write burst, ns
+// all requests except status:
+// bytes 24-39  name of the preset, NUL padded
+//
+typedef enum
+{
+    ePRLoad,
+    ePRSwitch,
+    ePRDelete,
+    ePRStatus
+} EPresetRequest;
+
+typedef enum
+{
+    ePRDone,
+    ePRBadRequest,                                  // unknown request, bad preset number or packet size
+    ePREmpty,                                       // no preset loaded in that number
+    ePRTransmitting                                 // switch refused: MOX asserted
+} EPresetResult;
+
+
+//
+// outcome of a switch
+//
+typedef struct
+{
+    EPresetResult Result;
+    uint32_t Writes;                                // registers written
+    uint32_t Unchanged;                             // registers in the preset already holding its value
+    int64_t LatencyNs;                              // request to last register write
+    int64_t BurstNs;                                // register writes
+} TPresetSwitch;
+
+
+//
+// handle a preset packet received on port 1024
+// the report is sent back to From on Socketid (no report if Socketid < 0)
+//
+void HandlePresetPacket(uint8_t* Buffer, uint32_t Size, int Socketid, struct sockaddr_in* From);
+
+
+//
+// switch to a preset. RequestNs: CLOCK_MONOTONIC time the request was
+// received, for the latency. Result (if not NULL) gets the outcome.
+// returns true if the switch was not made
+//
+bool SwitchBandPreset(uint32_t Preset, int64_t RequestNs, TPresetSwitch* Result);
+
+
+//
+// print switch counts and latency for the run that has ended, and clear them
+//
+void PrintPresetReport(void);
+
+
+//
+// check loading and switching with the simulated register backend: register
+// writes made, their order, register contents, and switch latency
+// returns true if the check fails
+//
+bool RunPresetCheck(void);
+
+
+#endif
@@ -0,0 +1,667 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// rxtiming.c:
+//
+// arrival timing of the DUC I/Q, speaker audio and high priority streams.
+// the sockets have SO_TIMESTAMPNS set, so each datagram comes with the time
+// the kernel received it. From those times (the network side):
+// - inter-arrival jitter: each gap's difference from the mean period
+// - bursts: runs of datagrams arriving less than a quarter period apart
+// and from the time the receiving thread got it (the p2app side):
+// - kernel to p2app delay
+// a stream delivered late by the network shows jitter and bursts with small
+// delays; one read late by p2app shows delays with even arrivals.
+// histograms are kept per report period and per run, under a mutex per
+// stream (each stream is recorded by one thread; only the report thread
+// contends). A report thread prints each period while the radio runs, and
+// the totals at the end of the run.
+//
+//////////////////////////////////////////////////////////////
+
+#include "threaddata.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include <syscall.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "rxtiming.h"
+
+
+#define VRXTWARMUP 16                               // gaps averaged before jitter and bursts are counted
+#define VRXTPERIODWEIGHT 64                         // mean period: EWMA weight of each gap
+#define VRXTRESTARTNS 1000000000LL                  // gap that restarts a stream's period estimate
+#define VRXTPOLLMS 100                              // report thread poll
+
+
+//
+// one set of histograms
+//
+typedef struct
+{
+    uint64_t Packets;
+    uint64_t NoTimestamp;                           // datagrams without a kernel timestamp
+    uint64_t Jitter[VRXTBINS];
+    uint64_t Delay[VRXTBINS];
+    uint64_t Bursts[VRXTBURSTBINS];
+    int64_t MaxJitterNs;
+    int64_t MaxDelayNs;
+    uint32_t LongestBurst;
+    double Seconds;                                 // time covered
+} TRXTHistograms;
+
+
+typedef struct
+{
+    char* Name;
+    pthread_mutex_t Mutex;
+    bool HaveLast;
+    int64_t LastKernelNs;
+    uint32_t Gaps;                                  // gaps seen since the period estimate restarted
+    double PeriodNs;                                // mean inter-arrival time
+    double RFCJitterNs;                             // RFC 3550 style smoothed jitter
+    uint32_t BurstLength;                           // datagrams in the current burst
+    TRXTHistograms Period;
+    TRXTHistograms Run;
+} TRXTStream;
+
+
+static const double RXTBinLimitsUs[VRXTBINS - 1] = {10, 30, 100, 300, 1000, 3000, 10000};
+static const char* RXTBinNames[VRXTBINS] = {"<10us", "<30us", "<100us", "<300us", "<1ms", "<3ms", "<10ms", ">=10ms"};
+static const uint32_t RXTBurstLimits[VRXTBURSTBINS - 1] = {1, 2, 4, 8, 16};
+static const char* RXTBurstNames[VRXTBURSTBINS] = {"1", "2", "3-4", "5-8", "9-16", ">16"};
+
+static bool RXTEnabled = false;
+static uint32_t RXTReportSeconds;
+static pthread_t RXTReportThread;
+static TRXTStream RXTStreams[eRXTNumStreams] =
+{
+    {.Name = "high priority", .Mutex = PTHREAD_MUTEX_INITIALIZER},
+    {.Name = "speaker audio", .Mutex = PTHREAD_MUTEX_INITIALIZER},
+    {.Name = "DUC I/Q", .Mutex = PTHREAD_MUTEX_INITIALIZER}
+};
+
+
+static int64_t RXTNowNs(clockid_t Clock)
+{
+    struct timespec Now;
+
+    clock_gettime(Clock, &Now);
+    return (int64_t)Now.tv_sec * 1000000000LL + Now.tv_nsec;
+}
+
+
+static uint32_t RXTTimeBin(int64_t Ns)
+{
+    uint32_t Bin;
+
+    for (Bin = 0; Bin < VRXTBINS - 1; Bin++)
+        if (Ns < RXTBinLimitsUs[Bin] * 1000.0)
+            break;
+    return Bin;
+}
+
+
+static uint32_t RXTBurstBin(uint32_t Length)
+{
+    uint32_t Bin;
+
+    for (Bin = 0; Bin < VRXTBURSTBINS - 1; Bin++)
+        if (Length <= RXTBurstLimits[Bin])
+            break;
+    return Bin;
+}
+
+
+//
+// parse a -J setting
+// returns true if not valid
+//
+bool ParseRxTimingSetting(char* Setting)
+{
+    unsigned int Seconds;
+
+    if ((sscanf(Setting, "%u", &Seconds) != 1) || (Seconds == 0) || (Seconds > VRXTMAXREPORTSECONDS))
+        return true;
+    RXTReportSeconds = Seconds;
+    RXTEnabled = true;
+    return false;
+}
+
+
+//
+// true if arrival timing is enabled
+//
+bool RxTimingEnabled(void)
+{
+    return RXTEnabled;
+}
+
+
+static void RXTEnableTimestamps(int Socketid)
+{
+    int yes = 1;
+
+    if (setsockopt(Socketid, SOL_SOCKET, SO_TIMESTAMPNS, (void *)&yes, sizeof(yes)) < 0)
+        perror("setsockopt SO_TIMESTAMPNS");
+}
+
+
+//
+// enable kernel receive timestamps on a socket, if its port is analysed
+//
+void RxTimingPrepareSocket(int PortIndex, int Socketid)
+{
+    if (!RXTEnabled)
+        return;
+    if ((PortIndex == VPORTHIGHPRIORITYTOSDR) || (PortIndex == VPORTSPKRAUDIO) || (PortIndex == VPORTDUCIQ))
+        RXTEnableTimestamps(Socketid);
+}
+
+
+//
+// give a receive message a control buffer for the timestamp
+//
+void RxTimingSetControl(struct msghdr* Msg, uint8_t* Control)
+{
+    if (!RXTEnabled)
+        return;
+    Msg->msg_control = Control;
+    Msg->msg_controllen = VRXTCONTROLSIZE;
+}
+
+
+//
+// record one datagram in a set of histograms
+//
+static void RXTAddBurst(TRXTHistograms* Hist, uint32_t Length)
+{
+    Hist->Bursts[RXTBurstBin(Length)]++;
+    if (Length > Hist->LongestBurst)
+        Hist->LongestBurst = Length;
+}
+
+
+//
+// a datagram has been received on a stream
+//
+void RxTimingRecord(ERXTStream Stream, struct msghdr* Msg)
+{
+    TRXTStream* St = &RXTStreams[Stream];
+    struct cmsghdr* Cmsg;
+    struct timespec Kernel;
+    bool Found = false;
+    int64_t NowNs, KernelNs, Delay, Gap, Jitter;
+    uint32_t Bin;
+
+    if (!RXTEnabled)
+        return;
+    NowNs = RXTNowNs(CLOCK_REALTIME);
+    for (Cmsg = CMSG_FIRSTHDR(Msg); Cmsg != NULL; Cmsg = CMSG_NXTHDR(Msg, Cmsg))
+        if ((Cmsg->cmsg_level == SOL_SOCKET) && (Cmsg->cmsg_type == SCM_TIMESTAMPNS))
+        {
+            memcpy(&Kernel, CMSG_DATA(Cmsg), sizeof(Kernel));
+            Found = true;
+            break;
+        }
+
+    pthread_mutex_lock(&St->Mutex);
+    St->Period.Packets++;
+    if (!Found)
+    {
+        St->Period.NoTimestamp++;
+        pthread_mutex_unlock(&St->Mutex);
+        return;
+    }
+    KernelNs = (int64_t)Kernel.tv_sec * 1000000000LL + Kernel.tv_nsec;
+
+    //
+    // p2app side: kernel to thread delay (0 if the clock has stepped back)
+    //
+    Delay = NowNs - KernelNs;
+    if (Delay < 0)
+        Delay = 0;
+    St->Period.Delay[RXTTimeBin(Delay)]++;
+    if (Delay > St->Period.MaxDelayNs)
+        St->Period.MaxDelayNs = Delay;
+
+    //
+    // network side: gap from the previous datagram, against the mean period
+    //
+    Gap = KernelNs - St->LastKernelNs;
+    if (!St->HaveLast || (Gap < 0) || (Gap > VRXTRESTARTNS))
+    {
+        St->HaveLast = true;
+        St->Gaps = 0;
+        St->BurstLength = 1;
+    }
+    else if (St->Gaps < VRXTWARMUP)
+    {
+        St->PeriodNs = (St->PeriodNs * St->Gaps + Gap) / (St->Gaps + 1);
+        St->Gaps++;
+    }
+    else
+    {
+        Jitter = llabs(Gap - (int64_t)St->PeriodNs);
+        Bin = RXTTimeBin(Jitter);
+        St->Period.Jitter[Bin]++;
+        if (Jitter > St->Period.MaxJitterNs)
+            St->Period.MaxJitterNs = Jitter;
+        St->RFCJitterNs += (Jitter - St->RFCJitterNs) / 16.0;
+        if (Gap < St->PeriodNs / 4.0)
+            St->BurstLength++;
+        else
+        {
+            RXTAddBurst(&St->Period, St->BurstLength);
+            St->BurstLength = 1;
+        }
+        St->PeriodNs += (Gap - St->PeriodNs) / VRXTPERIODWEIGHT;
+    }
+    St->LastKernelNs = KernelNs;
+    pthread_mutex_unlock(&St->Mutex);
+}
+
+
+//
+// bin holding a fraction of the counts: the histogram's percentile
+//
+static const char* RXTPercentile(uint64_t* Counts, double Fraction)
+{
+    uint64_t Total = 0, Sum = 0;
+    uint32_t Bin;
+
+    for (Bin = 0; Bin < VRXTBINS; Bin++)
+        Total += Counts[Bin];
+    if (Total == 0)
+        return "-";
+    for (Bin = 0; Bin < VRXTBINS; Bin++)
+    {
+        Sum += Counts[Bin];
+        if (Sum >= Fraction * Total)
+            break;
+    }
+    return RXTBinNames[Bin];
+}
+
+
+static void RXTPrintTimes(char* Label, uint64_t* Counts, int64_t MaxNs)
+{
+    uint32_t Bin;
+
+    printf("  %-22s", Label);
+    for (Bin = 0; Bin < VRXTBINS; Bin++)
+        printf(" %s:%llu", RXTBinNames[Bin], (unsigned long long)Counts[Bin]);
+    printf("; max %.2fms\n", MaxNs / 1.0e6);
+}
+
+
+//
+// print one stream's histograms
+//
+static void RXTPrintHistograms(TRXTStream* St, TRXTHistograms* Hist, char* Title)
+{
+    uint32_t Bin;
+
+    if (Hist->Packets == 0)
+        return;
+    printf("arrival timing, %s (%s): %llu datagrams in %.1fs, mean period %.3fms, RFC 3550 jitter %.1fus",
+           St->Name, Title, (unsigned long long)Hist->Packets, Hist->Seconds, St->PeriodNs / 1.0e6, St->RFCJitterNs / 1000.0);
+    if (Hist->NoTimestamp != 0)
+        printf("; %llu without a kernel timestamp", (unsigned long long)Hist->NoTimestamp);
+    printf("\n");
+    RXTPrintTimes("inter-arrival jitter", Hist->Jitter, Hist->MaxJitterNs);
+    printf("  %-22s", "burst length");
+    for (Bin = 0; Bin < VRXTBURSTBINS; Bin++)
+        printf(" %s:%llu", RXTBurstNames[Bin], (unsigned long long)Hist->Bursts[Bin]);
+    printf("; longest %d\n", Hist->LongestBurst);
+    RXTPrintTimes("kernel to p2app delay", Hist->Delay, Hist->MaxDelayNs);
+    printf("  99%% of datagrams: network jitter %s, p2app read delay %s\n",
+           RXTPercentile(Hist->Jitter, 0.99), RXTPercentile(Hist->Delay, 0.99));
+}
+
+
+//
+// add a period's histograms to the run's
+//
+static void RXTAddHistograms(TRXTHistograms* Run, TRXTHistograms* Period)
+{
+    uint32_t Bin;
+
+    Run->Packets += Period->Packets;
+    Run->NoTimestamp += Period->NoTimestamp;
+    for (Bin = 0; Bin < VRXTBINS; Bin++)
+    {
+        Run->Jitter[Bin] += Period->Jitter[Bin];
+        Run->Delay[Bin] += Period->Delay[Bin];
+    }
+    for (Bin = 0; Bin < VRXTBURSTBINS; Bin++)
+        Run->Bursts[Bin] += Period->Bursts[Bin];
+    if (Period->MaxJitterNs > Run->MaxJitterNs)
+        Run->MaxJitterNs = Period->MaxJitterNs;
+    if (Period->MaxDelayNs > Run->MaxDelayNs)
+        Run->MaxDelayNs = Period->MaxDelayNs;
+    if (Period->LongestBurst > Run->LongestBurst)
+        Run->LongestBurst = Period->LongestBurst;
+    Run->Seconds += Period->Seconds;
+}
+
+
+//
+// end a report period for every stream: print it if Print, then add it to the run
+//
+static void RXTEndPeriod(double Seconds, bool Print)
+{
+    TRXTStream* St;
+    uint32_t Stream;
+
+    for (Stream = 0; Stream < eRXTNumStreams; Stream++)
+    {
+        St = &RXTStreams[Stream];
+        pthread_mutex_lock(&St->Mutex);
+        St->Period.Seconds = Seconds;
+        if (Print)
+            RXTPrintHistograms(St, &St->Period, "last period");
+        RXTAddHistograms(&St->Run, &St->Period);
+        memset(&St->Period, 0, sizeof(TRXTHistograms));
+        pthread_mutex_unlock(&St->Mutex);
+    }
+}
+
+
+//
+// end of a run: print the run totals, and start again
+//
+static void RXTEndRun(void)
+{
+    TRXTStream* St;
+    uint32_t Stream;
+
+    for (Stream = 0; Stream < eRXTNumStreams; Stream++)
+    {
+        St = &RXTStreams[Stream];
+        pthread_mutex_lock(&St->Mutex);
+        RXTPrintHistograms(St, &St->Run, "run");
+        memset(&St->Run, 0, sizeof(TRXTHistograms));
+        St->HaveLast = false;
+        pthread_mutex_unlock(&St->Mutex);
+    }
+}
+
+
+//
+// report thread: each period while the radio runs, and at the end of the run
+//
+static void* RxTimingReport(__attribute__((unused)) void* arg)
+{
+    bool Running = false;
+    int64_t PeriodStart = 0;
+    int64_t Now;
+
+    printf("spinning up arrival timing report thread, pid=%ld\n", syscall(SYS_gettid));
+    while (1)
+    {
+        usleep(VRXTPOLLMS * 1000);
+        Now = RXTNowNs(CLOCK_MONOTONIC);
+        if (SDRActive && !Running)
+        {
+            RXTEndPeriod(0.0, false);                           // discard anything before the run
+            RXTEndRun();
+            PeriodStart = Now;
+            Running = true;
+        }
+        else if (!SDRActive && Running)
+        {
+            RXTEndPeriod((Now - PeriodStart) / 1.0e9, false);
+            RXTEndRun();
+            Running = false;
+        }
+        else if (Running && ((Now - PeriodStart) >= RXTReportSeconds * 1000000000LL))
+        {
+            RXTEndPeriod((Now - PeriodStart) / 1.0e9, true);
+            PeriodStart = Now;
+        }
+    }
+    return NULL;
+}
+
+
+//
+// start the report thread
+// returns true if error
+//
+bool InitialiseRxTiming(void)
+{
+    if (!RXTEnabled)
+        return false;
+    if (pthread_create(&RXTReportThread, NULL, RxTimingReport, NULL) < 0)
+    {
+        perror("pthread_create arrival timing");
+        return true;
+    }
+    pthread_detach(RXTReportThread);
+    printf("arrival timing of DUC I/Q, speaker audio and high priority datagrams reported every %ds\n", RXTReportSeconds);
+    return false;
+}
+
+
+
+//////////////////////////////////////////////////////////////
+//
+// check: a paced sender on the loopback interface, read by this thread as
+// the DUC I/Q stream. First the sender sends bursts (a network fault: 3
+// slots missed, then 4 datagrams together) and the datagrams are read at
+// once; then the sender is even and the reader stalls (a scheduling fault).
+// the two faults must show in different histograms.
+//
+//////////////////////////////////////////////////////////////
+
+#define VCHKPERIODNS 1250000LL                      // DUC I/Q datagram period at 192ksps
+#define VCHKPACKETS 2000                            // per phase
+#define VCHKCYCLE 20                                // slots per burst cycle; the last 4 datagrams together
+#define VCHKSTALLEVERY 25                           // datagrams read between reader stalls
+#define VCHKSTALLUS 5000
+#define VCHKPACKETSIZE 1444                         // DUC I/Q datagram size
+#define VCHKMINFOUND 0.8                            // fraction of injected faults to be found
+#define VCHKSEPARATION 3                            // each fault seen this many times more in its own phase than in the other
+
+
+typedef struct
+{
+    int Socket;
+    struct sockaddr_in Dest;
+    bool Bursts;
+} TRXTCheckSender;
+
+
+static void* RXTCheckSend(void* arg)
+{
+    TRXTCheckSender* Sender = (TRXTCheckSender*)arg;
+    uint8_t Packet[VCHKPACKETSIZE];
+    struct timespec Due;
+    uint32_t Sent = 0, Slot = 0, Cntr, Count;
+
+    memset(Packet, 0, sizeof(Packet));
+    clock_gettime(CLOCK_MONOTONIC, &Due);
+    while (Sent < VCHKPACKETS)
+    {
+        Due.tv_nsec += VCHKPERIODNS;
+        if (Due.tv_nsec >= 1000000000L)
+        {
+            Due.tv_nsec -= 1000000000L;
+            Due.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &Due, NULL);
+        Count = 1;
+        if (Sender->Bursts)
+        {
+            if ((Slot % VCHKCYCLE) >= VCHKCYCLE - 4)
+                Count = ((Slot % VCHKCYCLE) == VCHKCYCLE - 1) ? 4 : 0;
+        }
+        for (Cntr = 0; Cntr < Count; Cntr++)
+        {
+            *(uint32_t*)Packet = htonl(Sent++);
+            sendto(Sender->Socket, Packet, sizeof(Packet), 0, (struct sockaddr*)&Sender->Dest, sizeof(Sender->Dest));
+        }
+        Slot++;
+    }
+    return NULL;
+}
+
+
+//
+// run one phase; the stream's run histograms are left holding it
+// returns true if error
+//
+static bool RXTCheckPhase(int RxSocket, TRXTCheckSender* Sender, bool Stall)
+{
+    pthread_t Thread;
+    uint8_t Buffer[VCHKPACKETSIZE];
+    uint8_t Control[VRXTCONTROLSIZE];
+    struct iovec Iov;
+    struct msghdr Msg;
+    uint32_t Received = 0;
+    int64_t Start;
+    ssize_t Size;
+
+    RXTEndPeriod(0.0, false);
+    memset(&RXTStreams[eRXTDUCIQ].Run, 0, sizeof(TRXTHistograms));
+    RXTStreams[eRXTDUCIQ].HaveLast = false;
+    Start = RXTNowNs(CLOCK_MONOTONIC);
+    if (pthread_create(&Thread, NULL, RXTCheckSend, Sender) < 0)
+    {
+        perror("pthread_create arrival timing check");
+        return true;
+    }
+    while (Received < VCHKPACKETS)
+    {
+        memset(&Msg, 0, sizeof(Msg));
+        Iov.iov_base = Buffer;
+        Iov.iov_len = sizeof(Buffer);
+        Msg.msg_iov = &Iov;
+        Msg.msg_iovlen = 1;
+        RxTimingSetControl(&Msg, Control);
+        Size = recvmsg(RxSocket, &Msg, 0);
+        if (Size < 0)
+        {
+            if (errno == EAGAIN)
+                break;                                          // sender has stopped
+            continue;
+        }
+        RxTimingRecord(eRXTDUCIQ, &Msg);
+        Received++;
+        if (Stall && ((Received % VCHKSTALLEVERY) == 0))
+            usleep(VCHKSTALLUS);
+    }
+    pthread_join(Thread, NULL);
+    RXTEndPeriod((RXTNowNs(CLOCK_MONOTONIC) - Start) / 1.0e9, false);
+    RXTPrintHistograms(&RXTStreams[eRXTDUCIQ], &RXTStreams[eRXTDUCIQ].Run, Stall ? "late reads" : "network bursts");
+    if (Received < VCHKPACKETS * 0.95)
+    {
+        printf("  FAIL: %d of %d datagrams received\n", Received, VCHKPACKETS);
+        return true;
+    }
+    return false;
+}
+
+
+//
+// datagrams in bursts of 3 or more, and read 1ms or more late, in the last phase
+//
+static void RXTCheckCounts(uint64_t* LongBursts, uint64_t* LateReads)
+{
+    TRXTHistograms* Hist = &RXTStreams[eRXTDUCIQ].Run;
+
+    *LongBursts = Hist->Bursts[2] + Hist->Bursts[3] + Hist->Bursts[4] + Hist->Bursts[5];
+    *LateReads = Hist->Delay[5] + Hist->Delay[6] + Hist->Delay[7];
+}
+
+
+//
+// check with a local paced sender
+// returns true if failed
+//
+bool RunRxTimingCheck(void)
+{
+    TRXTCheckSender Sender;
+    struct sockaddr_in Addr;
+    socklen_t Length = sizeof(Addr);
+    struct timeval ReadTimeout;
+    int RxSocket;
+    uint64_t BurstsA, LateA, BurstsB, LateB;
+    uint32_t InjectedBursts, InjectedStalls;
+    bool Failed = false;
+
+    printf("arrival timing check: paced sender on loopback, %.2fms period, %d datagrams per phase\n",
+           VCHKPERIODNS / 1.0e6, VCHKPACKETS);
+    RXTEnabled = true;
+    RxSocket = socket(AF_INET, SOCK_DGRAM, 0);
+    Sender.Socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if ((RxSocket < 0) || (Sender.Socket < 0))
+    {
+        perror("socket, arrival timing check");
+        return true;
+    }
+    memset(&Addr, 0, sizeof(Addr));
+    Addr.sin_family = AF_INET;
+    Addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    Addr.sin_port = 0;
+    if ((bind(RxSocket, (struct sockaddr*)&Addr, sizeof(Addr)) < 0)
+        || (getsockname(RxSocket, (struct sockaddr*)&Addr, &Length) < 0))
+    {
+        perror("bind, arrival timing check");
+        return true;
+    }
+    ReadTimeout.tv_sec = 0;
+    ReadTimeout.tv_usec = 200000;
+    setsockopt(RxSocket, SOL_SOCKET, SO_RCVTIMEO, (void *)&ReadTimeout, sizeof(ReadTimeout));
+    RXTEnableTimestamps(RxSocket);
+    Sender.Dest = Addr;
+
+    Sender.Bursts = true;
+    Failed |= RXTCheckPhase(RxSocket, &Sender, false);
+    RXTCheckCounts(&BurstsA, &LateA);
+    Sender.Bursts = false;
+    Failed |= RXTCheckPhase(RxSocket, &Sender, true);
+    RXTCheckCounts(&BurstsB, &LateB);
+
+    InjectedBursts = VCHKPACKETS / VCHKCYCLE;
+    InjectedStalls = VCHKPACKETS / VCHKSTALLEVERY;
+    printf("network bursts: %llu bursts of 3 or more found (%d injected), %llu datagrams read 1ms or more late\n",
+           (unsigned long long)BurstsA, InjectedBursts, (unsigned long long)LateA);
+    printf("late reads: %llu datagrams read 1ms or more late (%d %dus stalls injected), %llu bursts of 3 or more\n",
+           (unsigned long long)LateB, InjectedStalls, VCHKSTALLUS, (unsigned long long)BurstsB);
+    if (BurstsA < VCHKMINFOUND * InjectedBursts)
+    {
+        printf("  FAIL: network bursts not found\n");
+        Failed = true;
+    }
+    if (LateB < VCHKMINFOUND * InjectedStalls)
+    {
+        printf("  FAIL: late reads not found\n");
+        Failed = true;
+    }
+    if ((LateB < VCHKSEPARATION * LateA) || (BurstsA < VCHKSEPARATION * BurstsB))
+    {
+        printf("  FAIL: network and scheduling faults not separated\n");
+        Failed = true;
+    }
+    close(RxSocket);
+    close(Sender.Socket);
+    RXTEnabled = false;
+    printf("arrival timing check: %s\n", Failed ? "FAIL" : "pass");
+    return Failed;
+}
@@ -0,0 +1,89 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// rxtiming.h:
+// arrival timing of incoming streams, from kernel receive timestamps:
+// inter-arrival jitter, bursts, and kernel to p2app delay, per stream
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __rxtiming_h
+#define __rxtiming_h
+
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include "../common/saturntypes.h"
+
+
+#define VRXTMAXREPORTSECONDS 3600
+#define VRXTCONTROLSIZE 64                          // receive control buffer for the timestamp
+#define VRXTBINS 8                                  // time histogram bins: <10us, <30us ... <10ms, >=10ms
+#define VRXTBURSTBINS 6                             // burst length bins: 1, 2, 3-4, 5-8, 9-16, >16
+
+
+//
+// streams analysed
+//
+typedef enum
+{
+    eRXTHighPriority,
+    eRXTSpeaker,
+    eRXTDUCIQ,
+    eRXTNumStreams
+} ERXTStream;
+
+
+//
+// parse a -J setting: report period, seconds
+// returns true if not valid
+//
+bool ParseRxTimingSetting(char* Setting);
+
+
+//
+// true if arrival timing is enabled
+//
+bool RxTimingEnabled(void);
+
+
+//
+// start the report thread
+// returns true if error
+//
+bool InitialiseRxTiming(void);
+
+
+//
+// enable kernel receive timestamps on a socket, if its port (VPORTxxx) is analysed
+//
+void RxTimingPrepareSocket(int PortIndex, int Socketid);
+
+
+//
+// give a receive message a control buffer for the timestamp (VRXTCONTROLSIZE
+// bytes); call after the msghdr is cleared, before each receive
+//
+void RxTimingSetControl(struct msghdr* Msg, uint8_t* Control);
+
+
+//
+// a datagram has been received on a stream: its message holds the kernel timestamp
+//
+void RxTimingRecord(ERXTStream Stream, struct msghdr* Msg);
+
+
+//
+// check with a local paced sender: network bursts, then late reads
+// returns true if failed
+//
+bool RunRxTimingCheck(void);
+
+
+#endif
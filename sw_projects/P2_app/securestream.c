@@ -0,0 +1,374 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// securestream.c:
+//
+// optional authenticated encryption of every P2 datagram (see p2crypt.h).
+// each socket gets a context when it is first used: a sender, with the
+// socket's local port as its sender id, and a receiver with a replay window
+// for each sender id it hears from. Datagrams to the host are sealed with one
+// key and datagrams from the host opened with another, both derived from the
+// pre-shared key.
+// the DDC I/Q thread batches its sealed datagrams and sends up to
+// VSSBATCHSIZE with one sendmmsg call, so the extra per packet cost is the
+// crypto alone.
+// a sealed datagram is VP2COVERHEAD bytes longer: a 1444 byte DDC I/Q
+// datagram becomes 1472 bytes, which still fits a 1500 byte MTU.
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "../common/saturntypes.h"
+#include "../common/p2crypt.h"
+#include "securestream.h"
+
+
+#define VSSMAXDATAGRAM 65536                        // largest datagram sealed or opened
+
+
+//
+// datagrams held for one sendmmsg
+//
+typedef struct
+{
+    uint8_t Buffer[VSSBATCHSIZE][VSSBATCHBYTES];
+    struct iovec Iov[VSSBATCHSIZE];
+    struct sockaddr_in Addr[VSSBATCHSIZE];
+    struct mmsghdr Msgs[VSSBATCHSIZE];
+    int Count;
+} TSecureBatch;
+
+
+//
+// state for a socket
+//
+typedef struct
+{
+    TP2CryptSender Sender;
+    TP2CryptReceiver Receiver;
+    TSecureBatch* Batch;                            // allocated when the socket first batches
+    _Atomic(uint64_t) Sealed;
+    uint64_t BatchCalls;                            // sendmmsg calls
+    uint64_t BatchDatagrams;                        // datagrams sent by them
+} TSecureSocket;
+
+
+static bool SSEnabled = false;
+static TP2CryptKey SSKeyToHost;
+static TP2CryptKey SSKeyToSDR;
+static _Atomic(TSecureSocket*) SSSockets[VSSMAXSOCKETS];
+static pthread_mutex_t SSMutex = PTHREAD_MUTEX_INITIALIZER;     // held to create a context
+
+
+//
+// read the pre-shared key file and enable encryption
+// returns true if error
+//
+bool LoadSecureKey(char* FileName)
+{
+    uint8_t KeyBytes[VP2CKEYSIZE];
+
+    if (P2CryptReadKeyFile(FileName, KeyBytes))
+        return true;
+    P2CryptDeriveKeys(KeyBytes, &SSKeyToHost, &SSKeyToSDR);
+    memset(KeyBytes, 0, sizeof(KeyBytes));
+    SSEnabled = true;
+    return false;
+}
+
+
+//
+// true if encryption is enabled
+//
+bool SecureStreamsEnabled(void)
+{
+    return SSEnabled;
+}
+
+
+//
+// find a socket's context, creating it on first use
+// returns NULL if the socket cannot be secured
+//
+static TSecureSocket* GetSecureSocket(int Socket)
+{
+    TSecureSocket* Context;
+    struct sockaddr_in Local;
+    socklen_t Length = sizeof(Local);
+
+    if ((Socket < 0) || (Socket >= VSSMAXSOCKETS))
+        return NULL;
+    Context = atomic_load(&SSSockets[Socket]);
+    if (Context != NULL)
+        return Context;
+
+    pthread_mutex_lock(&SSMutex);
+    Context = atomic_load(&SSSockets[Socket]);
+    if (Context == NULL)
+    {
+        Context = (TSecureSocket*)calloc(1, sizeof(TSecureSocket));
+        if (Context != NULL)
+        {
+            memset(&Local, 0, sizeof(Local));
+            if (getsockname(Socket, (struct sockaddr*)&Local, &Length) < 0)
+                perror("secure stream getsockname");
+            P2CryptInitSender(&Context->Sender, &SSKeyToHost, ntohs(Local.sin_port));
+            P2CryptInitReceiver(&Context->Receiver, &SSKeyToSDR);
+            atomic_store(&SSSockets[Socket], Context);
+        }
+    }
+    pthread_mutex_unlock(&SSMutex);
+    return Context;
+}
+
+
+//
+// send any datagrams held for a socket
+// returns -1 if error
+//
+static int FlushBatch(int Socket, TSecureSocket* Context)
+{
+    TSecureBatch* Batch = Context->Batch;
+    int Sent = 0;
+    int Result;
+
+    if ((Batch == NULL) || (Batch->Count == 0))
+        return 0;
+    while (Sent < Batch->Count)
+    {
+        Result = sendmmsg(Socket, Batch->Msgs + Sent, Batch->Count - Sent, 0);
+        if (Result < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            Batch->Count = 0;
+            return -1;
+        }
+        Context->BatchCalls++;
+        Context->BatchDatagrams += Result;
+        Sent += Result;
+    }
+    Batch->Count = 0;
+    return 0;
+}
+
+
+int SecureFlush(int Socket)
+{
+    TSecureSocket* Context;
+
+    if (!SSEnabled || (Socket < 0) || (Socket >= VSSMAXSOCKETS))
+        return 0;
+    Context = atomic_load(&SSSockets[Socket]);
+    if (Context == NULL)
+        return 0;
+    return FlushBatch(Socket, Context);
+}
+
+
+//
+// send a datagram, sealed if encryption is enabled
+// returns as sendmsg
+//
+ssize_t SecureSendMsg(int Socket, struct msghdr* Msg, bool Batch)
+{
+    uint8_t Sealed[VSSMAXDATAGRAM];
+    TSecureSocket* Context;
+    TSecureBatch* Held;
+    struct msghdr Out;
+    struct iovec OutIov;
+    size_t Length = 0;
+    size_t Cntr;
+    int SealedLength;
+
+    if (!SSEnabled)
+        return sendmsg(Socket, Msg, 0);
+    Context = GetSecureSocket(Socket);
+    if (Context == NULL)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    for (Cntr = 0; Cntr < Msg->msg_iovlen; Cntr++)
+        Length += Msg->msg_iov[Cntr].iov_len;
+
+    //
+    // batched: seal into the next free batch slot, and send the batch when full
+    //
+    if (Batch && (Length + VP2COVERHEAD <= VSSBATCHBYTES))
+    {
+        if (Context->Batch == NULL)
+        {
+            Context->Batch = (TSecureBatch*)calloc(1, sizeof(TSecureBatch));
+            if (Context->Batch == NULL)
+                return -1;
+        }
+        Held = Context->Batch;
+        SealedLength = P2CryptSeal(&Context->Sender, Msg->msg_iov, Msg->msg_iovlen, Held->Buffer[Held->Count], VSSBATCHBYTES);
+        Held->Iov[Held->Count].iov_base = Held->Buffer[Held->Count];
+        Held->Iov[Held->Count].iov_len = SealedLength;
+        memcpy(Held->Addr + Held->Count, Msg->msg_name, sizeof(struct sockaddr_in));   // (some callers give a longer length)
+        memset(&Held->Msgs[Held->Count], 0, sizeof(struct mmsghdr));
+        Held->Msgs[Held->Count].msg_hdr.msg_iov = Held->Iov + Held->Count;
+        Held->Msgs[Held->Count].msg_hdr.msg_iovlen = 1;
+        Held->Msgs[Held->Count].msg_hdr.msg_name = Held->Addr + Held->Count;
+        Held->Msgs[Held->Count].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        Held->Count++;
+        atomic_fetch_add(&Context->Sealed, 1);
+        if ((Held->Count == VSSBATCHSIZE) && (FlushBatch(Socket, Context) < 0))
+            return -1;
+        return (ssize_t)Length;
+    }
+
+    //
+    // not batched: send anything held first, to keep datagrams in order
+    //
+    if (FlushBatch(Socket, Context) < 0)
+        return -1;
+    SealedLength = P2CryptSeal(&Context->Sender, Msg->msg_iov, Msg->msg_iovlen, Sealed, sizeof(Sealed));
+    if (SealedLength < 0)
+    {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    atomic_fetch_add(&Context->Sealed, 1);
+    OutIov.iov_base = Sealed;
+    OutIov.iov_len = SealedLength;
+    memset(&Out, 0, sizeof(Out));
+    Out.msg_name = Msg->msg_name;
+    Out.msg_namelen = Msg->msg_namelen;
+    Out.msg_iov = &OutIov;
+    Out.msg_iovlen = 1;
+    if (sendmsg(Socket, &Out, 0) < 0)
+        return -1;
+    return (ssize_t)Length;
+}
+
+
+ssize_t SecureSendTo(int Socket, void* Buffer, size_t Length, struct sockaddr_in* Addr)
+{
+    struct msghdr Msg;
+    struct iovec Iov;
+
+    Iov.iov_base = Buffer;
+    Iov.iov_len = Length;
+    memset(&Msg, 0, sizeof(Msg));
+    Msg.msg_name = Addr;
+    Msg.msg_namelen = sizeof(struct sockaddr_in);
+    Msg.msg_iov = &Iov;
+    Msg.msg_iovlen = 1;
+    return SecureSendMsg(Socket, &Msg, false);
+}
+
+
+//
+// receive a datagram, opened if encryption is enabled
+// (into Msg->msg_iov[0]: all P2 receive calls use one buffer)
+//
+ssize_t SecureRecvMsg(int Socket, struct msghdr* Msg)
+{
+    uint8_t Sealed[VSSMAXDATAGRAM];
+    TSecureSocket* Context;
+    struct msghdr In;
+    struct iovec InIov;
+    ssize_t Size;
+    int Length;
+
+    if (!SSEnabled)
+        return recvmsg(Socket, Msg, 0);
+    Context = GetSecureSocket(Socket);
+    if (Context == NULL)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    InIov.iov_base = Sealed;
+    InIov.iov_len = sizeof(Sealed);
+    memset(&In, 0, sizeof(In));
+    In.msg_name = Msg->msg_name;
+    In.msg_namelen = Msg->msg_namelen;
+    In.msg_iov = &InIov;
+    In.msg_iovlen = 1;
+    In.msg_control = Msg->msg_control;                          // receive timestamp, if asked for
+    In.msg_controllen = Msg->msg_controllen;
+    Size = recvmsg(Socket, &In, 0);
+    if (Size < 0)
+        return Size;
+    Msg->msg_namelen = In.msg_namelen;
+    Msg->msg_controllen = In.msg_controllen;
+    Msg->msg_flags = In.msg_flags;
+    Length = P2CryptOpen(&Context->Receiver, Sealed, (uint32_t)Size, (uint8_t*)Msg->msg_iov[0].iov_base, Msg->msg_iov[0].iov_len);
+    if (Length < 0)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+    return Length;
+}
+
+
+//
+// forget a socket's state: call before it is closed
+// (the fd number may be reused for a socket on another port)
+//
+void SecureSocketClosed(int Socket)
+{
+    TSecureSocket* Context;
+
+    if ((Socket < 0) || (Socket >= VSSMAXSOCKETS))
+        return;
+    pthread_mutex_lock(&SSMutex);
+    Context = atomic_load(&SSSockets[Socket]);
+    atomic_store(&SSSockets[Socket], NULL);
+    pthread_mutex_unlock(&SSMutex);
+    if (Context != NULL)
+    {
+        FlushBatch(Socket, Context);
+        free(Context->Batch);
+        free(Context);
+    }
+}
+
+
+//
+// print datagrams sealed, opened and dropped so far
+//
+void PrintSecureReport(void)
+{
+    TSecureSocket* Context;
+    TP2CryptStatistics* Stats;
+    int Socket;
+
+    if (!SSEnabled)
+        return;
+    printf("secure streams: ChaCha20-Poly1305, %d bytes added per datagram\n", VP2COVERHEAD);
+    for (Socket = 0; Socket < VSSMAXSOCKETS; Socket++)
+    {
+        Context = atomic_load(&SSSockets[Socket]);
+        if (Context == NULL)
+            continue;
+        Stats = &Context->Receiver.Stats;
+        printf("  port %5d: sealed %llu", Context->Sender.SenderId, (unsigned long long)atomic_load(&Context->Sealed));
+        if (Context->BatchCalls != 0)
+            printf(" (%.1f per sendmmsg)", (double)Context->BatchDatagrams / (double)Context->BatchCalls);
+        printf("; opened %llu, dropped: bad tag %llu, replayed %llu, bad length %llu, sender refused %llu\n",
+               (unsigned long long)Stats->Opened, (unsigned long long)Stats->BadTag,
+               (unsigned long long)Stats->Replayed, (unsigned long long)Stats->Short,
+               (unsigned long long)Stats->NoSlot);
+    }
+}
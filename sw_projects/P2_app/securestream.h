@@ -0,0 +1,86 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// securestream.h:
+//
+// optional authenticated encryption of every P2 datagram, for remote
+// operation without a VPN. Enabled by a pre-shared key file (-K); the
+// send and receive calls below replace sendmsg, sendto and recvmsg, and
+// pass straight through if it is not enabled.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __securestream_h
+#define __securestream_h
+
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "../common/saturntypes.h"
+
+
+#define VSSMAXSOCKETS 1024                          // sockets with fd below this can be secured
+#define VSSBATCHSIZE 8                              // sealed datagrams sent by one sendmmsg
+#define VSSBATCHBYTES 1500                          // largest datagram that can be batched
+
+
+//
+// read the pre-shared key file and enable encryption
+// returns true if error
+//
+bool LoadSecureKey(char* FileName);
+
+
+//
+// true if encryption is enabled
+//
+bool SecureStreamsEnabled(void);
+
+
+//
+// send a datagram. If Batch, a sealed datagram may be held and sent with
+// others by one sendmmsg call: SecureFlush must then be called when the
+// caller has no more to send. A socket that is batched must be sent on by
+// one thread only. An unbatched send flushes any datagrams held for the
+// socket first.
+// returns as sendmsg
+//
+ssize_t SecureSendMsg(int Socket, struct msghdr* Msg, bool Batch);
+ssize_t SecureSendTo(int Socket, void* Buffer, size_t Length, struct sockaddr_in* Addr);
+
+
+//
+// send any datagrams held for a socket
+// returns -1 if error
+//
+int SecureFlush(int Socket);
+
+
+//
+// receive a datagram: opened into Msg's buffers
+// a datagram dropped for failed authentication or replay returns -1 with
+// errno EAGAIN, as a receive timeout does
+//
+ssize_t SecureRecvMsg(int Socket, struct msghdr* Msg);
+
+
+//
+// forget a socket's state: call before it is closed
+//
+void SecureSocketClosed(int Socket);
+
+
+//
+// print datagrams sealed, opened and dropped so far
+//
+void PrintSecureReport(void);
+
+
+#endif
@@ -0,0 +1,450 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// selftest.c:
+//
+// end to end streaming self test using the FPGA test DDS source
+// the test DDS replaces the ADCs; every DDC is tuned so the tone appears at a
+// known offset. Each sample rate and DDC count is streamed through the normal
+// DDC thread to a socket on this host, then for each DDC we check:
+// - UDP sequence numbers are contiguous
+// - samples taken from the DMA stream match the sample rate, and all reach UDP
+// - tone frequency, amplitude and SNR
+// - no phase jumps (missing or repeated samples)
+// - no FIFO overflow
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "../common/saturntypes.h"
+#include "../common/saturnregisters.h"
+#include "../common/toneanalysis.h"
+#include "threaddata.h"
+#include "OutDDCIQ.h"
+#include "selftest.h"
+
+
+#define VSELFTESTRUNMS 600                          // streaming time per configuration
+#define VSELFTESTSTOPMS 100                         // time for threads to stop between configurations
+#define VSELFTESTSETTLEPACKETS 10                   // packets discarded while DDC filters settle
+#define VSELFTESTMAXSAMPLES 32768                   // samples analysed per DDC
+#define VSELFTESTMINSAMPLES 2048                    // fewest samples for a valid analysis
+#define VSELFTESTFREQTOL 1.0                        // Hz
+#define VSELFTESTAMPLTOL 1.0                        // dB spread between DDCs
+#define VSELFTESTMINSNR 50.0                        // dB
+#define VSELFTESTMINRATE 0.9                        // DMA sample count / expected
+#define VSELFTESTMAXRATE 1.05
+#define VSELFTESTNUMRATES 6
+
+
+static const uint32_t SelfTestRates[VSELFTESTNUMRATES] = {48, 96, 192, 384, 768, 1536};
+
+
+//
+// data collected for one DDC
+//
+typedef struct
+{
+    bool SeqStarted;
+    uint32_t NextSeq;
+    uint32_t SeqGaps;                               // missing packets
+    uint32_t Packets;
+    uint64_t SamplesReceived;                       // all samples received by UDP
+    uint32_t SamplesStored;                         // samples kept for analysis
+    double* IQ;
+} TSelfTestDDC;
+
+
+//
+// tone offset from DDC centre: different for each DDC, within the passband
+//
+static double SelfTestToneOffset(uint32_t DDC, uint32_t RatekHz)
+{
+    return (double)RatekHz * 1000.0 * (double)(DDC + 1) / 40.0;
+}
+
+
+//
+// clear collected data for one DDC
+//
+static void ResetDDCCollector(TSelfTestDDC* Collect)
+{
+    double* IQ = Collect->IQ;
+
+    memset(Collect, 0, sizeof(TSelfTestDDC));
+    Collect->IQ = IQ;
+}
+
+
+//
+// add one received DDC packet to the collected data
+//
+static void CollectDDCPacket(TSelfTestDDC* Collect, uint8_t* Packet, int Size)
+{
+    uint32_t Seq;
+    uint32_t Samples;
+
+    if (Size != VDDCPACKETSIZE)
+        return;
+    Seq = ntohl(*(uint32_t*)Packet);
+    if (Collect->SeqStarted && (Seq != Collect->NextSeq))
+        Collect->SeqGaps += (Seq - Collect->NextSeq);
+    Collect->SeqStarted = true;
+    Collect->NextSeq = Seq + 1;
+    Collect->Packets++;
+    Collect->SamplesReceived += VIQSAMPLESPERFRAME;
+    if (Collect->Packets <= VSELFTESTSETTLEPACKETS)
+        return;
+    Samples = VIQSAMPLESPERFRAME;
+    if (Collect->SamplesStored + Samples > VSELFTESTMAXSAMPLES)
+        Samples = VSELFTESTMAXSAMPLES - Collect->SamplesStored;
+    UnpackP2IQSamples(Packet + 16, Samples, Collect->IQ + 2 * Collect->SamplesStored);
+    Collect->SamplesStored += Samples;
+}
+
+
+//
+// check the collected data for one DDC. Returns true if it fails
+// Reason is set to a description of the 1st failure
+//
+static bool EvaluateDDC(TSelfTestDDC* Collect, double SampleRate, double ExpectedFreq,
+                        TToneAnalysis* Result, char* Reason, size_t ReasonSize)
+{
+    if (Collect->SamplesStored < VSELFTESTMINSAMPLES)
+    {
+        memset(Result, 0, sizeof(TToneAnalysis));
+        snprintf(Reason, ReasonSize, "only %d samples", Collect->SamplesStored);
+        return true;
+    }
+    AnalyseTone(Collect->IQ, Collect->SamplesStored, SampleRate, Result);
+    if (Collect->SeqGaps != 0)
+        snprintf(Reason, ReasonSize, "%d packets missing", Collect->SeqGaps);
+    else if (Result->Discontinuities != 0)
+        snprintf(Reason, ReasonSize, "%d sample discontinuities", Result->Discontinuities);
+    else if (fabs(Result->Frequency - ExpectedFreq) > VSELFTESTFREQTOL)
+    {
+        if (fabs(Result->Frequency + ExpectedFreq) <= VSELFTESTFREQTOL)
+            snprintf(Reason, ReasonSize, "tone at %.1fHz: spectrum inverted", Result->Frequency);
+        else
+            snprintf(Reason, ReasonSize, "tone at %.1fHz, expected %.1fHz", Result->Frequency, ExpectedFreq);
+    }
+    else if (Result->SNRdB < VSELFTESTMINSNR)
+        snprintf(Reason, ReasonSize, "SNR %.1fdB", Result->SNRdB);
+    else
+        return false;
+    return true;
+}
+
+
+//
+// get time in ms
+//
+static double SelfTestTimeMs(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (double)Now.tv_sec * 1000.0 + (double)Now.tv_nsec / 1.0e6;
+}
+
+
+//
+// receive DDC packets for a time, sorting them by source port
+//
+static void ReceiveDDCPackets(int Socket, TSelfTestDDC* Collect, double DurationMs)
+{
+    uint8_t Buffer[VDDCPACKETSIZE];
+    struct sockaddr_in From;
+    socklen_t FromLength;
+    double EndTime;
+    int Size;
+    uint32_t DDC;
+
+    EndTime = SelfTestTimeMs() + DurationMs;
+    while (SelfTestTimeMs() < EndTime)
+    {
+        NewMessageReceived = true;                          // keep activity check happy
+        FromLength = sizeof(From);
+        Size = recvfrom(Socket, Buffer, sizeof(Buffer), 0, (struct sockaddr*)&From, &FromLength);
+        if (Size <= 0)
+            continue;
+        for (DDC = 0; DDC < VNUMDDC; DDC++)
+            if (ntohs(From.sin_port) == SocketData[VPORTDDCIQ0 + DDC].Portid)
+            {
+                CollectDDCPacket(Collect + DDC, Buffer, Size);
+                break;
+            }
+    }
+}
+
+
+//
+// run the streaming self test.
+// returns true if any configuration failed
+//
+bool RunStreamSelfTest(uint32_t ToneFrequency)
+{
+    TSelfTestDDC Collect[VNUMDDC];
+    TToneAnalysis Result[VNUMDDC];
+    uint64_t DemuxStart[VNUMDDC];
+    uint32_t MaxCount[VSELFTESTNUMRATES];
+    char Reason[80];
+    int Socket;
+    struct sockaddr_in SinkAddr;
+    socklen_t AddrLength = sizeof(SinkAddr);
+    struct timeval Timeout = {0, 10000};
+    int BufferSize = 8 * 1024 * 1024;
+    uint32_t RateIndex, Rate, Count, DDC;
+    double StartMs, ElapsedMs, Expected, DMARatio;
+    double MinAmpl, MaxAmpl;
+    uint64_t Demuxed;
+    bool ConfigFail, AnyFail = false;
+    bool RateStillPassing;
+    double BestThroughput = 0.0;
+    uint32_t BestRate = 0, BestCount = 0;
+
+    //
+    // local socket to receive the DDC packets
+    //
+    Socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (Socket < 0)
+    {
+        perror("self test socket");
+        return true;
+    }
+    setsockopt(Socket, SOL_SOCKET, SO_RCVTIMEO, (void*)&Timeout, sizeof(Timeout));
+    setsockopt(Socket, SOL_SOCKET, SO_RCVBUF, (void*)&BufferSize, sizeof(BufferSize));
+    memset(&SinkAddr, 0, sizeof(SinkAddr));
+    SinkAddr.sin_family = AF_INET;
+    SinkAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((bind(Socket, (struct sockaddr*)&SinkAddr, sizeof(SinkAddr)) < 0)
+        || (getsockname(Socket, (struct sockaddr*)&SinkAddr, &AddrLength) < 0))
+    {
+        perror("self test bind");
+        close(Socket);
+        return true;
+    }
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+    {
+        memset(&Collect[DDC], 0, sizeof(TSelfTestDDC));
+        Collect[DDC].IQ = malloc(VSELFTESTMAXSAMPLES * 2 * sizeof(double));
+        if (Collect[DDC].IQ == NULL)
+        {
+            printf("self test: memory allocation failed\n");
+            close(Socket);
+            return true;
+        }
+    }
+
+    //
+    // route the test DDS to every DDC, and send data to the local socket
+    //
+    printf("streaming self test: test tone %dHz\n", ToneFrequency);
+    SetTestDDSFrequency(ToneFrequency, false);
+    UseTestDDSSource();
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+        SetDDCADC(DDC, eADC1);                                      // overridden to test source
+    memcpy(&reply_addr, &SinkAddr, sizeof(struct sockaddr_in));
+    ReplyAddressSet = true;
+
+    for (RateIndex = 0; RateIndex < VSELFTESTNUMRATES; RateIndex++)
+    {
+        Rate = SelfTestRates[RateIndex];
+        MaxCount[RateIndex] = 0;
+        RateStillPassing = true;
+        for (Count = 1; Count <= VNUMDDC; Count++)
+        {
+            //
+            // stop streaming, then set up this configuration
+            //
+            SDRActive = false;
+            usleep(VSELFTESTSTOPMS * 1000);
+            for (DDC = 0; DDC < VNUMDDC; DDC++)
+            {
+                SetP2SampleRate(DDC, (DDC < Count), Rate, false);
+                SetDDCFrequency(DDC, (uint32_t)((double)ToneFrequency - SelfTestToneOffset(DDC, Rate)), false);
+                ResetDDCCollector(&Collect[DDC]);
+                DemuxStart[DDC] = DDCSamplesDemuxed[DDC];
+            }
+            WriteP2DDCRateRegister();
+            atomic_fetch_and(&GlobalFIFOOverflows, (uint8_t)~0b00000001);
+
+            //
+            // stream, then stop and collect anything still in flight
+            //
+            StartMs = SelfTestTimeMs();
+            SDRActive = true;
+            ReceiveDDCPackets(Socket, Collect, VSELFTESTRUNMS);
+            SDRActive = false;
+            ElapsedMs = SelfTestTimeMs() - StartMs;
+            ReceiveDDCPackets(Socket, Collect, VSELFTESTSTOPMS);
+
+            //
+            // evaluate each DDC
+            //
+            ConfigFail = false;
+            Reason[0] = 0;
+            MinAmpl = 1000.0;
+            MaxAmpl = -1000.0;
+            for (DDC = 0; DDC < Count; DDC++)
+            {
+                char DDCReason[60];
+                Expected = (double)Rate * ElapsedMs;                // samples expected
+                Demuxed = DDCSamplesDemuxed[DDC] - DemuxStart[DDC];
+                DMARatio = (double)Demuxed / Expected;
+                if (EvaluateDDC(&Collect[DDC], Rate * 1000.0, SelfTestToneOffset(DDC, Rate),
+                                &Result[DDC], DDCReason, sizeof(DDCReason)))
+                    ;
+                else if ((DMARatio < VSELFTESTMINRATE) || (DMARatio > VSELFTESTMAXRATE))
+                    snprintf(DDCReason, sizeof(DDCReason), "DMA delivered %.1f%% of samples", 100.0 * DMARatio);
+                else if ((Collect[DDC].SamplesReceived > Demuxed)
+                         || (Collect[DDC].SamplesReceived + VIQSAMPLESPERFRAME < Demuxed))
+                    snprintf(DDCReason, sizeof(DDCReason), "%llu samples from DMA, %llu by UDP",
+                             (unsigned long long)Demuxed, (unsigned long long)Collect[DDC].SamplesReceived);
+                else
+                    DDCReason[0] = 0;
+                if (DDCReason[0] != 0)
+                {
+                    if (!ConfigFail)
+                        snprintf(Reason, sizeof(Reason), "DDC%d %s", DDC, DDCReason);
+                    ConfigFail = true;
+                }
+                if (Result[DDC].AmplitudedBFS < MinAmpl)
+                    MinAmpl = Result[DDC].AmplitudedBFS;
+                if (Result[DDC].AmplitudedBFS > MaxAmpl)
+                    MaxAmpl = Result[DDC].AmplitudedBFS;
+                if (UseDebug)
+                    printf("    DDC%d: %6.1fHz %6.1fdBFS SNR %5.1fdB disc %d gaps %d DMA %.1f%% %s\n",
+                           DDC, Result[DDC].Frequency, Result[DDC].AmplitudedBFS, Result[DDC].SNRdB,
+                           Result[DDC].Discontinuities, Collect[DDC].SeqGaps, 100.0 * DMARatio, DDCReason);
+            }
+            if (!ConfigFail && (MaxAmpl - MinAmpl > VSELFTESTAMPLTOL))
+            {
+                snprintf(Reason, sizeof(Reason), "amplitude differs by %.1fdB between DDCs", MaxAmpl - MinAmpl);
+                ConfigFail = true;
+            }
+            if (!ConfigFail && (atomic_load(&GlobalFIFOOverflows) & 0b00000001))
+            {
+                snprintf(Reason, sizeof(Reason), "DDC FIFO over threshold");
+                ConfigFail = true;
+            }
+            printf("  %4dksps x %2d DDC: %s %s\n", Rate, Count, ConfigFail ? "FAIL" : "pass", Reason);
+
+            if (ConfigFail)
+            {
+                AnyFail = true;
+                RateStillPassing = false;
+            }
+            else if (RateStillPassing)
+            {
+                MaxCount[RateIndex] = Count;
+                if ((double)(Rate * Count) > BestThroughput)
+                {
+                    BestThroughput = (double)(Rate * Count);
+                    BestRate = Rate;
+                    BestCount = Count;
+                }
+            }
+        }
+    }
+
+    //
+    // tidy up, and report the largest configurations that worked
+    //
+    SDRActive = false;
+    ReplyAddressSet = false;
+    usleep(VSELFTESTSTOPMS * 1000);
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+    {
+        SetP2SampleRate(DDC, false, 48, false);
+        free(Collect[DDC].IQ);
+    }
+    WriteP2DDCRateRegister();
+    close(Socket);
+
+    printf("self test summary: maximum DDC count passing at each rate:\n");
+    for (RateIndex = 0; RateIndex < VSELFTESTNUMRATES; RateIndex++)
+        printf("  %4dksps: %d\n", SelfTestRates[RateIndex], MaxCount[RateIndex]);
+    if (BestCount != 0)
+        printf("maximum sustainable configuration: %d DDCs at %dksps (%.0f ksps total)\n", BestCount, BestRate, BestThroughput);
+    else
+        printf("no configuration passed\n");
+    printf("self test %s\n", AnyFail ? "FAILED" : "PASSED");
+    return AnyFail;
+}
+
+
+//
+// check the self test analysis offline, using synthesised DDC packet streams.
+// DDC0 is clean; DDC1 loses a packet; DDC2 loses samples inside a packet;
+// DDC3 is noisy; DDC4 has the wrong frequency. Only DDC0 should pass, each
+// other with the right reason.
+// returns true if the analysis did not detect the faults correctly
+//
+bool RunSelfTestAnalysisCheck(void)
+{
+    const char* ExpectedReason[5] = {"", "packets missing", "discontinuities", "SNR", "expected"};
+    TSelfTestDDC Collect;
+    TToneAnalysis Result;
+    uint8_t Packet[VDDCPACKETSIZE];
+    char Reason[80];
+    uint32_t DDC, Seq;
+    uint64_t Sample;
+    double Offset, SampleRate = 192000.0;
+    double Noise, ToneFreq;
+    bool Fail, AnyError = false;
+
+    Collect.IQ = malloc(VSELFTESTMAXSAMPLES * 2 * sizeof(double));
+    if (Collect.IQ == NULL)
+        return true;
+    srand(1);
+    printf("self test analysis check, synthesised packets:\n");
+    for (DDC = 0; DDC < 5; DDC++)
+    {
+        ResetDDCCollector(&Collect);
+        Offset = SelfTestToneOffset(DDC, 192);
+        ToneFreq = (DDC == 4) ? Offset + 50.0 : Offset;
+        Noise = (DDC == 3) ? 0.01 : 0.00001;
+        Sample = 0;
+        for (Seq = 0; Seq < 150; Seq++)
+        {
+            if ((DDC == 2) && (Seq == 60))
+                Sample += 17;                               // lose 17 samples
+            *(uint32_t*)Packet = htonl(Seq);
+            memset(Packet + 4, 0, 12);
+            SynthesiseP2Tone(Packet + 16, VIQSAMPLESPERFRAME, Sample, SampleRate, ToneFreq, 0.25, Noise);
+            Sample += VIQSAMPLESPERFRAME;
+            if ((DDC == 1) && (Seq == 80))
+                continue;                                   // lose a packet
+            CollectDDCPacket(&Collect, Packet, VDDCPACKETSIZE);
+        }
+        Fail = EvaluateDDC(&Collect, SampleRate, Offset, &Result, Reason, sizeof(Reason));
+        if (!Fail)
+            Reason[0] = 0;
+        printf("  DDC%d: %7.1fHz %6.1fdBFS SNR %5.1fdB disc %d: %s %s\n", DDC, Result.Frequency,
+               Result.AmplitudedBFS, Result.SNRdB, Result.Discontinuities, Fail ? "FAIL" : "pass", Reason);
+        if ((DDC == 0) == Fail)
+            AnyError = true;
+        else if (Fail && (strstr(Reason, ExpectedReason[DDC]) == NULL))
+            AnyError = true;
+    }
+    free(Collect.IQ);
+    printf("self test analysis check %s\n", AnyError ? "FAILED" : "PASSED");
+    return AnyError;
+}
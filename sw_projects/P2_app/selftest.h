@@ -0,0 +1,45 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// selftest.h:
+//
+// end to end streaming self test using the FPGA test DDS source
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __selftest_h
+#define __selftest_h
+
+
+#include <stdint.h>
+#include "../common/saturntypes.h"
+
+
+#define VSELFTESTDEFAULTFREQ 10000000               // default test tone frequency, Hz
+
+
+//
+// run the streaming self test. The test DDS is routed to every DDC; each DDC
+// count and sample rate is streamed through the DDC thread to a local socket
+// and the received tones are checked.
+// must be called after the DDC thread has been started, before any client connects.
+// returns true if any configuration failed
+//
+bool RunStreamSelfTest(uint32_t ToneFrequency);
+
+
+//
+// check the self test analysis offline, using synthesised DDC packet streams
+// with known faults. No hardware is used.
+// returns true if the analysis did not detect the faults correctly
+//
+bool RunSelfTestAnalysisCheck(void);
+
+
+#endif
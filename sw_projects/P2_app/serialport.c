@@ -107,6 +107,7 @@ void* CATSerial(void *arg)
     char ch;                                    // individual read character
     int MatchPositionZZZS;
     int MatchPositionZZZP;
+    int MatchPositionZZAS;
 
     TSerialThreadData *DeviceData;
 
@@ -145,12 +146,13 @@ void* CATSerial(void *arg)
                         CATMessageBuffer[CATWritePtr++] = 0;            // terminate the string
                         MatchPositionZZZS = (int)(strstr(CATMessageBuffer, "ZZZS") - CATMessageBuffer);
                         MatchPositionZZZP = (int)(strstr(CATMessageBuffer, "ZZZP") - CATMessageBuffer);
+                        MatchPositionZZAS = (int)(strstr(CATMessageBuffer, "ZZAS") - CATMessageBuffer);
                         if((DeviceData -> Device == eG2V2Panel) ||(DeviceData -> Device == eG2V1PanelAdapter))
                         {
                         //
-                        // if ZZZS or ZZZP, send to local handler; else send to SDR client app
+                        // if ZZZS, ZZZP or ZZAS, send to local handler; else send to SDR client app
                         //
-                            if((MatchPositionZZZS == 0) || (MatchPositionZZZP == 0))
+                            if((MatchPositionZZZS == 0) || (MatchPositionZZZP == 0) || (MatchPositionZZAS == 0))
                                 ParseCATCmd(CATMessageBuffer, DeviceData -> DeviceHandle);              // if ZZZS, process locally; else send to TCPIP CAT port
                             else
                                 SendCATMessage(CATMessageBuffer);           // send unprocessed to SDR client app via TCP/IP
@@ -168,6 +170,7 @@ void* CATSerial(void *arg)
             }
         }
         printf("Closing CAT Serial read handler thread for device %s\n", DeviceNames[(int)DeviceData->Device]);
+        CATUnsubscribeDevice(DeviceData -> DeviceHandle);
         close(DeviceData -> DeviceHandle);
         DeviceData -> IsOpen = false;
     }
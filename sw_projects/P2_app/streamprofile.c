@@ -0,0 +1,886 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// streamprofile.c:
+//
+// per-board streaming profile: DMA sizes, poll intervals and thread affinities
+// loaded from a file at startup; can be generated by a tuning run
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "../common/saturntypes.h"
+#include "../common/saturnregisters.h"
+#include "../common/saturndrivers.h"
+#include "streamprofile.h"
+
+
+//
+// profile in use. Defaults are the old compiled-in values
+//
+TStreamProfile GStreamProfile =
+{
+    4096,                               // DDC min DMA size
+    32768,                              // DDC max DMA size
+    500,                                // DDC poll
+    500,                                // DUC poll
+    1000,                               // mic poll
+    5000,                               // wideband loop
+    200,                                // wideband packet gap
+    -1, -1, -1, -1                      // no thread affinity
+};
+
+
+//
+// table of profile file keys
+//
+typedef struct
+{
+    char* Key;
+    void* Value;
+    bool IsSigned;
+} TProfileKey;
+
+static TProfileKey ProfileKeys[] =
+{
+    {"ddc_min_dma", &GStreamProfile.DDCMinDMASize, false},
+    {"ddc_max_dma", &GStreamProfile.DDCMaxDMASize, false},
+    {"ddc_poll_us", &GStreamProfile.DDCPollUs, false},
+    {"duc_poll_us", &GStreamProfile.DUCPollUs, false},
+    {"mic_poll_us", &GStreamProfile.MicPollUs, false},
+    {"wb_poll_us", &GStreamProfile.WBPollUs, false},
+    {"wb_packet_gap_us", &GStreamProfile.WBPacketGapUs, false},
+    {"ddc_cpu", &GStreamProfile.DDCCpu, true},
+    {"duc_cpu", &GStreamProfile.DUCCpu, true},
+    {"mic_cpu", &GStreamProfile.MicCpu, true},
+    {"wb_cpu", &GStreamProfile.WBCpu, true}
+};
+#define VNUMPROFILEKEYS (sizeof(ProfileKeys) / sizeof(ProfileKeys[0]))
+
+#define VMINDDCDMA 1024                 // limits for DDC DMA size
+#define VMAXDDCDMA 65536
+
+
+//
+// return true if a power of 2
+//
+static bool IsPowerOf2(uint32_t Value)
+{
+    return (Value != 0) && ((Value & (Value - 1)) == 0);
+}
+
+
+//
+// load profile from file. Settings not in the file keep their default values
+// lines are "key=value"; # starts a comment
+// returns true if the file could not be read
+//
+bool LoadStreamProfile(char* Path)
+{
+    FILE* fp;
+    char Line[120];
+    char* Equals;
+    char* Comment;
+    uint32_t Cntr;
+    uint32_t LineNum = 0;
+    TStreamProfile Saved;
+
+    fp = fopen(Path, "r");
+    if (fp == NULL)
+        return true;
+
+    Saved = GStreamProfile;
+    while (fgets(Line, sizeof(Line), fp) != NULL)
+    {
+        LineNum++;
+        Comment = strchr(Line, '#');
+        if (Comment)
+            *Comment = 0;
+        Equals = strchr(Line, '=');
+        if (Equals == NULL)
+            continue;
+        *Equals = 0;
+        strtok(Line, " \t\r\n");                            // trim key
+        for (Cntr = 0; Cntr < VNUMPROFILEKEYS; Cntr++)
+            if (strcmp(Line, ProfileKeys[Cntr].Key) == 0)
+            {
+                if (ProfileKeys[Cntr].IsSigned)
+                    *(int*)ProfileKeys[Cntr].Value = atoi(Equals + 1);
+                else
+                    *(uint32_t*)ProfileKeys[Cntr].Value = (uint32_t)strtoul(Equals + 1, NULL, 0);
+                break;
+            }
+        if (Cntr == VNUMPROFILEKEYS)
+            printf("stream profile %s line %d: unknown setting %s\n", Path, LineNum, Line);
+    }
+    fclose(fp);
+
+    //
+    // sanity check DMA sizes; revert if not usable
+    //
+    if (!IsPowerOf2(GStreamProfile.DDCMinDMASize) || !IsPowerOf2(GStreamProfile.DDCMaxDMASize)
+        || (GStreamProfile.DDCMinDMASize < VMINDDCDMA) || (GStreamProfile.DDCMaxDMASize > VMAXDDCDMA)
+        || (GStreamProfile.DDCMinDMASize > GStreamProfile.DDCMaxDMASize))
+    {
+        printf("stream profile %s: bad DDC DMA sizes; using defaults\n", Path);
+        GStreamProfile.DDCMinDMASize = Saved.DDCMinDMASize;
+        GStreamProfile.DDCMaxDMASize = Saved.DDCMaxDMASize;
+    }
+    return false;
+}
+
+
+//
+// save the profile in use to file
+// returns true if error
+//
+bool SaveStreamProfile(char* Path)
+{
+    FILE* fp;
+    uint32_t Cntr;
+
+    fp = fopen(Path, "w");
+    if (fp == NULL)
+    {
+        perror("save stream profile");
+        return true;
+    }
+    fprintf(fp, "# p2app streaming profile\n");
+    fprintf(fp, "# generated by p2app -T; cpu = -1 means no affinity set\n");
+    for (Cntr = 0; Cntr < VNUMPROFILEKEYS; Cntr++)
+    {
+        if (ProfileKeys[Cntr].IsSigned)
+            fprintf(fp, "%s=%d\n", ProfileKeys[Cntr].Key, *(int*)ProfileKeys[Cntr].Value);
+        else
+            fprintf(fp, "%s=%u\n", ProfileKeys[Cntr].Key, *(uint32_t*)ProfileKeys[Cntr].Value);
+    }
+    fclose(fp);
+    return false;
+}
+
+
+//
+// print the profile in use
+//
+void PrintStreamProfile(void)
+{
+    printf("stream profile: DDC DMA %d-%d bytes, poll DDC=%dus DUC=%dus mic=%dus WB=%dus, WB gap=%dus\n",
+           GStreamProfile.DDCMinDMASize, GStreamProfile.DDCMaxDMASize, GStreamProfile.DDCPollUs,
+           GStreamProfile.DUCPollUs, GStreamProfile.MicPollUs, GStreamProfile.WBPollUs, GStreamProfile.WBPacketGapUs);
+    printf("stream profile: CPU affinity DDC=%d DUC=%d mic=%d WB=%d\n",
+           GStreamProfile.DDCCpu, GStreamProfile.DUCCpu, GStreamProfile.MicCpu, GStreamProfile.WBCpu);
+}
+
+
+//
+// set the CPU affinity of the calling thread. Cpu < 0 leaves it unchanged.
+//
+void SetStreamThreadAffinity(int Cpu, char* Name)
+{
+    cpu_set_t CpuSet;
+
+    if (Cpu < 0)
+        return;
+    CPU_ZERO(&CpuSet);
+    CPU_SET(Cpu, &CpuSet);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &CpuSet) != 0)
+        printf("could not set %s thread affinity to CPU %d\n", Name, Cpu);
+}
+
+
+//
+// choose a DDC DMA transfer size for the current FIFO depth (in 64 bit words)
+// largest power of 2 within profile limits that the FIFO can supply
+//
+uint32_t GetDDCDMATransferSize(uint32_t Depth)
+{
+    uint32_t Size = GStreamProfile.DDCMaxDMASize;
+
+    while ((Size > GStreamProfile.DDCMinDMASize) && (Depth <= Size / 8U))
+        Size = Size >> 1;
+    return Size;
+}
+
+
+
+//////////////////////////////////////////////////////////////
+//
+// tuning run
+//
+// the DDC path is modelled by a synthetic workload: an emulated FIFO, the size
+// of this firmware's DDC FIFO, fills at the rate of 10 DDCs at 384ksps. The
+// worker thread polls it exactly as OutgoingDDCIQ does, copies each "DMA" block,
+// demultiplexes it into per-DDC buffers and sends 1444 byte packets by UDP to a
+// local sink thread. The sink measures the latency from sample production to
+// packet arrival. The FIFO DMA itself is emulated by a memory copy: reading the
+// real stream FIFOs before the SDR is running would disturb them.
+//
+// the DUC and mic poll intervals are chosen from measured sleep wakeup times
+// so a poll never takes longer than a fraction of one frame period.
+//
+// the wideband loop is modelled as Outwideband.c runs it: a frame is ready a
+// fixed time after the last was taken; the loop polls for it, then sends its
+// packets with a gap between each to a sink that, like a client, reads a small
+// socket buffer every millisecond. The poll time and gap are chosen for the
+// least frame latency and CPU load without packets lost at the sink.
+//
+// finally the DUC, mic and wideband threads are tried on each core while the
+// DDC workload runs on its own, and kept on a core only where they do better
+// and the DDC workload still keeps up.
+//
+//////////////////////////////////////////////////////////////
+
+#define VTUNENUMDDC 10                          // DDCs in synthetic workload
+#define VTUNEWORDRATE 3840000                   // FIFO words per second (10 x 384ksps)
+#define VTUNERUNMS 500                          // length of one trial
+#define VTUNESAMPLESPERFRAME 238                // as OutDDCIQ.c
+#define VTUNEPACKETSIZE 1444
+#define VTUNELATENCYWEIGHT 10.0                 // score: 1ms mean latency counts as 10% CPU
+#define VTUNEMINTHROUGHPUT 0.98                 // fraction of samples that must be delivered
+#define VTUNEPOLLFRACTION 0.75                  // poll wakeup must be within this fraction of a frame
+#define VTUNEDUCFRAMEUS 1250                    // 240 samples at 192ksps
+#define VTUNEMICFRAMEUS 1333                    // 64 samples at 48ksps
+#define VTUNESLEEPSAMPLES 200                   // sleeps timed per poll interval
+#define VTUNEWBFRAMEMS 20                       // wideband frame ready this long after the last was taken
+#define VTUNEWBPACKETS 32                       // packets per wideband frame
+#define VTUNEWBPACKETSIZE 1028                  // 512 samples
+#define VTUNEWBRUNMS 500                        // length of one wideband trial
+#define VTUNEWBCLIENTBUF 8192                   // sink socket receive buffer, bytes
+#define VTUNEWBCLIENTMS 1                       // sink reads its socket this often
+#define VTUNEAFFINITYMS 1500                    // DDC workload run while a core is tried
+
+
+//
+// settings and results for one trial
+//
+typedef struct
+{
+    uint32_t MinDMA;
+    uint32_t MaxDMA;
+    uint32_t PollUs;
+    int Cpu;
+    uint32_t FIFOWords;                         // emulated FIFO capacity
+    uint32_t RunMs;                             // trial length
+    int SinkSocket;                             // destination for packets
+    struct sockaddr_in SinkAddr;
+    uint64_t SamplesProduced;                   // results
+    uint64_t PacketsSent;
+    uint64_t Wakeups;
+    bool Overflow;
+    double CPULoad;                             // fraction of one core
+    double Score;
+} TTuneTrial;
+
+
+//
+// settings and results for one wideband trial
+//
+typedef struct
+{
+    uint32_t PollUs;
+    uint32_t GapUs;
+    int Cpu;
+    int SinkSocket;                             // destination for packets
+    struct sockaddr_in SinkAddr;
+    uint64_t Frames;                            // results
+    uint64_t PacketsSent;
+    uint64_t PacketsLost;
+    double CPULoad;                             // fraction of one core
+    double Score;
+} TTuneWBTrial;
+
+
+//
+// sink thread state
+//
+typedef struct
+{
+    int Socket;
+    volatile bool Stop;
+    uint64_t Packets;
+    uint64_t LatencySumNs;
+    uint64_t LatencyMaxNs;
+} TTuneSink;
+
+
+static uint64_t TuneTimeNs(clockid_t Clock)
+{
+    struct timespec Now;
+
+    clock_gettime(Clock, &Now);
+    return (uint64_t)Now.tv_sec * 1000000000ULL + (uint64_t)Now.tv_nsec;
+}
+
+
+//
+// sink thread: receive packets and measure latency from the timestamp field
+//
+static void* TuneSinkThread(void* arg)
+{
+    TTuneSink* Sink = (TTuneSink*)arg;
+    uint8_t Buffer[VTUNEPACKETSIZE];
+    uint64_t Stamp, Latency;
+    int Size;
+
+    while (!Sink->Stop)
+    {
+        Size = recv(Sink->Socket, Buffer, sizeof(Buffer), 0);
+        if (Size != VTUNEPACKETSIZE)
+            continue;
+        memcpy(&Stamp, Buffer + 4, sizeof(Stamp));
+        Latency = TuneTimeNs(CLOCK_MONOTONIC) - Stamp;
+        Sink->Packets++;
+        Sink->LatencySumNs += Latency;
+        if (Latency > Sink->LatencyMaxNs)
+            Sink->LatencyMaxNs = Latency;
+    }
+    return NULL;
+}
+
+
+//
+// worker thread: one trial of the synthetic DDC workload
+//
+static void* TuneWorkerThread(void* arg)
+{
+    TTuneTrial* Trial = (TTuneTrial*)arg;
+    uint8_t* SrcBuffer;
+    uint8_t* DMABuffer;
+    uint8_t DDCBuffer[VTUNENUMDDC][VTUNEPACKETSIZE];
+    uint32_t DDCFill[VTUNENUMDDC];
+    uint32_t DDCSeq[VTUNENUMDDC];
+    uint64_t StartNs, NowNs, EndNs, StartCpu;
+    uint64_t Produced, Consumed, Depth;
+    uint64_t Position, Stamp;
+    uint32_t Size, Cntr, DDC;
+    uint8_t* SrcPtr;
+
+    SetStreamThreadAffinity(Trial->Cpu, "tuner");
+    SrcBuffer = malloc(VMAXDDCDMA);
+    DMABuffer = malloc(VMAXDDCDMA);
+    if ((SrcBuffer == NULL) || (DMABuffer == NULL))
+    {
+        free(SrcBuffer);
+        free(DMABuffer);
+        Trial->Overflow = true;
+        return NULL;
+    }
+    for (Cntr = 0; Cntr < VMAXDDCDMA; Cntr++)
+        SrcBuffer[Cntr] = (uint8_t)Cntr;
+    memset(DDCFill, 0, sizeof(DDCFill));
+    memset(DDCSeq, 0, sizeof(DDCSeq));
+
+    Consumed = 0;
+    StartNs = TuneTimeNs(CLOCK_MONOTONIC);
+    StartCpu = TuneTimeNs(CLOCK_THREAD_CPUTIME_ID);
+    EndNs = StartNs + Trial->RunMs * 1000000ULL;
+    NowNs = StartNs;
+    while (NowNs < EndNs)
+    {
+        Produced = ((NowNs - StartNs) * VTUNEWORDRATE) / 1000000000ULL;
+        Depth = Produced - Consumed;
+        if (Depth > Trial->FIFOWords)                       // emulated FIFO overflowed: lose data
+        {
+            Trial->Overflow = true;
+            Consumed = Produced - Trial->FIFOWords;
+            Depth = Trial->FIFOWords;
+        }
+        if (Depth < (Trial->MinDMA / 8U))
+        {
+            usleep(Trial->PollUs);
+            Trial->Wakeups++;
+            NowNs = TuneTimeNs(CLOCK_MONOTONIC);
+            continue;
+        }
+        Size = Trial->MaxDMA;
+        while ((Size > Trial->MinDMA) && (Depth <= Size / 8U))
+            Size = Size >> 1;
+        memcpy(DMABuffer, SrcBuffer, Size);                 // "DMA"
+
+        //
+        // demultiplex 48 bits of each word to its DDC; send full packets
+        //
+        SrcPtr = DMABuffer;
+        for (Cntr = 0; Cntr < Size / 8U; Cntr++)
+        {
+            Position = Consumed + Cntr;
+            DDC = Position % VTUNENUMDDC;
+            memcpy(DDCBuffer[DDC] + 16 + DDCFill[DDC], SrcPtr, 6);
+            SrcPtr += 8;
+            DDCFill[DDC] += 6;
+            if (DDCFill[DDC] == VTUNESAMPLESPERFRAME * 6)
+            {
+                Stamp = StartNs + ((Position + 1) * 1000000000ULL) / VTUNEWORDRATE;   // when sample was produced
+                *(uint32_t*)DDCBuffer[DDC] = htonl(DDCSeq[DDC]++);
+                memcpy(DDCBuffer[DDC] + 4, &Stamp, sizeof(Stamp));
+                *(uint16_t*)(DDCBuffer[DDC] + 12) = htons(24);
+                *(uint16_t*)(DDCBuffer[DDC] + 14) = htons(VTUNESAMPLESPERFRAME);
+                sendto(Trial->SinkSocket, DDCBuffer[DDC], VTUNEPACKETSIZE, 0,
+                       (struct sockaddr*)&Trial->SinkAddr, sizeof(struct sockaddr_in));
+                Trial->PacketsSent++;
+                DDCFill[DDC] = 0;
+            }
+        }
+        Consumed += Size / 8U;
+        NowNs = TuneTimeNs(CLOCK_MONOTONIC);
+    }
+    Trial->SamplesProduced = ((NowNs - StartNs) * VTUNEWORDRATE) / 1000000000ULL;
+    Trial->CPULoad = (double)(TuneTimeNs(CLOCK_THREAD_CPUTIME_ID) - StartCpu) / (double)(NowNs - StartNs);
+    free(SrcBuffer);
+    free(DMABuffer);
+    return NULL;
+}
+
+
+//
+// run one trial, with its own sink thread. returns true if error
+//
+static bool RunTuneTrial(TTuneTrial* Trial)
+{
+    TTuneSink Sink;
+    pthread_t SinkThread, WorkerThread;
+    struct timeval Timeout = {0, 10000};
+    socklen_t AddrLength = sizeof(struct sockaddr_in);
+    int BufferSize = 4 * 1024 * 1024;
+    double Delivered, MeanLatencyMs;
+
+    memset(&Sink, 0, sizeof(Sink));
+    Sink.Socket = socket(AF_INET, SOCK_DGRAM, 0);
+    Trial->SinkSocket = socket(AF_INET, SOCK_DGRAM, 0);
+    if ((Sink.Socket < 0) || (Trial->SinkSocket < 0))
+    {
+        perror("tuner socket");
+        return true;
+    }
+    setsockopt(Sink.Socket, SOL_SOCKET, SO_RCVTIMEO, (void*)&Timeout, sizeof(Timeout));
+    setsockopt(Sink.Socket, SOL_SOCKET, SO_RCVBUF, (void*)&BufferSize, sizeof(BufferSize));
+    memset(&Trial->SinkAddr, 0, sizeof(struct sockaddr_in));
+    Trial->SinkAddr.sin_family = AF_INET;
+    Trial->SinkAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    Trial->SinkAddr.sin_port = 0;
+    if ((bind(Sink.Socket, (struct sockaddr*)&Trial->SinkAddr, sizeof(struct sockaddr_in)) < 0)
+        || (getsockname(Sink.Socket, (struct sockaddr*)&Trial->SinkAddr, &AddrLength) < 0))
+    {
+        perror("tuner bind");
+        close(Sink.Socket);
+        close(Trial->SinkSocket);
+        return true;
+    }
+
+    pthread_create(&SinkThread, NULL, TuneSinkThread, &Sink);
+    pthread_create(&WorkerThread, NULL, TuneWorkerThread, Trial);
+    pthread_join(WorkerThread, NULL);
+    usleep(20000);                                          // let the last packets arrive
+    Sink.Stop = true;
+    pthread_join(SinkThread, NULL);
+    close(Sink.Socket);
+    close(Trial->SinkSocket);
+
+    //
+    // score: CPU load plus weighted latency; failed trials get a huge score
+    //
+    Delivered = 0.0;
+    if (Trial->SamplesProduced != 0)
+        Delivered = (double)(Sink.Packets * VTUNESAMPLESPERFRAME) / (double)Trial->SamplesProduced;
+    MeanLatencyMs = 0.0;
+    if (Sink.Packets != 0)
+        MeanLatencyMs = (double)Sink.LatencySumNs / (double)Sink.Packets / 1.0e6;
+    Trial->Score = 100.0 * Trial->CPULoad + VTUNELATENCYWEIGHT * MeanLatencyMs;
+    if (Trial->Overflow || (Delivered < VTUNEMINTHROUGHPUT))
+        Trial->Score += 1.0e6;
+    printf("  DMA %5d-%5d poll %4dus cpu %2d: delivered %5.1f%% CPU %5.1f%% latency mean %5.2fms max %5.2fms wakeups %6llu%s\n",
+           Trial->MinDMA, Trial->MaxDMA, Trial->PollUs, Trial->Cpu, 100.0 * Delivered, 100.0 * Trial->CPULoad,
+           MeanLatencyMs, (double)Sink.LatencyMaxNs / 1.0e6, (unsigned long long)Trial->Wakeups,
+           Trial->Overflow ? " OVERFLOW" : "");
+    return false;
+}
+
+
+//
+// measure the 99th percentile wakeup time of usleep(PollUs), in us
+//
+static uint32_t MeasurePollWakeup(uint32_t PollUs)
+{
+    uint32_t Times[VTUNESLEEPSAMPLES];
+    uint32_t Cntr, Inner, Temp;
+    uint64_t Start;
+
+    for (Cntr = 0; Cntr < VTUNESLEEPSAMPLES; Cntr++)
+    {
+        Start = TuneTimeNs(CLOCK_MONOTONIC);
+        usleep(PollUs);
+        Times[Cntr] = (uint32_t)((TuneTimeNs(CLOCK_MONOTONIC) - Start) / 1000);
+    }
+    for (Cntr = 1; Cntr < VTUNESLEEPSAMPLES; Cntr++)            // insertion sort
+    {
+        Temp = Times[Cntr];
+        for (Inner = Cntr; (Inner > 0) && (Times[Inner - 1] > Temp); Inner--)
+            Times[Inner] = Times[Inner - 1];
+        Times[Inner] = Temp;
+    }
+    return Times[(VTUNESLEEPSAMPLES * 99) / 100];
+}
+
+
+//
+// wideband worker thread: one trial of the synthetic wideband loop
+//
+static void* TuneWBWorkerThread(void* arg)
+{
+    TTuneWBTrial* Trial = (TTuneWBTrial*)arg;
+    uint8_t Packet[VTUNEWBPACKETSIZE];
+    uint64_t StartNs, NowNs, EndNs, StartCpu, ReadyNs;
+    uint32_t Cntr;
+
+    SetStreamThreadAffinity(Trial->Cpu, "tuner");
+    memset(Packet, 0, sizeof(Packet));
+    StartNs = TuneTimeNs(CLOCK_MONOTONIC);
+    StartCpu = TuneTimeNs(CLOCK_THREAD_CPUTIME_ID);
+    EndNs = StartNs + VTUNEWBRUNMS * 1000000ULL;
+    ReadyNs = StartNs + VTUNEWBFRAMEMS * 1000000ULL;
+    NowNs = StartNs;
+    while (NowNs < EndNs)
+    {
+        if (NowNs >= ReadyNs)                               // "data available"
+        {
+            memcpy(Packet + 4, &ReadyNs, sizeof(ReadyNs));
+            ReadyNs = NowNs + VTUNEWBFRAMEMS * 1000000ULL;  // "re-enable record"
+            Trial->Frames++;
+            for (Cntr = 0; Cntr < VTUNEWBPACKETS; Cntr++)
+            {
+                *(uint32_t*)Packet = htonl(Cntr);
+                sendto(Trial->SinkSocket, Packet, VTUNEWBPACKETSIZE, 0,
+                       (struct sockaddr*)&Trial->SinkAddr, sizeof(struct sockaddr_in));
+                Trial->PacketsSent++;
+                usleep(Trial->GapUs);
+            }
+        }
+        usleep(Trial->PollUs);
+        NowNs = TuneTimeNs(CLOCK_MONOTONIC);
+    }
+    Trial->CPULoad = (double)(TuneTimeNs(CLOCK_THREAD_CPUTIME_ID) - StartCpu) / (double)(NowNs - StartNs);
+    return NULL;
+}
+
+
+//
+// wideband sink thread: read whatever is in the socket every VTUNEWBCLIENTMS;
+// latency is from frame ready to its last packet
+//
+static void* TuneWBSinkThread(void* arg)
+{
+    TTuneSink* Sink = (TTuneSink*)arg;
+    uint8_t Buffer[VTUNEWBPACKETSIZE];
+    uint64_t Stamp, Latency;
+
+    while (!Sink->Stop)
+    {
+        while (recv(Sink->Socket, Buffer, sizeof(Buffer), MSG_DONTWAIT) == VTUNEWBPACKETSIZE)
+        {
+            Sink->Packets++;
+            if (ntohl(*(uint32_t*)Buffer) != VTUNEWBPACKETS - 1)
+                continue;
+            memcpy(&Stamp, Buffer + 4, sizeof(Stamp));
+            Latency = TuneTimeNs(CLOCK_MONOTONIC) - Stamp;
+            Sink->LatencySumNs += Latency;
+            if (Latency > Sink->LatencyMaxNs)
+                Sink->LatencyMaxNs = Latency;
+        }
+        usleep(VTUNEWBCLIENTMS * 1000);
+    }
+    return NULL;
+}
+
+
+//
+// run one wideband trial, with its own sink thread. returns true if error
+//
+static bool RunTuneWBTrial(TTuneWBTrial* Trial)
+{
+    TTuneSink Sink;
+    pthread_t SinkThread, WorkerThread;
+    socklen_t AddrLength = sizeof(struct sockaddr_in);
+    int BufferSize = VTUNEWBCLIENTBUF;
+    double MeanLatencyMs;
+
+    memset(&Sink, 0, sizeof(Sink));
+    Sink.Socket = socket(AF_INET, SOCK_DGRAM, 0);
+    Trial->SinkSocket = socket(AF_INET, SOCK_DGRAM, 0);
+    if ((Sink.Socket < 0) || (Trial->SinkSocket < 0))
+    {
+        perror("tuner socket");
+        return true;
+    }
+    setsockopt(Sink.Socket, SOL_SOCKET, SO_RCVBUF, (void*)&BufferSize, sizeof(BufferSize));
+    memset(&Trial->SinkAddr, 0, sizeof(struct sockaddr_in));
+    Trial->SinkAddr.sin_family = AF_INET;
+    Trial->SinkAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((bind(Sink.Socket, (struct sockaddr*)&Trial->SinkAddr, sizeof(struct sockaddr_in)) < 0)
+        || (getsockname(Sink.Socket, (struct sockaddr*)&Trial->SinkAddr, &AddrLength) < 0))
+    {
+        perror("tuner bind");
+        close(Sink.Socket);
+        close(Trial->SinkSocket);
+        return true;
+    }
+
+    pthread_create(&SinkThread, NULL, TuneWBSinkThread, &Sink);
+    pthread_create(&WorkerThread, NULL, TuneWBWorkerThread, Trial);
+    pthread_join(WorkerThread, NULL);
+    usleep(20000);                                          // let the last packets arrive
+    Sink.Stop = true;
+    pthread_join(SinkThread, NULL);
+    close(Sink.Socket);
+    close(Trial->SinkSocket);
+
+    //
+    // score: CPU load plus weighted frame latency; any packet lost fails the trial
+    //
+    Trial->PacketsLost = Trial->PacketsSent - Sink.Packets;
+    MeanLatencyMs = 0.0;
+    if (Trial->Frames != 0)
+        MeanLatencyMs = (double)Sink.LatencySumNs / (double)Trial->Frames / 1.0e6;
+    Trial->Score = 100.0 * Trial->CPULoad + VTUNELATENCYWEIGHT * MeanLatencyMs;
+    if ((Trial->PacketsLost != 0) || (Trial->Frames == 0))
+        Trial->Score += 1.0e6;
+    printf("  WB poll %5dus gap %4dus cpu %2d: frames %3llu, lost %4llu packets, CPU %5.1f%% latency mean %5.2fms max %5.2fms\n",
+           Trial->PollUs, Trial->GapUs, Trial->Cpu, (unsigned long long)Trial->Frames,
+           (unsigned long long)Trial->PacketsLost, 100.0 * Trial->CPULoad, MeanLatencyMs,
+           (double)Sink.LatencyMaxNs / 1.0e6);
+    return false;
+}
+
+
+//
+// a core tried for the DUC, mic and wideband threads, while the DDC workload runs
+//
+typedef struct
+{
+    int Cpu;
+    uint32_t DUCWakeup;                         // 99% poll wakeup, us
+    uint32_t MicWakeup;
+    TTuneWBTrial WB;
+    TTuneTrial Load;                            // the DDC workload meanwhile
+} TTuneAffinity;
+
+
+static void* TuneLoadThread(void* arg)
+{
+    TTuneTrial* Load = (TTuneTrial*)arg;
+
+    if (RunTuneTrial(Load))
+        Load->Score = 1.0e12;
+    return NULL;
+}
+
+
+static void* TuneProbeThread(void* arg)
+{
+    TTuneAffinity* Probe = (TTuneAffinity*)arg;
+
+    SetStreamThreadAffinity(Probe->Cpu, "tuner");
+    Probe->DUCWakeup = MeasurePollWakeup(GStreamProfile.DUCPollUs);
+    Probe->MicWakeup = MeasurePollWakeup(GStreamProfile.MicPollUs);
+    return NULL;
+}
+
+
+//
+// try one core (-1 = none) for the DUC, mic and wideband threads
+// returns true if error
+//
+static bool RunTuneAffinity(TTuneAffinity* Probe, TTuneTrial* DDCSettings)
+{
+    pthread_t LoadThread, ProbeThread;
+
+    Probe->Load = *DDCSettings;
+    Probe->Load.RunMs = VTUNEAFFINITYMS;
+    Probe->Load.SamplesProduced = 0;
+    Probe->Load.PacketsSent = 0;
+    Probe->Load.Wakeups = 0;
+    Probe->Load.Overflow = false;
+    Probe->WB.PollUs = GStreamProfile.WBPollUs;
+    Probe->WB.GapUs = GStreamProfile.WBPacketGapUs;
+    Probe->WB.Cpu = Probe->Cpu;
+    if (pthread_create(&LoadThread, NULL, TuneLoadThread, &Probe->Load) != 0)
+        return true;
+    if (pthread_create(&ProbeThread, NULL, TuneProbeThread, Probe) == 0)
+        pthread_join(ProbeThread, NULL);
+    RunTuneWBTrial(&Probe->WB);
+    pthread_join(LoadThread, NULL);
+    printf("  cpu %2d: DUC poll wakeup %4dus, mic poll wakeup %4dus\n", Probe->Cpu, Probe->DUCWakeup, Probe->MicWakeup);
+    return false;
+}
+
+
+//
+// tuning run: sweep profile parameters against a synthetic workload,
+// measuring throughput, latency and CPU load. The best profile is made
+// current and saved to Path.
+// returns true if error
+//
+bool RunStreamTuner(char* Path)
+{
+    const uint32_t DMASizes[][2] = {{4096, 8192}, {4096, 32768}, {8192, 32768}, {16384, 32768}, {8192, 65536}, {16384, 65536}};
+    const uint32_t PollTimes[] = {100, 250, 500, 1000, 2000};
+    const uint32_t SleepTimes[] = {100, 200, 250, 500, 750, 1000};
+    const uint32_t WBPollTimes[] = {1000, 2000, 5000, 10000};
+    const uint32_t WBGapTimes[] = {0, 50, 100, 200, 500};
+    TTuneTrial Trial, Best;
+    TTuneWBTrial WBTrial, BestWB;
+    TTuneAffinity Probe;
+    uint32_t Size, Poll, Gap, Cntr;
+    uint32_t Wakeup, BestDUCWakeup, BestMicWakeup;
+    int Cpu, NumCpu;
+
+    if (!GFIFOSizesInitialised)                             // emulate this firmware's DDC FIFO
+    {
+        InitialiseFIFOSizes();
+        GFIFOSizesInitialised = true;
+    }
+    printf("stream tuner: synthetic workload of %d DDCs, %d words/s, DDC FIFO %d words\n",
+           VTUNENUMDDC, VTUNEWORDRATE, DMAFIFODepths[eRXDDCDMA]);
+    memset(&Best, 0, sizeof(Best));
+    Best.Score = 1.0e12;
+
+    //
+    // step 1: DMA sizes and poll interval, no affinity
+    //
+    for (Size = 0; Size < sizeof(DMASizes) / sizeof(DMASizes[0]); Size++)
+        for (Poll = 0; Poll < sizeof(PollTimes) / sizeof(PollTimes[0]); Poll++)
+        {
+            memset(&Trial, 0, sizeof(Trial));
+            Trial.MinDMA = DMASizes[Size][0];
+            Trial.MaxDMA = DMASizes[Size][1];
+            Trial.PollUs = PollTimes[Poll];
+            Trial.Cpu = -1;
+            Trial.FIFOWords = DMAFIFODepths[eRXDDCDMA];
+            Trial.RunMs = VTUNERUNMS;
+            if (RunTuneTrial(&Trial))
+                return true;
+            if (Trial.Score < Best.Score)
+                Best = Trial;
+        }
+
+    //
+    // step 2: CPU affinity for the DDC thread with the best settings. Core 0 is left for the system
+    //
+    NumCpu = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    for (Cpu = 1; Cpu < NumCpu; Cpu++)
+    {
+        memset(&Trial, 0, sizeof(Trial));
+        Trial.MinDMA = Best.MinDMA;
+        Trial.MaxDMA = Best.MaxDMA;
+        Trial.PollUs = Best.PollUs;
+        Trial.Cpu = Cpu;
+        Trial.FIFOWords = DMAFIFODepths[eRXDDCDMA];
+        Trial.RunMs = VTUNERUNMS;
+        if (RunTuneTrial(&Trial))
+            return true;
+        if (Trial.Score < Best.Score)
+            Best = Trial;
+    }
+    if (Best.Score >= 1.0e6)
+        printf("stream tuner: no setting sustained the workload; using the best found\n");
+    GStreamProfile.DDCMinDMASize = Best.MinDMA;
+    GStreamProfile.DDCMaxDMASize = Best.MaxDMA;
+    GStreamProfile.DDCPollUs = Best.PollUs;
+    GStreamProfile.DDCCpu = Best.Cpu;
+
+    //
+    // step 3: DUC and mic poll times: longest sleep whose wakeup time is within the frame budget
+    //
+    GStreamProfile.DUCPollUs = SleepTimes[0];
+    GStreamProfile.MicPollUs = SleepTimes[0];
+    for (Cntr = 0; Cntr < sizeof(SleepTimes) / sizeof(SleepTimes[0]); Cntr++)
+    {
+        Wakeup = MeasurePollWakeup(SleepTimes[Cntr]);
+        printf("  sleep %4dus: 99%% wakeup %4dus\n", SleepTimes[Cntr], Wakeup);
+        if (Wakeup <= VTUNEDUCFRAMEUS * VTUNEPOLLFRACTION)
+            GStreamProfile.DUCPollUs = SleepTimes[Cntr];
+        if (Wakeup <= VTUNEMICFRAMEUS * VTUNEPOLLFRACTION)
+            GStreamProfile.MicPollUs = SleepTimes[Cntr];
+    }
+
+    //
+    // step 4: wideband loop poll time and packet gap, no affinity
+    //
+    memset(&BestWB, 0, sizeof(BestWB));
+    BestWB.PollUs = GStreamProfile.WBPollUs;
+    BestWB.GapUs = GStreamProfile.WBPacketGapUs;
+    BestWB.Score = 1.0e12;
+    for (Poll = 0; Poll < sizeof(WBPollTimes) / sizeof(WBPollTimes[0]); Poll++)
+        for (Gap = 0; Gap < sizeof(WBGapTimes) / sizeof(WBGapTimes[0]); Gap++)
+        {
+            memset(&WBTrial, 0, sizeof(WBTrial));
+            WBTrial.PollUs = WBPollTimes[Poll];
+            WBTrial.GapUs = WBGapTimes[Gap];
+            WBTrial.Cpu = -1;
+            if (RunTuneWBTrial(&WBTrial))
+                return true;
+            if (WBTrial.Score < BestWB.Score)
+                BestWB = WBTrial;
+        }
+    if (BestWB.Score >= 1.0e6)
+        printf("stream tuner: no wideband setting avoided packet loss; keeping the wideband defaults\n");
+    else
+    {
+        GStreamProfile.WBPollUs = BestWB.PollUs;
+        GStreamProfile.WBPacketGapUs = BestWB.GapUs;
+    }
+
+    //
+    // step 5: CPU affinity for the DUC, mic and wideband threads. Each core is tried
+    // (first none) while the DDC workload runs with its settings; a thread is moved
+    // to a core only if it does better there and the DDC workload keeps up
+    //
+    BestDUCWakeup = 0xFFFFFFFF;
+    BestMicWakeup = 0xFFFFFFFF;
+    BestWB.Score = 1.0e12;
+    for (Cpu = -1; Cpu < NumCpu; Cpu++)
+    {
+        if (Cpu == 0)                                       // left for the system
+            continue;
+        memset(&Probe, 0, sizeof(Probe));
+        Probe.Cpu = Cpu;
+        if (RunTuneAffinity(&Probe, &Best))
+            return true;
+        if (Probe.Load.Score >= 1.0e6)
+            continue;
+        if (Probe.DUCWakeup < BestDUCWakeup)
+        {
+            BestDUCWakeup = Probe.DUCWakeup;
+            GStreamProfile.DUCCpu = Cpu;
+        }
+        if (Probe.MicWakeup < BestMicWakeup)
+        {
+            BestMicWakeup = Probe.MicWakeup;
+            GStreamProfile.MicCpu = Cpu;
+        }
+        if (Probe.WB.Score < BestWB.Score)
+        {
+            BestWB.Score = Probe.WB.Score;
+            GStreamProfile.WBCpu = Cpu;
+        }
+    }
+
+    PrintStreamProfile();
+    return SaveStreamProfile(Path);
+}
@@ -0,0 +1,93 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// streamprofile.h:
+//
+// per-board streaming profile: DMA sizes, poll intervals and thread affinities
+// loaded from a file at startup; can be generated by a tuning run
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __streamprofile_h
+#define __streamprofile_h
+
+
+#include <stdint.h>
+#include "../common/saturntypes.h"
+
+
+#define VDEFAULTPROFILEFILE "streamprofile.conf"            // default profile, in the working directory
+
+
+//
+// streaming profile
+// the defaults are the values that used to be compiled in
+//
+typedef struct
+{
+    uint32_t DDCMinDMASize;             // smallest DDC DMA read, bytes (power of 2)
+    uint32_t DDCMaxDMASize;             // largest DDC DMA read, bytes (power of 2)
+    uint32_t DDCPollUs;                 // DDC thread wait when FIFO has too little data
+    uint32_t DUCPollUs;                 // DUC thread wait when FIFO has too little space
+    uint32_t MicPollUs;                 // mic thread wait when FIFO has too little data
+    uint32_t WBPollUs;                  // wideband thread loop period
+    uint32_t WBPacketGapUs;             // gap between outgoing wideband packets
+    int DDCCpu;                         // CPU core for DDC thread (-1 = not set)
+    int DUCCpu;                         // CPU core for DUC I/Q thread (-1 = not set)
+    int MicCpu;                         // CPU core for mic thread (-1 = not set)
+    int WBCpu;                          // CPU core for wideband thread (-1 = not set)
+} TStreamProfile;
+
+
+extern TStreamProfile GStreamProfile;   // profile in use
+
+
+//
+// load profile from file. Settings not in the file keep their default values
+// returns true if the file could not be read
+//
+bool LoadStreamProfile(char* Path);
+
+
+//
+// save the profile in use to file
+// returns true if error
+//
+bool SaveStreamProfile(char* Path);
+
+
+//
+// print the profile in use
+//
+void PrintStreamProfile(void);
+
+
+//
+// set the CPU affinity of the calling thread. Cpu < 0 leaves it unchanged.
+//
+void SetStreamThreadAffinity(int Cpu, char* Name);
+
+
+//
+// choose a DDC DMA transfer size for the current FIFO depth (in 64 bit words)
+// largest power of 2 within profile limits that the FIFO can supply
+//
+uint32_t GetDDCDMATransferSize(uint32_t Depth);
+
+
+//
+// tuning run: sweep profile parameters against a synthetic workload,
+// measuring throughput, latency and CPU load. The best profile is made
+// current and saved to Path.
+// returns true if error
+//
+bool RunStreamTuner(char* Path);
+
+
+#endif
@@ -0,0 +1,1388 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// tenant.c:
+//
+// partitioned mode: the DDCs are shared between separate clients (tenants).
+// The primary client uses the standard ports and owns every DDC not given
+// to another tenant; it alone sets the ADCs, TX and the rest of the radio.
+// Each other tenant has its own base port: a listener thread answers
+// discovery, takes general, DDC specific and high priority packets for its
+// own DDCs only, and its DDC I/Q goes from base + 11 + n to its own reply
+// address. Secondary tenants are RX only.
+//
+// all DDCs share one DMA stream and FIFO in hardware, so the budgets are
+// enforced in software, where each tenant's load is created:
+// - sample rate: a tenant's enabled DDCs may not total more than its ksps
+//   budget; DDCs over it are refused (left disabled) in ascending order
+// - CPU: time the DDC I/Q thread spends on a tenant's frames is charged to
+//   it over a VTNWINDOWMS window; once over its share, its frames are shed
+//   until the next window, so the thread keeps up with the FIFO for everyone
+// - network: a token bucket over its DDC I/Q bytes
+// - commands: packets from its client are rate limited, and its DDC settings
+//   change at most every VTNMINCONFIGMS (later packets are coalesced), so a
+//   flood of DDC specific packets cannot keep resetting the DDC rate register
+//
+//////////////////////////////////////////////////////////////
+
+#include "threaddata.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "../common/saturnregisters.h"
+#include "../common/hwaccess.h"
+#include "IncomingDDCSpecific.h"
+#include "InHighPriority.h"
+#include "OutDDCIQ.h"
+#include "netclass.h"
+#include "securestream.h"
+#include "tenant.h"
+
+
+#define VTNDISCOVERYSIZE 60                         // discovery request and reply
+#define VTNPOLLMS 10                                // listener poll timeout
+#define VTNMAXPACKETBURST 50                        // packets a client may send at once
+#define VTNLISTENBUFSIZE 1500
+
+
+//
+// a tenant's listening ports, from its base port
+//
+typedef enum
+{
+    eTNGeneral,                                     // discovery and general packets: base port
+    eTNDDCSpecific,                                 // base + 1
+    eTNHighPriority,                                // base + 3
+    eTNNumListenPorts
+} ETNListenPort;
+
+
+typedef struct
+{
+    // settings
+    uint32_t DDCMask;                               // bit n set if DDC n owned
+    uint16_t BasePort;
+    uint32_t MaxKsps;                               // budgets; 0 = no limit
+    uint32_t CPUPercent;
+    uint32_t MaxMbps;
+    // sockets and session (listener thread)
+    int ListenSockets[eTNNumListenPorts];
+    int DDCSockets[VNUMDDC];
+    struct sockaddr_in ReplyAddr;                   // protected by TNAddrMutex
+    bool ReplyAddressSet;
+    bool RunBit;
+    _Atomic(bool) Active;
+    uint64_t LastPacketMs;
+    double PacketTokens;
+    uint64_t PacketTokenMs;
+    uint8_t Pending[VDDCSPECIFICSIZE];              // DDC specific packet held back
+    bool PendingValid;
+    uint8_t Applied[VDDCSPECIFICSIZE];              // last applied: restored when a session resumes
+    bool AppliedValid;
+    uint64_t LastConfigMs;
+    uint32_t RefusedMask;                           // DDCs last refused for the sample rate budget
+    // DDC I/Q thread budget state
+    struct sockaddr_in RouteAddr;                   // copy of ReplyAddr for this pass
+    uint64_t WindowStartNs;
+    uint64_t WindowCPUNs;
+    double NetTokens;
+    uint64_t NetTokenNs;
+    // statistics
+    uint64_t Frames;
+    uint64_t ShedInactive, ShedCPU, ShedNetwork;
+    uint64_t CPUNs, PeakWindowCPUNs;
+    uint64_t Configs, Coalesced, Refused, DroppedPackets, Sessions;
+} VCACHEALIGNED TTenant;
+
+
+static TTenant TNTenants[VTNMAXTENANTS];
+static uint32_t TNCount = 1;                        // tenant 0 is the primary client
+static bool TNEnabled = false;
+static bool TNPrimarySet = false;                   // primary DDCs given explicitly
+static bool TNBudgetsOn = true;                     // cleared by the check to show the overload
+static int8_t TNOwner[VNUMDDC];
+static uint8_t TNDiscoveryReply[VTNDISCOVERYSIZE];
+static pthread_t TNListeners[VTNMAXTENANTS];
+static bool TNListening[VTNMAXTENANTS];
+static _Atomic(bool) TNStopListeners = false;
+static pthread_mutex_t TNConfigMutex = PTHREAD_MUTEX_INITIALIZER;     // DDC rate register settings
+static pthread_mutex_t TNAddrMutex = PTHREAD_MUTEX_INITIALIZER;       // tenant reply addresses
+static uint64_t TNTimingNs[VNUMDDC];                // DDC I/Q thread: start of the time being charged
+
+
+static uint64_t TNNowNs(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (uint64_t)Now.tv_sec * 1000000000ULL + Now.tv_nsec;
+}
+
+
+static uint64_t TNNowMs(void)
+{
+    return TNNowNs() / 1000000ULL;
+}
+
+
+//
+// clear all settings (back to one primary client owning everything)
+//
+static void ResetTenants(void)
+{
+    uint32_t Tenant, Port, DDC;
+
+    memset(TNTenants, 0, sizeof(TNTenants));
+    for (Tenant = 0; Tenant < VTNMAXTENANTS; Tenant++)
+    {
+        for (Port = 0; Port < eTNNumListenPorts; Port++)
+            TNTenants[Tenant].ListenSockets[Port] = -1;
+        for (DDC = 0; DDC < VNUMDDC; DDC++)
+            TNTenants[Tenant].DDCSockets[DDC] = -1;
+    }
+    TNTenants[0].BasePort = VTNPRIMARYBASEPORT;
+    TNCount = 1;
+    TNEnabled = false;
+    TNPrimarySet = false;
+    TNBudgetsOn = true;
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+        TNOwner[DDC] = 0;
+}
+
+
+//
+// parse a DDC list eg "4-7,9" to a mask
+// returns 0 if not valid
+//
+static uint32_t ParseDDCList(char* List)
+{
+    char Copy[64];
+    char *Token, *Save;
+    unsigned int First, Last, DDC;
+    uint32_t Mask = 0;
+    int Fields;
+
+    strncpy(Copy, List, sizeof(Copy) - 1);
+    Copy[sizeof(Copy) - 1] = 0;
+    for (Token = strtok_r(Copy, ",", &Save); Token != NULL; Token = strtok_r(NULL, ",", &Save))
+    {
+        Fields = sscanf(Token, "%u-%u", &First, &Last);
+        if (Fields == 1)
+            Last = First;
+        else if (Fields != 2)
+            return 0;
+        if ((First > Last) || (Last >= VNUMDDC))
+            return 0;
+        for (DDC = First; DDC <= Last; DDC++)
+            Mask |= (1 << DDC);
+    }
+    return Mask;
+}
+
+
+//
+// add a tenant from a -M setting
+// returns true if not valid
+//
+bool ParseTenantSetting(char* Setting)
+{
+    char List[64];
+    unsigned int Base;
+    unsigned int Ksps = 0, CPU = 0, Mbps = 0;
+    uint32_t Mask, Tenant;
+    TTenant* T;
+    int Fields;
+
+    if (!TNEnabled && (TNCount == 1) && !TNPrimarySet)
+        ResetTenants();
+    Fields = sscanf(Setting, "%63[^:]:%u:%u,%u,%u", List, &Base, &Ksps, &CPU, &Mbps);
+    if (Fields < 2)
+    {
+        printf("tenant: %s not valid: <ddcs>:<base port>[:<ksps>[,<cpu %%>[,<Mbit/s>]]]\n", Setting);
+        return true;
+    }
+    Mask = ParseDDCList(List);
+    if (Mask == 0)
+    {
+        printf("tenant: DDC list %s not valid\n", List);
+        return true;
+    }
+    if (CPU > 100)
+    {
+        printf("tenant: CPU share %u%% not valid\n", CPU);
+        return true;
+    }
+
+    if (Base == VTNPRIMARYBASEPORT)
+    {
+        if (TNPrimarySet)
+        {
+            printf("tenant: primary client's DDCs already set\n");
+            return true;
+        }
+        Tenant = 0;
+        TNPrimarySet = true;
+    }
+    else
+    {
+        if ((Base < VTNPRIMARYBASEPORT + VTNPORTSPAN) || (Base > 65535 - VTNPORTSPAN))
+        {
+            printf("tenant: base port %u not valid\n", Base);
+            return true;
+        }
+        if (TNCount == VTNMAXTENANTS)
+        {
+            printf("tenant: no more than %d tenants\n", VTNMAXTENANTS);
+            return true;
+        }
+        for (Tenant = 1; Tenant < TNCount; Tenant++)
+            if (abs((int)TNTenants[Tenant].BasePort - (int)Base) < VTNPORTSPAN)
+            {
+                printf("tenant: base ports %u and %u must be at least %d apart\n",
+                       TNTenants[Tenant].BasePort, Base, VTNPORTSPAN);
+                return true;
+            }
+        Tenant = TNCount;
+    }
+    for (uint32_t Other = 0; Other < TNCount; Other++)
+        if ((Other != Tenant) && (TNTenants[Other].DDCMask & Mask))
+        {
+            printf("tenant: DDCs %s already given to another tenant\n", List);
+            return true;
+        }
+
+    T = &TNTenants[Tenant];
+    T->DDCMask = Mask;
+    T->BasePort = (uint16_t)Base;
+    T->MaxKsps = Ksps;
+    T->CPUPercent = CPU;
+    T->MaxMbps = Mbps;
+    if (Tenant != 0)
+        TNCount++;
+    TNEnabled = true;
+    return false;
+}
+
+
+//
+// true if partitioned mode is set
+//
+bool TenantsEnabled(void)
+{
+    return TNEnabled;
+}
+
+
+//
+// tenant that owns a DDC: 0 for the primary client; -1 if none
+//
+int TenantOfDDC(uint32_t DDC)
+{
+    if (DDC >= VNUMDDC)
+        return -1;
+    return TNOwner[DDC];
+}
+
+
+//
+// true if DDC I/Q should be streamed: the primary client or any tenant is active
+//
+bool TenantStreamsActive(void)
+{
+    uint32_t Tenant;
+
+    if (SDRActive)
+        return true;
+    if (!TNEnabled)
+        return false;
+    for (Tenant = 1; Tenant < TNCount; Tenant++)
+        if (atomic_load(&TNTenants[Tenant].Active))
+            return true;
+    return false;
+}
+
+
+//
+// disable DDCs over a tenant's sample rate budget, in ascending order.
+// an interleaved pair is refused together. Call with TNConfigMutex held.
+//
+static void ApplyRateBudget(uint32_t Tenant)
+{
+    TTenant* T = &TNTenants[Tenant];
+    uint32_t DDC, Rate, Total = 0;
+    uint32_t Refused = 0;
+
+    if (!TNBudgetsOn || (T->MaxKsps == 0))
+        return;
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+    {
+        if (!(T->DDCMask & (1 << DDC)))
+            continue;
+        Rate = GetP2SampleRate(DDC);
+        if (Rate == 0)
+            continue;
+        if (Total + Rate <= T->MaxKsps)
+        {
+            Total += Rate;
+            continue;
+        }
+        SetP2SampleRate(DDC, false, 0, false);
+        Refused |= (1 << DDC);
+        if ((DDC & 1) && (DDC < 8) && (GetP2SampleRate(DDC - 1) != 0))
+        {
+            Total -= GetP2SampleRate(DDC - 1);                  // its interleave partner
+            SetP2SampleRate(DDC - 1, false, 0, false);
+            Refused |= (1 << (DDC - 1));
+        }
+    }
+    if (Refused != 0)
+        T->Refused++;
+    if (Refused != T->RefusedMask)
+    {
+        if (Refused != 0)
+            printf("tenant %d: DDCs 0x%03x refused, over %u ksps budget\n", Tenant, Refused, T->MaxKsps);
+        T->RefusedMask = Refused;
+    }
+}
+
+
+//
+// apply a DDC specific packet to a tenant's DDCs and write the rate register
+//
+static void ApplyTenantDDCConfig(uint32_t Tenant, uint8_t* Buffer)
+{
+    TTenant* T = &TNTenants[Tenant];
+    bool Changed;
+
+    pthread_mutex_lock(&TNConfigMutex);
+    ApplyDDCSpecificPacket(Buffer, T->DDCMask, (Tenant == 0));
+    ApplyRateBudget(Tenant);
+    Changed = WriteP2DDCRateRegister();
+    pthread_mutex_unlock(&TNConfigMutex);
+    if (Changed)
+        HandlerCheckDDCSettings();
+    if (Buffer != T->Applied)
+        memcpy(T->Applied, Buffer, VDDCSPECIFICSIZE);
+    T->AppliedValid = true;
+    T->LastConfigMs = TNNowMs();
+    T->Configs++;
+}
+
+
+//
+// DDC specific packet from a tenant's client
+// applied now, or held if its settings changed less than VTNMINCONFIGMS ago
+// a later packet replaces one already held
+//
+void TenantDDCSpecificPacket(uint32_t Tenant, uint8_t* Buffer)
+{
+    TTenant* T = &TNTenants[Tenant];
+
+    if (TNBudgetsOn && (TNNowMs() - T->LastConfigMs < VTNMINCONFIGMS))
+    {
+        if (T->PendingValid)
+            T->Coalesced++;
+        memcpy(T->Pending, Buffer, VDDCSPECIFICSIZE);
+        T->PendingValid = true;
+    }
+    else
+    {
+        T->PendingValid = false;
+        ApplyTenantDDCConfig(Tenant, Buffer);
+    }
+}
+
+
+//
+// apply a held DDC specific packet once it is due
+// called by the thread that takes the tenant's DDC specific packets
+//
+void TenantServiceDDCConfig(uint32_t Tenant)
+{
+    TTenant* T = &TNTenants[Tenant];
+
+    if (T->PendingValid && (TNNowMs() - T->LastConfigMs >= VTNMINCONFIGMS))
+    {
+        T->PendingValid = false;
+        ApplyTenantDDCConfig(Tenant, T->Pending);
+    }
+}
+
+
+//
+// make a tenant socket, bound for its class
+// returns -1 if error
+//
+static int MakeTenantSocket(uint16_t Port, ENetClass Class)
+{
+    struct sockaddr_in Addr;
+    struct timeval ReadTimeout;
+    int Socketid;
+    int yes = 1;
+
+    Socketid = socket(AF_INET, SOCK_DGRAM, 0);
+    if (Socketid < 0)
+    {
+        perror("tenant socket");
+        return -1;
+    }
+    setsockopt(Socketid, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    ReadTimeout.tv_sec = 0;
+    ReadTimeout.tv_usec = 1000;
+    setsockopt(Socketid, SOL_SOCKET, SO_RCVTIMEO, &ReadTimeout, sizeof(ReadTimeout));
+    ApplyNetClass(Socketid, Class);
+    memset(&Addr, 0, sizeof(Addr));
+    Addr.sin_family = AF_INET;
+    Addr.sin_addr = GetNetClassAddress(Class);
+    Addr.sin_port = htons(Port);
+    if (bind(Socketid, (struct sockaddr*)&Addr, sizeof(Addr)) < 0)
+    {
+        printf("tenant: bind to port %d failed\n", Port);
+        perror("bind");
+        close(Socketid);
+        return -1;
+    }
+    return Socketid;
+}
+
+
+static void CloseTenantSockets(uint32_t Tenant)
+{
+    TTenant* T = &TNTenants[Tenant];
+    uint32_t Port, DDC;
+
+    for (Port = 0; Port < eTNNumListenPorts; Port++)
+        if (T->ListenSockets[Port] >= 0)
+        {
+            SecureSocketClosed(T->ListenSockets[Port]);
+            close(T->ListenSockets[Port]);
+            T->ListenSockets[Port] = -1;
+        }
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+        if (T->DDCSockets[DDC] >= 0)
+        {
+            SecureSocketClosed(T->DDCSockets[DDC]);
+            close(T->DDCSockets[DDC]);
+            T->DDCSockets[DDC] = -1;
+        }
+}
+
+
+//
+// end a tenant's session: stop its streams and disable its DDCs
+//
+static void EndTenantSession(uint32_t Tenant, char* Reason)
+{
+    TTenant* T = &TNTenants[Tenant];
+    uint32_t DDC;
+    bool Changed;
+
+    atomic_store(&T->Active, false);
+    T->RunBit = false;
+    T->PendingValid = false;
+    pthread_mutex_lock(&TNConfigMutex);
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+        if (T->DDCMask & (1 << DDC))
+            SetP2SampleRate(DDC, false, 0, false);
+    Changed = WriteP2DDCRateRegister();
+    pthread_mutex_unlock(&TNConfigMutex);
+    if (Changed)
+        HandlerCheckDDCSettings();
+    printf("tenant %d: session ended, %s\n", Tenant, Reason);
+}
+
+
+static void StartTenantSession(uint32_t Tenant)
+{
+    TTenant* T = &TNTenants[Tenant];
+
+    T->Sessions++;
+    if (T->AppliedValid && (T->Sessions > 1))                   // resumed: its DDCs were disabled when it ended
+        ApplyTenantDDCConfig(Tenant, T->Applied);
+    atomic_store(&T->Active, true);
+    printf("tenant %d: session started, streaming to %s:%d\n", Tenant,
+           inet_ntoa(T->ReplyAddr.sin_addr), ntohs(T->ReplyAddr.sin_port));
+}
+
+
+//
+// token bucket for packets from a tenant's client
+// returns false if the packet must be dropped
+//
+static bool TakePacketToken(TTenant* T)
+{
+    uint64_t Now = TNNowMs();
+
+    T->PacketTokens += (double)(Now - T->PacketTokenMs) * VTNMAXPACKETRATE / 1000.0;
+    T->PacketTokenMs = Now;
+    if (T->PacketTokens > VTNMAXPACKETBURST)
+        T->PacketTokens = VTNMAXPACKETBURST;
+    if (!TNBudgetsOn)
+        return true;
+    if (T->PacketTokens < 1.0)
+        return false;
+    T->PacketTokens -= 1.0;
+    return true;
+}
+
+
+//
+// handle a packet from a tenant's client
+//
+static void HandleTenantPacket(uint32_t Tenant, uint32_t Port, uint8_t* Buffer, ssize_t Size, struct sockaddr_in* From)
+{
+    TTenant* T = &TNTenants[Tenant];
+    uint8_t Reply[VTNDISCOVERYSIZE];
+    uint32_t DDC;
+    bool Run;
+
+    switch (Port)
+    {
+        case eTNGeneral:
+            if (Size != VTNDISCOVERYSIZE)
+                break;
+            if (Buffer[4] == 2)                                 // discovery
+            {
+                memcpy(Reply, TNDiscoveryReply, sizeof(Reply));
+                Reply[4] = atomic_load(&T->Active) ? 3 : 2;
+                SecureSendTo(T->ListenSockets[eTNGeneral], Reply, sizeof(Reply), From);
+            }
+            else if (Buffer[4] == 0)                            // general packet: sets the reply address
+            {
+                pthread_mutex_lock(&TNAddrMutex);
+                T->ReplyAddr = *From;
+                pthread_mutex_unlock(&TNAddrMutex);
+                T->ReplyAddressSet = true;
+                if (T->RunBit && !atomic_load(&T->Active))
+                    StartTenantSession(Tenant);
+            }
+            break;
+
+        case eTNDDCSpecific:
+            if (Size == VDDCSPECIFICSIZE)
+                TenantDDCSpecificPacket(Tenant, Buffer);
+            break;
+
+        case eTNHighPriority:
+            if (Size != VHIGHPRIOTIYTOSDRSIZE)
+                break;
+            for (DDC = 0; DDC < VNUMDDC; DDC++)                 // its own DDC frequencies only
+                if (T->DDCMask & (1 << DDC))
+                    SetDDCFrequency(DDC, ntohl(*(uint32_t*)(Buffer + DDC * 4 + 9)), true);
+            Run = (Buffer[4] & 1) != 0;
+            T->RunBit = Run;
+            if (Run && T->ReplyAddressSet && !atomic_load(&T->Active))
+                StartTenantSession(Tenant);
+            else if (!Run && atomic_load(&T->Active))
+                EndTenantSession(Tenant, "stopped by client");
+            break;
+    }
+}
+
+
+//
+// listener thread for a tenant's discovery, general, DDC specific and high priority ports
+//
+static void* TenantListener(void* arg)
+{
+    uint32_t Tenant = (uint32_t)(uintptr_t)arg;
+    TTenant* T = &TNTenants[Tenant];
+    struct pollfd Polls[eTNNumListenPorts];
+    uint8_t Buffer[VTNLISTENBUFSIZE];
+    struct sockaddr_in From;
+    struct iovec iovecinst;
+    struct msghdr datagram;
+    ssize_t Size;
+    uint32_t Port;
+
+    for (Port = 0; Port < eTNNumListenPorts; Port++)
+    {
+        Polls[Port].fd = T->ListenSockets[Port];
+        Polls[Port].events = POLLIN;
+    }
+    T->PacketTokens = VTNMAXPACKETBURST;
+    T->PacketTokenMs = TNNowMs();
+    while (!atomic_load(&TNStopListeners))
+    {
+        if (poll(Polls, eTNNumListenPorts, VTNPOLLMS) > 0)
+        {
+            for (Port = 0; Port < eTNNumListenPorts; Port++)
+            {
+                if (!(Polls[Port].revents & POLLIN))
+                    continue;
+                memset(&datagram, 0, sizeof(datagram));
+                iovecinst.iov_base = Buffer;
+                iovecinst.iov_len = sizeof(Buffer);
+                datagram.msg_iov = &iovecinst;
+                datagram.msg_iovlen = 1;
+                datagram.msg_name = &From;
+                datagram.msg_namelen = sizeof(From);
+                Size = SecureRecvMsg(T->ListenSockets[Port], &datagram);
+                if (Size < 0)
+                    continue;
+                if (!TakePacketToken(T))
+                {
+                    T->DroppedPackets++;
+                    continue;
+                }
+                T->LastPacketMs = TNNowMs();
+                HandleTenantPacket(Tenant, Port, Buffer, Size, &From);
+            }
+        }
+        TenantServiceDDCConfig(Tenant);
+        if (atomic_load(&T->Active) && (TNNowMs() - T->LastPacketMs > VTNSESSIONMS))
+            EndTenantSession(Tenant, "client silent");
+    }
+    return NULL;
+}
+
+
+//
+// make the tenants' sockets and start their listener threads
+// returns true if error
+//
+bool InitialiseTenants(uint8_t* DiscoveryReply)
+{
+    uint32_t Tenant, DDC, Others = 0;
+    TTenant* T;
+
+    if (!TNEnabled)
+        return false;
+    for (Tenant = 1; Tenant < TNCount; Tenant++)
+        Others |= TNTenants[Tenant].DDCMask;
+    if (!TNPrimarySet)
+        TNTenants[0].DDCMask = ((1 << VNUMDDC) - 1) & ~Others;
+
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+    {
+        TNOwner[DDC] = -1;
+        for (Tenant = 0; Tenant < TNCount; Tenant++)
+            if (TNTenants[Tenant].DDCMask & (1 << DDC))
+                TNOwner[DDC] = (int8_t)Tenant;
+    }
+    for (DDC = 0; DDC < 8; DDC += 2)                            // interleaved pairs must have one owner
+        if (TNOwner[DDC] != TNOwner[DDC + 1])
+        {
+            printf("tenant: DDCs %d and %d can be interleaved, so must have the same tenant\n", DDC, DDC + 1);
+            return true;
+        }
+
+    memcpy(TNDiscoveryReply, DiscoveryReply, VTNDISCOVERYSIZE);
+    atomic_store(&TNStopListeners, false);
+    for (Tenant = 1; Tenant < TNCount; Tenant++)
+    {
+        T = &TNTenants[Tenant];
+        T->ListenSockets[eTNGeneral] = MakeTenantSocket(T->BasePort, eNetControl);
+        T->ListenSockets[eTNDDCSpecific] = MakeTenantSocket(T->BasePort + VTNDDCSPECIFICOFFSET, eNetControl);
+        T->ListenSockets[eTNHighPriority] = MakeTenantSocket(T->BasePort + VTNHIGHPRIORITYOFFSET, eNetHighPriority);
+        for (DDC = 0; DDC < VNUMDDC; DDC++)
+            if (T->DDCMask & (1 << DDC))
+            {
+                T->DDCSockets[DDC] = MakeTenantSocket(T->BasePort + VTNDDCPORTOFFSET + DDC, eNetDDC);
+                if (T->DDCSockets[DDC] < 0)
+                    return true;
+            }
+        for (uint32_t Port = 0; Port < eTNNumListenPorts; Port++)
+            if (T->ListenSockets[Port] < 0)
+                return true;
+        if (pthread_create(&TNListeners[Tenant], NULL, TenantListener, (void*)(uintptr_t)Tenant) < 0)
+        {
+            perror("pthread_create tenant listener");
+            return true;
+        }
+        TNListening[Tenant] = true;
+    }
+
+    for (Tenant = 0; Tenant < TNCount; Tenant++)
+    {
+        T = &TNTenants[Tenant];
+        printf("tenant %d: base port %d, DDCs 0x%03x, budgets %u ksps, %u%% CPU, %u Mbit/s (0 = no limit)\n",
+               Tenant, T->BasePort, T->DDCMask, T->MaxKsps, T->CPUPercent, T->MaxMbps);
+    }
+    return false;
+}
+
+
+//
+// stop the listener threads and close the tenants' sockets
+//
+static void StopTenants(void)
+{
+    uint32_t Tenant;
+
+    atomic_store(&TNStopListeners, true);
+    for (Tenant = 1; Tenant < TNCount; Tenant++)
+    {
+        if (TNListening[Tenant])
+            pthread_join(TNListeners[Tenant], NULL);
+        TNListening[Tenant] = false;
+        CloseTenantSockets(Tenant);
+    }
+}
+
+
+//
+// DDC I/Q thread: start of a pass through the DDC buffers
+// restart CPU windows, refill network tokens and take the reply addresses
+//
+void TenantBeginPass(void)
+{
+    uint64_t Now;
+    uint32_t Tenant;
+    TTenant* T;
+    double Cap;
+
+    if (!TNEnabled)
+        return;
+    Now = TNNowNs();
+    for (Tenant = 0; Tenant < TNCount; Tenant++)
+    {
+        T = &TNTenants[Tenant];
+        if (Now - T->WindowStartNs >= VTNWINDOWMS * 1000000ULL)
+        {
+            if (T->WindowCPUNs > T->PeakWindowCPUNs)
+                T->PeakWindowCPUNs = T->WindowCPUNs;
+            T->WindowStartNs = Now;
+            T->WindowCPUNs = 0;
+        }
+        if (T->MaxMbps != 0)
+        {
+            Cap = (double)T->MaxMbps * 125.0 * VTNWINDOWMS;        // bytes in one window
+            T->NetTokens += (double)(Now - T->NetTokenNs) * T->MaxMbps / 8000.0;
+            if ((T->NetTokens > Cap) || (T->NetTokenNs == 0))
+                T->NetTokens = Cap;
+            T->NetTokenNs = Now;
+        }
+    }
+    pthread_mutex_lock(&TNAddrMutex);
+    for (Tenant = 1; Tenant < TNCount; Tenant++)
+        TNTenants[Tenant].RouteAddr = TNTenants[Tenant].ReplyAddr;
+    pthread_mutex_unlock(&TNAddrMutex);
+}
+
+
+//
+// the socket to send a DDC's I/Q from, and its destination address
+// returns -1 if the DDC has no tenant
+//
+int TenantDDCRoute(uint32_t DDC, int PrimarySocket, struct sockaddr_in* Addr)
+{
+    int Tenant;
+
+    if (!TNEnabled)
+        return PrimarySocket;
+    Tenant = TNOwner[DDC];
+    if (Tenant < 0)
+        return -1;
+    if (Tenant == 0)
+    {
+        memcpy(Addr, &reply_addr, sizeof(struct sockaddr_in));     // may have changed since the run began
+        return PrimarySocket;
+    }
+    memcpy(Addr, &TNTenants[Tenant].RouteAddr, sizeof(struct sockaddr_in));
+    return TNTenants[Tenant].DDCSockets[DDC];
+}
+
+
+//
+// false if a DDC frame must be dropped
+//
+bool TenantAdmitFrame(uint32_t DDC, uint32_t Bytes)
+{
+    TTenant* T;
+    int Tenant;
+    bool Active;
+
+    if (!TNEnabled)
+        return true;
+    Tenant = TNOwner[DDC];
+    if (Tenant < 0)
+        return false;
+    T = &TNTenants[Tenant];
+    Active = (Tenant == 0) ? SDRActive : atomic_load(&T->Active);
+    if (!Active)
+    {
+        T->ShedInactive++;
+        return false;
+    }
+    if (TNBudgetsOn && (T->CPUPercent != 0)
+        && (T->WindowCPUNs >= (uint64_t)T->CPUPercent * VTNWINDOWMS * 10000ULL))
+    {
+        T->ShedCPU++;
+        return false;
+    }
+    if (TNBudgetsOn && (T->MaxMbps != 0))
+    {
+        if (T->NetTokens < Bytes)
+        {
+            T->ShedNetwork++;
+            return false;
+        }
+        T->NetTokens -= Bytes;
+    }
+    T->Frames++;
+    return true;
+}
+
+
+//
+// DDC I/Q thread time, charged to a DDC's tenant frame by frame so it is
+// shed as soon as it reaches its CPU share
+//
+void TenantStartTiming(uint32_t DDC)
+{
+    if (TNEnabled)
+        TNTimingNs[DDC] = TNNowNs();
+}
+
+
+void TenantChargeTime(uint32_t DDC)
+{
+    uint64_t Now, Ns;
+    int Tenant;
+
+    if (!TNEnabled)
+        return;
+    Now = TNNowNs();
+    Ns = Now - TNTimingNs[DDC];
+    TNTimingNs[DDC] = Now;
+    Tenant = TNOwner[DDC];
+    if (Tenant < 0)
+        return;
+    TNTenants[Tenant].WindowCPUNs += Ns;
+    TNTenants[Tenant].CPUNs += Ns;
+}
+
+
+//
+// print each tenant's use of its budgets, and frames dropped
+//
+void PrintTenantReport(void)
+{
+    uint32_t Tenant;
+    TTenant* T;
+
+    if (!TNEnabled)
+        return;
+    for (Tenant = 0; Tenant < TNCount; Tenant++)
+    {
+        T = &TNTenants[Tenant];
+        printf("tenant %d (port %d): %llu frames sent, %llu sessions; DDC thread time %.1fms, peak %.0f%% of a window\n",
+               Tenant, T->BasePort, (unsigned long long)T->Frames, (unsigned long long)T->Sessions,
+               T->CPUNs / 1.0e6, T->PeakWindowCPUNs / (VTNWINDOWMS * 10000.0));
+        printf("    frames shed: %llu inactive, %llu CPU budget, %llu network budget\n",
+               (unsigned long long)T->ShedInactive, (unsigned long long)T->ShedCPU, (unsigned long long)T->ShedNetwork);
+        printf("    DDC settings: %llu applied, %llu coalesced, %llu over rate budget; %llu packets dropped\n",
+               (unsigned long long)T->Configs, (unsigned long long)T->Coalesced,
+               (unsigned long long)T->Refused, (unsigned long long)T->DroppedPackets);
+    }
+}
+
+
+
+//////////////////////////////////////////////////////////////
+//
+// check: two tenants with scripted loopback clients, and a modelled DDC FIFO
+// consumed through the same calls as the DDC I/Q thread
+//
+//////////////////////////////////////////////////////////////
+
+#define VCHKBASEA 41024                             // tenant 1: DDCs 0-3
+#define VCHKBASEB 42048                             // tenant 2: DDCs 4-9, with budgets
+#define VCHKSETTINGA "0-3:41024"
+#define VCHKSETTINGB "4-9:42048:384,20,40"
+#define VCHKRATE 96                                 // ksps requested for each DDC
+#define VCHKFREQA 0x11111111                        // DDC frequencies (delta phase)
+#define VCHKFREQB 0x22222222
+#define VCHKFIFOSAMPLES (16384 * 8 / 6)             // DDC FIFO capacity
+#define VCHKBFRAMEUS 700                            // modelled cost of each of B's frames
+#define VCHKPASSUS 1000                             // sleep between consumer passes
+#define VCHKKEEPALIVEMS 50
+#define VCHKFLOOD 2000                              // DDC specific packets in B's flood
+#define VCHKBUDGETMS 3000                           // streaming phase lengths
+#define VCHKOVERLOADMS 1000
+#define VCHKSLACKMS 500                             // allowed lateness of session ends
+#define VCHKPRIORITY 10
+#define VCHKRECEIVEBATCH 64                         // datagrams taken by a client between keepalives
+
+
+typedef enum
+{
+    eCCRun,                                         // keepalives
+    eCCFlood,                                       // flood of DDC specific packets, then run
+    eCCSilent,                                      // send nothing
+    eCCStop,                                        // high priority with run clear, then silent
+    eCCExit
+} ECheckCommand;
+
+
+typedef struct
+{
+    uint32_t Tenant;
+    uint16_t BasePort;
+    uint32_t RequestMask;                           // DDCs its DDC specific packets enable
+    uint32_t Frequency;
+    pthread_t Thread;
+    _Atomic(int) Command;
+    _Atomic(bool) Discovered;
+    _Atomic(uint64_t) Packets;                      // DDC I/Q received
+    _Atomic(uint64_t) Gaps;                         // sample index discontinuities
+    _Atomic(uint64_t) Foreign;                      // from a DDC or port not its own
+    _Atomic(uint64_t) FloodMs;                      // time taken to send the flood
+    uint64_t NextIndex[VNUMDDC];
+    bool Seen[VNUMDDC];
+} TCheckClient;
+
+
+typedef struct
+{
+    uint64_t Overflows;                             // not explained by a host stall
+    uint64_t StallOverflows;
+    uint64_t Passes;
+} TCheckStreamResult;
+
+
+static _Atomic(uint32_t) CHKRateWrites;             // changes to the DDC rate register
+static uint32_t CHKLastRateValue;
+
+
+static void TenantCheckHook(uint32_t Address, uint32_t Data)
+{
+    if ((Address == VADDRDDCRATES) && (Data != CHKLastRateValue))
+    {
+        CHKLastRateValue = Data;
+        atomic_fetch_add(&CHKRateWrites, 1);
+    }
+}
+
+
+static void CheckSend(int Socketid, uint16_t Port, uint8_t* Buffer, size_t Length)
+{
+    struct sockaddr_in Addr;
+
+    memset(&Addr, 0, sizeof(Addr));
+    Addr.sin_family = AF_INET;
+    Addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    Addr.sin_port = htons(Port);
+    sendto(Socketid, Buffer, Length, 0, (struct sockaddr*)&Addr, sizeof(Addr));
+}
+
+
+static void CheckSendDDCSpecific(TCheckClient* Client, int Socketid, uint32_t Rate)
+{
+    uint8_t Buffer[VDDCSPECIFICSIZE];
+    uint32_t DDC;
+
+    memset(Buffer, 0, sizeof(Buffer));
+    *(uint16_t*)(Buffer + 7) = (uint16_t)Client->RequestMask;   // low byte first
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+    {
+        *(uint16_t*)(Buffer + DDC * 6 + 18) = htons((uint16_t)Rate);
+        Buffer[DDC * 6 + 22] = 24;
+    }
+    CheckSend(Socketid, Client->BasePort + VTNDDCSPECIFICOFFSET, Buffer, sizeof(Buffer));
+}
+
+
+static void CheckSendHighPriority(TCheckClient* Client, int Socketid, bool Run)
+{
+    uint8_t Buffer[VHIGHPRIOTIYTOSDRSIZE];
+    uint32_t DDC;
+
+    memset(Buffer, 0, sizeof(Buffer));
+    Buffer[4] = Run ? 1 : 0;
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+        *(uint32_t*)(Buffer + DDC * 4 + 9) = htonl(Client->Frequency);
+    CheckSend(Socketid, Client->BasePort + VTNHIGHPRIORITYOFFSET, Buffer, sizeof(Buffer));
+}
+
+
+//
+// take DDC I/Q: check it comes from its own DDC ports, and the sample index continuity
+// returns after a batch, so the client's keepalives are not held up by a steady stream
+//
+static void CheckReceive(TCheckClient* Client, int Socketid)
+{
+    uint8_t Buffer[VTNLISTENBUFSIZE];
+    struct sockaddr_in From;
+    socklen_t FromLength;
+    ssize_t Size;
+    uint32_t DDC;
+    uint64_t Index;
+    uint32_t Count;
+
+    for (Count = 0; Count < VCHKRECEIVEBATCH; Count++)
+    {
+        FromLength = sizeof(From);
+        Size = recvfrom(Socketid, Buffer, sizeof(Buffer), 0, (struct sockaddr*)&From, &FromLength);
+        if (Size < 0)
+            return;
+        if ((Size == VTNDISCOVERYSIZE) && ((Buffer[4] == 2) || (Buffer[4] == 3)))
+        {
+            atomic_store(&Client->Discovered, true);
+            continue;
+        }
+        if (Size != VDDCPACKETSIZE)
+            continue;
+        DDC = Buffer[16];
+        if ((DDC >= VNUMDDC) || (TenantOfDDC(DDC) != (int)Client->Tenant)
+            || (ntohs(From.sin_port) != Client->BasePort + VTNDDCPORTOFFSET + DDC))
+        {
+            atomic_fetch_add(&Client->Foreign, 1);
+            continue;
+        }
+        memcpy(&Index, Buffer + 17, sizeof(Index));
+        if (Client->Seen[DDC] && (Index != Client->NextIndex[DDC]))
+            atomic_fetch_add(&Client->Gaps, 1);
+        Client->Seen[DDC] = true;
+        Client->NextIndex[DDC] = Index + VIQSAMPLESPERFRAME;
+        atomic_fetch_add(&Client->Packets, 1);
+    }
+}
+
+
+//
+// scripted client thread
+//
+static void* CheckClient(void* arg)
+{
+    TCheckClient* Client = (TCheckClient*)arg;
+    uint8_t Discovery[VTNDISCOVERYSIZE];
+    struct sockaddr_in Addr;
+    struct timeval ReadTimeout;
+    uint64_t LastKeepaliveMs = 0, Start;
+    int Socketid, Size = 4 * 1024 * 1024;
+    uint32_t Packet;
+    int Command;
+
+    Socketid = socket(AF_INET, SOCK_DGRAM, 0);
+    ReadTimeout.tv_sec = 0;
+    ReadTimeout.tv_usec = 2000;
+    setsockopt(Socketid, SOL_SOCKET, SO_RCVTIMEO, &ReadTimeout, sizeof(ReadTimeout));
+    setsockopt(Socketid, SOL_SOCKET, SO_RCVBUF, &Size, sizeof(Size));
+    memset(&Addr, 0, sizeof(Addr));
+    Addr.sin_family = AF_INET;
+    Addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(Socketid, (struct sockaddr*)&Addr, sizeof(Addr));
+
+    memset(Discovery, 0, sizeof(Discovery));
+    Discovery[4] = 2;
+    for (Packet = 0; (Packet < 50) && !atomic_load(&Client->Discovered); Packet++)
+    {
+        CheckSend(Socketid, Client->BasePort, Discovery, sizeof(Discovery));
+        CheckReceive(Client, Socketid);
+    }
+    Discovery[4] = 0;                                           // general packet
+    CheckSend(Socketid, Client->BasePort, Discovery, sizeof(Discovery));
+    CheckSendDDCSpecific(Client, Socketid, VCHKRATE);
+    CheckSendHighPriority(Client, Socketid, true);
+
+    while ((Command = atomic_load(&Client->Command)) != eCCExit)
+    {
+        CheckReceive(Client, Socketid);
+        if (Command == eCCFlood)
+        {
+            Start = TNNowMs();
+            for (Packet = 0; Packet < VCHKFLOOD; Packet++)      // alternate rates, ending at the requested one
+                CheckSendDDCSpecific(Client, Socketid, (Packet & 1) ? VCHKRATE : 2 * VCHKRATE);
+            atomic_store(&Client->FloodMs, TNNowMs() - Start);
+            atomic_store(&Client->Command, eCCRun);
+        }
+        else if (Command == eCCStop)
+        {
+            CheckSendHighPriority(Client, Socketid, false);
+            atomic_store(&Client->Command, eCCSilent);
+        }
+        else if ((Command == eCCRun) && (TNNowMs() - LastKeepaliveMs >= VCHKKEEPALIVEMS))
+        {
+            CheckSendHighPriority(Client, Socketid, true);
+            LastKeepaliveMs = TNNowMs();
+        }
+    }
+    close(Socketid);
+    return NULL;
+}
+
+
+static uint64_t CheckThreadCPUNs(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &Now);
+    return (uint64_t)Now.tv_sec * 1000000000ULL + Now.tv_nsec;
+}
+
+
+//
+// consume a modelled DDC FIFO for Ms through the DDC I/Q thread calls
+// samples arrive at the enabled DDCs' rates; if more than the FIFO holds
+// arrive between passes, it overflows and each DDC loses samples. An overflow
+// counts as a host stall if the thread was off the CPU longer than the FIFO
+// lasts, which no budget can prevent.
+//
+static void CheckStream(uint32_t Ms, uint64_t* SampleIndex, double* Fraction, TCheckStreamResult* Result)
+{
+    uint8_t Packet[VDDCPACKETSIZE];
+    struct sockaddr_in DestAddr[VNUMDDC];
+    uint64_t Available[VNUMDDC];
+    uint64_t Arrived[VNUMDDC];
+    uint64_t Start, Now, LastNs, LastCPUNs, CPUNs, Spin, FIFONs;
+    uint64_t Total, Lost, Drop;
+    double Expected;
+    uint32_t DDC, Rate;
+    int Socketid;
+
+    memset(Available, 0, sizeof(Available));
+    memset(Result, 0, sizeof(*Result));
+    memset(Packet, 0, sizeof(Packet));
+    Start = LastNs = TNNowNs();
+    LastCPUNs = CheckThreadCPUNs();
+    while ((Now = TNNowNs()) - Start < Ms * 1000000ULL)
+    {
+        //
+        // samples arrived since the last pass, and FIFO overflow
+        //
+        Total = 0;
+        FIFONs = 0;
+        Rate = GetP2TotalSampleRate();
+        if (Rate != 0)
+            FIFONs = (uint64_t)VCHKFIFOSAMPLES * 1000000ULL / Rate;
+        for (DDC = 0; DDC < VNUMDDC; DDC++)
+        {
+            Expected = (double)GetP2SampleRate(DDC) * (Now - LastNs) / 1.0e6 + Fraction[DDC];
+            Arrived[DDC] = (uint64_t)Expected;
+            Fraction[DDC] = Expected - Arrived[DDC];
+            Total += Arrived[DDC];
+        }
+        CPUNs = CheckThreadCPUNs();
+        if (Total > VCHKFIFOSAMPLES)
+        {
+            if ((Now - LastNs) - (CPUNs - LastCPUNs) > FIFONs)
+                Result->StallOverflows++;
+            else
+                Result->Overflows++;
+            Lost = Total - VCHKFIFOSAMPLES;
+            for (DDC = 0; DDC < VNUMDDC; DDC++)
+            {
+                Drop = Arrived[DDC] * Lost / Total;
+                SampleIndex[DDC] += Drop;                       // samples never seen
+                Arrived[DDC] -= Drop;
+            }
+        }
+        LastNs = Now;
+        LastCPUNs = CPUNs;
+
+        //
+        // the DDC I/Q thread's pass
+        //
+        TenantBeginPass();
+        for (DDC = 0; DDC < VNUMDDC; DDC++)
+        {
+            Available[DDC] += Arrived[DDC];
+            Socketid = TenantDDCRoute(DDC, -1, &DestAddr[DDC]);
+            TenantStartTiming(DDC);
+            while (Available[DDC] >= VIQSAMPLESPERFRAME)
+            {
+                Available[DDC] -= VIQSAMPLESPERFRAME;
+                SampleIndex[DDC] += VIQSAMPLESPERFRAME;
+                if ((Socketid < 0) || !TenantAdmitFrame(DDC, VDDCPACKETSIZE))
+                    continue;
+                Packet[16] = (uint8_t)DDC;
+                Spin = SampleIndex[DDC] - VIQSAMPLESPERFRAME;
+                memcpy(Packet + 17, &Spin, sizeof(Spin));
+                if (TenantOfDDC(DDC) == 2)                      // B's frames are expensive
+                {
+                    Spin = TNNowNs();
+                    while (TNNowNs() - Spin < VCHKBFRAMEUS * 1000ULL)
+                        ;
+                }
+                SecureSendTo(Socketid, Packet, sizeof(Packet), &DestAddr[DDC]);
+                TenantChargeTime(DDC);
+            }
+            TenantChargeTime(DDC);
+        }
+        Result->Passes++;
+        usleep(VCHKPASSUS);
+    }
+}
+
+
+static bool CheckResult(bool Passed, char* Description)
+{
+    printf("  %s: %s\n", Passed ? "pass" : "FAIL", Description);
+    return !Passed;
+}
+
+
+//
+// wait up to Ms for a tenant to become active or inactive
+// returns the time taken, or Ms + 1 if it did not
+//
+static uint64_t CheckWaitActive(uint32_t Tenant, bool Active, uint64_t Ms, uint64_t* SampleIndex, double* Fraction)
+{
+    TCheckStreamResult Result;
+    uint64_t Start = TNNowMs();
+
+    while (TNNowMs() - Start <= Ms)
+    {
+        if (atomic_load(&TNTenants[Tenant].Active) == Active)
+            return TNNowMs() - Start;
+        CheckStream(5, SampleIndex, Fraction, &Result);
+    }
+    return Ms + 1;
+}
+
+
+//
+// check with two scripted loopback clients and a modelled DDC FIFO
+// returns true if the check fails
+//
+bool RunTenantCheck(void)
+{
+    static TCheckClient Clients[2];
+    TCheckClient *A = &Clients[0], *B = &Clients[1];
+    TCheckStreamResult Budgeted, Overloaded, Silent;
+    uint64_t SampleIndex[VNUMDDC];
+    double Fraction[VNUMDDC];
+    uint8_t DiscoveryReply[VTNDISCOVERYSIZE];
+    struct sched_param Priority, SavedPriority;
+    uint64_t APackets, Waited, FloodStartMs;
+    uint32_t RateWrites, AllowedWrites, DDC;
+    int SavedPolicy;
+    bool Failed = false, Ok;
+    char Text[160];
+
+    printf("tenant check: A owns DDCs 0-3 (port %d), B owns DDCs 4-9 (port %d) with budgets %s\n",
+           VCHKBASEA, VCHKBASEB, VCHKSETTINGB);
+    EnableSimulatedRegisters(true);
+    CHKLastRateValue = RegisterRead(VADDRDDCRATES);
+    SetRegisterWriteHook(TenantCheckHook);
+    ResetTenants();
+    if (ParseTenantSetting(VCHKSETTINGA) || ParseTenantSetting(VCHKSETTINGB))
+        return true;
+    memset(DiscoveryReply, 0, sizeof(DiscoveryReply));
+    DiscoveryReply[4] = 2;
+    if (InitialiseTenants(DiscoveryReply))
+    {
+        StopTenants();
+        return true;
+    }
+    memset(SampleIndex, 0, sizeof(SampleIndex));
+    memset(Fraction, 0, sizeof(Fraction));
+
+    //
+    // clients: B asks for all ten DDCs, and sets every DDC frequency
+    //
+    memset(Clients, 0, sizeof(Clients));
+    A->Tenant = 1;
+    A->BasePort = VCHKBASEA;
+    A->RequestMask = 0x00F;
+    A->Frequency = VCHKFREQA;
+    B->Tenant = 2;
+    B->BasePort = VCHKBASEB;
+    B->RequestMask = (1 << VNUMDDC) - 1;
+    B->Frequency = VCHKFREQB;
+    pthread_create(&A->Thread, NULL, CheckClient, A);
+    Waited = CheckWaitActive(1, true, 2000, SampleIndex, Fraction);
+    pthread_create(&B->Thread, NULL, CheckClient, B);
+    Waited += CheckWaitActive(2, true, 2000, SampleIndex, Fraction);
+    Failed |= CheckResult(atomic_load(&A->Discovered) && atomic_load(&B->Discovered), "discovery answered on each tenant's base port");
+    Failed |= CheckResult(atomic_load(&TNTenants[1].Active) && atomic_load(&TNTenants[2].Active), "both sessions started");
+
+    Ok = true;
+    for (DDC = 0; DDC < 8; DDC++)
+        if (GetP2SampleRate(DDC) != VCHKRATE)
+            Ok = false;
+    Ok = Ok && (GetP2SampleRate(8) == 0) && (GetP2SampleRate(9) == 0);
+    Failed |= CheckResult(Ok, "A's DDCs intact; B's DDCs 8 and 9 refused, over its 384 ksps budget");
+    Ok = (RegisterRead(VADDRDDC0REG) == VCHKFREQA) && (RegisterRead(VADDRDDC4REG) == VCHKFREQB);
+    Failed |= CheckResult(Ok, "B's high priority packet sets its own DDC frequencies only");
+
+    //
+    // stream, with B flooding DDC specific packets and over its CPU share,
+    // at real time priority as the DDC I/Q thread would be
+    //
+    pthread_getschedparam(pthread_self(), &SavedPolicy, &SavedPriority);
+    Priority.sched_priority = VCHKPRIORITY;
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &Priority) != 0)
+        printf("  (real time priority not available)\n");
+    atomic_store(&A->Gaps, 0);
+    atomic_store(&A->Packets, 0);
+    atomic_store(&CHKRateWrites, 0);
+    FloodStartMs = TNNowMs();
+    atomic_store(&B->Command, eCCFlood);
+    CheckStream(VCHKBUDGETMS, SampleIndex, Fraction, &Budgeted);
+    RateWrites = atomic_load(&CHKRateWrites);
+    AllowedWrites = (TNNowMs() - FloodStartMs) / VTNMINCONFIGMS + 2;
+    APackets = atomic_load(&A->Packets);
+    printf("  budgets on: %llu passes, %llu overflows, %llu after host stalls; A %llu frames, %llu gaps; B shed %llu for CPU\n",
+           (unsigned long long)Budgeted.Passes, (unsigned long long)Budgeted.Overflows,
+           (unsigned long long)Budgeted.StallOverflows, (unsigned long long)APackets,
+           (unsigned long long)atomic_load(&A->Gaps), (unsigned long long)TNTenants[2].ShedCPU);
+    Failed |= CheckResult(Budgeted.Overflows == 0, "no FIFO overflow with B over its CPU share");
+    Failed |= CheckResult(atomic_load(&A->Gaps) <= 4 * Budgeted.StallOverflows, "A's streams continuous, except after host stalls");
+    Failed |= CheckResult(APackets > 0, "A received I/Q");
+    Failed |= CheckResult(TNTenants[2].ShedCPU > 0, "B's frames shed over its CPU share");
+    snprintf(Text, sizeof(Text), "B's flood of %d DDC specific packets: %u rate register changes (limit %u)",
+             VCHKFLOOD, RateWrites, AllowedWrites);
+    Failed |= CheckResult(RateWrites <= AllowedWrites, Text);
+    Failed |= CheckResult((atomic_load(&A->Foreign) == 0) && (atomic_load(&B->Foreign) == 0),
+                          "each client received only its own DDCs, from its own ports");
+
+    //
+    // without budgets, the same load overflows the FIFO
+    //
+    TNBudgetsOn = false;
+    CheckStream(VCHKOVERLOADMS, SampleIndex, Fraction, &Overloaded);
+    TNBudgetsOn = true;
+    printf("  budgets off: %llu overflows, %llu after host stalls\n",
+           (unsigned long long)Overloaded.Overflows, (unsigned long long)Overloaded.StallOverflows);
+    Failed |= CheckResult(Overloaded.Overflows + Overloaded.StallOverflows > 0, "without budgets, B's load overflows the FIFO");
+
+    //
+    // B goes silent: its session ends and its DDCs are disabled; A continues
+    //
+    atomic_store(&B->Command, eCCSilent);
+    atomic_store(&A->Packets, 0);
+    Waited = CheckWaitActive(2, false, VTNSESSIONMS + 3000, SampleIndex, Fraction);
+    snprintf(Text, sizeof(Text), "B's session ended %llums after it went silent", (unsigned long long)Waited);
+    Failed |= CheckResult(Waited <= VTNSESSIONMS + VTNPOLLMS + VCHKKEEPALIVEMS + VCHKSLACKMS, Text);
+    Failed |= CheckResult((GetP2SampleRate(4) == 0) && (GetP2SampleRate(7) == 0), "B's DDCs disabled");
+    CheckStream(200, SampleIndex, Fraction, &Silent);
+    Failed |= CheckResult((atomic_load(&A->Packets) > 0) && atomic_load(&TNTenants[1].Active), "A still streaming");
+
+    //
+    // A stops with its run bit
+    //
+    atomic_store(&A->Command, eCCStop);
+    Waited = CheckWaitActive(1, false, 2000, SampleIndex, Fraction);
+    Failed |= CheckResult(Waited <= VCHKSLACKMS, "A's session ended by its run bit");
+    pthread_setschedparam(pthread_self(), SavedPolicy, &SavedPriority);
+
+    atomic_store(&A->Command, eCCExit);
+    atomic_store(&B->Command, eCCExit);
+    pthread_join(A->Thread, NULL);
+    pthread_join(B->Thread, NULL);
+    StopTenants();
+    PrintTenantReport();
+    SetRegisterWriteHook(NULL);
+    ResetTenants();
+    printf("tenant check: %s\n", Failed ? "FAILED" : "passed");
+    return Failed;
+}
@@ -0,0 +1,121 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// tenant.h:
+//
+// partitioned mode: the DDCs are shared between separate clients (tenants),
+// each with its own port set, reply address and session, and with DMA, CPU
+// and network budgets so one tenant cannot cause DDC FIFO overflows in
+// another's streams.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __tenant_h
+#define __tenant_h
+
+
+#include <stdint.h>
+#include <netinet/in.h>
+#include "../common/saturntypes.h"
+
+
+#define VTNMAXTENANTS 4                             // the primary client and up to 3 more
+#define VTNPRIMARYBASEPORT 1024                     // the primary client uses the standard ports
+#define VTNDDCSPECIFICOFFSET 1                      // tenant ports, from its base port:
+#define VTNHIGHPRIORITYOFFSET 3                     // as the standard ports from 1024
+#define VTNDDCPORTOFFSET 11                         // DDC n I/Q sent from base + 11 + n
+#define VTNPORTSPAN 32                              // base ports must be this far apart
+#define VTNWINDOWMS 10                              // CPU and network budgets are enforced over this window
+#define VTNMINCONFIGMS 50                           // a tenant's DDC settings change at most this often
+#define VTNMAXPACKETRATE 1000                       // packets/s taken from a tenant's client (not the primary)
+#define VTNSESSIONMS 1000                           // a tenant's session ends when its client is silent this long
+
+
+//
+// add a tenant from a -M setting: <ddcs>:<base port>[:<ksps>[,<cpu %>[,<Mbit/s>]]]
+// <ddcs> is a list of DDCs and ranges, eg 4-7,9. Base port 1024 sets the
+// primary client's DDCs and budgets; otherwise the primary client has all
+// DDCs not given to another tenant.
+// budgets (0 = no limit): total sample rate of its enabled DDCs, share of the
+// DDC I/Q thread's time, and DDC I/Q bandwidth
+// returns true if not valid
+//
+bool ParseTenantSetting(char* Setting);
+
+
+//
+// true if partitioned mode is set
+//
+bool TenantsEnabled(void);
+
+
+//
+// make the tenants' sockets and start their listener threads
+// DiscoveryReply is the 60 byte reply to a discovery packet
+// returns true if error
+//
+bool InitialiseTenants(uint8_t* DiscoveryReply);
+
+
+//
+// tenant that owns a DDC: 0 for the primary client; -1 if none
+// (always 0 when partitioned mode is not set)
+//
+int TenantOfDDC(uint32_t DDC);
+
+
+//
+// true if DDC I/Q should be streamed: the primary client or any tenant is active
+//
+bool TenantStreamsActive(void);
+
+
+//
+// DDC specific packet from a tenant's client: applied to its DDCs only,
+// within its sample rate budget. If its DDC settings changed less than
+// VTNMINCONFIGMS ago, the packet is held and applied by TenantServiceDDCConfig.
+// (tenant 0: the primary client, which also sets the ADC options)
+//
+void TenantDDCSpecificPacket(uint32_t Tenant, uint8_t* Buffer);
+void TenantServiceDDCConfig(uint32_t Tenant);
+
+
+//
+// DDC I/Q thread calls
+// TenantBeginPass: at the start of each pass through the DDC buffers
+// TenantDDCRoute: the socket to send a DDC's I/Q from, and sets Addr to the
+//   owning tenant's reply address (unchanged if partitioned mode is not set)
+// TenantAdmitFrame: false if a frame must be dropped: its tenant is not
+//   active, or is over its CPU or network budget
+// TenantStartTiming: before a DDC's frames; TenantChargeTime: after each
+//   frame, charges the time since to the DDC's tenant
+//
+void TenantBeginPass(void);
+int TenantDDCRoute(uint32_t DDC, int PrimarySocket, struct sockaddr_in* Addr);
+bool TenantAdmitFrame(uint32_t DDC, uint32_t Bytes);
+void TenantStartTiming(uint32_t DDC);
+void TenantChargeTime(uint32_t DDC);
+
+
+//
+// print each tenant's use of its budgets, and frames dropped
+//
+void PrintTenantReport(void);
+
+
+//
+// check with two scripted loopback clients and a modelled DDC FIFO: each
+// gets only its own DDCs and I/Q, one floods commands and overloads the DDC
+// thread, and the other's streams must not overflow
+// returns true if the check fails
+//
+bool RunTenantCheck(void);
+
+
+#endif
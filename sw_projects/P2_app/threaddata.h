@@ -22,6 +22,17 @@
 #include <netinet/in.h>
 #include "../common/saturntypes.h"
 #include <semaphore.h>
+#include <stdatomic.h>
+
+
+//
+// cache line size of the Pi CM4 and CM5 processors.
+// data written by one thread and read by others on different cores is aligned
+// to a cache line, so it doesn't share a line with another thread's data
+// (false sharing makes the line move between cores on every write)
+//
+#define VCACHELINE 64
+#define VCACHEALIGNED __attribute__((aligned(VCACHELINE)))
 
 
 
@@ -55,6 +66,8 @@
 
 //
 // a type to hold data for each incoming or outgoing data thread
+// each occupies its own cache line. Active and Cmdid are written by one thread
+// and read by another, so they are accessed with explicit atomic operations
 //
 struct ThreadSocketData
 {
@@ -62,11 +75,11 @@ struct ThreadSocketData
   int Socketid;                                 // socket to access internet
   uint16_t Portid;                              // port to access
   char *Nameid;                                 // name (for error msg etc)
-  bool Active;                                  // true if thread is active
+  _Atomic(bool) Active;                         // true if thread is active
   struct sockaddr_in addr_cmddata;
-  uint32_t Cmdid;                               // command from app to thread - bits set for each command
+  _Atomic(uint32_t) Cmdid;                      // command from app to thread - bits set for each command
   uint32_t DDCSampleRate;                       // DDC sample rate
-};
+} VCACHEALIGNED;
 
 
 extern struct ThreadSocketData SocketData[];        // data for each thread
@@ -78,7 +91,7 @@ extern bool StartBitReceived;                       // true when "run" bit has b
 extern bool NewMessageReceived;                     // set whenever a message is received
 extern bool ThreadError;                            // set true if a thread reports an error
 extern bool UseDebug;                               // true if debugging enabled
-extern uint8_t GlobalFIFOOverflows;                 // FIFO overflow words
+extern _Atomic(uint8_t) GlobalFIFOOverflows;       // FIFO overflow words (set with atomic_fetch_or)
 extern sem_t MicWBDMAMutex;                         // protect one DMA read channel shared by mic and WB read
 
 
@@ -0,0 +1,778 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// timedcommand.c:
+//
+// timed register commands: a client schedules frequency, MOX, attenuator,
+// filter and drive changes for a future time, and an executor thread applies
+// them on schedule through the saturnregisters setters.
+//
+// the queue is kept sorted by due time. The executor waits on a condition
+// variable until just before the first entry is due, so a newly scheduled
+// earlier entry is not missed; then sleeps with clock_nanosleep, and spins for the
+// last part to avoid the scheduler's wakeup latency. The spin time follows the
+// wakeup latency measured on each sleep (a decaying peak), so it suits the host.
+// sample count times are converted to host time using the latest DDC0
+// sample count reference; that is only as accurate as the DMA transfer timing.
+//
+//////////////////////////////////////////////////////////////
+
+#include "threaddata.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <syscall.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "../common/saturnregisters.h"
+#include "../common/hwaccess.h"
+#include "timedcommand.h"
+#include "securestream.h"
+#include "tenant.h"
+#include "clockcorr.h"
+#include "presets.h"
+#include "liveness.h"
+#include "txplayback.h"
+
+
+#define VTIMEDMARGINNS 2000000LL                    // wake this long before a due time, then sleep to it
+#define VTIMEDSPINNS 200000LL                       // initial spin time before a due time
+#define VTIMEDMINSPINNS 50000LL                     // spin time limits
+#define VTIMEDMAXSPINNS 2000000LL
+#define VTIMEDIDLENS 100000000LL                    // longest wait, so the end of a run is seen
+#define VTIMEDPRIORITY 50                           // SCHED_FIFO priority for the executor, if allowed
+#define VNUMERRORBINS 5                             // error histogram bins
+
+
+//
+// one command, and one scheduled packet
+//
+typedef struct
+{
+    ETimedCmdType Type;
+    uint8_t Index;
+    uint32_t Value;
+} TTimedCommand;
+
+typedef struct
+{
+    int64_t DueNs;                                  // host clock time to apply
+    uint32_t Sequence;
+    uint32_t Count;
+    bool Late;                                      // due time had passed when received
+    int Socketid;                                   // report destination; no report if < 0
+    struct sockaddr_in ReplyAddr;
+    TTimedCommand Commands[VTIMEDCMDSPERPACKET];
+} TTimedEntry;
+
+
+TTimedEntry TimedQueue[VMAXTIMEDENTRIES];           // sorted, earliest first
+uint32_t TimedQueueCount;
+pthread_mutex_t TimedMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t TimedCondition = PTHREAD_COND_INITIALIZER;
+pthread_t TimedCommandThread;
+
+//
+// DDC0 sample count reference
+//
+uint64_t TimedRefSamples;
+int64_t TimedRefNs;
+uint32_t TimedRefRate;                              // ksps; 0 if no reference
+int64_t TimedWakeLatencyNs;                         // decaying peak of clock_nanosleep lateness
+
+//
+// timing statistics
+//
+uint32_t TimedApplied;
+uint32_t TimedLate;
+uint32_t TimedRejected;
+int64_t TimedMaxErrorNs;
+int64_t TimedSumErrorNs;
+uint32_t TimedErrorBins[VNUMERRORBINS];
+char* TimedErrorBinNames[VNUMERRORBINS] = {"<10us", "<100us", "<1ms", "<10ms", ">=10ms"};
+
+
+//
+// host clock time in ns
+//
+static int64_t TimedNowNs(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_REALTIME, &Now);
+    return (int64_t)Now.tv_sec * 1000000000LL + Now.tv_nsec;
+}
+
+
+//
+// convert ns to a timespec
+//
+static void TimedMakeTimespec(int64_t Ns, struct timespec* Time)
+{
+    Time->tv_sec = Ns / 1000000000LL;
+    Time->tv_nsec = Ns % 1000000000LL;
+}
+
+
+//
+// helpers: read and write big endian values
+//
+static uint64_t ReadBE64(uint8_t* Src)
+{
+    uint64_t Value = 0;
+    int Cntr;
+
+    for (Cntr = 0; Cntr < 8; Cntr++)
+        Value = (Value << 8) | Src[Cntr];
+    return Value;
+}
+
+static void WriteBE64(uint8_t* Dest, uint64_t Value)
+{
+    int Cntr;
+
+    for (Cntr = 7; Cntr >= 0; Cntr--)
+    {
+        Dest[Cntr] = (uint8_t)Value;
+        Value >>= 8;
+    }
+}
+
+
+//
+// send an execution report
+//
+static void SendTimedReport(TTimedEntry* Entry, uint8_t Status, int64_t AchievedNs)
+{
+    uint8_t Report[VTIMEDREPORTSIZE];
+    int64_t Error;
+
+    if (Entry->Socketid < 0)
+        return;
+    Error = AchievedNs - Entry->DueNs;
+    if (Error > INT32_MAX)
+        Error = INT32_MAX;
+    if (Error < INT32_MIN)
+        Error = INT32_MIN;
+    memset(Report, 0, sizeof(Report));
+    *(uint32_t*)Report = htonl(Entry->Sequence);
+    Report[4] = VTIMEDREPORTID;
+    Report[5] = Status;
+    WriteBE64(Report + 8, (uint64_t)Entry->DueNs);
+    WriteBE64(Report + 16, (uint64_t)AchievedNs);
+    *(uint32_t*)(Report + 24) = htonl((uint32_t)(int32_t)Error);
+    SecureSendTo(Entry->Socketid, Report, VTIMEDREPORTSIZE, &Entry->ReplyAddr);
+}
+
+
+//
+// apply the commands of one entry through the register setters
+//
+static void ApplyTimedEntry(TTimedEntry* Entry)
+{
+    uint32_t Cntr;
+    TTimedCommand* Cmd;
+    struct timespec Now;
+
+    for (Cntr = 0; Cntr < Entry->Count; Cntr++)
+    {
+        Cmd = Entry->Commands + Cntr;
+        switch (Cmd->Type)
+        {
+            case eTCDDCFrequency:
+                if (TenantOfDDC(Cmd->Index) == 0)              // the primary client's DDCs only
+                    SetDDCFrequency(Cmd->Index, Cmd->Value, true);
+                break;
+
+            case eTCDUCFrequency:
+                SetDUCFrequency(Cmd->Value, true);
+                break;
+
+            //
+            // MOX goes the same way as the high priority packet's bit: refused
+            // while TX is locked out after DUC I/Q stopped, kept while a
+            // preloaded waveform plays, and held in IsTXMode so that loss of
+            // DUC I/Q drops it and the DUC watchdog is armed
+            //
+            case eTCMOX:
+                IsTXMode = TXPlaybackHoldsMOX() || ((Cmd->Value != 0) && LivenessTXAllowed());
+                SetMOX(IsTXMode);
+                break;
+
+            case eTCADCAtten:
+                SetADCAttenuator((Cmd->Index & 1) ? eADC2 : eADC1, Cmd->Value, (Cmd->Index & 0x80) == 0, (Cmd->Index & 0x80) != 0);
+                break;
+
+            case eTCRXFilters:
+                SetAlexRXFilters(Cmd->Index == 0, Cmd->Value);
+                break;
+
+            case eTCTXFilters:
+                SetAlexTXFilters(Cmd->Value);
+                break;
+
+            case eTCDriveLevel:
+                SetTXDriveLevel(Cmd->Value);
+                break;
+
+            case eTCPreset:
+                clock_gettime(CLOCK_MONOTONIC, &Now);           // its latency is the burst only
+                SwitchBandPreset(Cmd->Index, (int64_t)Now.tv_sec * 1000000000LL + Now.tv_nsec, NULL);
+                break;
+
+            default:
+                break;
+        }
+    }
+}
+
+
+//
+// record achieved timing for one entry. Called with mutex held.
+//
+static void RecordTimedError(int64_t ErrorNs)
+{
+    int64_t Magnitude;
+    int Bin;
+
+    Magnitude = (ErrorNs < 0) ? -ErrorNs : ErrorNs;
+    TimedApplied++;
+    TimedSumErrorNs += Magnitude;
+    if (Magnitude > TimedMaxErrorNs)
+        TimedMaxErrorNs = Magnitude;
+    if (Magnitude < 10000)
+        Bin = 0;
+    else if (Magnitude < 100000)
+        Bin = 1;
+    else if (Magnitude < 1000000)
+        Bin = 2;
+    else if (Magnitude < 10000000)
+        Bin = 3;
+    else
+        Bin = 4;
+    TimedErrorBins[Bin]++;
+}
+
+
+//
+// clear statistics and discard scheduled commands. Called with mutex held.
+//
+static void ResetTimedCommands(void)
+{
+    TimedQueueCount = 0;
+    TimedApplied = 0;
+    TimedLate = 0;
+    TimedRejected = 0;
+    TimedMaxErrorNs = 0;
+    TimedSumErrorNs = 0;
+    TimedRefRate = 0;
+    memset(TimedErrorBins, 0, sizeof(TimedErrorBins));
+}
+
+
+//
+// print achieved-versus-requested timing for the commands applied so far
+//
+void PrintTimedCommandReport(void)
+{
+    int Bin;
+
+    pthread_mutex_lock(&TimedMutex);
+    if ((TimedApplied != 0) || (TimedRejected != 0))
+    {
+        printf("timed commands: %d applied (%d received late), %d rejected\n", TimedApplied, TimedLate, TimedRejected);
+        if (TimedApplied > TimedLate)
+        {
+            printf("  timing error: mean %.1fus, max %.1fus;", (double)TimedSumErrorNs / (TimedApplied - TimedLate) / 1000.0,
+                   (double)TimedMaxErrorNs / 1000.0);
+            for (Bin = 0; Bin < VNUMERRORBINS; Bin++)
+                printf(" %s:%d", TimedErrorBinNames[Bin], TimedErrorBins[Bin]);
+            printf("\n");
+        }
+    }
+    pthread_mutex_unlock(&TimedMutex);
+}
+
+
+//
+// executor thread
+// applies each entry at its due time; at the end of a run, prints the report and
+// discards anything still scheduled
+//
+static void* TimedCommandExecutor(__attribute__((unused)) void *arg)
+{
+    TTimedEntry Entry;
+    struct timespec WakeTime;
+    struct sched_param Priority;
+    int64_t Now, Wake, AchievedNs, SpinNs;
+    bool WasActive = false;
+
+    printf("spinning up timed command thread, pid=%ld\n", syscall(SYS_gettid));
+    TimedWakeLatencyNs = VTIMEDSPINNS - VTIMEDMINSPINNS;
+    Priority.sched_priority = VTIMEDPRIORITY;
+    if ((pthread_setschedparam(pthread_self(), SCHED_FIFO, &Priority) != 0) && UseDebug)
+        printf("timed commands: real time priority not available\n");
+    pthread_mutex_lock(&TimedMutex);
+    while (true)
+    {
+        Now = TimedNowNs();
+        Wake = Now + VTIMEDIDLENS;
+        if ((TimedQueueCount != 0) && (TimedQueue[0].DueNs - VTIMEDMARGINNS < Wake))
+            Wake = TimedQueue[0].DueNs - VTIMEDMARGINNS;
+        if (Wake > Now)
+        {
+            TimedMakeTimespec(Wake, &WakeTime);
+            pthread_cond_timedwait(&TimedCondition, &TimedMutex, &WakeTime);
+        }
+
+        //
+        // end of run: report, and discard what is left
+        //
+        if (WasActive && !SDRActive)
+        {
+            pthread_mutex_unlock(&TimedMutex);
+            PrintTimedCommandReport();
+            pthread_mutex_lock(&TimedMutex);
+            ResetTimedCommands();
+        }
+        WasActive = SDRActive;
+
+        //
+        // if the first entry is nearly due, take it, sleep to the exact time and apply it
+        //
+        if ((TimedQueueCount != 0) && (TimedQueue[0].DueNs - VTIMEDMARGINNS <= TimedNowNs()))
+        {
+            Entry = TimedQueue[0];
+            TimedQueueCount--;
+            memmove(TimedQueue, TimedQueue + 1, TimedQueueCount * sizeof(TTimedEntry));
+            pthread_mutex_unlock(&TimedMutex);
+
+            SpinNs = TimedWakeLatencyNs + VTIMEDMINSPINNS;
+            if (SpinNs > VTIMEDMAXSPINNS)
+                SpinNs = VTIMEDMAXSPINNS;
+            Wake = Entry.DueNs - SpinNs;
+            TimedMakeTimespec(Wake, &WakeTime);
+            while (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &WakeTime, NULL) == EINTR)
+                ;
+            Now = TimedNowNs();
+            if (Now > Wake)
+            {
+                TimedWakeLatencyNs -= TimedWakeLatencyNs / 16;
+                if (Now - Wake > TimedWakeLatencyNs)
+                    TimedWakeLatencyNs = Now - Wake;
+            }
+            while (TimedNowNs() < Entry.DueNs)
+                ;
+            ApplyTimedEntry(&Entry);
+            AchievedNs = TimedNowNs();
+            SendTimedReport(&Entry, Entry.Late ? 1 : 0, AchievedNs);
+            if (UseDebug)
+                printf("timed command %d applied, error %.1fus\n", Entry.Sequence, (double)(AchievedNs - Entry.DueNs) / 1000.0);
+
+            pthread_mutex_lock(&TimedMutex);
+            if (!Entry.Late)
+                RecordTimedError(AchievedNs - Entry.DueNs);
+            else
+                TimedApplied++;
+        }
+    }
+    return NULL;
+}
+
+
+//
+// start the executor thread
+// returns true if error
+//
+bool InitialiseTimedCommands(void)
+{
+    if (pthread_create(&TimedCommandThread, NULL, TimedCommandExecutor, NULL) < 0)
+    {
+        perror("pthread_create timed commands");
+        return true;
+    }
+    pthread_detach(TimedCommandThread);
+    return false;
+}
+
+
+//
+// update the DDC0 sample count reference used to convert sample times to host time
+// called by the DDC thread after each DMA transfer; SampleRate in ksps
+//
+void SetTimedCommandSampleReference(uint64_t SampleCount, uint32_t SampleRate)
+{
+    int64_t Now = TimedNowNs();
+
+    pthread_mutex_lock(&TimedMutex);
+    TimedRefSamples = SampleCount;
+    TimedRefNs = Now;
+    TimedRefRate = SampleRate;
+    pthread_mutex_unlock(&TimedMutex);
+}
+
+
+//
+// convert a DDC0 sample count time to host clock ns: through the sample clock
+// mapping if there is one, else from the latest DMA reference
+// returns true if there is no reference yet
+//
+bool TimedSampleCountToNs(uint64_t SampleCount, int64_t* Ns)
+{
+    bool Error = false;
+
+    if (!ClockCorrSampleToNs(0, SampleCount, CLOCK_REALTIME, Ns, NULL))
+        return false;
+    pthread_mutex_lock(&TimedMutex);
+    if (TimedRefRate != 0)
+        *Ns = TimedRefNs + ((int64_t)(SampleCount - TimedRefSamples) * 1000000LL) / TimedRefRate;
+    else
+        Error = true;
+    pthread_mutex_unlock(&TimedMutex);
+    return Error;
+}
+
+
+//
+// handle a timed command packet received on port 1024
+// the report is sent back to From on Socketid (no report if Socketid < 0)
+//
+void HandleTimedCommandPacket(uint8_t* Buffer, int Socketid, struct sockaddr_in* From)
+{
+    TTimedEntry Entry;
+    uint64_t Time;
+    uint32_t Cntr, Position;
+    uint8_t* CmdPtr;
+    bool Error = false;
+
+    memset(&Entry, 0, sizeof(Entry));
+    Entry.Sequence = ntohl(*(uint32_t*)Buffer);
+    Entry.Count = Buffer[6];
+    Entry.Socketid = Socketid;
+    if (From != NULL)
+        Entry.ReplyAddr = *From;
+    else
+        Entry.Socketid = -1;
+    Time = ReadBE64(Buffer + 8);
+
+    if ((Entry.Count == 0) || (Entry.Count > VTIMEDCMDSPERPACKET) || (Buffer[5] > eTimeSampleCount))
+        Error = true;
+    for (Cntr = 0; (Cntr < Entry.Count) && !Error; Cntr++)
+    {
+        CmdPtr = Buffer + 16 + 8 * Cntr;
+        Entry.Commands[Cntr].Type = (ETimedCmdType)CmdPtr[0];
+        Entry.Commands[Cntr].Index = CmdPtr[1];
+        Entry.Commands[Cntr].Value = ntohl(*(uint32_t*)(CmdPtr + 4));
+        if ((CmdPtr[0] == eTCNone) || (CmdPtr[0] >= eTCNumTypes)
+            || ((CmdPtr[0] == eTCDDCFrequency) && (CmdPtr[1] >= VNUMDDC))
+            || ((CmdPtr[0] == eTCPreset) && (CmdPtr[1] >= VPRMAXPRESETS)))
+            Error = true;
+    }
+
+    //
+    // find the host clock due time: a sample count goes through the sample
+    // clock mapping, so the ADC clock's drift from nominal is allowed for
+    //
+    if (Buffer[5] == eTimeHostClock)
+        Entry.DueNs = (int64_t)Time;
+    else if (!Error)
+        Error = TimedSampleCountToNs(Time, &Entry.DueNs);
+
+    pthread_mutex_lock(&TimedMutex);
+    if (Buffer[7] & 1)
+        TimedQueueCount = 0;
+    if ((TimedQueueCount >= VMAXTIMEDENTRIES) || Error)
+    {
+        TimedRejected++;
+        pthread_mutex_unlock(&TimedMutex);
+        if (UseDebug)
+            printf("timed command %d rejected\n", Entry.Sequence);
+        SendTimedReport(&Entry, 2, TimedNowNs());
+        return;
+    }
+    if (Entry.DueNs <= TimedNowNs())
+    {
+        Entry.Late = true;
+        TimedLate++;
+    }
+
+    //
+    // insert in due time order, after any entry due at the same time
+    //
+    Position = TimedQueueCount;
+    while ((Position > 0) && (TimedQueue[Position - 1].DueNs > Entry.DueNs))
+        Position--;
+    memmove(TimedQueue + Position + 1, TimedQueue + Position, (TimedQueueCount - Position) * sizeof(TTimedEntry));
+    TimedQueue[Position] = Entry;
+    TimedQueueCount++;
+    if (Position == 0)
+        pthread_cond_signal(&TimedCondition);
+    pthread_mutex_unlock(&TimedMutex);
+}
+
+
+
+//
+// offline check with the simulated register backend
+//
+#define VTIMEDPACKETSIZE 60
+#define VCHECKENTRIES 60                            // packets scheduled
+#define VCHECKSTARTNS 200000000LL                   // first packet this far ahead
+#define VCHECKSPACINGNS 15000000LL                  // mean spacing between packets
+#define VCHECKMAXERRORNS 1000000LL                  // largest allowed 95th percentile error
+#define VCHECKMAXWRITES 1024
+#define VCHECKRATE 192                              // simulated DDC0 sample rate, ksps
+#define VCHECKDRIFTPPM 100.0                        // simulated ADC clock drift (slow)
+#define VCHECKDRIFTDMAS 300                         // simulated DMAs, 10ms apart, to estimate it
+#define VCHECKDRIFTSPANS 10                         // seconds between the two packets scheduled
+#define VCHECKDRIFTERRORNS 20000LL                  // largest allowed error in their spacing
+
+//
+// register write log, filled by the write hook
+//
+uint32_t CheckWriteData[VCHECKMAXWRITES];
+int64_t CheckWriteNs[VCHECKMAXWRITES];
+uint32_t CheckWriteCount;
+
+static int CompareErrors(const void* A, const void* B)
+{
+    int64_t Diff = *(const int64_t*)A - *(const int64_t*)B;
+    return (Diff > 0) - (Diff < 0);
+}
+
+static void CheckWriteHook(__attribute__((unused)) uint32_t Address, uint32_t Data)
+{
+    if (CheckWriteCount < VCHECKMAXWRITES)
+    {
+        CheckWriteData[CheckWriteCount] = Data;
+        CheckWriteNs[CheckWriteCount++] = TimedNowNs();
+    }
+}
+
+
+//
+// sample count due times follow the sample clock mapping: with an ADC clock
+// VCHECKDRIFTPPM slow, two packets VCHECKDRIFTSPANS seconds of samples apart
+// must be due that much further apart in host time than at the nominal rate.
+// the executor isn't running, so the packets stay queued to be read.
+// returns true if the check fails
+//
+static bool CheckSampleClockDrift(void)
+{
+    uint8_t Packet[VTIMEDPACKETSIZE];
+    uint64_t Samples[VNUMDDC];
+    uint32_t Rates[VNUMDDC];
+    uint64_t Time;
+    int64_t HostBaseNs, Due[2], Spacing, Expected;
+    struct timespec Now;
+    uint32_t DMA, Cntr;
+    bool Fail;
+
+    memset(Samples, 0, sizeof(Samples));
+    memset(Rates, 0, sizeof(Rates));
+    Rates[0] = VCHECKRATE;
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    HostBaseNs = (int64_t)Now.tv_sec * 1000000000LL + Now.tv_nsec - VCHECKDRIFTDMAS * 10000000LL;
+    ClockCorrRestart();
+    for (DMA = 0; DMA < VCHECKDRIFTDMAS; DMA++)
+    {
+        Samples[0] = (uint64_t)DMA * VCHECKRATE * 10;
+        ClockCorrAddDMARates(Samples, Rates, HostBaseNs + (int64_t)(DMA * 10000000.0 * (1.0 + VCHECKDRIFTPPM * 1e-6)));
+    }
+    SetTimedCommandSampleReference(Samples[0], VCHECKRATE);
+
+    pthread_mutex_lock(&TimedMutex);
+    ResetTimedCommands();
+    pthread_mutex_unlock(&TimedMutex);
+    for (Cntr = 0; Cntr < 2; Cntr++)
+    {
+        memset(Packet, 0, sizeof(Packet));
+        *(uint32_t*)Packet = htonl(Cntr);
+        Packet[4] = VTIMEDCMDPACKETID;
+        Packet[5] = eTimeSampleCount;
+        Packet[6] = 1;
+        Time = Samples[0] + (1 + Cntr * VCHECKDRIFTSPANS) * VCHECKRATE * 1000ULL;
+        WriteBE64(Packet + 8, Time);
+        Packet[16] = eTCDDCFrequency;
+        *(uint32_t*)(Packet + 20) = htonl(0x10000000);
+        HandleTimedCommandPacket(Packet, -1, NULL);
+    }
+    pthread_mutex_lock(&TimedMutex);
+    Fail = (TimedQueueCount != 2);
+    Due[0] = TimedQueue[0].DueNs;
+    Due[1] = TimedQueue[1].DueNs;
+    ResetTimedCommands();
+    pthread_mutex_unlock(&TimedMutex);
+
+    Spacing = Due[1] - Due[0];
+    Expected = (int64_t)(VCHECKDRIFTSPANS * 1e9 * (1.0 + VCHECKDRIFTPPM * 1e-6));
+    Fail |= (llabs(Spacing - Expected) > VCHECKDRIFTERRORNS);
+    printf("sample clock %.0fppm slow: packets %ds of samples apart due %.3fms later than at the nominal rate (expected %.3fms)\n",
+           VCHECKDRIFTPPM, VCHECKDRIFTSPANS, (double)(Spacing - VCHECKDRIFTSPANS * 1000000000LL) / 1e6,
+           (double)(Expected - VCHECKDRIFTSPANS * 1000000000LL) / 1e6);
+
+    //
+    // start the mapping afresh, so the rest of the check uses the DMA reference
+    //
+    ClockCorrRestart();
+    ClockCorrAddDMARates(Samples, Rates, HostBaseNs + VCHECKDRIFTDMAS * 10000000LL);
+    return Fail;
+}
+
+
+//
+// check the executor against the simulated register backend: schedule
+// commands, timestamp the register writes they make, and report the error
+// each packet retunes 1-4 DDCs to unique delta phase values, so its writes can
+// be found in the log; the spread of each packet's writes is also reported.
+// the 95th percentile is judged, not the maximum, so a single preemption of the
+// host does not fail the check; the maximum is still reported.
+// returns true if the check fails
+//
+bool RunTimedCommandCheck(void)
+{
+    uint8_t Packet[VTIMEDPACKETSIZE];
+    int64_t DueNs[VCHECKENTRIES];
+    uint32_t Counts[VCHECKENTRIES];
+    uint32_t FirstWrite[VCHECKENTRIES];
+    uint32_t LastWrite[VCHECKENTRIES];
+    int64_t Errors[VCHECKENTRIES * VTIMEDCMDSPERPACKET];
+    int64_t Start, Time, Error, MaxSpread, First, Last;
+    double SumError = 0.0;
+    uint32_t Entry, Other, Cntr, Write, Found, Missing, OutOfOrder;
+    uint32_t Value;
+    bool Fail;
+
+    printf("timed command check with simulated registers: %d packets\n", VCHECKENTRIES);
+    EnableSimulatedRegisters(true);
+    CheckWriteCount = 0;
+    SetRegisterWriteHook(CheckWriteHook);
+    if (CheckSampleClockDrift())
+    {
+        printf("timed command check: FAIL (sample clock drift not followed)\n");
+        return true;
+    }
+    pthread_mutex_lock(&TimedMutex);
+    ResetTimedCommands();
+    pthread_mutex_unlock(&TimedMutex);
+    if (InitialiseTimedCommands())
+        return true;
+
+    //
+    // schedule packets in a scrambled order; odd ones use sample count time
+    //
+    srand(1);
+    Start = TimedNowNs();
+    SetTimedCommandSampleReference(0, VCHECKRATE);
+    for (Entry = 0; Entry < VCHECKENTRIES; Entry++)
+    {
+        DueNs[Entry] = Start + VCHECKSTARTNS + (int64_t)((Entry * 7) % VCHECKENTRIES) * VCHECKSPACINGNS
+                       + (rand() % 1000) * 1000;
+        Counts[Entry] = 1 + Entry % VTIMEDCMDSPERPACKET;
+        memset(Packet, 0, sizeof(Packet));
+        *(uint32_t*)Packet = htonl(Entry);
+        Packet[4] = VTIMEDCMDPACKETID;
+        Packet[6] = (uint8_t)Counts[Entry];
+        if (Entry & 1)
+        {
+            Packet[5] = eTimeSampleCount;
+            Time = ((DueNs[Entry] - Start) * VCHECKRATE) / 1000000LL;
+            DueNs[Entry] = Start + (Time * 1000000LL) / VCHECKRATE;
+        }
+        else
+        {
+            Packet[5] = eTimeHostClock;
+            Time = DueNs[Entry];
+        }
+        WriteBE64(Packet + 8, (uint64_t)Time);
+        for (Cntr = 0; Cntr < Counts[Entry]; Cntr++)
+        {
+            Packet[16 + 8 * Cntr] = eTCDDCFrequency;
+            Packet[17 + 8 * Cntr] = (uint8_t)Cntr;
+            *(uint32_t*)(Packet + 20 + 8 * Cntr) = htonl(0x10000000 + (Entry << 4) + Cntr);
+        }
+        HandleTimedCommandPacket(Packet, -1, NULL);
+    }
+    while (TimedNowNs() < Start + VCHECKSTARTNS + VCHECKENTRIES * VCHECKSPACINGNS + 100000000LL)
+        usleep(10000);
+
+    //
+    // find each packet's writes in the log
+    //
+    Missing = 0;
+    OutOfOrder = 0;
+    MaxSpread = 0;
+    Found = 0;
+    for (Entry = 0; Entry < VCHECKENTRIES; Entry++)
+    {
+        First = 0;
+        Last = 0;
+        FirstWrite[Entry] = CheckWriteCount;
+        LastWrite[Entry] = 0;
+        for (Cntr = 0; Cntr < Counts[Entry]; Cntr++)
+        {
+            Value = 0x10000000 + (Entry << 4) + Cntr;
+            for (Write = 0; Write < CheckWriteCount; Write++)
+                if (CheckWriteData[Write] == Value)
+                    break;
+            if (Write == CheckWriteCount)
+            {
+                Missing++;
+                continue;
+            }
+            if (Write < FirstWrite[Entry])
+                FirstWrite[Entry] = Write;
+            if (Write > LastWrite[Entry])
+                LastWrite[Entry] = Write;
+            if ((First == 0) || (CheckWriteNs[Write] < First))
+                First = CheckWriteNs[Write];
+            if (CheckWriteNs[Write] > Last)
+                Last = CheckWriteNs[Write];
+            Error = CheckWriteNs[Write] - DueNs[Entry];
+            if (Error < 0)
+                Error = -Error;
+            SumError += (double)Error;
+            Errors[Found++] = Error;
+        }
+        if (Last - First > MaxSpread)
+            MaxSpread = Last - First;
+    }
+
+    //
+    // every write of a packet must come after all writes of packets due before it
+    //
+    for (Entry = 0; Entry < VCHECKENTRIES; Entry++)
+        for (Other = 0; Other < VCHECKENTRIES; Other++)
+            if ((DueNs[Other] < DueNs[Entry]) && (LastWrite[Other] > FirstWrite[Entry]))
+            {
+                OutOfOrder++;
+                break;
+            }
+    PrintTimedCommandReport();
+    printf("register writes: %d found, %d missing, %d out of order\n", Found, Missing, OutOfOrder);
+    if (Found != 0)
+    {
+        qsort(Errors, Found, sizeof(int64_t), CompareErrors);
+        printf("write timing error: mean %.1fus, median %.1fus, 95%% %.1fus, max %.1fus\n", SumError / Found / 1000.0,
+               (double)Errors[Found / 2] / 1000.0, (double)Errors[(Found * 95) / 100] / 1000.0, (double)Errors[Found - 1] / 1000.0);
+        printf("largest spread of writes within a packet %.1fus\n", (double)MaxSpread / 1000.0);
+    }
+    Fail = (Missing != 0) || (OutOfOrder != 0) || (Found == 0) || (Errors[(Found * 95) / 100] > VCHECKMAXERRORNS);
+    printf("timed command check: %s\n", Fail ? "FAIL" : "pass");
+    SetRegisterWriteHook(NULL);
+    EnableSimulatedRegisters(false);
+    return Fail;
+}
@@ -0,0 +1,124 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// timedcommand.h:
+//
+// timed register commands: a client schedules frequency, MOX, attenuator,
+// filter and drive changes for a future time, and an executor thread applies
+// them on schedule through the saturnregisters setters.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __timedcommand_h
+#define __timedcommand_h
+
+
+#include <stdint.h>
+#include <netinet/in.h>
+#include "../common/saturntypes.h"
+
+
+#define VTIMEDCMDPACKETID 0x10                      // command byte of a timed command packet (port 1024)
+#define VTIMEDREPORTID 0x11                         // command byte of the execution report sent back
+#define VTIMEDREPORTSIZE 28                         // bytes in an execution report
+#define VMAXTIMEDENTRIES 64                         // scheduled packets held
+#define VTIMEDCMDSPERPACKET 4                       // commands in one packet, applied together
+
+
+//
+// timed command packet, 60 bytes on port 1024 (all fields big endian):
+// bytes 0-3    sequence number
+// byte 4       0x10
+// byte 5       time base: 0 = host clock (ns since the epoch, CLOCK_REALTIME)
+//                         1 = DDC0 sample number since the start of the run
+// byte 6       number of commands (1-4)
+// byte 7       bit 0: discard any commands already scheduled
+// bytes 8-15   time to apply the commands
+// bytes 16-47  up to 4 commands of 8 bytes: type, index, 2 unused bytes, 32 bit value
+//
+// execution report, 28 bytes, sent to the sender of the packet when the commands
+// have been applied (or at once if rejected):
+// bytes 0-3    sequence number of the timed command packet
+// byte 4       0x11
+// byte 5       status: 0 = applied; 1 = applied, but time had passed when received;
+//                      2 = rejected (bad command, queue full, or no sample reference)
+// bytes 6-7    0
+// bytes 8-15   requested host clock time, ns
+// bytes 16-23  achieved host clock time, ns
+// bytes 24-27  achieved - requested, ns (signed, saturated)
+//
+typedef enum
+{
+    eTimeHostClock,                                 // ns since the epoch
+    eTimeSampleCount                                // DDC0 samples since run start
+} ETimedCmdTimeBase;
+
+
+//
+// commands that can be scheduled
+//
+typedef enum
+{
+    eTCNone,
+    eTCDDCFrequency,                                // index = DDC; value = delta phase
+    eTCDUCFrequency,                                // value = delta phase
+    eTCMOX,                                         // value = 0 or 1; as the high priority MOX bit, which must then agree
+    eTCADCAtten,                                    // index bit 0 = ADC, bit 7 = TX atten; value = dB (0-31)
+    eTCRXFilters,                                   // index 0 = RX1, 1 = RX2; value = Alex filter bits
+    eTCTXFilters,                                   // value = Alex filter bits
+    eTCDriveLevel,                                  // value = drive level (0-255)
+    eTCPreset,                                      // index = band preset to switch to (see presets.h)
+    eTCNumTypes
+} ETimedCmdType;
+
+
+//
+// start the executor thread
+// returns true if error
+//
+bool InitialiseTimedCommands(void);
+
+
+//
+// handle a timed command packet received on port 1024
+// the report is sent back to From on Socketid (no report if Socketid < 0)
+//
+void HandleTimedCommandPacket(uint8_t* Buffer, int Socketid, struct sockaddr_in* From);
+
+
+//
+// update the DDC0 sample count reference used to convert sample times to host time
+// called by the DDC thread after each DMA transfer; SampleRate in ksps
+//
+void SetTimedCommandSampleReference(uint64_t SampleCount, uint32_t SampleRate);
+
+
+//
+// convert a DDC0 sample count time to host clock ns: through the sample clock
+// mapping when there is one, else the latest DMA reference at the nominal rate
+// returns true if there is no reference yet
+//
+bool TimedSampleCountToNs(uint64_t SampleCount, int64_t* Ns);
+
+
+//
+// print achieved-versus-requested timing for the commands applied so far
+//
+void PrintTimedCommandReport(void);
+
+
+//
+// check the executor against the simulated register backend: schedule
+// commands, timestamp the register writes they make, and report the error
+// returns true if the check fails
+//
+bool RunTimedCommandCheck(void);
+
+
+#endif
@@ -0,0 +1,916 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// txplayback.c:
+//
+// preloaded TX waveform playback: a client uploads a complete TX I/Q
+// waveform ahead of time, then arms it to start at a host clock or DDC0
+// sample count time. The DUC thread plays it from memory, with MOX
+// sequencing, so network timing cannot cause DUC underflows.
+//
+// the waveform is uploaded in blocks of 240 samples (one DUC frame); a block
+// map shows which have arrived, so a lost packet is found and sent again.
+// the DUC thread asks TXPlaybackDue() each time round its loop (at least once
+// per ms) and, once due, runs the playback itself so nothing else writes the
+// FIFO: it sleeps to the MOX lead time and sets MOX, sleeps then spins to the
+// start time, then writes frames whenever the FIFO has room. The FIFO is kept
+// full, so the host can be late by most of the FIFO depth (about 7ms) before
+// an underflow. Start error is measured for the first sample: the time its
+// frame was written, plus the time to play out anything ahead of it in the FIFO.
+//
+//////////////////////////////////////////////////////////////
+
+#include "threaddata.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "../common/saturnregisters.h"
+#include "../common/saturndrivers.h"
+#include "../common/hwaccess.h"
+#include "../common/txiqformat.h"
+#include "streamprofile.h"
+#include "watchdog.h"
+#include "liveness.h"
+#include "timedcommand.h"
+#include "txplayback.h"
+#include "securestream.h"
+
+
+#define VPBFRAMEBYTES (VPBBYTESPERSAMPLE * VPBFRAMESAMPLES)
+#define VPBWORDSPERFRAME 180                        // 64 bit FIFO words per frame
+#define VPBWORDNS ((VPBFRAMESAMPLES * 1000000000LL) / (VPBWORDSPERFRAME * VPBSAMPLERATE))    // play out time of a word
+#define VPBMARGINNS 3000000LL                       // start this long before the MOX lead time
+#define VPBSTEPNS 1000000LL                         // longest sleep while waiting, so heartbeats continue
+#define VPBSPINNS 200000LL                          // spin this long before a due time
+#define VPBDRAINNS 50000000LL                       // longest wait for the FIFO to empty after the last frame
+#define VPBPRIORITY 50                              // SCHED_FIFO priority while playing, if allowed
+
+
+//
+// waveform, in standard P2 format, padded with zeros to whole frames
+// the block map and state are protected by the mutex; while playing the
+// waveform is only read, and requests that would change it are refused
+//
+uint8_t* PBWaveform = NULL;
+uint8_t* PBBlockMap = NULL;                         // 1 if block n loaded
+uint32_t PBLength;                                  // samples
+uint32_t PBBlocks;
+uint32_t PBLoadedBlocks;
+ETXPlaybackState PBState = ePBEmpty;
+pthread_mutex_t PBMutex = PTHREAD_MUTEX_INITIALIZER;
+
+//
+// armed playback
+//
+int64_t PBStartNs;                                  // host clock time for the first sample
+int64_t PBLeadNs, PBTailNs;
+bool PBSequenceMOX;
+uint32_t PBArmSequence;                             // end of playback report goes to the arm request sender
+int PBArmSocketid = -1;
+struct sockaddr_in PBArmAddr;
+_Atomic(bool) PBAbortRequested;
+_Atomic(bool) PBMOXHeld;
+
+//
+// latest playback, and totals for the run
+//
+uint32_t PBPlayed;
+uint32_t PBUnderflows;
+int64_t PBStartErrorNs;
+int64_t PBMOXOnNs, PBEndNs;                         // MOX set, and FIFO empty after the last frame
+int64_t PBMaxGapNs;                                 // longest time between FIFO reads
+uint32_t PBStallUnderflows;                         // underflows after a gap longer than the FIFO held
+uint32_t PBPlaybacks;
+uint32_t PBAborted;
+uint32_t PBTotalUnderflows;
+int64_t PBSumErrorNs;
+int64_t PBMaxErrorNs;
+uint32_t PBRejected;
+
+
+//
+// host clock time in ns
+//
+static int64_t PBNowNs(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_REALTIME, &Now);
+    return (int64_t)Now.tv_sec * 1000000000LL + Now.tv_nsec;
+}
+
+
+//
+// helpers: read and write big endian values
+//
+static uint64_t ReadBE64(uint8_t* Src)
+{
+    uint64_t Value = 0;
+    int Cntr;
+
+    for (Cntr = 0; Cntr < 8; Cntr++)
+        Value = (Value << 8) | Src[Cntr];
+    return Value;
+}
+
+static void WriteBE64(uint8_t* Dest, uint64_t Value)
+{
+    int Cntr;
+
+    for (Cntr = 7; Cntr >= 0; Cntr--)
+    {
+        Dest[Cntr] = (uint8_t)Value;
+        Value >>= 8;
+    }
+}
+
+
+//
+// build a report from the current state. Called with mutex held.
+//
+static void MakePBReport(uint8_t* Report, uint32_t Sequence, uint8_t Result)
+{
+    uint32_t FirstMissing;
+    int64_t Error = PBStartErrorNs;
+
+    for (FirstMissing = 0; FirstMissing < PBBlocks; FirstMissing++)
+        if (PBBlockMap[FirstMissing] == 0)
+            break;
+    FirstMissing *= VPBFRAMESAMPLES;
+    if (FirstMissing > PBLength)
+        FirstMissing = PBLength;
+    if (Error > INT32_MAX)
+        Error = INT32_MAX;
+    if (Error < INT32_MIN)
+        Error = INT32_MIN;
+    memset(Report, 0, VPBREPORTSIZE);
+    *(uint32_t*)Report = htonl(Sequence);
+    Report[4] = VPBREPORTID;
+    Report[5] = (uint8_t)PBState;
+    Report[6] = Result;
+    *(uint32_t*)(Report + 8) = htonl(PBLength);
+    *(uint32_t*)(Report + 12) = htonl((PBLoadedBlocks == PBBlocks) ? PBLength : PBLoadedBlocks * VPBFRAMESAMPLES);
+    *(uint32_t*)(Report + 16) = htonl(FirstMissing);
+    *(uint32_t*)(Report + 20) = htonl(PBPlayed);
+    *(uint32_t*)(Report + 24) = htonl(PBUnderflows);
+    *(uint32_t*)(Report + 28) = htonl((uint32_t)(int32_t)Error);
+    WriteBE64(Report + 32, (uint64_t)PBStartNs);
+}
+
+
+//
+// discard the waveform. Called with mutex held.
+//
+static void FreePBWaveform(void)
+{
+    free(PBWaveform);
+    free(PBBlockMap);
+    PBWaveform = NULL;
+    PBBlockMap = NULL;
+    PBLength = 0;
+    PBBlocks = 0;
+    PBLoadedBlocks = 0;
+    PBState = ePBEmpty;
+}
+
+
+//
+// handle a playback packet received on port 1024
+// reports are sent to From on Socketid (no report if Socketid < 0)
+//
+void HandleTXPlaybackPacket(uint8_t* Buffer, uint32_t Size, int Socketid, struct sockaddr_in* From)
+{
+    uint8_t Report[VPBREPORTSIZE];
+    uint32_t Sequence, Length, Offset, Count, Block;
+    uint32_t LeadUs, TailUs;
+    uint64_t Time;
+    int64_t StartNs = 0;
+    bool Rejected = false;
+    uint8_t Request = Buffer[5];
+
+    Sequence = ntohl(*(uint32_t*)Buffer);
+    pthread_mutex_lock(&PBMutex);
+    switch (Request)
+    {
+        //
+        // new waveform: allocate it zeroed, so the last frame is padded
+        //
+        case ePBBegin:
+            Length = ntohl(*(uint32_t*)(Buffer + 8));
+            if ((PBState >= ePBArmed) || (Length == 0) || (Length > VPBMAXSAMPLES))
+            {
+                Rejected = true;
+                break;
+            }
+            FreePBWaveform();
+            PBBlocks = (Length + VPBFRAMESAMPLES - 1) / VPBFRAMESAMPLES;
+            PBWaveform = (uint8_t*)calloc(PBBlocks, VPBFRAMEBYTES);
+            PBBlockMap = (uint8_t*)calloc(PBBlocks, 1);
+            if ((PBWaveform == NULL) || (PBBlockMap == NULL))
+            {
+                printf("TX playback: no memory for %d samples\n", Length);
+                FreePBWaveform();
+                Rejected = true;
+                break;
+            }
+            PBLength = Length;
+            PBState = ePBLoading;
+            break;
+
+        //
+        // one block: a whole frame, or the rest of the waveform for the last one
+        //
+        case ePBData:
+            Offset = ntohl(*(uint32_t*)(Buffer + 8));
+            Count = (Size >= VPBDATAHEADERSIZE) ? (Size - VPBDATAHEADERSIZE) / VPBBYTESPERSAMPLE : 0;
+            if ((PBState != ePBLoading) && (PBState != ePBLoaded))
+                Rejected = true;
+            else if ((Offset % VPBFRAMESAMPLES) != 0 || (Offset >= PBLength)
+                     || ((Size - VPBDATAHEADERSIZE) % VPBBYTESPERSAMPLE) != 0
+                     || (Count != ((PBLength - Offset < VPBFRAMESAMPLES) ? PBLength - Offset : VPBFRAMESAMPLES)))
+                Rejected = true;
+            else
+            {
+                Block = Offset / VPBFRAMESAMPLES;
+                memcpy(PBWaveform + Block * VPBFRAMEBYTES, Buffer + VPBDATAHEADERSIZE, Count * VPBBYTESPERSAMPLE);
+                if (PBBlockMap[Block] == 0)
+                {
+                    PBBlockMap[Block] = 1;
+                    PBLoadedBlocks++;
+                }
+                if (PBLoadedBlocks == PBBlocks)
+                    PBState = ePBLoaded;
+            }
+            break;
+
+        //
+        // arm: find the host clock start time, as timed commands do
+        //
+        case ePBArm:
+            Time = ReadBE64(Buffer + 8);
+            LeadUs = ntohl(*(uint32_t*)(Buffer + 16));
+            TailUs = ntohl(*(uint32_t*)(Buffer + 20));
+            if ((PBState != ePBLoaded) || (Buffer[6] > eTimeSampleCount)
+                || (LeadUs > VPBMAXMOXLEADUS) || (TailUs > VPBMAXMOXLEADUS))
+                Rejected = true;
+            else if (Buffer[6] == eTimeHostClock)
+                StartNs = (int64_t)Time;
+            else if (TimedSampleCountToNs(Time, &StartNs))
+                Rejected = true;
+            if (!Rejected && (StartNs - (int64_t)LeadUs * 1000LL - VPBMARGINNS < PBNowNs()))
+                Rejected = true;                                // too late to start on time
+            if (Rejected)
+                break;
+            PBStartNs = StartNs;
+            PBLeadNs = (int64_t)LeadUs * 1000LL;
+            PBTailNs = (int64_t)TailUs * 1000LL;
+            PBSequenceMOX = (Buffer[7] & 1) != 0;
+            PBArmSequence = Sequence;
+            PBArmSocketid = (From != NULL) ? Socketid : -1;
+            if (From != NULL)
+                PBArmAddr = *From;
+            atomic_store(&PBAbortRequested, false);
+            PBState = ePBArmed;
+            break;
+
+        //
+        // abort: disarm now, or tell the playback to stop (it sends the final report)
+        //
+        case ePBAbort:
+            if (PBState == ePBArmed)
+                PBState = ePBLoaded;
+            else if (PBState == ePBPlaying)
+                atomic_store(&PBAbortRequested, true);
+            break;
+
+        case ePBStatus:
+            break;
+
+        default:
+            Rejected = true;
+            break;
+    }
+    if (Rejected)
+        PBRejected++;
+    if ((Request != ePBData) && (From != NULL) && (Socketid >= 0))
+    {
+        MakePBReport(Report, Sequence, Rejected ? 1 : 0);
+        pthread_mutex_unlock(&PBMutex);
+        SecureSendTo(Socketid, Report, VPBREPORTSIZE, From);
+    }
+    else
+        pthread_mutex_unlock(&PBMutex);
+    if (Rejected && UseDebug)
+        printf("TX playback request %d (sequence %d) rejected\n", Request, Sequence);
+}
+
+
+//
+// true if an armed playback is due to begin (MOX lead included)
+// disarms playback if the SDR is no longer active
+//
+bool TXPlaybackDue(void)
+{
+    bool Due = false;
+
+    pthread_mutex_lock(&PBMutex);
+    if (PBState == ePBArmed)
+    {
+        if (!SDRActive)
+        {
+            PBState = ePBLoaded;
+            printf("TX playback disarmed: SDR no longer active\n");
+        }
+        else if (PBNowNs() >= PBStartNs - PBLeadNs - VPBMARGINNS)
+            Due = true;
+    }
+    pthread_mutex_unlock(&PBMutex);
+    return Due;
+}
+
+
+//
+// true while playback has MOX set
+//
+bool TXPlaybackHoldsMOX(void)
+{
+    return atomic_load(&PBMOXHeld);
+}
+
+
+//
+// wait until a host clock time: sleep in steps so the DUC watchdog still sees
+// heartbeats, then spin for the last part
+// returns true if aborted, or the SDR is no longer active
+//
+static bool PBWaitUntil(int64_t DueNs)
+{
+    struct timespec WakeTime;
+    int64_t Now, Wake;
+
+    while (true)
+    {
+        if (atomic_load(&PBAbortRequested) || !SDRActive)
+            return true;
+        Now = PBNowNs();
+        if (Now >= DueNs - VPBSPINNS)
+            break;
+        Wake = Now + VPBSTEPNS;
+        if (Wake > DueNs - VPBSPINNS)
+            Wake = DueNs - VPBSPINNS;
+        WakeTime.tv_sec = Wake / 1000000000LL;
+        WakeTime.tv_nsec = Wake % 1000000000LL;
+        clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &WakeTime, NULL);
+        WatchdogHeartbeat(eWDDUCIQ);
+    }
+    while (PBNowNs() < DueNs)
+        ;
+    return false;
+}
+
+
+//
+// set or clear MOX for playback
+//
+static void PBSetMOX(bool MOX)
+{
+    atomic_store(&PBMOXHeld, MOX);
+    IsTXMode = MOX;
+    SetMOX(MOX);
+}
+
+
+//
+// play the armed waveform to Sink
+//
+void RunTXPlayback(TTXPlaybackSink* Sink)
+{
+    uint8_t Report[VPBREPORTSIZE];
+    uint32_t Frame = 0, Frames, Free, Occupied, StartOccupied = 0;
+    uint32_t Underflows = 0, StallUnderflows = 0, HeldWords = 0;
+    int64_t StartNs, LeadNs, TailNs, FirstWriteNs = 0, EndNs, Error;
+    int64_t Now, LastReadNs = 0, MaxGapNs = 0;
+    bool SequenceMOX, Underflowed, PrevUnderflowed = false, Aborted;
+    int Socketid;
+    struct sockaddr_in Addr;
+    struct sched_param Priority, SavedPriority;
+    int SavedPolicy;
+
+    pthread_mutex_lock(&PBMutex);
+    if (PBState != ePBArmed)
+    {
+        pthread_mutex_unlock(&PBMutex);
+        return;
+    }
+    PBState = ePBPlaying;
+    Frames = PBBlocks;
+    StartNs = PBStartNs;
+    LeadNs = PBLeadNs;
+    TailNs = PBTailNs;
+    SequenceMOX = PBSequenceMOX;
+    pthread_mutex_unlock(&PBMutex);
+
+    //
+    // the FIFO holds only a few ms, so play at real time priority if allowed
+    //
+    pthread_getschedparam(pthread_self(), &SavedPolicy, &SavedPriority);
+    Priority.sched_priority = VPBPRIORITY;
+    if ((pthread_setschedparam(pthread_self(), SCHED_FIFO, &Priority) != 0) && UseDebug)
+        printf("TX playback: real time priority not available\n");
+
+    //
+    // MOX lead, then the start time
+    //
+    Aborted = false;
+    if (SequenceMOX)
+    {
+        Aborted = PBWaitUntil(StartNs - LeadNs);
+        if (!Aborted)
+        {
+            PBSetMOX(true);
+            PBMOXOnNs = PBNowNs();
+        }
+    }
+    if (!Aborted)
+        Aborted = PBWaitUntil(StartNs);
+
+    //
+    // keep the FIFO full. The FIFO was empty just before the first frame, so the
+    // underflow seen at the next read is not counted. The underflow bit is set
+    // again at each read until the FIFO is written, so a run of reads showing
+    // it is one underflow. If the time since the previous read was longer than
+    // the FIFO then held, the host did not run this thread in time: that is
+    // counted too, so host stalls can be told from a fault here.
+    //
+    while ((Frame < Frames) && !Aborted)
+    {
+        Free = Sink->FreeWords(Sink->Context, &Underflowed, &Occupied);
+        Now = PBNowNs();
+        if ((Frame != 0) && (Now - LastReadNs > MaxGapNs))
+            MaxGapNs = Now - LastReadNs;
+        if (Underflowed && !PrevUnderflowed && (Frame >= 2))
+        {
+            Underflows++;
+            if (Now - LastReadNs > (int64_t)HeldWords * VPBWORDNS)
+                StallUnderflows++;
+        }
+        PrevUnderflowed = Underflowed && (Frame >= 2);
+        LastReadNs = Now;
+        HeldWords = Occupied;
+        if (Free >= VPBWORDSPERFRAME)
+        {
+            if (Frame == 0)
+            {
+                FirstWriteNs = PBNowNs();
+                StartOccupied = Occupied;
+            }
+            if (SequenceMOX && !MOXAsserted)                    // a client packet may have cleared it in passing
+                SetMOX(true);
+            Sink->WriteFrame(Sink->Context, PBWaveform + Frame * VPBFRAMEBYTES);
+            HeldWords += VPBWORDSPERFRAME;
+            Frame++;
+            WatchdogHeartbeat(eWDDUCIQ);
+        }
+        else
+            usleep(GStreamProfile.DUCPollUs);
+        Aborted = atomic_load(&PBAbortRequested) || !SDRActive;
+    }
+
+    //
+    // let the FIFO empty, then MOX tail
+    //
+    EndNs = PBNowNs();
+    if (!Aborted)
+    {
+        do
+        {
+            Sink->FreeWords(Sink->Context, &Underflowed, &Occupied);
+            EndNs = PBNowNs();
+            if (Occupied != 0)
+                usleep(GStreamProfile.DUCPollUs);
+            WatchdogHeartbeat(eWDDUCIQ);
+        } while ((Occupied != 0) && (EndNs < FirstWriteNs + ((int64_t)Frames * VPBFRAMESAMPLES * 1000000000LL) / VPBSAMPLERATE + VPBDRAINNS));
+        if (SequenceMOX)
+            PBWaitUntil(EndNs + TailNs);
+    }
+    if (SequenceMOX && atomic_load(&PBMOXHeld))
+        PBSetMOX(false);
+    pthread_setschedparam(pthread_self(), SavedPolicy, &SavedPriority);
+
+    //
+    // the start time is when the first sample left the FIFO
+    //
+    Error = (Frame == 0) ? 0 : FirstWriteNs + (int64_t)StartOccupied * VPBWORDNS - StartNs;
+    pthread_mutex_lock(&PBMutex);
+    PBPlayed = (Frame * VPBFRAMESAMPLES > PBLength) ? PBLength : Frame * VPBFRAMESAMPLES;
+    PBUnderflows = Underflows;
+    PBStartErrorNs = Error;
+    PBEndNs = EndNs;
+    PBMaxGapNs = MaxGapNs;
+    PBStallUnderflows = StallUnderflows;
+    PBState = ePBLoaded;
+    if (Aborted)
+        PBAborted++;
+    else
+    {
+        PBPlaybacks++;
+        PBTotalUnderflows += Underflows;
+        PBSumErrorNs += (Error < 0) ? -Error : Error;
+        if (((Error < 0) ? -Error : Error) > PBMaxErrorNs)
+            PBMaxErrorNs = (Error < 0) ? -Error : Error;
+    }
+    MakePBReport(Report, PBArmSequence, Aborted ? 2 : 0);
+    Socketid = PBArmSocketid;
+    Addr = PBArmAddr;
+    pthread_mutex_unlock(&PBMutex);
+    atomic_store(&PBAbortRequested, false);
+    if (Socketid >= 0)
+        SecureSendTo(Socketid, Report, VPBREPORTSIZE, &Addr);
+    printf("TX playback %s: %d samples, start error %.1fus, %d underflows (%d after host stalls), longest FIFO service gap %.1fms\n",
+           Aborted ? "aborted" : "complete", PBPlayed, (double)Error / 1000.0, Underflows, StallUnderflows, (double)MaxGapNs / 1.0e6);
+}
+
+
+//
+// print start accuracy and underflows for the playbacks so far, and clear them
+//
+void PrintTXPlaybackReport(void)
+{
+    pthread_mutex_lock(&PBMutex);
+    if ((PBPlaybacks != 0) || (PBAborted != 0) || (PBRejected != 0))
+    {
+        printf("TX playback: %d played, %d aborted, %d requests rejected\n", PBPlaybacks, PBAborted, PBRejected);
+        if (PBPlaybacks != 0)
+            printf("  start error: mean %.1fus, max %.1fus; %d DUC FIFO underflows\n",
+                   (double)PBSumErrorNs / PBPlaybacks / 1000.0, (double)PBMaxErrorNs / 1000.0, PBTotalUnderflows);
+    }
+    PBPlaybacks = 0;
+    PBAborted = 0;
+    PBRejected = 0;
+    PBTotalUnderflows = 0;
+    PBSumErrorNs = 0;
+    PBMaxErrorNs = 0;
+    pthread_mutex_unlock(&PBMutex);
+}
+
+
+
+//
+// offline check with simulated registers and a file backed DUC sink
+//
+#define VPBCHECKSAMPLES (VPBSAMPLERATE + 100)       // 1s, and a part frame
+#define VPBCHECKTRIALS 6                            // complete playbacks
+#define VPBCHECKAHEADNS 150000000LL                 // start this far after arming
+#define VPBCHECKLEADUS 20000
+#define VPBCHECKTAILUS 5000
+#define VPBCHECKABORTNS 300000000LL                 // abort this long after the start
+#define VPBCHECKMAXERRORNS 1000000LL                // largest allowed median start error
+#define VPBCHECKMOXSLACKNS 2000000LL                // allowed MOX lateness
+
+//
+// file backed DUC sink: the FIFO is modelled draining at the sample rate
+//
+typedef struct
+{
+    FILE* File;
+    double Level;                                   // occupied words
+    int64_t LastNs;
+    bool Underflowed;
+    uint8_t DMAFrame[VPBFRAMEBYTES];
+} TPBFileSink;
+
+static void UpdateFileSink(TPBFileSink* Sink)
+{
+    int64_t Now = PBNowNs();
+    double Drained = (double)(Now - Sink->LastNs) * VPBSAMPLERATE * VPBWORDSPERFRAME / VPBFRAMESAMPLES / 1.0e9;
+
+    if (Drained > Sink->Level)
+    {
+        Sink->Underflowed = true;
+        Sink->Level = 0.0;
+    }
+    else
+        Sink->Level -= Drained;
+    Sink->LastNs = Now;
+}
+
+static uint32_t FileSinkFreeWords(void* Context, bool* Underflowed, uint32_t* Occupied)
+{
+    TPBFileSink* Sink = (TPBFileSink*)Context;
+
+    UpdateFileSink(Sink);
+    *Underflowed = Sink->Underflowed;
+    Sink->Underflowed = false;
+    *Occupied = (uint32_t)Sink->Level;
+    return DMAFIFODepths[eTXDUCDMA] - (uint32_t)(Sink->Level + 0.999);
+}
+
+static void FileSinkWriteFrame(void* Context, uint8_t* Samples)
+{
+    TPBFileSink* Sink = (TPBFileSink*)Context;
+
+    UpdateFileSink(Sink);
+    TXFToDMA(eTXFormat24, Samples, Sink->DMAFrame);
+    fwrite(Sink->DMAFrame, 1, VPBFRAMEBYTES, Sink->File);
+    Sink->Level += VPBWORDSPERFRAME;
+}
+
+
+//
+// MOX transitions, recorded by the register write hook
+//
+static volatile int64_t CheckMOXOnNs, CheckMOXOffNs;
+static bool CheckPrevMOX;
+static volatile bool CheckDUCRun;
+
+static void PBCheckWriteHook(uint32_t Address, __attribute__((unused)) uint32_t Data)
+{
+    if ((Address == VADDRRFGPIOREG) && (MOXAsserted != CheckPrevMOX))
+    {
+        if (MOXAsserted)
+            CheckMOXOnNs = PBNowNs();
+        else
+            CheckMOXOffNs = PBNowNs();
+        CheckPrevMOX = MOXAsserted;
+    }
+}
+
+
+static int CompareErrors(const void* A, const void* B)
+{
+    int64_t Diff = *(const int64_t*)A - *(const int64_t*)B;
+    return (Diff > 0) - (Diff < 0);
+}
+
+
+//
+// stands in for the DUC thread: asks whether playback is due once per ms
+//
+static void* PBCheckDUCThread(void* arg)
+{
+    while (CheckDUCRun)
+    {
+        if (TXPlaybackDue())
+            RunTXPlayback((TTXPlaybackSink*)arg);
+        else
+            usleep(1000);
+    }
+    return NULL;
+}
+
+
+//
+// send an arm request for a start time AheadNs from now; returns the start time
+//
+static int64_t CheckArm(uint32_t Sequence, bool SampleTime, int64_t AheadNs, int64_t RefNs)
+{
+    uint8_t Packet[60];
+    int64_t StartNs = PBNowNs() + AheadNs;
+    uint64_t Time = (uint64_t)StartNs;
+
+    if (SampleTime)
+    {
+        Time = ((StartNs - RefNs) * 192) / 1000000LL;
+        StartNs = RefNs + ((int64_t)Time * 1000000LL) / 192;
+    }
+    memset(Packet, 0, sizeof(Packet));
+    *(uint32_t*)Packet = htonl(Sequence);
+    Packet[4] = VPBPACKETID;
+    Packet[5] = ePBArm;
+    Packet[6] = SampleTime ? eTimeSampleCount : eTimeHostClock;
+    Packet[7] = 1;
+    WriteBE64(Packet + 8, Time);
+    *(uint32_t*)(Packet + 16) = htonl(VPBCHECKLEADUS);
+    *(uint32_t*)(Packet + 20) = htonl(VPBCHECKTAILUS);
+    HandleTXPlaybackPacket(Packet, sizeof(Packet), -1, NULL);
+    return StartNs;
+}
+
+
+//
+// wait for a playback to end, with high priority packets arriving as they
+// would from a client, so the session is not ended
+//
+static void CheckWaitIdle(void)
+{
+    while ((PBState == ePBArmed) || (PBState == ePBPlaying))
+    {
+        LivenessPacket(eLVHighPriority);
+        usleep(10000);
+    }
+}
+
+
+//
+// check playback with simulated registers and a file backed DUC sink
+// a waveform with a part frame at the end is uploaded in a scrambled order, with
+// a duplicate; then played in full several times, alternating the time base,
+// and once aborted part way through. The file must hold exactly the frames
+// played; full playbacks must start within 1ms (the median is judged, as a host
+// stall during the spin moves one start) with no underflows, and MOX must be set
+// for the lead time first (median judged too) and cleared after the FIFO has emptied.
+// returns true if the check fails
+//
+bool RunTXPlaybackCheck(char* FileName)
+{
+    TPBFileSink FileSink;
+    TTXPlaybackSink Sink;
+    pthread_t DUCThread;
+    uint8_t Packet[VPBDATASIZE];
+    uint8_t Frame[VPBFRAMEBYTES];
+    uint8_t DMAFrame[VPBFRAMEBYTES];
+    uint8_t* Expected;
+    uint8_t* Actual;
+    uint8_t* Sample;
+    uint32_t Cntr, Block, Count, Samples, Trial;
+    uint32_t Played[VPBCHECKTRIALS + 1];
+    uint32_t Underflows = 0, StallUnderflows = 0;
+    int64_t Errors[VPBCHECKTRIALS];
+    int64_t Magnitudes[VPBCHECKTRIALS];
+    int64_t Leads[VPBCHECKTRIALS];
+    int64_t StartNs, RefNs, AbortNs = 0, MinTail = INT64_MAX;
+    int32_t I, Q;
+    long FileBytes, ExpectedBytes;
+    bool SavedActive = SDRActive;
+    bool Exact, LateRejected, AbortStopped, Fail;
+
+    printf("TX playback check with simulated registers, DUC output to %s\n", FileName);
+    memset(&FileSink, 0, sizeof(FileSink));
+    FileSink.File = fopen(FileName, "w+b");
+    if (FileSink.File == NULL)
+    {
+        perror("TX playback check: open sink file");
+        return true;
+    }
+    FileSink.LastNs = PBNowNs();
+    Sink.FreeWords = FileSinkFreeWords;
+    Sink.WriteFrame = FileSinkWriteFrame;
+    Sink.Context = &FileSink;
+    EnableSimulatedRegisters(true);
+    SetRegisterWriteHook(PBCheckWriteHook);
+    SDRActive = true;
+    RefNs = PBNowNs();
+    SetTimedCommandSampleReference(0, 192);
+    CheckDUCRun = true;
+    if (pthread_create(&DUCThread, NULL, PBCheckDUCThread, &Sink) != 0)
+    {
+        perror("pthread_create TX playback check");
+        fclose(FileSink.File);
+        return true;
+    }
+
+    //
+    // upload: a two tone signal with pseudo random low bits, so a misplaced
+    // or changed sample is seen
+    //
+    srand(1);
+    Expected = (uint8_t*)malloc(VPBCHECKSAMPLES * VPBBYTESPERSAMPLE);
+    for (Cntr = 0; Cntr < VPBCHECKSAMPLES; Cntr++)
+    {
+        I = (int32_t)(3000000.0 * (sin(Cntr * 0.0491) + sin(Cntr * 0.0523))) ^ (rand() & 0xFF);
+        Q = (int32_t)(3000000.0 * (cos(Cntr * 0.0491) + cos(Cntr * 0.0523))) ^ (rand() & 0xFF);
+        Sample = Expected + Cntr * VPBBYTESPERSAMPLE;
+        Sample[0] = (uint8_t)(I >> 16);
+        Sample[1] = (uint8_t)(I >> 8);
+        Sample[2] = (uint8_t)I;
+        Sample[3] = (uint8_t)(Q >> 16);
+        Sample[4] = (uint8_t)(Q >> 8);
+        Sample[5] = (uint8_t)Q;
+    }
+    memset(Packet, 0, sizeof(Packet));
+    Packet[4] = VPBPACKETID;
+    Packet[5] = ePBBegin;
+    *(uint32_t*)(Packet + 8) = htonl(VPBCHECKSAMPLES);
+    HandleTXPlaybackPacket(Packet, 60, -1, NULL);
+    Count = (VPBCHECKSAMPLES + VPBFRAMESAMPLES - 1) / VPBFRAMESAMPLES;
+    for (Cntr = 0; Cntr <= Count; Cntr++)
+    {
+        Block = (Cntr == Count) ? 5 : (Cntr * 7) % Count;   // Count is not a multiple of 7; block 5 twice
+        Packet[5] = ePBData;
+        *(uint32_t*)(Packet + 8) = htonl(Block * VPBFRAMESAMPLES);
+        Samples = (Block == Count - 1) ? VPBCHECKSAMPLES - Block * VPBFRAMESAMPLES : VPBFRAMESAMPLES;
+        memcpy(Packet + VPBDATAHEADERSIZE, Expected + Block * VPBFRAMEBYTES, Samples * VPBBYTESPERSAMPLE);
+        HandleTXPlaybackPacket(Packet, VPBDATAHEADERSIZE + Samples * VPBBYTESPERSAMPLE, -1, NULL);
+    }
+    printf("uploaded %d samples in %d blocks: %s\n", VPBCHECKSAMPLES, Count, (PBState == ePBLoaded) ? "complete" : "INCOMPLETE");
+
+    //
+    // a start time already passed is refused
+    //
+    CheckArm(100, false, -1000000LL, RefNs);
+    LateRejected = (PBState == ePBLoaded);
+
+    //
+    // full playbacks. An underflow is only a fault if the FIFO was read in time:
+    // one after a host stall longer than the FIFO held (seen on virtual
+    // machines) is reported separately.
+    //
+    for (Trial = 0; Trial < VPBCHECKTRIALS; Trial++)
+    {
+        CheckMOXOnNs = 0;
+        CheckMOXOffNs = 0;
+        StartNs = CheckArm(Trial, (Trial & 1) != 0, VPBCHECKAHEADNS, RefNs);
+        CheckWaitIdle();
+        Played[Trial] = PBPlayed;
+        Errors[Trial] = PBStartErrorNs;
+        Magnitudes[Trial] = (PBStartErrorNs < 0) ? -PBStartErrorNs : PBStartErrorNs;
+        StallUnderflows += PBStallUnderflows;
+        Underflows += PBUnderflows - PBStallUnderflows;
+        Leads[Trial] = (CheckMOXOnNs == 0) ? 0 : StartNs - CheckMOXOnNs;
+        if (CheckMOXOffNs == 0)
+            MinTail = 0;
+        else if (CheckMOXOffNs - PBEndNs < MinTail)
+            MinTail = CheckMOXOffNs - PBEndNs;
+    }
+
+    //
+    // aborted playback
+    //
+    CheckMOXOffNs = 0;
+    StartNs = CheckArm(VPBCHECKTRIALS, false, VPBCHECKAHEADNS, RefNs);
+    while (PBNowNs() < StartNs + VPBCHECKABORTNS)
+    {
+        LivenessPacket(eLVHighPriority);
+        usleep(10000);
+    }
+    memset(Packet, 0, 60);
+    Packet[4] = VPBPACKETID;
+    Packet[5] = ePBAbort;
+    AbortNs = PBNowNs();
+    HandleTXPlaybackPacket(Packet, 60, -1, NULL);
+    CheckWaitIdle();
+    Played[VPBCHECKTRIALS] = PBPlayed;
+    AbortStopped = (PBPlayed < VPBCHECKSAMPLES) && (CheckMOXOffNs != 0) && (CheckMOXOffNs - AbortNs < VPBCHECKMOXSLACKNS)
+                   && (PBAborted == 1);
+    CheckDUCRun = false;
+    pthread_join(DUCThread, NULL);
+
+    //
+    // the file must hold each playback's frames in DMA layout
+    //
+    fflush(FileSink.File);
+    FileBytes = ftell(FileSink.File);
+    ExpectedBytes = 0;
+    for (Trial = 0; Trial <= VPBCHECKTRIALS; Trial++)
+        ExpectedBytes += ((Played[Trial] + VPBFRAMESAMPLES - 1) / VPBFRAMESAMPLES) * VPBFRAMEBYTES;
+    Exact = (FileBytes == ExpectedBytes);
+    Actual = (uint8_t*)malloc(VPBFRAMEBYTES);
+    rewind(FileSink.File);
+    for (Trial = 0; (Trial <= VPBCHECKTRIALS) && Exact; Trial++)
+    {
+        for (Block = 0; (Block * VPBFRAMESAMPLES < Played[Trial]) && Exact; Block++)
+        {
+            if (fread(Actual, 1, VPBFRAMEBYTES, FileSink.File) != VPBFRAMEBYTES)
+                Exact = false;
+            memset(Frame, 0, VPBFRAMEBYTES);
+            Samples = (Block == Count - 1) ? VPBCHECKSAMPLES - Block * VPBFRAMESAMPLES : VPBFRAMESAMPLES;
+            memcpy(Frame, Expected + Block * VPBFRAMEBYTES, Samples * VPBBYTESPERSAMPLE);
+            TXFToDMA(eTXFormat24, Frame, DMAFrame);
+            if (memcmp(Actual, DMAFrame, VPBFRAMEBYTES) != 0)
+                Exact = false;
+        }
+    }
+    fclose(FileSink.File);
+    free(Actual);
+    free(Expected);
+
+    PrintTXPlaybackReport();
+    printf("start error:");
+    for (Trial = 0; Trial < VPBCHECKTRIALS; Trial++)
+        printf(" %.1fus (%s)", (double)Errors[Trial] / 1000.0, (Trial & 1) ? "sample time" : "host time");
+    qsort(Magnitudes, VPBCHECKTRIALS, sizeof(int64_t), CompareErrors);
+    qsort(Leads, VPBCHECKTRIALS, sizeof(int64_t), CompareErrors);
+    printf("\nmedian start error %.1fus, max %.1fus\n", (double)Magnitudes[VPBCHECKTRIALS / 2] / 1000.0,
+           (double)Magnitudes[VPBCHECKTRIALS - 1] / 1000.0);
+    printf("DUC FIFO underflows %d (and %d after host stalls longer than the FIFO held)\n", Underflows, StallUnderflows);
+    printf("MOX set a median %.1fms before start (lead %.1fms), cleared at least %.1fms after FIFO empty (tail %.1fms)\n",
+           (double)Leads[VPBCHECKTRIALS / 2] / 1.0e6, VPBCHECKLEADUS / 1000.0, (double)MinTail / 1.0e6, VPBCHECKTAILUS / 1000.0);
+    printf("late start refused %s; abort stopped playback %s (%d samples played); sink file %s (%ld bytes)\n",
+           LateRejected ? "yes" : "NO", AbortStopped ? "yes" : "NO", Played[VPBCHECKTRIALS], Exact ? "exact" : "WRONG", FileBytes);
+    Fail = !Exact || !LateRejected || !AbortStopped || (Underflows != 0) || (Magnitudes[VPBCHECKTRIALS / 2] > VPBCHECKMAXERRORNS)
+           || (Leads[0] == 0) || (Leads[VPBCHECKTRIALS / 2] < VPBCHECKLEADUS * 1000LL - VPBCHECKMOXSLACKNS) || (MinTail < VPBCHECKTAILUS * 1000LL);
+    for (Trial = 0; Trial < VPBCHECKTRIALS; Trial++)
+        if (Played[Trial] != VPBCHECKSAMPLES)
+            Fail = true;
+    printf("TX playback check: %s\n", Fail ? "FAIL" : "pass");
+    SetRegisterWriteHook(NULL);
+    EnableSimulatedRegisters(false);
+    SDRActive = SavedActive;
+    return Fail;
+}
@@ -0,0 +1,153 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// txplayback.h:
+//
+// preloaded TX waveform playback: a client uploads a complete TX I/Q
+// waveform ahead of time, then arms it to start at a host clock or DDC0
+// sample count time. The DUC thread plays it from memory, with MOX
+// sequencing, so network timing cannot cause DUC underflows.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __txplayback_h
+#define __txplayback_h
+
+
+#include <stdint.h>
+#include <netinet/in.h>
+#include "../common/saturntypes.h"
+
+
+#define VPBPACKETID 0x14                            // command byte of a playback packet (port 1024)
+#define VPBREPORTID 0x15                            // command byte of the report sent back
+#define VPBREPORTSIZE 40                            // bytes in a report
+#define VPBFRAMESAMPLES 240                         // samples per data packet, and per DUC frame
+#define VPBBYTESPERSAMPLE 6                         // 24 bit I then 24 bit Q
+#define VPBDATAHEADERSIZE 12
+#define VPBDATASIZE (VPBDATAHEADERSIZE + VPBBYTESPERSAMPLE * VPBFRAMESAMPLES)   // 1452: largest data packet
+#define VPBSAMPLERATE 192000                        // DUC I/Q sample rate
+#define VPBMAXSECONDS 30                            // longest waveform held
+#define VPBMAXSAMPLES (VPBMAXSECONDS * VPBSAMPLERATE)
+#define VPBMAXMOXLEADUS 500000                      // longest MOX lead and tail times
+
+
+//
+// playback packet, on port 1024 (all fields big endian):
+// bytes 0-3    sequence number
+// byte 4       0x14
+// byte 5       request: 0 = begin upload, 1 = data, 2 = arm, 3 = abort, 4 = status
+// begin (60 bytes; discards any waveform held):
+// bytes 8-11   waveform length, samples (1 to 30s at 192ksps)
+// data (12 + 6 * samples bytes; no report):
+// bytes 8-11   offset of the first sample; a multiple of 240
+// bytes 12-    240 samples in standard P2 format (fewer for the last block only)
+// arm (60 bytes; the whole waveform must be loaded):
+// byte 6       time base: 0 = host clock (ns since the epoch), 1 = DDC0 sample number,
+//              as for timed commands
+// byte 7       bit 0: sequence MOX (set it before the start, clear it when played out)
+// bytes 8-15   time the first sample is to leave the DUC FIFO
+// bytes 16-19  MOX lead: MOX set this long before the start, us
+// bytes 20-23  MOX tail: MOX cleared this long after the FIFO has emptied, us
+// abort and status (60 bytes): no fields
+//
+// report, 40 bytes, sent to the sender of every request except data, and
+// again to the sender of the arm request when playback ends:
+// bytes 0-3    sequence number of the request (of the arm request at the end of playback)
+// byte 4       0x15
+// byte 5       state (ETXPlaybackState)
+// byte 6       result: 0 = done; 1 = rejected; 2 = playback aborted
+// bytes 8-11   waveform length, samples
+// bytes 12-15  samples loaded
+// bytes 16-19  offset of the first missing block (= length when all loaded)
+// bytes 20-23  samples played in the latest playback
+// bytes 24-27  DUC FIFO underflows in the latest playback
+// bytes 28-31  start time error, ns (signed, saturated): time the first sample
+//              left the DUC FIFO - requested start
+// bytes 32-39  requested start, host clock ns
+//
+typedef enum
+{
+    ePBEmpty,                                       // no waveform
+    ePBLoading,                                     // waveform partly loaded
+    ePBLoaded,                                      // ready to arm
+    ePBArmed,                                       // waiting for the start time
+    ePBPlaying,                                     // started
+    ePBNumStates
+} ETXPlaybackState;
+
+typedef enum
+{
+    ePBBegin,
+    ePBData,
+    ePBArm,
+    ePBAbort,
+    ePBStatus
+} ETXPlaybackRequest;
+
+
+//
+// where playback writes DUC I/Q: the DUC DMA FIFO, or a file for checks
+// FreeWords returns the free 64 bit FIFO locations, and sets Underflowed (cleared
+// by the read, as the FIFO monitor does) and Occupied.
+// WriteFrame writes 240 samples in standard P2 format.
+//
+typedef struct
+{
+    uint32_t (*FreeWords)(void* Context, bool* Underflowed, uint32_t* Occupied);
+    void (*WriteFrame)(void* Context, uint8_t* Samples);
+    void* Context;
+} TTXPlaybackSink;
+
+
+//
+// handle a playback packet received on port 1024
+// reports are sent to From on Socketid (no report if Socketid < 0)
+//
+void HandleTXPlaybackPacket(uint8_t* Buffer, uint32_t Size, int Socketid, struct sockaddr_in* From);
+
+
+//
+// true if an armed playback is due to begin (MOX lead included) and the
+// caller should call RunTXPlayback. Called by the DUC thread each time round
+// its loop; disarms playback if the SDR is no longer active.
+//
+bool TXPlaybackDue(void);
+
+
+//
+// play the armed waveform to Sink: wait for the start time, write it
+// keeping the FIFO full, and sequence MOX. Returns when played out or aborted.
+//
+void RunTXPlayback(TTXPlaybackSink* Sink);
+
+
+//
+// true while playback has MOX set: the client's MOX bit does not clear it,
+// and TX is not dropped for lack of network DUC I/Q
+//
+bool TXPlaybackHoldsMOX(void);
+
+
+//
+// print start accuracy and underflows for the playbacks so far
+//
+void PrintTXPlaybackReport(void);
+
+
+//
+// check playback with simulated registers and a file backed DUC sink:
+// upload and play waveforms, check the file holds them exactly, and report
+// start time accuracy, underflows and MOX sequencing
+// returns true if the check fails
+//
+bool RunTXPlaybackCheck(char* FileName);
+
+
+#endif
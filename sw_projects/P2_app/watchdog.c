@@ -0,0 +1,360 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// watchdog.c:
+//
+// streaming thread stall watchdog
+// each streaming thread calls WatchdogHeartbeat() when it makes progress
+// (a DMA transfer, a packet sent or received). Each thread sets its expected
+// heartbeat period from its current sample rate when streaming starts.
+// The watchdog thread checks every few ms; if a thread is late by more than
+// VWDSTALLFACTOR periods it prints:
+// - which thread stalled, and for how long
+// - FIFO depths and flags for all 4 DMA streams
+// - recent heartbeat intervals for every monitored thread
+// - the call stack of every registered streaming thread
+// so a dropout can be attributed without attaching a debugger.
+// stacks are captured by signalling each thread: its signal handler writes
+// its own backtrace. The app is linked with -rdynamic so symbols are shown.
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <execinfo.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include "../common/saturntypes.h"
+#include "../common/saturnregisters.h"
+#include "../common/saturndrivers.h"
+#include "threaddata.h"
+#include "watchdog.h"
+#include "handoff.h"
+
+
+#define VWDSTACKDEPTH 32                            // deepest stack captured
+#define VWDSTACKWAITMS 50                           // time allowed for a thread to capture its stack
+#define VWDSIGNAL SIGUSR2                           // signal used to request a stack capture
+
+
+//
+// state for each monitored thread: its heartbeat is written for every
+// transfer, so each thread's state starts a new cache line
+//
+typedef struct
+{
+    char* Name;
+    bool Registered;                                // true if thread ID known
+    pthread_t ThreadId;
+    pid_t Tid;                                      // kernel thread ID (as shown by top -H)
+    volatile bool Armed;                            // true if being monitored
+    volatile bool Started;                          // true after 1st heartbeat since armed
+    volatile uint32_t PeriodUs;                     // expected heartbeat period
+    volatile uint64_t LastBeatUs;                   // time of last heartbeat
+    uint32_t History[VWDHISTORY];                   // recent heartbeat intervals, us
+    volatile uint32_t HistoryIndex;                 // next history location to write
+    uint32_t MaxIntervalUs;                         // longest interval since armed
+    uint32_t StallCount;                            // stalls reported since startup
+    bool Stalled;                                   // true while a stall is in progress
+    uint64_t StallBeatUs;                           // last heartbeat time when stall reported
+} VCACHEALIGNED TWatchdogThread;
+
+
+static TWatchdogThread WDThreads[eWDNumThreads];
+static volatile pthread_t StackCaptureTarget;       // thread whose stack is wanted
+static volatile sig_atomic_t StackCaptureDone;
+static pthread_t WatchdogThread;
+
+
+//
+// get time in us
+//
+static uint64_t WatchdogTimeUs(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (uint64_t)Now.tv_sec * 1000000ULL + (uint64_t)(Now.tv_nsec / 1000);
+}
+
+
+//
+// register the calling thread, so its stack can be captured.
+//
+void WatchdogRegisterThread(EWatchdogThread Thread, char* Name)
+{
+    TWatchdogThread* WD = &WDThreads[Thread];
+
+    WD->Name = Name;
+    WD->ThreadId = pthread_self();
+    WD->Tid = (pid_t)syscall(SYS_gettid);
+    WD->Registered = true;
+}
+
+
+//
+// start monitoring a thread.
+//
+void WatchdogArm(EWatchdogThread Thread, uint32_t PeriodUs)
+{
+    TWatchdogThread* WD = &WDThreads[Thread];
+
+    WD->Started = false;
+    WD->PeriodUs = PeriodUs;
+    WD->MaxIntervalUs = 0;
+    WD->Armed = true;
+}
+
+
+//
+// change the expected heartbeat period of an armed thread
+//
+void WatchdogSetPeriod(EWatchdogThread Thread, uint32_t PeriodUs)
+{
+    WDThreads[Thread].PeriodUs = PeriodUs;
+}
+
+
+//
+// stop monitoring a thread
+//
+void WatchdogDisarm(EWatchdogThread Thread)
+{
+    WDThreads[Thread].Armed = false;
+}
+
+
+//
+// publish a heartbeat
+//
+void WatchdogHeartbeat(EWatchdogThread Thread)
+{
+    TWatchdogThread* WD = &WDThreads[Thread];
+    uint64_t Now;
+    uint32_t Interval;
+
+    Now = WatchdogTimeUs();
+    if (WD->Started)
+    {
+        Interval = (uint32_t)(Now - WD->LastBeatUs);
+        WD->History[WD->HistoryIndex] = Interval;
+        WD->HistoryIndex = (WD->HistoryIndex + 1) % VWDHISTORY;
+        if (Interval > WD->MaxIntervalUs)
+            WD->MaxIntervalUs = Interval;
+    }
+    WD->LastBeatUs = Now;
+    WD->Started = true;
+}
+
+
+//
+// signal handler: if this is the thread whose stack is wanted, write it out.
+// backtrace() was called once at startup, so it does not need to allocate here.
+//
+static void StackCaptureHandler(int Signal)
+{
+    void* Stack[VWDSTACKDEPTH];
+    int Depth;
+
+    (void)Signal;
+    if (!pthread_equal(pthread_self(), StackCaptureTarget))
+        return;
+    Depth = backtrace(Stack, VWDSTACKDEPTH);
+    backtrace_symbols_fd(Stack, Depth, STDOUT_FILENO);
+    StackCaptureDone = 1;
+}
+
+
+//
+// capture the stack of one thread, by asking it to write its own
+//
+static void CaptureThreadStack(TWatchdogThread* WD)
+{
+    int Wait;
+
+    printf("  stack of %s thread (tid %d):\n", WD->Name, (int)WD->Tid);
+    fflush(stdout);
+    StackCaptureDone = 0;
+    StackCaptureTarget = WD->ThreadId;
+    if (pthread_kill(WD->ThreadId, VWDSIGNAL) != 0)
+    {
+        printf("    thread not running\n");
+        return;
+    }
+    for (Wait = 0; (Wait < VWDSTACKWAITMS) && !StackCaptureDone; Wait++)
+        usleep(1000);
+    if (!StackCaptureDone)
+        printf("    no response (signals blocked?)\n");
+}
+
+
+//
+// print FIFO depths and flags for all DMA streams.
+// reading the monitor clears its flags, so any found are passed on to the
+// high priority message as the data threads would have done.
+//
+static void PrintFIFODepths(void)
+{
+    static const char* Names[4] = {"DDC", "DUC", "mic", "speaker"};
+    static const EDMAStreamSelect Channels[4] = {eRXDDCDMA, eTXDUCDMA, eMicCodecDMA, eSpkCodecDMA};
+    bool Overflow, OverThreshold, Underflow;
+    unsigned int Current;
+    uint32_t Depth;
+    int Cntr;
+
+    for (Cntr = 0; Cntr < 4; Cntr++)
+    {
+        Depth = ReadFIFOMonitorChannel(Channels[Cntr], &Overflow, &OverThreshold, &Underflow, &Current);
+        printf("  %-7s FIFO: depth %5d current %5d%s%s%s\n", Names[Cntr], Depth, Current,
+               Overflow ? " OVERFLOW" : "", OverThreshold ? " OVERTHRESHOLD" : "", Underflow ? " UNDERFLOW" : "");
+        if ((Cntr == 0) && OverThreshold)
+            atomic_fetch_or(&GlobalFIFOOverflows, 0b00000001);
+        if ((Cntr == 1) && Underflow)
+            atomic_fetch_or(&GlobalFIFOOverflows, 0b00000100);
+        if ((Cntr == 2) && OverThreshold)
+            atomic_fetch_or(&GlobalFIFOOverflows, 0b00000010);
+        if ((Cntr == 3) && Underflow)
+            atomic_fetch_or(&GlobalFIFOOverflows, 0b00001000);
+    }
+}
+
+
+//
+// print recent heartbeat timing for every monitored thread, oldest first
+//
+static void PrintTimingHistory(uint64_t Now)
+{
+    TWatchdogThread* WD;
+    uint32_t Cntr, Index;
+    int Thread;
+
+    for (Thread = 0; Thread < eWDNumThreads; Thread++)
+    {
+        WD = &WDThreads[Thread];
+        if (!WD->Armed || !WD->Started)
+            continue;
+        printf("  %-13s last beat %6.1fms ago, expected every %6.1fms, longest %6.1fms\n    recent (ms):",
+               WD->Name, (double)(Now - WD->LastBeatUs) / 1000.0, (double)WD->PeriodUs / 1000.0,
+               (double)WD->MaxIntervalUs / 1000.0);
+        Index = WD->HistoryIndex;
+        for (Cntr = 0; Cntr < VWDHISTORY; Cntr++)
+        {
+            printf(" %.1f", (double)WD->History[Index] / 1000.0);
+            Index = (Index + 1) % VWDHISTORY;
+        }
+        printf("\n");
+    }
+}
+
+
+//
+// a thread has stalled: capture diagnostics
+//
+static void ReportStall(TWatchdogThread* WD, uint64_t Now)
+{
+    int Thread;
+
+    printf("WATCHDOG: %s thread stalled: no progress for %.1fms (expected every %.1fms), stall %d\n",
+           WD->Name, (double)(Now - WD->LastBeatUs) / 1000.0, (double)WD->PeriodUs / 1000.0, WD->StallCount);
+    printf("  SDR active = %d, TX = %d, total DDC rate = %dksps\n", SDRActive, IsTXMode, GetP2TotalSampleRate());
+    PrintFIFODepths();
+    PrintTimingHistory(Now);
+    fflush(stdout);
+    for (Thread = 0; Thread < eWDNumThreads; Thread++)
+        if (WDThreads[Thread].Registered)
+            CaptureThreadStack(&WDThreads[Thread]);
+    printf("WATCHDOG: end of report\n");
+    fflush(stdout);
+}
+
+
+//
+// watchdog thread: check each armed thread for a late heartbeat
+//
+static void* WatchdogCheck(void* arg)
+{
+    TWatchdogThread* WD;
+    uint64_t Now, Limit;
+    uint64_t ParkedUs = 0;                          // last time threads were parked for an upgrade
+    int Thread;
+
+    (void)arg;
+    while (1)
+    {
+        usleep(VWDCHECKMS * 1000);
+        Now = WatchdogTimeUs();
+        if (HandoffFreezing())                      // parked threads are not stalled
+        {
+            ParkedUs = Now;
+            continue;
+        }
+        for (Thread = 0; Thread < eWDNumThreads; Thread++)
+        {
+            WD = &WDThreads[Thread];
+            if (!WD->Armed || !WD->Started || (WD->PeriodUs == 0))
+            {
+                WD->Stalled = false;
+                continue;
+            }
+            Limit = (uint64_t)WD->PeriodUs * VWDSTALLFACTOR;
+            if (Limit < VWDMINSTALLMS * 1000)
+                Limit = VWDMINSTALLMS * 1000;
+            if (WD->Stalled)
+            {
+                if (WD->LastBeatUs != WD->StallBeatUs)
+                {
+                    printf("WATCHDOG: %s thread resumed after %.1fms\n", WD->Name,
+                           (double)(WD->LastBeatUs - WD->StallBeatUs) / 1000.0);
+                    WD->Stalled = false;
+                }
+            }
+            else if ((Now - ((WD->LastBeatUs > ParkedUs) ? WD->LastBeatUs : ParkedUs)) > Limit)
+            {
+                WD->Stalled = true;
+                WD->StallBeatUs = WD->LastBeatUs;
+                WD->StallCount++;
+                ReportStall(WD, Now);
+            }
+        }
+    }
+    return NULL;
+}
+
+
+//
+// start the watchdog thread.
+// returns true if error
+//
+bool InitialiseWatchdog(void)
+{
+    struct sigaction Action;
+    void* Dummy[1];
+
+    backtrace(Dummy, 1);                                    // loads unwinder now, not in a signal handler
+    memset(&Action, 0, sizeof(Action));
+    Action.sa_handler = StackCaptureHandler;
+    Action.sa_flags = SA_RESTART;
+    sigemptyset(&Action.sa_mask);
+    if (sigaction(VWDSIGNAL, &Action, NULL) < 0)
+    {
+        perror("watchdog sigaction");
+        return true;
+    }
+    if (pthread_create(&WatchdogThread, NULL, WatchdogCheck, NULL) < 0)
+    {
+        perror("pthread_create watchdog");
+        return true;
+    }
+    pthread_detach(WatchdogThread);
+    return false;
+}
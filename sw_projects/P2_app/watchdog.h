@@ -0,0 +1,88 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// watchdog.h:
+//
+// streaming thread stall watchdog
+// each streaming thread publishes a heartbeat when it makes progress. A
+// watchdog thread flags any thread that misses its expected cadence, and
+// captures stacks, FIFO depths and recent heartbeat timing.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __watchdog_h
+#define __watchdog_h
+
+
+#include <stdint.h>
+#include "../common/saturntypes.h"
+
+
+#define VWDHISTORY 16                               // heartbeat intervals kept for each thread
+#define VWDMINSTALLMS 20                            // shortest stall that is reported, ms
+#define VWDSTALLFACTOR 4                            // stall = this many expected periods late
+#define VWDCHECKMS 5                                // watchdog check interval, ms
+
+
+//
+// monitored threads
+//
+typedef enum
+{
+    eWDDDCIQ,                                       // outgoing DDC I/Q
+    eWDDUCIQ,                                       // incoming DUC I/Q
+    eWDMic,                                         // outgoing mic audio
+    eWDWideband,                                    // outgoing wideband
+    eWDHighPriority,                                // outgoing high priority
+    eWDNumThreads
+} EWatchdogThread;
+
+
+//
+// register the calling thread, so its stack can be captured.
+// called once by each streaming thread when it starts.
+//
+void WatchdogRegisterThread(EWatchdogThread Thread, char* Name);
+
+
+//
+// start monitoring a thread. PeriodUs = expected time between heartbeats.
+// monitoring begins at the first heartbeat after this call, so a thread waiting
+// for its first data is not flagged.
+//
+void WatchdogArm(EWatchdogThread Thread, uint32_t PeriodUs);
+
+
+//
+// change the expected heartbeat period of an armed thread, eg when the sample
+// rate changes. PeriodUs = 0 suspends checking (no data expected)
+//
+void WatchdogSetPeriod(EWatchdogThread Thread, uint32_t PeriodUs);
+
+
+//
+// stop monitoring a thread (eg when streaming stops)
+//
+void WatchdogDisarm(EWatchdogThread Thread);
+
+
+//
+// publish a heartbeat: called when a thread makes progress
+//
+void WatchdogHeartbeat(EWatchdogThread Thread);
+
+
+//
+// start the watchdog thread.
+// returns true if error
+//
+bool InitialiseWatchdog(void);
+
+
+#endif
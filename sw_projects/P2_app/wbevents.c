@@ -0,0 +1,341 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// wbevents.c:
+//
+// wideband signal detector. The wideband thread collects captures from the
+// detector's ADC whether or not the client has enabled wideband data (at the
+// client's rate if it has, else at the detector's), and passes each one here
+// after it is read. The detector (common/wbdetect.c) limits its own CPU use;
+// events from each update are sent straight away to every subscriber.
+// subscriptions are taken on the event port by the wideband thread too, so
+// nothing here needs a lock. The detector runs only while the radio is
+// running.
+//
+//////////////////////////////////////////////////////////////
+
+#include "threaddata.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "netclass.h"
+#include "securestream.h"
+#include "wbevents.h"
+
+
+#define VWBEPOLLUS 10000                            // subscription poll period
+#define VWBEMAXPERIODMS 255                         // wideband IP update rate register limit
+
+
+typedef struct
+{
+    struct sockaddr_in Addr;
+    uint64_t ExpiryUs;                              // CLOCK_REALTIME
+    uint32_t SequenceNumber;
+    uint64_t EventsSent;
+} TWBESubscriber;
+
+
+static bool WBEEnabled = false;
+static uint32_t WBEADC;
+static uint32_t WBEUpdates;
+static uint32_t WBEFFTSize = VWBDDEFAULTFFT;
+static uint32_t WBEAverages = VWBDDEFAULTAVERAGES;
+static double WBEMinSNRdB = 0.0;
+static uint32_t WBEPort = VWBEDEFAULTPORT;
+static int WBESocket = -1;
+static TWBDetector WBEDetector;
+static TWBESubscriber WBESubscribers[VWBEMAXSUBSCRIBERS];
+static uint32_t WBESubscriberCount = 0;
+static uint64_t WBELastPollUs = 0;
+static uint64_t WBESubscriptions, WBEPacketsSent, WBESendErrors, WBERejected;
+static TWBDEvent WBEEvents[VWBDMAXEVENTS];
+static uint8_t WBEPacket[VWBDPACKETSIZE];
+
+
+static uint64_t WBENowUs(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_REALTIME, &Now);
+    return (uint64_t)Now.tv_sec * 1000000ULL + Now.tv_nsec / 1000;
+}
+
+
+//
+// parse a -D setting
+// returns true if not valid
+//
+bool ParseWBDetectSetting(char* Setting)
+{
+    unsigned int ADC, Updates, FFTSize = VWBDDEFAULTFFT, Averages = VWBDDEFAULTAVERAGES, Port = VWBEDEFAULTPORT;
+    double MinSNR = 0.0;
+
+    if (sscanf(Setting, "%u,%u,%u,%u,%lf,%u", &ADC, &Updates, &FFTSize, &Averages, &MinSNR, &Port) < 2)
+        return true;
+    if ((ADC > 1) || (Updates == 0) || (Updates > VWBDMAXUPDATES) || (FFTSize < VWBDMINFFT) || (FFTSize > VWBDMAXFFT)
+        || ((FFTSize & (FFTSize - 1)) != 0) || (Averages == 0) || (Averages > VWBDMAXAVERAGES)
+        || (MinSNR < 0.0) || (MinSNR > 60.0) || (Port == 0) || (Port > 65535))
+        return true;
+    WBEADC = ADC;
+    WBEUpdates = Updates;
+    WBEFFTSize = FFTSize;
+    WBEAverages = Averages;
+    WBEMinSNRdB = MinSNR;
+    WBEPort = Port;
+    WBEEnabled = true;
+    return false;
+}
+
+
+//
+// true if the detector is set
+//
+bool WBEventsEnabled(void)
+{
+    return WBEEnabled;
+}
+
+
+//
+// allocate the detector and open the event port
+// returns true if error
+//
+bool InitialiseWBEvents(void)
+{
+    struct sockaddr_in Addr;
+    int yes = 1;
+
+    if (!WBEEnabled)
+        return false;
+    if (WBDetectInit(&WBEDetector, WBEFFTSize, WBEUpdates, WBEAverages, WBEMinSNRdB,
+                     VWBDDEFAULTHYSTERESIS, VWBDDEFAULTBUDGET))
+    {
+        printf("wideband detector: cannot allocate memory\n");
+        return true;
+    }
+    if ((WBESocket = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+    {
+        perror("socket fail, wideband events");
+        return true;
+    }
+    setsockopt(WBESocket, SOL_SOCKET, SO_REUSEADDR, (void *)&yes, sizeof(yes));
+    ApplyNetClass(WBESocket, eNetWideband);
+    memset(&Addr, 0, sizeof(Addr));
+    Addr.sin_family = AF_INET;
+    Addr.sin_addr = GetNetClassAddress(eNetWideband);
+    Addr.sin_port = htons(WBEPort);
+    if (bind(WBESocket, (struct sockaddr*)&Addr, sizeof(Addr)) < 0)
+    {
+        perror("bind, wideband events");
+        return true;
+    }
+    printf("wideband detector: ADC%d, %d point FFT (%.1fkHz bins), %d averages, %d updates/s",
+           WBEADC + 1, WBEFFTSize, (double)VWBDSAMPLERATE / WBEFFTSize / 1000.0, WBEAverages, WBEUpdates);
+    if (WBEMinSNRdB > 0.0)
+        printf(", at least %.1fdB SNR", WBEMinSNRdB);
+    printf("; events on port %d\n", WBEPort);
+    return false;
+}
+
+
+//
+// wideband capture settings the detector needs
+//
+uint8_t WBEventsADCEnables(void)
+{
+    if (!WBEEnabled)
+        return 0;
+    return (uint8_t)(1 << WBEADC);
+}
+
+
+uint32_t WBEventsCaptureSamples(void)
+{
+    return WBEFFTSize;
+}
+
+
+uint32_t WBEventsCapturePeriodMs(void)
+{
+    uint32_t Period;
+
+    Period = 1000 / (WBEUpdates * WBEAverages);
+    if (Period == 0)
+        Period = 1;
+    if (Period > VWBEMAXPERIODMS)
+        Period = VWBEMAXPERIODMS;
+    return Period;
+}
+
+
+//
+// start of a run: forget signals and statistics
+//
+void WBEventsRestart(void)
+{
+    if (WBEEnabled)
+        WBDetectRestart(&WBEDetector);
+    WBEPacketsSent = 0;
+    WBESendErrors = 0;
+}
+
+
+//
+// send Count events to one subscriber, in as many packets as needed
+// (a packet with no events is sent if Count is 0)
+//
+static void WBESend(TWBESubscriber* Sub, TWBDEvent* Events, uint32_t Count, uint64_t TimeUs)
+{
+    uint32_t Done = 0;
+    uint32_t Chunk, Length;
+
+    do
+    {
+        Chunk = Count - Done;
+        if (Chunk > VWBDEVENTSPERPACKET)
+            Chunk = VWBDEVENTSPERPACKET;
+        Length = WBDetectMakePacket(Events + Done, Chunk, Sub->SequenceNumber++, (uint8_t)WBEADC, TimeUs, WBEPacket);
+        if (SecureSendTo(WBESocket, WBEPacket, Length, &Sub->Addr) < 0)
+            WBESendErrors++;
+        else
+            WBEPacketsSent++;
+        Sub->EventsSent += Chunk;
+        Done += Chunk;
+    } while (Done < Count);
+}
+
+
+//
+// take a subscription or renewal; answer with the signals present
+//
+static void WBESubscribe(struct sockaddr_in* From, uint32_t Seconds, uint64_t NowUs)
+{
+    uint32_t Sub, Count;
+
+    for (Sub = 0; Sub < WBESubscriberCount; Sub++)
+        if ((WBESubscribers[Sub].Addr.sin_addr.s_addr == From->sin_addr.s_addr)
+            && (WBESubscribers[Sub].Addr.sin_port == From->sin_port))
+            break;
+
+    if (Seconds == 0)                                           // unsubscribe
+    {
+        if (Sub < WBESubscriberCount)
+            WBESubscribers[Sub] = WBESubscribers[--WBESubscriberCount];
+        return;
+    }
+    if (Seconds > VWBEMAXLEASE)
+        Seconds = VWBEMAXLEASE;
+    if (Sub == WBESubscriberCount)
+    {
+        if (WBESubscriberCount == VWBEMAXSUBSCRIBERS)
+        {
+            WBERejected++;
+            return;
+        }
+        memset(&WBESubscribers[Sub], 0, sizeof(TWBESubscriber));
+        WBESubscribers[Sub].Addr = *From;
+        WBESubscriberCount++;
+        WBESubscriptions++;
+        if (UseDebug)
+            printf("wideband detector: subscriber %s:%d\n", inet_ntoa(From->sin_addr), ntohs(From->sin_port));
+    }
+    WBESubscribers[Sub].ExpiryUs = NowUs + (uint64_t)Seconds * 1000000ULL;
+    Count = WBDetectListActive(&WBEDetector, WBEEvents, VWBDMAXEVENTS);
+    WBESend(&WBESubscribers[Sub], WBEEvents, Count, NowUs);
+}
+
+
+//
+// take subscriptions and expire old ones
+//
+void WBEventsPoll(void)
+{
+    struct sockaddr_in From;
+    socklen_t FromLength;
+    char Buffer[64];
+    ssize_t Size;
+    unsigned int Seconds;
+    uint64_t NowUs;
+    uint32_t Sub;
+
+    if (!WBEEnabled)
+        return;
+    NowUs = WBENowUs();
+    if ((NowUs - WBELastPollUs) < VWBEPOLLUS)
+        return;
+    WBELastPollUs = NowUs;
+
+    for (;;)
+    {
+        FromLength = sizeof(From);
+        Size = recvfrom(WBESocket, Buffer, sizeof(Buffer) - 1, MSG_DONTWAIT, (struct sockaddr*)&From, &FromLength);
+        if (Size < 0)
+        {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+                perror("recvfrom, wideband events");
+            break;
+        }
+        Buffer[Size] = 0;
+        if ((sscanf(Buffer, "WBDS %u", &Seconds) == 1) && (From.sin_family == AF_INET))
+            WBESubscribe(&From, Seconds, NowUs);
+    }
+
+    Sub = 0;
+    while (Sub < WBESubscriberCount)
+    {
+        if (WBESubscribers[Sub].ExpiryUs < NowUs)
+            WBESubscribers[Sub] = WBESubscribers[--WBESubscriberCount];
+        else
+            Sub++;
+    }
+}
+
+
+//
+// a wideband capture has been read: Count samples from ADC
+//
+void WBEventsProcessCapture(uint8_t* Src, uint32_t Count, uint32_t ADC)
+{
+    uint64_t NowUs;
+    uint32_t Events, Sub;
+
+    if (!WBEEnabled || (ADC != WBEADC))
+        return;
+    NowUs = WBENowUs();
+    if (!WBDetectAddCapture(&WBEDetector, Src, Count, NowUs))
+        return;
+    Events = WBDetectTakeEvents(&WBEDetector, WBEEvents, VWBDMAXEVENTS);
+    if (Events == 0)
+        return;
+    for (Sub = 0; Sub < WBESubscriberCount; Sub++)
+        WBESend(&WBESubscribers[Sub], WBEEvents, Events, NowUs);
+}
+
+
+//
+// print detector statistics and events sent
+//
+void PrintWBEventsReport(void)
+{
+    if (!WBEEnabled)
+        return;
+    WBDetectPrintStatistics("wideband detector", &WBEDetector);
+    printf("wideband detector: %d subscribers (%llu subscriptions, %llu refused); %llu packets sent, %llu send errors\n",
+           WBESubscriberCount, (unsigned long long)WBESubscriptions, (unsigned long long)WBERejected,
+           (unsigned long long)WBEPacketsSent, (unsigned long long)WBESendErrors);
+}
@@ -0,0 +1,88 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// wbevents.h:
+// wideband signal detector: runs on the raw wideband ADC captures in the
+// wideband thread, and sends signal start and stop events to subscribers
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __wbevents_h
+#define __wbevents_h
+
+
+#include <stdint.h>
+#include "../common/saturntypes.h"
+#include "../common/wbdetect.h"
+
+
+#define VWBEDEFAULTPORT 1050                        // subscription and event port
+#define VWBEMAXSUBSCRIBERS 8
+#define VWBEMAXLEASE 3600                           // longest subscription, s
+
+
+//
+// subscription (a datagram to the event port, in ASCII):
+// "WBDS <seconds>"  subscribe the sending address and port for <seconds>
+//                   (renew before it expires); 0 unsubscribes
+// each subscription or renewal is answered with an event packet listing the
+// signals present (eWBDActive events; it may hold none). Events then follow
+// as they happen, in the packet format in wbdetect.h.
+//
+
+
+//
+// parse a -D setting: <adc>,<updates/s>[,<FFT size>[,<averages>[,<min SNR dB>[,<port>]]]]
+// returns true if not valid
+//
+bool ParseWBDetectSetting(char* Setting);
+
+
+//
+// true if the detector is set
+//
+bool WBEventsEnabled(void);
+
+
+//
+// allocate the detector and open the event port
+// returns true if error
+//
+bool InitialiseWBEvents(void);
+
+
+//
+// wideband capture settings the detector needs
+// WBEventsADCEnables: enable bits as in SetWidebandParams (0 if the detector is off)
+// WBEventsCaptureSamples: samples per capture
+// WBEventsCapturePeriodMs: capture period, if the client has not enabled wideband data
+//
+uint8_t WBEventsADCEnables(void);
+uint32_t WBEventsCaptureSamples(void);
+uint32_t WBEventsCapturePeriodMs(void);
+
+
+//
+// wideband thread calls
+// WBEventsRestart: at the start of a run
+// WBEventsPoll: often; takes subscriptions and expires them (rate limited internally)
+// WBEventsProcessCapture: after each capture is read: Count samples from ADC
+//
+void WBEventsRestart(void);
+void WBEventsPoll(void);
+void WBEventsProcessCapture(uint8_t* Src, uint32_t Count, uint32_t ADC);
+
+
+//
+// print detector statistics and events sent, at the end of a run
+//
+void PrintWBEventsReport(void);
+
+
+#endif
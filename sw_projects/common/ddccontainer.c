@@ -0,0 +1,222 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// ddccontainer.c:
+// container datagrams carrying I/Q samples from several DDCs,
+// and a reference unpacker that restores standard DDC I/Q packets
+//
+// a standard DDC packet is already 1444 bytes whatever the sample rate, so
+// within a 1500 byte MTU a container saves little; the saving in datagrams
+// (and sendmsg calls) comes from a larger container size on a jumbo frame
+// link, or from accepting IP fragmentation.
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "../common/ddccontainer.h"
+
+
+//
+// initialise a packer. returns true if error
+//
+bool ContainerInit(TDDCContainer* Container, uint32_t MaxSize)
+{
+    memset(Container, 0, sizeof(TDDCContainer));
+    if ((MaxSize < VCTMINSIZE) || (MaxSize > VCTMAXSIZE))
+        return true;
+    Container->MaxSize = MaxSize;
+    Container->Buffer = malloc(MaxSize);
+    if (Container->Buffer == NULL)
+        return true;
+    ContainerRestart(Container);
+    return false;
+}
+
+
+//
+// free memory allocated by ContainerInit
+//
+void ContainerFree(TDDCContainer* Container)
+{
+    free(Container->Buffer);
+    Container->Buffer = NULL;
+    Container->MaxSize = 0;
+}
+
+
+//
+// start a new run: sample and container counts from 0
+//
+void ContainerRestart(TDDCContainer* Container)
+{
+    memset(Container->NextSample, 0, sizeof(Container->NextSample));
+    Container->Sequence = 0;
+    Container->Length = VCTHEADERSIZE;
+    Container->Blocks = 0;
+}
+
+
+//
+// add up to Count P2 format samples for a DDC
+// returns the number added; fewer than Count means the container is full,
+// and must be finished and sent before adding the rest
+//
+uint32_t ContainerAddSamples(TDDCContainer* Container, uint32_t DDC, uint8_t* Src, uint32_t Count)
+{
+    uint32_t Space;
+    uint8_t* Block;
+
+    if ((Count == 0) || (DDC >= VCTMAXDDC))
+        return Count;
+    if (Container->Length + VCTSUBHEADERSIZE + 6 > Container->MaxSize)
+        return 0;
+    Space = (Container->MaxSize - Container->Length - VCTSUBHEADERSIZE) / 6;
+    if (Count > Space)
+        Count = Space;
+    if (Count > 0xFFFF)
+        Count = 0xFFFF;
+
+    Block = Container->Buffer + Container->Length;
+    Block[0] = (uint8_t)DDC;
+    Block[1] = 24;
+    *(uint16_t*)(Block + 2) = htons((uint16_t)Count);
+    *(uint32_t*)(Block + 4) = htonl(Container->NextSample[DDC]);
+    memcpy(Block + VCTSUBHEADERSIZE, Src, 6 * Count);
+    Container->Length += VCTSUBHEADERSIZE + 6 * Count;
+    Container->Blocks++;
+    Container->NextSample[DDC] += Count;
+    return Count;
+}
+
+
+//
+// complete the current container
+// returns the datagram length, or 0 if it holds no samples
+// the datagram is at Container->Buffer; the next add starts a new container
+//
+uint32_t ContainerFinish(TDDCContainer* Container)
+{
+    uint32_t Length = Container->Length;
+    uint8_t* Header = Container->Buffer;
+
+    if (Container->Blocks == 0)
+        return 0;
+    *(uint32_t*)Header = htonl(Container->Sequence++);
+    *(uint32_t*)(Header + 4) = htonl(VCTMAGIC);
+    *(uint16_t*)(Header + 8) = htons((uint16_t)Container->Blocks);
+    *(uint16_t*)(Header + 10) = 0;
+    *(uint16_t*)(Header + 12) = 0;
+    *(uint16_t*)(Header + 14) = htons((uint16_t)(Length - VCTHEADERSIZE));
+    Container->Length = VCTHEADERSIZE;
+    Container->Blocks = 0;
+    return Length;
+}
+
+
+//
+// initialise an unpacker
+//
+void ContainerUnpackInit(TDDCUnpacker* Unpacker)
+{
+    memset(Unpacker, 0, sizeof(TDDCUnpacker));
+}
+
+
+//
+// add one block's samples to a DDC's packet being built
+// a gap in the sample index abandons the partly built packet; samples
+// are then skipped to the start of the next standard packet
+//
+static void UnpackBlock(TDDCUnpacker* Unpacker, uint32_t DDC, uint32_t FirstSample, uint8_t* Src, uint32_t Count,
+                        void (*Output)(void* Context, uint32_t DDC, uint8_t* Packet), void* Context)
+{
+    uint32_t Skip, Copy;
+    uint8_t* Packet = Unpacker->Packet[DDC];
+
+    if (!Unpacker->Started[DDC] || (FirstSample != Unpacker->NextSample[DDC]))
+    {
+        Unpacker->SamplesDiscarded += Unpacker->FrameFill[DDC];
+        Unpacker->FrameFill[DDC] = 0;
+        Unpacker->Started[DDC] = true;
+    }
+    //
+    // an empty packet must start on a packet boundary (only not so after a gap)
+    //
+    if (Unpacker->FrameFill[DDC] == 0)
+    {
+        Skip = (VCTSAMPLESPERPACKET - FirstSample % VCTSAMPLESPERPACKET) % VCTSAMPLESPERPACKET;
+        if (Skip > Count)
+            Skip = Count;
+        Src += 6 * Skip;
+        Count -= Skip;
+        FirstSample += Skip;
+        Unpacker->SamplesDiscarded += Skip;
+    }
+    Unpacker->NextSample[DDC] = FirstSample + Count;
+
+    while (Count != 0)
+    {
+        Copy = VCTSAMPLESPERPACKET - Unpacker->FrameFill[DDC];
+        if (Copy > Count)
+            Copy = Count;
+        memcpy(Packet + 16 + 6 * Unpacker->FrameFill[DDC], Src, 6 * Copy);
+        Unpacker->FrameFill[DDC] += Copy;
+        FirstSample += Copy;
+        Src += 6 * Copy;
+        Count -= Copy;
+        if (Unpacker->FrameFill[DDC] == VCTSAMPLESPERPACKET)
+        {
+            *(uint32_t*)Packet = htonl(FirstSample / VCTSAMPLESPERPACKET - 1);
+            memset(Packet + 4, 0, 8);
+            *(uint16_t*)(Packet + 12) = htons(24);
+            *(uint16_t*)(Packet + 14) = htons(VCTSAMPLESPERPACKET);
+            (*Output)(Context, DDC, Packet);
+            Unpacker->PacketsOut++;
+            Unpacker->FrameFill[DDC] = 0;
+        }
+    }
+}
+
+
+//
+// unpack one container datagram. Output is called for each standard I/Q packet completed.
+// returns true if the datagram is not a valid container
+//
+bool ContainerUnpack(TDDCUnpacker* Unpacker, uint8_t* Datagram, uint32_t Length,
+                     void (*Output)(void* Context, uint32_t DDC, uint8_t* Packet), void* Context)
+{
+    uint32_t Sequence, Blocks, Block, Count, DDC, Position;
+
+    if ((Length < VCTHEADERSIZE) || (ntohl(*(uint32_t*)(Datagram + 4)) != VCTMAGIC)
+        || (ntohs(*(uint16_t*)(Datagram + 14)) != Length - VCTHEADERSIZE))
+        return true;
+    Sequence = ntohl(*(uint32_t*)Datagram);
+    if ((Unpacker->Containers != 0) && (Sequence != Unpacker->NextContainer))
+        Unpacker->LostContainers += Sequence - Unpacker->NextContainer;
+    Unpacker->NextContainer = Sequence + 1;
+    Unpacker->Containers++;
+
+    Blocks = ntohs(*(uint16_t*)(Datagram + 8));
+    Position = VCTHEADERSIZE;
+    for (Block = 0; Block < Blocks; Block++)
+    {
+        if (Position + VCTSUBHEADERSIZE > Length)
+            return true;
+        DDC = Datagram[Position];
+        Count = ntohs(*(uint16_t*)(Datagram + Position + 2));
+        if ((DDC >= VCTMAXDDC) || (Position + VCTSUBHEADERSIZE + 6 * Count > Length))
+            return true;
+        UnpackBlock(Unpacker, DDC, ntohl(*(uint32_t*)(Datagram + Position + 4)),
+                    Datagram + Position + VCTSUBHEADERSIZE, Count, Output, Context);
+        Position += VCTSUBHEADERSIZE + 6 * Count;
+    }
+    return false;
+}
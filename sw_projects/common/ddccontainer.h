@@ -0,0 +1,133 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// ddccontainer.h:
+// container datagrams carrying I/Q samples from several DDCs,
+// and a reference unpacker that restores standard DDC I/Q packets
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __ddccontainer_h
+#define __ddccontainer_h
+
+#include <stdint.h>
+#include "saturntypes.h"
+
+
+#define VCTMAXDDC 10                                // DDCs that can be carried
+#define VCTHEADERSIZE 16                            // container header bytes
+#define VCTSUBHEADERSIZE 8                          // bytes before each DDC's samples
+#define VCTMINSIZE 256                              // smallest container datagram
+#define VCTMAXSIZE 65000                            // largest container datagram
+#define VCTDEFAULTSIZE 1472                         // fits a 1500 byte MTU without fragmentation
+#define VCTMAXINTERVALMS 100                        // longest interval between sending containers
+#define VCTMAGIC 0x50324354                         // "P2CT"
+#define VCTSAMPLESPERPACKET 238                     // samples in a standard DDC I/Q packet
+#define VCTPACKETSIZE 1444                          // standard DDC I/Q packet
+
+
+//
+// container datagram (sent on the DDC0 I/Q port in place of I/Q packets); all fields big endian:
+// bytes 0-3    container sequence number
+// bytes 4-7    VCTMAGIC
+// bytes 8-9    number of DDC blocks
+// bytes 10-11  0
+// bytes 12-13  0 (bits per sample in an I/Q packet)
+// bytes 14-15  bytes following the header
+// then for each block:
+// byte 0       DDC number
+// byte 1       bits per sample (24)
+// bytes 2-3    sample count
+// bytes 4-7    index of the 1st sample in the DDC's stream, counted from the start of the run
+// then 6 bytes per sample: 24 bit I, 24 bit Q, as in an I/Q packet.
+// standard I/Q packet n of a DDC holds samples 238n to 238n+237 and has sequence number n,
+// so an unpacker can rebuild the standard packets exactly.
+//
+
+
+//
+// container packer: one per outgoing stream
+//
+typedef struct
+{
+    uint32_t MaxSize;                               // largest datagram
+    uint32_t Length;                                // bytes in current datagram
+    uint32_t Blocks;                                // DDC blocks in current datagram
+    uint32_t Sequence;                              // next container sequence number
+    uint32_t NextSample[VCTMAXDDC];                 // index of next sample for each DDC
+    uint8_t* Buffer;
+} TDDCContainer;
+
+
+//
+// container unpacker: rebuilds standard I/Q packets
+//
+typedef struct
+{
+    uint32_t NextSample[VCTMAXDDC];                 // index of next sample expected
+    uint32_t FrameFill[VCTMAXDDC];                  // samples in the partly built packet
+    bool Started[VCTMAXDDC];
+    uint8_t Packet[VCTMAXDDC][VCTPACKETSIZE];
+    uint32_t NextContainer;                         // next container sequence number expected
+    uint64_t Containers;                            // containers received
+    uint64_t LostContainers;                        // gaps in container sequence
+    uint64_t PacketsOut;                            // standard packets rebuilt
+    uint64_t SamplesDiscarded;                      // samples in packets left incomplete by loss
+} TDDCUnpacker;
+
+
+//
+// initialise a packer. returns true if error
+//
+bool ContainerInit(TDDCContainer* Container, uint32_t MaxSize);
+
+
+//
+// free memory allocated by ContainerInit
+//
+void ContainerFree(TDDCContainer* Container);
+
+
+//
+// start a new run: sample and container counts from 0
+//
+void ContainerRestart(TDDCContainer* Container);
+
+
+//
+// add up to Count P2 format samples for a DDC
+// returns the number added; fewer than Count means the container is full,
+// and must be finished and sent before adding the rest
+//
+uint32_t ContainerAddSamples(TDDCContainer* Container, uint32_t DDC, uint8_t* Src, uint32_t Count);
+
+
+//
+// complete the current container
+// returns the datagram length, or 0 if it holds no samples
+// the datagram is at Container->Buffer; the next add starts a new container
+//
+uint32_t ContainerFinish(TDDCContainer* Container);
+
+
+//
+// initialise an unpacker
+//
+void ContainerUnpackInit(TDDCUnpacker* Unpacker);
+
+
+//
+// unpack one container datagram. Output is called for each standard I/Q packet completed.
+// returns true if the datagram is not a valid container
+//
+bool ContainerUnpack(TDDCUnpacker* Unpacker, uint8_t* Datagram, uint32_t Length,
+                     void (*Output)(void* Context, uint32_t DDC, uint8_t* Packet), void* Context);
+
+
+#endif
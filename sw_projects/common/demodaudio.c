@@ -0,0 +1,718 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// demodaudio.c:
+// demodulated audio output for a DDC: AM, SSB, CW or FM demodulation
+// with AGC, sent as compact audio packets for thin (listen only) clients
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include "../common/demodaudio.h"
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+
+#define VDAMAXDECIMTAPS (VDAMAXTAPSPERDECIM * VDAMAXDECIMATION)
+#define VDAHISTBLOCKS 8                             // source blocks held before the history is moved down
+#define VDAHISTSIZE(Taps) ((Taps) - 1 + VDAHISTBLOCKS * VDABLOCK)
+#define VDADECIMCUTOFF 0.5                          // decimation filter cutoff, fraction of channel rate
+#define VDACHANBETA 6.0                             // channel filter Kaiser beta: about 60dB stopband
+#define VDAFMCUTOFF 0.22                            // FM audio filter cutoff, fraction of channel rate
+#define VDAAMDCHZ 20.0                              // AM carrier level filter
+#define VDAAGCDECAYS 0.5                            // AGC gain recovery time constant, s
+#define VDAAGCHANGS 0.25                            // AGC hang time, s
+#define VDAFULLSCALE 8388608.0f                     // 24 bit full scale
+#define VDAIQPACKETBYTES 1444                       // a DDC I/Q packet, for bandwidth comparison
+#define VDAIQPACKETSAMPLES 238
+#define VDABENCHSAMPLES 384000                      // source samples timed per benchmark case
+#define VDACPUBUDGET 0.75                           // fraction of a core given to audio channels
+
+
+//
+// decimation filter Kaiser beta, by taps per unit of decimation / 8
+// (about 31dB, 55dB and 75dB stopband: each gives a similar transition band)
+//
+static const double DADecimBeta[] = {0.0, 2.3, 5.1, 7.5};
+
+static char* DAModeNames[] = {"none", "am", "usb", "lsb", "cwu", "cwl", "fm"};
+
+
+//
+// get time in ns, for CPU load measurement
+//
+static uint64_t DAGetTimeNs(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (uint64_t)Now.tv_sec * 1000000000ULL + (uint64_t)Now.tv_nsec;
+}
+
+
+//
+// zero order modified Bessel function, for the Kaiser window
+//
+static double DABesselI0(double X)
+{
+    double Sum = 1.0, Term = 1.0;
+    int K;
+
+    for (K = 1; K < 50; K++)
+    {
+        Term *= (X / (2.0 * K)) * (X / (2.0 * K));
+        Sum += Term;
+        if (Term < 1e-12 * Sum)
+            break;
+    }
+    return Sum;
+}
+
+
+//
+// Kaiser windowed sinc low pass filter tap X from the centre; Cutoff in cycles per sample
+//
+static double DALowPassTap(double X, double Centre, double Cutoff, double Beta)
+{
+    double Window;
+
+    Window = DABesselI0(Beta * sqrt(1.0 - (X / Centre) * (X / Centre))) / DABesselI0(Beta);
+    return 2.0 * Cutoff * Window * ((X == 0.0) ? 1.0 : sin(2.0 * M_PI * Cutoff * X) / (2.0 * M_PI * Cutoff * X));
+}
+
+
+//
+// dot product of N coefficients and samples; N a multiple of 8
+// NEON: 8 taps per iteration, two accumulators
+//
+static float DADot(const float* Coeff, const float* X, uint32_t N)
+{
+    uint32_t Tap;
+
+#if defined(__ARM_NEON)
+    float32x4_t A0 = vdupq_n_f32(0.0f), A1 = vdupq_n_f32(0.0f);
+    float32x2_t S;
+
+    for (Tap = 0; Tap < N; Tap += 8)
+    {
+        A0 = vmlaq_f32(A0, vld1q_f32(Coeff + Tap), vld1q_f32(X + Tap));
+        A1 = vmlaq_f32(A1, vld1q_f32(Coeff + Tap + 4), vld1q_f32(X + Tap + 4));
+    }
+    A0 = vaddq_f32(A0, A1);
+    S = vadd_f32(vget_low_f32(A0), vget_high_f32(A0));
+    return vget_lane_f32(vpadd_f32(S, S), 0);
+#else
+    float Sum = 0.0f;
+
+    for (Tap = 0; Tap < N; Tap++)
+        Sum += Coeff[Tap] * X[Tap];
+    return Sum;
+#endif
+}
+
+
+//
+// look up a mode by name; eDemodNone if not known
+//
+EDemodMode DemodAudioModeByName(char* Name)
+{
+    uint32_t Mode;
+
+    for (Mode = eDemodAM; Mode <= eDemodFM; Mode++)
+        if (strcmp(Name, DAModeNames[Mode]) == 0)
+            return (EDemodMode)Mode;
+    return eDemodNone;
+}
+
+
+//
+// get a mode's name
+//
+char* DemodAudioModeName(EDemodMode Mode)
+{
+    if (Mode > eDemodFM)
+        return "unknown";
+    return DAModeNames[Mode];
+}
+
+
+//
+// clear all filter history
+//
+static void DAClearHistory(TDemodAudio* Demod)
+{
+    if (Demod->DecimTaps != 0)
+    {
+        memset(Demod->HistI, 0, VDAHISTSIZE(Demod->DecimTaps) * sizeof(float));
+        memset(Demod->HistQ, 0, VDAHISTSIZE(Demod->DecimTaps) * sizeof(float));
+        Demod->HistFill = Demod->DecimTaps - 1;
+        Demod->NextOutput = Demod->DecimTaps - 1;
+    }
+    memset(Demod->ChanI, 0, sizeof(Demod->ChanI));
+    memset(Demod->ChanQ, 0, sizeof(Demod->ChanQ));
+    Demod->ChanFill = VDACHANNELTAPS - 1;
+    memset(Demod->FMHist, 0, sizeof(Demod->FMHist));
+    Demod->FMFill = VDAFMTAPS - 1;
+}
+
+
+//
+// calculate the decimation filter for the current source rate and quality
+// (the FIR is symmetrical, so reversing it for the dot product changes nothing)
+//
+static void DADesignDecimation(TDemodAudio* Demod)
+{
+    uint32_t Tap;
+    double Centre, Cutoff, Sum = 0.0;
+
+    Demod->DecimTaps = Demod->TapsPerDecim * Demod->Decimation;
+    Cutoff = VDADECIMCUTOFF / Demod->Decimation;
+    Centre = (Demod->DecimTaps - 1) / 2.0;
+    for (Tap = 0; Tap < Demod->DecimTaps; Tap++)
+    {
+        Demod->DecimCoeff[Tap] = (float)DALowPassTap(Tap - Centre, Centre, Cutoff, DADecimBeta[Demod->TapsPerDecim / 8]);
+        Sum += Demod->DecimCoeff[Tap];
+    }
+    for (Tap = 0; Tap < Demod->DecimTaps; Tap++)
+        Demod->DecimCoeff[Tap] = (float)(Demod->DecimCoeff[Tap] / Sum);         // unity gain at 0Hz
+    DAClearHistory(Demod);
+}
+
+
+//
+// a new source rate: find the decimation to the channel rate
+// (0 if the source rate is not a multiple of the channel rate)
+//
+static void DASetSourceRate(TDemodAudio* Demod, uint32_t SampleRate)
+{
+    uint32_t Decimation;
+
+    Demod->SampleRate = SampleRate;
+    Decimation = SampleRate / Demod->ChanRate;
+    if ((SampleRate % Demod->ChanRate != 0) || (Decimation < 2) || (Decimation > VDAMAXDECIMATION))
+    {
+        Demod->Decimation = 0;
+        return;
+    }
+    Demod->Decimation = Decimation;
+    DADesignDecimation(Demod);
+}
+
+
+//
+// initialise a demodulator
+// returns true if settings are not valid or memory could not be allocated
+//
+bool DemodAudioInit(TDemodAudio* Demod, EDemodMode Mode, uint32_t AudioRate, int32_t LowHz, int32_t HighHz,
+                    uint32_t AGCMaxGaindB, uint32_t BudgetPercent)
+{
+    uint32_t Tap;
+    int32_t Limit;
+    double ChanFs, Centre, X, Tone, Width, LowPass, Sum;
+
+    memset(Demod, 0, sizeof(TDemodAudio));
+    if ((Mode < eDemodAM) || (Mode > eDemodFM) || ((AudioRate != 8) && (AudioRate != 12) && (AudioRate != 16))
+        || (AGCMaxGaindB > 120) || (BudgetPercent == 0) || (BudgetPercent > 100))
+        return true;
+
+    Demod->Mode = Mode;
+    Demod->AudioRate = AudioRate;
+    Demod->ChanRate = (Mode == eDemodFM) ? 2 * AudioRate : AudioRate;
+    Demod->AGCMaxGain = (AGCMaxGaindB == 0) ? 1.0f : (float)pow(10.0, AGCMaxGaindB / 20.0);
+    Demod->BudgetPercent = BudgetPercent;
+    Demod->PacketSamples = AudioRate * VDAPACKETMS;
+    ChanFs = Demod->ChanRate * 1000.0;
+
+    //
+    // receive passband: the mode's default if not given, limited to the channel filter
+    //
+    if ((LowHz == 0) && (HighHz == 0))
+    {
+        switch (Mode)
+        {
+            case eDemodUSB:  LowHz = 150;  HighHz = 2850;  break;
+            case eDemodLSB:  LowHz = -2850;  HighHz = -150;  break;
+            case eDemodCWU:  LowHz = VDACWPITCH - 250;  HighHz = VDACWPITCH + 250;  break;
+            case eDemodCWL:  LowHz = -VDACWPITCH - 250;  HighHz = -VDACWPITCH + 250;  break;
+            case eDemodFM:   LowHz = -VDAFMDEVIATION - 3000;  HighHz = VDAFMDEVIATION + 3000;  break;
+            default:         LowHz = -4000;  HighHz = 4000;  break;
+        }
+    }
+    Limit = (int32_t)(0.4 * ChanFs);
+    LowHz = (LowHz < -Limit) ? -Limit : LowHz;
+    HighHz = (HighHz > Limit) ? Limit : HighHz;
+    if (LowHz >= HighHz)
+        return true;
+    Demod->LowHz = LowHz;
+    Demod->HighHz = HighHz;
+
+    if ((posix_memalign((void**)&Demod->DecimCoeff, 16, VDAMAXDECIMTAPS * sizeof(float)) != 0)
+        || (posix_memalign((void**)&Demod->HistI, 16, VDAHISTSIZE(VDAMAXDECIMTAPS) * sizeof(float)) != 0)
+        || (posix_memalign((void**)&Demod->HistQ, 16, VDAHISTSIZE(VDAMAXDECIMTAPS) * sizeof(float)) != 0))
+    {
+        DemodAudioFree(Demod);
+        return true;
+    }
+
+    //
+    // channel filter: a low pass of half the passband width, shifted to its centre.
+    // time reversed, so the imaginary part changes sign
+    //
+    Tone = (LowHz + HighHz) / (2.0 * ChanFs);               // cycles per channel sample
+    Width = (HighHz - LowHz) / (2.0 * ChanFs);
+    Centre = (VDACHANNELTAPS - 1) / 2.0;
+    Sum = 0.0;
+    for (Tap = 0; Tap < VDACHANNELTAPS; Tap++)
+    {
+        X = Tap - Centre;
+        LowPass = DALowPassTap(X, Centre, Width, VDACHANBETA);
+        Demod->ChanCoeffR[Tap] = (float)(LowPass * cos(2.0 * M_PI * Tone * X));
+        Demod->ChanCoeffI[Tap] = (float)(-LowPass * sin(2.0 * M_PI * Tone * X));
+        Sum += LowPass;
+    }
+    for (Tap = 0; Tap < VDACHANNELTAPS; Tap++)
+    {
+        Demod->ChanCoeffR[Tap] = (float)(Demod->ChanCoeffR[Tap] / Sum);       // unity gain in the passband
+        Demod->ChanCoeffI[Tap] = (float)(Demod->ChanCoeffI[Tap] / Sum);
+    }
+
+    //
+    // FM audio filter, for decimation by 2
+    //
+    Centre = (VDAFMTAPS - 1) / 2.0;
+    Sum = 0.0;
+    for (Tap = 0; Tap < VDAFMTAPS; Tap++)
+    {
+        Demod->FMCoeff[Tap] = (float)DALowPassTap(Tap - Centre, Centre, VDAFMCUTOFF, VDACHANBETA);
+        Sum += Demod->FMCoeff[Tap];
+    }
+    for (Tap = 0; Tap < VDAFMTAPS; Tap++)
+        Demod->FMCoeff[Tap] = (float)(Demod->FMCoeff[Tap] / Sum);
+
+    Demod->DCCoeff = (float)(1.0 - exp(-2.0 * M_PI * VDAAMDCHZ / ChanFs));
+    Demod->AGCDecay = (float)exp(-1.0 / (VDAAGCDECAYS * AudioRate * 1000.0));
+    Demod->AGCHangSamples = (uint32_t)(VDAAGCHANGS * AudioRate * 1000.0);
+    DemodAudioRestart(Demod);
+    return false;
+}
+
+
+//
+// free a demodulator's memory
+//
+void DemodAudioFree(TDemodAudio* Demod)
+{
+    free(Demod->DecimCoeff);
+    free(Demod->HistI);
+    free(Demod->HistQ);
+    Demod->DecimCoeff = NULL;
+    Demod->HistI = NULL;
+    Demod->HistQ = NULL;
+    Demod->DecimTaps = 0;
+    Demod->Mode = eDemodNone;
+}
+
+
+//
+// clear filters, AGC, output and statistics, ready for a new run
+// (the decimation filter is designed when the source rate is known)
+//
+void DemodAudioRestart(TDemodAudio* Demod)
+{
+    Demod->TapsPerDecim = VDAMAXTAPSPERDECIM;
+    Demod->SampleRate = 0;
+    Demod->Decimation = 0;
+    Demod->DecimTaps = 0;
+    DAClearHistory(Demod);
+    Demod->FMPhase = false;
+    Demod->PrevI = 0.0f;
+    Demod->PrevQ = 0.0f;
+    Demod->DCLevel = 0.0f;
+    Demod->DCPrimed = false;
+    Demod->AGCPeak = 0.0f;
+    Demod->AGCHang = 0;
+    Demod->WindowStart = 0;
+    Demod->WindowNs = 0;
+    Demod->WindowOver = false;
+    Demod->OutCount = 0;
+    Demod->NextAudioSample = 0;
+    memset(&Demod->Stats, 0, sizeof(TDemodAudioStatistics));
+}
+
+
+//
+// add one audio sample, full scale = 1.0
+// if packets have not been taken, the oldest is dropped; the sample numbers show the gap
+//
+static void DAPutAudio(TDemodAudio* Demod, float Value)
+{
+    if (Demod->OutCount == 2 * Demod->PacketSamples)
+    {
+        Demod->OutCount -= Demod->PacketSamples;
+        memmove(Demod->Out, Demod->Out + Demod->PacketSamples, Demod->OutCount * sizeof(int16_t));
+        Demod->NextAudioSample += Demod->PacketSamples;
+        Demod->Stats.Overruns += Demod->PacketSamples;
+    }
+    Value = (Value > 1.0f) ? 1.0f : (Value < -1.0f) ? -1.0f : Value;
+    Demod->Out[Demod->OutCount++] = (int16_t)lrintf(Value * 32767.0f);
+    Demod->Stats.AudioSamples++;
+}
+
+
+//
+// demodulate one channel filter output
+//
+static void DADemodulate(TDemodAudio* Demod, float I, float Q)
+{
+    float Audio, Magnitude;
+
+    switch (Demod->Mode)
+    {
+        case eDemodFM:
+            //
+            // phase change since the last sample; +/-deviation is full scale.
+            // audio is made from every other sample
+            //
+            Audio = atan2f(Q * Demod->PrevI - I * Demod->PrevQ, I * Demod->PrevI + Q * Demod->PrevQ)
+                    * (float)(Demod->ChanRate * 1000.0 / (2.0 * M_PI * VDAFMDEVIATION));
+            Demod->PrevI = I;
+            Demod->PrevQ = Q;
+            Demod->FMHist[Demod->FMFill] = Audio;
+            if (Demod->FMPhase)
+                DAPutAudio(Demod, DADot(Demod->FMCoeff, Demod->FMHist + Demod->FMFill + 1 - VDAFMTAPS, VDAFMTAPS));
+            Demod->FMFill++;
+            Demod->FMPhase = !Demod->FMPhase;
+            return;
+
+        case eDemodAM:
+            Magnitude = sqrtf(I * I + Q * Q);
+            if (!Demod->DCPrimed)
+            {
+                Demod->DCLevel = Magnitude;
+                Demod->DCPrimed = true;
+            }
+            Demod->DCLevel += Demod->DCCoeff * (Magnitude - Demod->DCLevel);
+            Audio = Magnitude - Demod->DCLevel;
+            break;
+
+        default:                                            // SSB and CW
+            Audio = I;
+            break;
+    }
+
+    //
+    // AGC: instant attack, so the output peak never exceeds the target;
+    // after the hang time the gain rises exponentially, to its limit
+    //
+    if (Demod->AGCMaxGain > 1.0f)
+    {
+        Magnitude = fabsf(Audio);
+        if (Magnitude >= Demod->AGCPeak)
+        {
+            Demod->AGCPeak = Magnitude;
+            Demod->AGCHang = Demod->AGCHangSamples;
+        }
+        else if (Demod->AGCHang != 0)
+            Demod->AGCHang--;
+        else
+            Demod->AGCPeak *= Demod->AGCDecay;
+        Audio *= (float)VDAAGCTARGET / fmaxf(Demod->AGCPeak, (float)VDAAGCTARGET / Demod->AGCMaxGain);
+    }
+    DAPutAudio(Demod, Audio);
+}
+
+
+//
+// filter, decimate and demodulate Count (up to VDABLOCK) converted source samples
+//
+static void DAProcess(TDemodAudio* Demod, float* I, float* Q, uint32_t Count)
+{
+    uint32_t Shift;
+    float* ChanI;
+    float* ChanQ;
+    float YI, YQ;
+
+    //
+    // move the history down when the buffer is full
+    //
+    if (Demod->HistFill + Count > VDAHISTSIZE(Demod->DecimTaps))
+    {
+        Shift = Demod->HistFill - (Demod->DecimTaps - 1);
+        memmove(Demod->HistI, Demod->HistI + Shift, (Demod->DecimTaps - 1) * sizeof(float));
+        memmove(Demod->HistQ, Demod->HistQ + Shift, (Demod->DecimTaps - 1) * sizeof(float));
+        Demod->HistFill -= Shift;
+        Demod->NextOutput -= Shift;
+    }
+    memcpy(Demod->HistI + Demod->HistFill, I, Count * sizeof(float));
+    memcpy(Demod->HistQ + Demod->HistFill, Q, Count * sizeof(float));
+    Demod->HistFill += Count;
+
+    //
+    // one channel sample every Decimation source samples, then the channel filter
+    //
+    while (Demod->NextOutput < Demod->HistFill)
+    {
+        Shift = Demod->NextOutput + 1 - Demod->DecimTaps;
+        Demod->ChanI[Demod->ChanFill] = DADot(Demod->DecimCoeff, Demod->HistI + Shift, Demod->DecimTaps);
+        Demod->ChanQ[Demod->ChanFill] = DADot(Demod->DecimCoeff, Demod->HistQ + Shift, Demod->DecimTaps);
+        Demod->NextOutput += Demod->Decimation;
+        ChanI = Demod->ChanI + Demod->ChanFill + 1 - VDACHANNELTAPS;
+        ChanQ = Demod->ChanQ + Demod->ChanFill + 1 - VDACHANNELTAPS;
+        YI = DADot(Demod->ChanCoeffR, ChanI, VDACHANNELTAPS) - DADot(Demod->ChanCoeffI, ChanQ, VDACHANNELTAPS);
+        YQ = DADot(Demod->ChanCoeffR, ChanQ, VDACHANNELTAPS) + DADot(Demod->ChanCoeffI, ChanI, VDACHANNELTAPS);
+        Demod->ChanFill++;
+        DADemodulate(Demod, YI, YQ);
+    }
+
+    //
+    // keep the channel and FM filter histories at the bottom of their buffers
+    //
+    Shift = Demod->ChanFill - (VDACHANNELTAPS - 1);
+    memmove(Demod->ChanI, Demod->ChanI + Shift, (VDACHANNELTAPS - 1) * sizeof(float));
+    memmove(Demod->ChanQ, Demod->ChanQ + Shift, (VDACHANNELTAPS - 1) * sizeof(float));
+    Demod->ChanFill -= Shift;
+    Shift = Demod->FMFill - (VDAFMTAPS - 1);
+    memmove(Demod->FMHist, Demod->FMHist + Shift, (VDAFMTAPS - 1) * sizeof(float));
+    Demod->FMFill -= Shift;
+}
+
+
+//
+// skip Count source samples: silent audio that keeps time (none if the source
+// rate is not supported). Filters restart from silence.
+//
+static void DASkip(TDemodAudio* Demod, uint32_t Count)
+{
+    uint32_t Position;
+
+    Demod->Stats.SkippedSamples += Count;
+    if (Demod->Decimation == 0)
+        return;
+    Position = Demod->NextOutput - Demod->HistFill;         // keep the decimation phase
+    DAClearHistory(Demod);
+    for (; Position < Count; Position += Demod->Decimation)
+    {
+        if ((Demod->Mode != eDemodFM) || Demod->FMPhase)
+            DAPutAudio(Demod, 0.0f);
+        if (Demod->Mode == eDemodFM)
+            Demod->FMPhase = !Demod->FMPhase;
+    }
+    Demod->NextOutput = Demod->HistFill + (Position - Count);
+}
+
+
+//
+// convert Count P2 format source samples to float; full scale = 1.0
+//
+static void DAConvertP2Samples(uint8_t* Src, uint32_t Count, float* I, float* Q)
+{
+    uint32_t Sample;
+    const float Scale = 1.0f / VDAFULLSCALE;
+
+    for (Sample = 0; Sample < Count; Sample++)
+    {
+        I[Sample] = (float)((int32_t)(((uint32_t)Src[0] << 24) | ((uint32_t)Src[1] << 16) | ((uint32_t)Src[2] << 8)) >> 8) * Scale;
+        Q[Sample] = (float)((int32_t)(((uint32_t)Src[3] << 24) | ((uint32_t)Src[4] << 16) | ((uint32_t)Src[5] << 8)) >> 8) * Scale;
+        Src += 6;
+    }
+}
+
+
+//
+// add P2 format I/Q samples
+// each second of source samples starts a new budget period; if the last one
+// went over budget the decimation filter is shortened first
+//
+void DemodAudioAddP2Samples(TDemodAudio* Demod, uint8_t* Src, uint32_t Count, uint32_t SampleRate)
+{
+    float I[VDABLOCK], Q[VDABLOCK];
+    uint64_t StartTime, Ns;
+    uint32_t Block;
+
+    if (Demod->Mode == eDemodNone)
+        return;
+    if ((SampleRate != Demod->SampleRate) && (SampleRate != 0))
+        DASetSourceRate(Demod, SampleRate);
+    while (Count != 0)
+    {
+        Block = (Count > VDABLOCK) ? VDABLOCK : Count;
+        if ((Demod->Stats.InputSamples - Demod->WindowStart) >= (uint64_t)Demod->SampleRate * 1000)
+        {
+            if (Demod->WindowOver && (Demod->TapsPerDecim > 8) && (Demod->Decimation != 0))
+            {
+                Demod->TapsPerDecim -= 8;
+                DADesignDecimation(Demod);
+                Demod->Stats.QualitySteps++;
+            }
+            Demod->WindowStart = Demod->Stats.InputSamples;
+            Demod->WindowNs = 0;
+            Demod->WindowOver = false;
+        }
+        if (Demod->WindowNs > (uint64_t)Demod->BudgetPercent * 10000000ULL)
+            Demod->WindowOver = true;
+
+        if ((Demod->Decimation == 0) || Demod->WindowOver)
+            DASkip(Demod, Block);
+        else
+        {
+            StartTime = DAGetTimeNs();
+            DAConvertP2Samples(Src, Block, I, Q);
+            DAProcess(Demod, I, Q, Block);
+            Ns = DAGetTimeNs() - StartTime;
+            Demod->WindowNs += Ns;
+            Demod->Stats.ProcessingNs += Ns;
+        }
+        Demod->Stats.InputSamples += Block;
+        Src += 6 * Block;
+        Count -= Block;
+    }
+}
+
+
+//
+// write one audio packet if one is ready
+// returns its length in bytes, or 0 if a packet is not ready yet
+//
+uint32_t DemodAudioMakePacket(TDemodAudio* Demod, uint32_t SequenceNumber, uint8_t* Dest)
+{
+    uint32_t Sample;
+    uint8_t* Ptr;
+
+    if ((Demod->Mode == eDemodNone) || (Demod->OutCount < Demod->PacketSamples))
+        return 0;
+    *(uint32_t*)Dest = htonl(SequenceNumber);
+    *(uint32_t*)(Dest + 4) = htonl(Demod->NextAudioSample);
+    *(uint16_t*)(Dest + 8) = htons((uint16_t)(Demod->AudioRate * 1000));
+    *(uint16_t*)(Dest + 10) = htons((uint16_t)Demod->Mode);
+    *(uint16_t*)(Dest + 12) = htons(16);                        // bits per sample
+    *(uint16_t*)(Dest + 14) = htons((uint16_t)Demod->PacketSamples);
+    Ptr = Dest + VDAHEADERSIZE;
+    for (Sample = 0; Sample < Demod->PacketSamples; Sample++)
+    {
+        *Ptr++ = (uint8_t)((uint16_t)Demod->Out[Sample] >> 8);
+        *Ptr++ = (uint8_t)Demod->Out[Sample];
+    }
+    Demod->OutCount -= Demod->PacketSamples;
+    memmove(Demod->Out, Demod->Out + Demod->PacketSamples, Demod->OutCount * sizeof(int16_t));
+    Demod->NextAudioSample += Demod->PacketSamples;
+    Demod->Stats.Packets++;
+    return VDAHEADERSIZE + 2 * Demod->PacketSamples;
+}
+
+
+//
+// print statistics for one channel
+// bandwidth includes IPv4 and UDP headers; raw I/Q is what its DDC would have sent
+//
+void DemodAudioPrintStatistics(char* Name, TDemodAudio* Demod)
+{
+    TDemodAudioStatistics* Stats = &Demod->Stats;
+    double Seconds, AudioBytes, IQBytes, NsPerSample;
+
+    if ((Stats->InputSamples == 0) || (Demod->SampleRate == 0))
+        return;
+    Seconds = (double)Stats->InputSamples / (Demod->SampleRate * 1000.0);
+    AudioBytes = (double)Stats->Packets * (VDAHEADERSIZE + 2 * Demod->PacketSamples + VDAUDPOVERHEAD);
+    IQBytes = ceil((double)Stats->InputSamples / VDAIQPACKETSAMPLES) * (VDAIQPACKETBYTES + VDAUDPOVERHEAD);
+    NsPerSample = (Stats->InputSamples > Stats->SkippedSamples)
+                  ? (double)Stats->ProcessingNs / (double)(Stats->InputSamples - Stats->SkippedSamples) : 0.0;
+    printf("%s: %s %dksps audio (%+d to %+dHz) from %dksps: %llu packets, %.1fkbit/s; raw I/Q %.1fkbit/s (%.0f times more)\n",
+           Name, DemodAudioModeName(Demod->Mode), Demod->AudioRate, Demod->LowHz, Demod->HighHz, Demod->SampleRate,
+           (unsigned long long)Stats->Packets, AudioBytes * 8.0 / Seconds / 1000.0, IQBytes * 8.0 / Seconds / 1000.0,
+           (AudioBytes > 0.0) ? IQBytes / AudioBytes : 0.0);
+    printf("%s: %.1fns per source sample (%.1f%% of a core, budget %d%%); %d taps per unit of decimation\n",
+           Name, NsPerSample, NsPerSample * Demod->SampleRate * 1000.0 / 1e7, Demod->BudgetPercent, Demod->TapsPerDecim);
+    if ((Stats->SkippedSamples != 0) || (Stats->Overruns != 0))
+        printf("%s: %llu source samples skipped (over budget, or rate not supported), filter shortened %d times; %llu audio samples not taken\n",
+               Name, (unsigned long long)Stats->SkippedSamples, Stats->QualitySteps, (unsigned long long)Stats->Overruns);
+}
+
+
+//
+// measure processing time per source sample on this processor, and print how many
+// channels one core can sustain for typical DDC rates, with the bandwidth saved
+// cost per source sample is nearly independent of the source rate: the decimation
+// filter has a fixed number of taps per unit of decimation
+//
+void DemodAudioPrintBenchmark(void)
+{
+    static const uint32_t SourceRates[] = {1536, 384, 192, 48};    // ksps
+    static const EDemodMode Modes[] = {eDemodUSB, eDemodFM};
+    static const uint32_t AudioRates[] = {8, 16};
+    TDemodAudio Demod;
+    uint8_t Src[6 * VDABLOCK];
+    uint8_t Packet[VDAPACKETSIZE];
+    char Model[80] = "unknown processor";
+    uint32_t Rate, Mode, Sample, Done;
+    int32_t Value;
+    uint64_t StartTime;
+    double NsPerSample, Sustained, AudioBytes, IQBytes;
+    FILE* Fp;
+
+    Fp = fopen("/proc/device-tree/model", "r");
+    if (Fp != NULL)
+    {
+        if (fgets(Model, sizeof(Model), Fp) == NULL)
+            strcpy(Model, "unknown processor");
+        fclose(Fp);
+    }
+    printf("demodulated audio benchmark on %s (%s):\n", Model,
+#if defined(__ARM_NEON)
+           "NEON");
+#else
+           "scalar");
+#endif
+    for (Sample = 0; Sample < VDABLOCK; Sample++)
+    {
+        Value = (int32_t)(0.3 * VDAFULLSCALE * cos(0.05 * Sample));
+        Src[6 * Sample] = (uint8_t)(Value >> 16);
+        Src[6 * Sample + 1] = (uint8_t)(Value >> 8);
+        Src[6 * Sample + 2] = (uint8_t)Value;
+        Value = (int32_t)(0.3 * VDAFULLSCALE * sin(0.05 * Sample));
+        Src[6 * Sample + 3] = (uint8_t)(Value >> 16);
+        Src[6 * Sample + 4] = (uint8_t)(Value >> 8);
+        Src[6 * Sample + 5] = (uint8_t)Value;
+    }
+    for (Mode = 0; Mode < sizeof(Modes) / sizeof(Modes[0]); Mode++)
+        for (Rate = 0; Rate < sizeof(SourceRates) / sizeof(SourceRates[0]); Rate++)
+        {
+            if (DemodAudioInit(&Demod, Modes[Mode], AudioRates[Mode], 0, 0, VDAAGCMAXGAINDB, 100))
+                return;
+            if ((SourceRates[Rate] % Demod.ChanRate) != 0)
+            {
+                printf("  %-3s %4dksps to %dksps: not supported (not a multiple of the %dksps channel rate)\n",
+                       DemodAudioModeName(Modes[Mode]), SourceRates[Rate], AudioRates[Mode], Demod.ChanRate);
+                DemodAudioFree(&Demod);
+                continue;
+            }
+            StartTime = DAGetTimeNs();
+            for (Done = 0; Done < VDABENCHSAMPLES; Done += VDABLOCK)
+            {
+                DemodAudioAddP2Samples(&Demod, Src, VDABLOCK, SourceRates[Rate]);
+                while (DemodAudioMakePacket(&Demod, 0, Packet) != 0)
+                    ;
+            }
+            NsPerSample = (double)(DAGetTimeNs() - StartTime) / Done;
+            Sustained = VDACPUBUDGET * 1e9 / (NsPerSample * SourceRates[Rate] * 1000.0);
+            AudioBytes = (1000.0 / VDAPACKETMS) * (VDAHEADERSIZE + 2 * Demod.PacketSamples + VDAUDPOVERHEAD);
+            IQBytes = SourceRates[Rate] * 1000.0 / VDAIQPACKETSAMPLES * (VDAIQPACKETBYTES + VDAUDPOVERHEAD);
+            printf("  %-3s %4dksps to %dksps (/%d): %.1fns per source sample (%.2f%% of a core); %.0f channels per core at %.0f%% load;"
+                   " %.0fkbit/s, 1/%.0f of raw I/Q\n",
+                   DemodAudioModeName(Modes[Mode]), SourceRates[Rate], AudioRates[Mode], Demod.Decimation, NsPerSample,
+                   NsPerSample * SourceRates[Rate] * 1000.0 / 1e7, floor(Sustained), VDACPUBUDGET * 100.0,
+                   AudioBytes * 8.0 / 1000.0, IQBytes / AudioBytes);
+            DemodAudioFree(&Demod);
+        }
+}
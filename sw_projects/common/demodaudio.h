@@ -0,0 +1,210 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// demodaudio.h:
+// demodulated audio output for a DDC: AM, SSB, CW or FM demodulation
+// with AGC, sent as compact audio packets for thin (listen only) clients
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __demodaudio_h
+#define __demodaudio_h
+
+#include <stdint.h>
+#include "saturntypes.h"
+
+
+#define VDAMINRATE 8                                // audio ksps
+#define VDAMAXRATE 16
+#define VDAPACKETMS 20                              // audio in one packet
+#define VDAMAXPACKETSAMPLES (VDAMAXRATE * VDAPACKETMS)
+#define VDAHEADERSIZE 16                            // bytes before audio samples
+#define VDAPACKETSIZE (VDAHEADERSIZE + 2 * VDAMAXPACKETSAMPLES)
+#define VDAMAXDECIMATION 192                        // 1536ksps to 8ksps
+#define VDAMAXTAPSPERDECIM 24                       // decimation FIR taps per unit of decimation, at full quality
+#define VDACHANNELTAPS 128                          // channel filter taps, at the channel rate
+#define VDAFMTAPS 32                                // FM audio decimation filter taps
+#define VDABLOCK 256                                // most source samples processed at once
+#define VDAFMDEVIATION 5000                         // FM deviation for full scale audio, Hz
+#define VDACWPITCH 600                              // CW tone, Hz
+#define VDAAGCTARGET 0.5                            // AGC output peak level (-6dBFS)
+#define VDAAGCMAXGAINDB 80                          // default AGC gain limit
+#define VDADEFAULTBUDGET 5                          // default CPU budget per channel, % of a core
+#define VDAUDPOVERHEAD 28                           // IPv4 and UDP headers per datagram
+
+
+//
+// audio packet (sent on the DDC I/Q port in place of I/Q packets)
+// the header matches the layout of a DDC I/Q packet so a client can tell them apart:
+// bytes 0-3    sequence number (shared with the DDC I/Q sequence)
+// bytes 4-7    audio sample number of the 1st sample in this packet
+// bytes 8-9    audio sample rate, Hz
+// bytes 10-11  demodulation mode (EDemodMode)
+// bytes 12-13  16 (bits per sample: 24 in an I/Q packet, 0 in a spectrum packet)
+// bytes 14-15  audio samples in this packet (VDAPACKETMS of audio)
+// then 2 bytes per sample: signed mono audio.
+// all fields big endian.
+//
+
+
+//
+// demodulation modes
+//
+typedef enum
+{
+    eDemodNone,
+    eDemodAM,
+    eDemodUSB,
+    eDemodLSB,
+    eDemodCWU,
+    eDemodCWL,
+    eDemodFM
+} EDemodMode;
+
+
+//
+// demodulated audio statistics
+//
+typedef struct
+{
+    uint64_t InputSamples;                          // source I/Q samples processed or skipped
+    uint64_t AudioSamples;
+    uint64_t Packets;                               // audio packets taken
+    uint64_t Overruns;                              // audio samples lost: packets not taken
+    uint64_t ProcessingNs;                          // time spent filtering and demodulating
+    uint64_t SkippedSamples;                        // source samples not processed: over budget or rate not supported
+    uint32_t QualitySteps;                          // times the decimation filter was shortened
+} TDemodAudioStatistics;
+
+
+//
+// demodulator for one DDC
+// the source is low pass filtered and decimated to the channel rate by a
+// Kaiser windowed FIR (passing to +/-0.4 of the channel rate), then a
+// complex FIR selects the receive passband (for SSB and CW, one sideband)
+// and the result is demodulated. CW and SSB are the real part of the
+// passband signal, AM is its envelope less the carrier level, FM is its
+// phase change per sample. AM, SSB and CW are then levelled by a peak AGC
+// with hang; FM audio level is set by deviation.
+// the channel rate is the audio rate, except for FM: it is filtered and
+// demodulated at twice the audio rate, then decimated.
+//
+// each channel has a CPU budget in % of a core. Time is measured per second
+// of source samples. If a channel exceeds its budget, its source samples are
+// skipped (audio is silent but keeps time) for the rest of that second, and
+// its decimation filter is shortened (24, 16 then 8 taps per unit of
+// decimation) for the rest of the run.
+// the filters use NEON where available.
+//
+typedef struct
+{
+    EDemodMode Mode;
+    uint32_t AudioRate;                             // ksps
+    uint32_t ChanRate;                              // ksps, after the decimation filter
+    int32_t LowHz, HighHz;                          // receive passband relative to the DDC centre
+    float AGCMaxGain;                               // linear; 1.0 = AGC off (unity gain)
+    uint32_t BudgetPercent;
+    uint32_t SampleRate;                            // source ksps; filter recalculated if it changes
+    uint32_t Decimation;                            // 0 if the source rate is not supported
+    uint32_t TapsPerDecim;                          // decimation filter length / Decimation
+    uint32_t DecimTaps;
+    float* DecimCoeff;                              // decimation FIR
+    float* HistI;                                   // source samples: DecimTaps-1 history, then new input
+    float* HistQ;
+    uint32_t HistFill;
+    uint32_t NextOutput;                            // last sample of the next output's FIR window
+    float ChanCoeffR[VDACHANNELTAPS];               // channel FIR (complex), time reversed
+    float ChanCoeffI[VDACHANNELTAPS];
+    float ChanI[VDACHANNELTAPS + VDABLOCK];         // decimated samples: history, then new
+    float ChanQ[VDACHANNELTAPS + VDABLOCK];
+    uint32_t ChanFill;
+    float FMCoeff[VDAFMTAPS];                       // FM audio decimation FIR
+    float FMHist[VDAFMTAPS + VDABLOCK];             // FM discriminator output: history, then new
+    uint32_t FMFill;
+    bool FMPhase;                                   // true if the next FM sample makes an audio sample
+    float PrevI, PrevQ;                             // previous channel output, for FM
+    float DCLevel;                                  // AM carrier level
+    float DCCoeff;
+    bool DCPrimed;                                  // false until the 1st AM sample
+    float AGCPeak;
+    float AGCDecay;                                 // per audio sample
+    uint32_t AGCHang;                               // audio samples before the AGC gain rises
+    uint32_t AGCHangSamples;
+    uint64_t WindowStart;                           // source sample at the start of this budget second
+    uint64_t WindowNs;                              // time used in this budget second
+    bool WindowOver;                                // budget exceeded in this second
+    uint32_t PacketSamples;                         // audio samples per packet
+    int16_t Out[2 * VDAMAXPACKETSAMPLES];           // audio not yet taken
+    uint32_t OutCount;
+    uint32_t NextAudioSample;                       // audio sample number of Out[0]
+    TDemodAudioStatistics Stats;
+} TDemodAudio;
+
+
+//
+// look up a mode by name (am, usb, lsb, cwu, cwl, fm) and get a mode's name
+// DemodAudioModeByName returns eDemodNone if not known
+//
+EDemodMode DemodAudioModeByName(char* Name);
+char* DemodAudioModeName(EDemodMode Mode);
+
+
+//
+// initialise a demodulator. AudioRate in ksps (8, 12 or 16).
+// LowHz = HighHz = 0 selects the mode's default passband. AGCMaxGaindB = 0 turns
+// AGC off. The passband is limited to +/-0.4 of the channel rate.
+// the source rate must be a multiple of the channel rate (FM at 16ksps needs 96ksps or more)
+// returns true if settings are not valid or memory could not be allocated
+//
+bool DemodAudioInit(TDemodAudio* Demod, EDemodMode Mode, uint32_t AudioRate, int32_t LowHz, int32_t HighHz,
+                    uint32_t AGCMaxGaindB, uint32_t BudgetPercent);
+
+
+//
+// free a demodulator's memory
+//
+void DemodAudioFree(TDemodAudio* Demod);
+
+
+//
+// clear filters, AGC, output and statistics, ready for a new run
+//
+void DemodAudioRestart(TDemodAudio* Demod);
+
+
+//
+// add P2 format I/Q samples (24 bit I then 24 bit Q, big endian)
+// SampleRate is the source rate in ksps. Take packets after each call: audio
+// beyond two packets is lost
+//
+void DemodAudioAddP2Samples(TDemodAudio* Demod, uint8_t* Src, uint32_t Count, uint32_t SampleRate);
+
+
+//
+// write one audio packet if one is ready
+// returns its length in bytes, or 0 if a packet is not ready yet
+//
+uint32_t DemodAudioMakePacket(TDemodAudio* Demod, uint32_t SequenceNumber, uint8_t* Dest);
+
+
+//
+// print statistics for one channel, with the network bandwidth compared with
+// sending its DDC's raw I/Q
+//
+void DemodAudioPrintStatistics(char* Name, TDemodAudio* Demod);
+
+
+//
+// measure processing time per source sample on this processor, and print how many
+// channels fit in one core for typical DDC rates
+//
+void DemodAudioPrintBenchmark(void);
+
+
+#endif
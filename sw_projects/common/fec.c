@@ -0,0 +1,471 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// fec.c:
+// forward error correction for protocol 2 I/Q streams
+// interleaved XOR parity: see fec.h for the packet format
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include "../common/fec.h"
+
+
+uint32_t FECGroupSize = 0;                      // 0 = FEC disabled
+uint32_t FECDepth = 1;                          // interleave depth
+
+
+//
+// get time in ns, for CPU load measurement
+//
+static uint64_t FECGetTimeNs(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (uint64_t)Now.tv_sec * 1000000000ULL + (uint64_t)Now.tv_nsec;
+}
+
+
+//
+// XOR one packet into an accumulator
+// 64 bit words where possible; packet lengths need not be a multiple of 8
+//
+static void FECXorPacket(uint8_t* Dest, uint8_t* Src, uint32_t Length)
+{
+    uint32_t Cntr;
+    uint64_t DestWord, SrcWord;
+
+    for (Cntr = 0; Cntr + 8 <= Length; Cntr += 8)
+    {
+        memcpy(&DestWord, Dest + Cntr, 8);
+        memcpy(&SrcWord, Src + Cntr, 8);
+        DestWord ^= SrcWord;
+        memcpy(Dest + Cntr, &DestWord, 8);
+    }
+    for (; Cntr < Length; Cntr++)
+        Dest[Cntr] ^= Src[Cntr];
+}
+
+
+//
+// set the FEC configuration used by p2app for DDC output and TX I/Q input
+// GroupSize = 0 disables FEC. Returns true if the parameters are out of range.
+//
+bool FECSetConfiguration(uint32_t GroupSize, uint32_t Depth)
+{
+    if ((GroupSize > VFECMAXGROUP) || (GroupSize == 1) || (Depth == 0) || (Depth > VFECMAXDEPTH))
+        return true;
+    FECGroupSize = GroupSize;
+    FECDepth = Depth;
+    return false;
+}
+
+
+//
+// return true if FEC has been enabled
+//
+bool FECIsEnabled(void)
+{
+    return (FECGroupSize != 0);
+}
+
+
+//
+// read back the FEC configuration
+//
+void FECGetConfiguration(uint32_t* GroupSize, uint32_t* Depth)
+{
+    *GroupSize = FECGroupSize;
+    *Depth = FECDepth;
+}
+
+
+//
+// initialise an encoder for a stream of fixed length data packets
+//
+void FECInitEncoder(TFECEncoder* Enc, uint32_t PacketSize, uint32_t GroupSize, uint32_t Depth)
+{
+    memset(Enc, 0, sizeof(TFECEncoder));
+    Enc->GroupSize = GroupSize;
+    Enc->Depth = Depth;
+    Enc->PacketSize = PacketSize;
+}
+
+
+//
+// add one data packet to the encoder. Sequence number is read from bytes 0-3.
+// returns true when a block is complete.
+// if the sequence number jumps (stream restarted) the part block is abandoned.
+//
+bool FECEncodePacket(TFECEncoder* Enc, uint8_t* Packet)
+{
+    uint64_t StartTime;
+    uint32_t Seq;
+    uint32_t BlockSize;
+    bool Result = false;
+
+    StartTime = FECGetTimeNs();
+    BlockSize = Enc->GroupSize * Enc->Depth;
+    Seq = ntohl(*(uint32_t*)Packet);
+    if ((Enc->Count != 0) && (Seq != Enc->NextSeq))
+        Enc->Count = 0;                                     // discontinuity: start again
+    if (Enc->Count == 0)
+    {
+        if ((Seq % BlockSize) != 0)                         // wait for a block boundary
+        {
+            Enc->NextSeq = Seq + 1;
+            Enc->Stats.DataPackets++;
+            Enc->Stats.DataBytes += Enc->PacketSize;
+            Enc->Stats.ProcessingNs += FECGetTimeNs() - StartTime;
+            return false;
+        }
+        Enc->BlockSeq = Seq;
+        memcpy(Enc->Parity[0], Packet, Enc->PacketSize);    // 1st of each group is a copy
+    }
+    else if (Enc->Count < Enc->Depth)
+        memcpy(Enc->Parity[Enc->Count], Packet, Enc->PacketSize);
+    else
+        FECXorPacket(Enc->Parity[Enc->Count % Enc->Depth], Packet, Enc->PacketSize);
+
+    Enc->NextSeq = Seq + 1;
+    Enc->Stats.DataPackets++;
+    Enc->Stats.DataBytes += Enc->PacketSize;
+    if (++Enc->Count == BlockSize)
+    {
+        Enc->Count = 0;
+        Enc->Stats.ParityPackets += Enc->Depth;
+        Enc->Stats.ParityBytes += Enc->Depth * (Enc->PacketSize + VFECHEADERSIZE);
+        Result = true;
+    }
+    Enc->Stats.ProcessingNs += FECGetTimeNs() - StartTime;
+    return Result;
+}
+
+
+//
+// write parity packet for group "Group" of the last completed block into Dest
+// returns its length
+//
+uint32_t FECGetParityPacket(TFECEncoder* Enc, uint32_t Group, uint8_t* Dest)
+{
+    *(uint32_t*)Dest = htonl(Enc->BlockSeq);
+    Dest[4] = (uint8_t)Group;
+    Dest[5] = (uint8_t)Enc->GroupSize;
+    Dest[6] = (uint8_t)Enc->Depth;
+    Dest[7] = VFECMARKER;
+    *(uint16_t*)(Dest + 8) = htons((uint16_t)Enc->PacketSize);
+    Dest[10] = 0;
+    Dest[11] = 0;
+    memcpy(Dest + VFECHEADERSIZE, Enc->Parity[Group], Enc->PacketSize);
+    return Enc->PacketSize + VFECHEADERSIZE;
+}
+
+
+//
+// initialise a decoder
+//
+void FECInitDecoder(TFECDecoder* Dec, uint32_t PacketSize, uint32_t GroupSize, uint32_t Depth)
+{
+    memset(Dec, 0, sizeof(TFECDecoder));
+    Dec->GroupSize = GroupSize;
+    Dec->Depth = Depth;
+    Dec->PacketSize = PacketSize;
+}
+
+
+//
+// recover missing packets in the current block, then move it to the "ready" buffer
+//
+static void FECReleaseBlock(TFECDecoder* Dec)
+{
+    uint32_t Group, Cntr, Index;
+    uint32_t Missing, MissingIndex;
+    uint32_t BlockSize;
+
+    if (!Dec->BlockStarted)
+        return;
+    BlockSize = Dec->GroupSize * Dec->Depth;
+    for (Group = 0; Group < Dec->Depth; Group++)
+    {
+        Missing = 0;
+        MissingIndex = 0;
+        for (Cntr = 0; Cntr < Dec->GroupSize; Cntr++)
+        {
+            Index = Group + Cntr * Dec->Depth;
+            if (!Dec->Present[Index])
+            {
+                Missing++;
+                MissingIndex = Index;
+            }
+        }
+        Dec->Stats.LostPackets += Missing;
+        if ((Missing == 1) && Dec->ParityPresent[Group] && (MissingIndex >= Dec->Released))
+        {
+            memcpy(Dec->Data[MissingIndex], Dec->Parity[Group], Dec->PacketSize);
+            for (Cntr = 0; Cntr < Dec->GroupSize; Cntr++)
+            {
+                Index = Group + Cntr * Dec->Depth;
+                if (Index != MissingIndex)
+                    FECXorPacket(Dec->Data[MissingIndex], Dec->Data[Index], Dec->PacketSize);
+            }
+            Dec->Present[MissingIndex] = true;
+            Dec->Stats.RecoveredPackets++;
+        }
+        else
+            Dec->Stats.UnrecoveredPackets += Missing;
+    }
+    //
+    // move to ready buffer, skipping any released at a pause. Any packets not yet read out are lost
+    //
+    for (Index = 0; Index < BlockSize; Index++)
+    {
+        Dec->ReadyPresent[Index] = Dec->Present[Index];
+        if (Dec->Present[Index])
+            memcpy(Dec->Ready[Index], Dec->Data[Index], Dec->PacketSize);
+    }
+    Dec->Stats.DataPackets += BlockSize;
+    Dec->ReadySize = BlockSize;
+    Dec->ReadyIndex = Dec->Released;
+    Dec->BlockStarted = false;
+    Dec->HaveHistory = true;
+    Dec->NextBlockSeq = Dec->BlockSeq + BlockSize;
+}
+
+
+//
+// start a new block in the "current" buffer
+// if whole blocks have been skipped since the last one, count them as lost
+//
+static void FECStartBlock(TFECDecoder* Dec, uint32_t BlockSeq)
+{
+    uint32_t Skipped;
+    uint32_t BlockSize;
+
+    BlockSize = Dec->GroupSize * Dec->Depth;
+    if (Dec->HaveHistory && ((int32_t)(BlockSeq - Dec->NextBlockSeq) > 0))
+    {
+        Skipped = BlockSeq - Dec->NextBlockSeq;
+        if (Skipped < VFECRESTARTBLOCKS * BlockSize)
+        {
+            Dec->Stats.DataPackets += Skipped;
+            Dec->Stats.LostPackets += Skipped;
+            Dec->Stats.UnrecoveredPackets += Skipped;
+        }
+    }
+    memset(Dec->Present, 0, sizeof(Dec->Present));
+    memset(Dec->ParityPresent, 0, sizeof(Dec->ParityPresent));
+    Dec->ParityCount = 0;
+    Dec->Received = 0;
+    Dec->Released = 0;
+    Dec->BlockSeq = BlockSeq;
+    Dec->BlockStarted = true;
+}
+
+
+//
+// true if a packet for block BlockSeq is too late to use: its block is older than
+// the one being assembled or, between blocks, older than the next one expected
+// (released early when all its parity arrived). A block much older than that
+// means the sender has restarted, so it is used.
+//
+static bool FECIsLate(TFECDecoder* Dec, uint32_t BlockSeq)
+{
+    uint32_t Reference;
+    int32_t Age;
+
+    if (Dec->BlockStarted)
+        Reference = Dec->BlockSeq;
+    else if (Dec->HaveHistory)
+        Reference = Dec->NextBlockSeq;
+    else
+        return false;
+    Age = (int32_t)(Reference - BlockSeq);
+    return (Age > 0) && (Age < (int32_t)(VFECRESTARTBLOCKS * Dec->GroupSize * Dec->Depth));
+}
+
+
+//
+// pass one received packet to the decoder. Data and parity packets are both accepted,
+// and told apart by length. Returns false if the packet isn't recognised.
+//
+bool FECDecodePacket(TFECDecoder* Dec, uint8_t* Packet, uint32_t Length)
+{
+    uint64_t StartTime;
+    uint32_t Seq, BlockSeq, Offset, Group;
+    uint32_t BlockSize;
+    bool Result = true;
+
+    StartTime = FECGetTimeNs();
+    BlockSize = Dec->GroupSize * Dec->Depth;
+    if (Length == Dec->PacketSize)
+    {
+        Seq = ntohl(*(uint32_t*)Packet);
+        BlockSeq = Seq - (Seq % BlockSize);
+        Dec->Stats.DataBytes += Length;
+        if (FECIsLate(Dec, BlockSeq))                       // old block: too late to use
+        {
+            Dec->Stats.LatePackets++;
+            Dec->Stats.ProcessingNs += FECGetTimeNs() - StartTime;
+            return true;
+        }
+        if (Dec->BlockStarted && (BlockSeq != Dec->BlockSeq))
+            FECReleaseBlock(Dec);
+        if (!Dec->BlockStarted)
+            FECStartBlock(Dec, BlockSeq);
+        Offset = Seq - BlockSeq;
+        if (Offset < Dec->Released)                         // released at a pause: too late to use
+        {
+            Dec->Stats.LatePackets++;
+            Dec->Stats.ProcessingNs += FECGetTimeNs() - StartTime;
+            return true;
+        }
+        memcpy(Dec->Data[Offset], Packet, Length);
+        Dec->Present[Offset] = true;
+        if (Offset >= Dec->Received)
+            Dec->Received = Offset + 1;
+    }
+    else if ((Length == Dec->PacketSize + VFECHEADERSIZE) && (Packet[7] == VFECMARKER)
+             && (Packet[5] == Dec->GroupSize) && (Packet[6] == Dec->Depth) && (Packet[4] < Dec->Depth))
+    {
+        BlockSeq = ntohl(*(uint32_t*)Packet);
+        Group = Packet[4];
+        Dec->Stats.ParityPackets++;
+        Dec->Stats.ParityBytes += Length;
+        if (FECIsLate(Dec, BlockSeq))
+        {
+            Dec->Stats.ProcessingNs += FECGetTimeNs() - StartTime;
+            return true;
+        }
+        if (Dec->BlockStarted && (BlockSeq != Dec->BlockSeq))
+            FECReleaseBlock(Dec);
+        if (!Dec->BlockStarted)
+            FECStartBlock(Dec, BlockSeq);
+        if (!Dec->ParityPresent[Group])
+        {
+            memcpy(Dec->Parity[Group], Packet + VFECHEADERSIZE, Dec->PacketSize);
+            Dec->ParityPresent[Group] = true;
+            Dec->ParityCount++;
+        }
+        if (Dec->ParityCount == Dec->Depth)                 // all parity in: release now
+            FECReleaseBlock(Dec);
+    }
+    else
+        Result = false;
+    Dec->Stats.ProcessingNs += FECGetTimeNs() - StartTime;
+    return Result;
+}
+
+
+//
+// release the current block, recovering what can be recovered
+//
+void FECFlushDecoder(TFECDecoder* Dec)
+{
+    FECReleaseBlock(Dec);
+}
+
+
+//
+// return true if data packets of the current block are held back
+//
+bool FECIsHolding(TFECDecoder* Dec)
+{
+    return Dec->BlockStarted && (Dec->Received > Dec->Released);
+}
+
+
+//
+// release (or drop) the data packets of the current block received so far,
+// without ending the block. Packets not yet read out from the ready buffer are lost.
+//
+static void FECReleaseHeld(TFECDecoder* Dec, bool Discard)
+{
+    uint32_t Index;
+
+    if (!FECIsHolding(Dec))
+        return;
+    if (!Discard)
+    {
+        for (Index = Dec->Released; Index < Dec->Received; Index++)
+        {
+            Dec->ReadyPresent[Index] = Dec->Present[Index];
+            if (Dec->Present[Index])
+                memcpy(Dec->Ready[Index], Dec->Data[Index], Dec->PacketSize);
+        }
+        Dec->ReadySize = Dec->Received;
+        Dec->ReadyIndex = Dec->Released;
+    }
+    else
+        Dec->ReadyIndex = Dec->ReadySize;
+    Dec->Released = Dec->Received;
+}
+
+
+//
+// the sender has paused part way through a block: release the data packets received so far
+//
+void FECFlushHeld(TFECDecoder* Dec)
+{
+    FECReleaseHeld(Dec, false);
+}
+
+
+//
+// the sender has paused part way through a block: drop the data packets received so far
+//
+void FECDiscardHeld(TFECDecoder* Dec)
+{
+    FECReleaseHeld(Dec, true);
+}
+
+
+//
+// get the next released data packet in sequence order, or NULL if none available
+//
+uint8_t* FECGetOutputPacket(TFECDecoder* Dec)
+{
+    while (Dec->ReadyIndex < Dec->ReadySize)
+    {
+        if (Dec->ReadyPresent[Dec->ReadyIndex])
+            return Dec->Ready[Dec->ReadyIndex++];
+        Dec->ReadyIndex++;
+    }
+    return NULL;
+}
+
+
+//
+// print statistics: bandwidth overhead, CPU time per packet and residual loss
+//
+void FECPrintStatistics(char* Name, TFECStatistics* Stats)
+{
+    double Overhead = 0.0;
+    double NsPerPacket = 0.0;
+    double RawLoss = 0.0;
+    double ResidualLoss = 0.0;
+
+    if (Stats->DataBytes != 0)
+        Overhead = 100.0 * (double)Stats->ParityBytes / (double)Stats->DataBytes;
+    if (Stats->DataPackets != 0)
+    {
+        NsPerPacket = (double)Stats->ProcessingNs / (double)Stats->DataPackets;
+        RawLoss = 100.0 * (double)Stats->LostPackets / (double)Stats->DataPackets;
+        ResidualLoss = 100.0 * (double)Stats->UnrecoveredPackets / (double)Stats->DataPackets;
+    }
+    printf("FEC %s: %llu data pkts, %llu parity pkts, overhead=%.1f%%, CPU=%.0fns/pkt\n", Name,
+           (unsigned long long)Stats->DataPackets, (unsigned long long)Stats->ParityPackets, Overhead, NsPerPacket);
+    printf("FEC %s: lost=%llu (%.3f%%) recovered=%llu residual=%llu (%.3f%%) late=%llu\n", Name,
+           (unsigned long long)Stats->LostPackets, RawLoss, (unsigned long long)Stats->RecoveredPackets,
+           (unsigned long long)Stats->UnrecoveredPackets, ResidualLoss, (unsigned long long)Stats->LatePackets);
+}
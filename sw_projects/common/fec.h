@@ -0,0 +1,212 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// fec.h:
+// forward error correction for protocol 2 I/Q streams
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __fec_h
+#define __fec_h
+
+#include <stdint.h>
+#include "saturntypes.h"
+
+
+//
+// FEC uses interleaved XOR parity.
+// a "block" is GroupSize * Depth consecutive data packets, starting at a sequence
+// number that is a multiple of GroupSize * Depth.
+// packet n of the block belongs to parity group (n % Depth); so a burst of up to
+// Depth consecutive lost packets can be recovered, provided no group loses more
+// than one packet.
+// after the last packet of a block, Depth parity packets are sent. Each is the XOR
+// of the GroupSize data packets in its group (including their sequence numbers),
+// with a header in front:
+//
+// byte 0-3:   sequence number of 1st data packet in block (network order)
+// byte 4:     parity group number (0 to Depth-1)
+// byte 5:     group size
+// byte 6:     interleave depth
+// byte 7:     VFECMARKER
+// byte 8-9:   length of data packet protected (network order)
+// byte 10-11: reserved (0)
+// byte 12+:   XOR of the data packets
+//
+// parity packets are sent to the same port as the data; they are recognised
+// by their length (data packet length + VFECHEADERSIZE).
+//
+#define VFECMAXGROUP 16                         // max data packets per parity group
+#define VFECMAXDEPTH 8                          // max interleave depth
+#define VFECMAXPACKET 1444                      // largest data packet protected
+#define VFECHEADERSIZE 12                       // parity packet header bytes
+#define VFECMARKER 0xFE                         // marker in parity header byte 7
+#define VFECMAXBLOCK (VFECMAXGROUP * VFECMAXDEPTH)
+#define VFECRESTARTBLOCKS 64                    // sequence jump (in blocks) treated as a stream restart
+
+
+//
+// FEC statistics, collected by encoder and decoder
+//
+typedef struct
+{
+    uint64_t DataPackets;                       // data packets encoded, or expected by decoder
+    uint64_t DataBytes;                         // data bytes sent or received
+    uint64_t ParityPackets;                     // parity packets sent or received
+    uint64_t ParityBytes;                       // parity bytes sent or received
+    uint64_t LostPackets;                       // data packets missing before recovery
+    uint64_t RecoveredPackets;                  // data packets rebuilt from parity
+    uint64_t UnrecoveredPackets;                // data packets still missing after recovery
+    uint64_t LatePackets;                       // data packets arriving after their block was released
+    uint64_t ProcessingNs;                      // CPU time spent in encode or decode
+} TFECStatistics;
+
+
+//
+// encoder state: one per outgoing stream
+//
+typedef struct
+{
+    uint32_t GroupSize;
+    uint32_t Depth;
+    uint32_t PacketSize;                        // data packet length
+    uint32_t Count;                             // data packets in current block
+    uint32_t BlockSeq;                          // sequence number of 1st packet in block
+    uint32_t NextSeq;                           // sequence number of next data packet
+    uint8_t Parity[VFECMAXDEPTH][VFECMAXPACKET];
+    TFECStatistics Stats;
+} TFECEncoder;
+
+
+//
+// decoder state: one per incoming stream
+// a block is accumulated in "Current"; when complete it is recovered and
+// moved to "Ready" to be read out in sequence order.
+//
+typedef struct
+{
+    uint32_t GroupSize;
+    uint32_t Depth;
+    uint32_t PacketSize;                        // data packet length
+    bool BlockStarted;                          // true when Current holds a block
+    uint32_t BlockSeq;                          // sequence number of 1st packet in current block
+    bool HaveHistory;                           // true once a block has been released
+    uint32_t NextBlockSeq;                      // sequence number of block expected after the last released
+    uint8_t Data[VFECMAXBLOCK][VFECMAXPACKET];  // current block data packets
+    bool Present[VFECMAXBLOCK];
+    uint8_t Parity[VFECMAXDEPTH][VFECMAXPACKET];
+    bool ParityPresent[VFECMAXDEPTH];
+    uint32_t ParityCount;                       // parity packets received for current block
+    uint32_t Received;                          // one past the last data packet received in current block
+    uint32_t Released;                          // packets at the start of current block already released
+    uint8_t Ready[VFECMAXBLOCK][VFECMAXPACKET]; // released block, waiting to be read out
+    bool ReadyPresent[VFECMAXBLOCK];
+    uint32_t ReadySize;                         // packets in released block
+    uint32_t ReadyIndex;                        // next packet to read out
+    TFECStatistics Stats;
+} TFECDecoder;
+
+
+
+//
+// set the FEC configuration used by p2app for DDC output and TX I/Q input
+// GroupSize = 0 disables FEC. Returns true if the parameters are out of range.
+//
+bool FECSetConfiguration(uint32_t GroupSize, uint32_t Depth);
+
+
+//
+// return true if FEC has been enabled
+//
+bool FECIsEnabled(void);
+
+
+//
+// read back the FEC configuration
+//
+void FECGetConfiguration(uint32_t* GroupSize, uint32_t* Depth);
+
+
+//
+// initialise an encoder for a stream of fixed length data packets
+// void FECInitEncoder(TFECEncoder* Enc, uint32_t PacketSize, uint32_t GroupSize, uint32_t Depth)
+//
+void FECInitEncoder(TFECEncoder* Enc, uint32_t PacketSize, uint32_t GroupSize, uint32_t Depth);
+
+
+//
+// add one data packet to the encoder. Sequence number is read from bytes 0-3.
+// returns true when a block is complete: then the caller should fetch and send
+// Depth parity packets using FECGetParityPacket
+//
+bool FECEncodePacket(TFECEncoder* Enc, uint8_t* Packet);
+
+
+//
+// write parity packet for group "Group" of the last completed block into Dest
+// (which must be at least PacketSize + VFECHEADERSIZE bytes). Returns its length.
+//
+uint32_t FECGetParityPacket(TFECEncoder* Enc, uint32_t Group, uint8_t* Dest);
+
+
+//
+// initialise a decoder
+// void FECInitDecoder(TFECDecoder* Dec, uint32_t PacketSize, uint32_t GroupSize, uint32_t Depth)
+//
+void FECInitDecoder(TFECDecoder* Dec, uint32_t PacketSize, uint32_t GroupSize, uint32_t Depth);
+
+
+//
+// pass one received packet to the decoder. Data and parity packets are both accepted,
+// and told apart by length. Returns false if the packet isn't recognised.
+// after each call, read out released data packets with FECGetOutputPacket.
+//
+bool FECDecodePacket(TFECDecoder* Dec, uint8_t* Packet, uint32_t Length);
+
+
+//
+// release the current block, recovering what can be recovered
+// used at end of stream, so nothing is held back.
+//
+void FECFlushDecoder(TFECDecoder* Dec);
+
+
+//
+// return true if data packets of the current block are held back
+//
+bool FECIsHolding(TFECDecoder* Dec);
+
+
+//
+// the sender has paused part way through a block (eg at the end of a transmission):
+// release the data packets received so far without ending the block. Its later
+// packets and parity are still accepted, but packets released can't be rebuilt.
+//
+void FECFlushHeld(TFECDecoder* Dec);
+
+
+//
+// as FECFlushHeld, but the held packets are dropped instead of released
+//
+void FECDiscardHeld(TFECDecoder* Dec);
+
+
+//
+// get the next released data packet in sequence order, or NULL if none available
+//
+uint8_t* FECGetOutputPacket(TFECDecoder* Dec);
+
+
+//
+// print statistics: bandwidth overhead, CPU time per packet and residual loss
+//
+void FECPrintStatistics(char* Name, TFECStatistics* Stats);
+
+
+#endif
@@ -40,6 +40,14 @@
 //
 	int register_fd;                             // device identifier
 
+//
+// simulated register backend
+//
+#define VSIMREGSPACE 0x10000									// bytes of simulated register space
+	bool SimulatedRegisters = false;
+	uint32_t SimulatedRegisterSpace[VSIMREGSPACE / 4];
+	void (*RegisterWriteHook)(uint32_t Address, uint32_t Data) = NULL;
+
 
 
 
@@ -146,6 +154,9 @@ uint32_t RegisterRead(uint32_t Address)
 {
 	uint32_t result = 0;
 
+	if(SimulatedRegisters)
+		return SimulatedRegisterSpace[(Address % VSIMREGSPACE) / 4];
+
     ssize_t nread = pread(register_fd, &result, sizeof(result), (off_t) Address);
     if (nread != sizeof(result))
         printf("ERROR: register read: addr=0x%08X   error=%s\n",Address, strerror(errno));
@@ -158,9 +169,34 @@ uint32_t RegisterRead(uint32_t Address)
 //
 void RegisterWrite(uint32_t Address, uint32_t Data)
 {
-    ssize_t nsent = pwrite(register_fd, &Data, sizeof(Data), (off_t) Address); 
-    if (nsent != sizeof(Data))
-        printf("ERROR: Write: addr=0x%08X   error=%s\n",Address, strerror(errno));
+	if(SimulatedRegisters)
+		SimulatedRegisterSpace[(Address % VSIMREGSPACE) / 4] = Data;
+	else
+	{
+	    ssize_t nsent = pwrite(register_fd, &Data, sizeof(Data), (off_t) Address); 
+	    if (nsent != sizeof(Data))
+	        printf("ERROR: Write: addr=0x%08X   error=%s\n",Address, strerror(errno));
+	}
+	if(RegisterWriteHook != NULL)
+		(*RegisterWriteHook)(Address, Data);
+}
+
+
+//
+// enable or disable the simulated register backend
+//
+void EnableSimulatedRegisters(bool Enabled)
+{
+	SimulatedRegisters = Enabled;
+}
+
+
+//
+// set a function to be called after every register write; NULL to remove
+//
+void SetRegisterWriteHook(void (*Hook)(uint32_t Address, uint32_t Data))
+{
+	RegisterWriteHook = Hook;
 }
 
 
@@ -65,4 +65,18 @@ uint32_t RegisterRead(uint32_t Address);
 void RegisterWrite(uint32_t Address, uint32_t Data);
 
 
+//
+// simulated register backend: when enabled, register reads and writes
+// go to a memory copy of the register space instead of the FPGA
+// (for checking register level code without hardware)
+//
+void EnableSimulatedRegisters(bool Enabled);
+
+
+//
+// set a function to be called after every register write; NULL to remove
+//
+void SetRegisterWriteHook(void (*Hook)(uint32_t Address, uint32_t Data));
+
+
 #endif
@@ -0,0 +1,645 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// p2crypt.c:
+// authenticated encryption of protocol 2 datagrams for remote operation:
+// ChaCha20-Poly1305 (RFC 8439) with a pre-shared key, and replay protection.
+// see p2crypt.h for the sealed datagram format.
+//
+// ChaCha20 needs only 32 bit adds, XORs and rotates, so it is fast without
+// crypto instructions. The main version makes 4 blocks at once, with each
+// state word held for all 4 blocks in an array: the compiler turns the lane
+// loops into vector instructions (NEON on the Pi) at -O2 -ftree-vectorize.
+// Poly1305 uses 26 bit limbs, so it needs only 32x32 bit multiplies.
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include "../common/p2crypt.h"
+
+
+#define VCHACHALANES 4                                  // blocks made together
+#define VCHACHABLOCK 64
+
+
+//
+// helpers: little endian loads and stores
+//
+static uint32_t LoadLE32(const uint8_t* Src)
+{
+    return (uint32_t)Src[0] | ((uint32_t)Src[1] << 8) | ((uint32_t)Src[2] << 16) | ((uint32_t)Src[3] << 24);
+}
+
+static void StoreLE32(uint8_t* Dest, uint32_t Value)
+{
+    Dest[0] = (uint8_t)Value;
+    Dest[1] = (uint8_t)(Value >> 8);
+    Dest[2] = (uint8_t)(Value >> 16);
+    Dest[3] = (uint8_t)(Value >> 24);
+}
+
+#define ROTL32(X, N) (((X) << (N)) | ((X) >> (32 - (N))))
+
+
+//
+// expand a 32 byte key
+//
+void P2CryptSetKey(TP2CryptKey* Key, const uint8_t* KeyBytes)
+{
+    int Cntr;
+
+    for (Cntr = 0; Cntr < 8; Cntr++)
+        Key->Words[Cntr] = LoadLE32(KeyBytes + 4 * Cntr);
+}
+
+
+//
+// initial state for a block: constants, key, counter, nonce
+//
+static void ChaChaInitState(uint32_t* State, const TP2CryptKey* Key, uint32_t Counter, const uint8_t* Nonce)
+{
+    int Cntr;
+
+    State[0] = 0x61707865;                              // "expand 32-byte k"
+    State[1] = 0x3320646e;
+    State[2] = 0x79622d32;
+    State[3] = 0x6b206574;
+    for (Cntr = 0; Cntr < 8; Cntr++)
+        State[4 + Cntr] = Key->Words[Cntr];
+    State[12] = Counter;
+    State[13] = LoadLE32(Nonce);
+    State[14] = LoadLE32(Nonce + 4);
+    State[15] = LoadLE32(Nonce + 8);
+}
+
+
+#define QUARTERROUND(A, B, C, D)                                    \
+    X[A] += X[B]; X[D] ^= X[A]; X[D] = ROTL32(X[D], 16);            \
+    X[C] += X[D]; X[B] ^= X[C]; X[B] = ROTL32(X[B], 12);            \
+    X[A] += X[B]; X[D] ^= X[A]; X[D] = ROTL32(X[D], 8);             \
+    X[C] += X[D]; X[B] ^= X[C]; X[B] = ROTL32(X[B], 7);
+
+
+//
+// one 64 byte keystream block
+//
+void P2CryptChaCha20Block(const TP2CryptKey* Key, uint32_t Counter, const uint8_t* Nonce, uint8_t* Out)
+{
+    uint32_t State[16];
+    uint32_t X[16];
+    int Cntr;
+
+    ChaChaInitState(State, Key, Counter, Nonce);
+    memcpy(X, State, sizeof(X));
+    for (Cntr = 0; Cntr < 10; Cntr++)
+    {
+        QUARTERROUND(0, 4, 8, 12)
+        QUARTERROUND(1, 5, 9, 13)
+        QUARTERROUND(2, 6, 10, 14)
+        QUARTERROUND(3, 7, 11, 15)
+        QUARTERROUND(0, 5, 10, 15)
+        QUARTERROUND(1, 6, 11, 12)
+        QUARTERROUND(2, 7, 8, 13)
+        QUARTERROUND(3, 4, 9, 14)
+    }
+    for (Cntr = 0; Cntr < 16; Cntr++)
+        StoreLE32(Out + 4 * Cntr, X[Cntr] + State[Cntr]);
+}
+
+
+//
+// encrypt or decrypt, one block at a time
+//
+void P2CryptChaCha20XorReference(const TP2CryptKey* Key, uint32_t Counter, const uint8_t* Nonce,
+                                 const uint8_t* In, uint8_t* Out, uint32_t Length)
+{
+    uint8_t Block[VCHACHABLOCK];
+    uint32_t Cntr, Count;
+
+    while (Length != 0)
+    {
+        P2CryptChaCha20Block(Key, Counter++, Nonce, Block);
+        Count = (Length < VCHACHABLOCK) ? Length : VCHACHABLOCK;
+        for (Cntr = 0; Cntr < Count; Cntr++)
+            Out[Cntr] = In[Cntr] ^ Block[Cntr];
+        In += Count;
+        Out += Count;
+        Length -= Count;
+    }
+}
+
+
+//
+// 4 keystream blocks at once: X[word][lane]
+//
+#define QUARTERROUND4(A, B, C, D)                                   \
+    for (L = 0; L < VCHACHALANES; L++)                              \
+    {                                                               \
+        X[A][L] += X[B][L]; X[D][L] ^= X[A][L]; X[D][L] = ROTL32(X[D][L], 16);  \
+        X[C][L] += X[D][L]; X[B][L] ^= X[C][L]; X[B][L] = ROTL32(X[B][L], 12);  \
+        X[A][L] += X[B][L]; X[D][L] ^= X[A][L]; X[D][L] = ROTL32(X[D][L], 8);   \
+        X[C][L] += X[D][L]; X[B][L] ^= X[C][L]; X[B][L] = ROTL32(X[B][L], 7);   \
+    }
+
+static void ChaCha20Blocks4(const uint32_t* State, uint8_t* Out)
+{
+    uint32_t X[16][VCHACHALANES];
+    int Word, L, Round;
+
+    for (Word = 0; Word < 16; Word++)
+        for (L = 0; L < VCHACHALANES; L++)
+            X[Word][L] = State[Word] + ((Word == 12) ? (uint32_t)L : 0);
+    for (Round = 0; Round < 10; Round++)
+    {
+        QUARTERROUND4(0, 4, 8, 12)
+        QUARTERROUND4(1, 5, 9, 13)
+        QUARTERROUND4(2, 6, 10, 14)
+        QUARTERROUND4(3, 7, 11, 15)
+        QUARTERROUND4(0, 5, 10, 15)
+        QUARTERROUND4(1, 6, 11, 12)
+        QUARTERROUND4(2, 7, 8, 13)
+        QUARTERROUND4(3, 4, 9, 14)
+    }
+    for (L = 0; L < VCHACHALANES; L++)
+        for (Word = 0; Word < 16; Word++)
+            StoreLE32(Out + VCHACHABLOCK * L + 4 * Word, X[Word][L] + State[Word] + ((Word == 12) ? (uint32_t)L : 0));
+}
+
+
+//
+// encrypt or decrypt, 4 blocks at a time
+//
+void P2CryptChaCha20Xor(const TP2CryptKey* Key, uint32_t Counter, const uint8_t* Nonce,
+                        const uint8_t* In, uint8_t* Out, uint32_t Length)
+{
+    uint32_t State[16];
+    uint8_t Stream[VCHACHALANES * VCHACHABLOCK];
+    uint32_t Cntr, Count;
+
+    ChaChaInitState(State, Key, Counter, Nonce);
+    while (Length != 0)
+    {
+        ChaCha20Blocks4(State, Stream);
+        State[12] += VCHACHALANES;
+        Count = (Length < sizeof(Stream)) ? Length : sizeof(Stream);
+        for (Cntr = 0; Cntr < Count; Cntr++)
+            Out[Cntr] = In[Cntr] ^ Stream[Cntr];
+        In += Count;
+        Out += Count;
+        Length -= Count;
+    }
+}
+
+
+//
+// Poly1305 with 26 bit limbs
+//
+typedef struct
+{
+    uint32_t R[5];
+    uint32_t H[5];
+    uint32_t Pad[4];
+    uint8_t Buffer[16];
+    uint32_t Leftover;
+} TPoly1305;
+
+static void Poly1305Init(TPoly1305* Poly, const uint8_t* Key)
+{
+    Poly->R[0] = LoadLE32(Key) & 0x3ffffff;
+    Poly->R[1] = (LoadLE32(Key + 3) >> 2) & 0x3ffff03;
+    Poly->R[2] = (LoadLE32(Key + 6) >> 4) & 0x3ffc0ff;
+    Poly->R[3] = (LoadLE32(Key + 9) >> 6) & 0x3f03fff;
+    Poly->R[4] = (LoadLE32(Key + 12) >> 8) & 0x00fffff;
+    memset(Poly->H, 0, sizeof(Poly->H));
+    Poly->Pad[0] = LoadLE32(Key + 16);
+    Poly->Pad[1] = LoadLE32(Key + 20);
+    Poly->Pad[2] = LoadLE32(Key + 24);
+    Poly->Pad[3] = LoadLE32(Key + 28);
+    Poly->Leftover = 0;
+}
+
+//
+// process whole 16 byte blocks; HiBit is 0 for the padded last block
+//
+static void Poly1305Blocks(TPoly1305* Poly, const uint8_t* Message, uint32_t Length, uint32_t HiBit)
+{
+    uint32_t R0 = Poly->R[0], R1 = Poly->R[1], R2 = Poly->R[2], R3 = Poly->R[3], R4 = Poly->R[4];
+    uint32_t S1 = R1 * 5, S2 = R2 * 5, S3 = R3 * 5, S4 = R4 * 5;
+    uint32_t H0 = Poly->H[0], H1 = Poly->H[1], H2 = Poly->H[2], H3 = Poly->H[3], H4 = Poly->H[4];
+    uint64_t D0, D1, D2, D3, D4;
+    uint32_t Carry;
+
+    while (Length >= 16)
+    {
+        H0 += LoadLE32(Message) & 0x3ffffff;
+        H1 += (LoadLE32(Message + 3) >> 2) & 0x3ffffff;
+        H2 += (LoadLE32(Message + 6) >> 4) & 0x3ffffff;
+        H3 += (LoadLE32(Message + 9) >> 6) & 0x3ffffff;
+        H4 += (LoadLE32(Message + 12) >> 8) | HiBit;
+
+        D0 = (uint64_t)H0 * R0 + (uint64_t)H1 * S4 + (uint64_t)H2 * S3 + (uint64_t)H3 * S2 + (uint64_t)H4 * S1;
+        D1 = (uint64_t)H0 * R1 + (uint64_t)H1 * R0 + (uint64_t)H2 * S4 + (uint64_t)H3 * S3 + (uint64_t)H4 * S2;
+        D2 = (uint64_t)H0 * R2 + (uint64_t)H1 * R1 + (uint64_t)H2 * R0 + (uint64_t)H3 * S4 + (uint64_t)H4 * S3;
+        D3 = (uint64_t)H0 * R3 + (uint64_t)H1 * R2 + (uint64_t)H2 * R1 + (uint64_t)H3 * R0 + (uint64_t)H4 * S4;
+        D4 = (uint64_t)H0 * R4 + (uint64_t)H1 * R3 + (uint64_t)H2 * R2 + (uint64_t)H3 * R1 + (uint64_t)H4 * R0;
+
+        Carry = (uint32_t)(D0 >> 26); H0 = (uint32_t)D0 & 0x3ffffff;
+        D1 += Carry; Carry = (uint32_t)(D1 >> 26); H1 = (uint32_t)D1 & 0x3ffffff;
+        D2 += Carry; Carry = (uint32_t)(D2 >> 26); H2 = (uint32_t)D2 & 0x3ffffff;
+        D3 += Carry; Carry = (uint32_t)(D3 >> 26); H3 = (uint32_t)D3 & 0x3ffffff;
+        D4 += Carry; Carry = (uint32_t)(D4 >> 26); H4 = (uint32_t)D4 & 0x3ffffff;
+        H0 += Carry * 5; Carry = H0 >> 26; H0 &= 0x3ffffff;
+        H1 += Carry;
+
+        Message += 16;
+        Length -= 16;
+    }
+    Poly->H[0] = H0;
+    Poly->H[1] = H1;
+    Poly->H[2] = H2;
+    Poly->H[3] = H3;
+    Poly->H[4] = H4;
+}
+
+static void Poly1305Update(TPoly1305* Poly, const uint8_t* Message, uint32_t Length)
+{
+    uint32_t Count, Whole;
+
+    if (Poly->Leftover != 0)
+    {
+        Count = 16 - Poly->Leftover;
+        if (Count > Length)
+            Count = Length;
+        memcpy(Poly->Buffer + Poly->Leftover, Message, Count);
+        Poly->Leftover += Count;
+        Message += Count;
+        Length -= Count;
+        if (Poly->Leftover < 16)
+            return;
+        Poly1305Blocks(Poly, Poly->Buffer, 16, 1 << 24);
+        Poly->Leftover = 0;
+    }
+    Whole = Length & ~15U;
+    if (Whole != 0)
+        Poly1305Blocks(Poly, Message, Whole, 1 << 24);
+    if (Length > Whole)
+    {
+        memcpy(Poly->Buffer, Message + Whole, Length - Whole);
+        Poly->Leftover = Length - Whole;
+    }
+}
+
+static void Poly1305Finish(TPoly1305* Poly, uint8_t* Tag)
+{
+    uint32_t H0, H1, H2, H3, H4, G0, G1, G2, G3, G4;
+    uint32_t Carry, Mask;
+    uint64_t F;
+
+    if (Poly->Leftover != 0)
+    {
+        Poly->Buffer[Poly->Leftover] = 1;
+        memset(Poly->Buffer + Poly->Leftover + 1, 0, 15 - Poly->Leftover);
+        Poly1305Blocks(Poly, Poly->Buffer, 16, 0);
+    }
+    H0 = Poly->H[0]; H1 = Poly->H[1]; H2 = Poly->H[2]; H3 = Poly->H[3]; H4 = Poly->H[4];
+
+    //
+    // fully carry, then subtract p = 2^130 - 5 if h >= p
+    //
+    Carry = H1 >> 26; H1 &= 0x3ffffff;
+    H2 += Carry; Carry = H2 >> 26; H2 &= 0x3ffffff;
+    H3 += Carry; Carry = H3 >> 26; H3 &= 0x3ffffff;
+    H4 += Carry; Carry = H4 >> 26; H4 &= 0x3ffffff;
+    H0 += Carry * 5; Carry = H0 >> 26; H0 &= 0x3ffffff;
+    H1 += Carry;
+
+    G0 = H0 + 5; Carry = G0 >> 26; G0 &= 0x3ffffff;
+    G1 = H1 + Carry; Carry = G1 >> 26; G1 &= 0x3ffffff;
+    G2 = H2 + Carry; Carry = G2 >> 26; G2 &= 0x3ffffff;
+    G3 = H3 + Carry; Carry = G3 >> 26; G3 &= 0x3ffffff;
+    G4 = H4 + Carry - (1 << 26);
+
+    Mask = (G4 >> 31) - 1;                              // all ones if h >= p
+    H0 = (H0 & ~Mask) | (G0 & Mask);
+    H1 = (H1 & ~Mask) | (G1 & Mask);
+    H2 = (H2 & ~Mask) | (G2 & Mask);
+    H3 = (H3 & ~Mask) | (G3 & Mask);
+    H4 = (H4 & ~Mask) | (G4 & Mask);
+
+    //
+    // to 4 32 bit words, and add the pad
+    //
+    H0 = H0 | (H1 << 26);
+    H1 = (H1 >> 6) | (H2 << 20);
+    H2 = (H2 >> 12) | (H3 << 14);
+    H3 = (H3 >> 18) | (H4 << 8);
+    F = (uint64_t)H0 + Poly->Pad[0];               StoreLE32(Tag, (uint32_t)F);
+    F = (uint64_t)H1 + Poly->Pad[1] + (F >> 32);   StoreLE32(Tag + 4, (uint32_t)F);
+    F = (uint64_t)H2 + Poly->Pad[2] + (F >> 32);   StoreLE32(Tag + 8, (uint32_t)F);
+    F = (uint64_t)H3 + Poly->Pad[3] + (F >> 32);   StoreLE32(Tag + 12, (uint32_t)F);
+}
+
+
+//
+// one shot Poly1305
+//
+void P2CryptPoly1305(const uint8_t* OneTimeKey, const uint8_t* Message, uint32_t Length, uint8_t* Tag)
+{
+    TPoly1305 Poly;
+
+    Poly1305Init(&Poly, OneTimeKey);
+    Poly1305Update(&Poly, Message, Length);
+    Poly1305Finish(&Poly, Tag);
+}
+
+
+//
+// AEAD tag: Poly1305 over AAD, ciphertext (each padded to 16 bytes) and their lengths
+//
+static void AEADTag(const TP2CryptKey* Key, const uint8_t* Nonce, const uint8_t* AAD, uint32_t AADLength,
+                    const uint8_t* Cipher, uint32_t Length, uint8_t* Tag)
+{
+    TPoly1305 Poly;
+    uint8_t Block[VCHACHABLOCK];
+    uint8_t Zeros[16];
+    uint8_t Lengths[16];
+
+    P2CryptChaCha20Block(Key, 0, Nonce, Block);         // first 32 bytes are the one time key
+    Poly1305Init(&Poly, Block);
+    memset(Zeros, 0, sizeof(Zeros));
+    Poly1305Update(&Poly, AAD, AADLength);
+    Poly1305Update(&Poly, Zeros, (16 - (AADLength & 15)) & 15);
+    Poly1305Update(&Poly, Cipher, Length);
+    Poly1305Update(&Poly, Zeros, (16 - (Length & 15)) & 15);
+    memset(Lengths, 0, sizeof(Lengths));
+    StoreLE32(Lengths, AADLength);
+    StoreLE32(Lengths + 8, Length);
+    Poly1305Update(&Poly, Lengths, 16);
+    Poly1305Finish(&Poly, Tag);
+}
+
+
+//
+// AEAD seal: encrypt in place and write the tag
+//
+void P2CryptAEADSeal(const TP2CryptKey* Key, const uint8_t* Nonce, const uint8_t* AAD, uint32_t AADLength,
+                     uint8_t* Data, uint32_t Length, uint8_t* Tag)
+{
+    P2CryptChaCha20Xor(Key, 1, Nonce, Data, Data, Length);
+    AEADTag(Key, Nonce, AAD, AADLength, Data, Length, Tag);
+}
+
+
+//
+// AEAD open: check the tag (in constant time), then decrypt in place
+// returns true if the tag is wrong
+//
+bool P2CryptAEADOpen(const TP2CryptKey* Key, const uint8_t* Nonce, const uint8_t* AAD, uint32_t AADLength,
+                     uint8_t* Data, uint32_t Length, const uint8_t* Tag)
+{
+    uint8_t Expected[VP2CTAGSIZE];
+    uint8_t Difference = 0;
+    int Cntr;
+
+    AEADTag(Key, Nonce, AAD, AADLength, Data, Length, Expected);
+    for (Cntr = 0; Cntr < VP2CTAGSIZE; Cntr++)
+        Difference |= Expected[Cntr] ^ Tag[Cntr];
+    if (Difference != 0)
+        return true;
+    P2CryptChaCha20Xor(Key, 1, Nonce, Data, Data, Length);
+    return false;
+}
+
+
+//
+// derive the key for each direction: the first 32 bytes of a ChaCha20 block
+// keyed by the pre-shared key, with a label as the nonce
+//
+void P2CryptDeriveKeys(const uint8_t* PreSharedKey, TP2CryptKey* ToHost, TP2CryptKey* ToSDR)
+{
+    TP2CryptKey Master;
+    uint8_t Block[VCHACHABLOCK];
+    uint8_t Label[12];
+
+    P2CryptSetKey(&Master, PreSharedKey);
+    memset(Label, 0, sizeof(Label));
+    memcpy(Label, "P2 to host", 10);
+    P2CryptChaCha20Block(&Master, 0, Label, Block);
+    P2CryptSetKey(ToHost, Block);
+    memset(Label, 0, sizeof(Label));
+    memcpy(Label, "P2 to SDR", 9);
+    P2CryptChaCha20Block(&Master, 0, Label, Block);
+    P2CryptSetKey(ToSDR, Block);
+    memset(Block, 0, sizeof(Block));
+    memset(&Master, 0, sizeof(Master));
+}
+
+
+//
+// read a pre-shared key file: 64 hex digits (white space ignored)
+// returns true if error
+//
+bool P2CryptReadKeyFile(char* FileName, uint8_t* KeyBytes)
+{
+    FILE* File;
+    int Ch;
+    uint32_t Digits = 0;
+    uint8_t Value;
+
+    File = fopen(FileName, "r");
+    if (File == NULL)
+    {
+        perror("open key file");
+        return true;
+    }
+    memset(KeyBytes, 0, VP2CKEYSIZE);
+    while ((Ch = fgetc(File)) != EOF)
+    {
+        if (isspace(Ch))
+            continue;
+        if (!isxdigit(Ch) || (Digits >= 2 * VP2CKEYSIZE))
+        {
+            Digits = 0;
+            break;
+        }
+        Value = (uint8_t)(isdigit(Ch) ? Ch - '0' : tolower(Ch) - 'a' + 10);
+        KeyBytes[Digits / 2] |= (Digits & 1) ? Value : (uint8_t)(Value << 4);
+        Digits++;
+    }
+    fclose(File);
+    if (Digits != 2 * VP2CKEYSIZE)
+    {
+        printf("key file %s must hold %d hex digits\n", FileName, 2 * VP2CKEYSIZE);
+        memset(KeyBytes, 0, VP2CKEYSIZE);
+        return true;
+    }
+    return false;
+}
+
+
+//
+// clock time in ns
+//
+static uint64_t ClockNs(clockid_t Clock)
+{
+    struct timespec Now;
+
+    clock_gettime(Clock, &Now);
+    return (uint64_t)Now.tv_sec * 1000000000ULL + (uint64_t)Now.tv_nsec;
+}
+
+
+//
+// initialise a sender: the counter starts at the host clock time in ns
+//
+void P2CryptInitSender(TP2CryptSender* Sender, const TP2CryptKey* Key, uint32_t SenderId)
+{
+    Sender->Key = *Key;
+    Sender->SenderId = SenderId;
+    Sender->FirstCounter = ClockNs(CLOCK_REALTIME);
+    atomic_store(&Sender->Counter, Sender->FirstCounter);
+}
+
+
+//
+// initialise a receiver: counters from before it started (less the allowance) are dropped
+//
+void P2CryptInitReceiver(TP2CryptReceiver* Receiver, const TP2CryptKey* Key)
+{
+    memset(Receiver, 0, sizeof(TP2CryptReceiver));
+    Receiver->Key = *Key;
+    Receiver->Floor = ClockNs(CLOCK_REALTIME) - VP2CSTARTALLOWANCENS;
+}
+
+
+//
+// seal a datagram gathered from an iovec into Out
+// returns the sealed length, or -1 if it does not fit in OutSize
+//
+int P2CryptSeal(TP2CryptSender* Sender, const struct iovec* Iov, int IovCount, uint8_t* Out, uint32_t OutSize)
+{
+    uint32_t Length = 0;
+    uint64_t Counter, Now;
+    int Cntr;
+
+    for (Cntr = 0; Cntr < IovCount; Cntr++)
+        Length += Iov[Cntr].iov_len;
+    if (Length + VP2COVERHEAD > OutSize)
+        return -1;
+    Length = VP2CHEADERSIZE;
+    for (Cntr = 0; Cntr < IovCount; Cntr++)
+    {
+        memcpy(Out + Length, Iov[Cntr].iov_base, Iov[Cntr].iov_len);
+        Length += Iov[Cntr].iov_len;
+    }
+    //
+    // take the next counter, or the clock time if the counter has fallen too far behind
+    //
+    Now = ClockNs(CLOCK_REALTIME);
+    Counter = atomic_load(&Sender->Counter);
+    while (!atomic_compare_exchange_weak(&Sender->Counter, &Counter,
+                                         ((Now > Counter + VP2CMAXLAGNS) ? Now : Counter) + 1))
+        ;
+    if (Now > Counter + VP2CMAXLAGNS)
+        Counter = Now;
+    *(uint32_t*)Out = htonl(Sender->SenderId);
+    *(uint32_t*)(Out + 4) = htonl((uint32_t)(Counter >> 32));
+    *(uint32_t*)(Out + 8) = htonl((uint32_t)Counter);
+    P2CryptAEADSeal(&Sender->Key, Out, NULL, 0, Out + VP2CHEADERSIZE, Length - VP2CHEADERSIZE, Out + Length);
+    return (int)(Length + VP2CTAGSIZE);
+}
+
+
+//
+// open a sealed datagram: check the counter against the replay window of its
+// sender id, authenticate and decrypt, then update the window (only after the
+// tag is checked, so a forged datagram cannot move it)
+// returns the datagram length, or -1 if it is dropped
+//
+int P2CryptOpen(TP2CryptReceiver* Receiver, uint8_t* In, uint32_t Length, uint8_t* Out, uint32_t OutSize)
+{
+    TP2CryptReplaySlot* Slot = NULL;
+    uint32_t SenderId, DataLength, Cntr;
+    uint64_t Counter, Behind, Now;
+
+    if ((Length < VP2COVERHEAD) || (Length - VP2COVERHEAD > OutSize))
+    {
+        Receiver->Stats.Short++;
+        return -1;
+    }
+    DataLength = Length - VP2COVERHEAD;
+    SenderId = ntohl(*(uint32_t*)In);
+    Counter = ((uint64_t)ntohl(*(uint32_t*)(In + 4)) << 32) | ntohl(*(uint32_t*)(In + 8));
+    for (Cntr = 0; Cntr < VP2CREPLAYSLOTS; Cntr++)
+        if (Receiver->Slots[Cntr].Used && (Receiver->Slots[Cntr].SenderId == SenderId))
+            Slot = Receiver->Slots + Cntr;
+    if (Counter < Receiver->Floor)
+    {
+        Receiver->Stats.Replayed++;
+        return -1;
+    }
+    if ((Slot != NULL) && (Counter <= Slot->Highest))
+    {
+        Behind = Slot->Highest - Counter;
+        if ((Behind >= VP2CWINDOW) || (Slot->Window & (1ULL << Behind)))
+        {
+            Receiver->Stats.Replayed++;
+            return -1;
+        }
+    }
+    if (P2CryptAEADOpen(&Receiver->Key, In, NULL, 0, In + VP2CHEADERSIZE, DataLength, In + VP2CHEADERSIZE + DataLength))
+    {
+        Receiver->Stats.BadTag++;
+        return -1;
+    }
+
+    //
+    // a new sender id takes a free slot, or one idle for VP2CSLOTIDLENS; its
+    // old sender's counters can't then be replayed, as the floor is raised past
+    // them. If every slot is active, the new sender id is refused.
+    //
+    Now = ClockNs(CLOCK_MONOTONIC);
+    if (Slot == NULL)
+    {
+        for (Cntr = 0; Cntr < VP2CREPLAYSLOTS; Cntr++)
+            if (!Receiver->Slots[Cntr].Used || (Now - Receiver->Slots[Cntr].LastNs >= VP2CSLOTIDLENS))
+            {
+                Slot = Receiver->Slots + Cntr;
+                break;
+            }
+        if (Slot == NULL)
+        {
+            Receiver->Stats.NoSlot++;
+            return -1;
+        }
+        if (Slot->Used && (Slot->Highest >= Receiver->Floor))
+            Receiver->Floor = Slot->Highest + 1;
+        Slot->Used = true;
+        Slot->SenderId = SenderId;
+        Slot->Highest = Counter;
+        Slot->Window = 1;
+    }
+    else if (Counter > Slot->Highest)
+    {
+        Behind = Counter - Slot->Highest;
+        Slot->Window = (Behind >= VP2CWINDOW) ? 1 : (Slot->Window << Behind) | 1;
+        Slot->Highest = Counter;
+    }
+    else
+        Slot->Window |= 1ULL << (Slot->Highest - Counter);
+    Slot->LastNs = Now;
+    Receiver->Stats.Opened++;
+    memcpy(Out, In + VP2CHEADERSIZE, DataLength);
+    return (int)DataLength;
+}
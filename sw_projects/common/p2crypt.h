@@ -0,0 +1,174 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// p2crypt.h:
+// authenticated encryption of protocol 2 datagrams for remote operation:
+// ChaCha20-Poly1305 (RFC 8439) with a pre-shared key, and replay protection
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __p2crypt_h
+#define __p2crypt_h
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+#include "saturntypes.h"
+
+
+//
+// a sealed datagram is the P2 datagram encrypted, with a header in front and
+// an authentication tag after it:
+//
+// byte 0-3:   sender id (the sending socket's local port), network order
+// byte 4-11:  sender counter, network order
+// byte 12+:   ChaCha20 encrypted datagram
+// last 16:    Poly1305 tag
+//
+// bytes 0-11 are the AEAD nonce; they are authenticated as part of it.
+// each sender's counter starts at the host clock time (CLOCK_REALTIME) in ns
+// when it is created, and goes up by 1 for each datagram; if it falls more than
+// VP2CMAXLAGNS behind the clock it jumps forward to the clock. So a nonce is
+// never used twice with a key even after a restart, and a counter is never far
+// behind the sender's clock. Separate keys are derived from the pre-shared key
+// for each direction, so the two ends cannot collide either.
+// a receiver drops datagrams that fail authentication, any with a counter from
+// before VP2CSTARTALLOWANCENS ahead of the receiver's creation (so nothing
+// captured before a restart can be replayed), and any with a counter it has
+// seen, or that is more than VP2CWINDOW behind the highest from that sender id.
+// a receiver tracks VP2CREPLAYSLOTS sender ids. A new sender id is refused
+// while every slot has been used within VP2CSLOTIDLENS, so a genuine sender's
+// window can't be pushed out; when an idle slot is given up, counters up to
+// the highest it accepted are dropped from then on. The two hosts' clocks
+// must agree to within a few seconds (use NTP).
+//
+#define VP2CKEYSIZE 32
+#define VP2CHEADERSIZE 12
+#define VP2CTAGSIZE 16
+#define VP2COVERHEAD (VP2CHEADERSIZE + VP2CTAGSIZE)
+#define VP2CWINDOW 64                                   // replay window, datagrams
+#define VP2CREPLAYSLOTS 4                               // sender ids remembered by a receiver
+#define VP2CMAXLAGNS 1000000000ULL                      // sender counter kept within this of its clock
+#define VP2CSTARTALLOWANCENS 5000000000ULL              // counters accepted from this long before a receiver started:
+                                                        // sender lag plus clock difference between hosts
+#define VP2CSLOTIDLENS 10000000000ULL                   // a slot unused this long may go to a new sender id
+
+
+//
+// expanded key
+//
+typedef struct
+{
+    uint32_t Words[8];
+} TP2CryptKey;
+
+
+//
+// sending end of a stream. Counter is atomic, so threads can share a sender.
+//
+typedef struct
+{
+    TP2CryptKey Key;
+    uint32_t SenderId;
+    uint64_t FirstCounter;
+    _Atomic(uint64_t) Counter;
+} TP2CryptSender;
+
+
+//
+// receiving end
+//
+typedef struct
+{
+    uint32_t SenderId;
+    uint64_t Highest;                                   // highest counter accepted
+    uint64_t Window;                                    // bit n set if Highest - n accepted
+    uint64_t LastNs;                                    // CLOCK_MONOTONIC time of the last datagram accepted
+    bool Used;
+} TP2CryptReplaySlot;
+
+typedef struct
+{
+    uint64_t Opened;                                    // datagrams accepted
+    uint64_t BadTag;                                    // failed authentication (or not sealed)
+    uint64_t Replayed;                                  // seen before, or too old
+    uint64_t Short;                                     // too short, or too long for the buffer
+    uint64_t NoSlot;                                    // new sender id refused: every slot in use
+} TP2CryptStatistics;
+
+typedef struct
+{
+    TP2CryptKey Key;
+    TP2CryptReplaySlot Slots[VP2CREPLAYSLOTS];
+    uint64_t Floor;                                     // counters below this are dropped
+    TP2CryptStatistics Stats;
+} TP2CryptReceiver;
+
+
+//
+// ChaCha20 and Poly1305 building blocks (RFC 8439)
+// P2CryptChaCha20Xor encrypts or decrypts Length bytes, from block Counter.
+// the Reference version is plain one block at a time code; the other works
+// on 4 blocks at once, written so the compiler can vectorise it. They give
+// identical output.
+//
+void P2CryptSetKey(TP2CryptKey* Key, const uint8_t* KeyBytes);
+void P2CryptChaCha20Block(const TP2CryptKey* Key, uint32_t Counter, const uint8_t* Nonce, uint8_t* Out);
+void P2CryptChaCha20XorReference(const TP2CryptKey* Key, uint32_t Counter, const uint8_t* Nonce,
+                                 const uint8_t* In, uint8_t* Out, uint32_t Length);
+void P2CryptChaCha20Xor(const TP2CryptKey* Key, uint32_t Counter, const uint8_t* Nonce,
+                        const uint8_t* In, uint8_t* Out, uint32_t Length);
+void P2CryptPoly1305(const uint8_t* OneTimeKey, const uint8_t* Message, uint32_t Length, uint8_t* Tag);
+
+
+//
+// AEAD: encrypt Length bytes in place and write the tag; or check the tag
+// and decrypt in place. Open returns true if the tag is wrong (Data unchanged).
+//
+void P2CryptAEADSeal(const TP2CryptKey* Key, const uint8_t* Nonce, const uint8_t* AAD, uint32_t AADLength,
+                     uint8_t* Data, uint32_t Length, uint8_t* Tag);
+bool P2CryptAEADOpen(const TP2CryptKey* Key, const uint8_t* Nonce, const uint8_t* AAD, uint32_t AADLength,
+                     uint8_t* Data, uint32_t Length, const uint8_t* Tag);
+
+
+//
+// derive the key for each direction from the pre-shared key
+//
+void P2CryptDeriveKeys(const uint8_t* PreSharedKey, TP2CryptKey* ToHost, TP2CryptKey* ToSDR);
+
+
+//
+// read a pre-shared key file: 64 hex digits (white space ignored)
+// returns true if error
+//
+bool P2CryptReadKeyFile(char* FileName, uint8_t* KeyBytes);
+
+
+//
+// initialise the ends of a stream
+//
+void P2CryptInitSender(TP2CryptSender* Sender, const TP2CryptKey* Key, uint32_t SenderId);
+void P2CryptInitReceiver(TP2CryptReceiver* Receiver, const TP2CryptKey* Key);
+
+
+//
+// seal a datagram gathered from an iovec into Out
+// returns the sealed length, or -1 if it does not fit in OutSize
+//
+int P2CryptSeal(TP2CryptSender* Sender, const struct iovec* Iov, int IovCount, uint8_t* Out, uint32_t OutSize);
+
+
+//
+// open a sealed datagram: authenticate, check for replay, and decrypt into Out
+// (In is changed). returns the datagram length, or -1 if it is dropped
+//
+int P2CryptOpen(TP2CryptReceiver* Receiver, uint8_t* In, uint32_t Length, uint8_t* Out, uint32_t OutSize);
+
+
+#endif
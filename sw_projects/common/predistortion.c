@@ -0,0 +1,352 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// predistortion.c:
+// TX predistortion applied to DUC I/Q samples from client supplied
+// AM/AM and AM/PM tables
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include "../common/predistortion.h"
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+
+#define VPDMAXSAMPLE 8388607                        // largest 24 bit sample
+#define VPDMINSAMPLE (-8388608)
+#define VPDMAXCOEFF 32767
+#define VPDMAXFRAME 256                             // samples unpacked at a time
+
+
+//
+// get time in ns, for CPU load measurement
+//
+static uint64_t PDGetTimeNs(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (uint64_t)Now.tv_sec * 1000000000ULL + (uint64_t)Now.tv_nsec;
+}
+
+
+//
+// initialise a predistorter, disabled
+//
+void PDInit(TPredistorter* PD)
+{
+    memset(PD, 0, sizeof(TPredistorter));
+    atomic_init(&PD->Active, NULL);
+    atomic_init(&PD->InUse, NULL);
+}
+
+
+//
+// build a table from VPDPOINTS big endian points (as in the packet) and make it active
+// the table is built in a slot that is neither active nor held by the applying thread.
+// returns true if a point is invalid
+//
+bool PDLoadTable(TPredistorter* PD, uint8_t* Points, uint32_t Id)
+{
+    double Gain[VPDPOINTS], Phase[VPDPOINTS];
+    double Amplitude, Position, Fraction, G, P;
+    uint32_t Point, Entry, Slot;
+    TPDTable* Table = NULL;
+    TPDTable* Active;
+    TPDTable* InUse;
+    long Cr, Ci;
+
+    for (Point = 0; Point < VPDPOINTS; Point++)
+    {
+        Gain[Point] = (double)ntohs(*(uint16_t*)(Points + 4 * Point));
+        Phase[Point] = (double)(int16_t)ntohs(*(uint16_t*)(Points + 4 * Point + 2)) * M_PI / 32768.0;
+        if (Gain[Point] > VPDMAXCOEFF)
+        {
+            PD->Stats.Rejected++;
+            return true;
+        }
+    }
+
+    Active = atomic_load(&PD->Active);
+    InUse = atomic_load(&PD->InUse);
+    for (Slot = 0; Slot < VPDSLOTS; Slot++)
+        if ((&PD->Tables[Slot] != Active) && (&PD->Tables[Slot] != InUse))
+        {
+            Table = &PD->Tables[Slot];
+            break;
+        }
+
+    //
+    // LUT entry n covers power n to n+1 (in units of 2^VPDPOWERSHIFT) of the top 16 bits
+    // of I and Q. Take the amplitude at the centre of that range, and interpolate the points.
+    //
+    for (Entry = 0; Entry < VPDLUTSIZE; Entry++)
+    {
+        Amplitude = sqrt(((double)Entry + 0.5) * (double)(1 << VPDPOWERSHIFT)) / 32768.0;
+        Position = Amplitude * (VPDPOINTS - 1);
+        if (Position >= VPDPOINTS - 1)
+        {
+            G = Gain[VPDPOINTS - 1];
+            P = Phase[VPDPOINTS - 1];
+        }
+        else
+        {
+            Point = (uint32_t)Position;
+            Fraction = Position - Point;
+            G = Gain[Point] + Fraction * (Gain[Point + 1] - Gain[Point]);
+            P = Phase[Point] + Fraction * (Phase[Point + 1] - Phase[Point]);
+        }
+        Cr = lround(G * cos(P));
+        Ci = lround(G * sin(P));
+        Table->Cr[Entry] = (Cr > VPDMAXCOEFF) ? VPDMAXCOEFF : (Cr < -VPDMAXCOEFF) ? -VPDMAXCOEFF : (int32_t)Cr;
+        Table->Ci[Entry] = (Ci > VPDMAXCOEFF) ? VPDMAXCOEFF : (Ci < -VPDMAXCOEFF) ? -VPDMAXCOEFF : (int32_t)Ci;
+    }
+    Table->Id = Id;
+    atomic_store(&PD->Active, Table);
+    PD->Stats.Loads++;
+    return false;
+}
+
+
+//
+// stop applying predistortion
+//
+void PDDisable(TPredistorter* PD)
+{
+    atomic_store(&PD->Active, NULL);
+}
+
+
+//
+// handle a predistortion packet. returns true if invalid
+//
+bool PDHandlePacket(TPredistorter* PD, uint8_t* Buffer, uint32_t Size)
+{
+    uint32_t Id;
+
+    if (Size < VPDHEADERSIZE)
+    {
+        PD->Stats.Rejected++;
+        return true;
+    }
+    Id = ntohl(*(uint32_t*)(Buffer + 8));
+    switch (Buffer[5])
+    {
+        case 0:
+            if (Size != VPDPACKETSIZE)
+                break;
+            return PDLoadTable(PD, Buffer + VPDHEADERSIZE, Id);
+
+        case 1:
+            PDDisable(PD);
+            return false;
+
+        default:
+            break;
+    }
+    PD->Stats.Rejected++;
+    return true;
+}
+
+
+//
+// true if a table is active
+//
+bool PDIsEnabled(TPredistorter* PD)
+{
+    return atomic_load(&PD->Active) != NULL;
+}
+
+
+//
+// get the active table for the applying thread; it stays protected until the next call.
+// publish it in InUse, then check it is still active: if the loader swapped tables in
+// between, it may already be building into the one we read, so try again.
+// returns NULL if disabled
+//
+TPDTable* PDAcquireTable(TPredistorter* PD)
+{
+    TPDTable* Table;
+
+    do
+    {
+        Table = atomic_load(&PD->Active);
+        atomic_store(&PD->InUse, Table);
+    } while (atomic_load(&PD->Active) != Table);
+    return Table;
+}
+
+
+//
+// LUT index for one sample: power of the top 16 bits of I and Q
+//
+static inline uint32_t PDIndex(int32_t I, int32_t Q)
+{
+    int32_t I16 = I >> 8;
+    int32_t Q16 = Q >> 8;
+    uint32_t Power = (uint32_t)(I16 * I16) + (uint32_t)(Q16 * Q16);
+    uint32_t Index = Power >> VPDPOWERSHIFT;
+
+    return (Index > VPDLUTSIZE - 1) ? VPDLUTSIZE - 1 : Index;
+}
+
+
+//
+// round and saturate a product sum to 24 bits
+//
+static inline int32_t PDScale(int64_t Sum)
+{
+    Sum = (Sum + (1 << (VPDCOEFFBITS - 1))) >> VPDCOEFFBITS;
+    if (Sum > VPDMAXSAMPLE)
+        return VPDMAXSAMPLE;
+    if (Sum < VPDMINSAMPLE)
+        return VPDMINSAMPLE;
+    return (int32_t)Sum;
+}
+
+
+//
+// apply a table to Count samples in place: scalar reference implementation
+//
+void PDApplyReference(TPDTable* Table, int32_t* I, int32_t* Q, uint32_t Count)
+{
+    uint32_t Sample, Index;
+    int32_t SI, SQ;
+
+    for (Sample = 0; Sample < Count; Sample++)
+    {
+        SI = I[Sample];
+        SQ = Q[Sample];
+        Index = PDIndex(SI, SQ);
+        I[Sample] = PDScale((int64_t)SI * Table->Cr[Index] - (int64_t)SQ * Table->Ci[Index]);
+        Q[Sample] = PDScale((int64_t)SI * Table->Ci[Index] + (int64_t)SQ * Table->Cr[Index]);
+    }
+}
+
+
+//
+// apply a table to Count samples in place: NEON where available, else the reference
+// 4 samples at a time; the table lookup itself has to be scalar (no gather).
+//
+void PDApply(TPDTable* Table, int32_t* I, int32_t* Q, uint32_t Count)
+{
+#if defined(__ARM_NEON)
+    uint32_t Sample = 0;
+    uint32_t Index[4];
+    int32_t Cr[4], Ci[4];
+    int32x4_t VI, VQ, VCr, VCi, YI, YQ;
+    uint32x4_t I16, Q16, Power;
+    int64x2_t Lo, Hi;
+    const int32x4_t Max = vdupq_n_s32(VPDMAXSAMPLE);
+    const int32x4_t Min = vdupq_n_s32(VPDMINSAMPLE);
+    const uint32x4_t Last = vdupq_n_u32(VPDLUTSIZE - 1);
+
+    for (; Sample + 4 <= Count; Sample += 4)
+    {
+        VI = vld1q_s32(I + Sample);
+        VQ = vld1q_s32(Q + Sample);
+        I16 = vreinterpretq_u32_s32(vshrq_n_s32(VI, 8));
+        Q16 = vreinterpretq_u32_s32(vshrq_n_s32(VQ, 8));
+        Power = vmlaq_u32(vmulq_u32(I16, I16), Q16, Q16);
+        vst1q_u32(Index, vminq_u32(vshrq_n_u32(Power, VPDPOWERSHIFT), Last));
+        Cr[0] = Table->Cr[Index[0]];  Ci[0] = Table->Ci[Index[0]];
+        Cr[1] = Table->Cr[Index[1]];  Ci[1] = Table->Ci[Index[1]];
+        Cr[2] = Table->Cr[Index[2]];  Ci[2] = Table->Ci[Index[2]];
+        Cr[3] = Table->Cr[Index[3]];  Ci[3] = Table->Ci[Index[3]];
+        VCr = vld1q_s32(Cr);
+        VCi = vld1q_s32(Ci);
+
+        // I out = I*Cr - Q*Ci
+        Lo = vmlsl_s32(vmull_s32(vget_low_s32(VI), vget_low_s32(VCr)), vget_low_s32(VQ), vget_low_s32(VCi));
+        Hi = vmlsl_s32(vmull_s32(vget_high_s32(VI), vget_high_s32(VCr)), vget_high_s32(VQ), vget_high_s32(VCi));
+        YI = vcombine_s32(vqmovn_s64(vrshrq_n_s64(Lo, VPDCOEFFBITS)), vqmovn_s64(vrshrq_n_s64(Hi, VPDCOEFFBITS)));
+        // Q out = I*Ci + Q*Cr
+        Lo = vmlal_s32(vmull_s32(vget_low_s32(VI), vget_low_s32(VCi)), vget_low_s32(VQ), vget_low_s32(VCr));
+        Hi = vmlal_s32(vmull_s32(vget_high_s32(VI), vget_high_s32(VCi)), vget_high_s32(VQ), vget_high_s32(VCr));
+        YQ = vcombine_s32(vqmovn_s64(vrshrq_n_s64(Lo, VPDCOEFFBITS)), vqmovn_s64(vrshrq_n_s64(Hi, VPDCOEFFBITS)));
+
+        vst1q_s32(I + Sample, vminq_s32(vmaxq_s32(YI, Min), Max));
+        vst1q_s32(Q + Sample, vminq_s32(vmaxq_s32(YQ, Min), Max));
+    }
+    PDApplyReference(Table, I + Sample, Q + Sample, Count - Sample);
+#else
+    PDApplyReference(Table, I, Q, Count);
+#endif
+}
+
+
+//
+// apply the active table in place to Count P2 format samples (24 bit I then 24 bit Q, big endian)
+// returns false if predistortion is disabled (samples unchanged)
+//
+bool PDApplyP2Samples(TPredistorter* PD, uint8_t* Samples, uint32_t Count)
+{
+    TPDTable* Table;
+    int32_t I[VPDMAXFRAME], Q[VPDMAXFRAME];
+    uint32_t Sample, Block;
+    uint64_t StartTime, Elapsed;
+    uint8_t* Ptr;
+
+    Table = PDAcquireTable(PD);
+    if (Table == NULL)
+        return false;
+
+    StartTime = PDGetTimeNs();
+    PD->Stats.Samples += Count;
+    while (Count != 0)
+    {
+        Block = (Count > VPDMAXFRAME) ? VPDMAXFRAME : Count;
+        Ptr = Samples;
+        for (Sample = 0; Sample < Block; Sample++)
+        {
+            I[Sample] = (int32_t)(((uint32_t)Ptr[0] << 24) | ((uint32_t)Ptr[1] << 16) | ((uint32_t)Ptr[2] << 8)) >> 8;
+            Q[Sample] = (int32_t)(((uint32_t)Ptr[3] << 24) | ((uint32_t)Ptr[4] << 16) | ((uint32_t)Ptr[5] << 8)) >> 8;
+            Ptr += 6;
+        }
+        PDApply(Table, I, Q, Block);
+        for (Sample = 0; Sample < Block; Sample++)
+        {
+            *Samples++ = (uint8_t)(I[Sample] >> 16);
+            *Samples++ = (uint8_t)(I[Sample] >> 8);
+            *Samples++ = (uint8_t)I[Sample];
+            *Samples++ = (uint8_t)(Q[Sample] >> 16);
+            *Samples++ = (uint8_t)(Q[Sample] >> 8);
+            *Samples++ = (uint8_t)Q[Sample];
+        }
+        Count -= Block;
+    }
+    Elapsed = PDGetTimeNs() - StartTime;
+    PD->Stats.ProcessingNs += Elapsed;
+    if (Elapsed > PD->Stats.MaxFrameNs)
+        PD->Stats.MaxFrameNs = Elapsed;
+    PD->Stats.Frames++;
+    PD->Stats.LastId = Table->Id;
+    return true;
+}
+
+
+//
+// print statistics
+//
+void PDPrintStatistics(char* Name, TPDStatistics* Stats)
+{
+    double NsPerSample = 0.0;
+
+    if (Stats->Samples != 0)
+        NsPerSample = (double)Stats->ProcessingNs / (double)Stats->Samples;
+    printf("predistortion %s: %llu samples, CPU=%.1fns/sample, max frame=%.1fus, %llu tables loaded (last id %u), %llu rejected\n",
+           Name, (unsigned long long)Stats->Samples, NsPerSample, (double)Stats->MaxFrameNs / 1000.0,
+           (unsigned long long)Stats->Loads, Stats->LastId, (unsigned long long)Stats->Rejected);
+}
@@ -0,0 +1,160 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// predistortion.h:
+// TX predistortion applied to DUC I/Q samples from client supplied
+// AM/AM and AM/PM tables
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __predistortion_h
+#define __predistortion_h
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "saturntypes.h"
+
+
+#define VPDPACKETID 0x12                            // command byte of a predistortion packet (port 1024)
+#define VPDHEADERSIZE 16                            // bytes before the table points
+#define VPDPOINTS 128                               // AM/AM and AM/PM points uploaded
+#define VPDPACKETSIZE (VPDHEADERSIZE + 4 * VPDPOINTS)
+#define VPDLUTSIZE 1024                             // complex gain entries, indexed by sample power
+#define VPDCOEFFBITS 14                             // fractional bits of a complex gain (16384 = unity)
+#define VPDPOWERSHIFT 21                            // power (from top 16 bits of I and Q) to LUT index
+#define VPDSLOTS 3                                  // tables held; one is always free to load
+
+
+//
+// predistortion packet, on port 1024 (all fields big endian):
+// bytes 0-3    sequence number
+// byte 4       0x12
+// byte 5       command: 0 = load table and apply it; 1 = stop predistortion
+// bytes 6-7    0
+// bytes 8-11   table identifier (reported back in statistics)
+// bytes 12-15  0
+// bytes 16-527 (load only) 128 points, 4 bytes each:
+//              16 bit AM/AM gain (16384 = unity, must be below 32768)
+//              16 bit signed AM/PM phase (32768 = pi radians)
+// point k applies at input amplitude k/127 of full scale; above full scale
+// the last point applies. A disable packet may be 60 bytes.
+//
+// on the device, the points become a 1024 entry table of complex gains indexed
+// by the power of the top 16 bits of I and Q. Each output sample is
+// y = x * C[index], rounded and saturated to 24 bits; this integer definition
+// is what the NEON code and the scalar reference both compute, bit for bit.
+//
+
+
+//
+// one complex gain table
+//
+typedef struct
+{
+    int32_t Cr[VPDLUTSIZE];                         // real part, VPDCOEFFBITS fraction
+    int32_t Ci[VPDLUTSIZE];                         // imaginary part
+    uint32_t Id;                                    // client table identifier
+} TPDTable;
+
+
+//
+// predistortion statistics
+//
+typedef struct
+{
+    uint64_t Samples;                               // samples predistorted
+    uint64_t Frames;                                // calls to PDApplyP2Samples that applied a table
+    uint64_t ProcessingNs;                          // time spent applying tables
+    uint64_t MaxFrameNs;                            // longest single call
+    uint64_t Loads;                                 // tables loaded
+    uint64_t Rejected;                              // invalid packets
+    uint32_t LastId;                                // identifier of the table last applied
+} TPDStatistics;
+
+
+//
+// predistorter: tables are loaded by one thread and applied by one other.
+// the applying thread publishes the table it is using in InUse; the loading
+// thread builds into a slot that is neither active nor in use, then swaps the
+// Active pointer, so a frame is always processed by one complete table.
+//
+typedef struct
+{
+    TPDTable Tables[VPDSLOTS];
+    _Atomic(TPDTable*) Active;                      // table to apply; NULL if disabled
+    _Atomic(TPDTable*) InUse;                       // table the applying thread holds
+    TPDStatistics Stats;
+} TPredistorter;
+
+
+//
+// initialise a predistorter, disabled
+//
+void PDInit(TPredistorter* PD);
+
+
+//
+// build a table from VPDPOINTS big endian points (as in the packet) and make it active
+// returns true if a point is invalid
+//
+bool PDLoadTable(TPredistorter* PD, uint8_t* Points, uint32_t Id);
+
+
+//
+// stop applying predistortion
+//
+void PDDisable(TPredistorter* PD);
+
+
+//
+// handle a predistortion packet. returns true if invalid
+//
+bool PDHandlePacket(TPredistorter* PD, uint8_t* Buffer, uint32_t Size);
+
+
+//
+// true if a table is active
+//
+bool PDIsEnabled(TPredistorter* PD);
+
+
+//
+// get the active table for the applying thread; it stays protected until the next call
+// returns NULL if disabled
+//
+TPDTable* PDAcquireTable(TPredistorter* PD);
+
+
+//
+// apply a table to Count samples in place: scalar reference implementation
+//
+void PDApplyReference(TPDTable* Table, int32_t* I, int32_t* Q, uint32_t Count);
+
+
+//
+// apply a table to Count samples in place: NEON where available, else the reference
+// the result is identical to PDApplyReference
+//
+void PDApply(TPDTable* Table, int32_t* I, int32_t* Q, uint32_t Count);
+
+
+//
+// apply the active table in place to Count P2 format samples (24 bit I then 24 bit Q, big endian)
+// returns false if predistortion is disabled (samples unchanged)
+//
+bool PDApplyP2Samples(TPredistorter* PD, uint8_t* Samples, uint32_t Count);
+
+
+//
+// print statistics
+//
+void PDPrintStatistics(char* Name, TPDStatistics* Stats);
+
+
+#endif
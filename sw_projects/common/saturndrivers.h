@@ -22,6 +22,12 @@
 #include "../P2_app/InDUCIQ.h"
 
 
+//
+// true once the FIFO size table (DMAFIFODepths) matches the firmware
+//
+extern bool GFIFOSizesInitialised;
+
+
 //
 // void SetupFIFOMonitorChannel(EDMAStreamSelect Channel, bool EnableInterrupt);
 //
@@ -23,6 +23,7 @@
 #include <semaphore.h>
 #include "version.h"
 #include <stdio.h>
+#include <string.h>
 
 //
 // semaphores to protect registers that are accessed from several threads
@@ -197,16 +198,6 @@ uint32_t DDCRegisters[VNUMDDC] =
 
 
 
-
-
-//
-// ALEX SPI registers
-//
-#define VOFFSETALEXTXFILTREG 0                          // offset addr in IP core: TX filt, RX ant
-#define VOFFSETALEXRXREG 4                              // offset addr in IP core
-#define VOFFSETALEXTXANTREG 8                           // offset addr in IP core: TX filt, TX ant
-
-
 //
 // bit addresses in status and GPIO registers
 //
@@ -583,6 +574,32 @@ uint32_t GetDDCEnables(void)
 }
 
 
+//
+// uint32_t GetP2TotalSampleRate(void)
+// get the sum of the sample rates of all enabled DDCs, in KHz
+// this is the rate at which I/Q samples arrive in the DDC FIFO
+//
+uint32_t GetP2TotalSampleRate(void)
+{
+    uint32_t DDC;
+    uint32_t Total = 0;
+
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+        Total += P2SampleRates[DDC];
+    return Total;
+}
+
+
+//
+// uint32_t GetP2SampleRate(unsigned int DDC)
+// get the sample rate of one DDC, in KHz; 0 if disabled
+//
+uint32_t GetP2SampleRate(unsigned int DDC)
+{
+    return P2SampleRates[DDC];
+}
+
+
 //
 // SetClassEPA(bool IsClassE)
 // enables non linear PA mode
@@ -1128,16 +1145,9 @@ void EnablePPSStamp(bool Enabled)
 //
 void SetTXDriveLevel(unsigned int Level)
 {
-    uint32_t RegisterValue = 0;
-    uint32_t DACDrive, AttenDrive;
+    uint32_t RegisterValue;
 
-    Level &= 0xFF;                                  // make sure 8 bits only
-    DACDrive = DACCurrentROM[Level];                // get PWM
-    AttenDrive = DACStepAttenROM[Level];            // get step atten
-    RegisterValue = DACDrive;                       // set drive level when RX
-    RegisterValue |= (DACDrive << 8);               // set drive level when TX
-    RegisterValue |= (AttenDrive << 16);            // set step atten when RX
-    RegisterValue |= (AttenDrive << 24);            // set step atten when TX
+    RegisterValue = TXDriveRegister(Level);
     GTXDACCtrl = RegisterValue;
     RegisterWrite(VADDRDACCTRLREG, RegisterValue);  // and write to it
 }
@@ -2347,4 +2357,257 @@ void UseTestDDSSource(void)
     DDCInSelReg = (DDCInSelReg & 0x40000000) | 0x000AAAAA;      // set all to test
     sem_post(&DDCInSelMutex);
 
-}
\ No newline at end of file
+}
+
+//
+// table of the local copies of register settings, so they can be passed to
+// another process that takes over the hardware without re-initialising it
+// (the ROMs and FIFO sizes are recalculated, so they aren't included).
+// Each entry's name and size make up the layout hash, so two builds only
+// exchange shadows if their tables match entry for entry.
+//
+#define VSHADOW(Var) { &(Var), sizeof(Var), #Var }
+static const struct
+{
+    void* Addr;
+    uint32_t Size;
+    const char* Name;
+} ShadowTable[] =
+{
+    VSHADOW(DDCDeltaPhase), VSHADOW(DUCDeltaPhase), VSHADOW(TestSourceDeltaPhase),
+    VSHADOW(GStatusRegister), VSHADOW(GPIORegValue), VSHADOW(TXConfigRegValue),
+    VSHADOW(DDCInSelReg), VSHADOW(DDCRateReg), VSHADOW(GADCOverride),
+    VSHADOW(GByteSwapEnabled), VSHADOW(GPTTEnabled), VSHADOW(MOXAsserted),
+    VSHADOW(GPureSignalEnabled), VSHADOW(P1SampleRate), VSHADOW(P2SampleRates),
+    VSHADOW(GDDCEnabled), VSHADOW(GClassESetting), VSHADOW(GIsApollo),
+    VSHADOW(GEnableApolloFilter), VSHADOW(GEnableApolloATU), VSHADOW(GStartApolloAutoTune),
+    VSHADOW(GPPSEnabled), VSHADOW(GTXDACCtrl), VSHADOW(GRXADCCtrl),
+    VSHADOW(GAlexRXOut), VSHADOW(GAlexTXFiltRegister), VSHADOW(GAlexTXAntRegister),
+    VSHADOW(GAlexRXRegister), VSHADOW(GRX2GroundDuringTX), VSHADOW(GAlexCoarseAttenuatorBits),
+    VSHADOW(GAlexManualFilterSelect), VSHADOW(GEnableAlexTXRXRelay), VSHADOW(GCWKeysReversed),
+    VSHADOW(GCWKeyerSpeed), VSHADOW(GCWKeyerMode), VSHADOW(GCWKeyerWeight),
+    VSHADOW(GCWKeyerSpacing), VSHADOW(GCWIambicKeyerEnabled), VSHADOW(GIambicConfigReg),
+    VSHADOW(GCWKeyerSetup), VSHADOW(GClassEPWMMin), VSHADOW(GClassEPWMMax),
+    VSHADOW(GCodecConfigReg), VSHADOW(GSidetoneEnabled), VSHADOW(GSidetoneVolume),
+    VSHADOW(GWidebandADC1), VSHADOW(GWidebandADC2), VSHADOW(GWidebandSampleCount),
+    VSHADOW(GWidebandUpdateRate), VSHADOW(GWidebandControl), VSHADOW(GAlexEnabledBits),
+    VSHADOW(GPAEnabled), VSHADOW(GTXDACCount), VSHADOW(GDUCSampleRate),
+    VSHADOW(GDUCSampleSize), VSHADOW(GDUCPhaseShift), VSHADOW(GSpeakerMuted),
+    VSHADOW(GCWXMode), VSHADOW(GCWXDot), VSHADOW(GCWXDash),
+    VSHADOW(GDashPressed), VSHADOW(GDotPressed), VSHADOW(GCWEnabled),
+    VSHADOW(GBreakinEnabled), VSHADOW(GUserOutputBits), VSHADOW(GTXAmplScaleFactor),
+    VSHADOW(GTXAlwaysEnabled), VSHADOW(GTXIQInterleaved), VSHADOW(GTXDUCMuxActive),
+    VSHADOW(GEEREnabled), VSHADOW(GTXModulationSource), VSHADOW(GTXProtocolP2),
+    VSHADOW(TXModulationTestReg), VSHADOW(GEnableTimeStamping), VSHADOW(GEnableVITA49),
+    VSHADOW(GCWKeyerRampms), VSHADOW(GCWKeyerRamp_IsP2), VSHADOW(GNumADCs),
+    VSHADOW(GCodecLineGain), VSHADOW(GCodecAnaloguePath)
+};
+#define VNUMSHADOWS (sizeof(ShadowTable) / sizeof(ShadowTable[0]))
+
+
+//
+// RegisterShadowSize(void)
+// bytes needed to save the register shadow copies
+//
+uint32_t RegisterShadowSize(void)
+{
+    uint32_t Size = 0;
+    uint32_t Entry;
+
+    for (Entry = 0; Entry < VNUMSHADOWS; Entry++)
+        Size += ShadowTable[Entry].Size;
+    return Size;
+}
+
+
+//
+// RegisterShadowLayout(void)
+// hash (FNV-1a) of the name and size of each register shadow, in table order
+//
+uint32_t RegisterShadowLayout(void)
+{
+    uint32_t Hash = 2166136261U;
+    uint32_t Entry, Cntr;
+    const char* Name;
+
+    for (Entry = 0; Entry < VNUMSHADOWS; Entry++)
+    {
+        for (Name = ShadowTable[Entry].Name; *Name != 0; Name++)
+            Hash = (Hash ^ (uint8_t)*Name) * 16777619U;
+        for (Cntr = 0; Cntr < 4; Cntr++)
+            Hash = (Hash ^ ((ShadowTable[Entry].Size >> (8 * Cntr)) & 0xFF)) * 16777619U;
+    }
+    return Hash;
+}
+
+
+//
+// SaveRegisterShadows(uint8_t* Buffer)
+// copy the register shadow copies into a buffer of RegisterShadowSize() bytes
+//
+void SaveRegisterShadows(uint8_t* Buffer)
+{
+    uint32_t Entry;
+
+    sem_wait(&DDCInSelMutex);                           // settle any change in progress
+    sem_wait(&RFGPIOMutex);
+    for (Entry = 0; Entry < VNUMSHADOWS; Entry++)
+    {
+        memcpy(Buffer, ShadowTable[Entry].Addr, ShadowTable[Entry].Size);
+        Buffer += ShadowTable[Entry].Size;
+    }
+    sem_post(&RFGPIOMutex);
+    sem_post(&DDCInSelMutex);
+}
+
+
+//
+// RestoreRegisterShadows(uint8_t* Buffer, uint32_t Size, uint32_t Layout)
+// load the register shadow copies saved by another process; the registers are not written
+// returns true if the saved size or layout hash doesn't match this build's table
+//
+bool RestoreRegisterShadows(uint8_t* Buffer, uint32_t Size, uint32_t Layout)
+{
+    uint32_t Entry;
+
+    if ((Size != RegisterShadowSize()) || (Layout != RegisterShadowLayout()))
+        return true;
+    for (Entry = 0; Entry < VNUMSHADOWS; Entry++)
+    {
+        memcpy(ShadowTable[Entry].Addr, Buffer, ShadowTable[Entry].Size);
+        Buffer += ShadowTable[Entry].Size;
+    }
+    return false;
+}
+
+
+//
+// TXDriveRegister(unsigned int Level)
+// DAC control register value for a drive level 0-255 (as SetTXDriveLevel)
+//
+uint32_t TXDriveRegister(unsigned int Level)
+{
+    uint32_t RegisterValue = 0;
+    uint32_t DACDrive, AttenDrive;
+
+    Level &= 0xFF;                                  // make sure 8 bits only
+    DACDrive = DACCurrentROM[Level];                // get PWM
+    AttenDrive = DACStepAttenROM[Level];            // get step atten
+    RegisterValue = DACDrive;                       // set drive level when RX
+    RegisterValue |= (DACDrive << 8);               // set drive level when TX
+    RegisterValue |= (AttenDrive << 16);            // set step atten when RX
+    RegisterValue |= (AttenDrive << 24);            // set step atten when TX
+    return RegisterValue;
+}
+
+
+//
+// ADCAttenRegister(...)
+// ADC control register value for RX and TX attenuations of both ADCs, dB
+// (as SetADCAttenuator): 5 bits each, ADC1 RX, ADC1 TX, ADC2 RX, ADC2 TX
+//
+uint32_t ADCAttenRegister(unsigned int ADC1RX, unsigned int ADC1TX, unsigned int ADC2RX, unsigned int ADC2TX)
+{
+    return (ADC1RX & 0x1F) | ((ADC1TX & 0x1F) << 5) | ((ADC2RX & 0x1F) << 10) | ((ADC2TX & 0x1F) << 15);
+}
+
+
+//
+// BandOutputBits(unsigned int OCBits, bool XvtrEnabled)
+// GPIO register bits for the open collector outputs (bits 6:0 of OCBits) and transverter enable
+//
+uint32_t BandOutputBits(unsigned int OCBits, bool XvtrEnabled)
+{
+    uint32_t Bits;
+
+    Bits = (OCBits & 0b1111111) << VOPENCOLLECTORBITS;
+    if(XvtrEnabled)
+        Bits |= (1 << VXVTRENABLEBIT);
+    return Bits;
+}
+
+#define VBANDOUTPUTMASK ((0b1111111 << VOPENCOLLECTORBITS) | (1 << VXVTRENABLEBIT))
+
+
+//
+// GetBandRegisters(TBandRegisters* Image)
+// copy the current settings of all band registers
+//
+void GetBandRegisters(TBandRegisters* Image)
+{
+    sem_wait(&RFGPIOMutex);
+    Image->Mask = VBANDALL;
+    memcpy(Image->DDCDeltaPhase, DDCDeltaPhase, sizeof(DDCDeltaPhase));
+    Image->DUCDeltaPhase = DUCDeltaPhase;
+    Image->AlexTXAnt = GAlexTXAntRegister;
+    Image->AlexTXFilt = GAlexTXFiltRegister;
+    Image->AlexRX = GAlexRXRegister;
+    Image->Outputs = GPIORegValue & VBANDOUTPUTMASK;
+    Image->ADCAtten = GRXADCCtrl;
+    Image->Drive = GTXDACCtrl;
+    sem_post(&RFGPIOMutex);
+}
+
+
+//
+// write one band register and its local copy, if it is in Mask and has changed
+//
+static void WriteBandRegister(uint32_t Mask, uint32_t* Copy, uint32_t Address, uint32_t Value, uint32_t* Writes)
+{
+    if((Mask != 0) && (*Copy != Value))
+    {
+        *Copy = Value;
+        RegisterWrite(Address, Value);
+        (*Writes)++;
+    }
+}
+
+
+//
+// ApplyBandRegisters(TBandRegisters* Image, uint32_t* Writes)
+// write the band registers in Image that differ from their current settings, in
+// one burst. If any attenuation rises, the attenuators go before the relays,
+// so neither band's signals reach the ADC with less attenuation than it needs.
+// The Alex registers are only written if the client selects filters manually;
+// otherwise the FPGA selects them, and their bits are cleared from Image->Mask.
+// The GPIO mutex is held throughout, so MOX can't change part way through.
+// returns true (and writes nothing) if MOX is asserted
+//
+bool ApplyBandRegisters(TBandRegisters* Image, uint32_t* Writes)
+{
+    uint32_t Mask;
+    uint32_t DDC;
+    uint32_t Field;
+    uint32_t Register;
+    bool AttenFirst = false;
+
+    *Writes = 0;
+    sem_wait(&RFGPIOMutex);                         // get protected access
+    if(MOXAsserted)
+    {
+        sem_post(&RFGPIOMutex);
+        return true;
+    }
+    if(!GAlexManualFilterSelect)
+        Image->Mask &= ~(VBANDALEXTXANT | VBANDALEXTXFILT | VBANDALEXRX);
+    Mask = Image->Mask;
+    for(Field = 0; Field < 20; Field += 5)
+        if(((Image->ADCAtten >> Field) & 0x1F) > ((GRXADCCtrl >> Field) & 0x1F))
+            AttenFirst = true;
+
+    if(AttenFirst)
+        WriteBandRegister(Mask & VBANDADCATTEN, &GRXADCCtrl, VADDRADCCTRLREG, Image->ADCAtten, Writes);
+    WriteBandRegister(Mask & VBANDALEXTXANT, &GAlexTXAntRegister, VADDRALEXSPIREG+VOFFSETALEXTXANTREG, Image->AlexTXAnt, Writes);
+    WriteBandRegister(Mask & VBANDALEXTXFILT, &GAlexTXFiltRegister, VADDRALEXSPIREG+VOFFSETALEXTXFILTREG, Image->AlexTXFilt, Writes);
+    WriteBandRegister(Mask & VBANDALEXRX, &GAlexRXRegister, VADDRALEXSPIREG+VOFFSETALEXRXREG, Image->AlexRX, Writes);
+    Register = (GPIORegValue & ~VBANDOUTPUTMASK) | (Image->Outputs & VBANDOUTPUTMASK);
+    WriteBandRegister(Mask & VBANDOUTPUTS, &GPIORegValue, VADDRRFGPIOREG, Register, Writes);
+    if(!AttenFirst)
+        WriteBandRegister(Mask & VBANDADCATTEN, &GRXADCCtrl, VADDRADCCTRLREG, Image->ADCAtten, Writes);
+    for(DDC = 0; DDC < VNUMDDC; DDC++)
+        WriteBandRegister(Mask & (1 << DDC), &DDCDeltaPhase[DDC], DDCRegisters[DDC], Image->DDCDeltaPhase[DDC], Writes);
+    WriteBandRegister(Mask & VBANDDUC, &DUCDeltaPhase, VADDRTXDUCREG, Image->DUCDeltaPhase, Writes);
+    WriteBandRegister(Mask & VBANDDRIVE, &GTXDACCtrl, VADDRDACCTRLREG, Image->Drive, Writes);
+    sem_post(&RFGPIOMutex);                         // clear protected access
+    return false;
+}
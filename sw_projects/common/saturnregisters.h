@@ -116,6 +116,9 @@ typedef enum
 #define VADDRFIFOMONBASE 0x9000
 #define VADDRALEXADCBASE 0xA000
 #define VADDRALEXSPIREG 0x0B000
+#define VOFFSETALEXTXFILTREG 0                          // ALEX SPI register offsets in IP core: TX filt, RX ant
+#define VOFFSETALEXRXREG 4
+#define VOFFSETALEXTXANTREG 8                           // TX filt, TX ant
 #define VADDRBOARDID1 0xC000
 #define VADDRBOARDID2 0xC004
 #define VADDRCONFIGSPIREG 0x10000
@@ -260,6 +263,21 @@ bool WriteP2DDCRateRegister(void);
 uint32_t GetDDCEnables(void);
 
 
+//
+// uint32_t GetP2TotalSampleRate(void)
+// get the sum of the sample rates of all enabled DDCs, in KHz
+// this is the rate at which I/Q samples arrive in the DDC FIFO
+//
+uint32_t GetP2TotalSampleRate(void);
+
+
+//
+// uint32_t GetP2SampleRate(unsigned int DDC)
+// get the sample rate of one DDC, in KHz; 0 if disabled
+//
+uint32_t GetP2SampleRate(unsigned int DDC);
+
+
 //
 // SetClassEPA(bool IsClassE)
 // enables non linear PA mode
@@ -905,6 +923,78 @@ void SetDDCSampleSize(unsigned int DDC, unsigned int Size);
 void UseTestDDSSource(void);
 
 
+//
+// register shadow copies, for handing the hardware to another process:
+// RegisterShadowSize: bytes needed to save them
+// RegisterShadowLayout: hash of the name and size of each, in the order saved
+// SaveRegisterShadows: copy them to a buffer of that size
+// RestoreRegisterShadows: load them without writing the registers; true if the size or layout doesn't match
+//
+uint32_t RegisterShadowSize(void);
+uint32_t RegisterShadowLayout(void);
+void SaveRegisterShadows(uint8_t* Buffer);
+bool RestoreRegisterShadows(uint8_t* Buffer, uint32_t Size, uint32_t Layout);
+
+
+//
+// band register image: the registers that change with band or antenna, as
+// the values to be written. Mask says which are included; the rest are left alone.
+//
+#define VBANDDDCMASK 0x3FF                          // bits 9:0: DDC0-9 frequency
+#define VBANDDUC (1 << 10)
+#define VBANDALEXTXANT (1 << 11)
+#define VBANDALEXTXFILT (1 << 12)
+#define VBANDALEXRX (1 << 13)
+#define VBANDOUTPUTS (1 << 14)                      // open collector and transverter bits
+#define VBANDADCATTEN (1 << 15)
+#define VBANDDRIVE (1 << 16)
+#define VBANDALL 0x1FFFF
+
+typedef struct
+{
+    uint32_t Mask;
+    uint32_t DDCDeltaPhase[VNUMDDC];
+    uint32_t DUCDeltaPhase;
+    uint32_t AlexTXAnt;
+    uint32_t AlexTXFilt;
+    uint32_t AlexRX;
+    uint32_t Outputs;                               // open collector and transverter bits of the GPIO register
+    uint32_t ADCAtten;                              // ADC control register: RX and TX attenuators
+    uint32_t Drive;                                 // DAC control register
+} TBandRegisters;
+
+
+//
+// register values for a band image, in the format the setters use:
+// TXDriveRegister: drive level 0-255, as SetTXDriveLevel
+// ADCAttenRegister: 5 bit attenuations, dB
+// BandOutputBits: 7 open collector bits in bits 6:0, and transverter enable
+//
+uint32_t TXDriveRegister(unsigned int Level);
+uint32_t ADCAttenRegister(unsigned int ADC1RX, unsigned int ADC1TX, unsigned int ADC2RX, unsigned int ADC2TX);
+uint32_t BandOutputBits(unsigned int OCBits, bool XvtrEnabled);
+
+
+//
+// GetBandRegisters(TBandRegisters* Image)
+// copy the current settings of all band registers
+//
+void GetBandRegisters(TBandRegisters* Image);
+
+
+//
+// ApplyBandRegisters(TBandRegisters* Image, uint32_t* Writes)
+// write the registers in Image that differ from their current settings, in
+// one burst, in the order: ADC attenuators (if any attenuation rises), Alex TX
+// antenna, TX filter and RX registers, open collector outputs, ADC attenuators
+// (if not already written), DDC and DUC frequencies, TX drive. The Alex
+// registers are left alone (and cleared from Image->Mask) unless manual
+// filter selection is enabled. Writes gets the number of registers written.
+// returns true (and writes nothing) if MOX is asserted: relays are not switched during TX
+//
+bool ApplyBandRegisters(TBandRegisters* Image, uint32_t* Writes);
+
+
 
 
 
@@ -0,0 +1,325 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// spectrum.c:
+// panadapter spectrum frames calculated from DDC I/Q samples:
+// windowed, averaged FFT power, sent as compact log power packets
+//
+// the FFT is a radix 2 decimation in time FFT in single precision float.
+// samples are windowed as they arrive and written to bit reversed locations,
+// so no separate reordering pass is needed. The butterfly loops are simple
+// unit stride loops that the compiler can vectorise (NEON on the Pi).
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <arpa/inet.h>
+#include "../common/spectrum.h"
+
+
+#define VP2FULLSCALE 8388608.0f                 // 2^23
+
+
+//
+// initialise spectrum calculation. FFTSize must be a power of 2.
+// returns true if error
+//
+bool SpectrumInit(TSpectrum* Spec, uint32_t FFTSize, uint32_t FramesPerSecond, uint32_t Averages)
+{
+    uint32_t Cntr, Bit, Reversed;
+    double Angle, WindowSum;
+
+    memset(Spec, 0, sizeof(TSpectrum));
+    if ((FFTSize < VSPECMINFFT) || (FFTSize > VSPECMAXFFT) || ((FFTSize & (FFTSize - 1)) != 0)
+        || (FramesPerSecond == 0) || (FramesPerSecond > VSPECMAXRATE)
+        || (Averages == 0) || (Averages > VSPECMAXAVERAGES))
+        return true;
+
+    Spec->FFTSize = FFTSize;
+    Spec->FramesPerSecond = FramesPerSecond;
+    Spec->Averages = Averages;
+    while ((1U << Spec->Log2Size) < FFTSize)
+        Spec->Log2Size++;
+
+    Spec->Window = malloc(FFTSize * sizeof(float));
+    Spec->Twiddle = malloc(FFTSize * sizeof(float));
+    Spec->BitReverse = malloc(FFTSize * sizeof(uint32_t));
+    Spec->Work = malloc(2 * FFTSize * sizeof(float));
+    Spec->PowerSum = malloc(FFTSize * sizeof(double));
+    Spec->Frame = malloc(FFTSize * sizeof(int16_t));
+    if (!Spec->Window || !Spec->Twiddle || !Spec->BitReverse || !Spec->Work || !Spec->PowerSum || !Spec->Frame)
+    {
+        SpectrumFree(Spec);
+        return true;
+    }
+
+    //
+    // 4 term Blackman-Harris window: sidelobes below -92dB
+    //
+    WindowSum = 0.0;
+    for (Cntr = 0; Cntr < FFTSize; Cntr++)
+    {
+        Angle = 2.0 * M_PI * (double)Cntr / (double)FFTSize;
+        Spec->Window[Cntr] = (float)(0.35875 - 0.48829 * cos(Angle) + 0.14128 * cos(2.0 * Angle) - 0.01168 * cos(3.0 * Angle));
+        WindowSum += Spec->Window[Cntr];
+    }
+    Spec->WindowPower = WindowSum * WindowSum;
+
+    for (Cntr = 0; Cntr < FFTSize / 2; Cntr++)
+    {
+        Angle = -2.0 * M_PI * (double)Cntr / (double)FFTSize;
+        Spec->Twiddle[2 * Cntr] = (float)cos(Angle);
+        Spec->Twiddle[2 * Cntr + 1] = (float)sin(Angle);
+    }
+    for (Cntr = 0; Cntr < FFTSize; Cntr++)
+    {
+        Reversed = 0;
+        for (Bit = 0; Bit < Spec->Log2Size; Bit++)
+            if (Cntr & (1U << Bit))
+                Reversed |= 1U << (Spec->Log2Size - 1 - Bit);
+        Spec->BitReverse[Cntr] = Reversed;
+    }
+    SpectrumRestart(Spec);
+    return false;
+}
+
+
+//
+// free memory allocated by SpectrumInit
+//
+void SpectrumFree(TSpectrum* Spec)
+{
+    free(Spec->Window);
+    free(Spec->Twiddle);
+    free(Spec->BitReverse);
+    free(Spec->Work);
+    free(Spec->PowerSum);
+    free(Spec->Frame);
+    Spec->Window = NULL;
+    Spec->Twiddle = NULL;
+    Spec->BitReverse = NULL;
+    Spec->Work = NULL;
+    Spec->PowerSum = NULL;
+    Spec->Frame = NULL;
+    Spec->FFTSize = 0;
+}
+
+
+//
+// discard partial data: the next sample starts a new frame
+//
+void SpectrumRestart(TSpectrum* Spec)
+{
+    Spec->SlotPosition = 0;
+    Spec->AveragesDone = 0;
+    Spec->SampleRate = 0;                           // force slot length recalculation
+    memset(Spec->PowerSum, 0, Spec->FFTSize * sizeof(double));
+}
+
+
+//
+// set slot length for a new sample rate
+// if FFTs can't be fitted into the frame period the frame rate falls
+//
+static void SetSlotLength(TSpectrum* Spec, uint32_t SampleRate)
+{
+    Spec->SampleRate = SampleRate;
+    Spec->SlotLength = (SampleRate * 1000U) / (Spec->FramesPerSecond * Spec->Averages);
+    if (Spec->SlotLength < Spec->FFTSize)
+        Spec->SlotLength = Spec->FFTSize;
+}
+
+
+//
+// in place radix 2 FFT of bit reversed input
+//
+static void FFT(TSpectrum* Spec)
+{
+    uint32_t Half, Step, Group, Cntr;
+    float* Work = Spec->Work;
+    float* Twiddle;
+    float* Top;
+    float* Bottom;
+    float Re, Im;
+
+    for (Half = 1, Step = Spec->FFTSize / 2; Half < Spec->FFTSize; Half *= 2, Step /= 2)
+    {
+        for (Group = 0; Group < Spec->FFTSize; Group += 2 * Half)
+        {
+            Top = Work + 2 * Group;
+            Bottom = Top + 2 * Half;
+            Twiddle = Spec->Twiddle;
+            for (Cntr = 0; Cntr < Half; Cntr++)
+            {
+                Re = Bottom[0] * Twiddle[0] - Bottom[1] * Twiddle[1];
+                Im = Bottom[0] * Twiddle[1] + Bottom[1] * Twiddle[0];
+                Bottom[0] = Top[0] - Re;
+                Bottom[1] = Top[1] - Im;
+                Top[0] += Re;
+                Top[1] += Im;
+                Top += 2;
+                Bottom += 2;
+                Twiddle += 2 * Step;
+            }
+        }
+    }
+}
+
+
+//
+// accumulate power of the FFT just completed; if enough, make a frame
+// returns true if a frame has been completed
+//
+static bool AccumulateFFT(TSpectrum* Spec)
+{
+    uint32_t Cntr, Bin;
+    double Scale, Power, dB;
+    float* Work = Spec->Work;
+
+    FFT(Spec);
+    for (Cntr = 0; Cntr < Spec->FFTSize; Cntr++)
+        Spec->PowerSum[Cntr] += (double)(Work[2 * Cntr] * Work[2 * Cntr] + Work[2 * Cntr + 1] * Work[2 * Cntr + 1]);
+    if (++Spec->AveragesDone < Spec->Averages)
+        return false;
+
+    //
+    // frame complete: scale so a full scale tone is 0dB, and reorder -Fs/2 first
+    //
+    Scale = 1.0 / (Spec->WindowPower * (double)Spec->Averages);
+    for (Cntr = 0; Cntr < Spec->FFTSize; Cntr++)
+    {
+        Bin = (Cntr + Spec->FFTSize / 2) & (Spec->FFTSize - 1);
+        Power = Spec->PowerSum[Bin] * Scale;
+        dB = 10.0 * log10(Power + 1.0e-30) * VSPECDBSCALE;
+        if (dB < -32768.0)
+            dB = -32768.0;
+        if (dB > 32767.0)
+            dB = 32767.0;
+        Spec->Frame[Cntr] = (int16_t)lrint(dB);
+    }
+    memset(Spec->PowerSum, 0, Spec->FFTSize * sizeof(double));
+    Spec->AveragesDone = 0;
+    Spec->FrameNumber++;
+    return true;
+}
+
+
+//
+// add one sample. returns true if a frame has been completed
+//
+static inline bool AddSample(TSpectrum* Spec, float I, float Q)
+{
+    uint32_t Position = Spec->SlotPosition;
+    uint32_t Dest;
+    bool FrameDone = false;
+
+    if (Position < Spec->FFTSize)
+    {
+        Dest = 2 * Spec->BitReverse[Position];
+        Spec->Work[Dest] = I * Spec->Window[Position];
+        Spec->Work[Dest + 1] = Q * Spec->Window[Position];
+        if (Position == Spec->FFTSize - 1)
+            FrameDone = AccumulateFFT(Spec);
+    }
+    if (++Position >= Spec->SlotLength)
+        Position = 0;
+    Spec->SlotPosition = Position;
+    return FrameDone;
+}
+
+
+//
+// add P2 format I/Q samples (24 bit I then 24 bit Q, big endian)
+// returns true if a new frame has been completed
+//
+bool SpectrumAddP2Samples(TSpectrum* Spec, uint8_t* Src, uint32_t Count, uint32_t SampleRate)
+{
+    uint32_t Cntr;
+    int32_t I, Q;
+    bool FrameDone = false;
+
+    if (SampleRate != Spec->SampleRate)
+        SetSlotLength(Spec, SampleRate);
+    for (Cntr = 0; Cntr < Count; Cntr++)
+    {
+        //
+        // skip samples between FFTs without converting them
+        //
+        if (Spec->SlotPosition >= Spec->FFTSize)
+        {
+            if (++Spec->SlotPosition >= Spec->SlotLength)
+                Spec->SlotPosition = 0;
+        }
+        else
+        {
+            I = (int32_t)(((uint32_t)Src[0] << 24) | ((uint32_t)Src[1] << 16) | ((uint32_t)Src[2] << 8)) >> 8;
+            Q = (int32_t)(((uint32_t)Src[3] << 24) | ((uint32_t)Src[4] << 16) | ((uint32_t)Src[5] << 8)) >> 8;
+            FrameDone |= AddSample(Spec, (float)I / VP2FULLSCALE, (float)Q / VP2FULLSCALE);
+        }
+        Src += 6;
+    }
+    return FrameDone;
+}
+
+
+//
+// add I/Q samples as interleaved doubles (full scale = 1.0)
+// returns true if a new frame has been completed
+//
+bool SpectrumAddSamples(TSpectrum* Spec, double* IQ, uint32_t Count, uint32_t SampleRate)
+{
+    uint32_t Cntr;
+    bool FrameDone = false;
+
+    if (SampleRate != Spec->SampleRate)
+        SetSlotLength(Spec, SampleRate);
+    for (Cntr = 0; Cntr < Count; Cntr++)
+        FrameDone |= AddSample(Spec, (float)IQ[2 * Cntr], (float)IQ[2 * Cntr + 1]);
+    return FrameDone;
+}
+
+
+//
+// number of packets needed for one frame
+//
+uint32_t SpectrumPacketCount(TSpectrum* Spec)
+{
+    return (Spec->FFTSize + VSPECBINSPERPACKET - 1) / VSPECBINSPERPACKET;
+}
+
+
+//
+// write one packet of the latest frame. returns packet length in bytes
+//
+uint32_t SpectrumMakePacket(TSpectrum* Spec, uint32_t PacketIndex, uint32_t SequenceNumber, uint8_t* Dest)
+{
+    uint32_t FirstBin, Bins, Cntr;
+    uint16_t* BinPtr;
+
+    FirstBin = PacketIndex * VSPECBINSPERPACKET;
+    if (FirstBin >= Spec->FFTSize)
+        return 0;
+    Bins = Spec->FFTSize - FirstBin;
+    if (Bins > VSPECBINSPERPACKET)
+        Bins = VSPECBINSPERPACKET;
+
+    *(uint32_t*)Dest = htonl(SequenceNumber);
+    *(uint32_t*)(Dest + 4) = htonl(Spec->FrameNumber);
+    *(uint16_t*)(Dest + 8) = htons((uint16_t)Spec->FFTSize);
+    *(uint16_t*)(Dest + 10) = htons((uint16_t)FirstBin);
+    *(uint16_t*)(Dest + 12) = 0;
+    *(uint16_t*)(Dest + 14) = htons((uint16_t)Bins);
+    BinPtr = (uint16_t*)(Dest + VSPECHEADERSIZE);
+    for (Cntr = 0; Cntr < Bins; Cntr++)
+        *BinPtr++ = htons((uint16_t)Spec->Frame[FirstBin + Cntr]);
+    return VSPECHEADERSIZE + 2 * Bins;
+}
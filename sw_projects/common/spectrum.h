@@ -0,0 +1,121 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// spectrum.h:
+// panadapter spectrum frames calculated from DDC I/Q samples:
+// windowed, averaged FFT power, sent as compact log power packets
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __spectrum_h
+#define __spectrum_h
+
+#include <stdint.h>
+#include "saturntypes.h"
+
+
+#define VSPECMINFFT 256                             // smallest FFT size
+#define VSPECMAXFFT 8192                            // largest FFT size
+#define VSPECMAXAVERAGES 64                         // most FFTs averaged per frame
+#define VSPECMAXRATE 50                             // most frames per second
+#define VSPECBINSPERPACKET 512                      // bins in one UDP packet
+#define VSPECHEADERSIZE 16                          // bytes before bin data
+#define VSPECPACKETSIZE (VSPECHEADERSIZE + 2 * VSPECBINSPERPACKET)
+#define VSPECDBSCALE 100.0                          // bin units per dB
+
+
+//
+// spectrum packet (sent on the DDC I/Q port in place of I/Q packets)
+// the header matches the layout of a DDC I/Q packet so a client can tell them apart:
+// bytes 0-3    sequence number (shared with the DDC I/Q sequence)
+// bytes 4-7    spectrum frame number
+// bytes 8-9    FFT size
+// bytes 10-11  index of 1st bin in this packet
+// bytes 12-13  0 (bits per sample in an I/Q packet)
+// bytes 14-15  bins in this packet
+// then 2 bytes per bin: signed power in 0.01dB relative to a full scale tone.
+// bins run from -Fs/2 to +Fs/2; bin FFTSize/2 is the DDC centre frequency.
+// all fields big endian.
+//
+
+
+//
+// spectrum calculation for one DDC
+// each frame period is divided into one slot per average; the first FFTSize
+// samples of each slot are transformed, so CPU load depends on the frame rate
+// and averaging, not the DDC sample rate
+//
+typedef struct
+{
+    uint32_t FFTSize;
+    uint32_t Log2Size;
+    uint32_t FramesPerSecond;
+    uint32_t Averages;
+    uint32_t SampleRate;                            // ksps; slot length is recalculated if it changes
+    uint32_t SlotLength;                            // samples per slot
+    uint32_t SlotPosition;                          // samples into the current slot
+    uint32_t AveragesDone;                          // FFTs accumulated in current frame
+    uint32_t FrameNumber;                           // frames completed
+    double WindowPower;                             // (sum of window)^2, for full scale normalisation
+    float* Window;
+    float* Twiddle;                                 // cos, sin pairs for FFTSize/2 angles
+    uint32_t* BitReverse;
+    float* Work;                                    // interleaved re, im
+    double* PowerSum;
+    int16_t* Frame;                                 // completed frame, 0.01dB units, -Fs/2 first
+} TSpectrum;
+
+
+//
+// initialise spectrum calculation. FFTSize must be a power of 2.
+// returns true if error
+//
+bool SpectrumInit(TSpectrum* Spec, uint32_t FFTSize, uint32_t FramesPerSecond, uint32_t Averages);
+
+
+//
+// free memory allocated by SpectrumInit
+//
+void SpectrumFree(TSpectrum* Spec);
+
+
+//
+// discard partial data: the next sample starts a new frame
+//
+void SpectrumRestart(TSpectrum* Spec);
+
+
+//
+// add P2 format I/Q samples (24 bit I then 24 bit Q, big endian)
+// SampleRate in ksps.
+// returns true if a new frame has been completed
+//
+bool SpectrumAddP2Samples(TSpectrum* Spec, uint8_t* Src, uint32_t Count, uint32_t SampleRate);
+
+
+//
+// add I/Q samples as interleaved doubles (full scale = 1.0)
+// returns true if a new frame has been completed
+//
+bool SpectrumAddSamples(TSpectrum* Spec, double* IQ, uint32_t Count, uint32_t SampleRate);
+
+
+//
+// number of packets needed for one frame
+//
+uint32_t SpectrumPacketCount(TSpectrum* Spec);
+
+
+//
+// write one packet of the latest frame. returns packet length in bytes
+//
+uint32_t SpectrumMakePacket(TSpectrum* Spec, uint32_t PacketIndex, uint32_t SequenceNumber, uint8_t* Dest);
+
+
+#endif
@@ -0,0 +1,268 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// toneanalysis.c:
+// measure a single test tone in complex I/Q samples:
+// frequency, amplitude, SNR and sample continuity
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "../common/toneanalysis.h"
+
+
+#define VP2FULLSCALE 8388608.0                  // 2^23
+#define VTONEJUMPMIN 0.01                       // smallest phase step error (radians) counted as a jump
+#define VTONEJUMPSIGMA 10.0                     // jump threshold, in robust standard deviations
+
+
+//
+// convert P2 format I/Q samples (24 bit I then 24 bit Q, big endian) to
+// interleaved doubles; full scale = 1.0
+//
+void UnpackP2IQSamples(uint8_t* Src, uint32_t Count, double* IQ)
+{
+    uint32_t Cntr;
+    int32_t Sample;
+
+    for (Cntr = 0; Cntr < Count * 2; Cntr++)
+    {
+        Sample = (int32_t)(((uint32_t)Src[0] << 24) | ((uint32_t)Src[1] << 16) | ((uint32_t)Src[2] << 8)) >> 8;
+        IQ[Cntr] = (double)Sample / VP2FULLSCALE;
+        Src += 3;
+    }
+}
+
+
+//
+// write one 24 bit sample, big endian, with clipping
+//
+static void WriteP2Sample(uint8_t* Dest, double Value)
+{
+    int32_t Sample;
+
+    Value = Value * VP2FULLSCALE;
+    if (Value > VP2FULLSCALE - 1.0)
+        Value = VP2FULLSCALE - 1.0;
+    if (Value < -VP2FULLSCALE)
+        Value = -VP2FULLSCALE;
+    Sample = (int32_t)lrint(Value);
+    Dest[0] = (uint8_t)(Sample >> 16);
+    Dest[1] = (uint8_t)(Sample >> 8);
+    Dest[2] = (uint8_t)Sample;
+}
+
+
+//
+// gaussian random number, Box-Muller
+//
+static double GaussianNoise(void)
+{
+    double U1, U2;
+
+    U1 = ((double)rand() + 1.0) / ((double)RAND_MAX + 2.0);
+    U2 = (double)rand() / ((double)RAND_MAX + 1.0);
+    return sqrt(-2.0 * log(U1)) * cos(2.0 * M_PI * U2);
+}
+
+
+//
+// synthesise a tone in P2 24 bit format, for offline checks.
+//
+void SynthesiseP2Tone(uint8_t* Dest, uint32_t Count, uint64_t StartSample, double SampleRate,
+                      double Frequency, double Amplitude, double NoiseRMS)
+{
+    uint32_t Cntr;
+    double Phase;
+    double Step;
+
+    Step = 2.0 * M_PI * Frequency / SampleRate;
+    for (Cntr = 0; Cntr < Count; Cntr++)
+    {
+        Phase = fmod(Step * (double)(StartSample + Cntr), 2.0 * M_PI);
+        WriteP2Sample(Dest, Amplitude * cos(Phase) + NoiseRMS * GaussianNoise());
+        WriteP2Sample(Dest + 3, Amplitude * sin(Phase) + NoiseRMS * GaussianNoise());
+        Dest += 6;
+    }
+}
+
+
+//
+// compare function for qsort of doubles
+//
+static int CompareDouble(const void* A, const void* B)
+{
+    double X = *(const double*)A;
+    double Y = *(const double*)B;
+
+    return (X > Y) - (X < Y);
+}
+
+
+//
+// wrap a phase into -pi to +pi
+//
+static double WrapPhase(double Phase)
+{
+    while (Phase > M_PI)
+        Phase -= 2.0 * M_PI;
+    while (Phase < -M_PI)
+        Phase += 2.0 * M_PI;
+    return Phase;
+}
+
+
+//
+// analyse complex samples (interleaved I, Q) containing a single tone
+// 1. the phase step between samples gives a first estimate of frequency;
+// 2. steps that differ from it by much more than the noise are discontinuities;
+// 3. the mean of the remaining steps gives the frequency;
+// 4. for each continuous segment, the tone is fitted by least squares; the
+//    fitted amplitude and the residual give amplitude and SNR.
+// returns true if too few samples to analyse
+//
+bool AnalyseTone(double* IQ, uint32_t Count, double SampleRate, TToneAnalysis* Result)
+{
+    double* Steps;
+    double* Deviation;
+    double SumRe, SumIm, Re, Im;
+    double Step, Threshold, Sigma;
+    double StepSum;
+    uint32_t StepCount;
+    uint32_t Cntr, SegStart, SegEnd;
+    bool InJump;
+    double Omega;
+    double SignalPower, NoisePower;
+    double FitRe, FitIm, CosW, SinW, ModelRe, ModelIm, Phase;
+
+    memset(Result, 0, sizeof(TToneAnalysis));
+    if (Count < VTONEMINSAMPLES)
+        return true;
+    Steps = malloc(Count * sizeof(double));
+    Deviation = malloc(Count * sizeof(double));
+    if ((Steps == NULL) || (Deviation == NULL))
+    {
+        free(Steps);
+        free(Deviation);
+        return true;
+    }
+
+    //
+    // phase step per sample; weighted mean gives 1st frequency estimate
+    //
+    SumRe = 0.0;
+    SumIm = 0.0;
+    for (Cntr = 1; Cntr < Count; Cntr++)
+    {
+        Re = IQ[2*Cntr] * IQ[2*Cntr-2] + IQ[2*Cntr+1] * IQ[2*Cntr-1];          // x[n] * conj(x[n-1])
+        Im = IQ[2*Cntr+1] * IQ[2*Cntr-2] - IQ[2*Cntr] * IQ[2*Cntr-1];
+        Steps[Cntr] = atan2(Im, Re);
+        SumRe += Re;
+        SumIm += Im;
+    }
+    Step = atan2(SumIm, SumRe);
+
+    //
+    // robust spread of the steps (median absolute deviation) sets the jump threshold
+    //
+    for (Cntr = 1; Cntr < Count; Cntr++)
+        Deviation[Cntr - 1] = fabs(WrapPhase(Steps[Cntr] - Step));
+    qsort(Deviation, Count - 1, sizeof(double), CompareDouble);
+    Sigma = 1.4826 * Deviation[(Count - 1) / 2];
+    Threshold = VTONEJUMPSIGMA * Sigma;
+    if (Threshold < VTONEJUMPMIN)
+        Threshold = VTONEJUMPMIN;
+
+    //
+    // count jumps (a run of outlying steps counts once), and average the good steps
+    //
+    InJump = false;
+    StepSum = 0.0;
+    StepCount = 0;
+    for (Cntr = 1; Cntr < Count; Cntr++)
+    {
+        if (fabs(WrapPhase(Steps[Cntr] - Step)) > Threshold)
+        {
+            if (!InJump)
+                Result->Discontinuities++;
+            InJump = true;
+            Steps[Cntr] = NAN;                                  // mark segment boundary
+        }
+        else
+        {
+            InJump = false;
+            StepSum += WrapPhase(Steps[Cntr] - Step);
+            StepCount++;
+        }
+    }
+    Omega = Step;
+    if (StepCount != 0)
+        Omega += StepSum / (double)StepCount;
+    Result->Frequency = Omega * SampleRate / (2.0 * M_PI);
+    Result->SampleCount = Count;
+
+    //
+    // least squares fit of A.exp(j.Omega.n) to each continuous segment
+    //
+    SignalPower = 0.0;
+    NoisePower = 0.0;
+    CosW = cos(Omega);
+    SinW = sin(Omega);
+    SegStart = 0;
+    while (SegStart < Count)
+    {
+        SegEnd = SegStart + 1;
+        while ((SegEnd < Count) && !isnan(Steps[SegEnd]))
+            SegEnd++;
+        //
+        // fit: A = mean of x[n].exp(-j.Omega.n), phase reference at segment start
+        //
+        FitRe = 0.0;
+        FitIm = 0.0;
+        ModelRe = 1.0;
+        ModelIm = 0.0;
+        for (Cntr = SegStart; Cntr < SegEnd; Cntr++)
+        {
+            FitRe += IQ[2*Cntr] * ModelRe + IQ[2*Cntr+1] * ModelIm;
+            FitIm += IQ[2*Cntr+1] * ModelRe - IQ[2*Cntr] * ModelIm;
+            Phase = ModelRe * CosW - ModelIm * SinW;             // rotate by Omega
+            ModelIm = ModelRe * SinW + ModelIm * CosW;
+            ModelRe = Phase;
+        }
+        FitRe /= (double)(SegEnd - SegStart);
+        FitIm /= (double)(SegEnd - SegStart);
+        //
+        // residual power
+        //
+        ModelRe = 1.0;
+        ModelIm = 0.0;
+        for (Cntr = SegStart; Cntr < SegEnd; Cntr++)
+        {
+            Re = IQ[2*Cntr] - (FitRe * ModelRe - FitIm * ModelIm);
+            Im = IQ[2*Cntr+1] - (FitRe * ModelIm + FitIm * ModelRe);
+            NoisePower += Re * Re + Im * Im;
+            Phase = ModelRe * CosW - ModelIm * SinW;
+            ModelIm = ModelRe * SinW + ModelIm * CosW;
+            ModelRe = Phase;
+        }
+        SignalPower += (FitRe * FitRe + FitIm * FitIm) * (double)(SegEnd - SegStart);
+        SegStart = SegEnd;
+    }
+    SignalPower /= (double)Count;
+    NoisePower /= (double)Count;
+    Result->AmplitudedBFS = 10.0 * log10(SignalPower + 1.0e-30);
+    Result->SNRdB = 10.0 * log10((SignalPower + 1.0e-30) / (NoisePower + 1.0e-30));
+
+    free(Steps);
+    free(Deviation);
+    return false;
+}
@@ -0,0 +1,62 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// toneanalysis.h:
+// measure a single test tone in complex I/Q samples:
+// frequency, amplitude, SNR and sample continuity
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __toneanalysis_h
+#define __toneanalysis_h
+
+#include <stdint.h>
+#include "saturntypes.h"
+
+
+#define VTONEMINSAMPLES 16                      // fewest samples that can be analysed
+
+
+//
+// results of a tone analysis
+//
+typedef struct
+{
+    uint32_t SampleCount;                       // samples analysed
+    double Frequency;                           // measured frequency, Hz (may be negative)
+    double AmplitudedBFS;                       // tone amplitude, dB relative to full scale
+    double SNRdB;                               // tone power / everything else
+    uint32_t Discontinuities;                   // phase jumps found (missing or repeated samples)
+} TToneAnalysis;
+
+
+//
+// convert P2 format I/Q samples (24 bit I then 24 bit Q, big endian) to
+// interleaved doubles; full scale = 1.0
+//
+void UnpackP2IQSamples(uint8_t* Src, uint32_t Count, double* IQ);
+
+
+//
+// synthesise a tone in P2 24 bit format, for offline checks.
+// StartSample is the sample index of the 1st sample: skipping indices between
+// calls creates a discontinuity. NoiseRMS adds gaussian noise to I and Q.
+//
+void SynthesiseP2Tone(uint8_t* Dest, uint32_t Count, uint64_t StartSample, double SampleRate,
+                      double Frequency, double Amplitude, double NoiseRMS);
+
+
+//
+// analyse complex samples (interleaved I, Q) containing a single tone
+// returns true if too few samples to analyse
+//
+bool AnalyseTone(double* IQ, uint32_t Count, double SampleRate, TToneAnalysis* Result);
+
+
+#endif
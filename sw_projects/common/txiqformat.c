@@ -0,0 +1,398 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// txiqformat.c:
+// TX (DUC) I/Q packet formats: standard 24 bit, and compact 16 bit and
+// 12 bit block scaled formats a client can negotiate to save bandwidth.
+// samples are expanded and swizzled straight into the DUC DMA layout.
+//
+//////////////////////////////////////////////////////////////
+
+#include <string.h>
+#include "../common/txiqformat.h"
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+
+//
+// packet size for a format; 0 if not valid
+//
+uint32_t TXFPacketSize(ETXIQFormat Format)
+{
+    switch (Format)
+    {
+        case eTXFormat24:
+            return VTXF24SIZE;
+        case eTXFormat16:
+            return VTXF16SIZE;
+        case eTXFormat12:
+            return VTXF12SIZE;
+        default:
+            return 0;
+    }
+}
+
+
+//
+// format name, for reports
+//
+char* TXFName(ETXIQFormat Format)
+{
+    switch (Format)
+    {
+        case eTXFormat24:
+            return "24 bit";
+        case eTXFormat16:
+            return "16 bit";
+        case eTXFormat12:
+            return "12 bit block scaled";
+        default:
+            return "unknown";
+    }
+}
+
+
+//
+// write one 24 bit sample value to the DMA layout (Q then I, big endian)
+//
+static void TXFWriteDMASample(uint8_t* Dest, int32_t I, int32_t Q)
+{
+    Dest[0] = (uint8_t)(Q >> 16);
+    Dest[1] = (uint8_t)(Q >> 8);
+    Dest[2] = (uint8_t)Q;
+    Dest[3] = (uint8_t)(I >> 16);
+    Dest[4] = (uint8_t)(I >> 8);
+    Dest[5] = (uint8_t)I;
+}
+
+
+//
+// 24 bit: swap I & Q (the original DUC I/Q loop)
+//
+void TXFSwizzle24Reference(uint8_t* Src, uint8_t* Dest, uint32_t Count)
+{
+    uint32_t Cntr;
+
+    for (Cntr = 0; Cntr < Count; Cntr++)
+    {
+        *Dest++ = *(Src+3);                                 // get Q sample (3 bytes)
+        *Dest++ = *(Src+4);
+        *Dest++ = *(Src+5);
+        *Dest++ = *(Src+0);                                 // get I sample (3 bytes)
+        *Dest++ = *(Src+1);
+        *Dest++ = *(Src+2);
+        Src += 6;
+    }
+}
+
+
+//
+// 24 bit, NEON: a 3 way de-interleave of 8 samples puts byte k of the I and Q
+// values of each sample in adjacent lanes, so swapping lane pairs swaps I and Q
+//
+void TXFSwizzle24(uint8_t* Src, uint8_t* Dest, uint32_t Count)
+{
+#if defined(__ARM_NEON)
+    uint8x16x3_t Bytes;
+    uint32_t Sample = 0;
+
+    for (; Sample + 8 <= Count; Sample += 8)
+    {
+        Bytes = vld3q_u8(Src + 6 * Sample);
+        Bytes.val[0] = vrev16q_u8(Bytes.val[0]);
+        Bytes.val[1] = vrev16q_u8(Bytes.val[1]);
+        Bytes.val[2] = vrev16q_u8(Bytes.val[2]);
+        vst3q_u8(Dest + 6 * Sample, Bytes);
+    }
+    TXFSwizzle24Reference(Src + 6 * Sample, Dest + 6 * Sample, Count - Sample);
+#else
+    TXFSwizzle24Reference(Src, Dest, Count);
+#endif
+}
+
+
+//
+// 16 bit: the 16 bit value is the top 2 bytes of the 24 bit value
+//
+void TXFExpand16Reference(uint8_t* Src, uint8_t* Dest, uint32_t Count)
+{
+    uint32_t Cntr;
+
+    for (Cntr = 0; Cntr < Count; Cntr++)
+    {
+        *Dest++ = *(Src+2);                                 // Q
+        *Dest++ = *(Src+3);
+        *Dest++ = 0;
+        *Dest++ = *(Src+0);                                 // I
+        *Dest++ = *(Src+1);
+        *Dest++ = 0;
+        Src += 4;
+    }
+}
+
+
+//
+// 16 bit, NEON: viewed as little endian halfwords, each output sample is
+// [Qhi Qlo] [0 Ihi] [Ilo 0]: the Q halfword as received, then the I halfword
+// shifted up and down a byte. 8 samples per iteration.
+//
+void TXFExpand16(uint8_t* Src, uint8_t* Dest, uint32_t Count)
+{
+#if defined(__ARM_NEON)
+    uint16x8x2_t In;
+    uint16x8x3_t Out;
+    uint32_t Sample = 0;
+
+    for (; Sample + 8 <= Count; Sample += 8)
+    {
+        In = vld2q_u16((uint16_t*)(Src + 4 * Sample));
+        Out.val[0] = In.val[1];
+        Out.val[1] = vshlq_n_u16(In.val[0], 8);
+        Out.val[2] = vshrq_n_u16(In.val[0], 8);
+        vst3q_u16((uint16_t*)(Dest + 6 * Sample), Out);
+    }
+    TXFExpand16Reference(Src + 4 * Sample, Dest + 6 * Sample, Count - Sample);
+#else
+    TXFExpand16Reference(Src, Dest, Count);
+#endif
+}
+
+
+//
+// 12 bit block scaled
+//
+bool TXFExpand12Reference(uint8_t* Src, uint8_t* Dest, uint32_t Count)
+{
+    uint32_t Block, Sample;
+    uint8_t Exponent;
+    int32_t I, Q;
+
+    for (Block = 0; Block < Count / VTXF12BLOCK; Block++)
+    {
+        Exponent = *Src++;
+        if (Exponent > VTXF12MAXEXPONENT)
+            return true;
+        for (Sample = 0; Sample < VTXF12BLOCK; Sample++)
+        {
+            I = (int32_t)(((uint32_t)Src[0] << 24) | ((uint32_t)(Src[1] & 0xF0) << 16)) >> 20;
+            Q = (int32_t)(((uint32_t)(Src[1] & 0x0F) << 28) | ((uint32_t)Src[2] << 20)) >> 20;
+            TXFWriteDMASample(Dest, I * (1 << Exponent), Q * (1 << Exponent));
+            Src += 3;
+            Dest += 6;
+        }
+    }
+    return false;
+}
+
+
+#if defined(__ARM_NEON)
+//
+// write 8 samples, as 32 bit I and Q values in two halves, to the DMA layout
+// as little endian halfwords each sample is [Q2 Q1] [Q0 I2] [I1 I0]
+//
+static void TXFStoreDMA8(int32x4_t ILo, int32x4_t IHi, int32x4_t QLo, int32x4_t QHi, uint8_t* Dest)
+{
+    uint16x8_t QMid, QLow, IHigh, ILow;
+    uint16x8x3_t Out;
+
+    QMid = vcombine_u16(vmovn_u32(vreinterpretq_u32_s32(vshrq_n_s32(QLo, 8))),
+                        vmovn_u32(vreinterpretq_u32_s32(vshrq_n_s32(QHi, 8))));       // Q bits 23-8
+    QLow = vcombine_u16(vmovn_u32(vreinterpretq_u32_s32(QLo)), vmovn_u32(vreinterpretq_u32_s32(QHi)));
+    IHigh = vcombine_u16(vmovn_u32(vreinterpretq_u32_s32(vshrq_n_s32(ILo, 16))),
+                         vmovn_u32(vreinterpretq_u32_s32(vshrq_n_s32(IHi, 16))));     // I bits 31-16
+    ILow = vcombine_u16(vmovn_u32(vreinterpretq_u32_s32(ILo)), vmovn_u32(vreinterpretq_u32_s32(IHi)));
+
+    Out.val[0] = vreinterpretq_u16_u8(vrev16q_u8(vreinterpretq_u8_u16(QMid)));
+    Out.val[1] = vorrq_u16(vandq_u16(QLow, vdupq_n_u16(0xFF)), vshlq_n_u16(IHigh, 8));
+    Out.val[2] = vreinterpretq_u16_u8(vrev16q_u8(vreinterpretq_u8_u16(ILow)));
+    vst3q_u16((uint16_t*)Dest, Out);
+}
+#endif
+
+
+//
+// 12 bit block scaled, NEON: a 3 way de-interleave puts the 3 bytes of each
+// of 16 samples in separate vectors; the 12 bit values are assembled and sign
+// extended in 16 bit lanes, then widened and shifted by the block exponent
+//
+bool TXFExpand12(uint8_t* Src, uint8_t* Dest, uint32_t Count)
+{
+#if defined(__ARM_NEON)
+    uint32_t Block;
+    uint8_t Exponent;
+    uint8x16x3_t Bytes;
+    uint16x8_t W01, W12;
+    int16x8_t I12, Q12;
+    int32x4_t Shift;
+    int Half;
+
+    for (Block = 0; Block < Count / VTXF12BLOCK; Block++)
+    {
+        Exponent = *Src++;
+        if (Exponent > VTXF12MAXEXPONENT)
+            return true;
+        Shift = vdupq_n_s32(Exponent);
+        Bytes = vld3q_u8(Src);
+        for (Half = 0; Half < 2; Half++)
+        {
+            if (Half == 0)
+            {
+                W01 = vorrq_u16(vshll_n_u8(vget_low_u8(Bytes.val[0]), 8), vmovl_u8(vget_low_u8(Bytes.val[1])));
+                W12 = vorrq_u16(vshll_n_u8(vget_low_u8(Bytes.val[1]), 8), vmovl_u8(vget_low_u8(Bytes.val[2])));
+            }
+            else
+            {
+                W01 = vorrq_u16(vshll_n_u8(vget_high_u8(Bytes.val[0]), 8), vmovl_u8(vget_high_u8(Bytes.val[1])));
+                W12 = vorrq_u16(vshll_n_u8(vget_high_u8(Bytes.val[1]), 8), vmovl_u8(vget_high_u8(Bytes.val[2])));
+            }
+            I12 = vshrq_n_s16(vreinterpretq_s16_u16(W01), 4);
+            Q12 = vshrq_n_s16(vreinterpretq_s16_u16(vshlq_n_u16(W12, 4)), 4);
+            TXFStoreDMA8(vshlq_s32(vmovl_s16(vget_low_s16(I12)), Shift), vshlq_s32(vmovl_s16(vget_high_s16(I12)), Shift),
+                         vshlq_s32(vmovl_s16(vget_low_s16(Q12)), Shift), vshlq_s32(vmovl_s16(vget_high_s16(Q12)), Shift),
+                         Dest);
+            Dest += 48;
+        }
+        Src += 3 * VTXF12BLOCK;
+    }
+    return false;
+#else
+    return TXFExpand12Reference(Src, Dest, Count);
+#endif
+}
+
+
+//
+// write one packet's samples (after the sequence number) to the DMA layout
+// returns true if the samples are not valid
+//
+bool TXFToDMA(ETXIQFormat Format, uint8_t* Src, uint8_t* Dest)
+{
+    switch (Format)
+    {
+        case eTXFormat24:
+            TXFSwizzle24(Src, Dest, VTXFSAMPLES);
+            return false;
+        case eTXFormat16:
+            TXFExpand16(Src, Dest, VTXFSAMPLES);
+            return false;
+        case eTXFormat12:
+            return TXFExpand12(Src, Dest, VTXFSAMPLES);
+        default:
+            return true;
+    }
+}
+
+
+//
+// expand one packet's samples to standard 24 bit P2 format (for predistortion)
+// the DMA layout is P2 format with I and Q swapped, so expand then swap back
+// returns true if the samples are not valid
+//
+bool TXFToP2(ETXIQFormat Format, uint8_t* Src, uint8_t* Dest)
+{
+    uint8_t Swapped[VTXFDMASIZE];
+
+    if (Format == eTXFormat24)
+    {
+        memcpy(Dest, Src, VTXFDMASIZE);
+        return false;
+    }
+    if (TXFToDMA(Format, Src, Swapped))
+        return true;
+    TXFSwizzle24(Swapped, Dest, VTXFSAMPLES);
+    return false;
+}
+
+
+//
+// get a 24 bit P2 sample
+//
+static void TXFReadP2Sample(uint8_t* Src, int32_t* I, int32_t* Q)
+{
+    *I = (int32_t)(((uint32_t)Src[0] << 24) | ((uint32_t)Src[1] << 16) | ((uint32_t)Src[2] << 8)) >> 8;
+    *Q = (int32_t)(((uint32_t)Src[3] << 24) | ((uint32_t)Src[4] << 16) | ((uint32_t)Src[5] << 8)) >> 8;
+}
+
+
+//
+// round a 24 bit value to Bits bits by dropping Shift bits, saturated
+//
+static int32_t TXFRound(int32_t Value, uint32_t Shift, uint32_t Bits)
+{
+    int32_t Max = (1 << (Bits - 1)) - 1;
+    int32_t Result;
+
+    Result = (Shift == 0) ? Value : (Value + (1 << (Shift - 1))) >> Shift;
+    if (Result > Max)
+        return Max;
+    if (Result < -Max - 1)
+        return -Max - 1;
+    return Result;
+}
+
+
+//
+// client side: pack 24 bit samples as 16 bit
+//
+void TXFPack16(uint8_t* Src, uint8_t* Dest, uint32_t Count)
+{
+    uint32_t Sample;
+    int32_t I, Q;
+
+    for (Sample = 0; Sample < Count; Sample++)
+    {
+        TXFReadP2Sample(Src, &I, &Q);
+        I = TXFRound(I, 8, 16);
+        Q = TXFRound(Q, 8, 16);
+        *Dest++ = (uint8_t)(I >> 8);
+        *Dest++ = (uint8_t)I;
+        *Dest++ = (uint8_t)(Q >> 8);
+        *Dest++ = (uint8_t)Q;
+        Src += 6;
+    }
+}
+
+
+//
+// client side: pack 24 bit samples as 12 bit block scaled
+//
+void TXFPack12(uint8_t* Src, uint8_t* Dest, uint32_t Count)
+{
+    uint32_t Block, Sample, Exponent;
+    int32_t I[VTXF12BLOCK], Q[VTXF12BLOCK];
+    int32_t Max, Min, SI, SQ;
+
+    for (Block = 0; Block < Count / VTXF12BLOCK; Block++)
+    {
+        Max = 0;
+        Min = 0;
+        for (Sample = 0; Sample < VTXF12BLOCK; Sample++)
+        {
+            TXFReadP2Sample(Src + 6 * Sample, &I[Sample], &Q[Sample]);
+            Max = (I[Sample] > Max) ? I[Sample] : Max;
+            Max = (Q[Sample] > Max) ? Q[Sample] : Max;
+            Min = (I[Sample] < Min) ? I[Sample] : Min;
+            Min = (Q[Sample] < Min) ? Q[Sample] : Min;
+        }
+        for (Exponent = 0; Exponent < VTXF12MAXEXPONENT; Exponent++)
+            if (((Max >> Exponent) <= 2047) && ((Min >> Exponent) >= -2048))
+                break;
+        *Dest++ = (uint8_t)Exponent;
+        for (Sample = 0; Sample < VTXF12BLOCK; Sample++)
+        {
+            SI = TXFRound(I[Sample], Exponent, 12);
+            SQ = TXFRound(Q[Sample], Exponent, 12);
+            *Dest++ = (uint8_t)(SI >> 4);
+            *Dest++ = (uint8_t)(((SI & 0x0F) << 4) | ((SQ >> 8) & 0x0F));
+            *Dest++ = (uint8_t)SQ;
+        }
+        Src += 6 * VTXF12BLOCK;
+    }
+}
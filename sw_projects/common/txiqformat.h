@@ -0,0 +1,120 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// txiqformat.h:
+// TX (DUC) I/Q packet formats: standard 24 bit, and compact 16 bit and
+// 12 bit block scaled formats a client can negotiate to save bandwidth.
+// samples are expanded and swizzled straight into the DUC DMA layout.
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __txiqformat_h
+#define __txiqformat_h
+
+#include <stdint.h>
+#include "saturntypes.h"
+
+
+#define VTXFPACKETID 0x13                           // command byte of a format request and its reply (port 1024)
+#define VTXFSAMPLES 240                             // samples per DUC I/Q packet, all formats
+#define VTXF24SIZE (4 + 6 * VTXFSAMPLES)            // 1444: standard
+#define VTXF16SIZE (4 + 4 * VTXFSAMPLES)            // 964
+#define VTXF12BLOCK 16                              // samples sharing one exponent
+#define VTXF12BLOCKSIZE (1 + 3 * VTXF12BLOCK)       // exponent byte then 16 packed samples
+#define VTXF12SIZE (4 + (VTXFSAMPLES / VTXF12BLOCK) * VTXF12BLOCKSIZE)    // 739
+#define VTXF12MAXEXPONENT 12
+#define VTXFDMASIZE (6 * VTXFSAMPLES)               // bytes written to the DUC per packet
+
+
+//
+// TX I/Q formats; the value is the format number in a request packet
+//
+typedef enum
+{
+    eTXFormat24,                                    // standard: 24 bit I then 24 bit Q
+    eTXFormat16,                                    // 16 bit I then 16 bit Q
+    eTXFormat12,                                    // 12 bit I and Q, block scaled
+    eTXNumFormats
+} ETXIQFormat;
+
+
+//
+// format request packet, on port 1024 (60 bytes):
+// bytes 0-3    sequence number
+// byte 4       0x13
+// byte 5       format requested (0 = 24 bit, 1 = 16 bit, 2 = 12 bit block scaled)
+// the SDR replies from port 1024 with:
+// bytes 0-3    sequence number of the request
+// byte 4       0x13
+// byte 5       format now accepted (unchanged if the request was not supported)
+// byte 6       bit n set if format n is supported
+// bytes 8-9    size of a DUC I/Q packet in the accepted format
+// the format returns to 24 bit at the next discovery while not running. Standard 24 bit packets
+// are always accepted too, unless FEC is on.
+//
+// all formats: bytes 0-3 sequence number, then 240 samples, big endian:
+// 16 bit:  I (16 bits), Q (16 bits); the sample is the top 16 bits of the 24 bit value
+// 12 bit:  15 blocks of 16 samples. Each block is an exponent byte E (0-12), then
+//          3 bytes per sample: I bits 11-4; I bits 3-0 and Q bits 11-8; Q bits 7-0.
+//          the 24 bit sample value is the signed 12 bit value * 2^E
+//
+// DMA layout (the DUC wants Q first): 24 bit Q then 24 bit I, big endian.
+//
+
+
+//
+// packet size for a format; 0 if not valid
+//
+uint32_t TXFPacketSize(ETXIQFormat Format);
+
+
+//
+// format name, for reports
+//
+char* TXFName(ETXIQFormat Format);
+
+
+//
+// write Count samples from a packet (after the sequence number) to the DMA layout
+// Reference versions are plain C; the others use NEON where available and give
+// identical output. Count must be a multiple of 8 (16 for 12 bit).
+// the 12 bit versions return true if an exponent is out of range
+//
+void TXFSwizzle24Reference(uint8_t* Src, uint8_t* Dest, uint32_t Count);
+void TXFSwizzle24(uint8_t* Src, uint8_t* Dest, uint32_t Count);
+void TXFExpand16Reference(uint8_t* Src, uint8_t* Dest, uint32_t Count);
+void TXFExpand16(uint8_t* Src, uint8_t* Dest, uint32_t Count);
+bool TXFExpand12Reference(uint8_t* Src, uint8_t* Dest, uint32_t Count);
+bool TXFExpand12(uint8_t* Src, uint8_t* Dest, uint32_t Count);
+
+
+//
+// write one packet's samples (after the sequence number) to the DMA layout
+// returns true if the samples are not valid
+//
+bool TXFToDMA(ETXIQFormat Format, uint8_t* Src, uint8_t* Dest);
+
+
+//
+// expand one packet's samples to standard 24 bit P2 format (for predistortion)
+// returns true if the samples are not valid
+//
+bool TXFToP2(ETXIQFormat Format, uint8_t* Src, uint8_t* Dest);
+
+
+//
+// client side: pack Count standard 24 bit P2 samples into a compact format
+// 16 bit rounds to nearest; 12 bit chooses the smallest exponent for each block
+// that holds its largest sample. Values representable in the format are exact.
+//
+void TXFPack16(uint8_t* Src, uint8_t* Dest, uint32_t Count);
+void TXFPack12(uint8_t* Src, uint8_t* Dest, uint32_t Count);
+
+
+#endif
@@ -0,0 +1,434 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// virtualrx.c:
+// software "virtual" receivers: narrow receivers mixed and decimated
+// from the samples of one wide hardware DDC
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "../common/saturnregisters.h"
+#include "../common/virtualrx.h"
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+
+#define VVRXKAISERBETA 7.5                          // about 75dB stopband
+#define VVRXCUTOFF 0.5                              // filter cutoff, fraction of output rate
+#define VVRXFULLSCALE 8388608.0f                    // 24 bit full scale
+#define VVRXMAXSAMPLE 8388607
+#define VVRXMINSAMPLE (-8388608)
+#define VVRXBENCHSAMPLES 192000                     // source samples timed per benchmark case
+#define VVRXCPUBUDGET 0.75                          // fraction of a core given to virtual receivers
+
+
+//
+// get time in ns, for CPU load measurement
+//
+static uint64_t VRXGetTimeNs(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (uint64_t)Now.tv_sec * 1000000000ULL + (uint64_t)Now.tv_nsec;
+}
+
+
+//
+// zero order modified Bessel function, for the Kaiser window
+//
+static double VRXBesselI0(double X)
+{
+    double Sum = 1.0, Term = 1.0;
+    int K;
+
+    for (K = 1; K < 50; K++)
+    {
+        Term *= (X / (2.0 * K)) * (X / (2.0 * K));
+        Sum += Term;
+        if (Term < 1e-12 * Sum)
+            break;
+    }
+    return Sum;
+}
+
+
+//
+// initialise a virtual receiver
+// returns true if settings are not valid or memory could not be allocated
+//
+bool VirtualRXInit(TVirtualRX* VRX, uint32_t SourceDDC, int32_t OffsetHz, uint32_t Decimation)
+{
+    uint32_t Tap;
+    double Centre, X, Window, Cutoff, Sum = 0.0;
+
+    memset(VRX, 0, sizeof(TVirtualRX));
+    if ((SourceDDC >= VNUMDDC) || (Decimation < VVRXMINDECIMATION) || (Decimation > VVRXMAXDECIMATION)
+        || (OffsetHz > VVRXMAXOFFSET) || (OffsetHz < -VVRXMAXOFFSET))
+        return true;
+
+    VRX->SourceDDC = SourceDDC;
+    VRX->OffsetHz = OffsetHz;
+    VRX->Decimation = Decimation;
+    VRX->Taps = VVRXTAPSPERDECIM * Decimation;
+    if ((posix_memalign((void**)&VRX->Coeff, 16, VRX->Taps * sizeof(float)) != 0)
+        || (posix_memalign((void**)&VRX->HistI, 16, (VRX->Taps + VVRXBLOCK) * sizeof(float)) != 0)
+        || (posix_memalign((void**)&VRX->HistQ, 16, (VRX->Taps + VVRXBLOCK) * sizeof(float)) != 0))
+    {
+        VirtualRXFree(VRX);
+        return true;
+    }
+
+    //
+    // Kaiser windowed sinc, cutoff midway between passband and stopband
+    // (the FIR is symmetrical, so reversing it for the dot product changes nothing)
+    //
+    Cutoff = VVRXCUTOFF / Decimation;               // cycles per source sample
+    Centre = (VRX->Taps - 1) / 2.0;
+    for (Tap = 0; Tap < VRX->Taps; Tap++)
+    {
+        X = Tap - Centre;
+        Window = VRXBesselI0(VVRXKAISERBETA * sqrt(1.0 - (X / Centre) * (X / Centre))) / VRXBesselI0(VVRXKAISERBETA);
+        VRX->Coeff[Tap] = (float)(2.0 * Cutoff * Window * ((X == 0.0) ? 1.0 : sin(2.0 * M_PI * Cutoff * X) / (2.0 * M_PI * Cutoff * X)));
+        Sum += VRX->Coeff[Tap];
+    }
+    for (Tap = 0; Tap < VRX->Taps; Tap++)
+        VRX->Coeff[Tap] = (float)(VRX->Coeff[Tap] / Sum);           // unity gain at 0Hz
+    VirtualRXRestart(VRX);
+    return false;
+}
+
+
+//
+// free a virtual receiver's memory
+//
+void VirtualRXFree(TVirtualRX* VRX)
+{
+    free(VRX->Coeff);
+    free(VRX->HistI);
+    free(VRX->HistQ);
+    VRX->Coeff = NULL;
+    VRX->HistI = NULL;
+    VRX->HistQ = NULL;
+    VRX->Taps = 0;
+}
+
+
+//
+// clear history, NCO phase, output and statistics, ready for a new run
+//
+void VirtualRXRestart(TVirtualRX* VRX)
+{
+    memset(VRX->HistI, 0, (VRX->Taps + VVRXBLOCK) * sizeof(float));
+    memset(VRX->HistQ, 0, (VRX->Taps + VVRXBLOCK) * sizeof(float));
+    VRX->HistFill = VRX->Taps - 1;
+    VRX->NextOutput = VRX->Taps - 1;
+    VRX->SampleRate = 0;
+    VRX->NCOPhase = 0.0;
+    VRX->OutCount = 0;
+    memset(&VRX->Stats, 0, sizeof(TVirtualRXStatistics));
+}
+
+
+//
+// convert Count P2 format source samples to float; full scale = 1.0
+//
+void VirtualRXConvertP2Samples(uint8_t* Src, uint32_t Count, float* I, float* Q)
+{
+    uint32_t Sample;
+    const float Scale = 1.0f / VVRXFULLSCALE;
+
+    for (Sample = 0; Sample < Count; Sample++)
+    {
+        I[Sample] = (float)((int32_t)(((uint32_t)Src[0] << 24) | ((uint32_t)Src[1] << 16) | ((uint32_t)Src[2] << 8)) >> 8) * Scale;
+        Q[Sample] = (float)((int32_t)(((uint32_t)Src[3] << 24) | ((uint32_t)Src[4] << 16) | ((uint32_t)Src[5] << 8)) >> 8) * Scale;
+        Src += 6;
+    }
+}
+
+
+//
+// mix Count source samples to 0Hz, appending them to the history
+// the oscillator runs as 4 phasors (one per NEON lane) rotated by 4 samples
+// at a time; they are recalculated exactly from the phase at each call, so
+// float rounding cannot accumulate beyond one block
+//
+static void VRXMix(TVirtualRX* VRX, float* I, float* Q, uint32_t Count)
+{
+    float* DestI = VRX->HistI + VRX->HistFill;
+    float* DestQ = VRX->HistQ + VRX->HistFill;
+    float PR[4], PI[4];
+    uint32_t Sample = 0, Lane;
+
+    for (Lane = 0; Lane < 4; Lane++)
+    {
+        PR[Lane] = (float)cos(-2.0 * M_PI * (VRX->NCOPhase + Lane * VRX->NCOStep));
+        PI[Lane] = (float)sin(-2.0 * M_PI * (VRX->NCOPhase + Lane * VRX->NCOStep));
+    }
+#if defined(__ARM_NEON)
+    float32x4_t Pr = vld1q_f32(PR);
+    float32x4_t Pi = vld1q_f32(PI);
+    float32x4_t XI, XQ, T;
+    const float32x4_t Rr = vdupq_n_f32(VRX->StepR);
+    const float32x4_t Ri = vdupq_n_f32(VRX->StepI);
+
+    for (; Sample + 4 <= Count; Sample += 4)
+    {
+        XI = vld1q_f32(I + Sample);
+        XQ = vld1q_f32(Q + Sample);
+        vst1q_f32(DestI + Sample, vmlsq_f32(vmulq_f32(XI, Pr), XQ, Pi));
+        vst1q_f32(DestQ + Sample, vmlaq_f32(vmulq_f32(XI, Pi), XQ, Pr));
+        T = vmlsq_f32(vmulq_f32(Pr, Rr), Pi, Ri);
+        Pi = vmlaq_f32(vmulq_f32(Pr, Ri), Pi, Rr);
+        Pr = T;
+    }
+    vst1q_f32(PR, Pr);
+    vst1q_f32(PI, Pi);
+#else
+    float TR;
+
+    for (; Sample + 4 <= Count; Sample += 4)
+        for (Lane = 0; Lane < 4; Lane++)
+        {
+            DestI[Sample + Lane] = I[Sample + Lane] * PR[Lane] - Q[Sample + Lane] * PI[Lane];
+            DestQ[Sample + Lane] = I[Sample + Lane] * PI[Lane] + Q[Sample + Lane] * PR[Lane];
+            TR = PR[Lane] * VRX->StepR - PI[Lane] * VRX->StepI;
+            PI[Lane] = PR[Lane] * VRX->StepI + PI[Lane] * VRX->StepR;
+            PR[Lane] = TR;
+        }
+#endif
+    for (Lane = 0; Sample < Count; Sample++, Lane++)
+    {
+        DestI[Sample] = I[Sample] * PR[Lane] - Q[Sample] * PI[Lane];
+        DestQ[Sample] = I[Sample] * PI[Lane] + Q[Sample] * PR[Lane];
+    }
+    VRX->HistFill += Count;
+    VRX->NCOPhase = fmod(VRX->NCOPhase + Count * VRX->NCOStep, 1.0);
+    if (VRX->NCOPhase < 0.0)
+        VRX->NCOPhase += 1.0;
+}
+
+
+//
+// one FIR output: the dot product of the coefficients with the Taps mixed
+// samples ending at End. NEON: 8 taps per iteration, two sets of accumulators
+//
+static void VRXFilter(TVirtualRX* VRX, uint32_t End, float* YI, float* YQ)
+{
+    const float* Coeff = VRX->Coeff;
+    const float* XI = VRX->HistI + End + 1 - VRX->Taps;
+    const float* XQ = VRX->HistQ + End + 1 - VRX->Taps;
+    uint32_t Tap;
+
+#if defined(__ARM_NEON)
+    float32x4_t AI0 = vdupq_n_f32(0.0f), AQ0 = vdupq_n_f32(0.0f);
+    float32x4_t AI1 = vdupq_n_f32(0.0f), AQ1 = vdupq_n_f32(0.0f);
+    float32x4_t C0, C1;
+    float32x2_t S;
+
+    for (Tap = 0; Tap < VRX->Taps; Tap += 8)
+    {
+        C0 = vld1q_f32(Coeff + Tap);
+        C1 = vld1q_f32(Coeff + Tap + 4);
+        AI0 = vmlaq_f32(AI0, C0, vld1q_f32(XI + Tap));
+        AQ0 = vmlaq_f32(AQ0, C0, vld1q_f32(XQ + Tap));
+        AI1 = vmlaq_f32(AI1, C1, vld1q_f32(XI + Tap + 4));
+        AQ1 = vmlaq_f32(AQ1, C1, vld1q_f32(XQ + Tap + 4));
+    }
+    AI0 = vaddq_f32(AI0, AI1);
+    AQ0 = vaddq_f32(AQ0, AQ1);
+    S = vadd_f32(vget_low_f32(AI0), vget_high_f32(AI0));
+    *YI = vget_lane_f32(vpadd_f32(S, S), 0);
+    S = vadd_f32(vget_low_f32(AQ0), vget_high_f32(AQ0));
+    *YQ = vget_lane_f32(vpadd_f32(S, S), 0);
+#else
+    float SumI = 0.0f, SumQ = 0.0f;
+
+    for (Tap = 0; Tap < VRX->Taps; Tap++)
+    {
+        SumI += Coeff[Tap] * XI[Tap];
+        SumQ += Coeff[Tap] * XQ[Tap];
+    }
+    *YI = SumI;
+    *YQ = SumQ;
+#endif
+}
+
+
+//
+// convert a float sample to 24 bit, saturated
+//
+static int32_t VRXToSample(float Value)
+{
+    float Scaled = Value * VVRXFULLSCALE;
+
+    if (Scaled >= (float)VVRXMAXSAMPLE)
+        return VVRXMAXSAMPLE;
+    if (Scaled <= (float)VVRXMINSAMPLE)
+        return VVRXMINSAMPLE;
+    return (int32_t)lrintf(Scaled);
+}
+
+
+//
+// mix, filter and decimate Count converted source samples
+//
+void VirtualRXProcess(TVirtualRX* VRX, float* I, float* Q, uint32_t Count, uint32_t SampleRate)
+{
+    uint64_t StartTime;
+    uint32_t Shift;
+    int32_t SampleI, SampleQ;
+    float YI, YQ;
+    uint8_t* Dest;
+
+    if ((Count == 0) || (Count > VVRXBLOCK))
+        return;
+    StartTime = VRXGetTimeNs();
+    if ((SampleRate != VRX->SampleRate) && (SampleRate != 0))
+    {
+        VRX->SampleRate = SampleRate;
+        VRX->NCOStep = (double)VRX->OffsetHz / (SampleRate * 1000.0);
+        VRX->StepR = (float)cos(-2.0 * M_PI * 4.0 * VRX->NCOStep);
+        VRX->StepI = (float)sin(-2.0 * M_PI * 4.0 * VRX->NCOStep);
+    }
+    VRXMix(VRX, I, Q, Count);
+
+    //
+    // one output every Decimation samples
+    //
+    while (VRX->NextOutput < VRX->HistFill)
+    {
+        VRXFilter(VRX, VRX->NextOutput, &YI, &YQ);
+        VRX->NextOutput += VRX->Decimation;
+        VRX->Stats.OutputSamples++;
+        if (VRX->OutCount == VVRXOUTSAMPLES)
+        {
+            VRX->Stats.Overruns++;
+            continue;
+        }
+        SampleI = VRXToSample(YI);
+        SampleQ = VRXToSample(YQ);
+        Dest = VRX->Out + 6 * VRX->OutCount++;
+        *Dest++ = (uint8_t)(SampleI >> 16);
+        *Dest++ = (uint8_t)(SampleI >> 8);
+        *Dest++ = (uint8_t)SampleI;
+        *Dest++ = (uint8_t)(SampleQ >> 16);
+        *Dest++ = (uint8_t)(SampleQ >> 8);
+        *Dest = (uint8_t)SampleQ;
+    }
+
+    //
+    // keep Taps-1 samples of history at the bottom of the buffer
+    //
+    Shift = VRX->HistFill - (VRX->Taps - 1);
+    memmove(VRX->HistI, VRX->HistI + Shift, (VRX->Taps - 1) * sizeof(float));
+    memmove(VRX->HistQ, VRX->HistQ + Shift, (VRX->Taps - 1) * sizeof(float));
+    VRX->HistFill -= Shift;
+    VRX->NextOutput -= Shift;
+    VRX->Stats.InputSamples += Count;
+    VRX->Stats.ProcessingNs += VRXGetTimeNs() - StartTime;
+}
+
+
+//
+// take one frame of output samples in P2 format
+// returns false if a complete frame is not ready yet
+//
+bool VirtualRXGetFrame(TVirtualRX* VRX, uint8_t* Dest)
+{
+    if (VRX->OutCount < VVRXFRAMESAMPLES)
+        return false;
+    memcpy(Dest, VRX->Out, 6 * VVRXFRAMESAMPLES);
+    VRX->OutCount -= VVRXFRAMESAMPLES;
+    memmove(VRX->Out, VRX->Out + 6 * VVRXFRAMESAMPLES, 6 * VRX->OutCount);
+    VRX->Stats.Frames++;
+    return true;
+}
+
+
+//
+// print statistics for one receiver
+// load is the fraction of one core used, at the source sample rate
+//
+void VirtualRXPrintStatistics(char* Name, TVirtualRX* VRX)
+{
+    TVirtualRXStatistics* Stats = &VRX->Stats;
+    double NsPerSample;
+
+    if (Stats->InputSamples == 0)
+        return;
+    NsPerSample = (double)Stats->ProcessingNs / (double)Stats->InputSamples;
+    printf("%s: DDC%d %+dHz /%d: %llu frames sent, %llu samples lost, %.1fns per source sample (%.1f%% of a core)\n",
+           Name, VRX->SourceDDC, VRX->OffsetHz, VRX->Decimation,
+           (unsigned long long)Stats->Frames, (unsigned long long)Stats->Overruns,
+           NsPerSample, NsPerSample * VRX->SampleRate * 1000.0 / 1e7);
+}
+
+
+//
+// measure processing time per source sample on this processor, and print how many
+// virtual receivers one core can sustain for typical wide DDC rates
+// cost per source sample is nearly independent of decimation: the FIR has
+// VVRXTAPSPERDECIM taps per unit of decimation, evaluated once per Decimation samples
+//
+void VirtualRXPrintBenchmark(void)
+{
+    static const uint32_t SourceRates[] = {1536, 768, 384};        // ksps
+    static const uint32_t OutputRate = 48;                         // ksps
+    TVirtualRX VRX;
+    float I[VVRXBLOCK], Q[VVRXBLOCK];
+    uint8_t Frame[6 * VVRXFRAMESAMPLES];
+    char Model[80] = "unknown processor";
+    uint32_t Rate, Sample, Done;
+    uint64_t StartTime;
+    double NsPerSample, Sustained;
+    FILE* Fp;
+
+    Fp = fopen("/proc/device-tree/model", "r");
+    if (Fp != NULL)
+    {
+        if (fgets(Model, sizeof(Model), Fp) == NULL)
+            strcpy(Model, "unknown processor");
+        fclose(Fp);
+    }
+    printf("virtual receiver benchmark on %s (%s):\n", Model,
+#if defined(__ARM_NEON)
+           "NEON");
+#else
+           "scalar");
+#endif
+    for (Sample = 0; Sample < VVRXBLOCK; Sample++)
+    {
+        I[Sample] = 0.5f * (float)cos(0.01 * Sample);
+        Q[Sample] = 0.5f * (float)sin(0.01 * Sample);
+    }
+    for (Rate = 0; Rate < sizeof(SourceRates) / sizeof(SourceRates[0]); Rate++)
+    {
+        if (VirtualRXInit(&VRX, 0, 10000, SourceRates[Rate] / OutputRate))
+            return;
+        StartTime = VRXGetTimeNs();
+        for (Done = 0; Done < VVRXBENCHSAMPLES; Done += VVRXBLOCK)
+        {
+            VirtualRXProcess(&VRX, I, Q, VVRXBLOCK, SourceRates[Rate]);
+            while (VirtualRXGetFrame(&VRX, Frame))
+                ;
+        }
+        NsPerSample = (double)(VRXGetTimeNs() - StartTime) / Done;
+        Sustained = VVRXCPUBUDGET * 1e9 / (NsPerSample * SourceRates[Rate] * 1000.0);
+        printf("  %4dksps to %dksps (/%d, %d taps): %.1fns per source sample; %.0f receivers per core at %.0f%% load\n",
+               SourceRates[Rate], OutputRate, VRX.Decimation, VRX.Taps, NsPerSample, floor(Sustained), VVRXCPUBUDGET * 100.0);
+        VirtualRXFree(&VRX);
+    }
+}
@@ -0,0 +1,135 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// virtualrx.h:
+// software "virtual" receivers: narrow receivers mixed and decimated
+// from the samples of one wide hardware DDC
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __virtualrx_h
+#define __virtualrx_h
+
+#include <stdint.h>
+#include "saturntypes.h"
+
+
+#define VVRXMAX 64                                  // most virtual receivers
+#define VVRXMINDECIMATION 2
+#define VVRXMAXDECIMATION 128
+#define VVRXTAPSPERDECIM 24                         // FIR taps per unit of decimation (a multiple of 8)
+#define VVRXMAXOFFSET 768000                        // largest frequency offset from the DDC centre, Hz
+#define VVRXBLOCK 256                               // most input samples processed per call
+#define VVRXFRAMESAMPLES 238                        // output samples in one P2 DDC I/Q packet
+#define VVRXOUTSAMPLES (2 * VVRXFRAMESAMPLES)       // output samples held until taken
+
+
+//
+// each virtual receiver mixes its frequency to 0Hz with a numerically controlled
+// oscillator, then low pass filters and decimates with a Kaiser windowed FIR.
+// the filter passes 80% of the output sample rate (to +/-0.4 Fout); anything
+// beyond +/-0.6 Fout, which would alias into the passband, is attenuated by
+// about 75dB. Output is full scale for a full scale input tone.
+//
+// source samples are converted to float once per wide DDC and shared by all
+// the receivers fed from it. The mix and filter use NEON where available.
+//
+
+
+//
+// virtual receiver statistics
+//
+typedef struct
+{
+    uint64_t InputSamples;                          // source samples processed
+    uint64_t OutputSamples;
+    uint64_t Frames;                                // output frames taken
+    uint64_t Overruns;                              // output samples lost: frames not taken
+    uint64_t ProcessingNs;                          // time spent mixing and filtering
+} TVirtualRXStatistics;
+
+
+//
+// one virtual receiver
+//
+typedef struct
+{
+    uint32_t SourceDDC;                             // wide DDC supplying samples
+    int32_t OffsetHz;                               // receive frequency relative to the DDC centre
+    uint32_t Decimation;
+    uint32_t Taps;                                  // FIR length
+    float* Coeff;                                   // FIR coefficients, time reversed
+    float* HistI;                                   // mixed samples: Taps-1 history, then new input
+    float* HistQ;
+    uint32_t HistFill;                              // samples in HistI, HistQ
+    uint32_t NextOutput;                            // last sample of the next output's FIR window
+    uint32_t SampleRate;                            // source ksps; NCO recalculated if it changes
+    double NCOPhase;                                // cycles, 0 to 1
+    double NCOStep;                                 // cycles per source sample
+    float StepR, StepI;                             // NCO rotation for 4 samples
+    uint8_t Out[6 * VVRXOUTSAMPLES];                // P2 format output samples not yet taken
+    uint32_t OutCount;                              // samples in Out
+    TVirtualRXStatistics Stats;
+} TVirtualRX;
+
+
+//
+// initialise a virtual receiver
+// returns true if settings are not valid or memory could not be allocated
+//
+bool VirtualRXInit(TVirtualRX* VRX, uint32_t SourceDDC, int32_t OffsetHz, uint32_t Decimation);
+
+
+//
+// free a virtual receiver's memory
+//
+void VirtualRXFree(TVirtualRX* VRX);
+
+
+//
+// clear history, NCO phase, output and statistics, ready for a new run
+//
+void VirtualRXRestart(TVirtualRX* VRX);
+
+
+//
+// convert Count (up to VVRXBLOCK) P2 format source samples (24 bit I then 24 bit Q,
+// big endian) to float; full scale = 1.0
+//
+void VirtualRXConvertP2Samples(uint8_t* Src, uint32_t Count, float* I, float* Q);
+
+
+//
+// mix, filter and decimate Count (up to VVRXBLOCK) converted source samples
+// SampleRate is the source rate in ksps
+//
+void VirtualRXProcess(TVirtualRX* VRX, float* I, float* Q, uint32_t Count, uint32_t SampleRate);
+
+
+//
+// take one frame of VVRXFRAMESAMPLES output samples in P2 format
+// returns false if a complete frame is not ready yet
+//
+bool VirtualRXGetFrame(TVirtualRX* VRX, uint8_t* Dest);
+
+
+//
+// print statistics for one receiver
+//
+void VirtualRXPrintStatistics(char* Name, TVirtualRX* VRX);
+
+
+//
+// measure processing time per source sample on this processor, and print how many
+// virtual receivers one core can sustain for typical wide DDC rates
+//
+void VirtualRXPrintBenchmark(void);
+
+
+#endif
@@ -0,0 +1,918 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// wbdetect.c:
+// signal detector for raw wideband ADC captures: FFT, noise floor
+// estimate and CFAR threshold with hysteresis, reported as signal
+// start and stop events
+//
+// the real samples are packed as FFTSize/2 complex samples (even samples
+// real, odd samples imaginary) and transformed with the same radix 2
+// decimation in time FFT as the spectrum code; the two interleaved
+// transforms are then separated to give bins 0 to Fs/2.
+//
+//////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include "../common/wbdetect.h"
+
+
+#define VWBDDCBINS 2                                // bins at 0Hz not searched (ADC offset)
+#define VWBDMERGEBINS 2                             // gaps up to this many bins are inside one detection
+#define VWBDMATCHBINS 2                             // a detection this close to a tracked signal is that signal
+#define VWBDNEIGHBOURS 2                            // noise floor: compared with this many segments either side
+#define VWBDRAISEDFACTOR 1.4f                       // a segment this far above its least neighbour holds a signal
+#define VWBDCONTINUEPFA 1.0e-2                      // continue threshold is not below the level noise exceeds in 1% of bins
+#define VWBDPERCENTILE 0.25                         // noise floor percentile within a segment
+#define VWBDOBWFRACTION 0.005                       // power outside the occupied bandwidth, each side
+#define VWBDMAXSEGMENTS (VWBDMAXFFT / 2 / VWBDSEGMENT)
+#define VWBDBENCHCAPTURES 200                       // captures timed per benchmark case
+
+
+//
+// get time in ns, for CPU load measurement
+//
+static uint64_t WBDGetTimeNs(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (uint64_t)Now.tv_sec * 1000000000ULL + (uint64_t)Now.tv_nsec;
+}
+
+
+//
+// probability that the mean of K unit mean exponential values exceeds Threshold
+// (upper tail of a gamma distribution with integer shape K)
+//
+static double WBDAveragedTail(uint32_t K, double Threshold)
+{
+    double X = K * Threshold;
+    double Term = 1.0, Sum = 1.0;
+    uint32_t I;
+
+    for (I = 1; I < K; I++)
+    {
+        Term *= X / I;
+        Sum += Term;
+    }
+    return exp(-X) * Sum;
+}
+
+
+//
+// find the threshold where the averaged tail probability equals Probability, by bisection
+//
+static double WBDAveragedThreshold(uint32_t K, double Probability)
+{
+    double Low = 0.0, High = 100.0, Mid = 1.0;
+    int Step;
+
+    for (Step = 0; Step < 60; Step++)
+    {
+        Mid = 0.5 * (Low + High);
+        if (WBDAveragedTail(K, Mid) > Probability)
+            Low = Mid;
+        else
+            High = Mid;
+    }
+    return Mid;
+}
+
+
+//
+// initialise a detector. FFTSize must be a power of 2.
+// returns true if settings are not valid or memory could not be allocated
+//
+bool WBDetectInit(TWBDetector* Det, uint32_t FFTSize, uint32_t UpdatesPerSecond, uint32_t Averages,
+                  double MinSNRdB, double HysteresisdB, uint32_t BudgetPercent)
+{
+    uint32_t Cntr, Bit, Reversed, Half;
+    double Angle, WindowSum;
+
+    memset(Det, 0, sizeof(TWBDetector));
+    if ((FFTSize < VWBDMINFFT) || (FFTSize > VWBDMAXFFT) || ((FFTSize & (FFTSize - 1)) != 0)
+        || (UpdatesPerSecond == 0) || (UpdatesPerSecond > VWBDMAXUPDATES)
+        || (Averages == 0) || (Averages > VWBDMAXAVERAGES)
+        || (MinSNRdB < 0.0) || (MinSNRdB > 60.0) || (HysteresisdB < 0.0) || (HysteresisdB > 20.0)
+        || (BudgetPercent == 0) || (BudgetPercent > 100))
+        return true;
+
+    Half = FFTSize / 2;
+    Det->FFTSize = FFTSize;
+    Det->HalfSize = Half;
+    while ((1U << Det->Log2Half) < Half)
+        Det->Log2Half++;
+    Det->UpdatesPerSecond = UpdatesPerSecond;
+    Det->Averages = Averages;
+    Det->MinSNRdB = MinSNRdB;
+    Det->HysteresisdB = HysteresisdB;
+    Det->BudgetPercent = BudgetPercent;
+    Det->BinHz = (double)VWBDSAMPLERATE / FFTSize;
+    Det->CapturePeriodUs = 1000000ULL / (UpdatesPerSecond * Averages);
+
+    //
+    // thresholds from the distribution of the average of Averages noise powers
+    //
+    Det->StartFactor = WBDAveragedThreshold(Averages, VWBDPFA);
+    if (Det->StartFactor < pow(10.0, MinSNRdB / 10.0))
+        Det->StartFactor = pow(10.0, MinSNRdB / 10.0);
+    Det->ContinueFactor = Det->StartFactor / pow(10.0, HysteresisdB / 10.0);
+    if (Det->ContinueFactor < WBDAveragedThreshold(Averages, VWBDCONTINUEPFA))
+        Det->ContinueFactor = WBDAveragedThreshold(Averages, VWBDCONTINUEPFA);
+    Det->NoiseCorrection = WBDAveragedThreshold(Averages, 1.0 - VWBDPERCENTILE);
+
+    Det->Window = malloc(FFTSize * sizeof(float));
+    Det->Twiddle = malloc(Half * sizeof(float));
+    Det->SplitTwiddle = malloc(2 * Half * sizeof(float));
+    Det->BitReverse = malloc(Half * sizeof(uint32_t));
+    Det->Work = malloc(2 * Half * sizeof(float));
+    Det->PowerSum = malloc(Half * sizeof(float));
+    Det->Noise = malloc(Half * sizeof(float));
+    Det->SegmentNoise = malloc((Half / VWBDSEGMENT) * sizeof(float));
+    if (!Det->Window || !Det->Twiddle || !Det->SplitTwiddle || !Det->BitReverse || !Det->Work
+        || !Det->PowerSum || !Det->Noise || !Det->SegmentNoise)
+    {
+        WBDetectFree(Det);
+        return true;
+    }
+
+    //
+    // 4 term Blackman-Harris window: sidelobes below -92dB
+    // bin power of a full scale (+/-32768) tone is (32768 * sum of window / 2)^2
+    //
+    WindowSum = 0.0;
+    for (Cntr = 0; Cntr < FFTSize; Cntr++)
+    {
+        Angle = 2.0 * M_PI * (double)Cntr / (double)FFTSize;
+        Det->Window[Cntr] = (float)(0.35875 - 0.48829 * cos(Angle) + 0.14128 * cos(2.0 * Angle) - 0.01168 * cos(3.0 * Angle));
+        WindowSum += Det->Window[Cntr];
+    }
+    Det->FullScale = (32768.0 * WindowSum / 2.0) * (32768.0 * WindowSum / 2.0);
+
+    for (Cntr = 0; Cntr < Half / 2; Cntr++)
+    {
+        Angle = -2.0 * M_PI * (double)Cntr / (double)Half;
+        Det->Twiddle[2 * Cntr] = (float)cos(Angle);
+        Det->Twiddle[2 * Cntr + 1] = (float)sin(Angle);
+    }
+    for (Cntr = 0; Cntr < Half; Cntr++)
+    {
+        Angle = -2.0 * M_PI * (double)Cntr / (double)FFTSize;
+        Det->SplitTwiddle[2 * Cntr] = (float)cos(Angle);
+        Det->SplitTwiddle[2 * Cntr + 1] = (float)sin(Angle);
+    }
+    for (Cntr = 0; Cntr < Half; Cntr++)
+    {
+        Reversed = 0;
+        for (Bit = 0; Bit < Det->Log2Half; Bit++)
+            if (Cntr & (1U << Bit))
+                Reversed |= 1U << (Det->Log2Half - 1 - Bit);
+        Det->BitReverse[Cntr] = Reversed;
+    }
+    WBDetectRestart(Det);
+    return false;
+}
+
+
+//
+// free a detector's memory
+//
+void WBDetectFree(TWBDetector* Det)
+{
+    free(Det->Window);
+    free(Det->Twiddle);
+    free(Det->SplitTwiddle);
+    free(Det->BitReverse);
+    free(Det->Work);
+    free(Det->PowerSum);
+    free(Det->Noise);
+    free(Det->SegmentNoise);
+    Det->Window = NULL;
+    Det->Twiddle = NULL;
+    Det->SplitTwiddle = NULL;
+    Det->BitReverse = NULL;
+    Det->Work = NULL;
+    Det->PowerSum = NULL;
+    Det->Noise = NULL;
+    Det->SegmentNoise = NULL;
+    Det->FFTSize = 0;
+}
+
+
+//
+// forget tracked signals, partial averages and statistics, ready for a new run
+//
+void WBDetectRestart(TWBDetector* Det)
+{
+    memset(Det->PowerSum, 0, Det->HalfSize * sizeof(float));
+    Det->AveragesDone = 0;
+    Det->LastCaptureUs = 0;
+    Det->WindowStartUs = 0;
+    Det->WindowNs = 0;
+    Det->WindowOver = false;
+    Det->SignalCount = 0;
+    Det->RegionCount = 0;
+    Det->EventCount = 0;
+    Det->NoisedBFS = 0.0;
+    memset(&Det->Stats, 0, sizeof(TWBDetectStatistics));
+}
+
+
+//
+// in place radix 2 FFT of bit reversed input, HalfSize complex points
+//
+static void WBDFFT(TWBDetector* Det)
+{
+    uint32_t Half, Step, Group, Cntr;
+    float* Work = Det->Work;
+    float* Twiddle;
+    float* Top;
+    float* Bottom;
+    float Re, Im;
+
+    for (Half = 1, Step = Det->HalfSize / 2; Half < Det->HalfSize; Half *= 2, Step /= 2)
+    {
+        for (Group = 0; Group < Det->HalfSize; Group += 2 * Half)
+        {
+            Top = Work + 2 * Group;
+            Bottom = Top + 2 * Half;
+            Twiddle = Det->Twiddle;
+            for (Cntr = 0; Cntr < Half; Cntr++)
+            {
+                Re = Bottom[0] * Twiddle[0] - Bottom[1] * Twiddle[1];
+                Im = Bottom[0] * Twiddle[1] + Bottom[1] * Twiddle[0];
+                Bottom[0] = Top[0] - Re;
+                Bottom[1] = Top[1] - Im;
+                Top[0] += Re;
+                Top[1] += Im;
+                Top += 2;
+                Bottom += 2;
+                Twiddle += 2 * Step;
+            }
+        }
+    }
+}
+
+
+//
+// window and transform one capture, and add its bin powers to the update
+// even samples go to the real part and odd samples to the imaginary part of a
+// half size complex FFT; bin k of the real FFT is then E + W^k O where
+// E = (Z[k] + conj Z[-k]) / 2 and O = (Z[k] - conj Z[-k]) / 2j
+//
+static void WBDTransform(TWBDetector* Det, uint8_t* Src)
+{
+    uint32_t Cntr, Mirror, Dest;
+    uint32_t Mask = Det->HalfSize - 1;
+    float* Work = Det->Work;
+    float* Window = Det->Window;
+    float* Split = Det->SplitTwiddle;
+    float Zr, Zi, Cr, Ci, Er, Ei, Or, Oi, Xr, Xi;
+
+    for (Cntr = 0; Cntr < Det->HalfSize; Cntr++)
+    {
+        Dest = 2 * Det->BitReverse[Cntr];
+        Work[Dest] = (float)(int16_t)((Src[0] << 8) | Src[1]) * Window[2 * Cntr];
+        Work[Dest + 1] = (float)(int16_t)((Src[2] << 8) | Src[3]) * Window[2 * Cntr + 1];
+        Src += 4;
+    }
+    WBDFFT(Det);
+    for (Cntr = 0; Cntr < Det->HalfSize; Cntr++)
+    {
+        Mirror = (Det->HalfSize - Cntr) & Mask;
+        Zr = Work[2 * Cntr];
+        Zi = Work[2 * Cntr + 1];
+        Cr = Work[2 * Mirror];
+        Ci = -Work[2 * Mirror + 1];
+        Er = 0.5f * (Zr + Cr);
+        Ei = 0.5f * (Zi + Ci);
+        Or = 0.5f * (Zi - Ci);
+        Oi = -0.5f * (Zr - Cr);
+        Xr = Er + Split[2 * Cntr] * Or - Split[2 * Cntr + 1] * Oi;
+        Xi = Ei + Split[2 * Cntr] * Oi + Split[2 * Cntr + 1] * Or;
+        Det->PowerSum[Cntr] += Xr * Xr + Xi * Xi;
+    }
+}
+
+
+//
+// find the Rank'th smallest of Count values (values are reordered)
+//
+static float WBDSelect(float* Values, uint32_t Count, uint32_t Rank)
+{
+    uint32_t Low = 0, High = Count - 1, Left, Right;
+    float Pivot, Temp;
+
+    while (Low < High)
+    {
+        Pivot = Values[(Low + High) / 2];
+        Left = Low;
+        Right = High;
+        while (Left <= Right)
+        {
+            while (Values[Left] < Pivot)
+                Left++;
+            while (Values[Right] > Pivot)
+                Right--;
+            if (Left <= Right)
+            {
+                Temp = Values[Left];
+                Values[Left] = Values[Right];
+                Values[Right] = Temp;
+                Left++;
+                if (Right == 0)
+                    break;
+                Right--;
+            }
+        }
+        if (Rank <= Right)
+            High = Right;
+        else if (Rank >= Left)
+            Low = Left;
+        else
+            break;
+    }
+    return Values[Rank];
+}
+
+
+//
+// estimate the noise floor of each bin from the averaged powers (PowerSum / Averages)
+// each segment's 25th percentile is scaled to the distribution mean. A
+// segment more than 1.5dB above the least of itself and VWBDNEIGHBOURS
+// segments either side is taken to be raised by a wide signal, and takes that
+// least value instead (always taking the least would bias the floor low).
+// bins are interpolated between segment centres
+//
+static void WBDEstimateNoise(TWBDetector* Det)
+{
+    float Values[VWBDSEGMENT];
+    float Raw[VWBDMAXSEGMENTS];
+    float Sorted[VWBDMAXSEGMENTS];
+    uint32_t Segments = Det->HalfSize / VWBDSEGMENT;
+    uint32_t Segment, Other, Bin, Lower;
+    int32_t First, Last;
+    float Scale = (float)(1.0 / (Det->Averages * Det->NoiseCorrection));
+    float Least, Position, Fraction;
+
+    for (Segment = 0; Segment < Segments; Segment++)
+    {
+        memcpy(Values, Det->PowerSum + Segment * VWBDSEGMENT, sizeof(Values));
+        Raw[Segment] = WBDSelect(Values, VWBDSEGMENT, (uint32_t)(VWBDPERCENTILE * VWBDSEGMENT)) * Scale;
+    }
+    for (Segment = 0; Segment < Segments; Segment++)
+    {
+        First = (int32_t)Segment - VWBDNEIGHBOURS;
+        Last = (int32_t)Segment + VWBDNEIGHBOURS;
+        if (First < 0)
+            First = 0;
+        if (Last > (int32_t)Segments - 1)
+            Last = (int32_t)Segments - 1;
+        Least = Raw[First];
+        for (Other = (uint32_t)First + 1; Other <= (uint32_t)Last; Other++)
+            if (Raw[Other] < Least)
+                Least = Raw[Other];
+        Det->SegmentNoise[Segment] = (Raw[Segment] > Least * VWBDRAISEDFACTOR) ? Least : Raw[Segment];
+    }
+    for (Bin = 0; Bin < Det->HalfSize; Bin++)
+    {
+        Position = ((float)Bin - 0.5f * (VWBDSEGMENT - 1)) / VWBDSEGMENT;
+        if (Position <= 0.0f)
+            Det->Noise[Bin] = Det->SegmentNoise[0];
+        else if (Position >= (float)(Segments - 1))
+            Det->Noise[Bin] = Det->SegmentNoise[Segments - 1];
+        else
+        {
+            Lower = (uint32_t)Position;
+            Fraction = Position - (float)Lower;
+            Det->Noise[Bin] = Det->SegmentNoise[Lower] + Fraction * (Det->SegmentNoise[Lower + 1] - Det->SegmentNoise[Lower]);
+        }
+    }
+    memcpy(Sorted, Det->SegmentNoise, Segments * sizeof(float));
+    Det->NoisedBFS = 10.0 * log10(WBDSelect(Sorted, Segments, Segments / 2) / Det->FullScale + 1.0e-30);
+}
+
+
+//
+// power above the noise floor in a bin, if it is above the continue threshold
+// (noise in the gaps of a detection does not move its centre or widen it)
+//
+static inline double WBDExcess(TWBDetector* Det, float* Power, uint32_t Bin)
+{
+    if (Power[Bin] <= Det->Noise[Bin] * (float)Det->ContinueFactor)
+        return 0.0;
+    return Power[Bin] - Det->Noise[Bin];
+}
+
+
+//
+// measure one detection: bins First to Last of the averaged power
+// frequency is the centroid of the power above the noise floor; bandwidth
+// leaves VWBDOBWFRACTION of that power outside each edge
+//
+static void WBDMeasureRegion(TWBDetector* Det, TWBDRegion* Region, float* Power)
+{
+    uint32_t Bin;
+    double Excess, Total = 0.0, Moment = 0.0, Peak = 0.0, SNR, Target, Sum;
+    double LowEdge, HighEdge;
+
+    Region->AboveBins = 0;
+    for (Bin = Region->FirstBin; Bin <= Region->LastBin; Bin++)
+    {
+        Excess = WBDExcess(Det, Power, Bin);
+        if (Excess > 0.0)
+            Region->AboveBins++;
+        Total += Excess;
+        Moment += Excess * Bin;
+        SNR = Power[Bin] / Det->Noise[Bin];
+        if (SNR > Peak)
+            Peak = SNR;
+    }
+    Region->SNRdB = 10.0 * log10(Peak);
+    if (Total <= 0.0)
+    {
+        Region->FrequencyHz = 0.5 * (Region->FirstBin + Region->LastBin) * Det->BinHz;
+        Region->BandwidthHz = Det->BinHz;
+        return;
+    }
+    Region->FrequencyHz = Moment / Total * Det->BinHz;
+
+    //
+    // occupied bandwidth edges, in bins; bin n covers n-0.5 to n+0.5
+    //
+    Target = VWBDOBWFRACTION * Total;
+    Sum = 0.0;
+    LowEdge = Region->FirstBin - 0.5;
+    for (Bin = Region->FirstBin; Bin <= Region->LastBin; Bin++)
+    {
+        Excess = WBDExcess(Det, Power, Bin);
+        if (Excess <= 0.0)
+            continue;
+        if (Sum + Excess >= Target)
+        {
+            LowEdge = Bin - 0.5 + (Target - Sum) / Excess;
+            break;
+        }
+        Sum += Excess;
+    }
+    Sum = 0.0;
+    HighEdge = Region->LastBin + 0.5;
+    for (Bin = Region->LastBin + 1; Bin-- > Region->FirstBin; )
+    {
+        Excess = WBDExcess(Det, Power, Bin);
+        if (Excess <= 0.0)
+            continue;
+        if (Sum + Excess >= Target)
+        {
+            HighEdge = Bin + 0.5 - (Target - Sum) / Excess;
+            break;
+        }
+        Sum += Excess;
+    }
+    Region->BandwidthHz = (HighEdge > LowEdge) ? (HighEdge - LowEdge) * Det->BinHz : 0.0;
+}
+
+
+//
+// find runs of bins above the continue threshold; gaps of up to VWBDMERGEBINS
+// bins are inside a run. The averaged power is left in PowerSum.
+//
+static void WBDFindRegions(TWBDetector* Det)
+{
+    float* Power = Det->PowerSum;
+    uint32_t Bin, Gap = 0;
+    bool Open = false;
+    TWBDRegion* Region = NULL;
+    float Continue = (float)Det->ContinueFactor;
+    float Start = (float)Det->StartFactor;
+
+    Det->RegionCount = 0;
+    for (Bin = VWBDDCBINS; Bin < Det->HalfSize; Bin++)
+    {
+        if (Power[Bin] > Det->Noise[Bin] * Continue)
+        {
+            if (!Open)
+            {
+                if (Det->RegionCount >= VWBDMAXREGIONS)
+                {
+                    Det->Stats.LostRegions++;
+                    break;
+                }
+                Region = &Det->Regions[Det->RegionCount++];
+                Region->FirstBin = Bin;
+                Region->AboveStart = false;
+                Region->Used = false;
+                Open = true;
+            }
+            Region->LastBin = Bin;
+            Gap = 0;
+            if (Power[Bin] > Det->Noise[Bin] * Start)
+                Region->AboveStart = true;
+        }
+        else if (Open && (++Gap > VWBDMERGEBINS))
+        {
+            WBDMeasureRegion(Det, Region, Power);
+            Open = false;
+        }
+    }
+    if (Open)
+        WBDMeasureRegion(Det, Region, Power);
+}
+
+
+//
+// add an event to the queue
+//
+static void WBDAddEvent(TWBDetector* Det, TWBDSignal* Signal, EWBDEventType Type, uint64_t StopUs)
+{
+    TWBDEvent* Event;
+
+    if (Det->EventCount >= VWBDMAXEVENTS)
+    {
+        Det->Stats.LostEvents++;
+        return;
+    }
+    Event = &Det->Events[Det->EventCount++];
+    Event->Id = Signal->Id;
+    Event->Type = Type;
+    Event->FrequencyHz = Signal->FrequencyHz;
+    Event->BandwidthHz = Signal->BandwidthHz;
+    Event->SNRdB = Signal->SNRdB;
+    Event->StartUs = Signal->StartUs;
+    Event->StopUs = StopUs;
+    Det->Stats.Events++;
+}
+
+
+//
+// match this update's detections to tracked signals
+// a tracked signal continues if the detections (above the continue
+// threshold) overlapping it have at least a quarter as many bins above that
+// threshold as it had when last seen, so that stray noise bins inside a wide
+// signal's extent do not keep it present; only a detection with a bin above
+// the start threshold can begin a new signal.
+// the signal is measured over all the detections it continues with. Its
+// frequency and bandwidth are those of the update with the highest peak SNR
+//
+static void WBDTrack(TWBDetector* Det, uint64_t TimeUs)
+{
+    TWBDSignal* Signal;
+    TWBDRegion* Region;
+    TWBDRegion* Single = NULL;
+    TWBDRegion Combined;
+    uint32_t Index, RegionIndex, Kept, Matched, AboveBins;
+
+    for (Index = 0; Index < Det->SignalCount; Index++)
+    {
+        Signal = &Det->Signals[Index];
+        Matched = 0;
+        AboveBins = 0;
+        for (RegionIndex = 0; RegionIndex < Det->RegionCount; RegionIndex++)
+        {
+            Region = &Det->Regions[RegionIndex];
+            if ((Region->FirstBin > Signal->LastBin + VWBDMATCHBINS) || (Region->LastBin + VWBDMATCHBINS < Signal->FirstBin))
+                continue;
+            if ((Matched == 0) || (Region->FirstBin < Combined.FirstBin))
+                Combined.FirstBin = Region->FirstBin;
+            if ((Matched == 0) || (Region->LastBin > Combined.LastBin))
+                Combined.LastBin = Region->LastBin;
+            AboveBins += Region->AboveBins;
+            Single = Region;
+            Matched++;
+        }
+        if ((Matched == 0) || (4 * AboveBins < Signal->AboveBins))
+        {
+            Signal->Misses++;
+            continue;
+        }
+        for (RegionIndex = 0; RegionIndex < Det->RegionCount; RegionIndex++)
+        {
+            Region = &Det->Regions[RegionIndex];
+            if ((Region->FirstBin <= Signal->LastBin + VWBDMATCHBINS) && (Region->LastBin + VWBDMATCHBINS >= Signal->FirstBin))
+                Region->Used = true;
+        }
+        if (Matched > 1)
+            WBDMeasureRegion(Det, &Combined, Det->PowerSum);
+        else
+            Combined = *Single;
+        Signal->FirstBin = Combined.FirstBin;
+        Signal->LastBin = Combined.LastBin;
+        Signal->AboveBins = Combined.AboveBins;
+        Signal->Hits++;
+        Signal->Misses = 0;
+        Signal->LastSeenUs = TimeUs;
+        if (Combined.SNRdB > Signal->SNRdB)
+        {
+            Signal->SNRdB = Combined.SNRdB;
+            Signal->FrequencyHz = Combined.FrequencyHz;
+            Signal->BandwidthHz = Combined.BandwidthHz;
+        }
+        if (!Signal->Started && (Signal->Hits >= VWBDSTARTUPDATES))
+        {
+            Signal->Started = true;
+            WBDAddEvent(Det, Signal, eWBDStart, 0);
+        }
+    }
+
+    //
+    // remove signals not seen: candidates at once, started signals after the hold time
+    //
+    Kept = 0;
+    for (Index = 0; Index < Det->SignalCount; Index++)
+    {
+        Signal = &Det->Signals[Index];
+        if (Signal->Misses != 0)
+        {
+            if (!Signal->Started)
+                continue;
+            if (Signal->Misses >= VWBDHOLDUPDATES)
+            {
+                WBDAddEvent(Det, Signal, eWBDStop, Signal->LastSeenUs);
+                continue;
+            }
+        }
+        if (Kept != Index)
+            Det->Signals[Kept] = *Signal;
+        Kept++;
+    }
+    Det->SignalCount = Kept;
+
+    //
+    // new candidates
+    //
+    for (RegionIndex = 0; RegionIndex < Det->RegionCount; RegionIndex++)
+    {
+        Region = &Det->Regions[RegionIndex];
+        if (Region->Used || !Region->AboveStart)
+            continue;
+        if (Det->SignalCount >= VWBDMAXSIGNALS)
+        {
+            Det->Stats.LostRegions++;
+            continue;
+        }
+        Signal = &Det->Signals[Det->SignalCount++];
+        memset(Signal, 0, sizeof(TWBDSignal));
+        Signal->Id = Det->NextId++;
+        Signal->FirstBin = Region->FirstBin;
+        Signal->LastBin = Region->LastBin;
+        Signal->AboveBins = Region->AboveBins;
+        Signal->Hits = 1;
+        Signal->FrequencyHz = Region->FrequencyHz;
+        Signal->BandwidthHz = Region->BandwidthHz;
+        Signal->SNRdB = Region->SNRdB;
+        Signal->StartUs = TimeUs;
+        Signal->LastSeenUs = TimeUs;
+        if (VWBDSTARTUPDATES <= 1)
+        {
+            Signal->Started = true;
+            WBDAddEvent(Det, Signal, eWBDStart, 0);
+        }
+    }
+}
+
+
+//
+// add one capture of 16 bit big endian ADC samples
+// returns true if an update has been completed
+//
+bool WBDetectAddCapture(TWBDetector* Det, uint8_t* Src, uint32_t Count, uint64_t TimeUs)
+{
+    uint64_t StartTime, Ns;
+    uint32_t Bin;
+    float Scale;
+
+    Det->Stats.Captures++;
+    if (Count < Det->FFTSize)
+    {
+        Det->Stats.ShortCaptures++;
+        return false;
+    }
+    if ((Det->LastCaptureUs != 0) && (TimeUs >= Det->LastCaptureUs)
+        && ((TimeUs - Det->LastCaptureUs) < Det->CapturePeriodUs * 9 / 10))
+    {
+        Det->Stats.RateSkipped++;
+        return false;
+    }
+
+    //
+    // CPU budget, per second of captures
+    //
+    if ((TimeUs < Det->WindowStartUs) || (TimeUs - Det->WindowStartUs >= 1000000ULL))
+    {
+        Det->WindowStartUs = TimeUs;
+        Det->WindowNs = 0;
+        Det->WindowOver = false;
+    }
+    if (Det->WindowOver)
+    {
+        Det->Stats.BudgetSkipped++;
+        return false;
+    }
+
+    StartTime = WBDGetTimeNs();
+    Det->LastCaptureUs = TimeUs;
+    WBDTransform(Det, Src);
+    Det->Stats.Processed++;
+    if (++Det->AveragesDone >= Det->Averages)
+    {
+        WBDEstimateNoise(Det);
+        Scale = 1.0f / (float)Det->Averages;
+        for (Bin = 0; Bin < Det->HalfSize; Bin++)
+            Det->PowerSum[Bin] *= Scale;
+        WBDFindRegions(Det);
+        WBDTrack(Det, TimeUs);
+        memset(Det->PowerSum, 0, Det->HalfSize * sizeof(float));
+        Det->AveragesDone = 0;
+        Det->Stats.Updates++;
+    }
+    Ns = WBDGetTimeNs() - StartTime;
+    Det->WindowNs += Ns;
+    Det->Stats.ProcessingNs += Ns;
+    if (Det->WindowNs > (uint64_t)Det->BudgetPercent * 10000000ULL)
+        Det->WindowOver = true;
+    return (Det->AveragesDone == 0);
+}
+
+
+//
+// copy up to Max events out of the queue and remove them. Returns the number copied
+//
+uint32_t WBDetectTakeEvents(TWBDetector* Det, TWBDEvent* Dest, uint32_t Max)
+{
+    uint32_t Count = Det->EventCount;
+
+    if (Count > Max)
+        Count = Max;
+    memcpy(Dest, Det->Events, Count * sizeof(TWBDEvent));
+    Det->EventCount -= Count;
+    memmove(Det->Events, Det->Events + Count, Det->EventCount * sizeof(TWBDEvent));
+    return Count;
+}
+
+
+//
+// list signals currently present as eWBDActive events. Returns the number listed
+//
+uint32_t WBDetectListActive(TWBDetector* Det, TWBDEvent* Dest, uint32_t Max)
+{
+    uint32_t Index, Count = 0;
+    TWBDSignal* Signal;
+
+    for (Index = 0; (Index < Det->SignalCount) && (Count < Max); Index++)
+    {
+        Signal = &Det->Signals[Index];
+        if (!Signal->Started)
+            continue;
+        Dest[Count].Id = Signal->Id;
+        Dest[Count].Type = eWBDActive;
+        Dest[Count].FrequencyHz = Signal->FrequencyHz;
+        Dest[Count].BandwidthHz = Signal->BandwidthHz;
+        Dest[Count].SNRdB = Signal->SNRdB;
+        Dest[Count].StartUs = Signal->StartUs;
+        Dest[Count].StopUs = 0;
+        Count++;
+    }
+    return Count;
+}
+
+
+//
+// write a 64 bit value big endian
+//
+static void WBDPut64(uint8_t* Dest, uint64_t Value)
+{
+    *(uint32_t*)Dest = htonl((uint32_t)(Value >> 32));
+    *(uint32_t*)(Dest + 4) = htonl((uint32_t)Value);
+}
+
+
+//
+// write an event packet holding Count (up to VWBDEVENTSPERPACKET) events
+// returns its length in bytes
+//
+uint32_t WBDetectMakePacket(TWBDEvent* Events, uint32_t Count, uint32_t SequenceNumber, uint8_t ADC,
+                            uint64_t TimeUs, uint8_t* Dest)
+{
+    uint32_t Index;
+    uint8_t* Ptr;
+    double SNR;
+
+    if (Count > VWBDEVENTSPERPACKET)
+        Count = VWBDEVENTSPERPACKET;
+    *(uint32_t*)Dest = htonl(SequenceNumber);
+    *(uint16_t*)(Dest + 4) = htons((uint16_t)Count);
+    Dest[6] = ADC;
+    Dest[7] = 0;
+    WBDPut64(Dest + 8, TimeUs);
+    Ptr = Dest + VWBDHEADERSIZE;
+    for (Index = 0; Index < Count; Index++)
+    {
+        SNR = Events[Index].SNRdB * 100.0;
+        if (SNR > 32767.0)
+            SNR = 32767.0;
+        *(uint32_t*)Ptr = htonl(Events[Index].Id);
+        Ptr[4] = (uint8_t)Events[Index].Type;
+        Ptr[5] = 0;
+        *(uint16_t*)(Ptr + 6) = htons((uint16_t)(int16_t)lrint(SNR));
+        *(uint32_t*)(Ptr + 8) = htonl((uint32_t)lrint(Events[Index].FrequencyHz));
+        *(uint32_t*)(Ptr + 12) = htonl((uint32_t)lrint(Events[Index].BandwidthHz));
+        WBDPut64(Ptr + 16, Events[Index].StartUs);
+        WBDPut64(Ptr + 24, Events[Index].StopUs);
+        Ptr += VWBDEVENTSIZE;
+    }
+    return VWBDHEADERSIZE + Count * VWBDEVENTSIZE;
+}
+
+
+//
+// print statistics
+//
+void WBDetectPrintStatistics(char* Name, TWBDetector* Det)
+{
+    TWBDetectStatistics* Stats = &Det->Stats;
+
+    if (Stats->Captures == 0)
+        return;
+    printf("%s: %d point FFT (%.0fHz bins), %d updates/s of %d captures; start threshold %.1fdB, continue %.1fdB over noise\n",
+           Name, Det->FFTSize, Det->BinHz, Det->UpdatesPerSecond, Det->Averages,
+           10.0 * log10(Det->StartFactor), 10.0 * log10(Det->ContinueFactor));
+    printf("%s: %llu captures: %llu transformed, %llu not needed for the update rate, %llu over budget, %llu short; %llu updates\n",
+           Name, (unsigned long long)Stats->Captures, (unsigned long long)Stats->Processed,
+           (unsigned long long)Stats->RateSkipped, (unsigned long long)Stats->BudgetSkipped,
+           (unsigned long long)Stats->ShortCaptures, (unsigned long long)Stats->Updates);
+    printf("%s: %.0fus per capture (budget %d%%); noise floor %.1fdBFS per bin; %llu events, %d signals present",
+           Name, (Stats->Processed != 0) ? (double)Stats->ProcessingNs / Stats->Processed / 1000.0 : 0.0,
+           Det->BudgetPercent, Det->NoisedBFS, (unsigned long long)Stats->Events, Det->SignalCount);
+    if ((Stats->LostEvents != 0) || (Stats->LostRegions != 0))
+        printf("; %llu events lost, %llu detections not tracked", (unsigned long long)Stats->LostEvents,
+               (unsigned long long)Stats->LostRegions);
+    printf("\n");
+}
+
+
+//
+// measure processing time per capture on this processor for each FFT size,
+// and print the CPU load at typical update rates
+// the capture is noise with a few tones, so the detection stages do typical work
+//
+void WBDetectPrintBenchmark(void)
+{
+    static const uint32_t Sizes[] = {4096, 8192, 16384};
+    static const uint32_t Rates[] = {10, 25, 50};          // captures per second
+    TWBDetector Det;
+    uint8_t* Capture;
+    char Model[80] = "unknown processor";
+    uint32_t Size, Sample, Done, Rate;
+    uint32_t Seed = 12345;
+    int32_t Value;
+    uint64_t StartTime;
+    double UsPerCapture, Noise;
+    FILE* Fp;
+
+    Fp = fopen("/proc/device-tree/model", "r");
+    if (Fp != NULL)
+    {
+        if (fgets(Model, sizeof(Model), Fp) == NULL)
+            strcpy(Model, "unknown processor");
+        fclose(Fp);
+    }
+    printf("wideband detector benchmark on %s:\n", Model);
+    Capture = malloc(2 * VWBDMAXFFT);
+    if (Capture == NULL)
+        return;
+    for (Sample = 0; Sample < VWBDMAXFFT; Sample++)
+    {
+        Seed = Seed * 1664525U + 1013904223U;
+        Noise = ((double)(Seed >> 8) / 16777216.0 - 0.5) * 64.0;
+        Value = (int32_t)lrint(Noise + 3000.0 * cos(0.3 * Sample) + 300.0 * cos(1.7 * Sample) + 30.0 * cos(2.9 * Sample));
+        Capture[2 * Sample] = (uint8_t)(Value >> 8);
+        Capture[2 * Sample + 1] = (uint8_t)Value;
+    }
+    for (Size = 0; Size < sizeof(Sizes) / sizeof(Sizes[0]); Size++)
+    {
+        if (WBDetectInit(&Det, Sizes[Size], 1, 1, 0.0, VWBDDEFAULTHYSTERESIS, 100))
+            break;
+        StartTime = WBDGetTimeNs();
+        for (Done = 0; Done < VWBDBENCHCAPTURES; Done++)
+            WBDetectAddCapture(&Det, Capture, VWBDMAXFFT, (uint64_t)(Done + 1) * 2000000ULL);
+        UsPerCapture = (double)(WBDGetTimeNs() - StartTime) / Done / 1000.0;
+        printf("  %5d point FFT (%5.0fHz bins): %.0fus per capture;", Sizes[Size], Det.BinHz, UsPerCapture);
+        for (Rate = 0; Rate < sizeof(Rates) / sizeof(Rates[0]); Rate++)
+            printf(" %.1f%% of a core at %d captures/s;", UsPerCapture * Rates[Rate] / 1e4, Rates[Rate]);
+        printf(" raw frames would be %.1fMbit/s at 40 captures/s\n", 40.0 * 2.0 * Sizes[Size] * 8.0 / 1e6);
+        WBDetectFree(&Det);
+    }
+    free(Capture);
+}
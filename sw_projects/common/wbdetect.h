@@ -0,0 +1,270 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// wbdetect.h:
+// signal detector for raw wideband ADC captures: FFT, noise floor
+// estimate and CFAR threshold with hysteresis, reported as signal
+// start and stop events
+//
+//////////////////////////////////////////////////////////////
+
+#ifndef __wbdetect_h
+#define __wbdetect_h
+
+#include <stdint.h>
+#include "saturntypes.h"
+
+
+#define VWBDSAMPLERATE 122880000                    // ADC sample rate, Hz
+#define VWBDMINFFT 1024                             // smallest FFT size (real samples per capture used)
+#define VWBDMAXFFT 16384                            // largest: fills the wideband DMA buffer
+#define VWBDDEFAULTFFT 16384                        // 7.5kHz bins
+#define VWBDMAXUPDATES 50                           // most detection updates per second
+#define VWBDDEFAULTUPDATES 10
+#define VWBDMAXAVERAGES 16                          // most captures averaged per update
+#define VWBDDEFAULTAVERAGES 4
+#define VWBDDEFAULTHYSTERESIS 3                     // dB from start threshold down to continue threshold
+#define VWBDDEFAULTBUDGET 10                        // default CPU budget, % of a core
+#define VWBDPFA 1.0e-6                              // false alarm probability per bin per update
+#define VWBDSEGMENT 64                              // bins per noise floor segment
+#define VWBDSTARTUPDATES 2                          // updates detected before a start event
+#define VWBDHOLDUPDATES 3                           // updates missed before a stop event
+#define VWBDMAXSIGNALS 128                          // signals tracked at once
+#define VWBDMAXREGIONS 256                          // detections per update
+#define VWBDMAXEVENTS 256                           // events held for the caller
+#define VWBDHEADERSIZE 16                           // bytes before events in an event packet
+#define VWBDEVENTSIZE 32                            // bytes per event
+#define VWBDEVENTSPERPACKET 40
+#define VWBDPACKETSIZE (VWBDHEADERSIZE + VWBDEVENTSIZE * VWBDEVENTSPERPACKET)
+
+
+//
+// event packet (sent to each subscriber)
+// bytes 0-3    sequence number
+// bytes 4-5    events in this packet
+// byte 6       ADC (0 or 1)
+// byte 7       0
+// bytes 8-15   time of the update, us since the unix epoch
+// then 32 bytes per event:
+// bytes 0-3    signal ID
+// byte 4       event type (EWBDEventType)
+// byte 5       0
+// bytes 6-7    peak SNR, signed 0.01dB
+// bytes 8-11   centre frequency, Hz
+// bytes 12-15  99% occupied bandwidth, Hz
+// bytes 16-23  start time, us since the unix epoch
+// bytes 24-31  stop time, us since the unix epoch (0 if not stopped)
+// all fields big endian.
+//
+
+
+//
+// event types
+// start: a signal has been present for VWBDSTARTUPDATES updates
+// stop: a signal has been absent for VWBDHOLDUPDATES updates. Stop time is the last update it was seen
+// active: a signal still present, listed for a new subscriber
+//
+typedef enum
+{
+    eWBDStart = 1,
+    eWBDStop,
+    eWBDActive
+} EWBDEventType;
+
+
+//
+// one detection event
+//
+typedef struct
+{
+    uint32_t Id;
+    EWBDEventType Type;
+    double FrequencyHz;                             // excess power centroid, at the highest SNR seen
+    double BandwidthHz;                             // 99% occupied bandwidth, at the highest SNR seen
+    double SNRdB;                                   // peak bin over noise floor, largest seen
+    uint64_t StartUs;
+    uint64_t StopUs;
+} TWBDEvent;
+
+
+//
+// detector statistics
+//
+typedef struct
+{
+    uint64_t Captures;                              // captures offered
+    uint64_t Processed;                             // captures transformed
+    uint64_t RateSkipped;                           // captures not needed for the update rate
+    uint64_t BudgetSkipped;                         // captures skipped: over CPU budget
+    uint64_t ShortCaptures;                         // captures with fewer samples than the FFT size
+    uint64_t Updates;
+    uint64_t Events;
+    uint64_t LostEvents;                            // events not taken before the queue filled
+    uint64_t LostRegions;                           // detections beyond VWBDMAXREGIONS or VWBDMAXSIGNALS
+    uint64_t ProcessingNs;
+} TWBDetectStatistics;
+
+
+//
+// a signal being tracked; not reported until it has been seen for VWBDSTARTUPDATES updates
+//
+typedef struct
+{
+    uint32_t Id;
+    uint32_t FirstBin, LastBin;                     // latest extent
+    uint32_t AboveBins;                             // bins above the continue threshold when last seen
+    uint32_t Hits;                                  // updates seen
+    uint32_t Misses;                                // consecutive updates not seen
+    bool Started;                                   // start event sent
+    double FrequencyHz;
+    double BandwidthHz;
+    double SNRdB;
+    uint64_t StartUs;
+    uint64_t LastSeenUs;
+} TWBDSignal;
+
+
+//
+// a detection in one update: a run of bins above the continue threshold
+//
+typedef struct
+{
+    uint32_t FirstBin, LastBin;
+    uint32_t AboveBins;                             // bins above the continue threshold
+    bool AboveStart;                                // at least one bin above the start threshold
+    bool Used;                                      // matched to a tracked signal
+    double FrequencyHz;
+    double BandwidthHz;
+    double SNRdB;
+} TWBDRegion;
+
+
+//
+// detector for one ADC
+// each capture's first FFTSize samples are windowed (Blackman-Harris) and
+// transformed with a real input FFT; Averages captures are averaged per
+// update. The noise floor is the 25th percentile of each VWBDSEGMENT bin
+// segment, corrected for the averaged power distribution; a segment well
+// above the least of its two neighbours either side takes that least value,
+// so that a signal up to 4 segments wide does not raise the floor under
+// itself. The floor is interpolated between segment centres.
+// a bin starts a detection if its power exceeds the CFAR threshold (set for
+// VWBDPFA from the averaged noise distribution, or MinSNR if higher); a
+// detection continues over bins, and a tracked signal stays present over
+// updates, while bins exceed a threshold HysteresisdB lower (but not so low
+// that noise exceeds it in more than 1% of bins). The window main lobe means
+// a pure tone measures 3 to 4.5 bins wide.
+// CPU use: captures beyond Averages * UpdatesPerSecond per second are not
+// transformed, and if the time used in a second of captures exceeds the
+// budget, the rest of that second's captures are skipped.
+//
+typedef struct
+{
+    uint32_t FFTSize;                               // real samples per transform
+    uint32_t HalfSize;                              // complex FFT size, and number of bins
+    uint32_t Log2Half;
+    uint32_t UpdatesPerSecond;
+    uint32_t Averages;
+    double MinSNRdB;
+    double HysteresisdB;
+    uint32_t BudgetPercent;
+    double StartFactor;                             // start threshold, power / noise
+    double ContinueFactor;
+    double NoiseCorrection;                         // 25th percentile of the averaged noise distribution
+    double BinHz;
+    double FullScale;                               // bin power of a full scale tone
+    uint64_t CapturePeriodUs;                       // shortest time between transformed captures
+    float* Window;
+    float* Twiddle;                                 // cos, sin pairs for the complex FFT
+    float* SplitTwiddle;                            // cos, sin pairs for the real FFT split
+    uint32_t* BitReverse;
+    float* Work;                                    // interleaved re, im
+    float* PowerSum;                                // summed bin power for this update
+    float* Noise;                                   // noise floor per bin, in power
+    float* SegmentNoise;
+    uint32_t AveragesDone;
+    uint64_t LastCaptureUs;
+    uint64_t WindowStartUs;                         // start of this budget second
+    uint64_t WindowNs;                              // time used in this budget second
+    bool WindowOver;
+    uint32_t NextId;
+    double NoisedBFS;                               // median noise floor of the last update, per bin
+    TWBDSignal Signals[VWBDMAXSIGNALS];
+    uint32_t SignalCount;
+    TWBDRegion Regions[VWBDMAXREGIONS];
+    uint32_t RegionCount;
+    TWBDEvent Events[VWBDMAXEVENTS];                // events not yet taken
+    uint32_t EventCount;
+    TWBDetectStatistics Stats;
+} TWBDetector;
+
+
+//
+// initialise a detector. FFTSize must be a power of 2.
+// MinSNRdB: least start threshold over the noise floor (0 = CFAR threshold only)
+// returns true if settings are not valid or memory could not be allocated
+//
+bool WBDetectInit(TWBDetector* Det, uint32_t FFTSize, uint32_t UpdatesPerSecond, uint32_t Averages,
+                  double MinSNRdB, double HysteresisdB, uint32_t BudgetPercent);
+
+
+//
+// free a detector's memory
+//
+void WBDetectFree(TWBDetector* Det);
+
+
+//
+// forget tracked signals, partial averages and statistics, ready for a new run
+//
+void WBDetectRestart(TWBDetector* Det);
+
+
+//
+// add one capture of 16 bit big endian ADC samples, as held in the wideband
+// DMA buffer. TimeUs is the capture time, us since the unix epoch.
+// returns true if an update has been completed: take its events with WBDetectTakeEvents
+//
+bool WBDetectAddCapture(TWBDetector* Det, uint8_t* Src, uint32_t Count, uint64_t TimeUs);
+
+
+//
+// copy up to Max events out of the queue and remove them. Returns the number copied
+//
+uint32_t WBDetectTakeEvents(TWBDetector* Det, TWBDEvent* Dest, uint32_t Max);
+
+
+//
+// list signals currently present as eWBDActive events. Returns the number listed
+//
+uint32_t WBDetectListActive(TWBDetector* Det, TWBDEvent* Dest, uint32_t Max);
+
+
+//
+// write an event packet holding Count (up to VWBDEVENTSPERPACKET) events
+// returns its length in bytes
+//
+uint32_t WBDetectMakePacket(TWBDEvent* Events, uint32_t Count, uint32_t SequenceNumber, uint8_t ADC,
+                            uint64_t TimeUs, uint8_t* Dest);
+
+
+//
+// print statistics
+//
+void WBDetectPrintStatistics(char* Name, TWBDetector* Det);
+
+
+//
+// measure processing time per capture on this processor for each FFT size,
+// and print the CPU load at typical update rates
+//
+void WBDetectPrintBenchmark(void);
+
+
+#endif
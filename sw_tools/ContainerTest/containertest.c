@@ -0,0 +1,368 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// containertest.c:
+//
+// test of the p2app multi-DDC container packets.
+// synthetic I/Q streams for several DDCs are packed into containers,
+// unpacked again, and every rebuilt I/Q packet is checked byte for byte
+// against the standard packet p2app would have sent. Repeated with
+// containers dropped, to check that loss never corrupts a packet.
+// then standard packets and containers of several sizes are sent to a
+// loopback socket, reporting datagrams per second and sender CPU time.
+//
+//////////////////////////////////////////////////////////////
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "../../sw_projects/common/ddccontainer.h"
+
+//------------------------------------------------------------------------------------------
+// VERSION History
+// V1, 18/10/2026:   initial release
+
+
+#define VDEFAULTRATE 48                         // ksps
+#define VDEFAULTDDCS 10
+#define VDEFAULTINTERVAL 10                     // ms
+#define VDEFAULTSECONDS 20                      // seconds of stream for each test
+#define VSINKPORT 50999                         // loopback port for throughput test
+
+
+//
+// sample i of a DDC's synthetic stream (6 bytes)
+//
+static void MakeSample(uint32_t DDC, uint32_t Index, uint8_t* Dest)
+{
+    uint32_t I = Index * 2654435761U ^ DDC * 0x9E3779B9U;
+    uint32_t Q = (Index + 12345U) * 40503U ^ (DDC << 24);
+
+    Dest[0] = (uint8_t)(I >> 24);
+    Dest[1] = (uint8_t)(I >> 16);
+    Dest[2] = (uint8_t)(I >> 8);
+    Dest[3] = (uint8_t)(Q >> 24);
+    Dest[4] = (uint8_t)(Q >> 16);
+    Dest[5] = (uint8_t)(Q >> 8);
+}
+
+
+//
+// the standard I/Q packet p2app sends for packet number Sequence of a DDC
+//
+static void MakeStandardPacket(uint32_t DDC, uint32_t Sequence, uint8_t* Packet)
+{
+    uint32_t Sample;
+
+    *(uint32_t*)Packet = htonl(Sequence);
+    memset(Packet + 4, 0, 8);
+    *(uint16_t*)(Packet + 12) = htons(24);
+    *(uint16_t*)(Packet + 14) = htons(VCTSAMPLESPERPACKET);
+    for (Sample = 0; Sample < VCTSAMPLESPERPACKET; Sample++)
+        MakeSample(DDC, Sequence * VCTSAMPLESPERPACKET + Sample, Packet + 16 + 6 * Sample);
+}
+
+
+//
+// check results
+//
+typedef struct
+{
+    uint64_t Packets[VCTMAXDDC];                // rebuilt packets for each DDC
+    uint32_t LastSequence[VCTMAXDDC];
+    uint64_t Mismatches;
+    uint64_t OutOfOrder;
+} TCheck;
+
+
+//
+// unpacker output: compare with the standard packet
+//
+static void CheckPacket(void* Context, uint32_t DDC, uint8_t* Packet)
+{
+    TCheck* Check = (TCheck*)Context;
+    uint8_t Expected[VCTPACKETSIZE];
+    uint32_t Sequence = ntohl(*(uint32_t*)Packet);
+
+    MakeStandardPacket(DDC, Sequence, Expected);
+    if (memcmp(Packet, Expected, VCTPACKETSIZE) != 0)
+        Check->Mismatches++;
+    if ((Check->Packets[DDC] != 0) && (Sequence <= Check->LastSequence[DDC]))
+        Check->OutOfOrder++;
+    Check->LastSequence[DDC] = Sequence;
+    Check->Packets[DDC]++;
+}
+
+
+//
+// pack NumDDC streams into containers of MaxSize, sent every Interval ms, and unpack them
+// every DropEvery'th container is discarded (0 = none)
+// returns true if any rebuilt packet is wrong, or packets are missing without loss
+//
+static bool RunRestoreTest(uint32_t NumDDC, uint32_t Rate, uint32_t Interval, uint32_t Seconds,
+                           uint32_t MaxSize, uint32_t DropEvery)
+{
+    TDDCContainer Container;
+    TDDCUnpacker* Unpacker;
+    TCheck Check;
+    uint8_t* Samples;
+    uint32_t DDC, Count, Added, Length, Sample, Tick;
+    uint32_t Ticks = Seconds * 1000 / Interval;
+    uint32_t SamplesPerTick = Rate * Interval;
+    uint64_t Expected = 0, Rebuilt = 0, Datagrams = 0, Dropped = 0;
+    bool Failed;
+
+    Unpacker = malloc(sizeof(TDDCUnpacker));
+    Samples = malloc(6 * SamplesPerTick);
+    if ((Unpacker == NULL) || (Samples == NULL) || ContainerInit(&Container, MaxSize))
+    {
+        printf("container test: memory or size error\n");
+        return true;
+    }
+    ContainerUnpackInit(Unpacker);
+    memset(&Check, 0, sizeof(Check));
+
+    for (Tick = 0; Tick < Ticks; Tick++)
+    {
+        for (DDC = 0; DDC < NumDDC; DDC++)
+        {
+            for (Sample = 0; Sample < SamplesPerTick; Sample++)
+                MakeSample(DDC, Container.NextSample[DDC] + Sample, Samples + 6 * Sample);
+            Count = SamplesPerTick;
+            while (Count != 0)
+            {
+                Added = ContainerAddSamples(&Container, DDC, Samples + 6 * (SamplesPerTick - Count), Count);
+                Count -= Added;
+                if (Count == 0)
+                    break;
+                Length = ContainerFinish(&Container);
+                Datagrams++;
+                if ((DropEvery != 0) && (Datagrams % DropEvery == 0))
+                    Dropped++;
+                else if (ContainerUnpack(Unpacker, Container.Buffer, Length, CheckPacket, &Check))
+                    Check.Mismatches++;
+            }
+        }
+        Length = ContainerFinish(&Container);
+        if (Length != 0)
+        {
+            Datagrams++;
+            if ((DropEvery != 0) && (Datagrams % DropEvery == 0))
+                Dropped++;
+            else if (ContainerUnpack(Unpacker, Container.Buffer, Length, CheckPacket, &Check))
+                Check.Mismatches++;
+        }
+    }
+
+    for (DDC = 0; DDC < NumDDC; DDC++)
+    {
+        Expected += Container.NextSample[DDC] / VCTSAMPLESPERPACKET;
+        Rebuilt += Check.Packets[DDC];
+    }
+    Failed = (Check.Mismatches != 0) || (Check.OutOfOrder != 0) || (Unpacker->LostContainers > Dropped)
+             || ((Dropped == 0) && (Rebuilt != Expected));
+    printf("%6d %6d %5d | %8llu %6llu | %9llu %9llu %8.3f%% | %5llu %5llu  %s\n",
+           MaxSize, Interval, DropEvery,
+           (unsigned long long)Datagrams, (unsigned long long)Unpacker->LostContainers,
+           (unsigned long long)Expected, (unsigned long long)Rebuilt,
+           Expected ? 100.0 * (double)(Expected - Rebuilt) / (double)Expected : 0.0,
+           (unsigned long long)Check.Mismatches, (unsigned long long)Check.OutOfOrder,
+           Failed ? "FAIL" : "pass");
+    ContainerFree(&Container);
+    free(Unpacker);
+    free(Samples);
+    return Failed;
+}
+
+
+//
+// nanoseconds of CPU time used by this thread
+//
+static uint64_t ThreadCPUNs(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &Now);
+    return (uint64_t)Now.tv_sec * 1000000000ULL + Now.tv_nsec;
+}
+
+
+//
+// send Seconds of NumDDC streams to a loopback sink
+// MaxSize = 0 sends standard I/Q packets, one socket per DDC as p2app does
+// reports datagrams per second and sender CPU per second of stream
+//
+static void RunThroughputTest(uint32_t NumDDC, uint32_t Rate, uint32_t Interval, uint32_t Seconds, uint32_t MaxSize)
+{
+    TDDCContainer Container;
+    uint8_t* Samples;
+    uint8_t Packet[VCTPACKETSIZE];
+    int Sockets[VCTMAXDDC];
+    struct sockaddr_in Sink;
+    uint32_t DDC, Count, Added, Length, Tick, Pending[VCTMAXDDC];
+    uint32_t Ticks = Seconds * 1000 / Interval;
+    uint32_t SamplesPerTick = Rate * Interval;
+    uint64_t Datagrams = 0, Bytes = 0, StartNs;
+    double CPUNs;
+    int SinkSocket;
+
+    memset(&Sink, 0, sizeof(Sink));
+    Sink.sin_family = AF_INET;
+    Sink.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    Sink.sin_port = htons(VSINKPORT);
+    SinkSocket = socket(AF_INET, SOCK_DGRAM, 0);
+    if ((SinkSocket < 0) || (bind(SinkSocket, (struct sockaddr*)&Sink, sizeof(Sink)) < 0))
+    {
+        perror("sink socket");
+        return;
+    }
+    for (DDC = 0; DDC < NumDDC; DDC++)
+    {
+        Sockets[DDC] = socket(AF_INET, SOCK_DGRAM, 0);
+        Pending[DDC] = 0;
+    }
+    Samples = malloc(6 * SamplesPerTick);
+    if ((Samples == NULL) || ((MaxSize != 0) && ContainerInit(&Container, MaxSize)))
+    {
+        printf("throughput test: memory or size error\n");
+        return;
+    }
+    memset(Samples, 0x5A, 6 * SamplesPerTick);
+    memset(Packet, 0, sizeof(Packet));
+
+    StartNs = ThreadCPUNs();
+    for (Tick = 0; Tick < Ticks; Tick++)
+    {
+        for (DDC = 0; DDC < NumDDC; DDC++)
+        {
+            if (MaxSize == 0)
+            {
+                Pending[DDC] += SamplesPerTick;
+                while (Pending[DDC] >= VCTSAMPLESPERPACKET)
+                {
+                    memcpy(Packet + 16, Samples, 6 * VCTSAMPLESPERPACKET);
+                    sendto(Sockets[DDC], Packet, VCTPACKETSIZE, 0, (struct sockaddr*)&Sink, sizeof(Sink));
+                    Pending[DDC] -= VCTSAMPLESPERPACKET;
+                    Datagrams++;
+                    Bytes += VCTPACKETSIZE;
+                }
+                continue;
+            }
+            Count = SamplesPerTick;
+            while (Count != 0)
+            {
+                Added = ContainerAddSamples(&Container, DDC, Samples, Count);
+                Count -= Added;
+                if (Count == 0)
+                    break;
+                Length = ContainerFinish(&Container);
+                sendto(Sockets[0], Container.Buffer, Length, 0, (struct sockaddr*)&Sink, sizeof(Sink));
+                Datagrams++;
+                Bytes += Length;
+            }
+        }
+        if (MaxSize != 0)
+        {
+            Length = ContainerFinish(&Container);
+            if (Length != 0)
+            {
+                sendto(Sockets[0], Container.Buffer, Length, 0, (struct sockaddr*)&Sink, sizeof(Sink));
+                Datagrams++;
+                Bytes += Length;
+            }
+        }
+    }
+    CPUNs = (double)(ThreadCPUNs() - StartNs);
+
+    if (MaxSize == 0)
+        printf("standard |");
+    else
+        printf("%8d |", MaxSize);
+    printf(" %10.0f %8.1f | %10.1f %8.2f%%\n", (double)Datagrams / Seconds,
+           (double)Bytes / (double)Datagrams, CPUNs / 1000.0 / Seconds, CPUNs / 1.0e7 / Seconds);
+
+    for (DDC = 0; DDC < NumDDC; DDC++)
+        close(Sockets[DDC]);
+    close(SinkSocket);
+    if (MaxSize != 0)
+        ContainerFree(&Container);
+    free(Samples);
+}
+
+
+//
+// main program
+//
+int main(int argc, char *argv[])
+{
+    int CmdOption;
+    uint32_t NumDDC = VDEFAULTDDCS;
+    uint32_t Rate = VDEFAULTRATE;
+    uint32_t Interval = VDEFAULTINTERVAL;
+    uint32_t Seconds = VDEFAULTSECONDS;
+    uint32_t Sizes[] = {VCTDEFAULTSIZE, 8972, 32000, VCTMAXSIZE};
+    uint32_t Drops[] = {0, 7, 50};
+    uint32_t Size, Drop;
+    bool Failed = false;
+
+    while ((CmdOption = getopt(argc, argv, ":n:r:i:s:h")) != -1)
+    {
+        switch (CmdOption)
+        {
+            case 'n':
+                NumDDC = atoi(optarg);
+                break;
+            case 'r':
+                Rate = atoi(optarg);
+                break;
+            case 'i':
+                Interval = atoi(optarg);
+                break;
+            case 's':
+                Seconds = atoi(optarg);
+                break;
+            default:
+                printf("usage: ./containertest <optional arguments>\n");
+                printf("-n <DDCs>     number of DDC streams (1-%d)\n", VCTMAXDDC);
+                printf("-r <rate>     DDC sample rate, ksps\n");
+                printf("-i <ms>       container interval (1-%d)\n", VCTMAXINTERVALMS);
+                printf("-s <seconds>  seconds of stream for each test\n");
+                return EXIT_SUCCESS;
+        }
+    }
+    if ((NumDDC == 0) || (NumDDC > VCTMAXDDC) || (Rate == 0) || (Interval == 0)
+        || (Interval > VCTMAXINTERVALMS) || (Seconds == 0))
+    {
+        printf("DDCs must be 1 to %d; interval 1 to %d ms; rate and time not 0\n", VCTMAXDDC, VCTMAXINTERVALMS);
+        return EXIT_FAILURE;
+    }
+
+    printf("%d DDCs at %d ksps, containers every %d ms, %d s of stream\n\n", NumDDC, Rate, Interval, Seconds);
+    printf("restore test: containers unpacked to standard I/Q packets\n");
+    printf("  size   int   drop | contnrs   lost |  expected   rebuilt     loss | wrong order\n");
+    for (Size = 0; Size < sizeof(Sizes) / sizeof(Sizes[0]); Size++)
+        for (Drop = 0; Drop < sizeof(Drops) / sizeof(Drops[0]); Drop++)
+            Failed |= RunRestoreTest(NumDDC, Rate, Interval, Seconds, Sizes[Size], Drops[Drop]);
+
+    printf("\nthroughput test: loopback sendto\n");
+    printf("    size | datagram/s  bytes/dg | CPU us/s     CPU%%\n");
+    RunThroughputTest(NumDDC, Rate, Interval, Seconds, 0);
+    for (Size = 0; Size < sizeof(Sizes) / sizeof(Sizes[0]); Size++)
+        RunThroughputTest(NumDDC, Rate, Interval, Seconds, Sizes[Size]);
+
+    printf("\ncontainer test %s\n", Failed ? "FAILED" : "passed");
+    return Failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
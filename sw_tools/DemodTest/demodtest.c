@@ -0,0 +1,717 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// demodtest.c:
+//
+// test of the p2app demodulated audio code, against a double precision
+// reference receiver.
+// with no recording:
+// 1. synthesised signals are demodulated in each mode, in random block
+//    sizes; the audio must match the reference.
+// 2. the audio of modulated test signals is measured: level, SINAD and
+//    rejection of the opposite sideband; AGC levels are checked.
+// 3. audio packets are checked for sequence and sample numbering.
+// 4. the CPU budget is checked: a channel over budget must skip source
+//    samples and shorten its filter, but keep audio time.
+// 5. the CPU cost and bandwidth saved are measured.
+// with a recording (-r): the recording is demodulated and compared with the
+// reference; the audio can be saved (-O) as raw 16 bit mono, big endian.
+// recordings are raw P2 DDC sample data: 24 bit I then 24 bit Q, big endian,
+// as in the payload of DDC I/Q packets.
+//
+//////////////////////////////////////////////////////////////
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <arpa/inet.h>
+
+#include "../../sw_projects/common/demodaudio.h"
+
+//------------------------------------------------------------------------------------------
+// VERSION History
+// V1, 18/10/2026:   initial release
+
+
+#define VFRAMESAMPLES 238                       // samples in a DDC I/Q packet
+#define VSYNTHRATE 192                          // synthesised DDC, ksps
+#define VSYNTHSAMPLES 384000                    // 2 seconds
+#define VBUDGETRATE 1536                        // DDC rate for the budget test, ksps
+#define VBUDGETSAMPLES (3 * VBUDGETRATE * 1000) // 3 seconds
+#define VBUDGETPERCENT 1
+#define VMODHZ 1000.0                           // modulating tone
+#define VSETTLESECONDS 0.5                      // audio ignored while filters and AGC settle
+#define VMAXREFERRORDB (-70.0)                  // largest RMS error from the reference, dBFS
+#define VMAXLEVELDB 0.2                         // largest audio level error with AGC off
+#define VMINSINADDB 40.0                        // least SINAD of a clean test signal
+#define VMINFMSINADDB 30.0
+#define VMINREJECTIONDB 50.0                    // least rejection of the opposite sideband
+#define VMAXAGCERRORDB 1.0                      // largest AGC level error (the AGC holds the largest
+                                                // sample at the target: a 1kHz tone at 8ksps peaks between samples)
+#define VAUDIOFLOORDB (-96.0)                   // smallest tone 16 bit audio can show
+
+
+//
+// small deterministic random number generator
+//
+static uint64_t RandomState = 0x0123456789ABCDEFULL;
+
+static double RandomUniform(void)
+{
+    RandomState ^= RandomState << 13;
+    RandomState ^= RandomState >> 7;
+    RandomState ^= RandomState << 17;
+    return (double)(RandomState >> 11) / 9007199254740992.0;
+}
+
+
+//
+// a synthesised signal: a carrier at Offset Hz from the DDC centre, optionally
+// AM or FM modulated by a tone, plus gaussian noise
+//
+typedef struct
+{
+    double Offset;
+    double Amplitude;                           // carrier, full scale = 1
+    double AMIndex;                             // 0 to 1
+    double FMDeviation;                         // Hz
+    double ModHz;
+    double NoiseRMS;
+} TTestSignal;
+
+
+//
+// pack one sample to P2 24 bit format, saturated; full scale = 1.0
+//
+static void PackSample(uint8_t* Dest, double I, double Q)
+{
+    int32_t SI = (int32_t)lrint(I * 8388608.0);
+    int32_t SQ = (int32_t)lrint(Q * 8388608.0);
+
+    SI = (SI > 8388607) ? 8388607 : (SI < -8388608) ? -8388608 : SI;
+    SQ = (SQ > 8388607) ? 8388607 : (SQ < -8388608) ? -8388608 : SQ;
+    Dest[0] = (uint8_t)(SI >> 16);
+    Dest[1] = (uint8_t)(SI >> 8);
+    Dest[2] = (uint8_t)SI;
+    Dest[3] = (uint8_t)(SQ >> 16);
+    Dest[4] = (uint8_t)(SQ >> 8);
+    Dest[5] = (uint8_t)SQ;
+}
+
+
+//
+// unpack P2 samples to interleaved doubles; full scale = 1.0
+//
+static void UnpackSamples(uint8_t* Src, uint32_t Count, double* IQ)
+{
+    uint32_t Sample;
+
+    for (Sample = 0; Sample < 2 * Count; Sample++)
+    {
+        IQ[Sample] = (double)((int32_t)(((uint32_t)Src[0] << 24) | ((uint32_t)Src[1] << 16) | ((uint32_t)Src[2] << 8)) >> 8) / 8388608.0;
+        Src += 3;
+    }
+}
+
+
+//
+// synthesise Count samples of the sum of Signals test signals
+//
+static void Synthesise(uint8_t* Dest, uint32_t Count, double SampleRate, TTestSignal* Signals, uint32_t SignalCount)
+{
+    uint32_t Sample, Signal;
+    double I, Q, Time, Amplitude, Phase, U1, U2, Radius, NoiseRMS = 0.0;
+
+    for (Signal = 0; Signal < SignalCount; Signal++)
+        NoiseRMS += Signals[Signal].NoiseRMS;
+    for (Sample = 0; Sample < Count; Sample++)
+    {
+        I = 0.0;
+        Q = 0.0;
+        Time = Sample / SampleRate;
+        for (Signal = 0; Signal < SignalCount; Signal++)
+        {
+            Amplitude = Signals[Signal].Amplitude * (1.0 + Signals[Signal].AMIndex * cos(2.0 * M_PI * Signals[Signal].ModHz * Time));
+            Phase = 2.0 * M_PI * fmod(Signals[Signal].Offset * Time, 1.0);
+            if (Signals[Signal].ModHz != 0.0)
+                Phase += Signals[Signal].FMDeviation / Signals[Signal].ModHz * sin(2.0 * M_PI * Signals[Signal].ModHz * Time);
+            I += Amplitude * cos(Phase);
+            Q += Amplitude * sin(Phase);
+        }
+        if (NoiseRMS != 0.0)
+        {
+            U1 = RandomUniform() + 1e-300;
+            U2 = RandomUniform();
+            Radius = NoiseRMS * sqrt(-2.0 * log(U1));
+            I += Radius * cos(2.0 * M_PI * U2);
+            Q += Radius * sin(2.0 * M_PI * U2);
+        }
+        PackSample(Dest + 6 * Sample, I, Q);
+    }
+}
+
+
+//
+// run a demodulator over a recording in blocks of BlockSize (0 = random sizes, up to
+// a DDC packet), taking packets as p2app does. Packet headers are checked.
+// returns the number of audio samples in Out (full scale = 1); HeaderErrors counts bad packets
+//
+static uint32_t RunDemod(TDemodAudio* Demod, uint8_t* Src, uint32_t Count, uint32_t SampleRate,
+                         uint32_t BlockSize, double* Out, uint32_t* HeaderErrors)
+{
+    uint8_t Packet[VDAPACKETSIZE];
+    uint32_t Done = 0, Block, Outputs = 0, Sequence = 0, Length, Samples, Sample;
+
+    DemodAudioRestart(Demod);
+    *HeaderErrors = 0;
+    while (Done < Count)
+    {
+        Block = (BlockSize != 0) ? BlockSize : 1 + (uint32_t)(RandomUniform() * VFRAMESAMPLES);
+        if (Block > Count - Done)
+            Block = Count - Done;
+        DemodAudioAddP2Samples(Demod, Src + 6 * Done, Block, SampleRate);
+        while ((Length = DemodAudioMakePacket(Demod, Sequence, Packet)) != 0)
+        {
+            Samples = ntohs(*(uint16_t*)(Packet + 14));
+            if ((ntohl(*(uint32_t*)Packet) != Sequence) || (ntohl(*(uint32_t*)(Packet + 4)) != Outputs)
+                || (ntohs(*(uint16_t*)(Packet + 8)) != Demod->AudioRate * 1000)
+                || (ntohs(*(uint16_t*)(Packet + 10)) != Demod->Mode) || (ntohs(*(uint16_t*)(Packet + 12)) != 16)
+                || (Samples != Demod->AudioRate * VDAPACKETMS) || (Length != VDAHEADERSIZE + 2 * Samples))
+                (*HeaderErrors)++;
+            for (Sample = 0; Sample < Samples; Sample++)
+                Out[Outputs + Sample] = (int16_t)ntohs(*(uint16_t*)(Packet + VDAHEADERSIZE + 2 * Sample)) / 32767.0;
+            Outputs += Samples;
+            Sequence++;
+        }
+        Done += Block;
+    }
+    return Outputs;
+}
+
+
+//
+// double precision reference receiver: the same filter coefficients and
+// settings, calculated sample by sample from the whole recording
+// (zero history before the start)
+//
+static void RunReference(TDemodAudio* Demod, uint8_t* Src, uint32_t Count, double* Out, uint32_t Outputs)
+{
+    double *Source, *Chan, *Discriminator;
+    double I, Q, YI, YQ, Audio, PrevI = 0.0, PrevQ = 0.0, Magnitude, DCLevel = 0.0, Peak = 0.0;
+    double AGCMaxGain = Demod->AGCMaxGain, DCCoeff = Demod->DCCoeff, AGCDecay = Demod->AGCDecay;
+    uint32_t ChanCount, Chan_, Tap, Output = 0, Hang = 0;
+    int64_t Index;
+    bool Primed = false;
+
+    Source = malloc(2 * Count * sizeof(double));
+    ChanCount = Count / Demod->Decimation + 1;
+    Chan = calloc(2 * ChanCount, sizeof(double));
+    Discriminator = calloc(ChanCount, sizeof(double));
+    UnpackSamples(Src, Count, Source);
+
+    //
+    // decimation filter: channel sample k is centred on source sample k * Decimation
+    //
+    for (Chan_ = 0; Chan_ < ChanCount; Chan_++)
+    {
+        I = 0.0;
+        Q = 0.0;
+        for (Tap = 0; Tap < Demod->DecimTaps; Tap++)
+        {
+            Index = (int64_t)Chan_ * Demod->Decimation - (Demod->DecimTaps - 1) + Tap;
+            if ((Index >= 0) && (Index < Count))
+            {
+                I += Demod->DecimCoeff[Tap] * Source[2 * Index];
+                Q += Demod->DecimCoeff[Tap] * Source[2 * Index + 1];
+            }
+        }
+        Chan[2 * Chan_] = I;
+        Chan[2 * Chan_ + 1] = Q;
+    }
+
+    //
+    // channel filter and demodulation
+    //
+    for (Chan_ = 0; (Chan_ < ChanCount) && (Output < Outputs); Chan_++)
+    {
+        YI = 0.0;
+        YQ = 0.0;
+        for (Tap = 0; Tap < VDACHANNELTAPS; Tap++)
+        {
+            Index = (int64_t)Chan_ - (VDACHANNELTAPS - 1) + Tap;
+            if (Index >= 0)
+            {
+                YI += Demod->ChanCoeffR[Tap] * Chan[2 * Index] - Demod->ChanCoeffI[Tap] * Chan[2 * Index + 1];
+                YQ += Demod->ChanCoeffR[Tap] * Chan[2 * Index + 1] + Demod->ChanCoeffI[Tap] * Chan[2 * Index];
+            }
+        }
+        if (Demod->Mode == eDemodFM)
+        {
+            Discriminator[Chan_] = atan2(YQ * PrevI - YI * PrevQ, YI * PrevI + YQ * PrevQ)
+                                   * Demod->ChanRate * 1000.0 / (2.0 * M_PI * VDAFMDEVIATION);
+            PrevI = YI;
+            PrevQ = YQ;
+            if ((Chan_ & 1) == 0)
+                continue;
+            Audio = 0.0;
+            for (Tap = 0; Tap < VDAFMTAPS; Tap++)
+            {
+                Index = (int64_t)Chan_ - (VDAFMTAPS - 1) + Tap;
+                if (Index >= 0)
+                    Audio += Demod->FMCoeff[Tap] * Discriminator[Index];
+            }
+        }
+        else
+        {
+            if (Demod->Mode == eDemodAM)
+            {
+                Magnitude = sqrt(YI * YI + YQ * YQ);
+                if (!Primed)
+                {
+                    DCLevel = Magnitude;
+                    Primed = true;
+                }
+                DCLevel += DCCoeff * (Magnitude - DCLevel);
+                Audio = Magnitude - DCLevel;
+            }
+            else
+                Audio = YI;
+            if (AGCMaxGain > 1.0)
+            {
+                Magnitude = fabs(Audio);
+                if (Magnitude >= Peak)
+                {
+                    Peak = Magnitude;
+                    Hang = Demod->AGCHangSamples;
+                }
+                else if (Hang != 0)
+                    Hang--;
+                else
+                    Peak *= AGCDecay;
+                Audio *= VDAAGCTARGET / fmax(Peak, VDAAGCTARGET / AGCMaxGain);
+            }
+        }
+        Out[Output++] = fmax(-1.0, fmin(1.0, Audio));
+    }
+    free(Source);
+    free(Chan);
+    free(Discriminator);
+}
+
+
+//
+// RMS difference between two sets of audio samples, dB relative to full scale
+//
+static double ErrordB(double* A, double* B, uint32_t Count)
+{
+    double Sum = 0.0;
+    uint32_t Sample;
+
+    for (Sample = 0; Sample < Count; Sample++)
+        Sum += (A[Sample] - B[Sample]) * (A[Sample] - B[Sample]);
+    return 10.0 * log10(Sum / Count + 1e-30);
+}
+
+
+//
+// fit a tone of known frequency (and DC) to audio by least squares
+// gives its amplitude in dBFS and SINAD: tone power / power of everything else
+//
+static void FitTone(double* Audio, uint32_t Count, double SampleRate, double Frequency, double* LeveldB, double* SINADdB)
+{
+    double SC = 0.0, SS = 0.0, CC = 0.0, XC = 0.0, XS = 0.0, Mean = 0.0, Det, A, B, Residual = 0.0, E, Phase;
+    uint32_t Sample;
+
+    for (Sample = 0; Sample < Count; Sample++)
+        Mean += Audio[Sample] / Count;
+    for (Sample = 0; Sample < Count; Sample++)
+    {
+        Phase = 2.0 * M_PI * Frequency * Sample / SampleRate;
+        CC += cos(Phase) * cos(Phase);
+        SS += sin(Phase) * sin(Phase);
+        SC += sin(Phase) * cos(Phase);
+        XC += (Audio[Sample] - Mean) * cos(Phase);
+        XS += (Audio[Sample] - Mean) * sin(Phase);
+    }
+    Det = CC * SS - SC * SC;
+    A = (XC * SS - XS * SC) / Det;
+    B = (XS * CC - XC * SC) / Det;
+    for (Sample = 0; Sample < Count; Sample++)
+    {
+        Phase = 2.0 * M_PI * Frequency * Sample / SampleRate;
+        E = Audio[Sample] - Mean - A * cos(Phase) - B * sin(Phase);
+        Residual += E * E;
+    }
+    *LeveldB = 20.0 * log10(sqrt(A * A + B * B) + 1e-30);
+    *SINADdB = 10.0 * log10(((A * A + B * B) / 2.0) / (Residual / Count + 1e-30));
+}
+
+
+//
+// 1. match to the reference in each mode, with a busy recording, in random and fixed block sizes
+// returns true if the error is too large
+//
+static bool RunReferenceTest(uint8_t* Recording)
+{
+    static const EDemodMode Modes[] = {eDemodAM, eDemodUSB, eDemodLSB, eDemodCWU, eDemodCWL, eDemodFM};
+    static const uint32_t AudioRates[] = {8, 12, 16, 8, 8, 16};
+    TTestSignal Signals[] =
+    {
+        {700.0, 0.1, 0.5, 0.0, 400.0, 0.0},
+        {-1500.0, 0.05, 0.0, 0.0, 0.0, 0.0},
+        {200.0, 0.2, 0.0, 3000.0, 1300.0, 0.001},
+        {30000.0, 0.3, 0.0, 0.0, 0.0, 0.0}
+    };
+    TDemodAudio Demod;
+    double *Out, *Reference, Error, Worst;
+    uint32_t Mode, Run, Outputs, HeaderErrors, BlockSize[] = {0, VFRAMESAMPLES, 1, VDABLOCK + 7};
+    bool Failed = false;
+
+    Synthesise(Recording, VSYNTHSAMPLES, VSYNTHRATE * 1000.0, Signals, 4);
+    Out = malloc(VSYNTHSAMPLES * sizeof(double));
+    Reference = malloc(VSYNTHSAMPLES * sizeof(double));
+    for (Mode = 0; Mode < sizeof(Modes) / sizeof(Modes[0]); Mode++)
+    {
+        if (DemodAudioInit(&Demod, Modes[Mode], AudioRates[Mode], 0, 0, VDAAGCMAXGAINDB, 100))
+            return true;
+        Worst = -999.0;
+        for (Run = 0; Run < sizeof(BlockSize) / sizeof(BlockSize[0]); Run++)
+        {
+            Outputs = RunDemod(&Demod, Recording, VSYNTHSAMPLES, VSYNTHRATE, BlockSize[Run], Out, &HeaderErrors);
+            if (Run == 0)
+                RunReference(&Demod, Recording, VSYNTHSAMPLES, Reference, Outputs);
+            Error = ErrordB(Out, Reference, Outputs);
+            if (Error > Worst)
+                Worst = Error;
+        }
+        printf("%-3s %2dksps: match to reference: %d audio samples, worst RMS error %.1fdBFS (limit %.0f)  %s\n",
+               DemodAudioModeName(Modes[Mode]), AudioRates[Mode], Outputs, Worst, VMAXREFERRORDB,
+               (Worst <= VMAXREFERRORDB) ? "pass" : "FAIL");
+        Failed |= (Worst > VMAXREFERRORDB);
+        DemodAudioFree(&Demod);
+    }
+    free(Out);
+    free(Reference);
+    return Failed;
+}
+
+
+//
+// demodulate one test signal, and fit the expected audio tone after the settling time
+// returns true if the demodulator could not be set up
+//
+static bool MeasureAudio(uint8_t* Recording, EDemodMode Mode, uint32_t AudioRate, uint32_t AGCMaxGaindB,
+                         TTestSignal* Signal, double ToneHz, double* LeveldB, double* SINADdB)
+{
+    TDemodAudio Demod;
+    double* Out;
+    uint32_t Outputs, Skip, HeaderErrors;
+
+    if (DemodAudioInit(&Demod, Mode, AudioRate, 0, 0, AGCMaxGaindB, 100))
+        return true;
+    Synthesise(Recording, VSYNTHSAMPLES, VSYNTHRATE * 1000.0, Signal, 1);
+    Out = malloc(VSYNTHSAMPLES * sizeof(double));
+    Outputs = RunDemod(&Demod, Recording, VSYNTHSAMPLES, VSYNTHRATE, VFRAMESAMPLES, Out, &HeaderErrors);
+    Skip = (uint32_t)(VSETTLESECONDS * AudioRate * 1000.0);
+    FitTone(Out + Skip, Outputs - Skip, AudioRate * 1000.0, ToneHz, LeveldB, SINADdB);
+    free(Out);
+    DemodAudioFree(&Demod);
+    return false;
+}
+
+
+//
+// 2. audio from modulated test signals: level and SINAD with AGC off, rejection of
+// the opposite sideband, and AGC output level for weak and strong signals
+// returns true if out of limits
+//
+static bool RunAudioTest(uint8_t* Recording)
+{
+    TTestSignal Signal;
+    double LeveldB, SINADdB, WantedLeveldB, Rejection;
+    bool Failed = false, Bad;
+    uint32_t Test;
+    static const struct
+    {
+        char* Name;
+        EDemodMode Mode;
+        uint32_t AudioRate;
+        TTestSignal Signal;
+        double ToneHz;                          // expected audio tone
+        double LeveldB;                         // expected level with AGC off
+        double MinSINADdB;
+    } Tests[] =
+    {
+        {"USB tone +1kHz", eDemodUSB, 8, {1000.0, 0.1, 0.0, 0.0, 0.0, 0.0}, 1000.0, -20.0, VMINSINADDB},
+        {"LSB tone -1kHz", eDemodLSB, 12, {-1000.0, 0.1, 0.0, 0.0, 0.0, 0.0}, 1000.0, -20.0, VMINSINADDB},
+        {"CWU tone +600Hz", eDemodCWU, 8, {VDACWPITCH, 0.1, 0.0, 0.0, 0.0, 0.0}, VDACWPITCH, -20.0, VMINSINADDB},
+        {"CWL tone -600Hz", eDemodCWL, 8, {-VDACWPITCH, 0.1, 0.0, 0.0, 0.0, 0.0}, VDACWPITCH, -20.0, VMINSINADDB},
+        {"AM 50% 1kHz", eDemodAM, 16, {0.0, 0.2, 0.5, 0.0, VMODHZ, 0.0}, VMODHZ, -20.0, VMINSINADDB},
+        {"FM 3kHz dev 1kHz", eDemodFM, 16, {0.0, 0.2, 0.0, 3000.0, VMODHZ, 0.0}, VMODHZ, -4.437, VMINFMSINADDB},
+        {"FM 3kHz dev 1kHz", eDemodFM, 8, {0.0, 0.2, 0.0, 3000.0, VMODHZ, 0.0}, VMODHZ, -4.437, VMINFMSINADDB}
+    };
+
+    for (Test = 0; Test < sizeof(Tests) / sizeof(Tests[0]); Test++)
+    {
+        Signal = Tests[Test].Signal;
+        if (MeasureAudio(Recording, Tests[Test].Mode, Tests[Test].AudioRate, 0, &Signal, Tests[Test].ToneHz, &LeveldB, &SINADdB))
+            return true;
+        Bad = (fabs(LeveldB - Tests[Test].LeveldB) > VMAXLEVELDB) || (SINADdB < Tests[Test].MinSINADdB);
+        printf("%-3s %2dksps %-18s: %.0fHz audio at %.2fdBFS (expected %.2f), SINAD %.1fdB (limit %.0f)  %s\n",
+               DemodAudioModeName(Tests[Test].Mode), Tests[Test].AudioRate, Tests[Test].Name, Tests[Test].ToneHz,
+               LeveldB, Tests[Test].LeveldB, SINADdB, Tests[Test].MinSINADdB, Bad ? "FAIL" : "pass");
+        Failed |= Bad;
+
+        //
+        // SSB and CW: the same tone in the opposite sideband must be rejected
+        //
+        if ((Tests[Test].Mode != eDemodAM) && (Tests[Test].Mode != eDemodFM))
+        {
+            WantedLeveldB = LeveldB;
+            Signal.Offset = -Signal.Offset;
+            MeasureAudio(Recording, Tests[Test].Mode, Tests[Test].AudioRate, 0, &Signal, Tests[Test].ToneHz, &LeveldB, &SINADdB);
+            Rejection = WantedLeveldB - ((LeveldB < VAUDIOFLOORDB) ? VAUDIOFLOORDB : LeveldB);
+            printf("%-3s %2dksps opposite sideband   : rejected by %s%.1fdB (limit %.0f)  %s\n",
+                   DemodAudioModeName(Tests[Test].Mode), Tests[Test].AudioRate, (LeveldB < VAUDIOFLOORDB) ? "more than " : "",
+                   Rejection, VMINREJECTIONDB, (Rejection < VMINREJECTIONDB) ? "FAIL" : "pass");
+            Failed |= (Rejection < VMINREJECTIONDB);
+        }
+    }
+
+    //
+    // AGC: weak and strong SSB tones come out at the target level
+    //
+    for (Test = 0; Test < 3; Test++)
+    {
+        Signal = (TTestSignal){1000.0, pow(10.0, (-75.0 + 35.0 * Test) / 20.0), 0.0, 0.0, 0.0, 0.0};
+        MeasureAudio(Recording, eDemodUSB, 8, VDAAGCMAXGAINDB, &Signal, 1000.0, &LeveldB, &SINADdB);
+        WantedLeveldB = 20.0 * log10(VDAAGCTARGET);
+        Bad = fabs(LeveldB - WantedLeveldB) > VMAXAGCERRORDB;
+        printf("usb  8ksps AGC, tone at %4.0fdBFS : audio at %.2fdBFS (expected %.2f)  %s\n",
+               20.0 * log10(Signal.Amplitude), LeveldB, WantedLeveldB, Bad ? "FAIL" : "pass");
+        Failed |= Bad;
+    }
+    return Failed;
+}
+
+
+//
+// 3. packet headers, and audio samples produced for the source samples given
+// returns true if wrong
+//
+static bool RunPacketTest(uint8_t* Recording)
+{
+    TDemodAudio Demod;
+    TTestSignal Signal = {1000.0, 0.1, 0.0, 0.0, 0.0, 0.001};
+    double* Out;
+    uint32_t Outputs, HeaderErrors, Expected;
+    bool Bad;
+
+    if (DemodAudioInit(&Demod, eDemodUSB, 12, 0, 0, VDAAGCMAXGAINDB, 100))
+        return true;
+    Synthesise(Recording, VSYNTHSAMPLES, VSYNTHRATE * 1000.0, &Signal, 1);
+    Out = malloc(VSYNTHSAMPLES * sizeof(double));
+    Outputs = RunDemod(&Demod, Recording, VSYNTHSAMPLES, VSYNTHRATE, 0, Out, &HeaderErrors);
+    Expected = (VSYNTHSAMPLES / (VSYNTHRATE / 12)) / (12 * VDAPACKETMS) * (12 * VDAPACKETMS);
+    Bad = (HeaderErrors != 0) || (Outputs != Expected) || (Demod.Stats.Overruns != 0);
+    printf("packets: %llu sent, %d audio samples (expected %d), %d header errors  %s\n",
+           (unsigned long long)Demod.Stats.Packets, Outputs, Expected, HeaderErrors, Bad ? "FAIL" : "pass");
+    free(Out);
+    DemodAudioFree(&Demod);
+    return Bad;
+}
+
+
+//
+// 4. CPU budget: a 1536ksps source with a small budget
+// a channel over budget must skip source samples and shorten its filter, but its
+// audio must keep time. Its CPU time per second must be close to the budget
+// returns true if wrong
+//
+static bool RunBudgetTest(void)
+{
+    TDemodAudio Demod;
+    TTestSignal Signal = {1000.0, 0.1, 0.0, 0.0, 0.0, 0.0};
+    uint8_t* Recording;
+    double* Out;
+    double Seconds, UsedPercent;
+    uint32_t Outputs, HeaderErrors, Expected;
+    bool Bad;
+
+    Recording = malloc(6 * VBUDGETSAMPLES);
+    Out = malloc((VBUDGETSAMPLES / 100) * sizeof(double));
+    if ((Recording == NULL) || (Out == NULL) || DemodAudioInit(&Demod, eDemodUSB, 8, 0, 0, VDAAGCMAXGAINDB, VBUDGETPERCENT))
+        return true;
+    Synthesise(Recording, VBUDGETSAMPLES, VBUDGETRATE * 1000.0, &Signal, 1);
+    Outputs = RunDemod(&Demod, Recording, VBUDGETSAMPLES, VBUDGETRATE, VFRAMESAMPLES, Out, &HeaderErrors);
+    Expected = (VBUDGETSAMPLES / (VBUDGETRATE / 8)) / (8 * VDAPACKETMS) * (8 * VDAPACKETMS);
+    Seconds = (double)VBUDGETSAMPLES / (VBUDGETRATE * 1000.0);
+    UsedPercent = Demod.Stats.ProcessingNs / Seconds / 1e7;
+    DemodAudioPrintStatistics("budget", &Demod);
+    if (Demod.Stats.SkippedSamples == 0)
+    {
+        printf("budget: %d%% was not exceeded on this processor (%.2f%% used); skipping not tested  pass\n",
+               VBUDGETPERCENT, UsedPercent);
+        Bad = (Outputs != Expected) || (HeaderErrors != 0);
+    }
+    else
+    {
+        Bad = (Outputs != Expected) || (HeaderErrors != 0) || (Demod.Stats.QualitySteps == 0);
+        printf("budget %d%%: %.2f%% of a core used, %.1f%% of source samples skipped, filter shortened %d times;"
+               " %d audio samples (expected %d)  %s\n",
+               VBUDGETPERCENT, UsedPercent, 100.0 * Demod.Stats.SkippedSamples / VBUDGETSAMPLES, Demod.Stats.QualitySteps,
+               Outputs, Expected, Bad ? "FAIL" : "pass");
+    }
+    free(Recording);
+    free(Out);
+    DemodAudioFree(&Demod);
+    return Bad;
+}
+
+
+//
+// demodulate a recording file, compare with the reference and optionally save the audio
+// returns true if the file could not be processed
+//
+static bool ProcessRecording(char* Path, uint32_t SampleRate, EDemodMode Mode, uint32_t AudioRate, char* OutPath)
+{
+    TDemodAudio Demod;
+    FILE* Fp;
+    long Size;
+    uint8_t* Recording;
+    double *Out, *Reference;
+    uint32_t Count, Outputs, Sample, HeaderErrors;
+    int16_t Value;
+
+    if (DemodAudioInit(&Demod, Mode, AudioRate, 0, 0, VDAAGCMAXGAINDB, 100))
+    {
+        printf("invalid demodulator settings\n");
+        return true;
+    }
+    Fp = fopen(Path, "rb");
+    if (Fp == NULL)
+    {
+        perror(Path);
+        return true;
+    }
+    fseek(Fp, 0, SEEK_END);
+    Size = ftell(Fp);
+    fseek(Fp, 0, SEEK_SET);
+    Count = (uint32_t)(Size / 6);
+    Recording = malloc(6 * Count + 6);
+    if ((Recording == NULL) || (fread(Recording, 6, Count, Fp) != Count))
+    {
+        printf("could not read %s\n", Path);
+        fclose(Fp);
+        return true;
+    }
+    fclose(Fp);
+
+    Out = malloc((Count + 1) * sizeof(double));
+    Reference = malloc((Count + 1) * sizeof(double));
+    Outputs = RunDemod(&Demod, Recording, Count, SampleRate, VFRAMESAMPLES, Out, &HeaderErrors);
+    if (Demod.Decimation == 0)
+    {
+        printf("%dksps is not a multiple of the %s channel rate (%dksps)\n", SampleRate, DemodAudioModeName(Mode), Demod.ChanRate);
+        return true;
+    }
+    RunReference(&Demod, Recording, Count, Reference, Outputs);
+    printf("%s: %d samples at %dksps; %s %dksps audio: %d samples\n",
+           Path, Count, SampleRate, DemodAudioModeName(Mode), AudioRate, Outputs);
+    printf("RMS error from reference %.1fdBFS (limit %.0f)\n", ErrordB(Out, Reference, Outputs), VMAXREFERRORDB);
+    DemodAudioPrintStatistics("recording", &Demod);
+
+    if (OutPath != NULL)
+    {
+        Fp = fopen(OutPath, "wb");
+        if (Fp == NULL)
+            perror(OutPath);
+        else
+        {
+            for (Sample = 0; Sample < Outputs; Sample++)
+            {
+                Value = (int16_t)htons((uint16_t)(int16_t)lrint(Out[Sample] * 32767.0));
+                fwrite(&Value, 2, 1, Fp);
+            }
+            fclose(Fp);
+            printf("audio written to %s (16 bit mono, big endian, %d samples/s)\n", OutPath, AudioRate * 1000);
+        }
+    }
+    free(Recording);
+    free(Out);
+    free(Reference);
+    DemodAudioFree(&Demod);
+    return false;
+}
+
+
+//
+// main program
+//
+int main(int argc, char *argv[])
+{
+    uint8_t* Recording;
+    int CmdOption;
+    char *RecordingPath = NULL, *OutPath = NULL;
+    uint32_t SampleRate = VSYNTHRATE, AudioRate = 8;
+    EDemodMode Mode = eDemodUSB;
+    bool Failed = false;
+
+    while ((CmdOption = getopt(argc, argv, ":r:s:m:a:O:h")) != -1)
+    {
+        switch (CmdOption)
+        {
+            case 'r':
+                RecordingPath = optarg;
+                break;
+            case 's':
+                SampleRate = atoi(optarg);
+                break;
+            case 'm':
+                Mode = DemodAudioModeByName(optarg);
+                break;
+            case 'a':
+                AudioRate = atoi(optarg);
+                break;
+            case 'O':
+                OutPath = optarg;
+                break;
+            default:
+                printf("usage: ./demodtest <optional arguments>\n");
+                printf("with no arguments, runs the synthetic tests\n");
+                printf("-r <file>     demodulate a recording of raw P2 DDC samples and compare with the reference\n");
+                printf("-s <ksps>     sample rate of the recording (default %d)\n", VSYNTHRATE);
+                printf("-m <mode>     am, usb, lsb, cwu, cwl or fm (default usb)\n");
+                printf("-a <ksps>     audio rate: 8, 12 or 16 (default 8)\n");
+                printf("-O <file>     save the audio (raw 16 bit mono, big endian)\n");
+                return EXIT_SUCCESS;
+        }
+    }
+
+    if (RecordingPath != NULL)
+        return ProcessRecording(RecordingPath, SampleRate, Mode, AudioRate, OutPath) ? EXIT_FAILURE : EXIT_SUCCESS;
+
+    Recording = malloc(6 * VSYNTHSAMPLES);
+    if (Recording == NULL)
+        return EXIT_FAILURE;
+    printf("demodulated audio from a %dksps DDC\n", VSYNTHRATE);
+    Failed |= RunReferenceTest(Recording);
+    Failed |= RunAudioTest(Recording);
+    Failed |= RunPacketTest(Recording);
+    Failed |= RunBudgetTest();
+    DemodAudioPrintBenchmark();
+
+    printf("\ndemodulated audio test %s\n", Failed ? "FAILED" : "passed");
+    free(Recording);
+    return Failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,417 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// fectest.c:
+//
+// lossy loopback test of the p2app FEC encoder and decoder.
+// synthetic 1444 byte packets are encoded, passed through a simulated
+// lossy channel (random or burst loss) then decoded. Every packet released
+// by the decoder is checked against the original.
+// reports bandwidth overhead, CPU time and residual loss for each configuration.
+//
+//////////////////////////////////////////////////////////////
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "../../sw_projects/common/fec.h"
+
+//------------------------------------------------------------------------------------------
+// VERSION History
+// V1, 18/10/2026:   initial release
+// V2, 19/10/2026:   late packet test after early block release
+// V3, 19/10/2026:   TX start/stop test: packets held at a pause
+
+
+#define VPACKETSIZE 1444                        // DDC or DUC I/Q packet
+#define VDEFAULTPACKETS 100000                  // packets per test
+
+
+//
+// lossy channel: Gilbert-Elliott model.
+// in "good" state no packets are lost; in "bad" state all are lost
+// average loss = P / (P + 1/Burst); average burst length = Burst
+//
+typedef struct
+{
+    double GoodToBad;                           // probability of entering bad state
+    double BadToGood;                           // probability of leaving bad state
+    bool Bad;                                   // current state
+    uint64_t Sent;
+    uint64_t Dropped;
+} TLossyChannel;
+
+
+//
+// initialise channel for required average loss (%) and mean burst length
+//
+static void InitChannel(TLossyChannel* Chan, double LossPercent, double Burst)
+{
+    double Loss = LossPercent / 100.0;
+
+    memset(Chan, 0, sizeof(TLossyChannel));
+    if (Burst < 1.0)
+        Burst = 1.0;
+    Chan->BadToGood = 1.0 / Burst;
+    if (Loss > 0.0)
+        Chan->GoodToBad = Loss * Chan->BadToGood / (1.0 - Loss);
+}
+
+
+//
+// return true if the next packet is lost
+//
+static bool ChannelDrops(TLossyChannel* Chan)
+{
+    double Random = (double)rand() / ((double)RAND_MAX + 1.0);
+
+    if (Chan->Bad)
+    {
+        if (Random < Chan->BadToGood)
+            Chan->Bad = false;
+    }
+    else if (Random < Chan->GoodToBad)
+        Chan->Bad = true;
+    Chan->Sent++;
+    if (Chan->Bad)
+        Chan->Dropped++;
+    return Chan->Bad;
+}
+
+
+//
+// make a synthetic packet: sequence number then payload derived from it
+//
+static void MakePacket(uint8_t* Packet, uint32_t Seq)
+{
+    uint32_t Cntr;
+    uint32_t Value = Seq * 2654435761U;
+
+    *(uint32_t*)Packet = htonl(Seq);
+    for (Cntr = 4; Cntr < VPACKETSIZE; Cntr++)
+    {
+        Value = Value * 1103515245U + 12345U;
+        Packet[Cntr] = (uint8_t)(Value >> 16);
+    }
+}
+
+
+//
+// run one test configuration. Prints one line of results.
+// GroupSize = 0 runs the channel with no FEC, for comparison
+//
+static void RunTest(uint32_t GroupSize, uint32_t Depth, double LossPercent, double Burst, uint32_t NumPackets)
+{
+    static TFECEncoder Encoder;
+    static TFECDecoder Decoder;
+    TLossyChannel Channel;
+    uint8_t Packet[VPACKETSIZE];
+    uint8_t Expected[VPACKETSIZE];
+    uint8_t Parity[VPACKETSIZE + VFECHEADERSIZE];
+    uint8_t* OutPtr;
+    uint32_t Seq, Group, Length;
+    uint64_t Delivered = 0;
+    uint64_t Corrupt = 0;
+    uint64_t OutOfOrder = 0;
+    uint32_t LastSeq = 0;
+    bool FirstOut = true;
+    double Overhead = 0.0;
+    double EncodeNs = 0.0;
+    double DecodeNs = 0.0;
+
+    srand(1);                                   // repeatable channel
+    InitChannel(&Channel, LossPercent, Burst);
+    if (GroupSize != 0)
+    {
+        FECInitEncoder(&Encoder, VPACKETSIZE, GroupSize, Depth);
+        FECInitDecoder(&Decoder, VPACKETSIZE, GroupSize, Depth);
+    }
+
+    for (Seq = 0; Seq < NumPackets; Seq++)
+    {
+        MakePacket(Packet, Seq);
+        if (GroupSize == 0)
+        {
+            if (!ChannelDrops(&Channel))
+                Delivered++;
+            continue;
+        }
+        if (!ChannelDrops(&Channel))
+            FECDecodePacket(&Decoder, Packet, VPACKETSIZE);
+        if (FECEncodePacket(&Encoder, Packet))
+            for (Group = 0; Group < Depth; Group++)
+            {
+                Length = FECGetParityPacket(&Encoder, Group, Parity);
+                if (!ChannelDrops(&Channel))
+                    FECDecodePacket(&Decoder, Parity, Length);
+            }
+        if (Seq == NumPackets - 1)
+            FECFlushDecoder(&Decoder);
+        //
+        // check everything released by the decoder
+        //
+        while ((OutPtr = FECGetOutputPacket(&Decoder)) != NULL)
+        {
+            uint32_t OutSeq = ntohl(*(uint32_t*)OutPtr);
+            if (!FirstOut && (OutSeq <= LastSeq))
+                OutOfOrder++;
+            FirstOut = false;
+            LastSeq = OutSeq;
+            MakePacket(Expected, OutSeq);
+            if (memcmp(Expected, OutPtr, VPACKETSIZE) != 0)
+                Corrupt++;
+            else
+                Delivered++;
+        }
+    }
+
+    if (GroupSize != 0)
+    {
+        Overhead = 100.0 * (double)Encoder.Stats.ParityBytes / (double)Encoder.Stats.DataBytes;
+        EncodeNs = (double)Encoder.Stats.ProcessingNs / (double)Encoder.Stats.DataPackets;
+        DecodeNs = (double)Decoder.Stats.ProcessingNs / (double)NumPackets;
+    }
+    printf("%5d %5d %7.2f %5.1f | %7.2f%% %8.0f %8.0f | %7.3f%% %9.4f%% %6llu %6llu\n",
+           GroupSize, Depth, LossPercent, Burst, Overhead, EncodeNs, DecodeNs,
+           100.0 * (double)Channel.Dropped / (double)Channel.Sent,
+           100.0 * (double)(NumPackets - Delivered) / (double)NumPackets,
+           (unsigned long long)Corrupt, (unsigned long long)OutOfOrder);
+}
+
+
+//
+// read out every packet the decoder has released, checking each is the next
+// one expected. returns false if any isn't
+//
+static bool ReadInSequence(TFECDecoder* Dec, uint32_t* NextSeq)
+{
+    uint8_t Expected[VPACKETSIZE];
+    uint8_t* OutPtr;
+    bool Good = true;
+
+    while ((OutPtr = FECGetOutputPacket(Dec)) != NULL)
+    {
+        MakePacket(Expected, *NextSeq);
+        if (memcmp(Expected, OutPtr, VPACKETSIZE) != 0)
+            Good = false;
+        (*NextSeq)++;
+    }
+    return Good;
+}
+
+
+//
+// reordering after an early release: a block is released as soon as its last
+// parity packet arrives, so a data packet or a duplicate parity packet for it
+// arriving after that is late, and must not start the block again.
+// group 4, depth 1: block 0 with packet 2 lost (then recovered from parity),
+// then packet 2 and the parity again, then block 1.
+// returns true if the test fails
+//
+static bool RunLateTest(void)
+{
+    static TFECEncoder Encoder;
+    static TFECDecoder Decoder;
+    uint8_t Packets[8][VPACKETSIZE];
+    uint8_t Parity[2][VPACKETSIZE + VFECHEADERSIZE];
+    uint32_t Length[2];
+    uint32_t Seq;
+    uint32_t NextSeq = 0;
+    bool Good;
+
+    FECInitEncoder(&Encoder, VPACKETSIZE, 4, 1);
+    FECInitDecoder(&Decoder, VPACKETSIZE, 4, 1);
+    for (Seq = 0; Seq < 8; Seq++)
+    {
+        MakePacket(Packets[Seq], Seq);
+        if (FECEncodePacket(&Encoder, Packets[Seq]))
+            Length[Seq / 4] = FECGetParityPacket(&Encoder, 0, Parity[Seq / 4]);
+    }
+    FECDecodePacket(&Decoder, Packets[0], VPACKETSIZE);
+    FECDecodePacket(&Decoder, Packets[1], VPACKETSIZE);
+    FECDecodePacket(&Decoder, Packets[3], VPACKETSIZE);
+    FECDecodePacket(&Decoder, Parity[0], Length[0]);      // block 0 released here
+    Good = ReadInSequence(&Decoder, &NextSeq);
+    FECDecodePacket(&Decoder, Packets[2], VPACKETSIZE);   // late
+    FECDecodePacket(&Decoder, Parity[0], Length[0]);      // duplicate
+    for (Seq = 4; Seq < 8; Seq++)
+        FECDecodePacket(&Decoder, Packets[Seq], VPACKETSIZE);
+    FECDecodePacket(&Decoder, Parity[1], Length[1]);
+    FECFlushDecoder(&Decoder);
+    Good &= ReadInSequence(&Decoder, &NextSeq);
+    Good &= (NextSeq == 8) && (Decoder.Stats.LatePackets == 1) && (Decoder.Stats.LostPackets == 1)
+            && (Decoder.Stats.RecoveredPackets == 1) && (Decoder.Stats.UnrecoveredPackets == 0);
+    printf("late packets after early release: delivered %d, late %llu, lost %llu, recovered %llu: %s\n\n",
+           NextSeq, (unsigned long long)Decoder.Stats.LatePackets, (unsigned long long)Decoder.Stats.LostPackets,
+           (unsigned long long)Decoder.Stats.RecoveredPackets, Good ? "ok" : "FAILED");
+    return !Good;
+}
+
+
+//
+// send data packets Start to End-1 (and parity when a block completes) to the decoder, losslessly
+//
+static void SendPackets(TFECEncoder* Enc, TFECDecoder* Dec, uint32_t Start, uint32_t End)
+{
+    uint8_t Packet[VPACKETSIZE];
+    uint8_t Parity[VPACKETSIZE + VFECHEADERSIZE];
+    uint32_t Seq, Group, Length;
+
+    for (Seq = Start; Seq < End; Seq++)
+    {
+        MakePacket(Packet, Seq);
+        FECDecodePacket(Dec, Packet, VPACKETSIZE);
+        if (FECEncodePacket(Enc, Packet))
+            for (Group = 0; Group < Enc->Depth; Group++)
+            {
+                Length = FECGetParityPacket(Enc, Group, Parity);
+                FECDecodePacket(Dec, Parity, Length);
+            }
+    }
+}
+
+
+//
+// TX start and stop, as p2app's DUC I/Q thread handles them: the client stops
+// part way through a block, and continues its sequence numbers at the next
+// transmission. Group 4, depth 2 (8 packet blocks), no loss:
+// TX 1 sends 0-9 then pauses: the decoder releases 8-9 at the pause;
+// TX 2 sends 10-21: after the gap, nothing before 10 may be written;
+// TX 3 sends 22-25, but MOX clears before the pause: 24-25 are dropped;
+// TX 4 sends 26-31: 24-25 must not be written ahead of it.
+// returns true if the test fails
+//
+static bool RunStartStopTest(void)
+{
+    static TFECEncoder Encoder;
+    static TFECDecoder Decoder;
+    uint32_t NextSeq = 0;
+    uint32_t AtPause[3];
+    bool Good;
+
+    FECInitEncoder(&Encoder, VPACKETSIZE, 4, 2);
+    FECInitDecoder(&Decoder, VPACKETSIZE, 4, 2);
+    SendPackets(&Encoder, &Decoder, 0, 10);
+    Good = ReadInSequence(&Decoder, &NextSeq);
+    FECFlushHeld(&Decoder);                                 // DUC I/Q paused in TX
+    Good &= ReadInSequence(&Decoder, &NextSeq);
+    AtPause[0] = NextSeq;
+    SendPackets(&Encoder, &Decoder, 10, 22);
+    Good &= ReadInSequence(&Decoder, &NextSeq);
+    FECFlushHeld(&Decoder);
+    Good &= ReadInSequence(&Decoder, &NextSeq);
+    AtPause[1] = NextSeq;
+    SendPackets(&Encoder, &Decoder, 22, 26);
+    Good &= ReadInSequence(&Decoder, &NextSeq);
+    FECDiscardHeld(&Decoder);                               // MOX cleared
+    Good &= ReadInSequence(&Decoder, &NextSeq);
+    AtPause[2] = NextSeq;
+    NextSeq = 26;
+    SendPackets(&Encoder, &Decoder, 26, 32);
+    FECFlushHeld(&Decoder);
+    Good &= ReadInSequence(&Decoder, &NextSeq);
+    Good &= (AtPause[0] == 10) && (AtPause[1] == 22) && (AtPause[2] == 24) && (NextSeq == 32) && !FECIsHolding(&Decoder)
+            && (Decoder.Stats.LatePackets == 0) && (Decoder.Stats.LostPackets == 0);
+    printf("TX start/stop: written by each pause %d, %d, %d (expected 10, 22, 24), then to %d; late %llu, lost %llu: %s\n",
+           AtPause[0], AtPause[1], AtPause[2], NextSeq, (unsigned long long)Decoder.Stats.LatePackets,
+           (unsigned long long)Decoder.Stats.LostPackets, Good ? "ok" : "FAILED");
+    return !Good;
+}
+
+
+static void PrintHeading(void)
+{
+    printf("group depth   loss%% burst |  overhead  enc ns   dec ns | chan loss  residual  corrupt  order\n");
+}
+
+
+//
+// main program. Either run a single configuration, or sweep a standard set
+//
+int main(int argc, char *argv[])
+{
+    int CmdOption;
+    uint32_t GroupSize = 0;
+    uint32_t Depth = 1;
+    uint32_t NumPackets = VDEFAULTPACKETS;
+    double LossPercent = 1.0;
+    double Burst = 1.0;
+    bool Sweep = true;
+    uint32_t Cntr, Model;
+
+    const uint32_t SweepGroups[][2] =
+    {
+        {0, 1}, {4, 1}, {8, 1}, {16, 1}, {4, 4}, {8, 4}, {8, 8}, {16, 8}
+    };
+    const double SweepLoss[][2] =
+    {
+        {0.1, 1.0}, {1.0, 1.0}, {5.0, 1.0}, {1.0, 4.0}
+    };
+
+    while ((CmdOption = getopt(argc, argv, ":g:d:l:b:n:h")) != -1)
+    {
+        switch (CmdOption)
+        {
+            case 'g':
+                GroupSize = atoi(optarg);
+                Sweep = false;
+                break;
+
+            case 'd':
+                Depth = atoi(optarg);
+                break;
+
+            case 'l':
+                LossPercent = atof(optarg);
+                break;
+
+            case 'b':
+                Burst = atof(optarg);
+                break;
+
+            case 'n':
+                NumPackets = atoi(optarg);
+                break;
+
+            default:
+                printf("usage: ./fectest <optional arguments>\n");
+                printf("with no -g option, a standard set of configurations is swept\n");
+                printf("-g <group>    data packets per parity packet (0 = no FEC)\n");
+                printf("-d <depth>    interleave depth\n");
+                printf("-l <loss>     average channel loss in percent\n");
+                printf("-b <burst>    average loss burst length in packets\n");
+                printf("-n <packets>  number of data packets to send\n");
+                return EXIT_SUCCESS;
+        }
+    }
+    if ((GroupSize != 0) && ((GroupSize < 2) || (GroupSize > VFECMAXGROUP) || (Depth < 1) || (Depth > VFECMAXDEPTH)))
+    {
+        printf("group must be 2 to %d; depth 1 to %d\n", VFECMAXGROUP, VFECMAXDEPTH);
+        return EXIT_FAILURE;
+    }
+
+    if (RunStartStopTest() || RunLateTest())
+        return EXIT_FAILURE;
+    PrintHeading();
+    if (!Sweep)
+        RunTest(GroupSize, Depth, LossPercent, Burst, NumPackets);
+    else
+        for (Model = 0; Model < sizeof(SweepLoss) / sizeof(SweepLoss[0]); Model++)
+        {
+            for (Cntr = 0; Cntr < sizeof(SweepGroups) / sizeof(SweepGroups[0]); Cntr++)
+                RunTest(SweepGroups[Cntr][0], SweepGroups[Cntr][1], SweepLoss[Model][0], SweepLoss[Model][1], NumPackets);
+            printf("\n");
+        }
+    return EXIT_SUCCESS;
+}
@@ -6,19 +6,27 @@
 //		record a block of 24 bit I&Q data from DDS in Litefury
 //		dump data to I/Q
 //		(established byte ordering)
-// 
+//
 // Plan B
 //		write CSV file & check data in Excel
 //		(added FIFO reset function to FPGA so we can re-start)
-// 
+//
 // Plan C
 //		prototype for thread - open buffer, read many blocks and write CSV file
-// 		(Jan 2022, current code)
+// 		(Jan 2022)
+//
+// Plan D
+//		DDC DMA stream analyser (current code)
+//		capture the DDC DMA stream continuously for a set time into memory,
+//		then decode the rate word framing the same way p2app does and report:
+//		- DMA throughput achieved, transfer sizes and residue
+//		- samples delivered for each DDC against the configured rate
+//		- framing errors (rate word not where expected) and discontinuities
+//		- tone frequency, amplitude and SNR if the FPGA test DDS is the source
+//		captures can be saved and analysed later, on any machine.
+//		-g makes a synthetic capture (optionally with errors) to check the analyser
 //
 
-#define _DEFAULT_SOURCE
-#define _XOPEN_SOURCE 500
-#include <assert.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <stdint.h>
@@ -28,281 +36,695 @@
 #include <unistd.h>
 #include <errno.h>
 #include <time.h>
+#include <math.h>
+#include <semaphore.h>
+
+#include "../../sw_projects/common/saturntypes.h"
+#include "../../sw_projects/common/hwaccess.h"
+#include "../../sw_projects/common/saturnregisters.h"
+#include "../../sw_projects/common/saturndrivers.h"
+#include "../../sw_projects/common/toneanalysis.h"
+
+//------------------------------------------------------------------------------------------
+// VERSION History
+// V1, 18/10/2026:   DMA stream analyser replaces CSV dump
+
+
+#define VALIGNMENT 4096                         // DMA buffer alignment
+#define VMINTRANSFER 4096                       // DMA transfer size limits (bytes)
+#define VMAXTRANSFER 65536
+#define VDEFAULTSECONDS 5.0                     // capture time
+#define VDEFAULTRATE 192                        // ksps
+#define VDEFAULTBUFFERMB 256                    // most memory a capture may use
+#define VFRAMERATE 48000.0                      // rate words per second (one per 48ksps sample)
+#define VRATEFLAGBYTE 7                         // byte of a 64 bit word holding the rate word flag
+#define VRATEFLAG 0x80
+#define VANALYSISBLOCK 65536                    // samples per tone analysis block
+#define VSETTLESAMPLES 4096                     // samples skipped while DDC filters settle
+#define VMINSNR 50.0                            // dB, as the p2app self test
+#define VFREQTOL 1.0                            // Hz
+#define VMINRATIO 0.95                          // samples delivered / expected
+#define VMAXRATIO 1.02
+#define VCAPTUREMAGIC "SATDDC01"                // capture file identifier
+
+
+//
+// capture file header; the DMA data follows it, exactly as read
+//
+typedef struct
+{
+    char Magic[8];
+    uint32_t NumDDC;                            // VNUMDDC
+    uint32_t Transfers;                         // DMA reads made
+    uint32_t RatekHz[VNUMDDC];                  // configured rate; 0 if not enabled
+    double ToneOffset[VNUMDDC];                 // expected tone frequency in each DDC (Hz)
+    uint32_t ToneActive;                        // 1 if the test DDS was the source
+    uint32_t MaxDepth;                          // largest FIFO depth seen (64 bit words)
+    uint32_t OverThreshold;                     // FIFO over threshold reports
+    uint32_t Spare;
+    uint64_t DurationNs;                        // capture time
+    uint64_t Bytes;                             // DMA bytes captured
+} TCaptureHeader;
 
-#include <sys/mman.h>
-#include <sys/stat.h>
-#include <sys/time.h>
-#include <sys/types.h>
-#include <unistd.h>
-
-#define VTRANSFERSIZE 4096										// size in bytes to DMA transfer
-#define VMEMBUFFERSIZE 32768									// memory buffer to reserve
-#define AXIBaseAddress 0x18000									// address of StreamRead/Writer IP
 
 //
-// mem read/write variables:
+// what the analysis found for one DDC
 //
-	int register_fd;                             // device identifier
+typedef struct
+{
+    uint64_t Samples;                           // samples in the stream
+    uint32_t BlockCount;                        // samples held for analysis
+    uint8_t* Block;                             // P2 format samples; 1st is last of previous block
+    double* IQ;
+    uint32_t Blocks;                            // blocks analysed
+    uint32_t Discontinuities;
+    double FrequencySum;                        // sum over blocks
+    double AmplitudeSum;
+    double MinSNR;
+} TDDCAnalysis;
 
 
 //
-// dump a memory buffer to terminal in hex
-// should be a multiple of 16 bytes long!
+// sequence of rate word analysis
 //
-void DumpMemoryBuffer(char* MemPtr, uint32_t Length)
+typedef struct
 {
-	unsigned char Byte;
-	uint32_t ByteCntr;
-  uint32_t RowCntr;
-
-	for (RowCntr=0; RowCntr < Length/16; RowCntr++)
-	{
-		printf("%04x   ", RowCntr*16);
-		for (ByteCntr = 0; ByteCntr < 16; ByteCntr++)
-			printf("%02x ", *MemPtr++);
-		printf("\n");
-	}
-}
-
+    uint64_t LeadingBytes;                      // before the 1st rate word
+    uint64_t Frames;
+    uint32_t RateChanges;                       // rate word differed from the previous one
+    uint32_t FramingErrors;                     // rate word not found where expected
+    uint64_t SkippedBytes;                      // discarded re-synchronising
+    uint64_t ResidueBytes;                      // incomplete frame at the end
+} TFramingAnalysis;
 
 
+//
+// mutexes used by the register code (initialised by p2app normally)
+//
+extern sem_t DDCInSelMutex;
+extern sem_t RFGPIOMutex;
+extern sem_t DDCResetFIFOMutex;
+extern sem_t CodecRegMutex;
 
 
 //
-// initiate a DMA from the FPGA with specified parameters
-// returns 1 if success, else 0
-// fd: file device (an open file)
-// DestData: pointer to memory block to transfer
-// Length: number of bytes to copy
-// AXIAddr: offset address in the FPGA window 
+// saturndrivers.c calls this p2app DUC handler; there is no DUC stream here
 //
-int DMAReadFromFPGA(int fd, char*DestData, uint32_t Length, uint32_t AXIAddr)
+void HandlerSetEERMode(bool EEREnabled)
 {
-	ssize_t rc;									// response code
-	off_t OffsetAddr;
-
-	OffsetAddr = AXIAddr;
-	rc = lseek(fd, OffsetAddr, SEEK_SET);
-	if (rc != OffsetAddr)
-	{
-		printf("seek off 0x%lx != 0x%lx.\n", rc, OffsetAddr);
-		perror("seek file");
-		return -EIO;
-	}
-
-	// write data to FPGA from memory buffer
-	rc = read(fd, DestData, Length);
-	if (rc < 0)
-	{
-		printf("read 0x%lx @ 0x%lx failed %ld.\n", Length, OffsetAddr, rc);
-		perror("DMA read");
-		return -EIO;
-	}
-	return 0;
+    (void)EEREnabled;
 }
 
 
-
-uint32_t RegisterRead(uint32_t Address)
+//
+// nanoseconds since an arbitrary start
+//
+static uint64_t GetTimeNs(void)
 {
-	uint32_t result = 0;
+    struct timespec Now;
 
-    ssize_t nread = pread(register_fd, &result, sizeof(result), (off_t) Address);
-    if (nread != sizeof(result))
-        printf("ERROR: register read: addr=0x%08X   error=%s\n",Address, strerror(errno));
-	return result;
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (uint64_t)Now.tv_sec * 1000000000ULL + (uint64_t)Now.tv_nsec;
 }
 
 
 //
-// 32 bit register write over the AXILite bus
+// tone offset from DDC centre: different for each DDC, within the passband
+// (the same offsets as the p2app streaming self test)
 //
-void RegisterWrite(uint32_t Address, uint32_t Data)
+static double ToneOffset(uint32_t DDC, uint32_t RatekHz)
 {
-    ssize_t nsent = pwrite(register_fd, &Data, sizeof(Data), (off_t) Address); 
-    if (nsent != sizeof(Data))
-        printf("ERROR: Write: addr=0x%08X   error=%s\n",Address, strerror(errno));
+    return (double)RatekHz * 1000.0 * (double)(DDC + 1) / 40.0;
 }
 
 
-#define VCSVCOUNT 83					// 83 I/Q pairs similar to one USB frame
-#define VPACKETSIZE VCSVCOUNT*6			// number of bytes needed for one CSV record
 //
-// write a packet of data to CSV; 
-// sending <VCSVCOUNT> I/Q pairs. This is similar to a USB frame.
-// parameters: 
-//  fd		pointer to the already open file
-//	Ptr		start location pointer into memory buffer
-// 	Counter	pointer to integer I/Q value counter
-//  returns the read pointer
-unsigned char * CSVWrite(FILE* fd, unsigned char* Ptr, uint32_t* Counter)
+// rate word code for a sample rate: count per frame = 2^(code-1)
+// returns 0 if not a P2 rate
+//
+static uint32_t RateCode(uint32_t RatekHz)
 {
-	int Cntr;
-	int32_t ISample, QSample;
-	for(Cntr=0; Cntr < VCSVCOUNT; Cntr ++)
-	{
-		ISample = (*Ptr) <<24 | (*(Ptr+1)<<16) | (*(Ptr+2)<<8);
-		Ptr += 3;
-		QSample = (*Ptr) <<24 | (*(Ptr+1)<<16) | (*(Ptr+2)<<8);
-		Ptr += 3;
-		fprintf(fd, "%d, %d, %d\n", *Counter, ISample, QSample);
-		*Counter += 1;
-	}
-	return Ptr;
+    uint32_t Code;
+
+    for (Code = 1; Code < 7; Code++)
+        if ((48U << (Code - 1)) == RatekHz)
+            return Code;
+    return 0;
 }
 
 
+//
+// DMA transfer size for the current FIFO depth (in 64 bit words)
+// largest power of 2 the FIFO can supply, as p2app
+//
+static uint32_t TransferSize(uint32_t Depth)
+{
+    uint32_t Size = VMAXTRANSFER;
 
+    while ((Size > VMINTRANSFER) && (Depth <= Size / 8U))
+        Size = Size >> 1;
+    return Size;
+}
 
-#define VALIGNMENT 4096
-#define VBASE 0x1000									// DMA start at 4K into buffer
 
 //
-// main program
+// capture from the DDC DMA stream into Buffer, for a time or until the buffer is full
+// returns true if the hardware could not be opened
 //
-int main(int argc, char *argv[])
+static bool CaptureDMA(TCaptureHeader* Header, uint8_t* Buffer, uint64_t BufferSize, double Seconds,
+                       uint32_t ToneFrequency)
 {
-	int DMAReadfile_fd = -1;											// DMA read file device
-  	char* ReadBuffer = NULL;											// data for DMA write
-	uint32_t BufferSize = 32768;
-
-	uint32_t RegisterValue;
-	uint32_t Depth = 0;
-	FILE *fp;
-	uint32_t SampleCounter = 0;
-
-	uint32_t Head = 0;											// byte address of 1st free location
-	uint32_t Read = 0;											// read point in buffer
-	unsigned char* ReadPtr;									// pointer for reading out an I or Q sample
-	unsigned char* HeadPtr;									// ptr to 1st free location
-	unsigned char* BasePtr;									// ptr to DMA location
-	uint32_t ResidueBytes;
-//
-// initialise. Create memory buffers and open DMA file devices
-//
-	posix_memalign((void **)&ReadBuffer, VALIGNMENT, BufferSize);
-	if(!ReadBuffer)
-	{
-		printf("read buffer allocation failed\n");
-		goto out;
-	}
-	ReadPtr = ReadBuffer + VBASE;							// offset 4096 bytes into buffer
-	HeadPtr = ReadBuffer + VBASE;
-	BasePtr = ReadBuffer + VBASE;
-
-//
-// try to open memory device, then DMA device
-//
-	if ((register_fd = open("/dev/xdma0_user", O_RDWR)) == -1)
+    int DMAReadfile_fd;
+    uint32_t DDC, Depth, Size;
+    unsigned int Current;
+    bool FIFOOverflow, FIFOOverThreshold, FIFOUnderflow;
+    uint64_t StartTime, EndTime;
+
+    if (OpenXDMADriver(false) == 0)
+        return true;
+    DMAReadfile_fd = open(VDDCDMADEVICE, O_RDWR);
+    if (DMAReadfile_fd < 0)
     {
-		printf("register R/W address space not available\n");
-		goto out;
+        printf("XDMA read device open failed for DDC data\n");
+        CloseXDMADriver();
+        return true;
     }
-    else
-		printf("register access connected to /dev/xdma0_user\n");
 
+    //
+    // stop and clear the stream, then set up the DDCs and source
+    //
+    SetRXDDCEnabled(false);
+    usleep(1000);                                           // give FIFO time to stop recording
+    SetByteSwapping(true);                                  // network byte order, as p2app
+    SetupFIFOMonitorChannel(eRXDDCDMA, false);
+    ResetDMAStreamFIFO(eRXDDCDMA);
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+    {
+        SetP2SampleRate(DDC, (Header->RatekHz[DDC] != 0), Header->RatekHz[DDC], false);
+        if (Header->ToneActive)
+        {
+            SetDDCADC(DDC, eADC1);                          // overridden to test source
+            SetDDCFrequency(DDC, (uint32_t)((double)ToneFrequency - Header->ToneOffset[DDC]), false);
+        }
+    }
+    if (Header->ToneActive)
+    {
+        SetTestDDSFrequency(ToneFrequency, false);
+        UseTestDDSSource();
+    }
+    WriteP2DDCRateRegister();
+    ReadFIFOMonitorChannel(eRXDDCDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);
+
+    //
+    // capture: nothing but DMA reads until the time is up or the buffer is full
+    //
+    SetRXDDCEnabled(true);
+    StartTime = GetTimeNs();
+    EndTime = StartTime + (uint64_t)(Seconds * 1.0e9);
+    while ((GetTimeNs() < EndTime) && (Header->Bytes + VMAXTRANSFER <= BufferSize))
+    {
+        Depth = ReadFIFOMonitorChannel(eRXDDCDMA, &FIFOOverflow, &FIFOOverThreshold, &FIFOUnderflow, &Current);
+        if (FIFOOverThreshold)
+            Header->OverThreshold++;
+        if (Current > Header->MaxDepth)
+            Header->MaxDepth = Current;
+        if (Depth < VMINTRANSFER / 8U)
+        {
+            usleep(100);
+            continue;
+        }
+        Size = TransferSize(Depth);
+        if (DMAReadFromFPGA(DMAReadfile_fd, Buffer + Header->Bytes, Size, VADDRDDCSTREAMREAD) != 0)
+            break;
+        Header->Bytes += Size;
+        Header->Transfers++;
+    }
+    Header->DurationNs = GetTimeNs() - StartTime;
+    SetRXDDCEnabled(false);
+    if (Header->Bytes + VMAXTRANSFER > BufferSize)
+        printf("capture buffer full after %.2fs\n", (double)Header->DurationNs / 1.0e9);
+
+    close(DMAReadfile_fd);
+    CloseXDMADriver();
+    return false;
+}
 
-	printf("Initialising XDMA read\n");
-	DMAReadfile_fd = open("/dev/xdma0_c2h_0", O_RDWR);
 
-	if(DMAReadfile_fd < 0)
-	{
-		printf("XDMA read device open failed\n");
-		goto out;
-	}
 //
-// open CSV file
+// write one 64 bit word holding a P2 format sample
 //
-	fp = fopen("sine.csv", "w");
+static void WriteSampleWord(uint8_t* Dest, uint8_t* Sample)
+{
+    memcpy(Dest, Sample, 6);
+    Dest[6] = 0;
+    Dest[7] = 0;
+}
 
-//
-// now read the user access register (it should have a date code)
-//
-	RegisterValue = RegisterRead(0xB000);				// read the user access register
-	printf("User register = %08x\n", RegisterValue);
 
 //
-// write 0 to GPIO to clear FIFO
-//
-	RegisterWrite(0xA000, 0);				// write to the GPIO register
-	RegisterWrite(0xA000, 2);				// write to the GPIO register
-	printf("GPIO Register written with value=0 then 2 to reset FIFO\n");
+// make a synthetic capture: rate word framing exactly as the FPGA, with a
+// tone in each DDC. If InjectErrors, one frame loses a sample from DDC0
+// (a discontinuity) and one rate word is corrupted (a framing error)
 //
-// read the FIFO depth register (it should be 0)
-//
-	RegisterValue = RegisterRead(0x9000);				// read the FIFO Depth register
-	printf("FIFO Depth register = %08x (should be 0)\n", RegisterValue);
-	Depth=0;
+static void GenerateCapture(TCaptureHeader* Header, uint8_t* Buffer, uint64_t BufferSize, double Seconds,
+                            bool InjectErrors)
+{
+    uint32_t RateWord = 0;
+    uint32_t DDC, Cntr, Count[VNUMDDC], FrameLength;
+    uint64_t Frame, Frames, Next[VNUMDDC];
+    uint8_t Sample[6 * 32];
+    uint8_t* Ptr = Buffer;
+    uint64_t ErrorFrame = 0;
+
+    FrameLength = 0;
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+    {
+        Next[DDC] = 0;
+        Count[DDC] = (Header->RatekHz[DDC] != 0) ? (1U << (RateCode(Header->RatekHz[DDC]) - 1)) : 0;
+        RateWord |= (Header->RatekHz[DDC] != 0) ? (RateCode(Header->RatekHz[DDC]) << (3 * DDC)) : 0;
+        FrameLength += Count[DDC];
+    }
+    Frames = (uint64_t)(Seconds * VFRAMERATE);
+    if ((Frames + 2) * (FrameLength + 1) * 8 > BufferSize)
+        Frames = BufferSize / ((FrameLength + 1) * 8) - 2;
+    if (InjectErrors)
+        ErrorFrame = Frames / 2;
+
+    //
+    // stream starts part way through a frame, like a real capture
+    //
+    memset(Ptr, 0, 24);
+    Ptr += 24;
+    for (Frame = 0; Frame < Frames; Frame++)
+    {
+        *(uint32_t*)Ptr = RateWord;
+        Ptr[4] = 0;
+        Ptr[5] = 0;
+        Ptr[6] = 0;
+        Ptr[VRATEFLAGBYTE] = VRATEFLAG;
+        if (InjectErrors && (Frame == ErrorFrame + 1000))
+            Ptr[VRATEFLAGBYTE] = 0;                         // corrupt rate word
+        Ptr += 8;
+        for (DDC = 0; DDC < VNUMDDC; DDC++)
+        {
+            if (Count[DDC] == 0)
+                continue;
+            if (InjectErrors && (DDC == 0) && (Frame == ErrorFrame))
+                Next[DDC]++;                                // lose a sample
+            SynthesiseP2Tone(Sample, Count[DDC], Next[DDC], Header->RatekHz[DDC] * 1000.0,
+                             Header->ToneOffset[DDC], 0.5, 1.0e-5);
+            Next[DDC] += Count[DDC];
+            for (Cntr = 0; Cntr < Count[DDC]; Cntr++)
+            {
+                WriteSampleWord(Ptr, Sample + 6 * Cntr);
+                Ptr += 8;
+            }
+        }
+    }
+    memset(Ptr, 0, FrameLength * 8);                        // incomplete frame at the end
+    *(uint32_t*)Ptr = RateWord;
+    Ptr[VRATEFLAGBYTE] = VRATEFLAG;
+    Ptr += FrameLength * 8;
+    Header->Bytes = Ptr - Buffer;
+    Header->Transfers = (uint32_t)((Header->Bytes + VMAXTRANSFER - 1) / VMAXTRANSFER);
+    Header->DurationNs = (uint64_t)((double)Frames / VFRAMERATE * 1.0e9);
+}
 
-//
-// write 3 to GPIO to enable FIFO writes
-//
-	RegisterWrite(0xA000, 3);				// write to the GPIO register
-	printf("GPIO Register written with value=3, enabling writes\n");
 
 //
-// now read and dump data until we have at least 10000 samples
+// analyse the samples held for one DDC, keeping the last as the start of the next block
+// so a discontinuity between blocks is found too
 //
-	while(SampleCounter < 10000)
-	{
+static void AnalyseBlock(TDDCAnalysis* DDC, double SampleRate)
+{
+    TToneAnalysis Result;
+
+    if (DDC->BlockCount < VTONEMINSAMPLES)
+        return;
+    UnpackP2IQSamples(DDC->Block, DDC->BlockCount, DDC->IQ);
+    AnalyseTone(DDC->IQ, DDC->BlockCount, SampleRate, &Result);
+    DDC->Blocks++;
+    DDC->Discontinuities += Result.Discontinuities;
+    DDC->FrequencySum += Result.Frequency;
+    DDC->AmplitudeSum += Result.AmplitudedBFS;
+    if ((DDC->Blocks == 1) || (Result.SNRdB < DDC->MinSNR))
+        DDC->MinSNR = Result.SNRdB;
+    memcpy(DDC->Block, DDC->Block + 6 * (DDC->BlockCount - 1), 6);
+    DDC->BlockCount = 1;
+}
+
+
 //
-// here we write CSV values while there is enough data available; then do DMA to get more
+// find the next rate word at or after Offset. returns the offset, or Bytes if none
 //
-		while((HeadPtr - ReadPtr)>VPACKETSIZE)
-			ReadPtr = CSVWrite(fp, ReadPtr, &SampleCounter);
+static uint64_t FindRateWord(uint8_t* Buffer, uint64_t Offset, uint64_t Bytes)
+{
+    while ((Offset + 8 <= Bytes) && (Buffer[Offset + VRATEFLAGBYTE] != VRATEFLAG))
+        Offset += 8;
+    return (Offset + 8 <= Bytes) ? Offset : Bytes;
+}
+
+
 //
-// now copy any residue to the start of the buffer (before the DMA point)
+// decode the rate word framing of a capture, as the p2app DDC thread does,
+// sorting samples to each DDC and analysing them if a tone is present
 //
-		ResidueBytes = HeadPtr-ReadPtr;
-		printf("Residue = %d bytes\n",ResidueBytes);
-		if(ResidueBytes != 0)					// if there is residue
-		{
-			memcpy(BasePtr-ResidueBytes, ReadPtr, ResidueBytes);
-			ReadPtr = BasePtr-ResidueBytes;
-		}
-		else
-			ReadPtr = BasePtr;
+static void AnalyseFraming(TCaptureHeader* Header, uint8_t* Buffer, TFramingAnalysis* Framing, TDDCAnalysis* Analysis)
+{
+    uint64_t Offset, Next;
+    uint32_t RateWord, PrevRateWord = 0xFFFFFFFF;
+    uint32_t DDCCounts[VNUMDDC] = {0};
+    uint32_t FrameLength = 0;
+    uint32_t DDC, Cntr;
+    uint8_t* SamplePtr;
+
+    memset(Framing, 0, sizeof(TFramingAnalysis));
+    Offset = FindRateWord(Buffer, 0, Header->Bytes);
+    Framing->LeadingBytes = Offset;
+    while (Offset + 8 <= Header->Bytes)
+    {
+        if (Buffer[Offset + VRATEFLAGBYTE] != VRATEFLAG)
+        {
+            Framing->FramingErrors++;
+            Next = FindRateWord(Buffer, Offset, Header->Bytes);
+            Framing->SkippedBytes += Next - Offset;
+            Offset = Next;
+            continue;
+        }
+        RateWord = *(uint32_t*)(Buffer + Offset);
+        if (RateWord != PrevRateWord)
+        {
+            if (PrevRateWord != 0xFFFFFFFF)
+                Framing->RateChanges++;
+            FrameLength = AnalyseDDCHeader(RateWord, DDCCounts);
+            PrevRateWord = RateWord;
+        }
+        if (Offset + (FrameLength + 1) * 8 > Header->Bytes)
+            break;                                          // incomplete frame
+        SamplePtr = Buffer + Offset + 8;
+        for (DDC = 0; DDC < VNUMDDC; DDC++)
+        {
+            Analysis[DDC].Samples += DDCCounts[DDC];
+            for (Cntr = 0; Cntr < DDCCounts[DDC]; Cntr++)
+            {
+                if (Header->ToneActive && (Analysis[DDC].Samples - DDCCounts[DDC] + Cntr >= VSETTLESAMPLES))
+                {
+                    memcpy(Analysis[DDC].Block + 6 * Analysis[DDC].BlockCount, SamplePtr, 6);
+                    if (++Analysis[DDC].BlockCount == VANALYSISBLOCK)
+                        AnalyseBlock(&Analysis[DDC], Header->RatekHz[DDC] * 1000.0);
+                }
+                SamplePtr += 8;
+            }
+        }
+        Framing->Frames++;
+        Offset += (FrameLength + 1) * 8;
+    }
+    Framing->ResidueBytes = Header->Bytes - Offset;
+    if (Header->ToneActive)
+        for (DDC = 0; DDC < VNUMDDC; DDC++)
+            if (Header->RatekHz[DDC] != 0)
+                AnalyseBlock(&Analysis[DDC], Header->RatekHz[DDC] * 1000.0);
+}
+
 
 //
-// now wait until there is data, then DMA it
+// analyse a capture and print the report
+// returns true if any check failed
 //
-		Depth = RegisterRead(0x9000);				// read the user access register
-		printf("read: depth = %d\n", Depth);
-		while(Depth < 512)			// 512 locations = 4K bytes
-		{
-			usleep(1000);								// 1ms wait
-			Depth = RegisterRead(0x9000);				// read the user access register
-			printf("read: depth = %d\n", Depth);
-		}
+static bool AnalyseCapture(TCaptureHeader* Header, uint8_t* Buffer)
+{
+    TDDCAnalysis Analysis[VNUMDDC];
+    TFramingAnalysis Framing;
+    uint32_t DDC, ExpectedRate;
+    double Seconds, Ratio, Frequency;
+    uint64_t Expected;
+    uint64_t StartTime;
+    bool Failed = false;
+    char Reason[64];
+
+    memset(Analysis, 0, sizeof(Analysis));
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+    {
+        Analysis[DDC].Block = malloc(6 * VANALYSISBLOCK);
+        Analysis[DDC].IQ = malloc(2 * VANALYSISBLOCK * sizeof(double));
+        if ((Analysis[DDC].Block == NULL) || (Analysis[DDC].IQ == NULL))
+        {
+            printf("analysis buffer allocation failed\n");
+            return true;
+        }
+    }
+    StartTime = GetTimeNs();
+    AnalyseFraming(Header, Buffer, &Framing, Analysis);
+    Seconds = (double)Header->DurationNs / 1.0e9;
+
+    //
+    // DMA
+    //
+    printf("\nDMA: %llu bytes in %u transfers over %.3fs: %.2fMB/s, average transfer %llu bytes\n",
+           (unsigned long long)Header->Bytes, Header->Transfers, Seconds, (double)Header->Bytes / Seconds / 1.0e6,
+           (unsigned long long)(Header->Transfers ? Header->Bytes / Header->Transfers : 0));
+    ExpectedRate = 0;
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+        ExpectedRate += Header->RatekHz[DDC];
+    if (ExpectedRate != 0)
+        printf("     configured stream %.2fMB/s (%dksps total, with rate words)\n",
+               (ExpectedRate * 1000.0 + VFRAMERATE) * 8.0 / 1.0e6, ExpectedRate);
+    printf("     FIFO: largest depth %u words, %u over threshold reports\n", Header->MaxDepth, Header->OverThreshold);
+    printf("     %llu bytes before 1st rate word; residue %llu bytes (incomplete frame at end)\n",
+           (unsigned long long)Framing.LeadingBytes, (unsigned long long)Framing.ResidueBytes);
+    if (Header->OverThreshold != 0)
+        Failed = true;
+
+    //
+    // framing
+    //
+    printf("framing: %llu frames, %u rate word changes, %u framing errors (%llu bytes skipped)\n",
+           (unsigned long long)Framing.Frames, Framing.RateChanges, Framing.FramingErrors,
+           (unsigned long long)Framing.SkippedBytes);
+    if ((Framing.FramingErrors != 0) || (Framing.RateChanges != 0))
+        Failed = true;
+
+    //
+    // per DDC
+    //
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+    {
+        if ((Analysis[DDC].Samples == 0) && (Header->RatekHz[DDC] == 0))
+            continue;
+        Reason[0] = 0;
+        Expected = (uint64_t)(Header->RatekHz[DDC] * 1000.0 * Seconds);
+        Ratio = (Expected != 0) ? (double)Analysis[DDC].Samples / (double)Expected : 0.0;
+        printf("DDC%d: %llu samples, %.1fksps (configured %dksps)", DDC, (unsigned long long)Analysis[DDC].Samples,
+               (double)Analysis[DDC].Samples / Seconds / 1000.0, Header->RatekHz[DDC]);
+        if ((Ratio < VMINRATIO) || (Ratio > VMAXRATIO))
+            snprintf(Reason, sizeof(Reason), "delivered %.1f%% of samples", 100.0 * Ratio);
+        if (Header->ToneActive && (Analysis[DDC].Blocks != 0))
+        {
+            Frequency = Analysis[DDC].FrequencySum / Analysis[DDC].Blocks;
+            printf("; tone %.2fHz %.1fdBFS SNR %.1fdB, %u discontinuities",
+                   Frequency, Analysis[DDC].AmplitudeSum / Analysis[DDC].Blocks, Analysis[DDC].MinSNR,
+                   Analysis[DDC].Discontinuities);
+            if (Reason[0] != 0)
+                ;
+            else if (Analysis[DDC].Discontinuities != 0)
+                snprintf(Reason, sizeof(Reason), "samples missing or repeated");
+            else if (fabs(Frequency - Header->ToneOffset[DDC]) > VFREQTOL)
+                snprintf(Reason, sizeof(Reason), "tone expected at %.2fHz", Header->ToneOffset[DDC]);
+            else if (Analysis[DDC].MinSNR < VMINSNR)
+                snprintf(Reason, sizeof(Reason), "low SNR");
+        }
+        printf("%s%s\n", (Reason[0] != 0) ? ": FAIL " : "", Reason);
+        if (Reason[0] != 0)
+            Failed = true;
+    }
+    if (!Header->ToneActive)
+        printf("(no tone analysis: the test DDS was not the source)\n");
+    printf("analysis took %.2fs\n", (double)(GetTimeNs() - StartTime) / 1.0e9);
 
-		printf("DMA read %d bytes from destination to base\n", VTRANSFERSIZE);
-		DMAReadFromFPGA(DMAReadfile_fd, BasePtr, VTRANSFERSIZE, AXIBaseAddress);
-		HeadPtr = BasePtr + VTRANSFERSIZE;
+    for (DDC = 0; DDC < VNUMDDC; DDC++)
+    {
+        free(Analysis[DDC].Block);
+        free(Analysis[DDC].IQ);
+    }
+    return Failed;
+}
 
-	}  //while(SampleCounter < 10000)
 
-	//
-	// Disable write, Do a DMA read, then re-read depth register
-	//
-		RegisterWrite(0xA000, 2);				// write to the GPIO register
-		printf("GPIO Register written with value=2\n");//
-	//
-	// read the FIFO depth register
-	//
-		RegisterValue = RegisterRead(0x9000);				// read the FIFO Depth register
-		printf("FIFO Depth register at end after multiple DMA transfers = %d\n", RegisterValue);
+//
+// save or load a capture. return true if failed
+//
+static bool SaveCapture(char* Filename, TCaptureHeader* Header, uint8_t* Buffer)
+{
+    FILE* fp;
+    bool Error;
 
-	fclose(fp);
+    fp = fopen(Filename, "wb");
+    if (fp == NULL)
+    {
+        perror("capture file");
+        return true;
+    }
+    Error = (fwrite(Header, sizeof(TCaptureHeader), 1, fp) != 1)
+         || (fwrite(Buffer, 1, Header->Bytes, fp) != Header->Bytes);
+    if (Error)
+        perror("capture file write");
+    fclose(fp);
+    return Error;
+}
 
+static uint8_t* LoadCapture(char* Filename, TCaptureHeader* Header)
+{
+    FILE* fp;
+    uint8_t* Buffer = NULL;
+
+    fp = fopen(Filename, "rb");
+    if (fp == NULL)
+    {
+        perror("capture file");
+        return NULL;
+    }
+    if ((fread(Header, sizeof(TCaptureHeader), 1, fp) != 1) || (memcmp(Header->Magic, VCAPTUREMAGIC, 8) != 0)
+        || (Header->NumDDC != VNUMDDC))
+        printf("%s is not a DDC capture file\n", Filename);
+    else if ((Buffer = malloc(Header->Bytes)) == NULL)
+        printf("capture buffer allocation failed\n");
+    else if (fread(Buffer, 1, Header->Bytes, fp) != Header->Bytes)
+    {
+        printf("capture file is truncated\n");
+        free(Buffer);
+        Buffer = NULL;
+    }
+    fclose(fp);
+    return Buffer;
+}
 
 
 //
-// close down. Deallocate memory and close files
+// main program
 //
-out:
-	close(DMAReadfile_fd);
-	close(register_fd);
+int main(int argc, char *argv[])
+{
+    TCaptureHeader Header;
+    uint8_t* Buffer = NULL;
+    int CmdOption;
+    double Seconds = VDEFAULTSECONDS;
+    uint32_t RatekHz = VDEFAULTRATE;
+    uint32_t DDCCount = 1;
+    uint32_t ToneFrequency = 0;
+    uint64_t BufferSize = (uint64_t)VDEFAULTBUFFERMB * 1024 * 1024;
+    char* SaveFile = NULL;
+    char* LoadFile = NULL;
+    char* GenerateFile = NULL;
+    bool InjectErrors = false;
+    bool Failed;
+    uint32_t DDC;
+
+    while ((CmdOption = getopt(argc, argv, ":t:r:n:f:m:w:o:g:eh")) != -1)
+    {
+        switch (CmdOption)
+        {
+            case 't':
+                Seconds = atof(optarg);
+                break;
+            case 'r':
+                RatekHz = atoi(optarg);
+                break;
+            case 'n':
+                DDCCount = atoi(optarg);
+                break;
+            case 'f':
+                ToneFrequency = atoi(optarg);
+                break;
+            case 'm':
+                BufferSize = (uint64_t)atoi(optarg) * 1024 * 1024;
+                break;
+            case 'w':
+                SaveFile = optarg;
+                break;
+            case 'o':
+                LoadFile = optarg;
+                break;
+            case 'g':
+                GenerateFile = optarg;
+                break;
+            case 'e':
+                InjectErrors = true;
+                break;
+            default:
+                printf("usage: ./iqdmatest <optional arguments>\n");
+                printf("-t <seconds>  capture time (default %.0f)\n", VDEFAULTSECONDS);
+                printf("-r <ksps>     DDC sample rate, 48 to 1536 (default %d)\n", VDEFAULTRATE);
+                printf("-n <count>    number of DDCs enabled (default 1)\n");
+                printf("-f <Hz>       use the FPGA test DDS at this frequency, and analyse the tone\n");
+                printf("-m <MB>       largest capture buffer (default %d)\n", VDEFAULTBUFFERMB);
+                printf("-w <file>     save the capture for offline analysis\n");
+                printf("-o <file>     analyse a saved capture offline (no hardware needed)\n");
+                printf("-g <file>     generate a synthetic capture with a tone in each DDC\n");
+                printf("-e            with -g: inject a missing sample and a corrupt rate word\n");
+                return EXIT_SUCCESS;
+        }
+    }
 
-	free(ReadBuffer);
-}
+    //
+    // offline analysis of a saved capture
+    //
+    if (LoadFile != NULL)
+    {
+        Buffer = LoadCapture(LoadFile, &Header);
+        if (Buffer == NULL)
+            return EXIT_FAILURE;
+        printf("analysing %s\n", LoadFile);
+        Failed = AnalyseCapture(&Header, Buffer);
+        printf("\nDDC DMA stream %s\n", Failed ? "FAILED" : "passed");
+        free(Buffer);
+        return Failed ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    if ((RateCode(RatekHz) == 0) || (DDCCount < 1) || (DDCCount > VNUMDDC) || (Seconds <= 0.0))
+    {
+        printf("sample rate must be 48, 96, 192, 384, 768 or 1536ksps, with 1 to %d DDCs\n", VNUMDDC);
+        return EXIT_FAILURE;
+    }
+    memset(&Header, 0, sizeof(Header));
+    memcpy(Header.Magic, VCAPTUREMAGIC, 8);
+    Header.NumDDC = VNUMDDC;
+    Header.ToneActive = (ToneFrequency != 0) || (GenerateFile != NULL);
+    for (DDC = 0; DDC < DDCCount; DDC++)
+    {
+        Header.RatekHz[DDC] = RatekHz;
+        Header.ToneOffset[DDC] = ToneOffset(DDC, RatekHz);
+    }
+    if (posix_memalign((void**)&Buffer, VALIGNMENT, BufferSize) != 0)
+    {
+        printf("capture buffer allocation failed\n");
+        return EXIT_FAILURE;
+    }
 
+    if (GenerateFile != NULL)
+    {
+        GenerateCapture(&Header, Buffer, BufferSize, Seconds, InjectErrors);
+        SaveFile = GenerateFile;
+        printf("generated %.2fs of %d x %dksps DDC stream%s\n", (double)Header.DurationNs / 1.0e9,
+               DDCCount, RatekHz, InjectErrors ? " with errors" : "");
+    }
+    else
+    {
+        sem_init(&DDCInSelMutex, 0, 1);
+        sem_init(&RFGPIOMutex, 0, 1);
+        sem_init(&DDCResetFIFOMutex, 0, 1);
+        sem_init(&CodecRegMutex, 0, 1);
+        printf("capturing %d x %dksps for %.1fs%s\n", DDCCount, RatekHz, Seconds,
+               Header.ToneActive ? " from the test DDS" : "");
+        if (CaptureDMA(&Header, Buffer, BufferSize, Seconds, ToneFrequency))
+        {
+            free(Buffer);
+            return EXIT_FAILURE;
+        }
+    }
+    if (SaveFile != NULL)
+        SaveCapture(SaveFile, &Header, Buffer);
+    Failed = AnalyseCapture(&Header, Buffer);
+    printf("\nDDC DMA stream %s\n", Failed ? "FAILED" : "passed");
+    free(Buffer);
+    return Failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,644 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// p2crypttest.c:
+//
+// test of the p2app datagram encryption.
+// 1. ChaCha20, Poly1305 and the AEAD are checked against the RFC 8439 test
+//    vectors, and the 4 block ChaCha20 against the one block reference.
+// 2. sealed datagrams are checked: tampering, replay, reordering within the
+//    replay window, and several sender ids.
+// 3. seal and open throughput per core for DDC I/Q sized datagrams.
+// 4. p2app's send and receive paths (securestream.c) talk over loopback to a
+//    reference client: CPU time per datagram, plain against sealed, and
+//    per datagram sendmsg against batched sendmmsg.
+//
+//////////////////////////////////////////////////////////////
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../../sw_projects/common/p2crypt.h"
+#include "../../sw_projects/P2_app/securestream.h"
+
+//------------------------------------------------------------------------------------------
+// VERSION History
+// V1, 18/10/2026:   initial release
+
+
+#define VDEFAULTPACKETS 50000                   // datagrams for throughput and loopback tests
+#define VDATAGRAMSIZE 1444                      // DDC I/Q datagram
+#define VKEYFILE "/tmp/p2crypttest.key"
+
+
+//
+// time from a clock, ns
+//
+static uint64_t ClockNs(clockid_t Clock)
+{
+    struct timespec Now;
+
+    clock_gettime(Clock, &Now);
+    return (uint64_t)Now.tv_sec * 1000000000ULL + (uint64_t)Now.tv_nsec;
+}
+
+
+//
+// small deterministic random number generator
+//
+static uint64_t RandomState = 0x0123456789ABCDEFULL;
+
+static uint32_t Random32(void)
+{
+    RandomState ^= RandomState << 13;
+    RandomState ^= RandomState >> 7;
+    RandomState ^= RandomState << 17;
+    return (uint32_t)(RandomState >> 16);
+}
+
+
+//
+// hex string to bytes (white space ignored)
+//
+static uint32_t FromHex(const char* Hex, uint8_t* Bytes)
+{
+    uint32_t Count = 0;
+    unsigned int Value;
+
+    while (*Hex != 0)
+    {
+        if ((*Hex == ' ') || (*Hex == ':'))
+        {
+            Hex++;
+            continue;
+        }
+        sscanf(Hex, "%2x", &Value);
+        Bytes[Count++] = (uint8_t)Value;
+        Hex += 2;
+    }
+    return Count;
+}
+
+
+//
+// compare with expected; print the result
+// returns true if different
+//
+static bool Check(const char* Name, const uint8_t* Got, const uint8_t* Expected, uint32_t Length)
+{
+    bool Failed = (memcmp(Got, Expected, Length) != 0);
+
+    printf("  %-44s %s\n", Name, Failed ? "FAILED" : "ok");
+    return Failed;
+}
+
+
+static const char* SunscreenText = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip "
+                                   "for the future, sunscreen would be it.";
+
+
+//
+// 1. RFC 8439 test vectors
+//
+static bool RunVectorTest(void)
+{
+    TP2CryptKey Key;
+    uint8_t KeyBytes[32], Nonce[12], Expected[256], Got[256], Text[256], Tag[16], AAD[12];
+    uint32_t Length, Cntr, Offset;
+    bool Failed = false;
+
+    printf("RFC 8439 test vectors:\n");
+
+    //
+    // 2.3.2: block function
+    //
+    for (Cntr = 0; Cntr < 32; Cntr++)
+        KeyBytes[Cntr] = (uint8_t)Cntr;
+    P2CryptSetKey(&Key, KeyBytes);
+    FromHex("000000090000004a00000000", Nonce);
+    FromHex("10f1e7e4d13b5915500fdd1fa32071c4c7d1f4c733c068030422aa9ac3d46c4e"
+            "d2826446079faa0914c2d705d98b02a2b5129cd1de164eb9cbd083e8a2503c4e", Expected);
+    P2CryptChaCha20Block(&Key, 1, Nonce, Got);
+    Failed |= Check("2.3.2 ChaCha20 block", Got, Expected, 64);
+
+    //
+    // 2.4.2: encryption
+    //
+    FromHex("000000000000004a00000000", Nonce);
+    Length = FromHex("6e2e359a2568f98041ba0728dd0d6981e97e7aec1d4360c20a27afccfd9fae0b"
+                     "f91b65c5524733ab8f593dabcd62b3571639d624e65152ab8f530c359f0861d8"
+                     "07ca0dbf500d6a6156a38e088a22b65e52bc514d16ccf806818ce91ab7793736"
+                     "5af90bbf74a35be6b40b8eedf2785e42874d", Expected);
+    P2CryptChaCha20Xor(&Key, 1, Nonce, (const uint8_t*)SunscreenText, Got, Length);
+    Failed |= Check("2.4.2 ChaCha20 encryption", Got, Expected, Length);
+    P2CryptChaCha20XorReference(&Key, 1, Nonce, (const uint8_t*)SunscreenText, Got, Length);
+    Failed |= Check("2.4.2 ChaCha20 encryption (reference)", Got, Expected, Length);
+
+    //
+    // 2.5.2: Poly1305
+    //
+    FromHex("85d6be7857556d337f4452fe42d506a80103808afb0db2fd4abff6af4149f51b", KeyBytes);
+    FromHex("a8061dc1305136c6c22b8baf0c0127a9", Expected);
+    P2CryptPoly1305(KeyBytes, (const uint8_t*)"Cryptographic Forum Research Group", 34, Got);
+    Failed |= Check("2.5.2 Poly1305", Got, Expected, 16);
+
+    //
+    // 2.6.2: Poly1305 key generation
+    //
+    for (Cntr = 0; Cntr < 32; Cntr++)
+        KeyBytes[Cntr] = (uint8_t)(0x80 + Cntr);
+    P2CryptSetKey(&Key, KeyBytes);
+    FromHex("000000000001020304050607", Nonce);
+    FromHex("8ad5a08b905f81cc815040274ab29471a833b637e3fd0da508dbb8e2fdd1a646", Expected);
+    P2CryptChaCha20Block(&Key, 0, Nonce, Got);
+    Failed |= Check("2.6.2 Poly1305 key generation", Got, Expected, 32);
+
+    //
+    // 2.8.2: AEAD
+    //
+    FromHex("070000004041424344454647", Nonce);
+    FromHex("50515253c0c1c2c3c4c5c6c7", AAD);
+    Length = FromHex("d31a8d34648e60db7b86afbc53ef7ec2a4aded51296e08fea9e2b5a736ee62d6"
+                     "3dbea45e8ca9671282fafb69da92728b1a71de0a9e060b2905d6a5b67ecd3b36"
+                     "92ddbd7f2d778b8c9803aee328091b58fab324e4fad675945585808b4831d7bc"
+                     "3ff4def08e4b7a9de576d26586cec64b6116", Expected);
+    memcpy(Text, SunscreenText, Length);
+    P2CryptAEADSeal(&Key, Nonce, AAD, 12, Text, Length, Tag);
+    Failed |= Check("2.8.2 AEAD ciphertext", Text, Expected, Length);
+    FromHex("1ae10b594f09e26a7e902ecbd0600691", Expected);
+    Failed |= Check("2.8.2 AEAD tag", Tag, Expected, 16);
+    if (P2CryptAEADOpen(&Key, Nonce, AAD, 12, Text, Length, Tag) || memcmp(Text, SunscreenText, Length))
+    {
+        printf("  2.8.2 AEAD open                              FAILED\n");
+        Failed = true;
+    }
+    else
+        printf("  2.8.2 AEAD open                              ok\n");
+
+    //
+    // 4 block ChaCha20 against the reference, at every length and start offset in a range
+    //
+    for (Cntr = 0; Cntr < sizeof(Text); Cntr++)
+        Text[Cntr] = (uint8_t)Random32();
+    for (Length = 0; (Length <= sizeof(Text)) && !Failed; Length++)
+        for (Offset = 0; Offset < 3; Offset++)
+        {
+            P2CryptChaCha20Xor(&Key, 7 + Offset, Nonce, Text, Got, Length);
+            P2CryptChaCha20XorReference(&Key, 7 + Offset, Nonce, Text, Expected, Length);
+            if (memcmp(Got, Expected, Length) != 0)
+            {
+                printf("  4 block ChaCha20 differs from reference at length %d\n", Length);
+                Failed = true;
+            }
+        }
+    printf("  %-44s %s\n", "4 block ChaCha20 = reference, 0-256 bytes", Failed ? "FAILED" : "ok");
+    return Failed;
+}
+
+
+//
+// 2. sealed datagrams
+//
+static bool Expect(const char* Name, bool Good)
+{
+    printf("  %-44s %s\n", Name, Good ? "ok" : "FAILED");
+    return !Good;
+}
+
+static bool RunDatagramTest(void)
+{
+    TP2CryptKey ToHost, ToSDR;
+    TP2CryptSender SenderA, SenderB, Wrong, Other;
+    TP2CryptReceiver Receiver;
+    uint8_t PSK[VP2CKEYSIZE];
+    uint8_t Plain[VDATAGRAMSIZE], Out[VDATAGRAMSIZE];
+    uint8_t Sealed[80][VDATAGRAMSIZE + VP2COVERHEAD];
+    uint8_t Copy[VDATAGRAMSIZE + VP2COVERHEAD];
+    int Length[80];
+    struct iovec Iov[2];
+    uint32_t Cntr;
+    uint64_t Counter;
+    bool Good;
+    bool Failed = false;
+
+    printf("sealed datagrams:\n");
+    for (Cntr = 0; Cntr < VP2CKEYSIZE; Cntr++)
+        PSK[Cntr] = (uint8_t)Random32();
+    for (Cntr = 0; Cntr < VDATAGRAMSIZE; Cntr++)
+        Plain[Cntr] = (uint8_t)Random32();
+    P2CryptDeriveKeys(PSK, &ToHost, &ToSDR);
+    P2CryptInitSender(&SenderA, &ToHost, 1025);
+    P2CryptInitSender(&SenderB, &ToHost, 1035);
+    P2CryptInitSender(&Wrong, &ToSDR, 1025);            // key for the other direction
+    P2CryptInitReceiver(&Receiver, &ToHost);
+
+    //
+    // seal 80 datagrams, gathered from 2 buffers
+    //
+    Iov[0].iov_base = Plain;
+    Iov[0].iov_len = 16;
+    Iov[1].iov_base = Plain + 16;
+    Iov[1].iov_len = VDATAGRAMSIZE - 16;
+    for (Cntr = 0; Cntr < 80; Cntr++)
+        Length[Cntr] = P2CryptSeal(&SenderA, Iov, 2, Sealed[Cntr], sizeof(Sealed[Cntr]));
+    Failed |= Expect("sealed length", Length[0] == VDATAGRAMSIZE + VP2COVERHEAD);
+    Failed |= Expect("too large to seal", P2CryptSeal(&SenderA, Iov, 2, Copy, VDATAGRAMSIZE) < 0);
+    Failed |= Expect("ciphertext differs from datagram", memcmp(Sealed[0] + VP2CHEADERSIZE, Plain, 64) != 0);
+
+    memcpy(Copy, Sealed[0], Length[0]);
+    Good = (P2CryptOpen(&Receiver, Copy, Length[0], Out, sizeof(Out)) == VDATAGRAMSIZE) && !memcmp(Out, Plain, VDATAGRAMSIZE);
+    Failed |= Expect("open", Good);
+    memcpy(Copy, Sealed[0], Length[0]);
+    Failed |= Expect("replayed datagram dropped", P2CryptOpen(&Receiver, Copy, Length[0], Out, sizeof(Out)) < 0);
+
+    //
+    // tampering anywhere: header, ciphertext or tag
+    //
+    Good = true;
+    for (Cntr = 0; Cntr < (uint32_t)Length[1]; Cntr += 97)
+    {
+        memcpy(Copy, Sealed[1], Length[1]);
+        Copy[Cntr] ^= 0x10;
+        if (P2CryptOpen(&Receiver, Copy, Length[1], Out, sizeof(Out)) >= 0)
+            Good = false;
+    }
+    memcpy(Copy, Sealed[1], Length[1]);
+    Copy[Length[1] - 1] ^= 1;
+    if (P2CryptOpen(&Receiver, Copy, Length[1], Out, sizeof(Out)) >= 0)
+        Good = false;
+    Failed |= Expect("tampered datagrams dropped", Good);
+    memcpy(Copy, Sealed[1], Length[1]);
+    Failed |= Expect("original opens after tampered copies", P2CryptOpen(&Receiver, Copy, Length[1], Out, sizeof(Out)) > 0);
+    Failed |= Expect("truncated datagram dropped", P2CryptOpen(&Receiver, Copy, VP2COVERHEAD - 1, Out, sizeof(Out)) < 0);
+    memcpy(Copy, Sealed[2], Length[2]);
+    Failed |= Expect("output buffer too small dropped", P2CryptOpen(&Receiver, Copy, Length[2], Out, 100) < 0);
+
+    Length[0] = P2CryptSeal(&Wrong, Iov, 2, Copy, sizeof(Copy));
+    Failed |= Expect("wrong direction key dropped", P2CryptOpen(&Receiver, Copy, Length[0], Out, sizeof(Out)) < 0);
+
+    //
+    // reordering: 70 then 10, 5, 3 (within the window), then 4 (too old), then 70 again
+    //
+    memcpy(Copy, Sealed[70], Length[70]);
+    Good = P2CryptOpen(&Receiver, Copy, Length[70], Out, sizeof(Out)) > 0;
+    memcpy(Copy, Sealed[10], Length[10]);
+    Good &= P2CryptOpen(&Receiver, Copy, Length[10], Out, sizeof(Out)) > 0;
+    memcpy(Copy, Sealed[7], Length[7]);
+    Good &= P2CryptOpen(&Receiver, Copy, Length[7], Out, sizeof(Out)) > 0;
+    Failed |= Expect("reordered within window accepted", Good);
+    memcpy(Copy, Sealed[6], Length[6]);
+    Failed |= Expect("older than window dropped", P2CryptOpen(&Receiver, Copy, Length[6], Out, sizeof(Out)) < 0);
+    memcpy(Copy, Sealed[10], Length[10]);
+    Failed |= Expect("reordered replay dropped", P2CryptOpen(&Receiver, Copy, Length[10], Out, sizeof(Out)) < 0);
+
+    //
+    // second sender id has its own window
+    //
+    Length[0] = P2CryptSeal(&SenderB, Iov, 2, Copy, sizeof(Copy));
+    Failed |= Expect("second sender id accepted", P2CryptOpen(&Receiver, Copy, Length[0], Out, sizeof(Out)) > 0);
+    memcpy(Copy, Sealed[71], Length[71]);
+    Failed |= Expect("first sender id still tracked", P2CryptOpen(&Receiver, Copy, Length[71], Out, sizeof(Out)) > 0);
+
+    //
+    // with every slot active, more sender ids are refused and the first
+    // sender's window is kept; a slot idle long enough goes to a new sender
+    // id, and the old sender's datagrams can't be replayed after that
+    //
+    for (Cntr = 0; Cntr < VP2CREPLAYSLOTS; Cntr++)
+    {
+        P2CryptInitSender(&Other, &ToHost, 2000 + Cntr);
+        Length[0] = P2CryptSeal(&Other, Iov, 2, Copy, sizeof(Copy));
+        P2CryptOpen(&Receiver, Copy, Length[0], Out, sizeof(Out));
+    }
+    Failed |= Expect("new sender ids refused when slots active", Receiver.Stats.NoSlot == VP2CREPLAYSLOTS - 2);
+    memcpy(Copy, Sealed[10], Length[10]);
+    Failed |= Expect("first sender id's window kept", P2CryptOpen(&Receiver, Copy, Length[10], Out, sizeof(Out)) < 0);
+    for (Cntr = 0; Cntr < VP2CREPLAYSLOTS; Cntr++)
+        if (Receiver.Slots[Cntr].SenderId == 1025)
+            Receiver.Slots[Cntr].LastNs -= VP2CSLOTIDLENS;
+    Length[0] = P2CryptSeal(&Other, Iov, 2, Copy, sizeof(Copy));
+    Failed |= Expect("idle slot goes to a new sender id", P2CryptOpen(&Receiver, Copy, Length[0], Out, sizeof(Out)) > 0);
+    Counter = Receiver.Stats.Replayed;
+    memcpy(Copy, Sealed[65], Length[65]);
+    Good = P2CryptOpen(&Receiver, Copy, Length[65], Out, sizeof(Out)) < 0;
+    Failed |= Expect("idle sender's datagrams not replayable", Good && (Receiver.Stats.Replayed == Counter + 1));
+    printf("  receiver: opened %llu, bad tag %llu, replayed %llu, bad length %llu, sender refused %llu\n",
+           (unsigned long long)Receiver.Stats.Opened, (unsigned long long)Receiver.Stats.BadTag,
+           (unsigned long long)Receiver.Stats.Replayed, (unsigned long long)Receiver.Stats.Short,
+           (unsigned long long)Receiver.Stats.NoSlot);
+
+    //
+    // a receiver created after a datagram was captured (as after a restart)
+    // drops it; a sender's counter is kept up with its clock
+    //
+    P2CryptInitReceiver(&Receiver, &ToHost);
+    Receiver.Floor += VP2CSTARTALLOWANCENS + 1000000000ULL;      // as if created 6s later
+    memcpy(Copy, Sealed[73], Length[73]);
+    Failed |= Expect("datagram from before receiver start dropped", P2CryptOpen(&Receiver, Copy, Length[73], Out, sizeof(Out)) < 0);
+    atomic_store(&SenderB.Counter, ClockNs(CLOCK_REALTIME) - 2 * VP2CMAXLAGNS);
+    Length[0] = P2CryptSeal(&SenderB, Iov, 2, Copy, sizeof(Copy));
+    Counter = ((uint64_t)ntohl(*(uint32_t*)(Copy + 4)) << 32) | ntohl(*(uint32_t*)(Copy + 8));
+    Failed |= Expect("lagging sender counter moved to its clock", Counter + VP2CMAXLAGNS > ClockNs(CLOCK_REALTIME));
+    return Failed;
+}
+
+
+//
+// 3. seal and open throughput, one core
+//
+static void RunThroughputTest(uint32_t Packets)
+{
+    TP2CryptKey Key;
+    TP2CryptSender Sender;
+    TP2CryptReceiver Receiver;
+    uint8_t KeyBytes[VP2CKEYSIZE];
+    uint8_t Plain[VDATAGRAMSIZE], Out[VDATAGRAMSIZE];
+    uint8_t Sealed[VDATAGRAMSIZE + VP2COVERHEAD];
+    uint8_t Nonce[12];
+    struct iovec Iov;
+    uint64_t Start, SealNs = 0, OpenNs = 0, RefNs, VecNs;
+    uint32_t Cntr;
+    int Length;
+
+    for (Cntr = 0; Cntr < VP2CKEYSIZE; Cntr++)
+        KeyBytes[Cntr] = (uint8_t)Random32();
+    for (Cntr = 0; Cntr < VDATAGRAMSIZE; Cntr++)
+        Plain[Cntr] = (uint8_t)Random32();
+    memset(Nonce, 0, sizeof(Nonce));
+    P2CryptSetKey(&Key, KeyBytes);
+    P2CryptInitSender(&Sender, &Key, 1035);
+    P2CryptInitReceiver(&Receiver, &Key);
+    Iov.iov_base = Plain;
+    Iov.iov_len = VDATAGRAMSIZE;
+
+    Start = ClockNs(CLOCK_THREAD_CPUTIME_ID);
+    for (Cntr = 0; Cntr < Packets; Cntr++)
+        P2CryptChaCha20XorReference(&Key, 1, Nonce, Plain, Out, VDATAGRAMSIZE);
+    RefNs = ClockNs(CLOCK_THREAD_CPUTIME_ID) - Start;
+    Start = ClockNs(CLOCK_THREAD_CPUTIME_ID);
+    for (Cntr = 0; Cntr < Packets; Cntr++)
+        P2CryptChaCha20Xor(&Key, 1, Nonce, Plain, Out, VDATAGRAMSIZE);
+    VecNs = ClockNs(CLOCK_THREAD_CPUTIME_ID) - Start;
+
+    for (Cntr = 0; Cntr < Packets; Cntr++)
+    {
+        Start = ClockNs(CLOCK_THREAD_CPUTIME_ID);
+        Length = P2CryptSeal(&Sender, &Iov, 1, Sealed, sizeof(Sealed));
+        SealNs += ClockNs(CLOCK_THREAD_CPUTIME_ID) - Start;
+        Start = ClockNs(CLOCK_THREAD_CPUTIME_ID);
+        P2CryptOpen(&Receiver, Sealed, Length, Out, sizeof(Out));
+        OpenNs += ClockNs(CLOCK_THREAD_CPUTIME_ID) - Start;
+    }
+    printf("throughput, %d byte datagrams, one core:\n", VDATAGRAMSIZE);
+    printf("  ChaCha20 reference:  %6.0f ns/datagram  %7.1f MB/s\n", (double)RefNs / Packets,
+           (double)Packets * VDATAGRAMSIZE * 1000.0 / (double)RefNs);
+    printf("  ChaCha20 4 block:    %6.0f ns/datagram  %7.1f MB/s\n", (double)VecNs / Packets,
+           (double)Packets * VDATAGRAMSIZE * 1000.0 / (double)VecNs);
+    printf("  seal:                %6.0f ns/datagram  %7.1f MB/s\n", (double)SealNs / Packets,
+           (double)Packets * VDATAGRAMSIZE * 1000.0 / (double)SealNs);
+    printf("  open:                %6.0f ns/datagram  %7.1f MB/s\n", (double)OpenNs / Packets,
+           (double)Packets * VDATAGRAMSIZE * 1000.0 / (double)OpenNs);
+    printf("  (10 DDCs at 1536 ksps send %.0f datagrams/s: %.1f%% of a core to seal)\n",
+           10.0 * 1536000.0 / 238.0, 100.0 * 10.0 * 1536000.0 / 238.0 * (double)SealNs / Packets / 1.0e9);
+    if (Receiver.Stats.Opened != Packets)
+        printf("  ERROR: only %llu of %d datagrams opened\n", (unsigned long long)Receiver.Stats.Opened, Packets);
+}
+
+
+//
+// 4. loopback: p2app's send path against a reference client
+//
+typedef struct
+{
+    int Socket;
+    bool Sealed;
+    TP2CryptReceiver Receiver;
+    uint32_t Received;
+    uint32_t Good;
+    uint64_t CPUNs;
+} TClient;
+
+static void* ClientThread(void* Arg)
+{
+    TClient* Client = (TClient*)Arg;
+    uint8_t Buffer[2048], Out[2048];
+    uint64_t Start;
+    ssize_t Size;
+
+    Start = ClockNs(CLOCK_THREAD_CPUTIME_ID);
+    while ((Size = recv(Client->Socket, Buffer, sizeof(Buffer), 0)) >= 0)
+    {
+        Client->Received++;
+        if (!Client->Sealed)
+            Client->Good++;
+        else if (P2CryptOpen(&Client->Receiver, Buffer, (uint32_t)Size, Out, sizeof(Out)) == VDATAGRAMSIZE)
+            Client->Good++;
+    }
+    Client->CPUNs = ClockNs(CLOCK_THREAD_CPUTIME_ID) - Start;
+    return NULL;
+}
+
+
+//
+// make a loopback socket with a receive timeout
+//
+static int MakeLoopbackSocket(struct sockaddr_in* Addr)
+{
+    struct timeval Timeout = {0, 200000};
+    int Size = 4 * 1024 * 1024;
+    socklen_t Length = sizeof(struct sockaddr_in);
+    int Socket;
+
+    Socket = socket(AF_INET, SOCK_DGRAM, 0);
+    setsockopt(Socket, SOL_SOCKET, SO_RCVBUF, &Size, sizeof(Size));
+    setsockopt(Socket, SOL_SOCKET, SO_RCVTIMEO, &Timeout, sizeof(Timeout));
+    memset(Addr, 0, sizeof(struct sockaddr_in));
+    Addr->sin_family = AF_INET;
+    Addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(Socket, (struct sockaddr*)Addr, sizeof(struct sockaddr_in));
+    getsockname(Socket, (struct sockaddr*)Addr, &Length);
+    return Socket;
+}
+
+
+//
+// send Packets datagrams from an "SDR" socket to the client, paced in bursts
+// of 8 so the client keeps up on a single core
+//
+static void RunLoopbackMode(const char* Name, uint32_t Packets, bool Batch, TP2CryptKey* ToHost)
+{
+    TClient Client;
+    pthread_t Thread;
+    struct sockaddr_in ClientAddr, SDRAddr;
+    struct msghdr Msg;
+    struct iovec Iov;
+    uint8_t Datagram[VDATAGRAMSIZE];
+    uint64_t Start, SendNs;
+    uint32_t Cntr;
+    int SDRSocket;
+
+    memset(&Client, 0, sizeof(Client));
+    Client.Socket = MakeLoopbackSocket(&ClientAddr);
+    Client.Sealed = SecureStreamsEnabled();
+    P2CryptInitReceiver(&Client.Receiver, ToHost);
+    SDRSocket = MakeLoopbackSocket(&SDRAddr);
+    for (Cntr = 0; Cntr < VDATAGRAMSIZE; Cntr++)
+        Datagram[Cntr] = (uint8_t)Random32();
+    pthread_create(&Thread, NULL, ClientThread, &Client);
+
+    Iov.iov_base = Datagram;
+    Iov.iov_len = VDATAGRAMSIZE;
+    memset(&Msg, 0, sizeof(Msg));
+    Msg.msg_name = &ClientAddr;
+    Msg.msg_namelen = sizeof(ClientAddr);
+    Msg.msg_iov = &Iov;
+    Msg.msg_iovlen = 1;
+    SendNs = 0;
+    for (Cntr = 0; Cntr < Packets; Cntr++)
+    {
+        *(uint32_t*)Datagram = htonl(Cntr);
+        Start = ClockNs(CLOCK_THREAD_CPUTIME_ID);
+        SecureSendMsg(SDRSocket, &Msg, Batch);
+        if ((Cntr % VSSBATCHSIZE) == VSSBATCHSIZE - 1)
+            SecureFlush(SDRSocket);
+        SendNs += ClockNs(CLOCK_THREAD_CPUTIME_ID) - Start;
+        if ((Cntr % VSSBATCHSIZE) == VSSBATCHSIZE - 1)
+            sched_yield();
+    }
+    SecureFlush(SDRSocket);
+    pthread_join(Thread, NULL);
+    printf("  %-26s send %5.2f us  client %5.2f us  per datagram; %d of %d received\n", Name,
+           (double)SendNs / Packets / 1000.0, (double)Client.CPUNs / (Client.Received ? Client.Received : 1) / 1000.0,
+           Client.Good, Packets);
+    SecureSocketClosed(SDRSocket);
+    close(SDRSocket);
+    close(Client.Socket);
+}
+
+
+//
+// the client sends sealed datagrams to p2app's receive path
+// returns true if they are not opened correctly
+//
+static bool RunLoopbackReceive(TP2CryptKey* ToSDR)
+{
+    TP2CryptSender Sender;
+    struct sockaddr_in ClientAddr, SDRAddr;
+    struct msghdr Msg;
+    struct iovec Iov;
+    uint8_t Datagram[60], Sealed[60 + VP2COVERHEAD], In[1500];
+    int ClientSocket, SDRSocket, Length, Good = 0;
+    uint32_t Cntr;
+    ssize_t Size;
+
+    ClientSocket = MakeLoopbackSocket(&ClientAddr);
+    SDRSocket = MakeLoopbackSocket(&SDRAddr);
+    P2CryptInitSender(&Sender, ToSDR, ntohs(ClientAddr.sin_port));
+    memset(Datagram, 0x5A, sizeof(Datagram));
+    Iov.iov_base = Datagram;
+    Iov.iov_len = sizeof(Datagram);
+    for (Cntr = 0; Cntr < 4; Cntr++)
+    {
+        Length = P2CryptSeal(&Sender, &Iov, 1, Sealed, sizeof(Sealed));
+        if (Cntr == 2)
+            Sealed[20] ^= 1;                                // tampered: dropped
+        sendto(ClientSocket, Sealed, Length, 0, (struct sockaddr*)&SDRAddr, sizeof(SDRAddr));
+        if (Cntr == 3)
+            sendto(ClientSocket, Sealed, Length, 0, (struct sockaddr*)&SDRAddr, sizeof(SDRAddr));    // replayed: dropped
+    }
+    for (Cntr = 0; Cntr < 5; Cntr++)
+    {
+        Iov.iov_base = In;
+        Iov.iov_len = sizeof(In);
+        memset(&Msg, 0, sizeof(Msg));
+        Msg.msg_iov = &Iov;
+        Msg.msg_iovlen = 1;
+        Size = SecureRecvMsg(SDRSocket, &Msg);
+        if ((Size == sizeof(Datagram)) && (In[59] == 0x5A))
+            Good++;
+        else if ((Size >= 0) || (errno != EAGAIN))
+            Good = -100;
+    }
+    SecureSocketClosed(SDRSocket);
+    close(SDRSocket);
+    close(ClientSocket);
+    return Expect("p2app receive: 3 opened, tampered and replay dropped", Good == 3);
+}
+
+
+static bool RunLoopbackTest(uint32_t Packets)
+{
+    TP2CryptKey ToHost, ToSDR;
+    uint8_t PSK[VP2CKEYSIZE];
+    FILE* File;
+    uint32_t Cntr;
+    bool Failed;
+
+    printf("loopback, %d byte datagrams, p2app send path to reference client (CPU time):\n", VDATAGRAMSIZE);
+    RunLoopbackMode("plain sendmsg", Packets, false, &ToHost);
+
+    File = fopen(VKEYFILE, "w");
+    for (Cntr = 0; Cntr < VP2CKEYSIZE; Cntr++)
+    {
+        PSK[Cntr] = (uint8_t)Random32();
+        fprintf(File, "%02x%s", PSK[Cntr], (Cntr % 16 == 15) ? "\n" : "");
+    }
+    fclose(File);
+    Failed = LoadSecureKey(VKEYFILE);
+    unlink(VKEYFILE);
+    if (Failed)
+        return Expect("key file read", false);
+    P2CryptDeriveKeys(PSK, &ToHost, &ToSDR);
+    RunLoopbackMode("sealed, sendmsg", Packets, false, &ToHost);
+    RunLoopbackMode("sealed, batched sendmmsg", Packets, true, &ToHost);
+    return RunLoopbackReceive(&ToSDR);
+}
+
+
+int main(int argc, char *argv[])
+{
+    int CmdOption;
+    uint32_t Packets = VDEFAULTPACKETS;
+    bool Failed = false;
+
+    while ((CmdOption = getopt(argc, argv, ":n:h")) != -1)
+    {
+        switch (CmdOption)
+        {
+            case 'n':
+                Packets = atoi(optarg);
+                break;
+            default:
+                printf("usage: ./p2crypttest <optional arguments>\n");
+                printf("-n <datagrams>  datagrams for throughput and loopback tests\n");
+                return EXIT_SUCCESS;
+        }
+    }
+    if (Packets < 100)
+        Packets = 100;
+
+    Failed |= RunVectorTest();
+    Failed |= RunDatagramTest();
+    RunThroughputTest(Packets);
+    Failed |= RunLoopbackTest(Packets);
+
+    printf("\nP2 encryption test %s\n", Failed ? "FAILED" : "passed");
+    return Failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
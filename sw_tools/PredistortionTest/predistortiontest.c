@@ -0,0 +1,435 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// predistortiontest.c:
+//
+// test of the p2app TX predistortion code.
+// 1. the NEON code (on a Pi) is checked bit for bit against the scalar
+//    reference, with random tables and samples including full scale.
+// 2. the result is compared with the ideal AM/AM and AM/PM correction
+//    computed in floating point from the uploaded points.
+// 3. tables are loaded continuously by one thread while another applies
+//    them; every frame must have been processed by exactly one table.
+// 4. the CPU cost per sample is measured.
+//
+//////////////////////////////////////////////////////////////
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "../../sw_projects/common/predistortion.h"
+
+//------------------------------------------------------------------------------------------
+// VERSION History
+// V1, 18/10/2026:   initial release
+
+
+#define VFRAMESAMPLES 240                       // samples in a DUC I/Q packet
+#define VDEFAULTSAMPLES 10000000                // samples for bit accuracy test
+#define VSWAPFRAMES 200000                      // frames applied in swap test
+#define VSWAPGAINS 8                            // distinct tables in swap test
+#define VMAXREFERROR 0.01                       // largest error from ideal, relative to full scale
+
+
+//
+// small deterministic random number generator
+//
+static uint64_t RandomState = 0x0123456789ABCDEFULL;
+
+static uint32_t Random32(void)
+{
+    RandomState ^= RandomState << 13;
+    RandomState ^= RandomState >> 7;
+    RandomState ^= RandomState << 17;
+    return (uint32_t)(RandomState >> 16);
+}
+
+
+//
+// a random 24 bit sample; 1 in 16 is at or near full scale
+//
+static int32_t RandomSample(void)
+{
+    uint32_t R = Random32();
+
+    if ((R & 15) == 0)
+        return (R & 16) ? 8388607 - (int32_t)((R >> 8) & 3) : -8388608 + (int32_t)((R >> 8) & 3);
+    return (int32_t)(Random32() << 8) >> 8;
+}
+
+
+//
+// make a table packet's points from gain and phase functions of amplitude (0 to 1)
+//
+static void MakePoints(uint8_t* Points, double (*Gain)(double), double (*Phase)(double))
+{
+    uint32_t Point;
+    double Amplitude;
+
+    for (Point = 0; Point < VPDPOINTS; Point++)
+    {
+        Amplitude = (double)Point / (VPDPOINTS - 1);
+        *(uint16_t*)(Points + 4 * Point) = htons((uint16_t)lround(Gain(Amplitude) * 16384.0));
+        *(int16_t*)(Points + 4 * Point + 2) = (int16_t)htons((uint16_t)(int16_t)lround(Phase(Amplitude) * 32768.0 / M_PI));
+    }
+}
+
+
+//
+// a typical PA correction: gain rising towards full scale, phase advancing
+//
+static double ExpandingGain(double A)
+{
+    return 1.0 + 0.6 * A * A * A;
+}
+
+static double AdvancingPhase(double A)
+{
+    return 0.5 * A * A;
+}
+
+
+//
+// random correction for the bit accuracy test
+//
+static double RandomGainCoeff[4], RandomPhaseCoeff[4];
+
+static double RandomGain(double A)
+{
+    return RandomGainCoeff[0] + RandomGainCoeff[1] * A + RandomGainCoeff[2] * A * A + RandomGainCoeff[3] * A * A * A;
+}
+
+static double RandomPhase(double A)
+{
+    return RandomPhaseCoeff[0] + RandomPhaseCoeff[1] * A + RandomPhaseCoeff[2] * A * A + RandomPhaseCoeff[3] * A * A * A;
+}
+
+
+//
+// nanoseconds since an arbitrary start
+//
+static uint64_t GetTimeNs(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (uint64_t)Now.tv_sec * 1000000000ULL + (uint64_t)Now.tv_nsec;
+}
+
+
+//
+// 1. NEON (or whatever PDApply uses) against the scalar reference, for several random tables
+// returns true if any sample differs
+//
+static bool RunBitAccuracyTest(TPredistorter* PD, uint32_t NumSamples)
+{
+    uint8_t Points[4 * VPDPOINTS];
+    int32_t I[VFRAMESAMPLES + 3], Q[VFRAMESAMPLES + 3];
+    int32_t RI[VFRAMESAMPLES + 3], RQ[VFRAMESAMPLES + 3];
+    uint32_t Table, Frame, Sample, Length;
+    uint64_t Compared = 0, Differences = 0;
+    TPDTable* Active;
+
+    for (Table = 0; Table < 8; Table++)
+    {
+        RandomGainCoeff[0] = 0.3 + (Random32() % 1000) / 1000.0;
+        RandomGainCoeff[1] = ((int32_t)(Random32() % 1000) - 500) / 2000.0;
+        RandomGainCoeff[2] = ((int32_t)(Random32() % 1000) - 500) / 2000.0;
+        RandomGainCoeff[3] = (Random32() % 1000) / 1500.0;
+        for (Sample = 0; Sample < 4; Sample++)
+            RandomPhaseCoeff[Sample] = ((int32_t)(Random32() % 2000) - 1000) / 1000.0;
+        MakePoints(Points, RandomGain, RandomPhase);
+        if (PDLoadTable(PD, Points, Table))
+        {
+            printf("random table %d rejected\n", Table);
+            return true;
+        }
+        Active = PDAcquireTable(PD);
+        for (Frame = 0; Frame < NumSamples / 8 / VFRAMESAMPLES; Frame++)
+        {
+            Length = VFRAMESAMPLES + (Frame & 3);               // exercise the odd sample tails
+            for (Sample = 0; Sample < Length; Sample++)
+            {
+                I[Sample] = RI[Sample] = RandomSample();
+                Q[Sample] = RQ[Sample] = RandomSample();
+            }
+            PDApply(Active, I, Q, Length);
+            PDApplyReference(Active, RI, RQ, Length);
+            for (Sample = 0; Sample < Length; Sample++)
+                if ((I[Sample] != RI[Sample]) || (Q[Sample] != RQ[Sample]))
+                    Differences++;
+            Compared += Length;
+        }
+    }
+#if defined(__ARM_NEON)
+    printf("bit accuracy, NEON against reference: %llu samples, %llu differ  %s\n",
+           (unsigned long long)Compared, (unsigned long long)Differences, Differences ? "FAIL" : "pass");
+#else
+    printf("bit accuracy: no NEON on this machine, reference compared with itself: %llu samples, %llu differ  %s\n",
+           (unsigned long long)Compared, (unsigned long long)Differences, Differences ? "FAIL" : "pass");
+#endif
+    return Differences != 0;
+}
+
+
+//
+// 2. compare with the ideal correction from the points, across the amplitude range
+// returns true if the error is too large
+//
+static bool RunIdealTest(TPredistorter* PD)
+{
+    uint8_t Points[4 * VPDPOINTS];
+    uint8_t Frame[6 * VFRAMESAMPLES];
+    uint32_t Step, Sample;
+    double Amplitude, Angle, Gain, Phase, IdealI, IdealQ, Error, MaxError = 0.0, SumSq = 0.0;
+    int32_t I, Q;
+    uint64_t Count = 0;
+
+    MakePoints(Points, ExpandingGain, AdvancingPhase);
+    PDLoadTable(PD, Points, 100);
+    for (Step = 0; Step < 1000; Step++)
+    {
+        //
+        // input amplitude up to 1/1.6 of full scale, so the output (gain up to 1.6) does not clip
+        //
+        Amplitude = (Step + 0.5) / 1000.0 / 1.6;
+        for (Sample = 0; Sample < VFRAMESAMPLES; Sample++)
+        {
+            Angle = 2.0 * M_PI * Sample / VFRAMESAMPLES;
+            I = (int32_t)lround(Amplitude * 8388607.0 * cos(Angle));
+            Q = (int32_t)lround(Amplitude * 8388607.0 * sin(Angle));
+            Frame[6 * Sample] = (uint8_t)(I >> 16);
+            Frame[6 * Sample + 1] = (uint8_t)(I >> 8);
+            Frame[6 * Sample + 2] = (uint8_t)I;
+            Frame[6 * Sample + 3] = (uint8_t)(Q >> 16);
+            Frame[6 * Sample + 4] = (uint8_t)(Q >> 8);
+            Frame[6 * Sample + 5] = (uint8_t)Q;
+        }
+        PDApplyP2Samples(PD, Frame, VFRAMESAMPLES);
+        Gain = ExpandingGain(Amplitude);
+        Phase = AdvancingPhase(Amplitude);
+        for (Sample = 0; Sample < VFRAMESAMPLES; Sample++)
+        {
+            Angle = 2.0 * M_PI * Sample / VFRAMESAMPLES;
+            IdealI = Amplitude * Gain * cos(Angle + Phase);
+            IdealQ = Amplitude * Gain * sin(Angle + Phase);
+            I = (int32_t)(((uint32_t)Frame[6 * Sample] << 24) | ((uint32_t)Frame[6 * Sample + 1] << 16) | ((uint32_t)Frame[6 * Sample + 2] << 8)) >> 8;
+            Q = (int32_t)(((uint32_t)Frame[6 * Sample + 3] << 24) | ((uint32_t)Frame[6 * Sample + 4] << 16) | ((uint32_t)Frame[6 * Sample + 5] << 8)) >> 8;
+            Error = hypot(I / 8388607.0 - IdealI, Q / 8388607.0 - IdealQ);
+            SumSq += Error * Error;
+            Count++;
+            if (Error > MaxError)
+                MaxError = Error;
+        }
+    }
+    printf("against ideal AM/AM and AM/PM: rms error %.2e, max error %.2e of full scale (limit %.0e)  %s\n",
+           sqrt(SumSq / Count), MaxError, VMAXREFERROR, (MaxError < VMAXREFERROR) ? "pass" : "FAIL");
+    return MaxError >= VMAXREFERROR;
+}
+
+
+//
+// 3. table swap: a loader thread cycles through tables of constant gain while frames are applied
+//
+typedef struct
+{
+    TPredistorter* PD;
+    volatile bool Stop;
+    uint64_t Loads;
+} TSwapLoader;
+
+static double SwapGainValue;
+
+static double SwapGain(__attribute__((unused)) double A)
+{
+    return SwapGainValue;
+}
+
+static double ZeroPhase(__attribute__((unused)) double A)
+{
+    return 0.0;
+}
+
+static void* SwapLoaderThread(void* arg)
+{
+    TSwapLoader* Loader = (TSwapLoader*)arg;
+    uint8_t Points[VSWAPGAINS][4 * VPDPOINTS];
+    uint32_t Table;
+
+    for (Table = 0; Table < VSWAPGAINS; Table++)
+    {
+        SwapGainValue = 0.5 + 0.125 * Table;
+        MakePoints(Points[Table], SwapGain, ZeroPhase);
+    }
+    while (!Loader->Stop)
+    {
+        Table = Loader->Loads % VSWAPGAINS;
+        PDLoadTable(Loader->PD, Points[Table], Table);
+        Loader->Loads++;
+    }
+    return NULL;
+}
+
+
+//
+// returns true if any frame was processed by a mixture of tables
+//
+static bool RunSwapTest(TPredistorter* PD)
+{
+    TSwapLoader Loader;
+    pthread_t Thread;
+    uint8_t Frame[6 * VFRAMESAMPLES];
+    uint32_t FrameCount, Sample, Table;
+    uint64_t Mixed = 0, Unknown = 0, Changes = 0;
+    int32_t Expected[VSWAPGAINS], First, I;
+    int32_t Input = 4000000;
+    int32_t Last = 0;
+
+    for (Table = 0; Table < VSWAPGAINS; Table++)
+        Expected[Table] = (int32_t)lround(Input * (0.5 + 0.125 * Table));
+    PDDisable(PD);                                          // frames before the 1st load are skipped
+    Loader.PD = PD;
+    Loader.Stop = false;
+    Loader.Loads = 0;
+    pthread_create(&Thread, NULL, SwapLoaderThread, &Loader);
+
+    for (FrameCount = 0; FrameCount < VSWAPFRAMES; FrameCount++)
+    {
+        for (Sample = 0; Sample < VFRAMESAMPLES; Sample++)
+        {
+            Frame[6 * Sample] = (uint8_t)(Input >> 16);
+            Frame[6 * Sample + 1] = (uint8_t)(Input >> 8);
+            Frame[6 * Sample + 2] = (uint8_t)Input;
+            memset(Frame + 6 * Sample + 3, 0, 3);
+        }
+        if (!PDApplyP2Samples(PD, Frame, VFRAMESAMPLES))
+            continue;
+        First = (int32_t)(((uint32_t)Frame[0] << 24) | ((uint32_t)Frame[1] << 16) | ((uint32_t)Frame[2] << 8)) >> 8;
+        for (Sample = 1; Sample < VFRAMESAMPLES; Sample++)
+        {
+            I = (int32_t)(((uint32_t)Frame[6 * Sample] << 24) | ((uint32_t)Frame[6 * Sample + 1] << 16) | ((uint32_t)Frame[6 * Sample + 2] << 8)) >> 8;
+            if (I != First)
+            {
+                Mixed++;
+                break;
+            }
+        }
+        for (Table = 0; Table < VSWAPGAINS; Table++)
+            if (abs(First - Expected[Table]) <= 64)
+                break;
+        if (Table == VSWAPGAINS)
+            Unknown++;
+        if (First != Last)
+            Changes++;
+        Last = First;
+    }
+    Loader.Stop = true;
+    pthread_join(Thread, NULL);
+    printf("table swap: %d frames, %llu tables loaded, %llu table changes seen, %llu mixed frames, %llu unknown  %s\n",
+           VSWAPFRAMES, (unsigned long long)Loader.Loads, (unsigned long long)Changes,
+           (unsigned long long)Mixed, (unsigned long long)Unknown, (Mixed || Unknown) ? "FAIL" : "pass");
+    return (Mixed != 0) || (Unknown != 0);
+}
+
+
+//
+// 4. CPU cost per sample
+//
+static void RunCostTest(TPredistorter* PD, uint32_t NumSamples)
+{
+    uint8_t Points[4 * VPDPOINTS];
+    uint8_t Frame[6 * VFRAMESAMPLES];
+    int32_t I[VFRAMESAMPLES], Q[VFRAMESAMPLES];
+    uint32_t FrameCount, Sample, Frames = NumSamples / VFRAMESAMPLES;
+    uint64_t Start, ApplyNs, ReferenceNs, P2Ns;
+    TPDTable* Active;
+
+    MakePoints(Points, ExpandingGain, AdvancingPhase);
+    PDLoadTable(PD, Points, 200);
+    Active = PDAcquireTable(PD);
+    for (Sample = 0; Sample < VFRAMESAMPLES; Sample++)
+    {
+        I[Sample] = RandomSample() >> 1;
+        Q[Sample] = RandomSample() >> 1;
+        Frame[6 * Sample] = (uint8_t)Random32();
+    }
+
+    Start = GetTimeNs();
+    for (FrameCount = 0; FrameCount < Frames; FrameCount++)
+        PDApply(Active, I, Q, VFRAMESAMPLES);
+    ApplyNs = GetTimeNs() - Start;
+    Start = GetTimeNs();
+    for (FrameCount = 0; FrameCount < Frames; FrameCount++)
+        PDApplyReference(Active, I, Q, VFRAMESAMPLES);
+    ReferenceNs = GetTimeNs() - Start;
+    PD->Stats.Samples = 0;
+    PD->Stats.ProcessingNs = 0;
+    PD->Stats.MaxFrameNs = 0;
+    Start = GetTimeNs();
+    for (FrameCount = 0; FrameCount < Frames; FrameCount++)
+        PDApplyP2Samples(PD, Frame, VFRAMESAMPLES);
+    P2Ns = GetTimeNs() - Start;
+
+    printf("cost per sample: PDApply %.2fns, reference %.2fns, with P2 unpack/pack %.2fns\n",
+           (double)ApplyNs / (Frames * VFRAMESAMPLES), (double)ReferenceNs / (Frames * VFRAMESAMPLES),
+           (double)P2Ns / (Frames * VFRAMESAMPLES));
+    printf("at 192ksps the DUC stream needs %.2f%% of a core\n",
+           (double)P2Ns / (Frames * VFRAMESAMPLES) * 192000.0 / 1.0e7);
+    PDPrintStatistics("test", &PD->Stats);
+}
+
+
+//
+// main program
+//
+int main(int argc, char *argv[])
+{
+    TPredistorter* PD;
+    int CmdOption;
+    uint32_t NumSamples = VDEFAULTSAMPLES;
+    bool Failed = false;
+
+    while ((CmdOption = getopt(argc, argv, ":n:h")) != -1)
+    {
+        switch (CmdOption)
+        {
+            case 'n':
+                NumSamples = atoi(optarg);
+                break;
+            default:
+                printf("usage: ./predistortiontest <optional arguments>\n");
+                printf("-n <samples>  samples for bit accuracy and cost tests\n");
+                return EXIT_SUCCESS;
+        }
+    }
+    if (NumSamples < 8 * VFRAMESAMPLES)
+        NumSamples = 8 * VFRAMESAMPLES;
+
+    PD = malloc(sizeof(TPredistorter));
+    if (PD == NULL)
+        return EXIT_FAILURE;
+    PDInit(PD);
+
+    Failed |= RunBitAccuracyTest(PD, NumSamples);
+    Failed |= RunIdealTest(PD);
+    Failed |= RunSwapTest(PD);
+    RunCostTest(PD, NumSamples);
+
+    printf("\npredistortion test %s\n", Failed ? "FAILED" : "passed");
+    free(PD);
+    return Failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
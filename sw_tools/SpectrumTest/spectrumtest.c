@@ -0,0 +1,318 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// spectrumtest.c:
+//
+// check the p2app panadapter spectrum calculation against recorded I/Q.
+// I/Q samples (from a file, or synthesised) are passed through the same code
+// p2app uses, 1 DDC packet at a time, and each spectrum frame is compared bin
+// by bin with a double precision DFT of the same samples.
+// the file format is raw DDC packet payload: 24 bit I then 24 bit Q, big endian.
+// optionally writes the frames as CSV for plotting.
+//
+//////////////////////////////////////////////////////////////
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+
+#include "../../sw_projects/common/spectrum.h"
+#include "../../sw_projects/common/toneanalysis.h"
+
+//------------------------------------------------------------------------------------------
+// VERSION History
+// V1, 18/10/2026:   initial release
+
+
+#define VIQSAMPLESPERFRAME 238                  // samples per DDC packet
+#define VDDCPACKETSIZE 1444
+#define VDEFAULTFRAMES 8                        // frames checked
+#define VDYNAMICRANGE 100.0                     // bins this far below peak are not compared, dB
+#define VMAXERROR 0.05                          // largest allowed error, dB
+
+
+//
+// double precision DFT power of N samples starting at IQ, windowed as p2app does.
+// Power is in the FFT bin order (DC first)
+//
+static void ReferencePower(double* IQ, uint32_t N, double* Power)
+{
+    double* Window;
+    double Re, Im, Angle, C, S, Sample;
+    uint32_t Bin, Cntr;
+
+    Window = malloc(N * sizeof(double));
+    for (Cntr = 0; Cntr < N; Cntr++)
+    {
+        Angle = 2.0 * M_PI * (double)Cntr / (double)N;
+        Window[Cntr] = 0.35875 - 0.48829 * cos(Angle) + 0.14128 * cos(2.0 * Angle) - 0.01168 * cos(3.0 * Angle);
+    }
+    for (Bin = 0; Bin < N; Bin++)
+    {
+        Re = 0.0;
+        Im = 0.0;
+        for (Cntr = 0; Cntr < N; Cntr++)
+        {
+            Angle = -2.0 * M_PI * (double)(((uint64_t)Bin * Cntr) % N) / (double)N;
+            C = cos(Angle);
+            S = sin(Angle);
+            Sample = Window[Cntr];
+            Re += Sample * (IQ[2 * Cntr] * C - IQ[2 * Cntr + 1] * S);
+            Im += Sample * (IQ[2 * Cntr] * S + IQ[2 * Cntr + 1] * C);
+        }
+        Power[Bin] = Re * Re + Im * Im;
+    }
+    free(Window);
+}
+
+
+//
+// compare one frame with the reference. returns the largest error in dB
+//
+static double CheckFrame(TSpectrum* Spec, double* IQ, uint32_t FrameIndex, double* PeakFreq)
+{
+    double* Power;
+    double* Sum;
+    double WindowSum, Angle, Scale, Reference, Peak, Error, MaxError;
+    uint32_t N = Spec->FFTSize;
+    uint32_t Average, Cntr, Bin, PeakBin;
+    uint64_t Start;
+
+    Power = malloc(N * sizeof(double));
+    Sum = calloc(N, sizeof(double));
+    for (Average = 0; Average < Spec->Averages; Average++)
+    {
+        Start = ((uint64_t)FrameIndex * Spec->Averages + Average) * Spec->SlotLength;
+        ReferencePower(IQ + 2 * Start, N, Power);
+        for (Cntr = 0; Cntr < N; Cntr++)
+            Sum[Cntr] += Power[Cntr];
+    }
+    WindowSum = 0.0;
+    for (Cntr = 0; Cntr < N; Cntr++)
+    {
+        Angle = 2.0 * M_PI * (double)Cntr / (double)N;
+        WindowSum += 0.35875 - 0.48829 * cos(Angle) + 0.14128 * cos(2.0 * Angle) - 0.01168 * cos(3.0 * Angle);
+    }
+    Scale = 1.0 / (WindowSum * WindowSum * (double)Spec->Averages);
+
+    //
+    // find the peak, then compare every bin within the dynamic range
+    //
+    Peak = -1000.0;
+    PeakBin = 0;
+    for (Cntr = 0; Cntr < N; Cntr++)
+    {
+        Reference = 10.0 * log10(Sum[(Cntr + N / 2) % N] * Scale + 1.0e-30);
+        if (Reference > Peak)
+        {
+            Peak = Reference;
+            PeakBin = Cntr;
+        }
+    }
+    MaxError = 0.0;
+    for (Cntr = 0; Cntr < N; Cntr++)
+    {
+        Bin = (Cntr + N / 2) % N;
+        Reference = 10.0 * log10(Sum[Bin] * Scale + 1.0e-30);
+        if (Reference < Peak - VDYNAMICRANGE)
+            continue;
+        Error = fabs((double)Spec->Frame[Cntr] / VSPECDBSCALE - Reference);
+        if (Error > MaxError)
+            MaxError = Error;
+    }
+    *PeakFreq = ((double)PeakBin - (double)(N / 2)) * (double)Spec->SampleRate * 1000.0 / (double)N;
+    free(Power);
+    free(Sum);
+    return MaxError;
+}
+
+
+//
+// write one frame as a CSV line: frame number then bins in dB
+//
+static void WriteFrame(FILE* Fp, TSpectrum* Spec)
+{
+    uint32_t Cntr;
+
+    fprintf(Fp, "%d", Spec->FrameNumber);
+    for (Cntr = 0; Cntr < Spec->FFTSize; Cntr++)
+        fprintf(Fp, ",%.2f", (double)Spec->Frame[Cntr] / VSPECDBSCALE);
+    fprintf(Fp, "\n");
+}
+
+
+//
+// main program
+//
+int main(int argc, char *argv[])
+{
+    int CmdOption;
+    char* InFile = NULL;
+    char* OutFile = NULL;
+    FILE* Fp;
+    FILE* OutFp = NULL;
+    uint32_t FFTSize = 4096;
+    uint32_t Rate = 10;
+    uint32_t Averages = 4;
+    uint32_t SampleRate = 192;                  // ksps
+    uint32_t Frames = VDEFAULTFRAMES;
+    double ToneFreq = 12345.0;
+    uint8_t* Raw;
+    double* IQ;
+    uint32_t SampleCount, Cntr, FrameIndex;
+    uint64_t FileSize;
+    TSpectrum Spec;
+    double Error, MaxError, PeakFreq;
+    double IQBitRate, SpecBitRate;
+    bool Fail = false;
+
+    while ((CmdOption = getopt(argc, argv, ":f:o:n:r:a:s:t:c:h")) != -1)
+    {
+        switch (CmdOption)
+        {
+            case 'f':
+                InFile = optarg;
+                break;
+
+            case 'o':
+                OutFile = optarg;
+                break;
+
+            case 'n':
+                FFTSize = atoi(optarg);
+                break;
+
+            case 'r':
+                Rate = atoi(optarg);
+                break;
+
+            case 'a':
+                Averages = atoi(optarg);
+                break;
+
+            case 's':
+                SampleRate = atoi(optarg);
+                break;
+
+            case 't':
+                ToneFreq = atof(optarg);
+                break;
+
+            case 'c':
+                Frames = atoi(optarg);
+                break;
+
+            default:
+                printf("usage: ./spectrumtest <optional arguments>\n");
+                printf("with no -f option, a tone plus noise is synthesised\n");
+                printf("-f <file>     recorded I/Q: 24 bit I, 24 bit Q big endian (DDC packet payload)\n");
+                printf("-o <file>     write spectrum frames as CSV\n");
+                printf("-n <size>     FFT size (%d-%d, default 4096)\n", VSPECMINFFT, VSPECMAXFFT);
+                printf("-r <rate>     frames per second (default 10)\n");
+                printf("-a <count>    FFTs averaged per frame (default 4)\n");
+                printf("-s <ksps>     DDC sample rate (default 192)\n");
+                printf("-t <Hz>       synthesised tone offset (default 12345)\n");
+                printf("-c <frames>   frames to check (default %d)\n", VDEFAULTFRAMES);
+                return EXIT_SUCCESS;
+        }
+    }
+    if (SpectrumInit(&Spec, FFTSize, Rate, Averages))
+    {
+        printf("invalid spectrum settings\n");
+        return EXIT_FAILURE;
+    }
+
+    //
+    // get I/Q: whole packets only
+    //
+    if (InFile != NULL)
+    {
+        Fp = fopen(InFile, "rb");
+        if (Fp == NULL)
+        {
+            perror("open I/Q file");
+            return EXIT_FAILURE;
+        }
+        fseek(Fp, 0, SEEK_END);
+        FileSize = ftell(Fp);
+        fseek(Fp, 0, SEEK_SET);
+        SampleCount = (uint32_t)(FileSize / 6);
+        SampleCount -= SampleCount % VIQSAMPLESPERFRAME;
+        Raw = malloc((size_t)SampleCount * 6);
+        if (fread(Raw, 6, SampleCount, Fp) != SampleCount)
+        {
+            printf("error reading I/Q file\n");
+            return EXIT_FAILURE;
+        }
+        fclose(Fp);
+    }
+    else
+    {
+        SampleCount = (uint32_t)(((uint64_t)SampleRate * 1000 * (Frames + 1)) / Rate);
+        if (SampleCount < (Frames + 1) * Averages * FFTSize)
+            SampleCount = (Frames + 1) * Averages * FFTSize;
+        SampleCount += VIQSAMPLESPERFRAME - SampleCount % VIQSAMPLESPERFRAME;
+        Raw = malloc((size_t)SampleCount * 6);
+        srand(1);
+        SynthesiseP2Tone(Raw, SampleCount, 0, SampleRate * 1000.0, ToneFreq, 0.5, 0.0001);
+    }
+    IQ = malloc((size_t)SampleCount * 2 * sizeof(double));
+    UnpackP2IQSamples(Raw, SampleCount, IQ);
+    if (OutFile != NULL)
+        OutFp = fopen(OutFile, "w");
+
+    //
+    // run the samples through the spectrum code 1 packet at a time, and check each frame
+    //
+    printf("%d point FFT, %d frames/s, %d averages, %dksps, %d samples\n", FFTSize, Rate, Averages, SampleRate, SampleCount);
+    MaxError = 0.0;
+    FrameIndex = 0;
+    for (Cntr = 0; (Cntr < SampleCount) && (FrameIndex < Frames); Cntr += VIQSAMPLESPERFRAME)
+    {
+        if (!SpectrumAddP2Samples(&Spec, Raw + 6 * Cntr, VIQSAMPLESPERFRAME, SampleRate))
+            continue;
+        Error = CheckFrame(&Spec, IQ, FrameIndex, &PeakFreq);
+        printf("frame %3d: peak at %9.1fHz, max error %.3fdB\n", Spec.FrameNumber, PeakFreq, Error);
+        if (Error > MaxError)
+            MaxError = Error;
+        if (OutFp != NULL)
+            WriteFrame(OutFp, &Spec);
+        FrameIndex++;
+    }
+    if (OutFp != NULL)
+        fclose(OutFp);
+
+    //
+    // network load compared with I/Q
+    //
+    IQBitRate = (double)SampleRate * 1000.0 / VIQSAMPLESPERFRAME * VDDCPACKETSIZE * 8.0;
+    SpecBitRate = (double)Rate * ((double)FFTSize * 2.0 + SpectrumPacketCount(&Spec) * VSPECHEADERSIZE) * 8.0;
+    printf("I/Q output %.2fMbit/s; spectrum output %.3fMbit/s (%.0f times less)\n",
+           IQBitRate / 1.0e6, SpecBitRate / 1.0e6, IQBitRate / SpecBitRate);
+
+    if (FrameIndex == 0)
+    {
+        printf("not enough samples for a frame\n");
+        Fail = true;
+    }
+    else if (MaxError > VMAXERROR)
+        Fail = true;
+    if (InFile == NULL)
+        printf("synthesised tone at %.1fHz\n", ToneFreq);
+    printf("largest error %.3fdB: %s\n", MaxError, Fail ? "FAIL" : "pass");
+    SpectrumFree(&Spec);
+    free(Raw);
+    free(IQ);
+    return Fail ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,345 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// txformattest.c:
+//
+// test of the p2app compact TX I/Q formats.
+// 1. 16 bit and 12 bit packets of values the format can hold must give
+//    exactly the DMA data the 24 bit path gives for the same values.
+// 2. the NEON code (on a Pi) is checked bit for bit against the scalar
+//    reference, and invalid 12 bit exponents must be rejected.
+// 3. a tone is packed and expanded to measure the quantisation SNR.
+// 4. network bandwidth and the CPU cost per sample are reported.
+//
+//////////////////////////////////////////////////////////////
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+
+#include "../../sw_projects/common/txiqformat.h"
+
+//------------------------------------------------------------------------------------------
+// VERSION History
+// V1, 18/10/2026:   initial release
+
+
+#define VDEFAULTFRAMES 40000                    // frames for bit accuracy and cost tests
+#define VSAMPLERATE 192000.0                    // DUC I/Q sample rate
+#define VIPUDPHEADER 28                         // IPv4 + UDP header bytes per packet
+#define VTONEFRAMES 400                         // frames for SNR test
+#define VMIN16SNR 90.0                          // quantisation SNR limits (dB), full scale tone
+#define VMIN12SNR 68.0
+
+
+//
+// small deterministic random number generator
+//
+static uint64_t RandomState = 0x0123456789ABCDEFULL;
+
+static uint32_t Random32(void)
+{
+    RandomState ^= RandomState << 13;
+    RandomState ^= RandomState >> 7;
+    RandomState ^= RandomState << 17;
+    return (uint32_t)(RandomState >> 16);
+}
+
+
+//
+// nanoseconds since an arbitrary start
+//
+static uint64_t GetTimeNs(void)
+{
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (uint64_t)Now.tv_sec * 1000000000ULL + (uint64_t)Now.tv_nsec;
+}
+
+
+//
+// write and read a 24 bit P2 sample
+//
+static void WriteP2Sample(uint8_t* Dest, int32_t I, int32_t Q)
+{
+    Dest[0] = (uint8_t)(I >> 16);
+    Dest[1] = (uint8_t)(I >> 8);
+    Dest[2] = (uint8_t)I;
+    Dest[3] = (uint8_t)(Q >> 16);
+    Dest[4] = (uint8_t)(Q >> 8);
+    Dest[5] = (uint8_t)Q;
+}
+
+static void ReadP2Sample(uint8_t* Src, int32_t* I, int32_t* Q)
+{
+    *I = (int32_t)(((uint32_t)Src[0] << 24) | ((uint32_t)Src[1] << 16) | ((uint32_t)Src[2] << 8)) >> 8;
+    *Q = (int32_t)(((uint32_t)Src[3] << 24) | ((uint32_t)Src[4] << 16) | ((uint32_t)Src[5] << 8)) >> 8;
+}
+
+
+//
+// random 24 bit frame of values a format can hold exactly:
+// 16 bit: low 8 bits zero. 12 bit: per block, a random exponent and 12 bit values
+//
+static void MakeRepresentableFrame(ETXIQFormat Format, uint8_t* Frame)
+{
+    uint32_t Sample;
+    uint32_t Exponent = 0;
+    int32_t I, Q;
+
+    for (Sample = 0; Sample < VTXFSAMPLES; Sample++)
+    {
+        if (Format == eTXFormat16)
+        {
+            I = (int32_t)(int16_t)Random32() * 256;
+            Q = (int32_t)(int16_t)Random32() * 256;
+        }
+        else
+        {
+            if ((Sample % VTXF12BLOCK) == 0)
+                Exponent = Random32() % (VTXF12MAXEXPONENT + 1);
+            I = ((int32_t)(Random32() & 0xFFF) - 2048) * (1 << Exponent);
+            Q = ((int32_t)(Random32() & 0xFFF) - 2048) * (1 << Exponent);
+            if ((Sample % VTXF12BLOCK) == 0)                // full scale sample so packing picks this exponent
+                I = ((Random32() & 1) ? 2047 : -2048) * (1 << Exponent);
+        }
+        WriteP2Sample(Frame + 6 * Sample, I, Q);
+    }
+}
+
+
+//
+// 1 and 2. bit exactness against the 24 bit path, and NEON against reference
+// returns true if any byte differs
+//
+static bool RunBitExactTest(uint32_t Frames)
+{
+    uint8_t P2[VTXFDMASIZE], Packet[VTXFDMASIZE], Expected[VTXFDMASIZE], Result[VTXFDMASIZE];
+    uint8_t ReferenceResult[VTXFDMASIZE], RoundTrip[VTXFDMASIZE];
+    uint32_t Errors[eTXNumFormats] = {0};
+    uint32_t Frame, Byte, Rejected = 0;
+    ETXIQFormat Format;
+    bool Failed = false;
+
+    for (Frame = 0; Frame < Frames; Frame++)
+    {
+        for (Format = eTXFormat24; Format < eTXNumFormats; Format++)
+        {
+            if (Format == eTXFormat24)
+            {
+                for (Byte = 0; Byte < VTXFDMASIZE; Byte++)
+                    P2[Byte] = (uint8_t)Random32();
+                memcpy(Packet, P2, VTXFDMASIZE);
+            }
+            else
+            {
+                MakeRepresentableFrame(Format, P2);
+                if (Format == eTXFormat16)
+                    TXFPack16(P2, Packet, VTXFSAMPLES);
+                else
+                    TXFPack12(P2, Packet, VTXFSAMPLES);
+            }
+            TXFSwizzle24Reference(P2, Expected, VTXFSAMPLES);
+            switch (Format)
+            {
+                case eTXFormat24:
+                    TXFSwizzle24Reference(Packet, ReferenceResult, VTXFSAMPLES);
+                    break;
+                case eTXFormat16:
+                    TXFExpand16Reference(Packet, ReferenceResult, VTXFSAMPLES);
+                    break;
+                default:
+                    TXFExpand12Reference(Packet, ReferenceResult, VTXFSAMPLES);
+                    break;
+            }
+            if (TXFToDMA(Format, Packet, Result) || (memcmp(Result, Expected, VTXFDMASIZE) != 0)
+                || (memcmp(ReferenceResult, Expected, VTXFDMASIZE) != 0))
+                Errors[Format]++;
+            if (TXFToP2(Format, Packet, RoundTrip) || (memcmp(RoundTrip, P2, VTXFDMASIZE) != 0))
+                Errors[Format]++;
+        }
+        //
+        // a 12 bit packet with a bad exponent must be rejected by both versions
+        //
+        MakeRepresentableFrame(eTXFormat12, P2);
+        TXFPack12(P2, Packet, VTXFSAMPLES);
+        Packet[VTXF12BLOCKSIZE * (Random32() % (VTXFSAMPLES / VTXF12BLOCK))] = VTXF12MAXEXPONENT + 1 + (Random32() % 243);
+        if (TXFToDMA(eTXFormat12, Packet, Result) && TXFExpand12Reference(Packet, Result, VTXFSAMPLES))
+            Rejected++;
+    }
+
+    for (Format = eTXFormat24; Format < eTXNumFormats; Format++)
+    {
+        printf("%s: %u frames, %u differ from the 24 bit path\n", TXFName(Format), Frames, Errors[Format]);
+        Failed |= (Errors[Format] != 0);
+    }
+    printf("12 bit invalid exponent: %u of %u frames rejected\n", Rejected, Frames);
+    Failed |= (Rejected != Frames);
+    return Failed;
+}
+
+
+//
+// 3. quantisation SNR of a near full scale tone
+// returns true if below the expected SNR
+//
+static bool RunToneTest(void)
+{
+    uint8_t P2[VTXFDMASIZE], Packet[VTXFDMASIZE], Result[VTXFDMASIZE];
+    uint32_t Frame, Sample;
+    ETXIQFormat Format;
+    double Phase = 0.0, Signal, Noise, SNR;
+    int32_t I, Q, RI, RQ;
+    bool Failed = false;
+    double MinSNR[eTXNumFormats] = {0.0, VMIN16SNR, VMIN12SNR};
+
+    for (Format = eTXFormat16; Format < eTXNumFormats; Format++)
+    {
+        Signal = 0.0;
+        Noise = 0.0;
+        Phase = 0.0;
+        for (Frame = 0; Frame < VTONEFRAMES; Frame++)
+        {
+            for (Sample = 0; Sample < VTXFSAMPLES; Sample++)
+            {
+                I = (int32_t)lrint(0.9 * 8388607.0 * cos(Phase));
+                Q = (int32_t)lrint(0.9 * 8388607.0 * sin(Phase));
+                Phase += 2.0 * M_PI * 1234.5 / VSAMPLERATE;
+                WriteP2Sample(P2 + 6 * Sample, I, Q);
+            }
+            if (Format == eTXFormat16)
+                TXFPack16(P2, Packet, VTXFSAMPLES);
+            else
+                TXFPack12(P2, Packet, VTXFSAMPLES);
+            TXFToP2(Format, Packet, Result);
+            for (Sample = 0; Sample < VTXFSAMPLES; Sample++)
+            {
+                ReadP2Sample(P2 + 6 * Sample, &I, &Q);
+                ReadP2Sample(Result + 6 * Sample, &RI, &RQ);
+                Signal += (double)I * I + (double)Q * Q;
+                Noise += (double)(RI - I) * (RI - I) + (double)(RQ - Q) * (RQ - Q);
+            }
+        }
+        SNR = 10.0 * log10(Signal / Noise);
+        printf("%s: tone at -0.9dBFS, quantisation SNR %.1fdB\n", TXFName(Format), SNR);
+        Failed |= (SNR < MinSNR[Format]);
+    }
+    return Failed;
+}
+
+
+//
+// 4. network bandwidth, and CPU cost to write each format to the DMA buffer
+//
+static void RunCostTest(uint32_t Frames)
+{
+    uint8_t P2[VTXFDMASIZE];
+    uint8_t* Packets;
+    uint8_t Result[VTXFDMASIZE];
+    uint32_t Frame;
+    uint64_t Start, Ns, ReferenceNs;
+    ETXIQFormat Format;
+    double Rate, Rate24 = 0.0;
+
+    printf("\nbandwidth at %.0fksps, including %d byte IP/UDP header:\n", VSAMPLERATE / 1000.0, VIPUDPHEADER);
+    for (Format = eTXFormat24; Format < eTXNumFormats; Format++)
+    {
+        Rate = (TXFPacketSize(Format) + VIPUDPHEADER) * 8.0 * VSAMPLERATE / VTXFSAMPLES / 1.0e6;
+        if (Format == eTXFormat24)
+            Rate24 = Rate;
+        printf("%-22s %4u byte packets, %6.2fMbit/s (%.1f%% saved)\n", TXFName(Format), TXFPacketSize(Format),
+               Rate, 100.0 * (1.0 - Rate / Rate24));
+    }
+
+    //
+    // a buffer of different packets, so the cost includes cache misses a real stream would have
+    //
+    Packets = malloc((size_t)Frames * VTXFDMASIZE);
+    if (Packets == NULL)
+        return;
+    printf("\ncost per sample to write the DMA buffer:\n");
+    for (Format = eTXFormat24; Format < eTXNumFormats; Format++)
+    {
+        for (Frame = 0; Frame < Frames; Frame++)
+        {
+            MakeRepresentableFrame((Format == eTXFormat24) ? eTXFormat16 : Format, P2);
+            if (Format == eTXFormat24)
+                memcpy(Packets + (size_t)Frame * VTXFDMASIZE, P2, VTXFDMASIZE);
+            else if (Format == eTXFormat16)
+                TXFPack16(P2, Packets + (size_t)Frame * VTXFDMASIZE, VTXFSAMPLES);
+            else
+                TXFPack12(P2, Packets + (size_t)Frame * VTXFDMASIZE, VTXFSAMPLES);
+        }
+        Start = GetTimeNs();
+        for (Frame = 0; Frame < Frames; Frame++)
+            TXFToDMA(Format, Packets + (size_t)Frame * VTXFDMASIZE, Result);
+        Ns = GetTimeNs() - Start;
+        Start = GetTimeNs();
+        for (Frame = 0; Frame < Frames; Frame++)
+        {
+            if (Format == eTXFormat24)
+                TXFSwizzle24Reference(Packets + (size_t)Frame * VTXFDMASIZE, Result, VTXFSAMPLES);
+            else if (Format == eTXFormat16)
+                TXFExpand16Reference(Packets + (size_t)Frame * VTXFDMASIZE, Result, VTXFSAMPLES);
+            else
+                TXFExpand12Reference(Packets + (size_t)Frame * VTXFDMASIZE, Result, VTXFSAMPLES);
+        }
+        ReferenceNs = GetTimeNs() - Start;
+        printf("%-22s %.2fns (reference %.2fns); %.3f%% of a core at %.0fksps\n", TXFName(Format),
+               (double)Ns / ((double)Frames * VTXFSAMPLES), (double)ReferenceNs / ((double)Frames * VTXFSAMPLES),
+               (double)Ns / ((double)Frames * VTXFSAMPLES) * VSAMPLERATE / 1.0e7, VSAMPLERATE / 1000.0);
+    }
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    printf("(NEON)\n");
+#else
+    printf("(scalar: no NEON on this processor)\n");
+#endif
+    free(Packets);
+}
+
+
+//
+// main program
+//
+int main(int argc, char *argv[])
+{
+    int CmdOption;
+    uint32_t Frames = VDEFAULTFRAMES;
+    bool Failed = false;
+
+    while ((CmdOption = getopt(argc, argv, ":n:h")) != -1)
+    {
+        switch (CmdOption)
+        {
+            case 'n':
+                Frames = atoi(optarg);
+                break;
+            default:
+                printf("usage: ./txformattest <optional arguments>\n");
+                printf("-n <frames>  frames for bit exactness and cost tests\n");
+                return EXIT_SUCCESS;
+        }
+    }
+    if (Frames < 100)
+        Frames = 100;
+
+    Failed |= RunBitExactTest(Frames);
+    Failed |= RunToneTest();
+    RunCostTest(Frames);
+
+    printf("\nTX I/Q format test %s\n", Failed ? "FAILED" : "passed");
+    return Failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,464 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// virtualrxtest.c:
+//
+// test of the p2app virtual receiver code, against a double precision
+// reference mixer and filter.
+// with no recording:
+// 1. a synthesised wide DDC recording (tones and noise) is processed in
+//    random block sizes; the output must match the reference.
+// 2. passband gain, tone frequency and alias rejection are measured.
+// 3. the CPU cost per source sample is measured.
+// with a recording (-r): the recording is processed as the DDC thread would
+// and compared with the reference; the output can be saved (-O).
+// recordings are raw P2 DDC sample data: 24 bit I then 24 bit Q, big endian,
+// as in the payload of DDC I/Q packets. -w saves the synthesised recording.
+//
+//////////////////////////////////////////////////////////////
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "../../sw_projects/common/virtualrx.h"
+#include "../../sw_projects/common/toneanalysis.h"
+
+//------------------------------------------------------------------------------------------
+// VERSION History
+// V1, 18/10/2026:   initial release
+
+
+#define VFRAMESAMPLES 238                       // samples in a DDC I/Q packet
+#define VSYNTHRATE 768                          // synthesised recording, ksps
+#define VSYNTHSAMPLES 768000                    // 1 second
+#define VSYNTHOFFSET 100000                     // virtual receiver offset for the synthetic tests, Hz
+#define VSYNTHDECIMATION 16                     // to 48ksps
+#define VMAXREFERRORDB (-100.0)                 // largest RMS error from the reference, dBFS
+#define VMAXPASSBANDDB 0.05                     // largest passband gain error
+#define VMINREJECTIONDB 70.0                    // least rejection of a tone that would alias into the passband
+
+
+//
+// small deterministic random number generator
+//
+static uint64_t RandomState = 0x0123456789ABCDEFULL;
+
+static double RandomUniform(void)
+{
+    RandomState ^= RandomState << 13;
+    RandomState ^= RandomState >> 7;
+    RandomState ^= RandomState << 17;
+    return (double)(RandomState >> 11) / 9007199254740992.0;
+}
+
+
+//
+// pack one sample to P2 24 bit format, saturated; full scale = 1.0
+//
+static void PackSample(uint8_t* Dest, double I, double Q)
+{
+    int32_t SI = (int32_t)lrint(I * 8388608.0);
+    int32_t SQ = (int32_t)lrint(Q * 8388608.0);
+
+    SI = (SI > 8388607) ? 8388607 : (SI < -8388608) ? -8388608 : SI;
+    SQ = (SQ > 8388607) ? 8388607 : (SQ < -8388608) ? -8388608 : SQ;
+    Dest[0] = (uint8_t)(SI >> 16);
+    Dest[1] = (uint8_t)(SI >> 8);
+    Dest[2] = (uint8_t)SI;
+    Dest[3] = (uint8_t)(SQ >> 16);
+    Dest[4] = (uint8_t)(SQ >> 8);
+    Dest[5] = (uint8_t)SQ;
+}
+
+
+//
+// synthesise a recording: tones at the given offsets from the DDC centre (Hz) and
+// amplitudes (full scale = 1), plus gaussian noise
+//
+static void SynthesiseRecording(uint8_t* Dest, uint32_t Count, double SampleRate, double* Frequency,
+                                double* Amplitude, uint32_t Tones, double NoiseRMS)
+{
+    uint32_t Sample, Tone;
+    double I, Q, Phase, U1, U2, Radius;
+
+    for (Sample = 0; Sample < Count; Sample++)
+    {
+        I = 0.0;
+        Q = 0.0;
+        for (Tone = 0; Tone < Tones; Tone++)
+        {
+            Phase = 2.0 * M_PI * fmod(Frequency[Tone] * Sample / SampleRate, 1.0);
+            I += Amplitude[Tone] * cos(Phase);
+            Q += Amplitude[Tone] * sin(Phase);
+        }
+        if (NoiseRMS != 0.0)
+        {
+            U1 = RandomUniform() + 1e-300;
+            U2 = RandomUniform();
+            Radius = NoiseRMS * sqrt(-2.0 * log(U1));
+            I += Radius * cos(2.0 * M_PI * U2);
+            Q += Radius * sin(2.0 * M_PI * U2);
+        }
+        PackSample(Dest + 6 * Sample, I, Q);
+    }
+}
+
+
+//
+// run a virtual receiver over a recording in blocks of BlockSize (0 = random sizes)
+// returns the number of output samples in Out (interleaved I, Q; full scale = 1)
+//
+static uint32_t RunReceiver(TVirtualRX* VRX, uint8_t* Src, uint32_t Count, uint32_t SampleRate,
+                            uint32_t BlockSize, double* Out)
+{
+    float I[VVRXBLOCK], Q[VVRXBLOCK];
+    uint8_t Frame[6 * VVRXFRAMESAMPLES];
+    uint32_t Done = 0, Block, Outputs = 0;
+
+    VirtualRXRestart(VRX);
+    while (Done < Count)
+    {
+        Block = (BlockSize != 0) ? BlockSize : 1 + (uint32_t)(RandomUniform() * VVRXBLOCK);
+        if (Block > VVRXBLOCK)
+            Block = VVRXBLOCK;
+        if (Block > Count - Done)
+            Block = Count - Done;
+        VirtualRXConvertP2Samples(Src + 6 * Done, Block, I, Q);
+        VirtualRXProcess(VRX, I, Q, Block, SampleRate);
+        while (VirtualRXGetFrame(VRX, Frame))
+        {
+            UnpackP2IQSamples(Frame, VVRXFRAMESAMPLES, Out + 2 * Outputs);
+            Outputs += VVRXFRAMESAMPLES;
+        }
+        Done += Block;
+    }
+    return Outputs;
+}
+
+
+//
+// double precision reference: exact oscillator, the same FIR coefficients
+// output k is centred on source sample k * Decimation, with zero history before the start
+//
+static void RunReference(TVirtualRX* VRX, uint8_t* Src, uint32_t Count, uint32_t SampleRate,
+                         double* Out, uint32_t Outputs)
+{
+    double* Mixed;
+    double I, Q, Phase;
+    uint32_t Sample, Output, Tap;
+    int64_t Index;
+
+    Mixed = malloc(2 * Count * sizeof(double));
+    UnpackP2IQSamples(Src, Count, Mixed);
+    for (Sample = 0; Sample < Count; Sample++)
+    {
+        Phase = -2.0 * M_PI * fmod((double)VRX->OffsetHz * Sample / (SampleRate * 1000.0), 1.0);
+        I = Mixed[2 * Sample];
+        Q = Mixed[2 * Sample + 1];
+        Mixed[2 * Sample] = I * cos(Phase) - Q * sin(Phase);
+        Mixed[2 * Sample + 1] = I * sin(Phase) + Q * cos(Phase);
+    }
+    for (Output = 0; Output < Outputs; Output++)
+    {
+        I = 0.0;
+        Q = 0.0;
+        for (Tap = 0; Tap < VRX->Taps; Tap++)
+        {
+            Index = (int64_t)Output * VRX->Decimation - (VRX->Taps - 1) + Tap;
+            if ((Index >= 0) && (Index < Count))
+            {
+                I += VRX->Coeff[Tap] * Mixed[2 * Index];
+                Q += VRX->Coeff[Tap] * Mixed[2 * Index + 1];
+            }
+        }
+        Out[2 * Output] = I;
+        Out[2 * Output + 1] = Q;
+    }
+    free(Mixed);
+}
+
+
+//
+// RMS difference between two sets of complex samples, dB relative to full scale
+//
+static double ErrordB(double* A, double* B, uint32_t Count)
+{
+    double Sum = 0.0;
+    uint32_t Sample;
+
+    for (Sample = 0; Sample < 2 * Count; Sample++)
+        Sum += (A[Sample] - B[Sample]) * (A[Sample] - B[Sample]);
+    return 10.0 * log10(Sum / Count + 1e-30);
+}
+
+
+//
+// mean power of complex samples, dB relative to full scale, skipping the filter's start
+//
+static double PowerdB(double* IQ, uint32_t Count, uint32_t Skip)
+{
+    double Sum = 0.0;
+    uint32_t Sample;
+
+    for (Sample = Skip; Sample < Count; Sample++)
+        Sum += IQ[2 * Sample] * IQ[2 * Sample] + IQ[2 * Sample + 1] * IQ[2 * Sample + 1];
+    return 10.0 * log10(Sum / (Count - Skip) + 1e-30);
+}
+
+
+//
+// 1. match to the reference with a busy recording, in random and fixed block sizes
+// returns true if the error is too large
+//
+static bool RunReferenceTest(TVirtualRX* VRX, uint8_t* Recording)
+{
+    double Frequency[] = {VSYNTHOFFSET + 3000.0, VSYNTHOFFSET - 11000.0, VSYNTHOFFSET + 40000.0, -250000.0};
+    double Amplitude[] = {0.3, 0.1, 0.3, 0.2};
+    double *Out, *Reference, Error, Worst = -999.0;
+    uint32_t Outputs, Run, BlockSize[] = {0, VFRAMESAMPLES, 1, VVRXBLOCK};
+
+    SynthesiseRecording(Recording, VSYNTHSAMPLES, VSYNTHRATE * 1000.0, Frequency, Amplitude, 4, 0.01);
+    Out = malloc(2 * (VSYNTHSAMPLES / VSYNTHDECIMATION + VVRXFRAMESAMPLES) * sizeof(double));
+    Reference = malloc(2 * (VSYNTHSAMPLES / VSYNTHDECIMATION + VVRXFRAMESAMPLES) * sizeof(double));
+    for (Run = 0; Run < sizeof(BlockSize) / sizeof(BlockSize[0]); Run++)
+    {
+        Outputs = RunReceiver(VRX, Recording, VSYNTHSAMPLES, VSYNTHRATE, BlockSize[Run], Out);
+        if (Run == 0)
+            RunReference(VRX, Recording, VSYNTHSAMPLES, VSYNTHRATE, Reference, Outputs);
+        Error = ErrordB(Out, Reference, Outputs);
+        if (Error > Worst)
+            Worst = Error;
+    }
+    printf("match to reference: %d output samples, worst RMS error %.1fdBFS (limit %.0f)  %s\n",
+           Outputs, Worst, VMAXREFERRORDB, (Worst <= VMAXREFERRORDB) ? "pass" : "FAIL");
+    free(Out);
+    free(Reference);
+    return Worst > VMAXREFERRORDB;
+}
+
+
+//
+// 2. single tones: passband gain and frequency, and rejection beyond 0.6 Fout
+// returns true if out of limits
+//
+static bool RunResponseTest(TVirtualRX* VRX, uint8_t* Recording)
+{
+    double OutRate = VSYNTHRATE * 1000.0 / VSYNTHDECIMATION;
+    double Relative[] = {0.0, 0.1, -0.25, 0.38, -0.38, 0.62, -0.62, 1.5, -3.7};
+    double *Out, Frequency, Amplitude = 0.5, LeveldB;
+    uint32_t Outputs, Tone, Skip;
+    TToneAnalysis Analysis;
+    bool Failed = false, InBand;
+
+    Out = malloc(2 * (VSYNTHSAMPLES / VSYNTHDECIMATION + VVRXFRAMESAMPLES) * sizeof(double));
+    Skip = 2 * VVRXTAPSPERDECIM;                        // outputs before the FIR is full
+    for (Tone = 0; Tone < sizeof(Relative) / sizeof(Relative[0]); Tone++)
+    {
+        Frequency = VSYNTHOFFSET + Relative[Tone] * OutRate;
+        SynthesiseRecording(Recording, VSYNTHSAMPLES, VSYNTHRATE * 1000.0, &Frequency, &Amplitude, 1, 0.0);
+        Outputs = RunReceiver(VRX, Recording, VSYNTHSAMPLES, VSYNTHRATE, VFRAMESAMPLES, Out);
+        LeveldB = PowerdB(Out, Outputs, Skip) - 20.0 * log10(Amplitude);
+        InBand = fabs(Relative[Tone]) < 0.5;
+        if (InBand)
+        {
+            AnalyseTone(Out + 2 * Skip, Outputs - Skip, OutRate, &Analysis);
+            printf("tone at %+.2f Fout: gain %+.3fdB, output frequency %.1fHz (expected %.1f)", Relative[Tone],
+                   LeveldB, Analysis.Frequency, Relative[Tone] * OutRate);
+            if ((fabs(LeveldB) > VMAXPASSBANDDB) || (fabs(Analysis.Frequency - Relative[Tone] * OutRate) > 1.0))
+            {
+                printf("  FAIL\n");
+                Failed = true;
+            }
+            else
+                printf("  pass\n");
+        }
+        else
+        {
+            printf("tone at %+.2f Fout: rejected by %.1fdB (limit %.0f)", Relative[Tone], -LeveldB, VMINREJECTIONDB);
+            if (-LeveldB < VMINREJECTIONDB)
+            {
+                printf("  FAIL\n");
+                Failed = true;
+            }
+            else
+                printf("  pass\n");
+        }
+    }
+    free(Out);
+    return Failed;
+}
+
+
+//
+// process a recording file and compare with the reference
+// returns true if the file could not be processed
+//
+static bool ProcessRecording(char* Path, uint32_t SampleRate, int32_t OffsetHz, uint32_t Decimation, char* OutPath)
+{
+    TVirtualRX VRX;
+    FILE* Fp;
+    long Size;
+    uint8_t* Recording;
+    uint8_t Frame[6];
+    double *Out, *Reference;
+    uint32_t Count, Outputs, Sample;
+    TToneAnalysis Analysis;
+
+    if (VirtualRXInit(&VRX, 0, OffsetHz, Decimation))
+    {
+        printf("invalid virtual receiver settings\n");
+        return true;
+    }
+    Fp = fopen(Path, "rb");
+    if (Fp == NULL)
+    {
+        perror(Path);
+        return true;
+    }
+    fseek(Fp, 0, SEEK_END);
+    Size = ftell(Fp);
+    fseek(Fp, 0, SEEK_SET);
+    Count = (uint32_t)(Size / 6);
+    Recording = malloc(6 * Count + 6);
+    if ((Recording == NULL) || (fread(Recording, 6, Count, Fp) != Count))
+    {
+        printf("could not read %s\n", Path);
+        fclose(Fp);
+        return true;
+    }
+    fclose(Fp);
+
+    Out = malloc(2 * (Count / Decimation + VVRXFRAMESAMPLES) * sizeof(double));
+    Reference = malloc(2 * (Count / Decimation + VVRXFRAMESAMPLES) * sizeof(double));
+    Outputs = RunReceiver(&VRX, Recording, Count, SampleRate, VFRAMESAMPLES, Out);
+    RunReference(&VRX, Recording, Count, SampleRate, Reference, Outputs);
+    printf("%s: %d samples at %dksps; virtual receiver %+dHz /%d: %d output samples\n",
+           Path, Count, SampleRate, OffsetHz, Decimation, Outputs);
+    printf("RMS error from reference %.1fdBFS (limit %.0f); output level %.1fdBFS\n",
+           ErrordB(Out, Reference, Outputs), VMAXREFERRORDB, PowerdB(Out, Outputs, 0));
+    if (!AnalyseTone(Out, Outputs, SampleRate * 1000.0 / Decimation, &Analysis))
+        printf("strongest tone %.1fHz at %.1fdBFS, SNR %.1fdB\n", Analysis.Frequency, Analysis.AmplitudedBFS, Analysis.SNRdB);
+
+    if (OutPath != NULL)
+    {
+        Fp = fopen(OutPath, "wb");
+        if (Fp == NULL)
+            perror(OutPath);
+        else
+        {
+            for (Sample = 0; Sample < Outputs; Sample++)
+            {
+                PackSample(Frame, Out[2 * Sample], Out[2 * Sample + 1]);
+                fwrite(Frame, 6, 1, Fp);
+            }
+            fclose(Fp);
+            printf("output written to %s\n", OutPath);
+        }
+    }
+    free(Recording);
+    free(Out);
+    free(Reference);
+    VirtualRXFree(&VRX);
+    return false;
+}
+
+
+//
+// main program
+//
+int main(int argc, char *argv[])
+{
+    TVirtualRX VRX;
+    uint8_t* Recording;
+    int CmdOption;
+    char *RecordingPath = NULL, *OutPath = NULL, *WritePath = NULL;
+    uint32_t SampleRate = VSYNTHRATE, Decimation = VSYNTHDECIMATION;
+    int32_t OffsetHz = VSYNTHOFFSET;
+    double Frequency[] = {VSYNTHOFFSET + 3000.0, VSYNTHOFFSET + 40000.0};
+    double Amplitude[] = {0.3, 0.3};
+    bool Failed = false;
+    FILE* Fp;
+
+    while ((CmdOption = getopt(argc, argv, ":r:s:o:D:O:w:h")) != -1)
+    {
+        switch (CmdOption)
+        {
+            case 'r':
+                RecordingPath = optarg;
+                break;
+            case 's':
+                SampleRate = atoi(optarg);
+                break;
+            case 'o':
+                OffsetHz = atoi(optarg);
+                break;
+            case 'D':
+                Decimation = atoi(optarg);
+                break;
+            case 'O':
+                OutPath = optarg;
+                break;
+            case 'w':
+                WritePath = optarg;
+                break;
+            default:
+                printf("usage: ./virtualrxtest <optional arguments>\n");
+                printf("with no arguments, runs the synthetic tests\n");
+                printf("-r <file>     process a recording of raw P2 DDC samples and compare with the reference\n");
+                printf("-s <ksps>     sample rate of the recording (default %d)\n", VSYNTHRATE);
+                printf("-o <Hz>       virtual receiver offset from the DDC centre (default %d)\n", VSYNTHOFFSET);
+                printf("-D <n>        decimation (default %d)\n", VSYNTHDECIMATION);
+                printf("-O <file>     save the virtual receiver output (raw P2 samples)\n");
+                printf("-w <file>     save a synthesised %dksps recording, then exit\n", VSYNTHRATE);
+                return EXIT_SUCCESS;
+        }
+    }
+
+    Recording = malloc(6 * VSYNTHSAMPLES);
+    if (Recording == NULL)
+        return EXIT_FAILURE;
+    if (WritePath != NULL)
+    {
+        SynthesiseRecording(Recording, VSYNTHSAMPLES, VSYNTHRATE * 1000.0, Frequency, Amplitude, 2, 0.001);
+        Fp = fopen(WritePath, "wb");
+        if ((Fp == NULL) || (fwrite(Recording, 6, VSYNTHSAMPLES, Fp) != VSYNTHSAMPLES))
+        {
+            perror(WritePath);
+            return EXIT_FAILURE;
+        }
+        fclose(Fp);
+        printf("synthesised recording written to %s: %dksps, tones at %+.0fHz and %+.0fHz\n",
+               WritePath, VSYNTHRATE, Frequency[0], Frequency[1]);
+        free(Recording);
+        return EXIT_SUCCESS;
+    }
+    if (RecordingPath != NULL)
+    {
+        free(Recording);
+        return ProcessRecording(RecordingPath, SampleRate, OffsetHz, Decimation, OutPath) ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    if (VirtualRXInit(&VRX, 0, VSYNTHOFFSET, VSYNTHDECIMATION))
+        return EXIT_FAILURE;
+    printf("virtual receiver %+dHz in a %dksps DDC, decimation %d, %d taps\n",
+           VSYNTHOFFSET, VSYNTHRATE, VSYNTHDECIMATION, VRX.Taps);
+    Failed |= RunReferenceTest(&VRX, Recording);
+    Failed |= RunResponseTest(&VRX, Recording);
+    VirtualRXPrintBenchmark();
+
+    printf("\nvirtual receiver test %s\n", Failed ? "FAILED" : "passed");
+    VirtualRXFree(&VRX);
+    free(Recording);
+    return Failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
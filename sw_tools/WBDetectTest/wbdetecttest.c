@@ -0,0 +1,728 @@
+/////////////////////////////////////////////////////////////
+//
+// Saturn project: Artix7 FPGA + Raspberry Pi4 Compute Module
+// PCI Express interface from linux on Raspberry pi
+// this application uses C code to emulate HPSDR protocol 2
+//
+// copyright Laurence Barker November 2021
+// licenced under GNU GPL3
+//
+// wbdetecttest.c:
+//
+// test of the p2app wideband signal detector, with synthesised captures.
+// with no recording:
+// 1. the real input FFT is compared with a double precision DFT.
+// 2. the noise floor estimate is compared with the synthesised noise, and
+//    false alarms are counted over noise only captures.
+// 3. tones at known SNR, frequency and on/off times must give one start
+//    and one stop event each, with the right measurements; tones below the
+//    threshold must not be reported.
+// 4. hysteresis: a signal that falls between the start and continue
+//    thresholds must stay present; a short gap must not stop it.
+// 5. wide signals: bandwidth, centre, and a weak tone beside a wide signal.
+// 6. event packets are checked field by field.
+// 7. the CPU budget and update rate limits are checked, and the cost measured.
+// with a recording (-r): the recording is run through the detector and each
+// event printed. Recordings are raw wideband ADC samples, 16 bit big endian
+// as in the payload of wideband packets, in captures of -n samples.
+//
+//////////////////////////////////////////////////////////////
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <arpa/inet.h>
+
+#include "../../sw_projects/common/wbdetect.h"
+
+//------------------------------------------------------------------------------------------
+// VERSION History
+// V1, 18/10/2026:   initial release
+
+
+#define VFFTSIZE 16384
+#define VUPDATES 10                             // updates per second
+#define VAVERAGES 4
+#define VCAPTUREUS (1000000 / (VUPDATES * VAVERAGES))
+#define VSTARTUS 1700000000000000ULL            // time of the first synthesised capture
+#define VNOISERMS 20.0                          // ADC noise, LSB
+#define VMAXTONES 256                           // tones in one synthesised capture
+#define VMAXFFTERROR 1.0e-4                     // largest FFT bin power error, relative to the peak
+#define VMAXNOISEERRORDB 0.5                    // largest noise floor error
+#define VNOISEUPDATES 200
+#define VMAXFALSESTARTS 1                       // in VNOISEUPDATES noise only updates
+#define VMAXFREQERRORBINS 0.25
+#define VMAXSNRERRORDB 1.5                      // of the start event: peak of 2 updates, signal plus noise
+#define VMAXTONEBWBINS 5.0                      // 99% bandwidth of a pure tone (window main lobe)
+#define VMAXBWERROR 0.1                         // fraction of a wide signal's bandwidth
+#define VMAXCENTREERROR 0.01                    // wide signal centre error, fraction of its bandwidth (or 2 bins)
+#define VHYSTSTARTDB 12.0                       // hysteresis test thresholds: far enough apart that a signal
+#define VHYSTDB 6.0                             // between them rarely crosses either with 4 averages
+#define VBUDGETPERCENT 1
+#define VBUDGETCAPTURES 37                      // different noise captures, cycled
+
+
+//
+// small deterministic random number generator
+//
+static uint64_t RandomState = 0x0123456789ABCDEFULL;
+
+static double RandomUniform(void)
+{
+    RandomState ^= RandomState << 13;
+    RandomState ^= RandomState >> 7;
+    RandomState ^= RandomState << 17;
+    return (double)(RandomState >> 11) / 9007199254740992.0;
+}
+
+
+//
+// a synthesised signal: Tones equal tones Spacing Hz apart centred on
+// Frequency (random phases, so a multi-tone signal is noise like), present
+// in updates On to Off-1. SNR is per tone, in a bin at the tone frequency.
+//
+typedef struct
+{
+    double Frequency;
+    double SNRdB;
+    uint32_t Tones;
+    double Spacing;
+    uint32_t On, Off;
+} TTestSignal;
+
+
+//
+// window sums of the detector's Blackman-Harris window
+//
+static double WindowSum, WindowSquares;
+
+static void CalculateWindowSums(uint32_t Size)
+{
+    uint32_t Cntr;
+    double Angle, W;
+
+    WindowSum = 0.0;
+    WindowSquares = 0.0;
+    for (Cntr = 0; Cntr < Size; Cntr++)
+    {
+        Angle = 2.0 * M_PI * (double)Cntr / (double)Size;
+        W = 0.35875 - 0.48829 * cos(Angle) + 0.14128 * cos(2.0 * Angle) - 0.01168 * cos(3.0 * Angle);
+        WindowSum += W;
+        WindowSquares += W * W;
+    }
+}
+
+
+//
+// noise floor per bin in dBFS, for gaussian noise of RMS LSB
+//
+static double NoiseBindBFS(double RMS)
+{
+    return 10.0 * log10(RMS * RMS * WindowSquares / ((32768.0 * WindowSum / 2.0) * (32768.0 * WindowSum / 2.0)));
+}
+
+
+//
+// tone amplitude (LSB) for an SNR per bin over gaussian noise of RMS LSB
+//
+static double ToneAmplitude(double SNRdB, double RMS)
+{
+    return 2.0 * sqrt(pow(10.0, SNRdB / 10.0) * RMS * RMS * WindowSquares) / WindowSum;
+}
+
+
+//
+// synthesise one capture of Count samples for update Update, 16 bit big endian
+//
+static void Synthesise(uint8_t* Dest, uint32_t Count, uint32_t Update, TTestSignal* Signals, uint32_t SignalCount, double NoiseRMS)
+{
+    double Re[VMAXTONES], Im[VMAXTONES], StepRe[VMAXTONES], StepIm[VMAXTONES], Amplitude[VMAXTONES];
+    uint32_t Tones = 0, Signal, Tone, Sample;
+    double Frequency, Phase, Value, U1, U2, Temp;
+    int32_t Quantised;
+
+    for (Signal = 0; Signal < SignalCount; Signal++)
+    {
+        if ((Update < Signals[Signal].On) || (Update >= Signals[Signal].Off))
+            continue;
+        for (Tone = 0; (Tone < Signals[Signal].Tones) && (Tones < VMAXTONES); Tone++)
+        {
+            Frequency = Signals[Signal].Frequency + (Tone - 0.5 * (Signals[Signal].Tones - 1)) * Signals[Signal].Spacing;
+            Phase = 2.0 * M_PI * RandomUniform();
+            Re[Tones] = cos(Phase);
+            Im[Tones] = sin(Phase);
+            StepRe[Tones] = cos(2.0 * M_PI * Frequency / VWBDSAMPLERATE);
+            StepIm[Tones] = sin(2.0 * M_PI * Frequency / VWBDSAMPLERATE);
+            Amplitude[Tones] = ToneAmplitude(Signals[Signal].SNRdB, NoiseRMS);
+            Tones++;
+        }
+    }
+    for (Sample = 0; Sample < Count; Sample++)
+    {
+        Value = 0.0;
+        for (Tone = 0; Tone < Tones; Tone++)
+        {
+            Value += Amplitude[Tone] * Re[Tone];
+            Temp = Re[Tone] * StepRe[Tone] - Im[Tone] * StepIm[Tone];
+            Im[Tone] = Re[Tone] * StepIm[Tone] + Im[Tone] * StepRe[Tone];
+            Re[Tone] = Temp;
+        }
+        if (NoiseRMS != 0.0)
+        {
+            U1 = RandomUniform() + 1e-300;
+            U2 = RandomUniform();
+            Value += NoiseRMS * sqrt(-2.0 * log(U1)) * cos(2.0 * M_PI * U2);
+        }
+        Quantised = (int32_t)lrint(Value);
+        Quantised = (Quantised > 32767) ? 32767 : (Quantised < -32768) ? -32768 : Quantised;
+        Dest[2 * Sample] = (uint8_t)(Quantised >> 8);
+        Dest[2 * Sample + 1] = (uint8_t)Quantised;
+    }
+}
+
+
+//
+// time of the last capture of an update
+//
+static uint64_t UpdateTime(uint32_t Update)
+{
+    return VSTARTUS + ((uint64_t)Update * VAVERAGES + VAVERAGES - 1) * VCAPTUREUS;
+}
+
+
+//
+// run a detector over Updates synthesised updates, collecting events
+// returns the number of events in Events
+//
+static uint32_t RunDetector(TWBDetector* Det, uint32_t Updates, TTestSignal* Signals, uint32_t SignalCount,
+                            TWBDEvent* Events, uint32_t MaxEvents)
+{
+    uint8_t* Capture = malloc(2 * VFFTSIZE);
+    uint32_t Update, Average, Count = 0;
+
+    if (Capture == NULL)
+        return 0;
+    for (Update = 0; Update < Updates; Update++)
+        for (Average = 0; Average < VAVERAGES; Average++)
+        {
+            Synthesise(Capture, VFFTSIZE, Update, Signals, SignalCount, VNOISERMS);
+            if (WBDetectAddCapture(Det, Capture, VFFTSIZE, VSTARTUS + ((uint64_t)Update * VAVERAGES + Average) * VCAPTUREUS))
+                Count += WBDetectTakeEvents(Det, Events + Count, MaxEvents - Count);
+        }
+    free(Capture);
+    return Count;
+}
+
+
+//
+// find the start or stop event for a signal nearest Frequency (within 2 bins)
+//
+static TWBDEvent* FindEvent(TWBDEvent* Events, uint32_t Count, EWBDEventType Type, double Frequency, double BinHz,
+                            uint32_t* Found)
+{
+    uint32_t Index;
+    TWBDEvent* Event = NULL;
+
+    *Found = 0;
+    for (Index = 0; Index < Count; Index++)
+        if ((Events[Index].Type == Type) && (fabs(Events[Index].FrequencyHz - Frequency) < 2.0 * BinHz + 0.5 * Events[Index].BandwidthHz))
+        {
+            (*Found)++;
+            if (Event == NULL)
+                Event = &Events[Index];
+        }
+    return Event;
+}
+
+
+//
+// compare the real input FFT with a double precision DFT of the same windowed capture
+// (with 2 averages, the summed bin powers are held after the first capture)
+//
+static bool RunFFTTest(void)
+{
+    TWBDetector Det;
+    TTestSignal Signals[] =
+    {
+        {1.234e6, 60.0, 1, 0.0, 0, 1},
+        {30.0e6 + 1234.5, 40.0, 1, 0.0, 0, 1},
+        {61.0e6, 50.0, 1, 0.0, 0, 1}
+    };
+    uint8_t* Capture = malloc(2 * VFFTSIZE);
+    double* Samples = malloc(VFFTSIZE * sizeof(double));
+    uint32_t Sample, Test, Bin;
+    double Angle, Re, Im, Power, Peak = 0.0, Error, WorstError = 0.0;
+    bool Bad;
+
+    if ((Capture == NULL) || (Samples == NULL) || WBDetectInit(&Det, VFFTSIZE, 1, 2, 0.0, VWBDDEFAULTHYSTERESIS, 100))
+        return true;
+    Synthesise(Capture, VFFTSIZE, 0, Signals, 3, VNOISERMS);
+    for (Sample = 0; Sample < VFFTSIZE; Sample++)
+    {
+        Angle = 2.0 * M_PI * (double)Sample / (double)VFFTSIZE;
+        Samples[Sample] = (double)(int16_t)((Capture[2 * Sample] << 8) | Capture[2 * Sample + 1])
+                          * (0.35875 - 0.48829 * cos(Angle) + 0.14128 * cos(2.0 * Angle) - 0.01168 * cos(3.0 * Angle));
+    }
+    WBDetectAddCapture(&Det, Capture, VFFTSIZE, VSTARTUS);
+    for (Bin = 0; Bin < Det.HalfSize; Bin++)
+        if (Det.PowerSum[Bin] > Peak)
+            Peak = Det.PowerSum[Bin];
+    //
+    // DFT at the tone bins, the band edges and random bins
+    //
+    for (Test = 0; Test < 70; Test++)
+    {
+        if (Test < 3)
+            Bin = (uint32_t)lrint(Signals[Test].Frequency / Det.BinHz);
+        else if (Test < 5)
+            Bin = (Test == 3) ? 0 : Det.HalfSize - 1;
+        else
+            Bin = (uint32_t)(RandomUniform() * Det.HalfSize);
+        Re = 0.0;
+        Im = 0.0;
+        for (Sample = 0; Sample < VFFTSIZE; Sample++)
+        {
+            Angle = -2.0 * M_PI * fmod((double)Bin * Sample / VFFTSIZE, 1.0);
+            Re += Samples[Sample] * cos(Angle);
+            Im += Samples[Sample] * sin(Angle);
+        }
+        Power = Re * Re + Im * Im;
+        Error = fabs(Det.PowerSum[Bin] - Power) / Peak;
+        if (Error > WorstError)
+            WorstError = Error;
+    }
+    Bad = !(WorstError < VMAXFFTERROR);
+    printf("FFT: largest bin power error from a double precision DFT %.1fdB below the peak (limit %.0fdB)  %s\n",
+           10.0 * log10(WorstError + 1e-30), 10.0 * log10(VMAXFFTERROR), Bad ? "FAIL" : "pass");
+    WBDetectFree(&Det);
+    free(Capture);
+    free(Samples);
+    return Bad;
+}
+
+
+//
+// noise only: check the noise floor and count false alarms
+//
+static bool RunNoiseTest(void)
+{
+    TWBDetector Det;
+    TWBDEvent Events[VWBDMAXEVENTS];
+    uint32_t Count, Index, Starts = 0;
+    double Expected;
+    bool Bad;
+
+    if (WBDetectInit(&Det, VFFTSIZE, VUPDATES, VAVERAGES, 0.0, VWBDDEFAULTHYSTERESIS, 100))
+        return true;
+    Count = RunDetector(&Det, VNOISEUPDATES, NULL, 0, Events, VWBDMAXEVENTS);
+    for (Index = 0; Index < Count; Index++)
+        if (Events[Index].Type == eWBDStart)
+            Starts++;
+    Expected = NoiseBindBFS(VNOISERMS);
+    Bad = (fabs(Det.NoisedBFS - Expected) > VMAXNOISEERRORDB) || (Starts > VMAXFALSESTARTS);
+    printf("noise: floor %.2fdBFS per bin, expected %.2fdBFS; %d false starts in %d updates of %d bins (limit %d)  %s\n",
+           Det.NoisedBFS, Expected, Starts, VNOISEUPDATES, Det.HalfSize, VMAXFALSESTARTS, Bad ? "FAIL" : "pass");
+    WBDetectFree(&Det);
+    return Bad;
+}
+
+
+//
+// tones of known SNR, frequency and timing
+//
+static bool RunToneTest(void)
+{
+    TWBDetector Det;
+    TWBDEvent Events[VWBDMAXEVENTS];
+    TTestSignal Signals[] =
+    {
+        {7.0725e6, 12.0, 1, 0.0, 10, 40},               // bin centres
+        {14.0775e6, 20.0, 1, 0.0, 15, 25},
+        {21.074e6, 40.0, 1, 0.0, 5, 45},                // between bins
+        {50.3175e6, 60.0, 1, 0.0, 20, 30},
+        {28.1e6, 0.0, 1, 0.0, 0, 50}                    // below threshold
+    };
+    uint32_t SignalCount = sizeof(Signals) / sizeof(Signals[0]);
+    TWBDEvent *Start, *Stop;
+    uint32_t Count, Signal, Starts, Stops;
+    double FreqError, SNRError;
+    bool Bad, Failed = false;
+
+    if (WBDetectInit(&Det, VFFTSIZE, VUPDATES, VAVERAGES, 0.0, VWBDDEFAULTHYSTERESIS, 100))
+        return true;
+    Count = RunDetector(&Det, 50, Signals, SignalCount, Events, VWBDMAXEVENTS);
+    printf("tones: start threshold %.1fdB, continue %.1fdB over the noise floor\n",
+           10.0 * log10(Det.StartFactor), 10.0 * log10(Det.ContinueFactor));
+    for (Signal = 0; Signal < SignalCount; Signal++)
+    {
+        Start = FindEvent(Events, Count, eWBDStart, Signals[Signal].Frequency, Det.BinHz, &Starts);
+        Stop = FindEvent(Events, Count, eWBDStop, Signals[Signal].Frequency, Det.BinHz, &Stops);
+        if (Signals[Signal].SNRdB < 10.0 * log10(Det.StartFactor))
+        {
+            Bad = (Starts != 0);
+            printf("  %8.3fMHz %4.0fdB: %d events (below threshold)  %s\n",
+                   Signals[Signal].Frequency / 1e6, Signals[Signal].SNRdB, Starts + Stops, Bad ? "FAIL" : "pass");
+            Failed |= Bad;
+            continue;
+        }
+        if ((Starts != 1) || (Stops != 1) || (Start == NULL) || (Stop == NULL) || (Start->Id != Stop->Id))
+        {
+            printf("  %8.3fMHz %4.0fdB: %d start and %d stop events  FAIL\n",
+                   Signals[Signal].Frequency / 1e6, Signals[Signal].SNRdB, Starts, Stops);
+            Failed = true;
+            continue;
+        }
+        FreqError = fabs(Stop->FrequencyHz - Signals[Signal].Frequency);
+        SNRError = fabs(Start->SNRdB - 10.0 * log10(1.0 + pow(10.0, Signals[Signal].SNRdB / 10.0)));
+        Bad = (FreqError > VMAXFREQERRORBINS * Det.BinHz)
+              || ((fmod(Signals[Signal].Frequency, Det.BinHz) == 0.0) && (SNRError > VMAXSNRERRORDB))
+              || (Stop->BandwidthHz > VMAXTONEBWBINS * Det.BinHz)
+              || (Start->StartUs != UpdateTime(Signals[Signal].On)) || (Stop->StopUs != UpdateTime(Signals[Signal].Off - 1));
+        printf("  %8.3fMHz %4.0fdB: %+.0fHz, SNR %.1fdB at start, bandwidth %.0fHz; on %.3fs to %.3fs (set %.3fs to %.3fs)  %s\n",
+               Signals[Signal].Frequency / 1e6, Signals[Signal].SNRdB, Stop->FrequencyHz - Signals[Signal].Frequency,
+               Start->SNRdB, Stop->BandwidthHz, (Stop->StartUs - VSTARTUS) / 1e6, (Stop->StopUs - VSTARTUS) / 1e6,
+               (UpdateTime(Signals[Signal].On) - VSTARTUS) / 1e6, (UpdateTime(Signals[Signal].Off - 1) - VSTARTUS) / 1e6,
+               Bad ? "FAIL" : "pass");
+        Failed |= Bad;
+    }
+    WBDetectFree(&Det);
+    return Failed;
+}
+
+
+//
+// hysteresis in level (between the thresholds) and in time (short gaps)
+//
+static bool RunHysteresisTest(void)
+{
+    TWBDetector Det;
+    TWBDEvent Events[VWBDMAXEVENTS];
+    TTestSignal Signals[] =
+    {
+        {5.0e6, 0.0, 1, 0.0, 0, 35},                    // between the thresholds throughout: not reported
+        {6.0e6, 0.0, 1, 0.0, 10, 35},                   // between the thresholds after starting strongly
+        {6.0e6, 30.0, 1, 0.0, 10, 12},
+        {8.0e6, 20.0, 1, 0.0, 5, 15},                   // gap shorter than the hold time: one signal
+        {8.0e6, 20.0, 1, 0.0, 17, 30},
+        {9.0e6, 20.0, 1, 0.0, 5, 15},                   // gap longer than the hold time: two signals
+        {9.0e6, 20.0, 1, 0.0, 20, 30}
+    };
+    uint32_t Count, Starts[4], Stops, Index;
+    static const double Frequencies[] = {5.0e6, 6.0e6, 8.0e6, 9.0e6};
+    static const uint32_t Expected[] = {0, 1, 1, 2};
+    double Between;
+    bool Bad = false;
+
+    if (WBDetectInit(&Det, VFFTSIZE, VUPDATES, VAVERAGES, VHYSTSTARTDB, VHYSTDB, 100))
+        return true;
+    //
+    // between the thresholds: the geometric mean of the two, in power over the floor
+    //
+    Between = 10.0 * log10(sqrt(Det.StartFactor * Det.ContinueFactor) - 1.0);
+    Signals[0].SNRdB = Between;
+    Signals[1].SNRdB = Between;
+    Count = RunDetector(&Det, 40, Signals, sizeof(Signals) / sizeof(Signals[0]), Events, VWBDMAXEVENTS);
+    for (Index = 0; Index < 4; Index++)
+    {
+        FindEvent(Events, Count, eWBDStart, Frequencies[Index], Det.BinHz, &Starts[Index]);
+        FindEvent(Events, Count, eWBDStop, Frequencies[Index], Det.BinHz, &Stops);
+        Bad |= (Starts[Index] != Expected[Index]) || (Stops != Expected[Index]);
+    }
+    printf("hysteresis: start %.1fdB, continue %.1fdB: weak signal %d starts (expect 0); weak after strong %d (expect 1);"
+           " short gap %d (expect 1); long gap %d (expect 2)  %s\n",
+           10.0 * log10(Det.StartFactor), 10.0 * log10(Det.ContinueFactor),
+           Starts[0], Starts[1], Starts[2], Starts[3], Bad ? "FAIL" : "pass");
+    WBDetectFree(&Det);
+    return Bad;
+}
+
+
+//
+// wide signals: bandwidth and centre, and a weak tone beside a wide signal
+//
+static bool RunWideTest(void)
+{
+    TWBDetector Det;
+    TWBDEvent Events[VWBDMAXEVENTS];
+    TTestSignal Signals[] =
+    {
+        {3.5e6, 15.0, 67, 3000.0, 0, 25},               // 200kHz
+        {9.7e6, 15.0, 61, 25000.0, 0, 25},              // 1.5MHz: wider than the noise segments
+        {10.6125e6, 15.0, 1, 0.0, 0, 25}                // 150kHz beyond its edge
+    };
+    static const double Widths[] = {201000.0, 1525000.0, 0.0};
+    TWBDEvent *Start, *Stop;
+    uint32_t Count, Signal, Starts;
+    bool Bad, Failed = false;
+
+    if (WBDetectInit(&Det, VFFTSIZE, VUPDATES, VAVERAGES, 0.0, VWBDDEFAULTHYSTERESIS, 100))
+        return true;
+    Count = RunDetector(&Det, 30, Signals, 3, Events, VWBDMAXEVENTS);
+    for (Signal = 0; Signal < 3; Signal++)
+    {
+        Stop = FindEvent(Events, Count, eWBDStop, Signals[Signal].Frequency, Det.BinHz, &Starts);
+        Start = FindEvent(Events, Count, eWBDStart, Signals[Signal].Frequency, Det.BinHz, &Starts);
+        if ((Starts != 1) || (Start == NULL) || (Stop == NULL))
+        {
+            printf("wide: %.3fMHz: %d start events, expected 1  FAIL\n", Signals[Signal].Frequency / 1e6, Starts);
+            Failed = true;
+            continue;
+        }
+        if (Widths[Signal] != 0.0)
+            Bad = (fabs(Stop->BandwidthHz - Widths[Signal]) > VMAXBWERROR * Widths[Signal])
+                  || (fabs(Stop->FrequencyHz - Signals[Signal].Frequency) > fmax(2.0 * Det.BinHz, VMAXCENTREERROR * Widths[Signal]));
+        else
+            Bad = (fabs(Stop->FrequencyHz - Signals[Signal].Frequency) > VMAXFREQERRORBINS * Det.BinHz)
+                  || (fabs(Start->SNRdB - 10.0 * log10(1.0 + pow(10.0, Signals[Signal].SNRdB / 10.0))) > VMAXSNRERRORDB);
+        printf("wide: %.3fMHz, %.0fkHz: centre %+.0fHz, bandwidth %.1fkHz, SNR %.1fdB at start  %s\n",
+               Signals[Signal].Frequency / 1e6, Widths[Signal] / 1000.0, Stop->FrequencyHz - Signals[Signal].Frequency,
+               Stop->BandwidthHz / 1000.0, Start->SNRdB, Bad ? "FAIL" : "pass");
+        Failed |= Bad;
+    }
+    WBDetectFree(&Det);
+    return Failed;
+}
+
+
+//
+// read a 64 bit big endian value
+//
+static uint64_t Get64(uint8_t* Src)
+{
+    return ((uint64_t)ntohl(*(uint32_t*)Src) << 32) | ntohl(*(uint32_t*)(Src + 4));
+}
+
+
+//
+// event packet fields
+//
+static bool RunPacketTest(void)
+{
+    TWBDEvent Events[VWBDEVENTSPERPACKET + 1];
+    uint8_t Packet[VWBDPACKETSIZE];
+    uint8_t* Ptr;
+    uint32_t Index, Length;
+    bool Bad = false;
+
+    for (Index = 0; Index <= VWBDEVENTSPERPACKET; Index++)
+    {
+        Events[Index].Id = 1000 + Index;
+        Events[Index].Type = (Index & 1) ? eWBDStop : eWBDStart;
+        Events[Index].FrequencyHz = 61439999.6 - Index * 1000000.0;
+        Events[Index].BandwidthHz = 2400.4 + Index;
+        Events[Index].SNRdB = (Index == 0) ? 400.0 : 3.214 * Index;
+        Events[Index].StartUs = VSTARTUS + Index;
+        Events[Index].StopUs = (Index & 1) ? VSTARTUS + 1000000ULL * Index : 0;
+    }
+    Length = WBDetectMakePacket(Events, VWBDEVENTSPERPACKET + 1, 0x12345678, 1, VSTARTUS + 99, Packet);
+    Bad |= (Length != VWBDPACKETSIZE) || (ntohl(*(uint32_t*)Packet) != 0x12345678)
+           || (ntohs(*(uint16_t*)(Packet + 4)) != VWBDEVENTSPERPACKET) || (Packet[6] != 1)
+           || (Get64(Packet + 8) != VSTARTUS + 99);
+    Ptr = Packet + VWBDHEADERSIZE;
+    for (Index = 0; Index < VWBDEVENTSPERPACKET; Index++)
+    {
+        Bad |= (ntohl(*(uint32_t*)Ptr) != 1000 + Index) || (Ptr[4] != (uint8_t)Events[Index].Type)
+               || ((int16_t)ntohs(*(uint16_t*)(Ptr + 6)) != ((Index == 0) ? 32767 : (int16_t)lrint(321.4 * Index)))
+               || (ntohl(*(uint32_t*)(Ptr + 8)) != (uint32_t)lrint(Events[Index].FrequencyHz))
+               || (ntohl(*(uint32_t*)(Ptr + 12)) != 2400 + Index)
+               || (Get64(Ptr + 16) != Events[Index].StartUs) || (Get64(Ptr + 24) != Events[Index].StopUs);
+        Ptr += VWBDEVENTSIZE;
+    }
+    printf("packets: %d events in %d bytes; header and event fields  %s\n", VWBDEVENTSPERPACKET, Length, Bad ? "FAIL" : "pass");
+    return Bad;
+}
+
+
+//
+// update rate and CPU budget limits
+// captures are offered at 4 times the rate needed: 3 in 4 must not be transformed.
+// then with a 1% budget, a second of captures must stop being transformed once
+// the time used in it exceeds 10ms
+//
+static bool RunBudgetTest(void)
+{
+    TWBDetector Det;
+    uint8_t* Capture = malloc(2 * VFFTSIZE * VBUDGETCAPTURES);
+    uint32_t Index, Offered = 400;
+    double UsPerCapture, Allowed;
+    bool Bad;
+
+    if ((Capture == NULL) || WBDetectInit(&Det, VFFTSIZE, VUPDATES, VAVERAGES, 0.0, VWBDDEFAULTHYSTERESIS, 100))
+        return true;
+    for (Index = 0; Index < VBUDGETCAPTURES; Index++)
+        Synthesise(Capture + 2 * VFFTSIZE * Index, VFFTSIZE, 0, NULL, 0, VNOISERMS);
+    for (Index = 0; Index < Offered; Index++)
+        WBDetectAddCapture(&Det, Capture + 2 * VFFTSIZE * (Index % VBUDGETCAPTURES), VFFTSIZE,
+                           VSTARTUS + (uint64_t)Index * VCAPTUREUS / 4);
+    Bad = (Det.Stats.Processed != Offered / 4) || (Det.Stats.RateSkipped != Offered - Offered / 4);
+    printf("rate: %d captures offered at %d/s: %llu transformed, %llu not needed (expect %d)  %s\n",
+           Offered, 4 * VUPDATES * VAVERAGES, (unsigned long long)Det.Stats.Processed,
+           (unsigned long long)Det.Stats.RateSkipped, Offered / 4, Bad ? "FAIL" : "pass");
+    UsPerCapture = (double)Det.Stats.ProcessingNs / Det.Stats.Processed / 1000.0;
+    WBDetectFree(&Det);
+
+    //
+    // budget: 50 updates of 16 captures per second, for 2 seconds
+    //
+    if (WBDetectInit(&Det, VFFTSIZE, VWBDMAXUPDATES, VWBDMAXAVERAGES, 0.0, VWBDDEFAULTHYSTERESIS, VBUDGETPERCENT))
+        return true;
+    Offered = 2 * VWBDMAXUPDATES * VWBDMAXAVERAGES;
+    for (Index = 0; Index < Offered; Index++)
+        WBDetectAddCapture(&Det, Capture + 2 * VFFTSIZE * (Index % VBUDGETCAPTURES), VFFTSIZE,
+                           VSTARTUS + (uint64_t)Index * (1000000 / (VWBDMAXUPDATES * VWBDMAXAVERAGES)));
+    Allowed = VBUDGETPERCENT * 10000.0 / UsPerCapture;
+    if (Det.Stats.BudgetSkipped == 0)
+    {
+        printf("budget: %d%% was not exceeded on this processor (%.0fus per capture); skipping not tested  pass\n",
+               VBUDGETPERCENT, UsPerCapture);
+        Bad |= (Det.Stats.Processed != Offered);
+    }
+    else
+    {
+        //
+        // each second may overrun the budget by its last capture; allow for timing noise
+        //
+        Bad |= (Det.Stats.Processed + Det.Stats.BudgetSkipped != Offered) || (Det.Stats.Processed > 2 * (3.0 * Allowed + 2.0));
+        printf("budget %d%%: %d captures offered in 2s at %.0fus each: %llu transformed (about %.0f per second fit), %llu skipped  %s\n",
+               VBUDGETPERCENT, Offered, UsPerCapture, (unsigned long long)Det.Stats.Processed, Allowed,
+               (unsigned long long)Det.Stats.BudgetSkipped, Bad ? "FAIL" : "pass");
+    }
+    WBDetectPrintStatistics("budget", &Det);
+    WBDetectFree(&Det);
+    free(Capture);
+    return Bad;
+}
+
+
+//
+// run a recording through the detector, printing each event
+// returns true if the file could not be processed
+//
+static bool ProcessRecording(char* Path, uint32_t CaptureSamples, uint32_t CapturesPerSecond, uint32_t FFTSize,
+                             uint32_t Updates, uint32_t Averages, double MinSNRdB)
+{
+    TWBDetector Det;
+    TWBDEvent Events[VWBDMAXEVENTS];
+    FILE* Fp;
+    uint8_t* Capture;
+    uint64_t TimeUs;
+    uint32_t Captures = 0, Count, Index;
+    static char* TypeNames[] = {"", "start", "stop", "active"};
+
+    if ((CapturesPerSecond == 0) || WBDetectInit(&Det, FFTSize, Updates, Averages, MinSNRdB, VWBDDEFAULTHYSTERESIS, 100))
+    {
+        printf("invalid detector settings\n");
+        return true;
+    }
+    Fp = fopen(Path, "rb");
+    if (Fp == NULL)
+    {
+        perror(Path);
+        return true;
+    }
+    Capture = malloc(2 * CaptureSamples);
+    if (Capture == NULL)
+    {
+        fclose(Fp);
+        return true;
+    }
+    printf("%s: captures of %d samples at %d/s\n", Path, CaptureSamples, CapturesPerSecond);
+    while (fread(Capture, 2, CaptureSamples, Fp) == CaptureSamples)
+    {
+        TimeUs = VSTARTUS + (uint64_t)Captures * 1000000ULL / CapturesPerSecond;
+        Captures++;
+        if (!WBDetectAddCapture(&Det, Capture, CaptureSamples, TimeUs))
+            continue;
+        Count = WBDetectTakeEvents(&Det, Events, VWBDMAXEVENTS);
+        for (Index = 0; Index < Count; Index++)
+            printf("%8.3fs %-6s %5d: %10.3fkHz, bandwidth %8.1fkHz, SNR %5.1fdB, started %.3fs\n",
+                   (TimeUs - VSTARTUS) / 1e6, TypeNames[Events[Index].Type], Events[Index].Id,
+                   Events[Index].FrequencyHz / 1000.0, Events[Index].BandwidthHz / 1000.0, Events[Index].SNRdB,
+                   (Events[Index].StartUs - VSTARTUS) / 1e6);
+    }
+    fclose(Fp);
+    Count = WBDetectListActive(&Det, Events, VWBDMAXEVENTS);
+    for (Index = 0; Index < Count; Index++)
+        printf("end      active %5d: %10.3fkHz, bandwidth %8.1fkHz, SNR %5.1fdB, started %.3fs\n",
+               Events[Index].Id, Events[Index].FrequencyHz / 1000.0, Events[Index].BandwidthHz / 1000.0,
+               Events[Index].SNRdB, (Events[Index].StartUs - VSTARTUS) / 1e6);
+    WBDetectPrintStatistics("recording", &Det);
+    free(Capture);
+    WBDetectFree(&Det);
+    return false;
+}
+
+
+//
+// main program
+//
+int main(int argc, char *argv[])
+{
+    int CmdOption;
+    char *RecordingPath = NULL;
+    uint32_t CaptureSamples = VFFTSIZE, CapturesPerSecond = VUPDATES * VAVERAGES;
+    uint32_t FFTSize = VFFTSIZE, Updates = VUPDATES, Averages = VAVERAGES;
+    double MinSNRdB = 0.0;
+    bool Failed = false;
+
+    while ((CmdOption = getopt(argc, argv, ":r:n:c:f:u:a:m:h")) != -1)
+    {
+        switch (CmdOption)
+        {
+            case 'r':
+                RecordingPath = optarg;
+                break;
+            case 'n':
+                CaptureSamples = atoi(optarg);
+                break;
+            case 'c':
+                CapturesPerSecond = atoi(optarg);
+                break;
+            case 'f':
+                FFTSize = atoi(optarg);
+                break;
+            case 'u':
+                Updates = atoi(optarg);
+                break;
+            case 'a':
+                Averages = atoi(optarg);
+                break;
+            case 'm':
+                MinSNRdB = atof(optarg);
+                break;
+            default:
+                printf("usage: ./wbdetecttest <optional arguments>\n");
+                printf("with no arguments, runs the synthetic tests\n");
+                printf("-r <file>     run a recording of raw wideband samples (16 bit big endian) and print events\n");
+                printf("-n <samples>  samples per capture in the recording (default %d)\n", VFFTSIZE);
+                printf("-c <rate>     captures per second in the recording (default %d)\n", VUPDATES * VAVERAGES);
+                printf("-f <size>     FFT size, %d to %d (default %d)\n", VWBDMINFFT, VWBDMAXFFT, VFFTSIZE);
+                printf("-u <rate>     updates per second (default %d)\n", VUPDATES);
+                printf("-a <count>    captures averaged per update (default %d)\n", VAVERAGES);
+                printf("-m <dB>       least start threshold over the noise floor (default 0: CFAR only)\n");
+                return EXIT_SUCCESS;
+        }
+    }
+
+    if (RecordingPath != NULL)
+        return ProcessRecording(RecordingPath, CaptureSamples, CapturesPerSecond, FFTSize, Updates, Averages, MinSNRdB)
+               ? EXIT_FAILURE : EXIT_SUCCESS;
+
+    CalculateWindowSums(VFFTSIZE);
+    printf("wideband detector: %d point FFT, %d updates/s of %d captures\n", VFFTSIZE, VUPDATES, VAVERAGES);
+    Failed |= RunFFTTest();
+    Failed |= RunNoiseTest();
+    Failed |= RunToneTest();
+    Failed |= RunHysteresisTest();
+    Failed |= RunWideTest();
+    Failed |= RunPacketTest();
+    Failed |= RunBudgetTest();
+    WBDetectPrintBenchmark();
+
+    printf("\nwideband detector test %s\n", Failed ? "FAILED" : "passed");
+    return Failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}